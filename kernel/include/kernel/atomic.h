@@ -118,6 +118,10 @@ static inline uint64_t atomic_add_u64(volatile uint64_t* ptr, uint64_t val) {
     return __atomic_fetch_add(ptr, val, __ATOMIC_SEQ_CST);
 }
 
+static inline uint64_t atomic_add_u64_relaxed(volatile uint64_t* ptr, uint64_t val) {
+    return __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED);
+}
+
 static inline uint64_t atomic_and_u64(volatile uint64_t* ptr, uint64_t val) {
     return __atomic_fetch_and(ptr, val, __ATOMIC_SEQ_CST);
 }
@@ -25,6 +25,9 @@ struct percpu {
     /* thread/cpu level statistics */
     struct cpu_stats stats;
 
+    /* this cpu's kcounters, see lib/counters.h */
+    uint64_t* counters;
+
     /* per cpu idle thread */
     thread_t idle_thread;
 } __CPU_MAX_ALIGN;
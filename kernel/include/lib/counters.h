@@ -0,0 +1,75 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <kernel/atomic.h>
+#include <kernel/percpu.h>
+#include <magenta/compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Kernel counters (kcounters) are cheap, always-on event counts for hot
+// paths.  Each counter is declared with KCOUNTER() in the file that bumps
+// it, which places its descriptor in the kcounter_desc section; at boot
+// the counters lib gathers the descriptors and gives every cpu an array
+// with one uint64_t per counter.  Bumping a counter is a relaxed atomic add
+// to the current cpu's array, so there is no lock and no shared cache line.
+//
+// The arrays live in a VMO which privileged userspace can map read-only,
+// see mx_kcounters_get_vmo() and <magenta/kcounters.h>.
+
+__BEGIN_CDECLS
+
+typedef struct k_counter_desc k_counter_desc_t;
+
+struct k_counter_desc {
+    const char* name;
+    // Optional name of each element of an array counter, or NULL to use
+    // the element's number.
+    const char* (*element_name)(size_t i);
+    // Number of consecutive counters, for arrays indexed by a small integer.
+    uint32_t count;
+    // Index of the first counter in each cpu's array, assigned at boot.
+    uint32_t index;
+} __ALIGNED(32); // align on multiple of 32 to match linker packing of the kcounter_desc section
+
+// Declares a counter |var| named |name|, e.g. "kernel.context_switches".
+#define KCOUNTER(var, name) KCOUNTER_ARRAY(var, name, 1, NULL)
+
+// Declares |count| counters under the one |name|, bumped with
+// kcounter_add_at().
+#define KCOUNTER_ARRAY(var, name, count, element_name)    \
+    __USED __SECTION("kcounter_desc")                     \
+    static k_counter_desc_t var = { name, element_name, count, 0 }
+
+// Adds |amount| to element |i| of |desc| on the current cpu.  Out of range
+// elements, and counts made before the counters are set up, are dropped.
+//
+// The thread may migrate after reading the cpu's array, in which case the
+// count lands on the cpu it started on; that is why the add is atomic.
+static inline void kcounter_add_at(k_counter_desc_t* desc, size_t i, uint64_t amount) {
+    uint64_t* counters = get_local_percpu()->counters;
+    if (likely(counters != NULL) && likely(i < desc->count))
+        atomic_add_u64_relaxed(&counters[desc->index + i], amount);
+}
+
+#define kcounter_add(var, amount) kcounter_add_at(&(var), 0, (amount))
+
+__END_CDECLS
+
+#ifdef __cplusplus
+
+#include <fbl/ref_ptr.h>
+
+class VmObject;
+
+// Returns the VMO holding the counters, or MX_ERR_UNAVAILABLE if they could
+// not be set up.
+status_t kcounters_get_vmo(fbl::RefPtr<VmObject>* vmo);
+
+#endif // __cplusplus
@@ -18,6 +18,7 @@
 #include <kernel/spinlock.h>
 #include <kernel/stats.h>
 #include <kernel/timer.h>
+#include <lib/counters.h>
 #include <stdlib.h>
 #include <trace.h>
 
@@ -29,6 +30,9 @@ struct mp_state mp __CPU_ALIGN = {
     .ipi_task_lock = SPIN_LOCK_INITIAL_VALUE,
 };
 
+KCOUNTER(generic_ipis_counter, "kernel.ipis.generic");
+KCOUNTER(reschedule_ipis_counter, "kernel.ipis.reschedule");
+
 /* Helpers used for implementing mp_sync */
 struct mp_sync_context;
 static void mp_sync_task(void* context);
@@ -350,6 +354,7 @@ enum handler_return mp_mbx_generic_irq(void) {
     uint local_cpu = arch_curr_cpu_num();
 
     CPU_STATS_INC(generic_ipis);
+    kcounter_add(generic_ipis_counter, 1);
 
     while (1) {
         struct mp_ipi_task* task;
@@ -371,6 +376,7 @@ enum handler_return mp_mbx_reschedule_irq(void) {
     LTRACEF("cpu %u\n", cpu);
 
     CPU_STATS_INC(reschedule_ipis);
+    kcounter_add(reschedule_ipis_counter, 1);
 
     return (mp.active_cpus & (1U << cpu)) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
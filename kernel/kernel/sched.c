@@ -14,6 +14,7 @@
 #include <kernel/percpu.h>
 #include <kernel/thread.h>
 #include <kernel/vm.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 #include <list.h>
 #include <magenta/types.h>
@@ -46,6 +47,8 @@
             printf("CS " str, ##x);      \
     } while (0)
 
+KCOUNTER(context_switches_counter, "kernel.context_switches");
+
 /* threads get 10ms to run before they use up their time slice and the scheduler is invoked */
 #define THREAD_INITIAL_TIME_SLICE LK_MSEC(10)
 
@@ -445,6 +448,7 @@ void sched_resched_internal(void) {
     }
 
     CPU_STATS_INC(context_switches);
+    kcounter_add(context_switches_counter, 1);
 
     if (thread_is_idle(oldthread)) {
         percpu[cpu].stats.idle_time += now - oldthread->last_started_running;
@@ -0,0 +1,161 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/counters.h>
+
+#include <arch/defines.h>
+#include <debug.h>
+#include <err.h>
+#include <inttypes.h>
+#include <lib/console.h>
+#include <lk/init.h>
+#include <magenta/kcounters.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vm/pmm.h>
+#include <vm/vm_object_physical.h>
+
+extern k_counter_desc_t __start_kcounter_desc[] __WEAK;
+extern k_counter_desc_t __stop_kcounter_desc[] __WEAK;
+
+// The VMO holding the header, names and per-cpu arrays, and the kernel's
+// view of it.  Both are set once at boot and never change.
+static fbl::RefPtr<VmObject> arena_vmo;
+static const mx_kcounters_header_t* arena_header;
+
+static const uint64_t* kcounters_cpu_array(uint cpu) {
+    const uint8_t* arena = reinterpret_cast<const uint8_t*>(arena_header);
+    return reinterpret_cast<const uint64_t*>(arena + arena_header->counters_offset) +
+           cpu * arena_header->cpu_stride;
+}
+
+static void kcounters_name(const k_counter_desc_t* desc, size_t i, char* name, size_t len) {
+    if (desc->count == 1) {
+        strlcpy(name, desc->name, len);
+        return;
+    }
+    const char* element = desc->element_name ? desc->element_name(i) : nullptr;
+    if (element) {
+        snprintf(name, len, "%s.%s", desc->name, element);
+    } else {
+        snprintf(name, len, "%s.%zu", desc->name, i);
+    }
+}
+
+// Runs on the boot cpu right after the VM is up, before the secondary cpus
+// are started, so the arrays can be handed out without any ordering
+// concerns.  The number of cpus is not known yet, so every possible cpu
+// gets an array.
+static void kcounters_init(uint level) {
+    size_t num_counters = 0;
+    for (k_counter_desc_t* desc = __start_kcounter_desc; desc != __stop_kcounter_desc; desc++) {
+        desc->index = static_cast<uint32_t>(num_counters);
+        num_counters += desc->count;
+    }
+    if (num_counters == 0)
+        return;
+
+    // Each cpu's array takes whole cache lines, so cpus never share one.
+    const size_t cpu_stride = ROUNDUP(num_counters, CACHE_LINE / sizeof(uint64_t));
+    const size_t desc_offset = sizeof(mx_kcounters_header_t);
+    const size_t counters_offset =
+        ROUNDUP(desc_offset + num_counters * sizeof(mx_kcounter_desc_t), PAGE_SIZE);
+    const size_t size =
+        ROUNDUP(counters_offset + SMP_MAX_CPUS * cpu_stride * sizeof(uint64_t), PAGE_SIZE);
+
+    // The counters are written from every context, including ones which
+    // cannot fault, so the arena lives in wired pages out of the kernel's
+    // physmap rather than in a paged VMO that userspace could decommit.
+    paddr_t pa;
+    void* ptr = pmm_alloc_kpages(size / PAGE_SIZE, nullptr, &pa);
+    if (!ptr) {
+        dprintf(INFO, "kcounters: cannot allocate %zu bytes\n", size);
+        return;
+    }
+    memset(ptr, 0, size);
+
+    fbl::RefPtr<VmObject> vmo;
+    status_t status = VmObjectPhysical::Create(pa, size, &vmo);
+    if (status != MX_OK) {
+        dprintf(INFO, "kcounters: cannot create vmo %d\n", status);
+        pmm_free_kpages(ptr, size / PAGE_SIZE);
+        return;
+    }
+    // Physical VMOs default to uncached mappings; readers must see the
+    // counters with the same memory type as the physmap the kernel writes
+    // them through.
+    status = vmo->SetMappingCachePolicy(ARCH_MMU_FLAG_CACHED);
+    if (status != MX_OK) {
+        dprintf(INFO, "kcounters: cannot set cache policy %d\n", status);
+        vmo.reset();
+        pmm_free_kpages(ptr, size / PAGE_SIZE);
+        return;
+    }
+
+    uint8_t* arena = static_cast<uint8_t*>(ptr);
+    mx_kcounters_header_t* header = reinterpret_cast<mx_kcounters_header_t*>(arena);
+    header->magic = MX_KCOUNTERS_MAGIC;
+    header->num_counters = static_cast<uint32_t>(num_counters);
+    header->num_cpus = SMP_MAX_CPUS;
+    header->cpu_stride = static_cast<uint32_t>(cpu_stride);
+    header->desc_offset = static_cast<uint32_t>(desc_offset);
+    header->counters_offset = static_cast<uint32_t>(counters_offset);
+
+    mx_kcounter_desc_t* names = reinterpret_cast<mx_kcounter_desc_t*>(arena + desc_offset);
+    for (const k_counter_desc_t* desc = __start_kcounter_desc; desc != __stop_kcounter_desc;
+         desc++) {
+        for (size_t i = 0; i < desc->count; i++) {
+            mx_kcounter_desc_t* name = &names[desc->index + i];
+            kcounters_name(desc, i, name->name, sizeof(name->name));
+        }
+    }
+
+    uint64_t* counters = reinterpret_cast<uint64_t*>(arena + counters_offset);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+        percpu[cpu].counters = counters + cpu * cpu_stride;
+
+    arena_vmo = fbl::move(vmo);
+    arena_header = header;
+
+    dprintf(INFO, "kcounters: %zu counters in %zu bytes\n", num_counters, size);
+}
+
+LK_INIT_HOOK(kcounters, kcounters_init, LK_INIT_LEVEL_VM + 1);
+
+status_t kcounters_get_vmo(fbl::RefPtr<VmObject>* vmo) {
+    if (!arena_vmo)
+        return MX_ERR_UNAVAILABLE;
+    *vmo = arena_vmo;
+    return MX_OK;
+}
+
+static int cmd_kcounters(int argc, const cmd_args* argv, uint32_t flags) {
+    if (!arena_header) {
+        printf("kcounters unavailable\n");
+        return -1;
+    }
+
+    // With an argument, only print the counters whose names start with it.
+    const char* prefix = argc > 1 ? argv[1].str : "";
+    const size_t prefix_len = strlen(prefix);
+    const mx_kcounter_desc_t* names = reinterpret_cast<const mx_kcounter_desc_t*>(
+        reinterpret_cast<const uint8_t*>(arena_header) + arena_header->desc_offset);
+    for (uint32_t i = 0; i < arena_header->num_counters; i++) {
+        if (strncmp(names[i].name, prefix, prefix_len) != 0)
+            continue;
+        uint64_t total = 0;
+        for (uint cpu = 0; cpu < arena_header->num_cpus; cpu++)
+            total += kcounters_cpu_array(cpu)[i];
+        if (total != 0 || prefix_len != 0)
+            printf("%-40s %20" PRIu64 "\n", names[i].name, total);
+    }
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("kcounters", "print kernel counters", &cmd_kcounters)
+STATIC_COMMAND_END(kcounters);
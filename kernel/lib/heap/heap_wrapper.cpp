@@ -20,6 +20,7 @@
 #include <vm/pmm.h>
 #include <lib/cmpctmalloc.h>
 #include <lib/console.h>
+#include <lib/counters.h>
 
 #define LOCAL_TRACE 0
 
@@ -31,6 +32,10 @@
 #endif
 #endif
 
+KCOUNTER(heap_allocs, "kernel.heap.allocs");
+KCOUNTER(heap_alloc_bytes, "kernel.heap.alloc_bytes");
+KCOUNTER(heap_frees, "kernel.heap.frees");
+
 /* heap tracing */
 #if LK_DEBUGLEVEL > 1
 static bool heap_trace = false;
@@ -54,6 +59,9 @@ void *malloc(size_t size)
 
     LTRACEF("size %zu\n", size);
 
+    kcounter_add(heap_allocs, 1);
+    kcounter_add(heap_alloc_bytes, size);
+
     void *ptr = cmpct_alloc(size);
     if (unlikely(heap_trace))
         printf("caller %p malloc %zu -> %p\n", __GET_CALLER(), size, ptr);
@@ -71,6 +79,9 @@ void *memalign(size_t boundary, size_t size)
 
     LTRACEF("boundary %zu, size %zu\n", boundary, size);
 
+    kcounter_add(heap_allocs, 1);
+    kcounter_add(heap_alloc_bytes, size);
+
     void *ptr = cmpct_memalign(size, boundary);
     if (unlikely(heap_trace))
         printf("caller %p memalign %zu, %zu -> %p\n", __GET_CALLER(), boundary, size, ptr);
@@ -90,6 +101,9 @@ void *calloc(size_t count, size_t size)
 
     size_t realsize = count * size;
 
+    kcounter_add(heap_allocs, 1);
+    kcounter_add(heap_alloc_bytes, realsize);
+
     void *ptr = cmpct_alloc(realsize);
     if (likely(ptr))
         memset(ptr, 0, realsize);
@@ -123,6 +137,9 @@ void free(void *ptr)
     if (unlikely(heap_trace))
         printf("caller %p free %p\n", __GET_CALLER(), ptr);
 
+    if (ptr)
+        kcounter_add(heap_frees, 1);
+
     cmpct_free(ptr);
 }
 
@@ -11,6 +11,7 @@
 
 #include <arch/ops.h>
 #include <arch/user_copy.h>
+#include <kernel/spinlock.h>
 #include <kernel/cmdline.h>
 #include <vm/vm_aspace.h>
 #include <lib/ktrace.h>
@@ -82,86 +83,377 @@ static void ktrace_report_probes(void) {
     mutex_release(&probe_list_lock);
 }
 
-typedef struct ktrace_state {
+// Records are appended to a buffer of the CPU they are written on, so that
+// tracing does not bounce a shared cache line between CPUs.  Records are
+// reserved and timestamped under the buffer's lock, with interrupts
+// disabled, so each buffer is in timestamp order.
+//
+// In circular mode a full buffer wraps around and overwrites its oldest
+// records: its valid data is then the older segment [tail, end) followed by
+// the newer segment [0, offset).  Otherwise its valid data is [0, offset),
+// and tracing stops as soon as any buffer fills up, so that all buffers
+// cover the same period of time.
+typedef struct ktrace_cpu_buffer {
+    spin_lock_t lock;
+    uint8_t* buffer;
+    uint32_t size;
+
     // where the next record will be written
-    int offset;
+    uint32_t offset;
 
+    // the oldest record and the end of the older segment, if wrapped
+    uint32_t tail;
+    uint32_t end;
+    bool wrapped;
+} __CPU_ALIGN ktrace_cpu_buffer_t;
+
+typedef struct ktrace_state {
     // mask of groups we allow, 0 == tracing disabled
     int grpmask;
 
-    // total size of the trace buffer
-    uint32_t bufsize;
+    // overwrite the oldest records instead of stopping when full
+    bool circular;
 
-    // offset where tracing was stopped, 0 if tracing active
-    uint32_t marker;
+    // number of per-cpu buffers in use
+    uint32_t cpu_count;
 
-    // raw trace buffer
-    uint8_t* buffer;
+    // Name and metadata records are kept apart from the per-cpu
+    // buffers, so that they are never overwritten in circular mode.
+    // Names which do not fit are dropped, and counted in the
+    // TAG_NAMES_DROPPED record.  In circular mode, stopping tracing after
+    // names were dropped starts the name buffer over with the names of
+    // the threads and processes that are still alive, since those are
+    // what the remaining records are most likely to refer to.
+    spin_lock_t meta_lock;
+
+    // where the next name record will be written
+    uint32_t meta_offset;
+
+    // name records dropped since the last rewind
+    int meta_dropped;
+
+    // size of the name record buffer
+    uint32_t meta_size;
+
+    // raw name record buffer
+    uint8_t* meta;
+
+    ktrace_cpu_buffer_t cpu[SMP_MAX_CPUS];
 } ktrace_state_t;
 
 static ktrace_state_t KTRACE_STATE;
 
-int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
+// The version, ticks per ms, and dropped names records, which start
+// the name record buffer.
+static const uint32_t kMetaHeaderSize = KTRACE_RECSIZE * 3;
+
+// Reading exports the name records followed by the records of all of the
+// per-cpu buffers, merged in timestamp order.  The reader works from a
+// snapshot of the buffers' bookkeeping, taken when the first read after a
+// change of state (or any read from offset 0) starts, and keeps a merge
+// cursor so that sequential reads do not restart the merge.  In circular
+// mode, tracing should be stopped before reading, or records may be
+// overwritten while they are read.
+typedef struct ktrace_cpu_snapshot {
+    // logical layout: the older segment, then the newer segment
+    uint32_t tail;
+    uint32_t end;
+    uint32_t offset;
+
+    // logical position of the first exported record
+    uint32_t start;
+
+    // logical position of the merge cursor
+    uint32_t pos;
+} ktrace_cpu_snapshot_t;
+
+typedef struct ktrace_snapshot {
+    bool valid;
+
+    // bytes of name records, and total bytes exported
+    uint32_t meta_len;
+    uint32_t total;
+
+    // offset (past the name records) of the merge cursor
+    uint32_t cursor;
+
+    ktrace_cpu_snapshot_t cpu[SMP_MAX_CPUS];
+} ktrace_snapshot_t;
+
+static mutex_t read_lock = MUTEX_INITIAL_VALUE(read_lock);
+static ktrace_snapshot_t KTRACE_SNAPSHOT TA_GUARDED(read_lock);
+
+static void ktrace_invalidate_snapshot(void) {
+    mutex_acquire(&read_lock);
+    KTRACE_SNAPSHOT.valid = false;
+    mutex_release(&read_lock);
+}
+
+static uint32_t snapshot_len(const ktrace_cpu_snapshot_t* cs) {
+    return (cs->end - cs->tail) + cs->offset;
+}
+
+static ktrace_header_t* snapshot_record(const ktrace_cpu_buffer_t* cb,
+                                        const ktrace_cpu_snapshot_t* cs, uint32_t pos) {
+    uint32_t older = cs->end - cs->tail;
+    uint32_t off = (pos < older) ? (cs->tail + pos) : (pos - older);
+    return (ktrace_header_t*) (cb->buffer + off);
+}
+
+// Returns the length of the record at pos, or 0 if the cpu has no
+// more records to export.
+static uint32_t snapshot_reclen(const ktrace_cpu_buffer_t* cb,
+                                const ktrace_cpu_snapshot_t* cs, uint32_t pos) {
+    if (pos >= snapshot_len(cs)) {
+        return 0;
+    }
+    uint32_t len = KTRACE_LEN(snapshot_record(cb, cs, pos)->tag);
+    return (len <= snapshot_len(cs) - pos) ? len : 0;
+}
+
+static void ktrace_take_snapshot(void) TA_REQ(read_lock) {
     ktrace_state_t* ks = &KTRACE_STATE;
+    ktrace_snapshot_t* snap = &KTRACE_SNAPSHOT;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&ks->meta_lock, state);
+    snap->meta_len = ks->meta_offset;
+    if (snap->meta_len >= kMetaHeaderSize) {
+        ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) ks->meta;
+        rec[2].a = atomic_load(&ks->meta_dropped);
+    }
+    spin_unlock_irqrestore(&ks->meta_lock, state);
+
+    // Buffers which have wrapped only hold the most recent part of the
+    // trace, and a busy cpu wraps sooner than an idle one.  Only export
+    // the period of time which all of the buffers cover.
+    uint64_t cutoff = 0;
+    for (uint32_t i = 0; i < ks->cpu_count; i++) {
+        ktrace_cpu_buffer_t* cb = &ks->cpu[i];
+        ktrace_cpu_snapshot_t* cs = &snap->cpu[i];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cb->lock, state);
+        cs->tail = cb->wrapped ? cb->tail : 0;
+        cs->end = cb->wrapped ? cb->end : 0;
+        cs->offset = cb->offset;
+        bool wrapped = cb->wrapped;
+        spin_unlock_irqrestore(&cb->lock, state);
+
+        if (wrapped && snapshot_reclen(cb, cs, 0)) {
+            uint64_t ts = snapshot_record(cb, cs, 0)->ts;
+            if (ts > cutoff) {
+                cutoff = ts;
+            }
+        }
+    }
 
-    // Buffer size is limited by the marker if set,
-    // otherwise limited by offset (last written point).
-    // Offset can end up pointing past the end, so clip
-    // it to the actual buffer size to be safe.
-    uint32_t max;
-    if (ks->marker) {
-        max = ks->marker;
-    } else {
-        max = ks->offset;
-        if (max > ks->bufsize) {
-            max = ks->bufsize;
+    snap->total = snap->meta_len;
+    for (uint32_t i = 0; i < ks->cpu_count; i++) {
+        ktrace_cpu_buffer_t* cb = &ks->cpu[i];
+        ktrace_cpu_snapshot_t* cs = &snap->cpu[i];
+        uint32_t pos = 0;
+        uint32_t len;
+        while (((len = snapshot_reclen(cb, cs, pos)) != 0) &&
+               (snapshot_record(cb, cs, pos)->ts < cutoff)) {
+            pos += len;
         }
+        cs->start = pos;
+        cs->pos = pos;
+        while ((len = snapshot_reclen(cb, cs, pos)) != 0) {
+            pos += len;
+        }
+        snap->total += pos - cs->start;
     }
 
+    snap->cursor = 0;
+    snap->valid = true;
+}
+
+// Returns the cpu whose next record is the oldest, or -1 if all of
+// the records have been merged.
+static int ktrace_merge_next(void) TA_REQ(read_lock) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    ktrace_snapshot_t* snap = &KTRACE_SNAPSHOT;
+    int next = -1;
+    uint64_t next_ts = 0;
+    for (uint32_t i = 0; i < ks->cpu_count; i++) {
+        ktrace_cpu_snapshot_t* cs = &snap->cpu[i];
+        if (snapshot_reclen(&ks->cpu[i], cs, cs->pos) == 0) {
+            continue;
+        }
+        uint64_t ts = snapshot_record(&ks->cpu[i], cs, cs->pos)->ts;
+        if ((next < 0) || (ts < next_ts)) {
+            next = i;
+            next_ts = ts;
+        }
+    }
+    return next;
+}
+
+// Copy merged records, starting moff bytes past the name records, to
+// out + *copied until *copied reaches len.
+static mx_status_t ktrace_read_merged(uint8_t* out, uint32_t moff, uint32_t len,
+                                      uint32_t* copied) TA_REQ(read_lock) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    ktrace_snapshot_t* snap = &KTRACE_SNAPSHOT;
+
+    // The merged records follow the name records.  Restart the merge
+    // if the read is behind the cursor.
+    if (moff < snap->cursor) {
+        for (uint32_t i = 0; i < ks->cpu_count; i++) {
+            snap->cpu[i].pos = snap->cpu[i].start;
+        }
+        snap->cursor = 0;
+    }
+
+    while (*copied < len) {
+        int i = ktrace_merge_next();
+        if (i < 0) {
+            break;
+        }
+        ktrace_cpu_snapshot_t* cs = &snap->cpu[i];
+        uint32_t reclen = snapshot_reclen(&ks->cpu[i], cs, cs->pos);
+        if (snap->cursor + reclen > moff) {
+            // copy all or part of this record
+            uint32_t skip = moff - snap->cursor;
+            uint32_t n = reclen - skip;
+            if (n > len - *copied) {
+                n = len - *copied;
+            }
+            const uint8_t* rec = (const uint8_t*) snapshot_record(&ks->cpu[i], cs, cs->pos);
+            if (arch_copy_to_user(out + *copied, rec + skip, n) != MX_OK) {
+                return MX_ERR_INVALID_ARGS;
+            }
+            *copied += n;
+            moff += n;
+            if (skip + n < reclen) {
+                // leave the cursor on the partially read record
+                break;
+            }
+        }
+        cs->pos += reclen;
+        snap->cursor += reclen;
+    }
+
+    return MX_OK;
+}
+
+int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    ktrace_snapshot_t* snap = &KTRACE_SNAPSHOT;
+
+    mutex_acquire(&read_lock);
+
     // null read is a query for trace buffer size
     if (ptr == nullptr) {
-        return max;
+        ktrace_take_snapshot();
+        mutex_release(&read_lock);
+        return snap->total;
+    }
+
+    if (!snap->valid || (off == 0)) {
+        ktrace_take_snapshot();
     }
 
     // constrain read to available buffer
-    if (off >= max) {
+    if (off >= snap->total) {
+        mutex_release(&read_lock);
         return 0;
     }
-    if (len > (max - off)) {
-        len = max - off;
+    if (len > (snap->total - off)) {
+        len = snap->total - off;
     }
 
-    if (arch_copy_to_user(ptr, ks->buffer + off, len) != MX_OK) {
-        return MX_ERR_INVALID_ARGS;
+    uint8_t* out = (uint8_t*) ptr;
+    uint32_t copied = 0;
+    if (off < snap->meta_len) {
+        uint32_t n = snap->meta_len - off;
+        if (n > len) {
+            n = len;
+        }
+        if (arch_copy_to_user(out, ks->meta + off, n) != MX_OK) {
+            mutex_release(&read_lock);
+            return MX_ERR_INVALID_ARGS;
+        }
+        copied = n;
+    }
+
+    if (copied < len) {
+        mx_status_t status = ktrace_read_merged(out, off + copied - snap->meta_len, len, &copied);
+        if (status != MX_OK) {
+            mutex_release(&read_lock);
+            return status;
+        }
+    }
+
+    mutex_release(&read_lock);
+    return copied;
+}
+
+// Empty the name record buffer, leaving just the metadata records.
+static void ktrace_reset_names(void) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&ks->meta_lock, state);
+    ks->meta_offset = kMetaHeaderSize;
+    spin_unlock_irqrestore(&ks->meta_lock, state);
+}
+
+static void ktrace_reset_buffers(void) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    for (uint32_t i = 0; i < ks->cpu_count; i++) {
+        ktrace_cpu_buffer_t* cb = &ks->cpu[i];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cb->lock, state);
+        cb->offset = 0;
+        cb->tail = 0;
+        cb->end = 0;
+        cb->wrapped = false;
+        spin_unlock_irqrestore(&cb->lock, state);
     }
-    return len;
 }
 
 mx_status_t ktrace_control(uint32_t action, uint32_t options, void* ptr) {
     ktrace_state_t* ks = &KTRACE_STATE;
     switch (action) {
     case KTRACE_ACTION_START:
+    case KTRACE_ACTION_START_CIRCULAR:
         options = KTRACE_GRP_TO_MASK(options);
-        ks->marker = 0;
+        ks->circular = (action == KTRACE_ACTION_START_CIRCULAR);
+        ktrace_invalidate_snapshot();
         atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
         ktrace_report_live_processes();
         ktrace_report_live_threads();
         break;
     case KTRACE_ACTION_STOP: {
+        int dropped = atomic_load(&ks->meta_dropped);
+        if (ks->circular && dropped && atomic_load(&ks->grpmask)) {
+            // Evict the names of exited threads and processes, which
+            // have likely been overwritten along with their records,
+            // in favor of those still alive.  This has to happen while
+            // tracing is still on, or the names are not recorded.
+            ktrace_reset_names();
+            ktrace_report_syscalls(kt_syscall_info);
+            ktrace_report_probes();
+            ktrace_report_live_processes();
+            ktrace_report_live_threads();
+        }
         atomic_store(&ks->grpmask, 0);
-        uint32_t n = ks->offset;
-        if (n > ks->bufsize) {
-            ks->marker = ks->bufsize;
-        } else {
-            ks->marker = n;
+        if (dropped) {
+            dprintf(INFO, "ktrace: %d name records did not fit in %u bytes\n",
+                    dropped, ks->meta_size);
         }
+        ktrace_invalidate_snapshot();
         break;
     }
     case KTRACE_ACTION_REWIND:
         // roll back to just after the metadata
-        atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
+        ktrace_reset_buffers();
+        ktrace_reset_names();
+        atomic_store(&ks->meta_dropped, 0);
         ktrace_report_syscalls(kt_syscall_info);
         ktrace_report_probes();
+        ktrace_invalidate_snapshot();
         break;
     case KTRACE_ACTION_NEW_PROBE: {
         ktrace_probe_info_t* probe;
@@ -202,19 +494,32 @@ void ktrace_init(unsigned level) {
 
     mb *= (1024*1024);
 
+    uint8_t* buffer;
     mx_status_t status;
     VmAspace* aspace = VmAspace::kernel_aspace();
-    if ((status = aspace->Alloc("ktrace", mb, (void**)&ks->buffer, 0, VmAspace::VMM_FLAG_COMMIT,
+    if ((status = aspace->Alloc("ktrace", mb, (void**)&buffer, 0, VmAspace::VMM_FLAG_COMMIT,
                                 ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE)) < 0) {
         dprintf(INFO, "ktrace: cannot alloc buffer %d\n", status);
         return;
     }
 
-    // The last packet written can overhang the end of the buffer,
-    // so we reduce the reported size by the max size of a record
-    ks->bufsize = mb - 256;
+    // The first 1/16th of the buffer holds name records, the rest is
+    // split evenly between the cpus.
+    spin_lock_init(&ks->meta_lock);
+    ks->meta = buffer;
+    ks->meta_size = mb / 16;
+    ks->cpu_count = arch_max_num_cpus();
+    uint32_t cpu_size = ((mb - ks->meta_size) / ks->cpu_count) & ~7u;
+    for (uint32_t i = 0; i < ks->cpu_count; i++) {
+        ktrace_cpu_buffer_t* cb = &ks->cpu[i];
+        spin_lock_init(&cb->lock);
+        cb->buffer = buffer + ks->meta_size + i * cpu_size;
+        cb->size = cpu_size;
+    }
+    ks->circular = cmdline_get_bool("ktrace.circular", false);
 
-    dprintf(INFO, "ktrace: buffer at %p (%u bytes)\n", ks->buffer, mb);
+    dprintf(INFO, "ktrace: buffer at %p (%u bytes, %u cpus%s)\n", buffer, mb, ks->cpu_count,
+            ks->circular ? ", circular" : "");
 
     // register all static probes
     ktrace_probe_info_t *probe;
@@ -224,17 +529,19 @@ void ktrace_init(unsigned level) {
     }
     mutex_release(&probe_list_lock);
 
-    // write metadata to the first two event slots
+    // write metadata to the first three event slots
     uint64_t n = ktrace_ticks_per_ms();
-    ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) ks->buffer;
+    ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) ks->meta;
     rec[0].tag = TAG_VERSION;
     rec[0].a = KTRACE_VERSION;
     rec[1].tag = TAG_TICKS_PER_MS;
     rec[1].a = (uint32_t)n;
     rec[1].b = (uint32_t)(n >> 32);
+    rec[2].tag = TAG_NAMES_DROPPED;
+    rec[2].a = 0;
 
     // enable tracing
-    atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
+    ktrace_reset_names();
     ktrace_report_syscalls(kt_syscall_info);
     ktrace_report_probes();
     atomic_store(&ks->grpmask, KTRACE_GRP_TO_MASK(grpmask));
@@ -243,20 +550,65 @@ void ktrace_init(unsigned level) {
     ktrace_report_live_threads();
 }
 
-void ktrace_tiny(uint32_t tag, uint32_t arg) {
+// Drop the oldest records of a wrapped buffer until the next limit bytes
+// are free.
+static void ktrace_drop_oldest(ktrace_cpu_buffer_t* cb, uint32_t limit) {
+    while ((cb->tail < cb->end) && (cb->tail < limit)) {
+        uint32_t len = KTRACE_LEN(((ktrace_header_t*) (cb->buffer + cb->tail))->tag);
+        if (len == 0) {
+            cb->tail = cb->end;
+            break;
+        }
+        cb->tail += len;
+    }
+}
+
+// Reserve space for a record with the given tag in the current cpu's
+// buffer and fill in its header.  Returns nullptr if the record was
+// dropped.
+static ktrace_header_t* ktrace_reserve(uint32_t tag, uint32_t tid) {
     ktrace_state_t* ks = &KTRACE_STATE;
-    if (tag & atomic_load(&ks->grpmask)) {
-        tag = (tag & 0xFFFFFFF0) | 2;
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_HDRSIZE)) >= (int)ks->bufsize) {
+    uint32_t len = KTRACE_LEN(tag);
+    ktrace_header_t* hdr = nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    ktrace_cpu_buffer_t* cb = &ks->cpu[arch_curr_cpu_num()];
+    spin_lock(&cb->lock);
+
+    if (cb->offset + len > cb->size) {
+        if (!ks->circular) {
             // if we arrive at the end, stop
             atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-            hdr->ts = ktrace_timestamp();
-            hdr->tag = tag;
-            hdr->tid = arg;
+            goto done;
         }
+        // wrap around; what was written so far becomes the older segment
+        cb->end = cb->offset;
+        cb->tail = 0;
+        cb->offset = 0;
+        cb->wrapped = true;
+    }
+    if (cb->wrapped) {
+        ktrace_drop_oldest(cb, cb->offset + len);
+    }
+
+    hdr = (ktrace_header_t*) (cb->buffer + cb->offset);
+    cb->offset += len;
+    hdr->ts = ktrace_timestamp();
+    hdr->tag = tag;
+    hdr->tid = tid;
+
+done:
+    spin_unlock(&cb->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return hdr;
+}
+
+void ktrace_tiny(uint32_t tag, uint32_t arg) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (tag & atomic_load(&ks->grpmask)) {
+        tag = (tag & 0xFFFFFFF0) | 2;
+        ktrace_reserve(tag, arg);
     }
 }
 
@@ -266,17 +618,10 @@ void* ktrace_open(uint32_t tag) {
         return nullptr;
     }
 
-    int off;
-    if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-        // if we arrive at the end, stop
-        atomic_store(&ks->grpmask, 0);
+    ktrace_header_t* hdr = ktrace_reserve(tag, (uint32_t)get_current_thread()->user_tid);
+    if (hdr == nullptr) {
         return nullptr;
     }
-
-    ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-    hdr->ts = ktrace_timestamp();
-    hdr->tag = tag;
-    hdr->tid = (uint32_t)get_current_thread()->user_tid;
     return hdr + 1;
 }
 
@@ -288,18 +633,25 @@ static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char*
         // set size to: sizeof(hdr) + len + 1, round up to multiple of 8
         tag = (tag & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
 
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->buffer + off);
+        // if the name buffer is full, drop the record but keep tracing
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&ks->meta_lock, state);
+        uint32_t off = ks->meta_offset;
+        if (off < kMetaHeaderSize) {
+            // the name buffer is not set up yet; names reported
+            // before then are reported again by ktrace_init()
+        } else if (off + KTRACE_LEN(tag) <= ks->meta_size) {
+            ks->meta_offset = off + KTRACE_LEN(tag);
+            ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->meta + off);
             rec->tag = tag;
             rec->id = id;
             rec->arg = arg;
             memcpy(rec->name, name, len);
             rec->name[len] = 0;
+        } else {
+            atomic_add(&ks->meta_dropped, 1);
         }
+        spin_unlock_irqrestore(&ks->meta_lock, state);
     }
 }
 
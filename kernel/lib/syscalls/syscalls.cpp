@@ -7,6 +7,7 @@
 #include <err.h>
 #include <kernel/stats.h>
 #include <kernel/thread.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 #include <lib/vdso.h>
 #include <magenta/mx-syscall-numbers.h>
@@ -22,6 +23,31 @@
 
 #define LOCAL_TRACE 0
 
+namespace {
+
+// Generated struct that has the syscall index and name.
+struct SyscallInfo {
+    uint32_t id;
+    uint32_t nargs;
+    const char* name;
+};
+
+const SyscallInfo kSyscallInfo[] = {
+#include <magenta/syscall-ktrace-info.inc>
+};
+
+const char* syscall_name(size_t num) {
+    for (const auto& info : kSyscallInfo) {
+        if (info.id == num)
+            return info.name;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+KCOUNTER_ARRAY(syscalls_by_number, "kernel.syscalls", MX_SYS_COUNT, syscall_name);
+
 int sys_invalid_syscall(uint64_t num, uint64_t pc,
                         uintptr_t vdso_code_address) {
     LTRACEF("invalid syscall %lu from PC %#lx vDSO code %#lx\n",
@@ -68,6 +94,7 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
     ktrace_tiny(TAG_SYSCALL_ENTER, ((uint32_t)syscall_num << 8) | arch_curr_cpu_num());
 
     CPU_STATS_INC(syscalls);
+    kcounter_add_at(&syscalls_by_number, syscall_num, 1);
 
     /* re-enable interrupts to maintain kernel preemptiveness
        This must be done after the above ktrace_tiny call, and after the
@@ -109,6 +136,7 @@ inline x86_64_syscall_result do_syscall(uint64_t syscall_num, uint64_t ip,
     ktrace_tiny(TAG_SYSCALL_ENTER, (static_cast<uint32_t>(syscall_num) << 8) | arch_curr_cpu_num());
 
     CPU_STATS_INC(syscalls);
+    kcounter_add_at(&syscalls_by_number, syscall_num, 1);
 
     /* re-enable interrupts to maintain kernel preemptiveness
        This must be done after the above ktrace_tiny call, and after the
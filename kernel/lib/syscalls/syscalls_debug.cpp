@@ -13,6 +13,7 @@
 #include <trace.h>
 
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <lib/user_copy/user_ptr.h>
 #include <lib/ktrace.h>
 #include <lib/mtrace.h>
@@ -20,6 +21,7 @@
 #include <object/handle_owner.h>
 #include <object/process_dispatcher.h>
 #include <object/resources.h>
+#include <object/vm_object_dispatcher.h>
 
 #include <platform/debug.h>
 
@@ -166,3 +168,34 @@ mx_status_t sys_mtrace_control(mx_handle_t handle,
 
     return mtrace_control(kind, action, options, ptr, size);
 }
+
+mx_status_t sys_kcounters_get_vmo(mx_handle_t handle, user_ptr<mx_handle_t> _out) {
+    // TODO(MG-971): finer grained validation
+    mx_status_t status;
+    if ((status = validate_resource(handle, MX_RSRC_KIND_ROOT)) < 0) {
+        return status;
+    }
+
+    fbl::RefPtr<VmObject> vmo;
+    if ((status = kcounters_get_vmo(&vmo)) != MX_OK)
+        return status;
+
+    fbl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    if ((status = VmObjectDispatcher::Create(fbl::move(vmo), &dispatcher, &rights)) != MX_OK)
+        return status;
+
+    // The kernel keeps writing the counters, so readers only get to map them.
+    rights &= ~(MX_RIGHT_WRITE | MX_RIGHT_EXECUTE | MX_RIGHT_SET_PROPERTY);
+
+    HandleOwner out(MakeHandle(fbl::move(dispatcher), rights));
+    if (!out)
+        return MX_ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    if (_out.copy_to_user(up->MapHandleToValue(out)) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    up->AddHandle(fbl::move(out));
+    return MX_OK;
+}
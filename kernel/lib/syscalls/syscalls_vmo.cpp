@@ -175,8 +175,12 @@ mx_status_t sys_vmo_set_size(mx_handle_t handle, uint64_t size) {
     auto up = ProcessDispatcher::GetCurrent();
 
     // lookup the dispatcher from handle
+    // Resizing needs MX_RIGHT_SET_PROPERTY as well, so that a VMO can be
+    // shared writable with a process that cannot shrink it out from under
+    // another's mapping.
     fbl::RefPtr<VmObjectDispatcher> vmo;
-    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_WRITE, &vmo);
+    mx_status_t status = up->GetDispatcherWithRights(
+        handle, MX_RIGHT_WRITE | MX_RIGHT_SET_PROPERTY, &vmo);
     if (status != MX_OK)
         return status;
 
@@ -13,6 +13,7 @@
 #include <trace.h>
 
 #include <kernel/event.h>
+#include <lib/counters.h>
 #include <platform.h>
 #include <object/handle.h>
 #include <object/message_packet.h>
@@ -28,6 +29,9 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE 0
 
+KCOUNTER(channel_messages, "kernel.channel.messages");
+KCOUNTER(channel_bytes, "kernel.channel.bytes");
+
 // static
 mx_status_t ChannelDispatcher::Create(fbl::RefPtr<Dispatcher>* dispatcher0,
                                       fbl::RefPtr<Dispatcher>* dispatcher1,
@@ -259,6 +263,9 @@ mx_status_t ChannelDispatcher::ResumeInterruptedCall(MessageWaiter* waiter,
 int ChannelDispatcher::WriteSelf(fbl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
+    kcounter_add(channel_messages, 1);
+    kcounter_add(channel_bytes, msg->data_size());
+
     AutoLock lock(&lock_);
 
     if (!waiters_.is_empty()) {
@@ -13,6 +13,7 @@
 #include <kernel/mutex.h>
 #include <kernel/vm.h>
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 #include <object/diagnostics.h>
 #include <string.h>
@@ -25,6 +26,8 @@
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 #define TRACE_PAGE_FAULT 0
 
+KCOUNTER(page_faults_counter, "kernel.page_faults");
+
 // This file mostly contains C wrappers around the underlying C++ objects, conforming to
 // the older api.
 
@@ -50,6 +53,7 @@ status_t vmm_page_fault_handler(vaddr_t addr, uint flags) {
 #endif
 
     ktrace(TAG_PAGE_FAULT, (uint32_t)(addr >> 32), (uint32_t)addr, flags, arch_curr_cpu_num());
+    kcounter_add(page_faults_counter, 1);
 
     // get the address space object this pointer is in
     VmAspace* aspace = VmAspace::vaddr_to_aspace(addr);
@@ -19,6 +19,7 @@ typedef struct dc_devhost devhost_t;
 typedef struct dc_device device_t;
 typedef struct dc_driver driver_t;
 typedef struct dc_devnode devnode_t;
+typedef struct dc_launch launch_t;
 
 struct dc_work {
     list_node_t node;
@@ -43,6 +44,9 @@ struct dc_devhost {
     int32_t refcount;
     uint32_t flags;
 
+    // launch in progress, if the process hasn't started yet
+    launch_t* launch;
+
     // list of all devices on this devhost
     list_node_t devices;
 };
@@ -85,6 +89,11 @@ struct dc_device {
     // listnode for this device in the all devices list
     list_node_t anode;
 
+    // listnode for this device in the devices-by-protocol index,
+    // and the protocol (BIND_PROTOCOL) it is indexed under
+    list_node_t inode;
+    uint32_t bind_protocol;
+
     mx_device_prop_t props[];
 };
 
@@ -114,6 +123,8 @@ struct dc_device {
 
 #define DEV_CTX_SHADOW     0x40
 
+#define DC_BIND_KEYS_MAX 4
+
 struct dc_driver {
     const char* name;
     const mx_bind_inst_t* binding;
@@ -121,6 +132,16 @@ struct dc_driver {
     uint32_t flags;
     struct list_node node;
     const char* libname;
+
+    // property values any device must have for the binding
+    // program to match it (see dc_compile_binding())
+    mx_device_prop_t keys[DC_BIND_KEYS_MAX];
+    uint32_t key_count;
+
+    // position in the list of drivers, and listnode
+    // for this driver in the drivers-by-protocol index
+    uint32_t seq;
+    list_node_t inode;
 };
 
 #define DRIVER_NAME_LEN_MAX 64
@@ -131,6 +152,9 @@ void devfs_unpublish(device_t* dev);
 device_t* coordinator_init(mx_handle_t root_job);
 void coordinator(void);
 
+// Logs a boot progress message with the time since boot.
+void dc_timeline(const char* fmt, ...) __PRINTFLIKE(1, 2);
+
 void dc_driver_added(driver_t* drv, const char* version);
 
 void load_driver(const char* path);
@@ -140,6 +164,22 @@ bool dc_is_bindable(driver_t* drv, uint32_t protocol_id,
                     mx_device_prop_t* props, size_t prop_count,
                     bool autobind);
 
+// Fill in the driver's binding keys from its binding program.
+void dc_compile_binding(driver_t* drv);
+
+// Find the value the driver's binding keys require for property id.
+bool dc_binding_key(driver_t* drv, uint32_t id, uint32_t* value);
+
+// Cheap pre-check for dc_is_bindable(): false if the device cannot
+// satisfy the driver's binding keys.
+bool dc_binding_may_match(driver_t* drv, uint32_t protocol_id,
+                          mx_device_prop_t* props, size_t prop_count,
+                          bool autobind);
+
+// The BIND_PROTOCOL value binding programs see for a device.
+uint32_t dc_bind_protocol(uint32_t protocol_id,
+                          mx_device_prop_t* props, size_t prop_count);
+
 #define DC_MAX_DATA 4096
 
 // The first two fields of devcoordinator messages align
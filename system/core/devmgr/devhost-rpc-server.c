@@ -57,7 +57,7 @@ static mx_status_t devhost_get_handles(mx_handle_t rh, mx_device_t* dev,
     // detect pipeline directive and discard all other
     // protocol flags
     bool pipeline = flags & O_PIPELINE;
-    flags &= (~O_PIPELINE);
+    flags &= ~(O_PIPELINE | O_XFER_VMO);
 
     newios->flags = flags;
 
@@ -154,3 +154,82 @@ bool dc_is_bindable(driver_t* drv, uint32_t protocol_id,
     ctx.autobind = autobind ? 1 : 0;
     return is_bindable(&ctx);
 }
+
+// The binding program of most drivers starts with a run of
+// BI_ABORT_IF(NE, ...) instructions (typically on BIND_PROTOCOL and
+// a vendor id) before anything that can match.  Every device the
+// program can match must satisfy those equalities, so they can be
+// checked without running the program at all.  A program that ends in
+// a single BI_MATCH_IF(EQ, ...) with only aborts after it contributes
+// that equality as well.  Nothing after a GOTO is considered, since
+// control may skip around it.
+void dc_compile_binding(driver_t* drv) {
+    const mx_bind_inst_t* ip = drv->binding;
+    const mx_bind_inst_t* end = ip + (drv->binding_size / sizeof(mx_bind_inst_t));
+
+    drv->key_count = 0;
+    for (; ip < end; ip++) {
+        uint32_t op = BINDINST_OP(ip->op);
+        if (op == OP_MATCH || op == OP_GOTO) {
+            break;
+        }
+        if ((op == OP_ABORT) && (BINDINST_CC(ip->op) == COND_NE) &&
+            (BINDINST_PB(ip->op) != BIND_FLAGS) &&
+            (drv->key_count < DC_BIND_KEYS_MAX)) {
+            mx_device_prop_t* key = &drv->keys[drv->key_count++];
+            key->id = BINDINST_PB(ip->op);
+            key->value = ip->arg;
+        }
+    }
+
+    if ((ip < end) && (BINDINST_OP(ip->op) == OP_MATCH) &&
+        (BINDINST_CC(ip->op) == COND_EQ) &&
+        (BINDINST_PB(ip->op) != BIND_FLAGS) &&
+        (drv->key_count < DC_BIND_KEYS_MAX)) {
+        const mx_bind_inst_t* match = ip;
+        while (++ip < end) {
+            if (BINDINST_OP(ip->op) != OP_ABORT) {
+                return;
+            }
+        }
+        mx_device_prop_t* key = &drv->keys[drv->key_count++];
+        key->id = BINDINST_PB(match->op);
+        key->value = match->arg;
+    }
+}
+
+bool dc_binding_key(driver_t* drv, uint32_t id, uint32_t* value) {
+    for (uint32_t i = 0; i < drv->key_count; i++) {
+        if (drv->keys[i].id == id) {
+            *value = drv->keys[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool dc_binding_may_match(driver_t* drv, uint32_t protocol_id,
+                          mx_device_prop_t* props, size_t prop_count,
+                          bool autobind) {
+    bpctx_t ctx;
+    ctx.props = props;
+    ctx.end = props + prop_count;
+    ctx.protocol_id = protocol_id;
+    ctx.autobind = autobind ? 1 : 0;
+    for (uint32_t i = 0; i < drv->key_count; i++) {
+        if (dev_get_prop(&ctx, drv->keys[i].id) != drv->keys[i].value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t dc_bind_protocol(uint32_t protocol_id,
+                          mx_device_prop_t* props, size_t prop_count) {
+    bpctx_t ctx;
+    ctx.props = props;
+    ctx.end = props + prop_count;
+    ctx.protocol_id = protocol_id;
+    ctx.autobind = 0;
+    return dev_get_prop(&ctx, BIND_PROTOCOL);
+}
@@ -4,9 +4,11 @@
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <threads.h>
 
 #include <ddk/driver.h>
 #include <driver-info/driver-info.h>
@@ -141,6 +143,110 @@ static list_node_t list_drivers_new = LIST_INITIAL_VALUE(list_drivers_new);
 // All Devices (excluding static immortal devices)
 static list_node_t list_devices = LIST_INITIAL_VALUE(list_devices);
 
+// Drivers and devices are also indexed by the BIND_PROTOCOL value
+// they require or have, so that matching a new device (or driver) only
+// looks at the drivers (or devices) which could bind to it.  Drivers
+// whose binding programs don't pin down a protocol are kept on a list
+// of their own and always considered.
+#define BIND_INDEX_BUCKETS 64
+
+static list_node_t driver_index[BIND_INDEX_BUCKETS];
+static list_node_t driver_index_any = LIST_INITIAL_VALUE(driver_index_any);
+static list_node_t device_index[BIND_INDEX_BUCKETS];
+static uint32_t driver_count;
+static uint32_t device_count;
+
+// Cost of matching drivers to devices, reported by "dmctl dump".
+static struct {
+    uint64_t pairs;         // driver/device pairs a full scan would match
+    uint64_t candidates;    // pairs looked at after consulting the index
+    uint64_t programs;      // binding programs run
+    mx_time_t match_time;   // spent looking for matches
+    uint32_t binds;         // calls to dc_attempt_bind() from matching
+    mx_time_t bind_time;    // spent in those calls
+} bind_stats;
+
+static uint32_t bind_index_bucket(uint32_t protocol) {
+    return ((protocol * 2654435761u) >> 16) % BIND_INDEX_BUCKETS;
+}
+
+// Drivers must be indexed in list_drivers order.
+static void dc_index_driver(driver_t* drv) {
+    dc_compile_binding(drv);
+    drv->seq = driver_count++;
+    uint32_t protocol;
+    if (dc_binding_key(drv, BIND_PROTOCOL, &protocol)) {
+        list_add_tail(&driver_index[bind_index_bucket(protocol)], &drv->inode);
+    } else {
+        list_add_tail(&driver_index_any, &drv->inode);
+    }
+}
+
+static void dc_index_device(device_t* dev) {
+    dev->bind_protocol = dc_bind_protocol(dev->protocol_id,
+                                          dev->props, dev->prop_count);
+    list_add_tail(&device_index[bind_index_bucket(dev->bind_protocol)], &dev->inode);
+    device_count++;
+}
+
+static void dc_unindex_device(device_t* dev) {
+    list_delete(&dev->inode);
+    device_count--;
+}
+
+// Walks the drivers which might bind to a device with a given
+// protocol, in list_drivers order, by merging that protocol's
+// bucket with the drivers that could bind to any protocol.
+typedef struct {
+    uint32_t protocol;
+    list_node_t* bucket;
+    driver_t* next;
+    driver_t* next_any;
+} driver_cursor_t;
+
+static driver_t* driver_cursor_skip(driver_cursor_t* c, driver_t* drv) {
+    // other protocols may share the bucket
+    while (drv != NULL) {
+        uint32_t protocol;
+        if (dc_binding_key(drv, BIND_PROTOCOL, &protocol) && (protocol == c->protocol)) {
+            break;
+        }
+        drv = list_next_type(c->bucket, &drv->inode, driver_t, inode);
+    }
+    return drv;
+}
+
+static void driver_cursor_init(driver_cursor_t* c, uint32_t protocol) {
+    c->protocol = protocol;
+    c->bucket = &driver_index[bind_index_bucket(protocol)];
+    c->next = driver_cursor_skip(c, list_peek_head_type(c->bucket, driver_t, inode));
+    c->next_any = list_peek_head_type(&driver_index_any, driver_t, inode);
+}
+
+static driver_t* driver_cursor_next(driver_cursor_t* c) {
+    driver_t* drv;
+    if ((c->next != NULL) &&
+        ((c->next_any == NULL) || (c->next->seq < c->next_any->seq))) {
+        drv = c->next;
+        c->next = driver_cursor_skip(
+            c, list_next_type(c->bucket, &drv->inode, driver_t, inode));
+    } else if ((drv = c->next_any) != NULL) {
+        c->next_any = list_next_type(&driver_index_any, &drv->inode, driver_t, inode);
+    }
+    return drv;
+}
+
+static bool dc_match(driver_t* drv, device_t* dev, bool autobind) {
+    bind_stats.candidates++;
+    if (!dc_binding_may_match(drv, dev->protocol_id,
+                              dev->props, dev->prop_count, autobind)) {
+        return false;
+    }
+    bind_stats.programs++;
+    return dc_is_bindable(drv, dev->protocol_id,
+                          dev->props, dev->prop_count, autobind);
+}
+
 static driver_t* libname_to_driver(const char* libname) {
     driver_t* drv;
     list_for_every_entry(&list_drivers, drv, driver_t, node) {
@@ -267,6 +373,13 @@ static void dc_dump_state(void) {
     if (platform_device.hrsrc != MX_HANDLE_INVALID) {
         dc_dump_device(&platform_device, 1);
     }
+    dmprintf("\nBinding : %u drivers, %u devices\n", driver_count, device_count);
+    dmprintf("Matching: %" PRIu64 " of %" PRIu64 " pairs considered, "
+             "%" PRIu64 " programs run, %" PRIu64 " us\n",
+             bind_stats.candidates, bind_stats.pairs, bind_stats.programs,
+             bind_stats.match_time / 1000);
+    dmprintf("Binds   : %u, %" PRIu64 " us\n",
+             bind_stats.binds, bind_stats.bind_time / 1000);
 }
 
 static void dc_dump_device_props(device_t* dev) {
@@ -496,63 +609,218 @@ static void dc_watch(mx_handle_t h) {
     }
 }
 
-static mx_status_t dc_launch_devhost(devhost_t* host,
-                                     const char* name, mx_handle_t hrpc) {
+void dc_timeline(const char* fmt, ...) {
+    if (!(log_flags & LOG_INFO)) {
+        return;
+    }
+    char buf[128];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+    printf("devmgr: timeline: %6" PRIu64 ".%03u ms: %s\n",
+           now / MX_MSEC(1), (unsigned) ((now % MX_MSEC(1)) / MX_USEC(1)), buf);
+}
+
+// Devhosts are launched by a few helper threads, so that loading one
+// devhost's process doesn't hold up binding everything else.  The
+// coordinator creates the devhost's rpc channel itself and can queue
+// requests on it at once; the devhost picks them up once it runs.
+// When a launch finishes, the helper queues the launch_t back to the
+// coordinator's port, and the coordinator updates the devhost.
+#define DEVHOST_LAUNCHERS 4
+#define DEVHOST_LAUNCH_HANDLES 6
+
+struct dc_launch {
+    list_node_t node;
+    port_handler_t ph;
+
+    // NULL if the devhost was released before the launch finished
+    devhost_t* host;
+
+    char name[32];
+    mx_handle_t handles[DEVHOST_LAUNCH_HANDLES];
+    uint32_t ids[DEVHOST_LAUNCH_HANDLES];
+    size_t handle_count;
+    size_t name_count;
+
+    // results, filled in by the launcher
+    mx_handle_t proc;
+    mx_status_t status;
+    const char* errmsg;
+
+    mx_time_t queued;
+    mx_time_t done;
+};
+
+static const char* devhost_nametable[2] = { "/", "/svc", };
+
+// Every devhost runs the same binary, so the parts of
+// loading it which never change are only done once.
+static launchpad_template_t* devhost_template;
+
+static mtx_t launch_lock = MTX_INIT;
+static cnd_t launch_cnd;
+static list_node_t list_launches = LIST_INITIAL_VALUE(list_launches);
+static bool launchers_started;
+
+static void dc_do_launch(launch_t* launch) {
     launchpad_t* lp;
-    launchpad_create_with_jobs(devhost_job, 0, name, &lp);
-    launchpad_load_from_file(lp, devhost_bin);
+    launchpad_create_with_jobs(devhost_job, 0, launch->name, &lp);
+    if (devhost_template != NULL) {
+        launchpad_load_from_template(lp, devhost_template);
+    } else {
+        launchpad_load_from_file(lp, devhost_bin);
+    }
     launchpad_set_args(lp, 1, &devhost_bin);
 
-    launchpad_add_handle(lp, hrpc, PA_HND(PA_USER0, 0));
-
-    mx_handle_t h;
-    //TODO: limit root resource to root devhost only
-    mx_handle_duplicate(get_root_resource(), MX_RIGHT_SAME_RIGHTS, &h);
-    launchpad_add_handle(lp, h, PA_HND(PA_RESOURCE, 0));
+    launchpad_add_handles(lp, launch->handle_count, launch->handles, launch->ids);
 
     // Inherit devmgr's environment (including kernel cmdline)
     launchpad_clone(lp, LP_CLONE_ENVIRON);
 
-    const char* nametable[2] = { "/", "/svc", };
-    size_t name_count = 0;
+    launchpad_set_nametable(lp, launch->name_count, devhost_nametable);
+
+    launch->status = launchpad_go(lp, &launch->proc, &launch->errmsg);
+    launch->done = mx_time_get(MX_CLOCK_MONOTONIC);
+}
+
+static int dc_launcher(void* arg) {
+    for (;;) {
+        launch_t* launch;
+        mtx_lock(&launch_lock);
+        while ((launch = list_remove_head_type(&list_launches, launch_t, node)) == NULL) {
+            cnd_wait(&launch_cnd, &launch_lock);
+        }
+        mtx_unlock(&launch_lock);
+
+        dc_do_launch(launch);
+        port_queue(&dc_port, &launch->ph, 0);
+    }
+    return 0;
+}
+
+static bool dc_start_launchers(void) {
+    if (launchers_started) {
+        return true;
+    }
+    if (devhost_template == NULL) {
+        mx_status_t r = launchpad_template_create_from_file(devhost_bin, &devhost_template);
+        if (r < 0) {
+            log(ERROR, "devcoord: cannot create devhost template: %d\n", r);
+        }
+    }
+    if (cnd_init(&launch_cnd) != thrd_success) {
+        return false;
+    }
+    for (int i = 0; i < DEVHOST_LAUNCHERS; i++) {
+        thrd_t t;
+        if (thrd_create_with_name(&t, dc_launcher, NULL, "devhost-launcher") != thrd_success) {
+            if (i == 0) {
+                cnd_destroy(&launch_cnd);
+                return false;
+            }
+            break;
+        }
+        thrd_detach(t);
+    }
+    launchers_started = true;
+    return true;
+}
+
+static mx_status_t dc_launch_done(port_handler_t* ph, mx_signals_t signals, uint32_t evt) {
+    launch_t* launch = containerof(ph, launch_t, ph);
+    devhost_t* dh = launch->host;
+
+    if (launch->status < 0) {
+        // The devhost's end of the rpc channel is gone with the
+        // launchpad, so its devices will go away as if it had died.
+        log(ERROR, "devcoord: launch devhost '%s': failed: %d: %s\n",
+            launch->name, launch->status, launch->errmsg);
+    } else if (dh == NULL) {
+        mx_task_kill(launch->proc);
+        mx_handle_close(launch->proc);
+    } else {
+        dh->proc = launch->proc;
+        mx_info_handle_basic_t info;
+        if (mx_object_get_info(dh->proc, MX_INFO_HANDLE_BASIC, &info,
+                               sizeof(info), NULL, NULL) == MX_OK) {
+            dh->koid = info.koid;
+        }
+        log(INFO, "devcoord: launch devhost '%s': pid=%zu\n",
+            launch->name, dh->koid);
+        dc_timeline("devhost '%s' launched in %" PRIu64 " us", launch->name,
+                    (launch->done - launch->queued) / MX_USEC(1));
+    }
+
+    if (dh != NULL) {
+        dh->launch = NULL;
+    }
+    free(launch);
+    return MX_OK;
+}
+
+// Consumes hrpc.  The launch usually completes asynchronously, in which
+// case success only means it has been started.
+static mx_status_t dc_launch_devhost(devhost_t* host,
+                                     const char* name, mx_handle_t hrpc) {
+    launch_t* launch = calloc(1, sizeof(launch_t));
+    if (launch == NULL) {
+        mx_handle_close(hrpc);
+        return MX_ERR_NO_MEMORY;
+    }
+    launch->ph.func = dc_launch_done;
+    launch->host = host;
+    snprintf(launch->name, sizeof(launch->name), "%s", name);
+
+    size_t n = 0;
+    launch->handles[n] = hrpc;
+    launch->ids[n++] = PA_HND(PA_USER0, 0);
+
+    mx_handle_t h;
+    //TODO: limit root resource to root devhost only
+    mx_handle_duplicate(get_root_resource(), MX_RIGHT_SAME_RIGHTS, &h);
+    launch->handles[n] = h;
+    launch->ids[n++] = PA_HND(PA_RESOURCE, 0);
 
     //TODO: eventually devhosts should not have vfs access
-    launchpad_add_handle(lp, vfs_create_global_root_handle(),
-                         PA_HND(PA_NS_DIR, name_count++));
+    launch->handles[n] = vfs_create_global_root_handle();
+    launch->ids[n++] = PA_HND(PA_NS_DIR, launch->name_count++);
 
     //TODO: constrain to /svc/device
     if ((h = get_service_root()) != MX_HANDLE_INVALID) {
-        launchpad_add_handle(lp, h, PA_HND(PA_NS_DIR, name_count++));
+        launch->handles[n] = h;
+        launch->ids[n++] = PA_HND(PA_NS_DIR, launch->name_count++);
     }
 
-    launchpad_set_nametable(lp, name_count, nametable);
-
     //TODO: limit root job access to root devhost only
-    launchpad_add_handle(lp, get_sysinfo_job_root(),
-                         PA_HND(PA_USER0, ID_HJOBROOT));
+    launch->handles[n] = get_sysinfo_job_root();
+    launch->ids[n++] = PA_HND(PA_USER0, ID_HJOBROOT);
 
     //TODO: pass a channel to the acpi devhost to rpc with
     //      devcoordinator, so it can call reboot/poweroff/ps0.
     //      come up with a better way to wire this up.
     if (!strcmp(name, "devhost:acpi")) {
-        launchpad_add_handle(lp, acpi_rpc[1], PA_HND(PA_USER0, 10));
-    }
-
-    const char* errmsg;
-    mx_status_t status = launchpad_go(lp, &host->proc, &errmsg);
-    if (status < 0) {
-        log(ERROR, "devcoord: launch devhost '%s': failed: %d: %s\n",
-            name, status, errmsg);
+        launch->handles[n] = acpi_rpc[1];
+        launch->ids[n++] = PA_HND(PA_USER0, 10);
+    }
+    launch->handle_count = n;
+
+    host->launch = launch;
+    launch->queued = mx_time_get(MX_CLOCK_MONOTONIC);
+    if (dc_start_launchers()) {
+        mtx_lock(&launch_lock);
+        list_add_tail(&list_launches, &launch->node);
+        cnd_signal(&launch_cnd);
+        mtx_unlock(&launch_lock);
+    } else {
+        // No launcher threads, so launch it right here.
+        dc_do_launch(launch);
+        mx_status_t status = launch->status;
+        dc_launch_done(&launch->ph, 0, 0);
         return status;
     }
-    mx_info_handle_basic_t info;
-    if (mx_object_get_info(host->proc, MX_INFO_HANDLE_BASIC, &info,
-                           sizeof(info), NULL, NULL) == MX_OK) {
-        host->koid = info.koid;
-    }
-    log(INFO, "devcoord: launch devhost '%s': pid=%zu\n",
-        name, host->koid);
-
     return MX_OK;
 }
 
@@ -569,14 +837,14 @@ static mx_status_t dc_new_devhost(const char* name, devhost_t** out) {
         return r;
     }
 
+    list_initialize(&dh->devices);
+
     if ((r = dc_launch_devhost(dh, name, hrpc)) < 0) {
         mx_handle_close(dh->hrpc);
         free(dh);
         return r;
     }
 
-    list_initialize(&dh->devices);
-
     *out = dh;
     return MX_OK;
 }
@@ -588,6 +856,9 @@ static void dc_release_devhost(devhost_t* dh) {
         return;
     }
     log(INFO, "devcoord: destroy host %p\n", dh);
+    if (dh->launch != NULL) {
+        dh->launch->host = NULL;
+    }
     mx_handle_close(dh->hrpc);
     mx_task_kill(dh->proc);
     mx_handle_close(dh->proc);
@@ -722,6 +993,7 @@ static mx_status_t dc_add_device(device_t* parent,
     parent->refcount++;
 
     list_add_tail(&list_devices, &dev->anode);
+    dc_index_device(dev);
 
     log(DEVLC, "devcoord: dev %p name='%s' ++ref=%d (child)\n",
         parent, parent->name, parent->refcount);
@@ -834,6 +1106,7 @@ static mx_status_t dc_remove_device(device_t* dev, bool forced) {
     if (!(dev->flags & DEV_CTX_SHADOW)) {
         // remove from list of all devices
         list_delete(&dev->anode);
+        dc_unindex_device(dev);
         dc_notify(dev, DEVMGR_OP_DEVICE_REMOVED);
     }
 
@@ -866,8 +1139,7 @@ static mx_status_t dc_bind_device(device_t* dev, const char* drvlibname) {
     driver_t* drv;
     list_for_every_entry(&list_drivers, drv, driver_t, node) {
         if (autobind || !strcmp(drv->libname, drvlibname)) {
-            if (dc_is_bindable(drv, dev->protocol_id,
-                               dev->props, dev->prop_count, autobind)) {
+            if (dc_match(drv, dev, autobind)) {
                 log(SPEW, "devcoord: drv='%s' bindable to dev='%s'\n",
                     drv->name, dev->name);
                 dc_attempt_bind(drv, dev);
@@ -1249,21 +1521,38 @@ static mx_status_t dc_attempt_bind(driver_t* drv, device_t* dev) {
     return dh_bind_driver(dev->shadow, drv->libname);
 }
 
+// dc_attempt_bind() for matches found through the index,
+// keeping track of the time spent binding.
+static void dc_bind_match(driver_t* drv, device_t* dev) {
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    dc_attempt_bind(drv, dev);
+    bind_stats.bind_time += mx_time_get(MX_CLOCK_MONOTONIC) - start;
+    bind_stats.binds++;
+}
+
 static void dc_handle_new_device(device_t* dev) {
-    driver_t* drv;
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    mx_time_t bind_time = bind_stats.bind_time;
+    bind_stats.pairs += driver_count;
 
-    list_for_every_entry(&list_drivers, drv, driver_t, node) {
-        if (dc_is_bindable(drv, dev->protocol_id,
-                           dev->props, dev->prop_count, true)) {
+    driver_cursor_t cursor;
+    driver_cursor_init(&cursor, dc_bind_protocol(dev->protocol_id,
+                                                 dev->props, dev->prop_count));
+    driver_t* drv;
+    while ((drv = driver_cursor_next(&cursor)) != NULL) {
+        if (dc_match(drv, dev, true)) {
             log(SPEW, "devcoord: drv='%s' bindable to dev='%s'\n",
                 drv->name, dev->name);
 
-            dc_attempt_bind(drv, dev);
+            dc_bind_match(drv, dev);
             if (!(dev->flags & DEV_CTX_MULTI_BIND)) {
                 break;
             }
         }
     }
+
+    bind_stats.match_time += mx_time_get(MX_CLOCK_MONOTONIC) - start -
+                             (bind_stats.bind_time - bind_time);
 }
 
 // device binding program that pure (parentless)
@@ -1336,6 +1625,11 @@ device_t* coordinator_init(mx_handle_t root_job) {
 
     port_init(&dc_port);
 
+    for (size_t i = 0; i < BIND_INDEX_BUCKETS; i++) {
+        list_initialize(&driver_index[i]);
+        list_initialize(&device_index[i]);
+    }
+
     return &root_device;
 }
 
@@ -1349,6 +1643,19 @@ static void acpi_init(void) {
     devhost_acpi_set_rpc(acpi_rpc[0]);
 }
 
+static void dc_bind_driver_to_device(driver_t* drv, device_t* dev) {
+    if (dev->flags & (DEV_CTX_BOUND | DEV_CTX_DEAD | DEV_CTX_ZOMBIE)) {
+        // if device is already bound or being destroyed, skip it
+        return;
+    }
+    if (dc_match(drv, dev, true)) {
+        log(INFO, "devcoord: drv='%s' bindable to dev='%s'\n",
+            drv->name, dev->name);
+
+        dc_bind_match(drv, dev);
+    }
+}
+
 void dc_bind_driver(driver_t* drv) {
     if (dc_running) {
         printf("devcoord: driver '%s' added\n", drv->name);
@@ -1363,20 +1670,27 @@ void dc_bind_driver(driver_t* drv) {
                (platform_device.hrsrc != MX_HANDLE_INVALID)) {
         dc_attempt_bind(drv, &platform_device);
     } else if (dc_running) {
+        mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+        mx_time_t bind_time = bind_stats.bind_time;
+        bind_stats.pairs += device_count;
+
         device_t* dev;
-        list_for_every_entry(&list_devices, dev, device_t, anode) {
-            if (dev->flags & (DEV_CTX_BOUND | DEV_CTX_DEAD | DEV_CTX_ZOMBIE)) {
-                // if device is already bound or being destroyed, skip it
-                continue;
+        uint32_t protocol;
+        if (dc_binding_key(drv, BIND_PROTOCOL, &protocol)) {
+            list_node_t* bucket = &device_index[bind_index_bucket(protocol)];
+            list_for_every_entry(bucket, dev, device_t, inode) {
+                if (dev->bind_protocol == protocol) {
+                    dc_bind_driver_to_device(drv, dev);
+                }
             }
-            if (dc_is_bindable(drv, dev->protocol_id,
-                               dev->props, dev->prop_count, true)) {
-                log(INFO, "devcoord: drv='%s' bindable to dev='%s'\n",
-                    drv->name, dev->name);
-
-                dc_attempt_bind(drv, dev);
+        } else {
+            list_for_every_entry(&list_devices, dev, device_t, anode) {
+                dc_bind_driver_to_device(drv, dev);
             }
         }
+
+        bind_stats.match_time += mx_time_get(MX_CLOCK_MONOTONIC) - start -
+                                 (bind_stats.bind_time - bind_time);
     }
 }
 
@@ -1384,6 +1698,7 @@ void dc_handle_new_driver(void) {
     driver_t* drv;
     while ((drv = list_remove_head_type(&list_drivers_new, driver_t, node)) != NULL) {
         list_add_tail(&list_drivers, &drv->node);
+        dc_index_driver(drv);
         dc_bind_driver(drv);
     }
 }
@@ -1400,6 +1715,7 @@ static mx_status_t dc_control_event(port_handler_t* ph, mx_signals_t signals, ui
             system_loaded = true;
             find_loadable_drivers("/system/driver");
             find_loadable_drivers("/system/lib/driver");
+            dc_timeline("system drivers loaded");
         }
         break;
     }
@@ -1418,6 +1734,7 @@ void load_system_drivers(void) {
 
 void coordinator(void) {
     log(INFO, "devmgr: coordinator()\n");
+    dc_timeline("coordinator started");
 
     if (getenv_bool("devmgr.verbose", false)) {
         log_flags |= LOG_DEVLC;
@@ -1438,6 +1755,7 @@ void coordinator(void) {
     find_loadable_drivers("/boot/driver");
     find_loadable_drivers("/boot/driver/test");
     find_loadable_drivers("/boot/lib/driver");
+    dc_timeline("boot drivers loaded");
 
     // Special case early handling for the ramdisk boot
     // path where /system is present before the coordinator
@@ -1448,12 +1766,18 @@ void coordinator(void) {
         dc_control_event(&control_handler, 0, CTL_SCAN_SYSTEM);
     }
 
+    // The initial drivers are only indexed now that their order
+    // in list_drivers is final.
     driver_t* drv;
+    list_for_every_entry(&list_drivers, drv, driver_t, node) {
+        dc_index_driver(drv);
+    }
     list_for_every_entry(&list_drivers, drv, driver_t, node) {
         dc_bind_driver(drv);
     }
 
     dc_running = true;
+    dc_timeline("initial drivers bound");
 
     for (;;) {
         mx_status_t status;
@@ -336,6 +336,9 @@ got_name:
         }
 
         // add link node to class directory
+        if (list_is_empty(&dir->children)) {
+            dc_timeline("/dev/class/%s available", dir->name);
+        }
         list_add_tail(&dir->children, &dnlink->node);
         dev->link = dnlink;
         devfs_notify(dir, dnlink->name, VFS_WATCH_EVT_ADDED);
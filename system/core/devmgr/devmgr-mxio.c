@@ -24,7 +24,9 @@
 #include <mxio/util.h>
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -227,6 +229,75 @@ fail:
     return status;
 }
 
+// Userboot only decompresses the files of a per-file compressed primary
+// bootfs which it needs to start devmgr.  The rest are decompressed here,
+// on a few threads at once, before the vfs is handed out.
+#define BOOTFS_PREFETCH_THREADS 4
+
+typedef struct {
+    bootfs_lazy_t lazy;
+    atomic_uint next;
+} bootfs_prefetch_t;
+
+static int bootfs_prefetch_thread(void* arg) {
+    bootfs_prefetch_t* pf = arg;
+
+    // Files userboot filled in are in use, so nothing may be
+    // decompressed in place: go through a buffer.
+    uint8_t* buffer = malloc(BOOTFS_LAZY_BUFFER_SIZE);
+    if (buffer == NULL) {
+        return MX_ERR_NO_MEMORY;
+    }
+    unsigned i;
+    while ((i = atomic_fetch_add(&pf->next, 1)) < pf->lazy.frame_count) {
+        const char* errmsg;
+        mx_status_t status = bootfs_lazy_fill_frame(&pf->lazy, i, buffer, &errmsg);
+        if (status != MX_OK) {
+            printf("devmgr: bootfs: cannot decompress file #%u: %s\n", i, errmsg);
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+static void bootfs_prefetch(mx_handle_t bootdata_vmo, size_t off, size_t len,
+                            mx_handle_t bootfs_vmo) {
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+
+    bootfs_prefetch_t pf;
+    const char* errmsg;
+    mx_status_t status = bootfs_lazy_attach(mx_vmar_root_self(), bootdata_vmo,
+                                            off, len, bootfs_vmo, &pf.lazy, &errmsg);
+    if (status != MX_OK) {
+        printf("devmgr: failed to decompress bootfs: %s\n", errmsg);
+        return;
+    }
+    atomic_init(&pf.next, 0);
+
+    // This thread does its share too.
+    thrd_t threads[BOOTFS_PREFETCH_THREADS - 1];
+    unsigned count = 0;
+    uint32_t cpus = mx_system_get_num_cpus();
+    while ((count + 1 < cpus) && (count < countof(threads))) {
+        if (thrd_create_with_name(&threads[count], bootfs_prefetch_thread, &pf,
+                                  "bootfs-prefetch") != thrd_success) {
+            break;
+        }
+        count++;
+    }
+    if (bootfs_prefetch_thread(&pf) != 0) {
+        printf("devmgr: bootfs: out of memory for decompression\n");
+    }
+    for (unsigned n = 0; n < count; n++) {
+        thrd_join(threads[n], NULL);
+    }
+
+    printf("devmgr: bootfs: decompressed %u files in %" PRIu64 " us on %u threads\n",
+           pf.lazy.frame_count,
+           (mx_time_get(MX_CLOCK_MONOTONIC) - start) / MX_USEC(1), count + 1);
+    bootfs_lazy_destroy(&pf.lazy);
+}
+
 #define HND_BOOTFS(n) PA_HND(PA_VMO_BOOTFS, n)
 #define HND_BOOTDATA(n) PA_HND(PA_VMO_BOOTDATA, n)
 
@@ -234,7 +305,10 @@ static void setup_bootfs(void) {
     mx_handle_t vmo;
     unsigned idx = 0;
 
+    // The vnodes share this handle, so it stays valid.
+    mx_handle_t primary_vmo = MX_HANDLE_INVALID;
     if ((vmo = mx_get_startup_handle(HND_BOOTFS(0)))) {
+        primary_vmo = vmo;
         setup_bootfs_vmo(idx++, BOOTDATA_BOOTFS_BOOT, vmo);
     } else {
         printf("devmgr: missing primary bootfs?!\n");
@@ -277,7 +351,12 @@ static void setup_bootfs(void) {
                 printf("devmgr: unexpected bootdata container header\n");
                 goto done;
             case BOOTDATA_BOOTFS_DISCARD:
-                // this was already unpacked for us by userboot
+                // this was already unpacked for us by userboot,
+                // perhaps only in part
+                if ((bootdata.flags & BOOTDATA_BOOTFS_FLAG_FILE_COMPRESSED) &&
+                    (primary_vmo != MX_HANDLE_INVALID)) {
+                    bootfs_prefetch(vmo, off, bootdata.length + hdrsz, primary_vmo);
+                }
                 break;
             case BOOTDATA_BOOTFS_BOOT:
             case BOOTDATA_BOOTFS_SYSTEM: {
@@ -4,6 +4,7 @@
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -378,7 +379,8 @@ int main(int argc, char** argv) {
     root_resource_handle = mx_get_startup_handle(PA_HND(PA_RESOURCE, 0));
     root_job_handle = mx_job_default();
 
-    printf("devmgr: main()\n");
+    printf("devmgr: main() at %" PRIu64 " ms since boot\n",
+           mx_time_get(MX_CLOCK_MONOTONIC) / MX_MSEC(1));
 
     devmgr_init(root_job_handle);
     devmgr_vfs_init();
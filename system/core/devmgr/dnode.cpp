@@ -44,10 +44,11 @@ void Dnode::RemoveFromParent() {
 
     // Detach from parent
     if (parent_) {
+        parent_->index_.erase(*this);
         parent_->children_.erase(*this);
         if (IsDirectory()) {
             // '..' no longer references parent.
-            parent_->vnode_->link_count_--;
+            parent_->vnode_->link_count_.fetch_sub(1);
         }
         parent_->vnode_->UpdateModified();
         if (parent_->vnode_->IsDetachedDevice() && !parent_->HasChildren()) {
@@ -59,7 +60,7 @@ void Dnode::RemoveFromParent() {
             delete parent_->vnode_.get();
         }
         parent_ = nullptr;
-        vnode_->link_count_--;
+        vnode_->link_count_.fetch_sub(1);
     }
 }
 
@@ -83,10 +84,10 @@ void Dnode::AddChild(fbl::RefPtr<Dnode> parent, fbl::RefPtr<Dnode> child) {
     MX_DEBUG_ASSERT(parent->IsDirectory());
 
     child->parent_ = parent;
-    child->vnode_->link_count_++;
+    child->vnode_->link_count_.fetch_add(1);
     if (child->IsDirectory()) {
         // Child has '..' pointing back at parent.
-        parent->vnode_->link_count_++;
+        parent->vnode_->link_count_.fetch_add(1);
     }
     // Ensure that the ordering of tokens in the children list is absolute.
     if (parent->children_.is_empty()) {
@@ -94,20 +95,19 @@ void Dnode::AddChild(fbl::RefPtr<Dnode> parent, fbl::RefPtr<Dnode> child) {
     } else {
         child->ordering_token_ = parent->children_.back().ordering_token_ + 1;
     }
+    parent->index_.insert(child.get());
     parent->children_.push_back(fbl::move(child));
     parent->vnode_->UpdateModified();
 }
 
 mx_status_t Dnode::Lookup(const char* name, size_t len, fbl::RefPtr<Dnode>* out) const {
-    auto dn = children_.find_if([&name, &len](const Dnode& elem) -> bool {
-        return elem.NameMatch(name, len);
-    });
-    if (dn == children_.end()) {
+    auto dn = index_.find(NameKey{name, len, NameHash(name, len)});
+    if (!dn.IsValid()) {
         return MX_ERR_NOT_FOUND;
     }
 
     if (out != nullptr) {
-        *out = dn.CopyPointer();
+        *out = fbl::RefPtr<Dnode>(dn.CopyPointer());
     }
     return MX_OK;
 }
@@ -190,22 +190,31 @@ fbl::unique_ptr<char[]> Dnode::TakeName() {
 }
 
 void Dnode::PutName(fbl::unique_ptr<char[]> name, size_t len) {
+    MX_DEBUG_ASSERT(parent_ == nullptr); // The name is indexed by the parent
     flags_ = static_cast<uint32_t>((flags_ & ~kDnodeNameMax) | len);
     name_ = fbl::move(name);
+    name_hash_ = NameHash(name_.get(), len);
 }
 
 bool Dnode::IsDirectory() const { return vnode_->IsDirectory(); }
 
 Dnode::Dnode(fbl::RefPtr<VnodeMemfs> vn, fbl::unique_ptr<char[]> name, uint32_t flags) :
-    vnode_(fbl::move(vn)), parent_(nullptr), ordering_token_(0), flags_(flags), name_(fbl::move(name)) {
+    vnode_(fbl::move(vn)), parent_(nullptr), ordering_token_(0), flags_(flags),
+    name_(fbl::move(name)) {
+    name_hash_ = NameHash(name_.get(), NameLen());
 };
 
 size_t Dnode::NameLen() const {
     return flags_ & kDnodeNameMax;
 }
 
-bool Dnode::NameMatch(const char* name, size_t len) const {
-    return (NameLen() == len) && (memcmp(name_.get(), name, len) == 0);
+// FNV-1a
+uint32_t Dnode::NameHash(const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+    }
+    return hash;
 }
 
 } // namespace memfs
@@ -10,6 +10,8 @@
 #include <fs/vfs.h>
 #include <mxio/vfs.h>
 #include <fbl/intrusive_double_list.h>
+#include <fbl/intrusive_resizable_hash_table.h>
+#include <fbl/intrusive_single_list.h>
 #include <fbl/ref_counted.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
@@ -42,6 +44,27 @@ public:
     using ChildList = fbl::DoublyLinkedList<fbl::RefPtr<Dnode>, Dnode::TypeChildTraits>;
     using DeviceList = fbl::DoublyLinkedList<fbl::RefPtr<Dnode>, Dnode::TypeDeviceTraits>;
 
+    // A directory also indexes its children by name. The index holds
+    // unowned pointers; children_ owns the children and orders them.
+    struct NameKey {
+        const char* name;
+        size_t len;
+        uint32_t hash;
+    };
+    using IndexNodeState = fbl::SinglyLinkedListNodeState<Dnode*>;
+    struct TypeIndexTraits { static IndexNodeState& node_state(Dnode& dn) { return dn.type_index_state_; }};
+    struct IndexKeyTraits {
+        static NameKey GetKey(const Dnode& dn) { return dn.Key(); }
+        static bool EqualTo(const NameKey& key1, const NameKey& key2) {
+            return (key1.hash == key2.hash) && (key1.len == key2.len) &&
+                   (memcmp(key1.name, key2.name, key1.len) == 0);
+        }
+    };
+    struct IndexHashTraits { static uint32_t GetHash(const NameKey& key) { return key.hash; }};
+    using ChildIndex = fbl::ResizableHashTable<NameKey, Dnode*,
+                                               fbl::SinglyLinkedList<Dnode*, TypeIndexTraits>,
+                                               uint32_t, IndexKeyTraits, IndexHashTraits>;
+
     // Allocates a dnode, attached to a vnode
     static fbl::RefPtr<Dnode> Create(const char* name, size_t len, fbl::RefPtr<VnodeMemfs> vn);
 
@@ -96,20 +119,26 @@ public:
 private:
     friend struct TypeChildTraits;
     friend struct TypeDeviceTraits;
+    friend struct TypeIndexTraits;
+    friend struct IndexKeyTraits;
 
     Dnode(fbl::RefPtr<VnodeMemfs> vn, fbl::unique_ptr<char[]> name, uint32_t flags);
 
     size_t NameLen() const;
-    bool NameMatch(const char* name, size_t len) const;
+    NameKey Key() const { return NameKey{name_.get(), NameLen(), name_hash_}; }
+    static uint32_t NameHash(const char* name, size_t len);
 
     NodeState type_child_state_;
     NodeState type_device_state_;
+    IndexNodeState type_index_state_;
     fbl::RefPtr<VnodeMemfs> vnode_;
     fbl::RefPtr<Dnode> parent_;
     // Used to impose an absolute order on dnodes within a directory.
     size_t ordering_token_;
     ChildList children_;
+    ChildIndex index_;
     uint32_t flags_;
+    uint32_t name_hash_;
     fbl::unique_ptr<char[]> name_;
 };
 
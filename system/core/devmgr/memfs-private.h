@@ -40,19 +40,20 @@ public:
     // To be more specific: Is this vnode connected into the directory hierarchy?
     // VnodeDirs can be unlinked, and this method will subsequently return false.
     bool IsDirectory() const { return dnode_ != nullptr; }
-    void UpdateModified() { modify_time_ = mx_time_get(MX_CLOCK_UTC); }
+    void UpdateModified() { modify_time_.store(mx_time_get(MX_CLOCK_UTC)); }
 
     virtual ~VnodeMemfs();
 
     fbl::RefPtr<Dnode> dnode_;
-    uint32_t link_count_;
+    // Changed under the namespace lock, but read by stat without it.
+    fbl::atomic<uint32_t> link_count_;
 
 protected:
     VnodeMemfs();
 
     uint64_t ino_;
     uint64_t create_time_;
-    uint64_t modify_time_;
+    fbl::atomic<uint64_t> modify_time_;
 
 private:
     static fbl::atomic<uint64_t> ino_ctr_;
@@ -72,6 +73,7 @@ private:
     mx_status_t Truncate(size_t len) final;
     mx_status_t Getattr(vnattr_t* a) final;
     mx_status_t Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) final;
+    bool SupportsTransferVmo() const final { return true; }
 
     mx_handle_t vmo_;
     mx_off_t length_;
@@ -92,6 +94,9 @@ public:
     mx_status_t CreateFromVmo(bool vmofile, const char* name, size_t namelen, mx_handle_t vmo,
                               mx_off_t off, mx_off_t len);
 
+    // Looks up the directory |name|, creating it if it does not exist.
+    mx_status_t LookupOrCreateDir(fbl::RefPtr<VnodeDir>* out, const char* name, size_t namelen);
+
     // Use the watcher container to implement a directory watcher
     void Notify(const char* name, size_t len, unsigned event) final;
     mx_status_t WatchDir(mx::channel* out) final;
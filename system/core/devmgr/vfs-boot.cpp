@@ -41,16 +41,11 @@ static mx_status_t add_file(fbl::RefPtr<VnodeDir> vnb, const char* path, mx_hand
                 return MX_ERR_INVALID_ARGS;
             }
 
-            fbl::RefPtr<fs::Vnode> out;
-            r = vnb->Lookup(&out, path, nextpath - path);
-            if (r == MX_ERR_NOT_FOUND) {
-                r = vnb->Create(&out, path, nextpath - path, S_IFDIR);
-            }
-
-            if (r < 0) {
+            fbl::RefPtr<VnodeDir> out;
+            if ((r = vnb->LookupOrCreateDir(&out, path, nextpath - path)) < 0) {
                 return r;
             }
-            vnb = fbl::RefPtr<VnodeDir>::Downcast(fbl::move(out));
+            vnb = fbl::move(out);
             path = nextpath + 1;
         }
     }
@@ -20,6 +20,7 @@
 #include <fs/async-dispatcher.h>
 #include <fs/vfs.h>
 #include <magenta/device/vfs.h>
+#include <magenta/syscalls.h>
 #include <magenta/thread_annotations.h>
 #include <mxio/debug.h>
 #include <mxio/vfs.h>
@@ -59,8 +60,8 @@ static bool WindowMatchesVMO(mx_handle_t vmo, mx_off_t offset, mx_off_t length)
 fbl::atomic<uint64_t> VnodeMemfs::ino_ctr_(0);
 
 VnodeMemfs::VnodeMemfs() : dnode_(nullptr), link_count_(0),
-    ino_(ino_ctr_.fetch_add(1, fbl::memory_order_relaxed)) {
-    create_time_ = modify_time_ = mx_time_get(MX_CLOCK_UTC);
+    ino_(ino_ctr_.fetch_add(1, fbl::memory_order_relaxed)),
+    create_time_(mx_time_get(MX_CLOCK_UTC)), modify_time_(create_time_) {
 }
 VnodeMemfs::~VnodeMemfs() {
 }
@@ -75,7 +76,7 @@ VnodeFile::~VnodeFile() {
 }
 
 VnodeDir::VnodeDir() {
-    link_count_ = 1; // Implied '.'
+    link_count_.store(1); // Implied '.'
 }
 VnodeDir::~VnodeDir() {}
 
@@ -270,9 +271,9 @@ mx_status_t VnodeFile::Getattr(vnattr_t* attr) {
     attr->size = length_;
     attr->blksize = kMemfsBlksize;
     attr->blkcount = fbl::roundup(attr->size, kMemfsBlksize) / VNATTR_BLKSIZE;
-    attr->nlink = link_count_;
+    attr->nlink = link_count_.load();
     attr->create_time = create_time_;
-    attr->modify_time = modify_time_;
+    attr->modify_time = modify_time_.load();
     return MX_OK;
 }
 
@@ -283,9 +284,9 @@ mx_status_t VnodeDir::Getattr(vnattr_t* attr) {
     attr->size = 0;
     attr->blksize = kMemfsBlksize;
     attr->blkcount = fbl::roundup(attr->size, kMemfsBlksize) / VNATTR_BLKSIZE;
-    attr->nlink = link_count_;
+    attr->nlink = link_count_.load();
     attr->create_time = create_time_;
-    attr->modify_time = modify_time_;
+    attr->modify_time = modify_time_.load();
     return MX_OK;
 }
 
@@ -296,9 +297,9 @@ mx_status_t VnodeVmo::Getattr(vnattr_t* attr) {
     attr->size = length_;
     attr->blksize = kMemfsBlksize;
     attr->blkcount = fbl::roundup(attr->size, kMemfsBlksize) / VNATTR_BLKSIZE;
-    attr->nlink = link_count_;
+    attr->nlink = link_count_.load();
     attr->create_time = create_time_;
-    attr->modify_time = modify_time_;
+    attr->modify_time = modify_time_.load();
     return MX_OK;
 }
 
@@ -308,7 +309,7 @@ mx_status_t VnodeMemfs::Setattr(vnattr_t* attr) {
         return MX_ERR_INVALID_ARGS;
     }
     if (attr->valid & ATTR_MTIME) {
-        modify_time_ = attr->modify_time;
+        modify_time_.store(attr->modify_time);
     }
     return MX_OK;
 }
@@ -408,7 +409,7 @@ mx_status_t VnodeFile::Truncate(size_t len) {
     }
 
     length_ = len;
-    modify_time_ = mx_time_get(MX_CLOCK_UTC);
+    UpdateModified();
     return MX_OK;
 }
 
@@ -646,6 +647,21 @@ mx_status_t VnodeDir::CreateFromVmo(bool vmofile, const char* name, size_t namel
     return MX_OK;
 }
 
+mx_status_t VnodeDir::LookupOrCreateDir(fbl::RefPtr<VnodeDir>* out, const char* name,
+                                        size_t namelen) {
+    fbl::AutoLock lock(&memfs::vfs.vfs_lock_);
+    fbl::RefPtr<fs::Vnode> vn;
+    mx_status_t status = Lookup(&vn, name, namelen);
+    if (status == MX_ERR_NOT_FOUND) {
+        status = Create(&vn, name, namelen, S_IFDIR);
+    }
+    if (status != MX_OK) {
+        return status;
+    }
+    *out = fbl::RefPtr<VnodeDir>::Downcast(fbl::move(vn));
+    return MX_OK;
+}
+
 mx_status_t VnodeDir::CanCreate(const char* name, size_t namelen) const {
     if (!IsDirectory()) {
         return MX_ERR_INVALID_ARGS;
@@ -755,6 +771,7 @@ fbl::RefPtr<memfs::VnodeDir> BootfsRoot() {
 }
 
 mx_status_t devfs_mount(mx_handle_t h) {
+    fbl::AutoLock lock(&memfs::vfs.vfs_lock_);
     return DevfsRoot()->AttachRemote(fs::MountChannel(h));
 }
 
@@ -781,7 +798,13 @@ VnodeDir* vfs_create_global_root() {
 
         memfs::global_loop.reset(new async::Loop());
         memfs::global_dispatcher.reset(new fs::AsyncDispatcher(memfs::global_loop->async()));
-        memfs::global_loop->StartThread("root-dispatcher");
+        // Messages on a single channel are still handled in order; the
+        // namespace is guarded by the vfs lock, and file contents by each
+        // vnode's IoLock.
+        uint32_t threads = mx_system_get_num_cpus();
+        for (uint32_t i = 0; i < threads; i++) {
+            memfs::global_loop->StartThread("root-dispatcher");
+        }
         memfs::vfs.SetDispatcher(memfs::global_dispatcher.get());
     }
     return memfs::vfs_root.get();
@@ -15,7 +15,10 @@
 #pragma GCC visibility pop
 
 mx_handle_t bootdata_get_bootfs(mx_handle_t log, mx_handle_t vmar_self,
-                                mx_handle_t bootdata_vmo) {
+                                mx_handle_t bootdata_vmo,
+                                bootfs_lazy_t* lazy) {
+    lazy->vmo = MX_HANDLE_INVALID;
+
     size_t off = 0;
     for (;;) {
         bootdata_t bootdata;
@@ -44,9 +47,16 @@ mx_handle_t bootdata_get_bootfs(mx_handle_t log, mx_handle_t vmar_self,
         case BOOTDATA_BOOTFS_BOOT:;
             const char* errmsg;
             mx_handle_t bootfs_vmo;
-            status = decompress_bootdata(vmar_self, bootdata_vmo, off,
-                                         bootdata.length + hdrsz,
-                                         &bootfs_vmo, &errmsg);
+            if (bootdata.flags & BOOTDATA_BOOTFS_FLAG_FILE_COMPRESSED) {
+                // Devmgr decompresses whatever we don't need.
+                status = bootfs_lazy_create(vmar_self, bootdata_vmo, off,
+                                            bootdata.length + hdrsz,
+                                            lazy, &bootfs_vmo, &errmsg);
+            } else {
+                status = decompress_bootdata(vmar_self, bootdata_vmo, off,
+                                             bootdata.length + hdrsz,
+                                             &bootfs_vmo, &errmsg);
+            }
             check(log, status, "%s", errmsg);
 
             // Signal that we've already processed this one.
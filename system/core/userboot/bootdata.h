@@ -6,9 +6,14 @@
 
 #pragma GCC visibility push(hidden)
 
+#include <bootdata/decompress.h>
 #include <magenta/types.h>
 
+// If the bootfs has its files compressed separately, only its directory
+// is filled in, and lazy is set up to fill in the files as they're
+// used.  Otherwise, lazy->vmo is MX_HANDLE_INVALID.
 mx_handle_t bootdata_get_bootfs(mx_handle_t log, mx_handle_t vmar_self,
-                                mx_handle_t bootdata_vmo);
+                                mx_handle_t bootdata_vmo,
+                                bootfs_lazy_t* lazy);
 
 #pragma GCC visibility pop
@@ -22,6 +22,7 @@ void bootfs_mount(mx_handle_t vmar, mx_handle_t log, mx_handle_t vmo, struct boo
     check(log, status, "mx_vmar_map failed on bootfs vmo\n");
     fs->contents = (const void*)addr;
     fs->len = size;
+    fs->lazy = NULL;
     status = mx_handle_duplicate(
         vmo,
         MX_RIGHT_READ | MX_RIGHT_EXECUTE | MX_RIGHT_MAP |
@@ -35,6 +36,8 @@ void bootfs_unmount(mx_handle_t vmar, mx_handle_t log, struct bootfs *fs) {
     check(log, status, "mx_vmar_unmap failed\n");
     status = mx_handle_close(fs->vmo);
     check(log, status, "mx_handle_close failed\n");
+    if (fs->lazy != NULL)
+        bootfs_lazy_destroy(fs->lazy);
 }
 
 static const bootfs_entry_t* bootfs_search(mx_handle_t log,
@@ -87,6 +90,12 @@ mx_handle_t bootfs_open(mx_handle_t log, const char* purpose,
     if (fs->len - e->data_off < e->data_len)
         fail(log, "bogus size in bootfs header!");
 
+    if (fs->lazy != NULL) {
+        const char* errmsg;
+        mx_status_t status = bootfs_lazy_fill(fs->lazy, e->data_off, &errmsg);
+        check(log, status, "%s", errmsg);
+    }
+
     // Clone a private copy of the file's subset of the bootfs VMO.
     // TODO(mcgrathr): Create a plain read-only clone when the feature
     // is implemented in the VM.
@@ -6,6 +6,7 @@
 
 #pragma GCC visibility push(hidden)
 
+#include <bootdata/decompress.h>
 #include <magenta/types.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -14,6 +15,9 @@ struct bootfs {
     mx_handle_t vmo;
     const void* contents;
     size_t len;
+
+    // If not NULL, files are decompressed when they are opened.
+    bootfs_lazy_t* lazy;
 };
 
 void bootfs_mount(mx_handle_t vmar, mx_handle_t log, mx_handle_t vmo, struct bootfs *fs);
@@ -51,15 +51,78 @@ static mx_handle_t try_load_object(struct loader_state* state,
     return bootfs_open(state->log, "shared library", state->bootfs, file);
 }
 
-static mx_handle_t load_object(struct loader_state* state, const char* name) {
+static mx_handle_t find_object(struct loader_state* state, const char* name) {
     mx_handle_t vmo = try_load_object(state, name, state->prefix_len);
     if (vmo == MX_HANDLE_INVALID && state->prefix_len > 0 && !state->exclusive)
         vmo = try_load_object(state, name, 0);
+    return vmo;
+}
+
+static mx_handle_t load_object(struct loader_state* state, const char* name) {
+    mx_handle_t vmo = find_object(state, name);
     if (vmo == MX_HANDLE_INVALID)
         fail(state->log, "cannot find shared library '%s'", name);
     return vmo;
 }
 
+// Handle a LOADER_SVC_OP_LOAD_OBJECTS request, which carries several
+// names and gets one reply with a status and maybe a VMO for each.
+static void load_objects(struct loader_state* state, mx_handle_t channel,
+                         mx_loader_svc_msg_t* msg, uint32_t size) {
+    struct {
+        mx_loader_svc_msg_t header;
+        int32_t status[LOADER_SVC_LOAD_OBJECTS_MAX];
+    } reply = { .header = *msg };
+    mx_handle_t handles[LOADER_SVC_LOAD_OBJECTS_MAX];
+    uint32_t nhandles = 0;
+    uint32_t reply_size = sizeof(reply.header);
+
+    // The names must all end within the message.  A last name that is
+    // cut short would otherwise be looked up as a different name.
+    const bool terminated = (size > sizeof(*msg) &&
+                             ((const char*)msg)[size - 1] == '\0');
+
+    const uint32_t count = (uint32_t)msg->arg;
+    const char* name = (const char*)msg->data;
+    const char* const end = (const char*)msg + size;
+    if (!terminated || msg->arg <= 0 || count > LOADER_SVC_LOAD_OBJECTS_MAX) {
+        reply.header.arg = MX_ERR_INVALID_ARGS;
+    } else {
+        reply.header.arg = MX_OK;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (name >= end) {
+                reply.header.arg = MX_ERR_INVALID_ARGS;
+                break;
+            }
+            mx_handle_t vmo = find_object(state, name);
+            if (vmo == MX_HANDLE_INVALID) {
+                printl(state->log, "cannot find shared library '%s'", name);
+                reply.status[i] = MX_ERR_NOT_FOUND;
+            } else {
+                reply.status[i] = MX_OK;
+                handles[nhandles++] = vmo;
+            }
+            name += strlen(name) + 1;
+        }
+        if (reply.header.arg == MX_OK) {
+            reply_size += count * sizeof(reply.status[0]);
+        } else {
+            for (uint32_t i = 0; i < nhandles; ++i)
+                mx_handle_close(handles[i]);
+            nhandles = 0;
+        }
+    }
+
+    // txid returned as received from the client.
+    reply.header.opcode = LOADER_SVC_OP_STATUS;
+    reply.header.reserved0 = 0;
+    reply.header.reserved1 = 0;
+    mx_status_t status = mx_channel_write(channel, 0, &reply, reply_size,
+                                          handles, nhandles);
+    check(state->log, status,
+          "mx_channel_write on loader-service channel failed");
+}
+
 static bool handle_loader_rpc(struct loader_state* state,
                               mx_handle_t channel) {
     union {
@@ -114,6 +177,10 @@ static bool handle_loader_rpc(struct loader_state* state,
         handle = load_object(state, string);
         break;
 
+    case LOADER_SVC_OP_LOAD_OBJECTS:
+        load_objects(state, channel, &msgbuf.msg, size);
+        return true;
+
     case LOADER_SVC_OP_CLONE:
         msgbuf.msg.arg = MX_ERR_NOT_SUPPORTED;
         goto error_reply;
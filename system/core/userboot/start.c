@@ -204,7 +204,12 @@ static noreturn void bootstrap(mx_handle_t log, mx_handle_t bootstrap_pipe) {
     // Locate the first bootfs bootdata section and decompress it.
     // We need it to load devmgr and libc from.
     // Later bootfs sections will be processed by devmgr.
-    mx_handle_t bootfs_vmo = bootdata_get_bootfs(log, vmar_self, bootdata_vmo);
+    mx_time_t bootfs_start = mx_time_get(MX_CLOCK_MONOTONIC);
+    bootfs_lazy_t bootfs_lazy;
+    mx_handle_t bootfs_vmo = bootdata_get_bootfs(log, vmar_self, bootdata_vmo,
+                                                 &bootfs_lazy);
+    printl(log, "bootfs ready in %zu us",
+           (mx_time_get(MX_CLOCK_MONOTONIC) - bootfs_start) / MX_USEC(1));
 
     // Pass the decompressed bootfs VMO on.
     handles[nhandles + EXTRA_HANDLE_BOOTFS] = bootfs_vmo;
@@ -214,6 +219,8 @@ static noreturn void bootstrap(mx_handle_t log, mx_handle_t bootstrap_pipe) {
     // Map in the bootfs so we can look for files in it.
     struct bootfs bootfs;
     bootfs_mount(vmar_self, log, bootfs_vmo, &bootfs);
+    if (bootfs_lazy.vmo != MX_HANDLE_INVALID)
+        bootfs.lazy = &bootfs_lazy;
 
     // Make the channel for the bootstrap message.
     mx_handle_t to_child;
@@ -191,7 +191,8 @@ static bool cmd_is_read(uint8_t cmd) {
 static bool cmd_is_write(uint8_t cmd) {
     if (cmd == SATA_CMD_WRITE_DMA ||
         cmd == SATA_CMD_WRITE_DMA_EXT ||
-        cmd == SATA_CMD_WRITE_FPDMA_QUEUED) {
+        cmd == SATA_CMD_WRITE_FPDMA_QUEUED ||
+        cmd == SATA_CMD_DATA_SET_MANAGEMENT) {
         return true;
     } else {
         return false;
@@ -274,6 +275,11 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
         cfis[11] = (pdata->count >> 8) & 0xff;
         cfis[12] = (slot << 3) & 0xff; // tag
         cfis[13] = 0; // normal priority
+    } else if (pdata->cmd == SATA_CMD_DATA_SET_MANAGEMENT) {
+        // count is in 512-byte blocks of range entries
+        cfis[3] = pdata->features;
+        cfis[12] = pdata->count & 0xff;
+        cfis[13] = (pdata->count >> 8) & 0xff;
     }
 
     cl->prdtl = 0;
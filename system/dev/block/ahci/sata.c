@@ -36,6 +36,7 @@
 
 #define SATA_FLAG_DMA   (1 << 0)
 #define SATA_FLAG_LBA48 (1 << 1)
+#define SATA_FLAG_TRIM  (1 << 2)
 
 typedef struct sata_device {
     mx_device_t* mxdev;
@@ -147,11 +148,92 @@ static mx_status_t sata_device_identify(sata_device_t* dev, mx_device_t* control
     } else {
         xprintf("  CHS unsupported!\n");
     }
+    if (*(devinfo + SATA_DEVINFO_DSM_SUPPORT) & SATA_DSM_TRIM) {
+        flags |= SATA_FLAG_TRIM;
+        xprintf("  TRIM\n");
+    }
     dev->flags = flags;
 
     return MX_OK;
 }
 
+// A trim is sent as a series of DATA SET MANAGEMENT commands, each carrying
+// one block of ranges. txn->actual tracks how much of the trim has been sent.
+
+static uint64_t sata_trim_chunk(sata_device_t* dev, iotxn_t* txn) {
+    uint64_t max = (uint64_t)SATA_DSM_RANGES_PER_BLOCK * SATA_DSM_RANGE_MAX_SECTORS * dev->sector_sz;
+    return MIN(txn->length - txn->actual, max);
+}
+
+static void sata_trim_send(sata_device_t* dev, iotxn_t* dsm, iotxn_t* txn) {
+    uint64_t ranges[SATA_DSM_RANGES_PER_BLOCK];
+    memset(ranges, 0, sizeof(ranges));
+    uint64_t lba = (txn->offset + txn->actual) / dev->sector_sz;
+    uint64_t sectors = sata_trim_chunk(dev, txn) / dev->sector_sz;
+    for (int i = 0; sectors > 0; i++) {
+        uint64_t n = MIN(sectors, SATA_DSM_RANGE_MAX_SECTORS);
+        ranges[i] = lba | (n << 48);
+        lba += n;
+        sectors -= n;
+    }
+    iotxn_copyto(dsm, ranges, sizeof(ranges), 0);
+
+    sata_pdata_t* pdata = sata_iotxn_pdata(dsm);
+    pdata->cmd = SATA_CMD_DATA_SET_MANAGEMENT;
+    pdata->features = SATA_DSM_TRIM;
+    pdata->device = 0x40;
+    pdata->lba = 0;
+    pdata->count = 1;
+    pdata->max_cmd = dev->max_cmd;
+    pdata->port = dev->port;
+
+    // DSM is not a queued command, so it must not overlap with NCQ commands
+    dsm->opcode = IOTXN_OP_WRITE;
+    dsm->flags = IOTXN_SYNC_BEFORE | IOTXN_SYNC_AFTER;
+    dsm->offset = 0;
+    dsm->length = sizeof(ranges);
+    iotxn_queue(dev->parent, dsm);
+}
+
+static void sata_trim_complete(iotxn_t* dsm, void* cookie) {
+    iotxn_t* txn = cookie;
+    sata_device_t* dev;
+    memcpy(&dev, dsm->extra, sizeof(sata_device_t*));
+    mx_status_t status = dsm->status;
+    if (status != MX_OK) {
+        iotxn_release(dsm);
+        iotxn_complete(txn, status, 0);
+        return;
+    }
+    txn->actual += sata_trim_chunk(dev, txn);
+    if (txn->actual < txn->length) {
+        sata_trim_send(dev, dsm, txn);
+        return;
+    }
+    iotxn_release(dsm);
+    iotxn_complete(txn, MX_OK, txn->length);
+}
+
+static void sata_trim(sata_device_t* dev, iotxn_t* txn) {
+    if (!(dev->flags & SATA_FLAG_TRIM)) {
+        iotxn_complete(txn, MX_ERR_NOT_SUPPORTED, 0);
+        return;
+    }
+
+    iotxn_t* dsm;
+    mx_status_t status = iotxn_alloc(&dsm, IOTXN_ALLOC_CONTIGUOUS,
+                                     SATA_DSM_RANGES_PER_BLOCK * sizeof(uint64_t));
+    if (status != MX_OK) {
+        iotxn_complete(txn, status, 0);
+        return;
+    }
+    dsm->complete_cb = sata_trim_complete;
+    dsm->cookie = txn;
+    memcpy(dsm->extra, &dev, sizeof(sata_device_t*));
+    txn->actual = 0;
+    sata_trim_send(dev, dsm, txn);
+}
+
 // implement device protocol:
 
 static mx_protocol_device_t sata_device_proto;
@@ -168,6 +250,18 @@ static void sata_iotxn_queue(void* ctx, iotxn_t* txn) {
     // constrain to device capacity and round down to block aligned
     txn->length = MIN(ROUNDDOWN(txn->length, device->sector_sz), device->capacity - txn->offset);
 
+    if (txn->opcode == IOTXN_OP_TRIM) {
+        if (txn->length == 0) {
+            iotxn_complete(txn, MX_OK, 0);
+        } else {
+            sata_trim(device, txn);
+        }
+        return;
+    } else if ((txn->opcode != IOTXN_OP_READ) && (txn->opcode != IOTXN_OP_WRITE)) {
+        iotxn_complete(txn, MX_ERR_NOT_SUPPORTED, 0);
+        return;
+    }
+
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
     pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
     pdata->device = 0x40;
@@ -188,6 +282,9 @@ static void sata_get_info(sata_device_t* dev, block_info_t* info) {
     info->block_size = dev->sector_sz;
     info->block_count = dev->capacity / dev->sector_sz;
     info->max_transfer_size = AHCI_MAX_PRDS * PAGE_SIZE; // fully discontiguous
+    if (dev->flags & SATA_FLAG_TRIM) {
+        info->flags |= BLOCK_FLAG_TRIM_SUPPORT;
+    }
 }
 
 static mx_status_t sata_ioctl(void* ctx, uint32_t op, const void* cmd, size_t cmdlen, void* reply,
@@ -281,12 +378,18 @@ static void sata_block_txn(sata_device_t* dev, uint32_t opcode, mx_handle_t vmo,
 
     mx_status_t status;
     iotxn_t* txn;
-    if ((status = iotxn_alloc_vmo(&txn, IOTXN_ALLOC_POOL, vmo, vmo_offset, length)) != MX_OK) {
+    if (opcode == IOTXN_OP_TRIM) {
+        status = iotxn_alloc(&txn, IOTXN_ALLOC_POOL, 0);
+    } else {
+        status = iotxn_alloc_vmo(&txn, IOTXN_ALLOC_POOL, vmo, vmo_offset, length);
+    }
+    if (status != MX_OK) {
         dev->callbacks->complete(cookie, status);
         return;
     }
     txn->opcode = opcode;
     txn->offset = dev_offset;
+    txn->length = length;
     txn->complete_cb = sata_block_complete;
     txn->cookie = cookie;
     memcpy(txn->extra, &dev, sizeof(sata_device_t*));
@@ -304,11 +407,16 @@ static void sata_block_write(void* ctx, mx_handle_t vmo, uint64_t length,
     sata_block_txn(ctx, IOTXN_OP_WRITE, vmo, length, vmo_offset, dev_offset, cookie);
 }
 
+static void sata_block_trim(void* ctx, uint64_t length, uint64_t dev_offset, void* cookie) {
+    sata_block_txn(ctx, IOTXN_OP_TRIM, MX_HANDLE_INVALID, length, 0, dev_offset, cookie);
+}
+
 static block_protocol_ops_t sata_block_ops = {
     .set_callbacks = sata_block_set_callbacks,
     .get_info = sata_block_get_info,
     .read = sata_block_read,
     .write = sata_block_write,
+    .trim = sata_block_trim,
 };
 
 mx_status_t sata_bind(mx_device_t* dev, int port) {
@@ -13,6 +13,7 @@
 #define SATA_CMD_WRITE_DMA            0xca
 #define SATA_CMD_WRITE_DMA_EXT        0x35
 #define SATA_CMD_WRITE_FPDMA_QUEUED   0x61
+#define SATA_CMD_DATA_SET_MANAGEMENT 0x06
 
 #define SATA_DEVINFO_SERIAL              10
 #define SATA_DEVINFO_FW_REV              23
@@ -27,17 +28,25 @@
 #define SATA_DEVINFO_LBA_CAPACITY_2      100
 #define SATA_DEVINFO_SECTOR_SIZE         106
 #define SATA_DEVINFO_LOGICAL_SECTOR_SIZE 117
+#define SATA_DEVINFO_DSM_SUPPORT         169
 
 #define SATA_DEVINFO_SERIAL_LEN   20
 #define SATA_DEVINFO_FW_REV_LEN   8
 #define SATA_DEVINFO_MODEL_ID_LEN 40
 
+// DATA SET MANAGEMENT carries 512-byte blocks of 8-byte range entries: the
+// starting LBA in bits 0-47 and the sector count in bits 48-63.
+#define SATA_DSM_TRIM               (1 << 0) // features bit
+#define SATA_DSM_RANGES_PER_BLOCK   64
+#define SATA_DSM_RANGE_MAX_SECTORS  0xffff
+
 typedef struct sata_pdata {
     mx_time_t timeout; // for ahci driver watchdog
     uint64_t lba;   // in blocks
     uint16_t count; // in blocks
     uint8_t cmd;
     uint8_t device;
+    uint8_t features;
     int max_cmd;
     int port;
 } sata_pdata_t;
@@ -219,8 +219,8 @@ mx_status_t BlockServer::Create(mx::fifo* fifo_out, BlockServer** out) {
 void blockserver_fifo_complete(void* cookie, mx_status_t status) {
     block_msg_t* msg = static_cast<block_msg_t*>(cookie);
     // Since iobuf is a RefPtr, it lives at least as long as the txn,
-    // and is not discarded underneath the block device driver.
-    MX_DEBUG_ASSERT(msg->iobuf != nullptr);
+    // and is not discarded underneath the block device driver. Trims
+    // don't access a VMO, so they carry no iobuf.
     MX_DEBUG_ASSERT(msg->txn != nullptr);
     // Hold an extra copy of the 'txn' refptr; if we don't, and 'msg->txn' is
     // the last copy, then when we nullify 'msg->txn' in Complete we end up
@@ -251,9 +251,11 @@ mx_status_t BlockServer::Serve(block_protocol_t* proto) {
             txnid_t txnid = requests[i].txnid;
             vmoid_t vmoid = requests[i].vmoid;
 
+            uint16_t opcode = requests[i].opcode & BLOCKIO_OP_MASK;
+
             fbl::AutoLock server_lock(&server_lock_);
             auto iobuf = tree_.find(vmoid);
-            if (!iobuf.IsValid()) {
+            if (!iobuf.IsValid() && opcode != BLOCKIO_TRIM) {
                 // Operation which is not accessing a valid vmo
                 if (wants_reply) {
                     OutOfBandErrorRespond(fifo_, MX_ERR_IO, txnid);
@@ -268,7 +270,7 @@ mx_status_t BlockServer::Serve(block_protocol_t* proto) {
                 continue;
             }
 
-            switch (requests[i].opcode & BLOCKIO_OP_MASK) {
+            switch (opcode) {
             case BLOCKIO_READ:
             case BLOCKIO_WRITE: {
                 block_msg_t* msg;
@@ -290,7 +292,7 @@ mx_status_t BlockServer::Serve(block_protocol_t* proto) {
                     break;
                 }
 
-                if ((requests[i].opcode & BLOCKIO_OP_MASK) == BLOCKIO_READ) {
+                if (opcode == BLOCKIO_READ) {
                     block_read(proto, iobuf->io_vmo_.get(), requests[i].length,
                                      requests[i].vmo_offset, requests[i].dev_offset, msg);
                 } else {
@@ -299,6 +301,22 @@ mx_status_t BlockServer::Serve(block_protocol_t* proto) {
                 }
                 break;
             }
+            case BLOCKIO_TRIM: {
+                block_msg_t* msg;
+                status = txns_[txnid]->Enqueue(wants_reply, &msg);
+                if (status != MX_OK) {
+                    break;
+                }
+                MX_DEBUG_ASSERT(msg->txn == nullptr);
+                msg->txn = txns_[txnid];
+
+                if (proto->ops->trim == nullptr) {
+                    cb.complete(msg, MX_ERR_NOT_SUPPORTED);
+                    break;
+                }
+                block_trim(proto, requests[i].length, requests[i].dev_offset, msg);
+                break;
+            }
             case BLOCKIO_SYNC: {
                 // TODO(smklein): It might be more useful to have this on a per-vmo basis
                 fprintf(stderr, "Warning: BLOCKIO_SYNC is currently unimplemented\n");
@@ -128,6 +128,10 @@ public:
     mx_status_t FreeSlicesLocked(VPartition* vp, size_t vslice_start,
                                  size_t count) TA_REQ(lock_);
 
+    // Discard the contents of the given physical slices on the underlying
+    // device. Best-effort; failures are ignored.
+    void TrimSlicesLocked(const fbl::Vector<uint32_t>& pslices) TA_REQ(lock_);
+
     size_t DiskSize() const { return info_.block_count * info_.block_size; }
     size_t SliceSize() const { return slice_size_; }
     size_t VSliceMax() const { return VSLICE_MAX; }
@@ -202,6 +206,7 @@ public:
                    uint64_t dev_offset, void* cookie);
     void BlockWrite(mx_handle_t vmo, uint64_t length, uint64_t vmo_offset,
                     uint64_t dev_offset, void* cookie);
+    void BlockTrim(uint64_t length, uint64_t dev_offset, void* cookie);
 
     auto ExtentBegin() TA_REQ(lock_) {
         return slice_map_.begin();
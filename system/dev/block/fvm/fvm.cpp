@@ -372,6 +372,18 @@ mx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
     }
 
     bool freed_something = false;
+    // Physical slices released by this call, to be discarded once the new
+    // metadata is durable. Discards are advisory, so running out of memory
+    // here only costs the trim.
+    fbl::Vector<uint32_t> freed;
+    bool trim = info_.flags & BLOCK_FLAG_TRIM_SUPPORT;
+    auto record_freed = [&freed, &trim](uint32_t pslice) {
+        if (trim) {
+            fbl::AllocChecker ac;
+            freed.push_back(pslice, &ac);
+            trim = ac.check();
+        }
+    };
     {
         fbl::AutoLock lock(&vp->lock_);
         if (vp->IsKilledLocked())
@@ -390,8 +402,10 @@ mx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
             for (auto extent = vp->ExtentBegin(); extent.IsValid(); extent = vp->ExtentBegin()) {
                 while (!extent->is_empty()) {
                     auto vslice = extent->end() - 1;
-                    GetSliceEntryLocked(vp->SliceGetLocked(vslice))->vpart = PSLICE_UNALLOCATED;
+                    uint32_t pslice = vp->SliceGetLocked(vslice);
+                    GetSliceEntryLocked(pslice)->vpart = PSLICE_UNALLOCATED;
                     MX_ASSERT(vp->SliceFreeLocked(vslice));
+                    record_freed(pslice);
                 }
             }
 
@@ -417,6 +431,7 @@ mx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
                         MX_ASSERT(vp->SliceFreeLocked(vslice));
                     }
                     GetSliceEntryLocked(pslice)->vpart = 0;
+                    record_freed(static_cast<uint32_t>(pslice));
                     freed_something = true;
                 }
             }
@@ -426,7 +441,44 @@ mx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
     if (!freed_something) {
         return MX_ERR_INVALID_ARGS;
     }
-    return WriteFvmLocked();
+    mx_status_t status = WriteFvmLocked();
+    if (status == MX_OK && trim) {
+        TrimSlicesLocked(freed);
+    }
+    return status;
+}
+
+static void fvm_trim_complete(iotxn_t* txn, void* cookie) {
+    iotxn_release(txn);
+}
+
+void VPartitionManager::TrimSlicesLocked(const fbl::Vector<uint32_t>& pslices) {
+    // Slices are freed from the back of each extent, so runs of physically
+    // adjacent slices may arrive in either order.
+    size_t i = 0;
+    while (i < pslices.size()) {
+        uint32_t lo = pslices[i];
+        uint32_t hi = pslices[i];
+        for (i++; i < pslices.size(); i++) {
+            if (pslices[i] == hi + 1) {
+                hi++;
+            } else if (pslices[i] + 1 == lo) {
+                lo--;
+            } else {
+                break;
+            }
+        }
+
+        iotxn_t* txn;
+        if (iotxn_alloc(&txn, IOTXN_ALLOC_POOL, 0) != MX_OK) {
+            return;
+        }
+        txn->opcode = IOTXN_OP_TRIM;
+        txn->offset = SliceStart(DiskSize(), SliceSize(), lo);
+        txn->length = static_cast<uint64_t>(hi - lo + 1) * SliceSize();
+        txn->complete_cb = fvm_trim_complete;
+        iotxn_queue(parent(), txn);
+    }
 }
 
 // Device protocol (FVM)
@@ -913,6 +965,26 @@ void VPartition::BlockWrite(mx_handle_t vmo, uint64_t length, uint64_t vmo_offse
     Txn(IOTXN_OP_WRITE, vmo, length, vmo_offset, dev_offset, cookie);
 }
 
+void VPartition::BlockTrim(uint64_t length, uint64_t dev_offset, void* cookie) {
+    if (!(mgr_->info_.flags & BLOCK_FLAG_TRIM_SUPPORT)) {
+        callbacks_->complete(cookie, MX_ERR_NOT_SUPPORTED);
+        return;
+    }
+    mx_status_t status;
+    iotxn_t* txn;
+    if ((status = iotxn_alloc(&txn, IOTXN_ALLOC_POOL, 0)) != MX_OK) {
+        callbacks_->complete(cookie, status);
+        return;
+    }
+    txn->opcode = IOTXN_OP_TRIM;
+    txn->offset = dev_offset;
+    txn->length = length;
+    txn->complete_cb = vpart_block_complete;
+    txn->cookie = cookie;
+    memcpy(txn->extra, &callbacks_, sizeof(void*));
+    iotxn_queue(mxdev(), txn);
+}
+
 } // namespace fvm
 
 // C-compatibility definitions
@@ -249,7 +249,12 @@ static void block_do_txn(gptpart_device_t* dev, uint32_t opcode, mx_handle_t vmo
 
     mx_status_t status;
     iotxn_t* txn;
-    if ((status = iotxn_alloc_vmo(&txn, IOTXN_ALLOC_POOL, vmo, vmo_offset, length)) != MX_OK) {
+    if (opcode == IOTXN_OP_TRIM) {
+        status = iotxn_alloc(&txn, IOTXN_ALLOC_POOL, 0);
+    } else {
+        status = iotxn_alloc_vmo(&txn, IOTXN_ALLOC_POOL, vmo, vmo_offset, length);
+    }
+    if (status != MX_OK) {
         dev->callbacks->complete(cookie, status);
         return;
     }
@@ -270,11 +275,21 @@ static void gpt_block_write(void* ctx, mx_handle_t vmo, uint64_t length, uint64_
     block_do_txn(ctx, IOTXN_OP_WRITE, vmo, length, vmo_offset, dev_offset, cookie);
 }
 
+static void gpt_block_trim(void* ctx, uint64_t length, uint64_t dev_offset, void* cookie) {
+    gptpart_device_t* dev = ctx;
+    if (!(dev->info.flags & BLOCK_FLAG_TRIM_SUPPORT)) {
+        dev->callbacks->complete(cookie, MX_ERR_NOT_SUPPORTED);
+        return;
+    }
+    block_do_txn(dev, IOTXN_OP_TRIM, MX_HANDLE_INVALID, length, 0, dev_offset, cookie);
+}
+
 static block_protocol_ops_t gpt_block_ops = {
     .set_callbacks = gpt_block_set_callbacks,
     .get_info = gpt_block_get_info,
     .read = gpt_block_read,
     .write = gpt_block_write,
+    .trim = gpt_block_trim,
 };
 
 static void gpt_read_sync_complete(iotxn_t* txn, void* cookie) {
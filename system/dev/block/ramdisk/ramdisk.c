@@ -40,6 +40,9 @@ typedef struct ramdisk_device {
     // status of 'dead'.
     mtx_t lock;
     bool dead;
+    // Number of blocks which may still be written before writes are
+    // silently dropped (UINT64_MAX if unlimited). Protected by 'lock'.
+    uint64_t write_budget;
 } ramdisk_device_t;
 
 static uint64_t sizebytes(ramdisk_device_t* rdev) {
@@ -64,11 +67,42 @@ static mx_status_t constrain_args(ramdisk_device_t* ramdev,
     return MX_OK;
 }
 
+// Returns the number of bytes of a |len| byte write which should persist,
+// consuming the write budget. Must be called with 'lock' held.
+static mx_off_t consume_write_budget(ramdisk_device_t* ramdev, mx_off_t len) {
+    if (ramdev->write_budget == UINT64_MAX) {
+        return len;
+    }
+    uint64_t blocks = MIN(len / ramdev->blk_size, ramdev->write_budget);
+    ramdev->write_budget -= blocks;
+    return blocks * ramdev->blk_size;
+}
+
+// Discards |len| bytes at |offset|, returning whole pages to the system and
+// zeroing any partial pages at either end. Discarded blocks are charged
+// against the write budget like written ones, and the rest of the range is
+// left alone once it runs out. Must be called with 'lock' held.
+static mx_status_t discard_range(ramdisk_device_t* ramdev, mx_off_t offset, mx_off_t len) {
+    if ((len = consume_write_budget(ramdev, len)) == 0) {
+        return MX_OK;
+    }
+    mx_off_t start = ROUNDUP(offset, PAGE_SIZE);
+    mx_off_t end = ROUNDDOWN(offset + len, PAGE_SIZE);
+    if (start >= end) {
+        memset((void*)ramdev->mapped_addr + offset, 0, len);
+        return MX_OK;
+    }
+    memset((void*)ramdev->mapped_addr + offset, 0, start - offset);
+    memset((void*)ramdev->mapped_addr + end, 0, offset + len - end);
+    return mx_vmo_op_range(ramdev->vmo, MX_VMO_OP_DECOMMIT, start, end - start, NULL, 0);
+}
+
 static void ramdisk_get_info(void* ctx, block_info_t* info) {
     ramdisk_device_t* ramdev = ctx;
     memset(info, 0, sizeof(*info));
     info->block_size = ramdev->blk_size;
     info->block_count = sizebytes(ramdev) / ramdev->blk_size;
+    info->flags = BLOCK_FLAG_TRIM_SUPPORT;
 }
 
 static void ramdisk_fifo_set_callbacks(void* ctx, block_callbacks_t* cb) {
@@ -115,8 +149,30 @@ static void ramdisk_fifo_write(void* ctx, mx_handle_t vmo, uint64_t length,
     } else {
         size_t actual = 0;
         // Writing to disk --> Read from file VMO
-        status = mx_vmo_read(vmo, (void*)rdev->mapped_addr + dev_offset,
-                             vmo_offset, len, &actual);
+        len = consume_write_budget(rdev, len);
+        if (len != 0) {
+            status = mx_vmo_read(vmo, (void*)rdev->mapped_addr + dev_offset,
+                                 vmo_offset, len, &actual);
+        }
+    }
+    mtx_unlock(&rdev->lock);
+    rdev->cb->complete(cookie, status);
+}
+
+static void ramdisk_fifo_trim(void* ctx, uint64_t length, uint64_t dev_offset, void* cookie) {
+    ramdisk_device_t* rdev = ctx;
+    mx_off_t len = length;
+    mx_status_t status = constrain_args(rdev, &dev_offset, &len);
+    if (status != MX_OK) {
+        rdev->cb->complete(cookie, status);
+        return;
+    }
+
+    mtx_lock(&rdev->lock);
+    if (rdev->dead) {
+        status = MX_ERR_BAD_STATE;
+    } else {
+        status = discard_range(rdev, dev_offset, len);
     }
     mtx_unlock(&rdev->lock);
     rdev->cb->complete(cookie, status);
@@ -127,6 +183,7 @@ static block_protocol_ops_t ramdisk_block_ops = {
     .get_info = ramdisk_get_info,
     .read = ramdisk_fifo_read,
     .write = ramdisk_fifo_write,
+    .trim = ramdisk_fifo_trim,
 };
 
 // implement device protocol:
@@ -151,6 +208,15 @@ static mx_status_t ramdisk_ioctl(void* ctx, uint32_t op, const void* cmd,
         ramdisk_unbind(ramdev);
         return MX_OK;
     }
+    case IOCTL_RAMDISK_DROP_WRITES_AFTER: {
+        if (cmdlen != sizeof(uint64_t)) {
+            return MX_ERR_INVALID_ARGS;
+        }
+        mtx_lock(&ramdev->lock);
+        ramdev->write_budget = *(const uint64_t*)cmd;
+        mtx_unlock(&ramdev->lock);
+        return MX_OK;
+    }
     // Block Protocol
     case IOCTL_BLOCK_GET_NAME: {
         char* name = reply;
@@ -198,10 +264,20 @@ static void ramdisk_iotxn_queue(void* ctx, iotxn_t* txn) {
             return;
         }
         case IOTXN_OP_WRITE: {
-            iotxn_copyfrom(txn, (void*) ramdev->mapped_addr + txn->offset, txn->length, 0);
+            mtx_lock(&ramdev->lock);
+            mx_off_t len = consume_write_budget(ramdev, txn->length);
+            mtx_unlock(&ramdev->lock);
+            iotxn_copyfrom(txn, (void*) ramdev->mapped_addr + txn->offset, len, 0);
             iotxn_complete(txn, MX_OK, txn->length);
             return;
         }
+        case IOTXN_OP_TRIM: {
+            mtx_lock(&ramdev->lock);
+            status = discard_range(ramdev, txn->offset, txn->length);
+            mtx_unlock(&ramdev->lock);
+            iotxn_complete(txn, status, status == MX_OK ? txn->length : 0);
+            return;
+        }
         default: {
             iotxn_complete(txn, MX_ERR_INVALID_ARGS, 0);
             return;
@@ -255,6 +331,7 @@ static mx_status_t ramctl_ioctl(void* ctx, uint32_t op, const void* cmd,
         }
         ramdev->blk_size = config->blk_size;
         ramdev->blk_count = config->blk_count;
+        ramdev->write_budget = UINT64_MAX;
         mtx_init(&ramdev->lock, mtx_plain);
         sprintf(ramdev->name, "ramdisk-%lu", ramdisk_count++);
         mx_status_t status;
@@ -41,7 +41,8 @@ void BlockDevice::virtio_block_iotxn_queue(void* ctx, iotxn_t* txn) {
         bd->QueueReadWriteTxn(txn);
         break;
     default:
-        iotxn_complete(txn, -1, 0);
+        // Including IOTXN_OP_TRIM, which is not advertised.
+        iotxn_complete(txn, MX_ERR_NOT_SUPPORTED, 0);
         break;
     }
 }
@@ -82,6 +83,11 @@ mx_status_t BlockDevice::virtio_block_ioctl(void* ctx, uint32_t op, const void*
         // rebind to reread the partition table
         return device_rebind(bd->device());
     }
+    case IOCTL_DEVICE_SYNC: {
+        // VIRTIO_BLK_F_FLUSH is never negotiated, so the device may not
+        // cache writes: each write is stable once it has completed.
+        return MX_OK;
+    }
     default:
         return MX_ERR_NOT_SUPPORTED;
     }
@@ -319,6 +325,11 @@ static void ScatterGatherHelper(const iotxn_t *txn, callback callback_new_run) {
 void BlockDevice::QueueReadWriteTxn(iotxn_t* txn) {
     LTRACEF("txn %p, pflags %#x\n", txn, txn->pflags);
 
+    if (txn->opcode != IOTXN_OP_READ && txn->opcode != IOTXN_OP_WRITE) {
+        iotxn_complete(txn, MX_ERR_NOT_SUPPORTED, 0);
+        return;
+    }
+
     fbl::AutoLock lock(&lock_);
 
     bool write = (txn->opcode == IOTXN_OP_WRITE);
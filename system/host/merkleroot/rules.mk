@@ -26,9 +26,11 @@ MODULE_SRCS += \
 MODULE_HOST_LIBS := \
 	system/ulib/fbl.hostlib
 
+MODULE_HOST_SYSLIBS := -lpthread
+
 ifneq (,$(wildcard $(OPENSSL_DIR)/sha.h))
 MODULE_DEFINES += USE_LIBCRYPTO=1
-MODULE_HOST_SYSLIBS := -lcrypto
+MODULE_HOST_SYSLIBS += -lcrypto
 else
 MODULE_COMPILEFLAGS += -Ithird_party/ulib/cryptolib/include
 MODULE_SRCS += third_party/ulib/cryptolib/cryptolib.c
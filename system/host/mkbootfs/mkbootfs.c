@@ -615,6 +615,9 @@ char fill[4096];
 
 #define CHECK(w) do { if ((w) < 0) goto fail; } while (0)
 
+int finish_bootfs(int fd, item_t* item, off_t start, off_t end, size_t outsize,
+                  uint32_t flags, bool extra, uint32_t* crc);
+
 int write_bootfs(int fd, const io_ops* op, item_t* item, bool compressed, bool extra) {
     uint32_t n;
     fsentry_t* e;
@@ -709,6 +712,23 @@ fail:
         return -1;
     }
 
+    size_t wrote = (end - start) - hdrsize;
+    return finish_bootfs(fd, item, start, end,
+                         compressed ? item->outsize : wrote,
+                         compressed ? BOOTDATA_BOOTFS_FLAG_COMPRESSED : 0,
+                         extra, crc);
+}
+
+// Writes the bootdata header of a bootfs item whose payload was written
+// between start (plus the room left for the header) and end, and moves
+// on past the padding after it.
+int finish_bootfs(int fd, item_t* item, off_t start, off_t end, size_t outsize,
+                  uint32_t flags, bool extra, uint32_t* crc) {
+    size_t hdrsize = sizeof(bootdata_t);
+    if (extra) {
+        hdrsize += sizeof(bootextra_t);
+    }
+
     // pad bootdata_t records to 8 byte boundary
     size_t pad = BOOTDATA_ALIGN(end) - end;
     if (pad) {
@@ -729,8 +749,8 @@ fail:
         .type = (item->type == ITEM_BOOTFS_SYSTEM) ?
                 BOOTDATA_BOOTFS_SYSTEM : BOOTDATA_BOOTFS_BOOT,
         .length = wrote,
-        .extra = compressed ? item->outsize : wrote,
-        .flags = compressed ? BOOTDATA_BOOTFS_FLAG_COMPRESSED : 0
+        .extra = outsize,
+        .flags = flags,
     };
     if (extra) {
         boothdr.flags |= BOOTDATA_FLAG_EXTRA | BOOTDATA_FLAG_CRC32;
@@ -761,6 +781,127 @@ fail:
     return 0;
 }
 
+// Writes a bootfs item whose files are compressed one by one, so they
+// can be decompressed independently as they're needed: the bootfs header
+// and directory as they appear in the image, an index of the files' LZ4
+// frames, and then the frames.
+int write_bootfs_files(int fd, item_t* item, bool extra) {
+    uint32_t n;
+    fsentry_t* e;
+
+    size_t hdrsize = sizeof(bootdata_t);
+    if (extra) {
+        hdrsize += sizeof(bootextra_t);
+    }
+
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0) {
+        fprintf(stderr, "error: couldn't seek\n");
+        return -1;
+    }
+    off_t payload = start + hdrsize;
+    if (lseek(fd, payload, SEEK_SET) != payload) {
+        fprintf(stderr, "error: cannot seek\n");
+        return -1;
+    }
+
+    bootfs_header_t hdr = {
+        .magic = BOOTFS_MAGIC,
+        .dirsize = item->hdrsize - sizeof(bootfs_header_t),
+    };
+    CHECK(writex(fd, &hdr, sizeof(hdr)));
+    uint32_t count = 0;
+    for (e = item->first; e != NULL; e = e->next) {
+        bootfs_entry_t entry = {
+            .name_len = e->namelen,
+            .data_len = e->length,
+            .data_off = e->offset,
+        };
+        CHECK(writex(fd, &entry, sizeof(entry)));
+        CHECK(writex(fd, e->name, e->namelen));
+        if ((n = BOOTFS_ALIGN(e->namelen) - e->namelen) > 0) {
+            CHECK(writex(fd, fill, n));
+        }
+        count++;
+    }
+
+    // The index is filled in once the frames are written.
+    bootfs_index_t index = {
+        .magic = BOOTFS_INDEX_MAGIC,
+        .count = count,
+    };
+    CHECK(writex(fd, &index, sizeof(index)));
+    off_t index_off = lseek(fd, 0, SEEK_CUR);
+    bootfs_frame_t* frames = calloc(count, sizeof(bootfs_frame_t));
+    if ((index_off < 0) || ((count > 0) && (frames == NULL))) {
+        fprintf(stderr, "error: cannot write bootfs index\n");
+        free(frames);
+        return -1;
+    }
+    if (writex(fd, frames, count * sizeof(bootfs_frame_t)) < 0) {
+        goto fail_frames;
+    }
+
+    bootfs_frame_t* frame = frames;
+    for (e = item->first; e != NULL; e = e->next, frame++) {
+        if (verbose) {
+            fprintf(stderr, "%08x %08x %s\n", e->offset, e->length, e->name);
+        }
+        frame->data_off = e->offset;
+        frame->data_len = e->length;
+        if (e->length == 0) {
+            continue;
+        }
+        off_t frame_start = lseek(fd, 0, SEEK_CUR);
+        void* cookie = NULL;
+        lz4_prefs.frameInfo.contentSize = e->length;
+        if ((frame_start < 0) ||
+            (compress_setup(fd, &cookie, NULL) < 0) ||
+            (compress_file(fd, e->srcpath, e->length, cookie, NULL) < 0) ||
+            (compress_finish(fd, cookie, NULL) < 0)) {
+            goto fail_frames;
+        }
+        off_t frame_end = lseek(fd, 0, SEEK_CUR);
+        if ((frame_end < 0) || (frame_end - payload > UINT32_MAX)) {
+            fprintf(stderr, "error: bootfs too large\n");
+            goto fail_frames;
+        }
+        frame->frame_off = frame_start - payload;
+        frame->frame_len = frame_end - frame_start;
+    }
+
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    if ((end < 0) || (lseek(fd, index_off, SEEK_SET) != index_off) ||
+        (writex(fd, frames, count * sizeof(bootfs_frame_t)) < 0)) {
+        goto fail_frames;
+    }
+    free(frames);
+
+    // The payload was not written in order, so read it back for the crc.
+    uint32_t crcval = 0;
+    uint32_t* crc = NULL;
+    if (extra) {
+        crc = &crcval;
+        if ((lseek(fd, payload, SEEK_SET) != payload) ||
+            (readcrc32(fd, end - payload, crc) < 0)) {
+            fprintf(stderr, "error: cannot read back bootfs for crc\n");
+            return -1;
+        }
+    }
+    if (lseek(fd, end, SEEK_SET) != end) {
+        fprintf(stderr, "error: couldn't seek\n");
+        return -1;
+    }
+
+    return finish_bootfs(fd, item, start, end, item->outsize,
+                         BOOTDATA_BOOTFS_FLAG_FILE_COMPRESSED, extra, crc);
+
+fail_frames:
+    free(frames);
+fail:
+    return -1;
+}
+
 int write_bootitem(int fd, item_t* item, uint32_t type, size_t nulls, bool extra) {
     uint32_t* crc = NULL;
 
@@ -826,14 +967,15 @@ int write_bootitem(int fd, item_t* item, uint32_t type, size_t nulls, bool extra
     return 0;
 }
 
-int write_bootdata(const char* fn, item_t* item, bool extra) {
+int write_bootdata(const char* fn, item_t* item, bool extra, bool per_file) {
     //TODO: re-enable for debugging someday
     bool compressed = true;
 
     int fd;
     const io_ops* op = compressed ? &io_compressed : &io_plain;
 
-    fd = open(fn, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    // Read access is for computing crcs of items not written in order.
+    fd = open(fn, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     if (fd < 0) {
         fprintf(stderr, "error: cannot create '%s'\n", fn);
         return -1;
@@ -863,7 +1005,11 @@ int write_bootdata(const char* fn, item_t* item, bool extra) {
             break;
         case ITEM_BOOTFS_BOOT:
         case ITEM_BOOTFS_SYSTEM:
-            CHECK(write_bootfs(fd, op, item, compressed, extra));
+            if (compressed && per_file) {
+                CHECK(write_bootfs_files(fd, item, extra));
+            } else {
+                CHECK(write_bootfs(fd, op, item, compressed, extra));
+            }
             break;
         default:
             fprintf(stderr, "error: internal: type %08x unknown\n", item->type);
@@ -1046,6 +1192,8 @@ void usage(void) {
     "                          (multiple groups may be comma separated)\n"
     "                          (the value 'all' resets to include all groups)\n"
     "         --uncompressed   don't compress bootfs image (debug only)\n"
+    "         --compress-whole compress each bootfs image as a whole,\n"
+    "                          rather than file by file\n"
     "         --target=system  bootfs to be unpacked at /system\n"
     "         --target=boot    bootfs to be unpacked at /boot\n"
     "\n"
@@ -1063,6 +1211,7 @@ int main(int argc, char **argv) {
     const char* output_file = "user.bootfs";
 
     bool compressed = true;
+    bool per_file = true;
     bool have_kernel = false;
     bool have_cmdline = false;
     bool extra = false;
@@ -1161,6 +1310,8 @@ int main(int argc, char **argv) {
             compressed = true;
         } else if (!strcmp(cmd,"--uncompressed")) {
             compressed = false;
+        } else if (!strcmp(cmd,"--compress-whole")) {
+            per_file = false;
         } else if (!strcmp(cmd,"--target=system")) {
             system = true;
         } else if (!strcmp(cmd,"--target=boot")) {
@@ -1224,5 +1375,5 @@ int main(int argc, char **argv) {
         }
     }
 
-    return write_bootdata(output_file, first_item, extra);
+    return write_bootdata(output_file, first_item, extra, per_file);
 }
@@ -63,6 +63,11 @@
 // Flag indicating that the bootfs is compressed.
 #define BOOTDATA_BOOTFS_FLAG_COMPRESSED  (1 << 0)
 
+// Flag indicating that each file in the bootfs is compressed
+// separately, so that files can be decompressed as needed.
+// See bootfs_index_t below for the layout.
+#define BOOTDATA_BOOTFS_FLAG_FILE_COMPRESSED  (1 << 1)
+
 
 // These items are for passing from bootloader to kernel
 
@@ -235,5 +240,37 @@ typedef struct bootfs_entry {
 #define BOOTFS_RECSIZE(entry) \
     (sizeof(bootfs_entry_t) + BOOTFS_ALIGN(entry->name_len))
 
+// A bootfs with BOOTDATA_BOOTFS_FLAG_FILE_COMPRESSED is stored as:
+//   the bootfs_header_t and bootfs_entry_t's, uncompressed, exactly
+//     as they appear in the decompressed image
+//   a bootfs_index_t
+//   a bootfs_frame_t for each bootfs_entry_t, in the same order
+//   the LZ4 frames holding the contents of each file
+//
+// - frame offsets are relative to the start of the bootdata payload
+// - frames have the same restrictions as for a compressed bootfs
+// - a frame_len of 0 means the file is empty
+
+//lsw of sha256("bootfsindex")
+#define BOOTFS_INDEX_MAGIC (0x391ba5e6)
+
+typedef struct bootfs_index {
+    // magic value BOOTFS_INDEX_MAGIC
+    uint32_t magic;
+
+    // number of bootfs_frame_t's which follow
+    uint32_t count;
+} bootfs_index_t;
+
+typedef struct bootfs_frame {
+    // data_off and data_len of the file's bootfs_entry_t
+    uint32_t data_off;
+    uint32_t data_len;
+
+    // location of the LZ4 frame holding the file's contents
+    uint32_t frame_off;
+    uint32_t frame_len;
+} bootfs_frame_t;
+
 #endif
 
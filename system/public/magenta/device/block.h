@@ -61,6 +61,7 @@
 
 #define BLOCK_FLAG_READONLY 0x00000001
 #define BLOCK_FLAG_REMOVABLE 0x00000002
+#define BLOCK_FLAG_TRIM_SUPPORT 0x00000004 // Discards issued with BLOCKIO_TRIM reach the media
 
 typedef struct {
     uint64_t block_count;       // The number of blocks in this block device
@@ -163,7 +164,7 @@ IOCTL_WRAPPER_OUT(ioctl_block_fvm_query, IOCTL_BLOCK_FVM_QUERY, fvm_info_t);
 //    This response is sent once all operations either complete or a single operation fails.
 //    At this point, step (1) may begin again without reallocating the txn.
 //
-// For BLOCKIO_READ and BLOCKIO_WRITE, N may be greater than 1.
+// For BLOCKIO_READ, BLOCKIO_WRITE and BLOCKIO_TRIM, N may be greater than 1.
 // Otherwise, N == 1 (skipping step (1) in the protocol above).
 //
 // Notes:
@@ -190,11 +191,16 @@ IOCTL_WRAPPER_OUT(ioctl_block_fvm_query, IOCTL_BLOCK_FVM_QUERY, fvm_info_t);
 // 'dev_offset', into the VMO associated with 'vmoid', starting at 'vmo_offset'.
 // If the transaction is out of range, for example if 'length' is too large or if
 // 'dev_offset' is beyond the end of the device, MX_ERR_OUT_OF_RANGE is returned.
+//
+// BLOCKIO_TRIM informs the device that the 'length' bytes starting at 'dev_offset' no
+// longer hold useful data; their contents are undefined until next written. 'vmoid' and
+// 'vmo_offset' are ignored. Devices which cannot discard return MX_ERR_NOT_SUPPORTED.
 
 #define BLOCKIO_READ 0x0001      // Reads from the Block device into the VMO
 #define BLOCKIO_WRITE 0x0002     // Writes to the Block device from the VMO
 #define BLOCKIO_SYNC 0x0003      // Unimplemented
 #define BLOCKIO_CLOSE_VMO 0x0004 // Detaches the VMO from the block device; closes the handle to it.
+#define BLOCKIO_TRIM 0x0005      // Discards a range of the Block device
 #define BLOCKIO_OP_MASK 0x00FF
 
 #define BLOCKIO_TXN_END 0x0100 // Expects response after request (and all previous) have completed
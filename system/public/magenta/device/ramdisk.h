@@ -12,6 +12,8 @@
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 1)
 #define IOCTL_RAMDISK_UNLINK \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 2)
+#define IOCTL_RAMDISK_DROP_WRITES_AFTER \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 3)
 
 typedef struct ramdisk_ioctl_config {
     uint64_t blk_size;
@@ -29,3 +31,9 @@ IOCTL_WRAPPER_INOUT(ioctl_ramdisk_config, IOCTL_RAMDISK_CONFIG, ramdisk_ioctl_co
 
 // ssize_t ioctl_ramdisk_unlink(int fd);
 IOCTL_WRAPPER(ioctl_ramdisk_unlink, IOCTL_RAMDISK_UNLINK);
+
+// Simulates a power failure, for crash-consistency testing: once |in| more
+// blocks have been written, subsequent writes are discarded (while still
+// reporting success). Pass UINT64_MAX to resume persisting writes.
+// ssize_t ioctl_ramdisk_drop_writes_after(int fd, const uint64_t* in);
+IOCTL_WRAPPER_IN(ioctl_ramdisk_drop_writes_after, IOCTL_RAMDISK_DROP_WRITES_AFTER, uint64_t);
@@ -59,6 +59,16 @@
 // Return path of block device underlying the filesystem. Requires O_ADMIN.
 #define IOCTL_VFS_GET_DEVICE_PATH \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 9)
+// Returns statistics about the filesystem's in-memory cache. Fields which a
+// filesystem does not track are zero, as are limits it does not enforce.
+// Filesystems without a cache return MX_ERR_NOT_SUPPORTED.
+#define IOCTL_VFS_GET_CACHE_STATS \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 10)
+// Asks for the blob being created through this connection to be stored
+// compressed, where that saves space. Must be issued before the blob's size
+// is set. Only supported by blobstore.
+#define IOCTL_VFS_BLOB_COMPRESS \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 11)
 
 typedef struct {
     mx_handle_t channel; // Channel to which watch events will be sent
@@ -140,6 +150,29 @@ IOCTL_WRAPPER_IN(ioctl_vfs_watch_dir, IOCTL_VFS_WATCH_DIR, vfs_watch_dir_t);
 // ssize_t ioctl_vfs_get_device_path(int fd, char* out, size_t out_len);
 IOCTL_WRAPPER_VAROUT(ioctl_vfs_get_device_path, IOCTL_VFS_GET_DEVICE_PATH, char);
 
+typedef struct vfs_cache_stats {
+    // Data blocks, in units of block_size
+    uint64_t hits;            // Read from memory
+    uint64_t misses;          // Fetched from disk on behalf of a reader
+    uint64_t readahead;       // Fetched from disk ahead of a sequential reader
+    uint64_t evictions;       // Dropped from memory to stay within limit_blocks
+    uint64_t resident_blocks;
+    uint64_t limit_blocks;
+    // Vnodes
+    uint64_t vnode_hits;      // Found in memory
+    uint64_t vnode_misses;    // Loaded from the inode table
+    uint64_t vnode_count;     // Currently cached
+    uint64_t vnode_limit;
+    uint32_t block_size;
+    uint32_t reserved;
+} vfs_cache_stats_t;
+
+// ssize_t ioctl_vfs_get_cache_stats(int fd, vfs_cache_stats_t* out);
+IOCTL_WRAPPER_OUT(ioctl_vfs_get_cache_stats, IOCTL_VFS_GET_CACHE_STATS, vfs_cache_stats_t);
+
+// ssize_t ioctl_vfs_blob_compress(int fd);
+IOCTL_WRAPPER(ioctl_vfs_blob_compress, IOCTL_VFS_BLOB_COMPRESS);
+
 typedef struct {
     mx_handle_t vmo;
     char name[]; // Null-terminator required
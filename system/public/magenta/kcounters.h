@@ -0,0 +1,46 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+// Layout of the read-only VMO returned by mx_kcounters_get_vmo().
+//
+// The VMO starts with an mx_kcounters_header_t, followed at |desc_offset|
+// by |num_counters| descriptors giving the name of each counter.  The
+// counters themselves start at |counters_offset|, one array of
+// |cpu_stride| uint64_t values for each of the |num_cpus| cpus, so the
+// value of counter |i| on cpu |cpu| is the word at
+//   counters_offset + (cpu * cpu_stride + i) * sizeof(uint64_t)
+// and the counter's total is the sum over all cpus.
+//
+// The kernel updates the counters with relaxed atomic adds and never takes
+// a lock that readers could observe, so readers simply load each word.
+// Counts made very early in boot, before the VMO is set up, are dropped.
+
+#define MX_KCOUNTERS_MAGIC 0x53524e544e434b4dull // "MKCNTNRS"
+
+#define MX_KCOUNTER_NAME_LEN 56
+
+typedef struct mx_kcounters_header {
+    uint64_t magic;
+    uint32_t num_counters;
+    uint32_t num_cpus;
+    uint32_t cpu_stride;
+    uint32_t desc_offset;
+    uint32_t counters_offset;
+    uint32_t reserved;
+} mx_kcounters_header_t;
+
+typedef struct mx_kcounter_desc {
+    // Nul-terminated, e.g. "kernel.context_switches".
+    char name[MX_KCOUNTER_NAME_LEN];
+    uint64_t reserved;
+} mx_kcounter_desc_t;
+
+__END_CDECLS
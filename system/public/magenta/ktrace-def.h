@@ -10,6 +10,7 @@
 
 KTRACE_DEF(0x000,32B,VERSION,META) // version
 KTRACE_DEF(0x001,32B,TICKS_PER_MS,META) // lo32, hi32
+KTRACE_DEF(0x002,32B,NAMES_DROPPED,META) // count
 
 KTRACE_DEF(0x020,NAME,KTHREAD_NAME,META) // ktid, 0, name[]
 KTRACE_DEF(0x021,NAME,THREAD_NAME,META) // tid, pid, name[]
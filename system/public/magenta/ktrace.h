@@ -88,5 +88,6 @@ enum {
 #define KTRACE_ACTION_STOP      2 // options ignored
 #define KTRACE_ACTION_REWIND    3 // options ignored
 #define KTRACE_ACTION_NEW_PROBE 4 // options ignored, ptr = name
+#define KTRACE_ACTION_START_CIRCULAR 5 // options = grpmask, 0 = all; overwrite oldest records when full
 
 __END_CDECLS
@@ -210,6 +210,16 @@ struct mx_loader_svc_msg {
 // obtain a new loader service connection/context
 // arg=0, data[] empty, request includes channel for new connection
 
+#define LOADER_SVC_OP_LOAD_OBJECTS 9
+// arg=count, data[] count object names (each asciiz, back to back)
+// reply arg=status of the request as a whole; on success, reply data[]
+// is an int32_t status for each name and the reply includes a vmo
+// handle for each name whose status is MX_OK, in the order of the names
+// Older services reply MX_ERR_INVALID_ARGS; use LOAD_OBJECT instead.
+
+// Most object names one LOADER_SVC_OP_LOAD_OBJECTS request may carry.
+#define LOADER_SVC_LOAD_OBJECTS_MAX 64
+
 #ifdef __cplusplus
 }
 #endif
@@ -40,7 +40,8 @@ mx_status_t blobstore_check_info(const blobstore_info_t* info, uint64_t max) {
         fprintf(stderr, "blobstore: bad magic\n");
         return MX_ERR_INVALID_ARGS;
     }
-    if (info->version != kBlobstoreVersion) {
+    if ((info->version != kBlobstoreVersion) &&
+        (info->version != kBlobstoreVersionUncompressed)) {
         fprintf(stderr, "blobstore: FS Version: %08x. Driver version: %08x\n", info->version,
                 kBlobstoreVersion);
         return MX_ERR_INVALID_ARGS;
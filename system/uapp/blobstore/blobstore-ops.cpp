@@ -28,13 +28,17 @@ using digest::Digest;
 namespace blobstore {
 
 VnodeBlob::~VnodeBlob() {
-    blobstore_->ReleaseBlob(this);
+    {
+        // Blobs which were looked up, but never opened, have not been
+        // released by Close.
+        fs::AutoLock lock(&blobstore_->hash_lock_);
+        blobstore_->ReleaseBlob(this);
+    }
     if (blob_ != nullptr) {
-        block_fifo_request_t request;
-        request.txnid = blobstore_->TxnId();
-        request.vmoid = vmoid_;
-        request.opcode = BLOCKIO_CLOSE_VMO;
-        blobstore_->Txn(&request, 1);
+        blobstore_->DetachVmo(vmoid_);
+    }
+    if (compressed_ != nullptr) {
+        blobstore_->DetachVmo(compressed_vmoid_);
     }
 }
 
@@ -45,6 +49,11 @@ mx_status_t VnodeBlob::Open(uint32_t flags) {
         return MX_ERR_NOT_FILE;
     }
 
+    if (IsDirectory()) {
+        return MX_OK;
+    }
+
+    fs::AutoLock lock(&lock_);
     switch (flags & O_ACCMODE) {
     case O_WRONLY:
     case O_RDWR:
@@ -52,6 +61,30 @@ mx_status_t VnodeBlob::Open(uint32_t flags) {
             return MX_ERR_ACCESS_DENIED;
         }
     }
+
+    fs::AutoLock hash_lock(&blobstore_->hash_lock_);
+    if (GetState() == kBlobStateReleasing) {
+        return MX_ERR_NOT_FOUND;
+    }
+    if (fd_count_++ == 0) {
+        blobstore_->hash_.insert(this);
+    }
+    return MX_OK;
+}
+
+mx_status_t VnodeBlob::Close() {
+    if (IsDirectory()) {
+        return MX_OK;
+    }
+
+    // The blob is released (and freed, if it was unlinked) under hash_lock_,
+    // so that it cannot be looked up again in between.
+    fs::AutoLock lock(&lock_);
+    fs::AutoLock hash_lock(&blobstore_->hash_lock_);
+    assert(fd_count_ > 0);
+    if (--fd_count_ == 0) {
+        blobstore_->ReleaseBlob(this);
+    }
     return MX_OK;
 }
 
@@ -80,6 +113,7 @@ ssize_t VnodeBlob::Write(const void* data, size_t len, size_t off) {
     if (IsDirectory()) {
         return MX_ERR_NOT_FILE;
     }
+    fs::AutoLock lock(&lock_);
     size_t actual;
     mx_status_t status = WriteInternal(data, len, &actual);
     if (status != MX_OK) {
@@ -114,11 +148,12 @@ mx_status_t VnodeBlob::Lookup(fbl::RefPtr<fs::Vnode>* out, const char* name, siz
 }
 
 mx_status_t VnodeBlob::Getattr(vnattr_t* a) {
+    fs::AutoLock lock(&lock_);
     a->mode = IsDirectory() ? V_TYPE_DIR : V_TYPE_FILE;
     a->inode = 0;
     a->size = IsDirectory() ? 0 : SizeData();
     a->blksize = kBlobstoreBlockSize;
-    a->blkcount = blobstore_->GetNode(map_index_)->num_blocks *
+    a->blkcount = inode_.num_blocks *
                   (kBlobstoreBlockSize / VNATTR_BLKSIZE);
     a->nlink = 1;
     a->create_time = 0;
@@ -141,6 +176,11 @@ mx_status_t VnodeBlob::Create(fbl::RefPtr<fs::Vnode>* out, const char* name, siz
     if ((status = blobstore_->NewBlob(digest, &vn)) != MX_OK) {
         return status;
     }
+    // The new blob is handed back open, which also makes it visible to
+    // lookups until it is closed.
+    if ((status = vn->Open(O_RDWR)) != MX_OK) {
+        return status;
+    }
     *out = fbl::move(vn);
     return MX_OK;
 }
@@ -155,10 +195,7 @@ ssize_t VnodeBlob::Ioctl(uint32_t op, const void* in_buf, size_t in_len, void* o
             return MX_ERR_INVALID_ARGS;
         }
         vfs_query_info_t* info = static_cast<vfs_query_info_t*>(out_buf);
-        info->total_bytes = blobstore_->info_.block_count * blobstore_->info_.block_size;
-        info->used_bytes = blobstore_->info_.alloc_block_count * blobstore_->info_.block_size;
-        info->total_nodes = blobstore_->info_.inode_count;
-        info->used_nodes = blobstore_->info_.alloc_inode_count;
+        blobstore_->GetUsage(info);
         memcpy(info->name, kFsName, strlen(kFsName));
         return sizeof(vfs_query_info_t) + strlen(kFsName);
     }
@@ -169,6 +206,24 @@ ssize_t VnodeBlob::Ioctl(uint32_t op, const void* in_buf, size_t in_len, void* o
         }
         return blobstore_->Unmount();
     }
+    case IOCTL_VFS_GET_CACHE_STATS: {
+        if (out_len < sizeof(vfs_cache_stats_t)) {
+            return MX_ERR_INVALID_ARGS;
+        }
+        blobstore_->GetCacheStats(static_cast<vfs_cache_stats_t*>(out_buf));
+        return sizeof(vfs_cache_stats_t);
+    }
+    case IOCTL_VFS_BLOB_COMPRESS: {
+        if (IsDirectory()) {
+            return MX_ERR_NOT_FILE;
+        }
+        fs::AutoLock lock(&lock_);
+        if (GetState() != kBlobStateEmpty) {
+            return MX_ERR_BAD_STATE;
+        }
+        flags_ |= kBlobFlagCompress;
+        return MX_OK;
+    }
 #ifdef __Fuchsia__
     case IOCTL_VFS_GET_DEVICE_PATH: {
         ssize_t len = ioctl_device_get_topo_path(blobstore_->blockfd_, static_cast<char*>(out_buf), out_len);
@@ -190,6 +245,7 @@ mx_status_t VnodeBlob::Truncate(size_t len) {
     if (IsDirectory()) {
         return MX_ERR_NOT_SUPPORTED;
     }
+    fs::AutoLock lock(&lock_);
 
     return SpaceAllocate(len);
 }
@@ -208,6 +264,7 @@ mx_status_t VnodeBlob::Unlink(const char* name, size_t len, bool must_be_dir) {
     } else if ((status = blobstore_->LookupBlob(digest, &out)) < 0) {
         return status;
     }
+    fs::AutoLock lock(&out->lock_);
     out->QueueUnlink();
     return MX_OK;
 }
@@ -219,11 +276,12 @@ mx_status_t VnodeBlob::Mmap(int flags, size_t len, size_t* off, mx_handle_t* out
     if (flags & MXIO_MMAP_FLAG_WRITE) {
         return MX_ERR_NOT_SUPPORTED;
     }
+    fs::AutoLock lock(&lock_);
 
     mx_rights_t rights = MX_RIGHT_TRANSFER | MX_RIGHT_MAP;
     rights |= (flags & MXIO_MMAP_FLAG_READ) ? MX_RIGHT_READ : 0;
     rights |= (flags & MXIO_MMAP_FLAG_EXEC) ? MX_RIGHT_EXECUTE : 0;
-    return CopyVmo(rights, out);
+    return CopyVmo(rights, len, off, out);
 }
 
 mx_status_t VnodeBlob::Sync() {
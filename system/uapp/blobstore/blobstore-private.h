@@ -9,15 +9,20 @@
 #include <string.h>
 
 #include <bitmap/raw-bitmap.h>
+#include <bitmap/storage.h>
 #include <digest/digest.h>
 #include <fbl/algorithm.h>
+#include <fbl/array.h>
+#include <fbl/atomic.h>
 #include <fbl/macros.h>
 #include <fbl/ref_counted.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
 
 #include <fs/block-txn.h>
+#include <fs/locking.h>
 #include <fs/vfs.h>
+#include <magenta/device/vfs.h>
 
 #ifdef __Fuchsia__
 #include <block-client/client.h>
@@ -55,6 +60,7 @@ constexpr BlobFlags kBlobStateMask        = 0x00FF0000;
 constexpr BlobFlags kBlobFlagSync         = 0x01000000; // The blob is being written to disk
 constexpr BlobFlags kBlobFlagDeletable    = 0x02000000; // This node should be unlinked when closed
 constexpr BlobFlags kBlobFlagDirectory    = 0x04000000; // This node represents the root directory
+constexpr BlobFlags kBlobFlagCompress     = 0x08000000; // Store compressed if that saves space
 constexpr BlobFlags kBlobOtherMask        = 0xFF000000;
 
 // clang-format on
@@ -62,6 +68,12 @@ constexpr BlobFlags kBlobOtherMask        = 0xFF000000;
 static_assert(((kBlobStateMask | kBlobOtherMask) & VFS_FLAG_RESERVED_MASK) == 0,
               "Blobstore flags conflict with VFS-reserved flags");
 
+// Blob data is read from disk, and verified, as it is accessed. Sequential
+// readers fetch up to this many blocks past the end of each read, starting
+// with kBlobstoreReadAheadMin blocks and doubling on each subsequent miss.
+constexpr uint64_t kBlobstoreReadAheadMin = 4;
+constexpr uint64_t kBlobstoreReadAheadMax = 128;
+
 #ifdef __Fuchsia__
 
 class VnodeBlob final : public fs::Vnode {
@@ -102,14 +114,21 @@ public:
 
     uint64_t SizeData() const;
 
+    bool IsCompressed() const;
+
     // Constructs the "directory" blob
     VnodeBlob(fbl::RefPtr<Blobstore> bs);
     // Constructs actual blobs
     VnodeBlob(fbl::RefPtr<Blobstore> bs, const Digest& digest);
     virtual ~VnodeBlob();
 
+    // Guards the state of the blob: its flags, VMOs, and in-memory node.
+    // Acquired before any of the Blobstore locks.
+    fs::Mutex lock_{};
+
 private:
     friend struct TypeWavlTraits;
+    friend class Blobstore;
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VnodeBlob);
 
@@ -122,7 +141,10 @@ private:
     // Otherwise, returns size of the handle.
     mx_status_t GetReadableEvent(mx_handle_t* out);
 
-    mx_status_t CopyVmo(mx_rights_t rights, mx_handle_t* out);
+    // Returns a copy-on-write clone of the (verified) blob data covering
+    // [*off, *off + len). On return, |*off| is relative to the start of the
+    // clone.
+    mx_status_t CopyVmo(mx_rights_t rights, size_t len, size_t* off, mx_handle_t* out);
 
     void QueueUnlink();
 
@@ -153,16 +175,42 @@ private:
     mx_status_t Unlink(const char* name, size_t len, bool must_be_dir) final;
     mx_status_t Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) final;
     mx_status_t Sync() final;
+    mx_status_t Close() final;
 
-    // Read both VMOs into memory, if we haven't already.
+    // Creates the blob VMO and reads the Merkle tree into it, if we haven't
+    // already. Blob data is read on demand, by LoadData.
     //
     // TODO(smklein): When we have can register the Blob Store as a pager
     // service, and it can properly handle pages faults on a vnode's contents,
-    // then we can avoid reading the entire blob up-front. Until then, read
-    // the contents of a VMO into memory when it is opened.
+    // then the kernel can fault in (and we can verify) individual pages.
     mx_status_t InitVmos();
 
+    // Ensures the blob data in [off, off + len) is in memory, and has been
+    // verified against the Merkle tree.
+    mx_status_t LoadData(uint64_t off, uint64_t len);
+
+    // Returns how many data blocks in [start, end) have not been verified.
+    uint64_t CountUnverified(uint64_t start, uint64_t end) const;
+
+    // Reads and decompresses the chunks holding data blocks [*start, *end)
+    // into scratch_, widening the range to the chunks' boundaries.
+    mx_status_t LoadCompressed(uint64_t* start, uint64_t* end);
+
+    // Compresses the blob data into compressed_, returning the number of
+    // blocks it occupies. Returns MX_ERR_BUFFER_TOO_SMALL if compression
+    // would not save at least one block.
+    mx_status_t Compress(uint64_t* blocks_out);
+
+    // Whether the blob is to be stored compressed: its writer asked for it
+    // (IOCTL_VFS_BLOB_COMPRESS), the volume supports it, and the blob is of a
+    // compressible size. Such blobs are written out once all of their data
+    // has arrived, rather than as it arrives.
+    bool ShouldCompress() const;
+
     mx_status_t WriteShared(WriteTxn* txn, size_t start, size_t len, uint64_t start_block);
+    // Writes out the blob data once all of it has been written to the VMO,
+    // compressed if that saves space.
+    mx_status_t WriteData(WriteTxn* txn);
     // Called by Blob once the last write has completed, updating the
     // on-disk metadata.
     mx_status_t WriteMetadata();
@@ -176,12 +224,37 @@ private:
     const fbl::RefPtr<Blobstore> blobstore_;
     BlobFlags flags_;
 
+    // Connections open to the blob; guarded by |Blobstore::hash_lock_|.
+    uint32_t fd_count_{};
+
+    // The blob's node. Kept apart from the node map, which may be resized
+    // underneath it, and copied into it once the blob has been written.
+    blobstore_inode_t inode_{};
+
     // The blob_ here consists of:
     // 1) The Merkle Tree
     // 2) The Blob itself, aligned to the nearest kBlobstoreBlockSize
     fbl::unique_ptr<MappedVmo> blob_{};
     vmoid_t vmoid_{};
 
+    // For compressed blobs: the chunk table, and a VMO into which
+    // compressed data is read before it is decompressed into scratch_.
+    fbl::Array<uint32_t> chunk_table_{};
+    fbl::unique_ptr<MappedVmo> compressed_{};
+    vmoid_t compressed_vmoid_{};
+
+    // Holds data blocks, at their offsets within the blob data, between
+    // being read and being verified and copied into blob_.
+    fbl::unique_ptr<MappedVmo> scratch_{};
+    vmoid_t scratch_vmoid_{};
+
+    // Data blocks of blob_ which have been read and verified.
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> verified_{};
+    // Read-ahead window (in blocks) and the block at which the next
+    // sequential read is expected to start.
+    uint64_t readahead_{};
+    uint64_t readahead_next_{};
+
     mx::event readable_event_{};
     uint64_t bytes_written_{};
     uint8_t digest_[Digest::kLength]{};
@@ -223,23 +296,27 @@ public:
     // 'out' may be null -- the same error code will be returned as if it
     // was a valid pointer.
     //
-    // If 'out' is not null, then the blob's  will be added to the
-    // "quick lookup" map if it was not there already.
+    // Blobs are added to the "quick lookup" map when they are opened, and
+    // removed when they are last closed.
     mx_status_t LookupBlob(const Digest& digest, fbl::RefPtr<VnodeBlob>* out);
 
     // Creates a new blob in-memory, with no backing disk storage (yet).
     // If a blob with the name already exists, this function fails.
     //
-    // Adds Blob to the "quick lookup" map.
+    // The blob is added to the "quick lookup" map once it is opened.
     mx_status_t NewBlob(const Digest& digest, fbl::RefPtr<VnodeBlob>* out);
 
-    // Removes blob from 'active' hashmap.
+    // Removes blob from 'active' hashmap, and frees its node and blocks if
+    // it was unlinked or never completely written.
+    // Requires |hash_lock_|.
     mx_status_t ReleaseBlob(VnodeBlob* blob);
 
     mx_status_t Readdir(void* cookie, void* dirents, size_t len);
 
     mx_status_t AttachVmo(mx_handle_t vmo, vmoid_t* out);
+    mx_status_t DetachVmo(vmoid_t vmoid);
     mx_status_t Txn(block_fifo_request_t* requests, size_t count) {
+        fs::AutoLock lock(&fifo_lock_);
         return block_fifo_txn(fifo_client_, requests, count);
     }
     txnid_t TxnId() const { return txnid_; }
@@ -250,7 +327,15 @@ public:
     // Add enough slices required to hold nblocks additional blocks.
     mx_status_t AddBlocks(size_t nblocks);
 
+    // Reports how reads of blob data have been served. Blob data stays in
+    // memory while the blob is open, so there are no limits or evictions.
+    void GetCacheStats(vfs_cache_stats_t* out) const;
+
+    // Reports the space and nodes in use.
+    void GetUsage(vfs_query_info_t* out) const;
+
     int blockfd_;
+    // Fields which change after mount are guarded by |alloc_lock_|.
     blobstore_info_t info_;
 
 private:
@@ -259,6 +344,8 @@ private:
     Blobstore(int fd, const blobstore_info_t* info);
     mx_status_t LoadBitmaps();
 
+    // The following require |alloc_lock_|, and do not acquire it.
+
     // Finds space for a block in memory. Does not update disk.
     mx_status_t AllocateBlocks(size_t nblocks, size_t* blkno_out);
     void FreeBlocks(size_t nblocks, size_t blkno);
@@ -274,22 +361,44 @@ private:
     // write out the bitmap to disk for the corresponding blocks.
     mx_status_t WriteBitmap(WriteTxn* txn, uint64_t nblocks, uint64_t start_block);
 
+    // Lets the device discard freed blocks, once |txn| has written the
+    // bitmap which frees them. Does nothing if the device cannot discard.
+    void TrimBlocks(WriteTxn* txn, uint64_t nblocks, uint64_t start_block);
+
     // Given a node within the node map at an index, write it to disk.
     mx_status_t WriteNode(WriteTxn* txn, size_t map_index);
 
     // Enqueues an update for allocated inode/block counts
     mx_status_t CountUpdate(WriteTxn* txn);
 
-    // VnodeBlobs exist in the WAVLTree as long as one or more reference exists;
-    // when the Vnode is deleted, it is immediately removed from the WAVL tree.
+    // VnodeBlobs exist in the WAVLTree while they are open; the last Close
+    // removes them. Since each open connection holds a reference, a blob
+    // found here may always be referenced again.
     using WAVLTreeByMerkle = fbl::WAVLTree<const uint8_t*,
                                             VnodeBlob*,
                                             MerkleRootTraits,
                                             VnodeBlob::TypeWavlTraits>;
     WAVLTreeByMerkle hash_{}; // Map of all 'in use' blobs
 
+    // Blocks of blob data served from memory, read on behalf of a reader,
+    // and read ahead of a sequential reader.
+    fbl::atomic<uint64_t> cache_hits_{};
+    fbl::atomic<uint64_t> cache_misses_{};
+    fbl::atomic<uint64_t> cache_readahead_{};
+
+    // Lock order: VnodeBlob::lock_, hash_lock_, alloc_lock_, fifo_lock_.
+    //
+    // Guards hash_, and the open counts of the blobs.
+    mutable fs::Mutex hash_lock_{};
+    // Guards the block map, the node map, and info_.
+    mutable fs::Mutex alloc_lock_{};
+    // Blobs issue transactions concurrently, but they all share txnid_, so
+    // each must run to completion before the next is sent.
+    fs::Mutex fifo_lock_{};
+
     fifo_client_t* fifo_client_{};
     txnid_t txnid_{};
+    bool trim_{};
     RawBitmap block_map_{};
     vmoid_t block_map_vmoid_{};
     fbl::unique_ptr<MappedVmo> node_map_{};
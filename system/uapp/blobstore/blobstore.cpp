@@ -19,6 +19,7 @@
 #include <fbl/alloc_checker.h>
 #include <fbl/limits.h>
 #include <fbl/ref_ptr.h>
+#include <lz4/lz4.h>
 
 #define MXDEBUG 0
 
@@ -65,7 +66,7 @@ mx_status_t VnodeBlob::InitVmos() {
     }
 
     mx_status_t status;
-    blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    blobstore_inode_t* inode = &inode_;
 
     uint64_t num_blocks = BlobDataBlocks(*inode) + MerkleTreeBlocks(*inode);
     if ((status = MappedVmo::Create(num_blocks * kBlobstoreBlockSize, "blob", &blob_)) != MX_OK) {
@@ -73,25 +74,239 @@ mx_status_t VnodeBlob::InitVmos() {
         BlobCloseHandles();
         return status;
     }
+    if ((status = verified_.Reset(BlobDataBlocks(*inode))) != MX_OK) {
+        BlobCloseHandles();
+        return status;
+    }
     if ((status = blobstore_->AttachVmo(blob_->GetVmo(), &vmoid_)) != MX_OK) {
         FS_TRACE_ERROR("Failed to attach VMO to block device; error: %d\n", status);
         BlobCloseHandles();
         return status;
     }
 
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
     ReadTxn txn(blobstore_.get());
-    txn.Enqueue(vmoid_, 0, inode->start_block, BlobDataBlocks(*inode) + MerkleTreeBlocks(*inode));
-    return txn.Flush();
+    if (merkle_blocks > 0) {
+        txn.Enqueue(vmoid_, 0, inode->start_block, merkle_blocks);
+    }
+    if (IsCompressed()) {
+        // Read the chunk table along with the Merkle tree.
+        const uint64_t compressed_size = (inode->num_blocks - merkle_blocks) * kBlobstoreBlockSize;
+        const uint64_t table_size = BlobCompressedChunks(*inode) * sizeof(uint32_t);
+        const uint64_t table_blocks = fbl::roundup(table_size, kBlobstoreBlockSize) /
+                                      kBlobstoreBlockSize;
+        fbl::AllocChecker ac;
+        chunk_table_.reset(new (&ac) uint32_t[BlobCompressedChunks(*inode)],
+                           BlobCompressedChunks(*inode));
+        if (!ac.check()) {
+            BlobCloseHandles();
+            return MX_ERR_NO_MEMORY;
+        }
+        if ((status = MappedVmo::Create(compressed_size, "blob-compressed",
+                                        &compressed_)) != MX_OK) {
+            BlobCloseHandles();
+            return status;
+        }
+        if ((status = blobstore_->AttachVmo(compressed_->GetVmo(), &compressed_vmoid_)) != MX_OK) {
+            compressed_ = nullptr;
+            BlobCloseHandles();
+            return status;
+        }
+        txn.Enqueue(compressed_vmoid_, 0, inode->start_block + merkle_blocks, table_blocks);
+        if ((status = txn.Flush()) != MX_OK) {
+            BlobCloseHandles();
+            return status;
+        }
+
+        // The table is not covered by the Merkle tree. Each chunk is checked
+        // to lie within the compressed data and to be no larger than the data
+        // it holds, so that decompression stays in bounds; a table which
+        // passes these checks but was tampered with yields data which fails
+        // verification against the Merkle tree.
+        memcpy(chunk_table_.get(), compressed_->GetData(), table_size);
+        uint64_t prev = table_size;
+        for (size_t i = 0; i < chunk_table_.size(); i++) {
+            const uint64_t out_len = fbl::min(static_cast<uint64_t>(kBlobstoreCompressChunkSize),
+                                              inode->blob_size - i * kBlobstoreCompressChunkSize);
+            if ((chunk_table_[i] <= prev) || (chunk_table_[i] - prev > out_len) ||
+                (chunk_table_[i] > compressed_size)) {
+                FS_TRACE_ERROR("blobstore: Corrupt chunk table\n");
+                BlobCloseHandles();
+                return MX_ERR_IO_DATA_INTEGRITY;
+            }
+            prev = chunk_table_[i];
+        }
+        // The chunks fill exactly the blocks allocated to them.
+        if (fbl::roundup(prev, kBlobstoreBlockSize) != compressed_size) {
+            FS_TRACE_ERROR("blobstore: Corrupt chunk table\n");
+            BlobCloseHandles();
+            return MX_ERR_IO_DATA_INTEGRITY;
+        }
+        mx_vmo_op_range(compressed_->GetVmo(), MX_VMO_OP_DECOMMIT, 0,
+                        table_blocks * kBlobstoreBlockSize, nullptr, 0);
+        return MX_OK;
+    }
+    if ((status = txn.Flush()) != MX_OK) {
+        BlobCloseHandles();
+    }
+    return status;
+}
+
+mx_status_t VnodeBlob::LoadCompressed(uint64_t* start, uint64_t* end) {
+    auto inode = &inode_;
+    constexpr uint64_t kChunkBlocks = kBlobstoreCompressChunkSize / kBlobstoreBlockSize;
+    const uint64_t first = *start / kChunkBlocks;
+    const uint64_t last = fbl::roundup(*end, kChunkBlocks) / kChunkBlocks;
+    *start = first * kChunkBlocks;
+    *end = fbl::min(last * kChunkBlocks, BlobDataBlocks(*inode));
+
+    const uint64_t table_size = chunk_table_.size() * sizeof(uint32_t);
+    auto chunk_start = [this, table_size](uint64_t chunk) -> uint64_t {
+        return (chunk == 0) ? table_size : chunk_table_[chunk - 1];
+    };
+    const uint64_t bstart = chunk_start(first) / kBlobstoreBlockSize;
+    const uint64_t bend = fbl::roundup(static_cast<uint64_t>(chunk_table_[last - 1]),
+                                       kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    ReadTxn txn(blobstore_.get());
+    txn.Enqueue(compressed_vmoid_, bstart, inode->start_block + merkle_blocks + bstart,
+                bend - bstart);
+    mx_status_t status;
+    if ((status = txn.Flush()) != MX_OK) {
+        return status;
+    }
+
+    const char* in = static_cast<const char*>(compressed_->GetData());
+    char* out = static_cast<char*>(scratch_->GetData());
+    for (uint64_t chunk = first; chunk < last; chunk++) {
+        const uint64_t in_off = chunk_start(chunk);
+        const uint64_t in_len = chunk_table_[chunk] - in_off;
+        const uint64_t out_off = chunk * kBlobstoreCompressChunkSize;
+        const uint64_t out_len = fbl::min(static_cast<uint64_t>(kBlobstoreCompressChunkSize),
+                                          inode->blob_size - out_off);
+        if (in_len == out_len) {
+            memcpy(out + out_off, in + in_off, out_len);
+        } else if (LZ4_decompress_safe(in + in_off, out + out_off, static_cast<int>(in_len),
+                                       static_cast<int>(out_len)) !=
+                   static_cast<int>(out_len)) {
+            status = MX_ERR_IO_DATA_INTEGRITY;
+            break;
+        }
+    }
+
+    // The compressed data is of no further use once decompressed.
+    mx_vmo_op_range(compressed_->GetVmo(), MX_VMO_OP_DECOMMIT, bstart * kBlobstoreBlockSize,
+                    (bend - bstart) * kBlobstoreBlockSize, nullptr, 0);
+    return status;
+}
+
+uint64_t VnodeBlob::CountUnverified(uint64_t start, uint64_t end) const {
+    uint64_t count = 0;
+    for (uint64_t run = verified_.Scan(start, end, true); run < end;) {
+        const uint64_t run_end = verified_.Scan(run, end, false);
+        count += run_end - run;
+        run = verified_.Scan(run_end, end, true);
+    }
+    return count;
+}
+
+mx_status_t VnodeBlob::LoadData(uint64_t off, uint64_t len) {
+    auto inode = &inode_;
+    uint64_t start = off / kBlobstoreBlockSize;
+    uint64_t end = fbl::roundup(off + len, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+
+    // A read which picks up where the last one left off (possibly within the
+    // same block) grows the read-ahead window; any other read resets it.
+    bool sequential = (start == readahead_next_) || (start + 1 == readahead_next_);
+    readahead_next_ = end;
+    size_t first_unverified;
+    if (verified_.Get(start, end, &first_unverified)) {
+        blobstore_->cache_hits_.fetch_add(end - start);
+        return MX_OK;
+    }
+    if (sequential) {
+        readahead_ = (readahead_ == 0) ? kBlobstoreReadAheadMin :
+                                         fbl::min(readahead_ * 2, kBlobstoreReadAheadMax);
+    } else {
+        readahead_ = 0;
+    }
+    const uint64_t requested = end - start;
+    const uint64_t missed = CountUnverified(first_unverified, end);
+    blobstore_->cache_hits_.fetch_add(requested - missed);
+    blobstore_->cache_misses_.fetch_add(missed);
+    start = first_unverified;
+    const uint64_t requested_end = end;
+    end = fbl::min(end + readahead_, BlobDataBlocks(*inode));
+    if (end > requested_end) {
+        blobstore_->cache_readahead_.fetch_add(CountUnverified(requested_end, end));
+    }
+
+    // Data is read (and decompressed) into scratch_ at the same offsets it
+    // has in the blob, and only copied into blob_, which may already be
+    // mapped by clients, once it has been verified.
+    mx_status_t status;
+    if (scratch_ == nullptr) {
+        if ((status = MappedVmo::Create(BlobDataBlocks(*inode) * kBlobstoreBlockSize,
+                                        "blob-scratch", &scratch_)) != MX_OK) {
+            return status;
+        }
+        if ((status = blobstore_->AttachVmo(scratch_->GetVmo(), &scratch_vmoid_)) != MX_OK) {
+            scratch_ = nullptr;
+            return status;
+        }
+    }
+    if (IsCompressed()) {
+        status = LoadCompressed(&start, &end);
+    } else {
+        const uint64_t data_start = inode->start_block + MerkleTreeBlocks(*inode);
+        ReadTxn txn(blobstore_.get());
+        for (uint64_t run = start; run < end;) {
+            const uint64_t run_end = verified_.Scan(run, end, false);
+            txn.Enqueue(scratch_vmoid_, run, data_start + run, run_end - run);
+            run = verified_.Scan(run_end, end, true);
+        }
+        status = txn.Flush();
+    }
+
+    // Only the runs of blocks which were not verified already are checked,
+    // and only the Merkle tree nodes on the paths from them to the root.
+    Digest d;
+    d = ((const uint8_t*)&digest_[0]);
+    for (uint64_t run = start; (status == MX_OK) && (run < end);) {
+        const uint64_t run_end = verified_.Scan(run, end, false);
+        const uint64_t data_off = run * kBlobstoreBlockSize;
+        const uint64_t data_len = fbl::min(run_end * kBlobstoreBlockSize, inode->blob_size) -
+                                  data_off;
+        const uint8_t* data = static_cast<const uint8_t*>(scratch_->GetData());
+        status = MerkleTree::Verify(data, inode->blob_size, GetMerkle(),
+                                    MerkleTree::GetTreeLength(inode->blob_size),
+                                    data_off, data_len, d);
+        if (status == MX_OK) {
+            memcpy(static_cast<uint8_t*>(GetData()) + data_off, data + data_off, data_len);
+            status = verified_.Set(run, run_end);
+        }
+        run = verified_.Scan(run_end, end, true);
+    }
+
+    mx_vmo_op_range(scratch_->GetVmo(), MX_VMO_OP_DECOMMIT, start * kBlobstoreBlockSize,
+                    (end - start) * kBlobstoreBlockSize, nullptr, 0);
+    return status;
 }
 
 uint64_t VnodeBlob::SizeData() const {
     if (GetState() == kBlobStateReadable) {
-        auto inode = blobstore_->GetNode(map_index_);
+        auto inode = &inode_;
         return inode->blob_size;
     }
     return 0;
 }
 
+bool VnodeBlob::IsCompressed() const {
+    // Older volumes never set inode flags.
+    return (blobstore_->info_.version >= kBlobstoreVersion) &&
+           (inode_.flags & kBlobstoreInodeFlagCompressed);
+}
+
 VnodeBlob::VnodeBlob(fbl::RefPtr<Blobstore> bs, const Digest& digest)
     : blobstore_(fbl::move(bs)),
       flags_(kBlobStateEmpty) {
@@ -104,6 +319,15 @@ VnodeBlob::VnodeBlob(fbl::RefPtr<Blobstore> bs)
       flags_(kBlobStateEmpty | kBlobFlagDirectory) {}
 
 void VnodeBlob::BlobCloseHandles() {
+    if (compressed_ != nullptr) {
+        blobstore_->DetachVmo(compressed_vmoid_);
+        compressed_ = nullptr;
+    }
+    if (scratch_ != nullptr) {
+        blobstore_->DetachVmo(scratch_vmoid_);
+        scratch_ = nullptr;
+    }
+    chunk_table_.reset();
     blob_ = nullptr;
     readable_event_.reset();
 }
@@ -118,14 +342,20 @@ mx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
 
     // Find a free node, mark it as reserved.
     mx_status_t status;
-    if ((status = blobstore_->AllocateNode(&map_index_)) != MX_OK) {
+    {
+        fs::AutoLock lock(&blobstore_->alloc_lock_);
+        status = blobstore_->AllocateNode(&map_index_);
+    }
+    if (status != MX_OK) {
         return status;
     }
 
-    // Initialize the inode with known fields
-    blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    // Initialize the inode with known fields. The node map only sees them
+    // once the blob has been written.
+    blobstore_inode_t* inode = &inode_;
     memset(inode->merkle_root_hash, 0, Digest::kLength);
     inode->blob_size = size_data;
+    inode->flags = 0;
     inode->num_blocks = MerkleTreeBlocks(*inode) + BlobDataBlocks(*inode);
 
     // Open VMOs, so we can begin writing after allocate succeeds.
@@ -137,7 +367,11 @@ mx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
     }
 
     // Allocate space for the blob
-    if ((status = blobstore_->AllocateBlocks(inode->num_blocks, &inode->start_block)) != MX_OK) {
+    {
+        fs::AutoLock lock(&blobstore_->alloc_lock_);
+        status = blobstore_->AllocateBlocks(inode->num_blocks, &inode->start_block);
+    }
+    if (status != MX_OK) {
         goto fail;
     }
 
@@ -146,6 +380,7 @@ mx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
 
 fail:
     BlobCloseHandles();
+    fs::AutoLock lock(&blobstore_->alloc_lock_);
     blobstore_->FreeNode(map_index_);
     return status;
 }
@@ -160,8 +395,117 @@ mx_status_t VnodeBlob::WriteShared(WriteTxn* txn, size_t start, size_t len, uint
     return txn->Flush();
 }
 
+namespace {
+
+// Blobs smaller than this could not be stored in fewer blocks.
+constexpr uint64_t kCompressMinSize = 2 * kBlobstoreBlockSize;
+
+// Whether a blob is of a size which may be stored compressed.
+bool Compressible(const blobstore_inode_t& inode) {
+    return (inode.blob_size >= kCompressMinSize) &&
+           (inode.blob_size <= fbl::numeric_limits<uint32_t>::max());
+}
+
+} // namespace
+
+bool VnodeBlob::ShouldCompress() const {
+    return (flags_ & kBlobFlagCompress) &&
+           (blobstore_->info_.version >= kBlobstoreVersion) && Compressible(inode_);
+}
+
+mx_status_t VnodeBlob::Compress(uint64_t* blocks_out) {
+    auto inode = &inode_;
+    const uint64_t chunks = BlobCompressedChunks(*inode);
+    const uint64_t table_size = chunks * sizeof(uint32_t);
+    const uint64_t capacity = (BlobDataBlocks(*inode) - 1) * kBlobstoreBlockSize;
+    if (table_size >= capacity) {
+        return MX_ERR_BUFFER_TOO_SMALL;
+    }
+
+    fbl::AllocChecker ac;
+    fbl::Array<uint32_t> table(new (&ac) uint32_t[chunks], chunks);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    fbl::unique_ptr<MappedVmo> vmo;
+    mx_status_t status;
+    if ((status = MappedVmo::Create(capacity, "blob-compressed", &vmo)) != MX_OK) {
+        return status;
+    }
+
+    const char* in = static_cast<const char*>(GetData());
+    char* out = static_cast<char*>(vmo->GetData());
+    uint64_t pos = table_size;
+    for (uint64_t chunk = 0; chunk < chunks; chunk++) {
+        const uint64_t in_off = chunk * kBlobstoreCompressChunkSize;
+        const uint64_t in_len = fbl::min(static_cast<uint64_t>(kBlobstoreCompressChunkSize),
+                                         inode->blob_size - in_off);
+        const uint64_t avail = capacity - pos;
+        // Compressed chunks must be strictly smaller than the original, so
+        // that stored chunks can be told apart by their length.
+        int len = LZ4_compress_default(in + in_off, out + pos, static_cast<int>(in_len),
+                                       static_cast<int>(fbl::min(avail, in_len - 1)));
+        if (len <= 0) {
+            if (avail < in_len) {
+                return MX_ERR_BUFFER_TOO_SMALL;
+            }
+            memcpy(out + pos, in + in_off, in_len);
+            len = static_cast<int>(in_len);
+        }
+        pos += len;
+        table[chunk] = static_cast<uint32_t>(pos);
+    }
+    memcpy(out, table.get(), table_size);
+
+    if ((status = blobstore_->AttachVmo(vmo->GetVmo(), &compressed_vmoid_)) != MX_OK) {
+        return status;
+    }
+    compressed_ = fbl::move(vmo);
+    chunk_table_ = fbl::move(table);
+    *blocks_out = fbl::roundup(pos, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    return MX_OK;
+}
+
+mx_status_t VnodeBlob::WriteData(WriteTxn* txn) {
+    auto inode = &inode_;
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    const uint64_t data_blocks = BlobDataBlocks(*inode);
+    uint64_t compressed_blocks;
+    mx_status_t status = Compress(&compressed_blocks);
+    if (status == MX_ERR_BUFFER_TOO_SMALL) {
+        return WriteShared(txn, merkle_blocks * kBlobstoreBlockSize, inode->blob_size,
+                           inode->start_block);
+    } else if (status != MX_OK) {
+        return status;
+    }
+
+    txn->Enqueue(compressed_vmoid_, 0, inode->start_block + merkle_blocks, compressed_blocks);
+    status = txn->Flush();
+    // All of the data is verified and in memory; the compressed copy is only
+    // needed again if the blob is reopened.
+    blobstore_->DetachVmo(compressed_vmoid_);
+    compressed_ = nullptr;
+    if (status != MX_OK) {
+        return status;
+    }
+
+    // Give back the blocks reserved for the uncompressed data which were not
+    // needed after all. They are discarded before another blob may take them.
+    const uint64_t unused_start = inode->start_block + merkle_blocks + compressed_blocks;
+    const uint64_t unused_blocks = data_blocks - compressed_blocks;
+    fs::AutoLock lock(&blobstore_->alloc_lock_);
+    blobstore_->FreeBlocks(unused_blocks, unused_start);
+    inode->num_blocks = merkle_blocks + compressed_blocks;
+    inode->flags |= kBlobstoreInodeFlagCompressed;
+    if ((status = blobstore_->WriteBitmap(txn, unused_blocks, unused_start)) != MX_OK) {
+        return status;
+    }
+    blobstore_->TrimBlocks(txn, unused_blocks, unused_start);
+    return txn->Flush();
+}
+
 void* VnodeBlob::GetData() const {
-    auto inode = blobstore_->GetNode(map_index_);
+    auto inode = &inode_;
     return fs::GetBlock<kBlobstoreBlockSize>(blob_->GetData(),
                                              MerkleTreeBlocks(*inode));
 }
@@ -190,12 +534,11 @@ mx_status_t VnodeBlob::WriteMetadata() {
     // This 'kBlobFlagSync' is currently not used, but it indicates when the sync is
     // complete.
     flags_ |= kBlobFlagSync;
-    auto inode = blobstore_->GetNode(map_index_);
-
+    fs::AutoLock lock(&blobstore_->alloc_lock_);
     WriteTxn txn(blobstore_.get());
 
     // Write block allocation bitmap
-    if (blobstore_->WriteBitmap(&txn, inode->num_blocks, inode->start_block) != MX_OK) {
+    if (blobstore_->WriteBitmap(&txn, inode_.num_blocks, inode_.start_block) != MX_OK) {
         return MX_ERR_IO;
     }
 
@@ -203,9 +546,10 @@ mx_status_t VnodeBlob::WriteMetadata() {
     fsync(blobstore_->blockfd_);
 
     // Update the on-disk hash
-    memcpy(inode->merkle_root_hash, &digest_[0], Digest::kLength);
+    memcpy(inode_.merkle_root_hash, &digest_[0], Digest::kLength);
 
     // Write back the blob node
+    memcpy(blobstore_->GetNode(map_index_), &inode_, sizeof(inode_));
     if (blobstore_->WriteNode(&txn, map_index_)) {
         return MX_ERR_IO;
     }
@@ -222,7 +566,7 @@ mx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
     }
 
     WriteTxn txn(blobstore_.get());
-    auto inode = blobstore_->GetNode(map_index_);
+    auto inode = &inode_;
     const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     if (GetState() == kBlobStateDataWrite) {
         size_t to_write = fbl::min(len, inode->blob_size - bytes_written_);
@@ -232,10 +576,13 @@ mx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             return status;
         }
 
-        status = WriteShared(&txn, offset, len, inode->start_block);
-        if (status != MX_OK) {
-            SetState(kBlobStateError);
-            return status;
+        const bool compress = ShouldCompress();
+        if (!compress) {
+            status = WriteShared(&txn, offset, len, inode->start_block);
+            if (status != MX_OK) {
+                SetState(kBlobStateError);
+                return status;
+            }
         }
 
         *actual = to_write;
@@ -271,6 +618,19 @@ mx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             }
         }
 
+        if (compress && ((status = WriteData(&txn)) != MX_OK)) {
+            SetState(kBlobStateError);
+            return status;
+        }
+
+        // The data in memory produced the expected digest; it need not be
+        // read back or verified again.
+        if ((status = verified_.Reset(BlobDataBlocks(*inode))) != MX_OK ||
+            (status = verified_.Set(0, BlobDataBlocks(*inode))) != MX_OK) {
+            SetState(kBlobStateError);
+            return status;
+        }
+
         // No more data to write. Flush to disk.
         if ((status = WriteMetadata()) != MX_OK) {
             SetState(kBlobStateError);
@@ -300,7 +660,7 @@ mx_status_t VnodeBlob::GetReadableEvent(mx_handle_t* out) {
     return sizeof(mx_handle_t);
 }
 
-mx_status_t VnodeBlob::CopyVmo(mx_rights_t rights, mx_handle_t* out) {
+mx_status_t VnodeBlob::CopyVmo(mx_rights_t rights, size_t len, size_t* off, mx_handle_t* out) {
     if (GetState() != kBlobStateReadable) {
         return MX_ERR_BAD_STATE;
     }
@@ -312,25 +672,25 @@ mx_status_t VnodeBlob::CopyVmo(mx_rights_t rights, mx_handle_t* out) {
     // TODO(smklein): We could lazily verify more of the VMO if
     // we could fault in pages on-demand.
     //
-    // For now, we aggressively verify the entire VMO up front.
-    Digest d;
-    d = ((const uint8_t*)&digest_[0]);
-    auto inode = blobstore_->GetNode(map_index_);
-    uint64_t size_merkle = MerkleTree::GetTreeLength(inode->blob_size);
-    const void* merkle_data = GetMerkle();
-    const void* blob_data = GetData();
-    status = MerkleTree::Verify(blob_data, inode->blob_size, merkle_data,
-                                size_merkle, 0, inode->blob_size, d);
-    if (status != MX_OK) {
+    // For now, we verify the entire requested range up front.
+    auto inode = &inode_;
+    if ((*off >= inode->blob_size) || (len == 0)) {
+        return MX_ERR_OUT_OF_RANGE;
+    }
+    len = fbl::min(len, inode->blob_size - *off);
+    if ((status = LoadData(*off, len)) != MX_OK) {
         return status;
     }
 
-    // TODO(smklein): Only clone / verify the part of the vmo that
-    // was requested.
+    // Only clone the (block-aligned) part of the blob which was requested.
     const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
+    const size_t clone_start = *off - (*off % kBlobstoreBlockSize);
+    const size_t clone_end = fbl::min(fbl::roundup(*off + len, kBlobstoreBlockSize),
+                                      inode->blob_size);
     mx_handle_t clone;
     if ((status = mx_vmo_clone(blob_->GetVmo(), MX_VMO_CLONE_COPY_ON_WRITE,
-                               data_start, inode->blob_size, &clone)) != MX_OK) {
+                               data_start + clone_start, clone_end - clone_start,
+                               &clone)) != MX_OK) {
         return status;
     }
 
@@ -338,40 +698,40 @@ mx_status_t VnodeBlob::CopyVmo(mx_rights_t rights, mx_handle_t* out) {
         mx_handle_close(clone);
         return status;
     }
+    *off -= clone_start;
     return MX_OK;
 }
 
 mx_status_t VnodeBlob::ReadInternal(void* data, size_t len, size_t off, size_t* actual) {
-    if (GetState() != kBlobStateReadable) {
-        return MX_ERR_BAD_STATE;
-    }
+    size_t data_start;
+    {
+        // The data of a readable blob never changes, and is never evicted
+        // once verified; only bringing it into memory requires the lock.
+        fs::AutoLock lock(&lock_);
+        if (GetState() != kBlobStateReadable) {
+            return MX_ERR_BAD_STATE;
+        }
 
-    mx_status_t status = InitVmos();
-    if (status != MX_OK) {
-        return status;
-    }
+        mx_status_t status = InitVmos();
+        if (status != MX_OK) {
+            return status;
+        }
 
-    Digest d;
-    d = ((const uint8_t*)&digest_[0]);
-    auto inode = blobstore_->GetNode(map_index_);
-    if (off >= inode->blob_size) {
-        *actual = 0;
-        return MX_OK;
-    }
-    if (len > (inode->blob_size - off)) {
-        len = inode->blob_size - off;
-    }
+        auto inode = &inode_;
+        if (off >= inode->blob_size) {
+            *actual = 0;
+            return MX_OK;
+        }
+        if (len > (inode->blob_size - off)) {
+            len = inode->blob_size - off;
+        }
 
-    uint64_t size_merkle = MerkleTree::GetTreeLength(inode->blob_size);
-    const void* merkle_data = GetMerkle();
-    const void* blob_data = GetData();
-    status = MerkleTree::Verify(blob_data, inode->blob_size, merkle_data,
-                                size_merkle, off, len, d);
-    if (status != MX_OK) {
-        return status;
+        if ((status = LoadData(off, len)) != MX_OK) {
+            return status;
+        }
+        data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     }
 
-    const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     return mx_vmo_read(blob_->GetVmo(), data, data_start + off, len, actual);
 }
 
@@ -463,6 +823,12 @@ mx_status_t Blobstore::WriteBitmap(WriteTxn* txn, uint64_t nblocks, uint64_t sta
     return txn->Flush();
 }
 
+void Blobstore::TrimBlocks(WriteTxn* txn, uint64_t nblocks, uint64_t start_block) {
+    if (trim_ && nblocks != 0) {
+        txn->EnqueueTrim(start_block, nblocks);
+    }
+}
+
 mx_status_t Blobstore::WriteNode(WriteTxn* txn, size_t map_index) {
     uint64_t b = (map_index * sizeof(blobstore_inode_t)) / kBlobstoreBlockSize;
     txn->Enqueue(node_map_vmoid_, b, NodeMapStartBlock(info_) + b, 1);
@@ -482,8 +848,6 @@ mx_status_t Blobstore::NewBlob(const Digest& digest, fbl::RefPtr<VnodeBlob>* out
     if (!ac.check()) {
         return MX_ERR_NO_MEMORY;
     }
-
-    hash_.insert(out->get());
     return MX_OK;
 }
 
@@ -493,16 +857,22 @@ mx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
     // Ex: open, alloc, disk write async start, unlink, release, disk write async end.
     // FWIW, this isn't a problem right now with synchronous writes, but it
     // would become a problem with asynchronous writes.
-    switch (vn->GetState()) {
-    case kBlobStateEmpty: {
-        // There are no in-memory or on-disk structures allocated.
+
+    // Blobs which were never opened were never added.
+    if (VnodeBlob::TypeWavlTraits::node_state(*vn).InContainer()) {
         hash_.erase(*vn);
+    }
+
+    switch (vn->GetState()) {
+    case kBlobStateEmpty:
+    case kBlobStateReleasing: {
+        // There are no in-memory or on-disk structures allocated, or they
+        // have already been freed.
         return MX_OK;
     }
     case kBlobStateReadable: {
         if (!vn->DeletionQueued()) {
             // We want in-memory and on-disk data to persist.
-            hash_.erase(*vn);
             return MX_OK;
         }
         // Fall-through
@@ -511,15 +881,17 @@ mx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
     case kBlobStateError: {
         vn->SetState(kBlobStateReleasing);
         size_t node_index = vn->GetMapIndex();
-        uint64_t start_block = GetNode(node_index)->start_block;
-        uint64_t nblocks = GetNode(node_index)->num_blocks;
+        uint64_t start_block = vn->inode_.start_block;
+        uint64_t nblocks = vn->inode_.num_blocks;
+        fs::AutoLock lock(&alloc_lock_);
         FreeNode(node_index);
         FreeBlocks(nblocks, start_block);
         WriteTxn txn(this);
         WriteNode(&txn, node_index);
-        WriteBitmap(&txn, nblocks, start_block);
+        if (WriteBitmap(&txn, nblocks, start_block) == MX_OK) {
+            TrimBlocks(&txn, nblocks, start_block);
+        }
         CountUpdate(&txn);
-        hash_.erase(*vn);
         return MX_OK;
     }
     default: {
@@ -548,6 +920,7 @@ static_assert(sizeof(dircookie_t) <= sizeof(vdircookie_t),
 mx_status_t Blobstore::Readdir(void* cookie, void* dirents, size_t len) {
     fs::DirentFiller df(dirents, len);
     dircookie_t* c = static_cast<dircookie_t*>(cookie);
+    fs::AutoLock lock(&alloc_lock_);
 
     for (size_t i = c->index; i < info_.inode_count; ++i) {
         if (GetNode(i)->start_block >= kStartBlockMinimum) {
@@ -569,16 +942,20 @@ mx_status_t Blobstore::Readdir(void* cookie, void* dirents, size_t len) {
 
 mx_status_t Blobstore::LookupBlob(const Digest& digest, fbl::RefPtr<VnodeBlob>* out) {
     // Look up blob in the fast map (is the blob open elsewhere?)
-    fbl::RefPtr<VnodeBlob> vn = fbl::RefPtr<VnodeBlob>(hash_.find(digest.AcquireBytes()).CopyPointer());
+    fs::AutoLock lock(&hash_lock_);
+    VnodeBlob* raw = hash_.find(digest.AcquireBytes()).CopyPointer();
     digest.ReleaseBytes();
-    if (vn != nullptr) {
+    if (raw != nullptr) {
+        // The blob is open, so its connections hold references to it.
         if (out != nullptr) {
-            *out = fbl::move(vn);
+            *out = fbl::RefPtr<VnodeBlob>(raw);
         }
         return MX_OK;
     }
 
-    // Look up blob in the slow map
+    // Look up blob in the slow map. Holding hash_lock_ keeps the last
+    // Close of an unlinked blob from freeing its node underneath us.
+    fs::AutoLock alloc_lock(&alloc_lock_);
     for (size_t i = 0; i < info_.inode_count; ++i) {
         if (GetNode(i)->start_block >= kStartBlockMinimum) {
             if (digest == GetNode(i)->merkle_root_hash) {
@@ -592,8 +969,8 @@ mx_status_t Blobstore::LookupBlob(const Digest& digest, fbl::RefPtr<VnodeBlob>*
                     }
                     vn->SetState(kBlobStateReadable);
                     vn->SetMapIndex(i);
+                    memcpy(&vn->inode_, GetNode(i), sizeof(vn->inode_));
                     // Delay reading any data from disk until read.
-                    hash_.insert(vn.get());
                     *out = fbl::move(vn);
                 }
                 return MX_OK;
@@ -617,6 +994,14 @@ mx_status_t Blobstore::AttachVmo(mx_handle_t vmo, vmoid_t* out) {
     return MX_OK;
 }
 
+mx_status_t Blobstore::DetachVmo(vmoid_t vmoid) {
+    block_fifo_request_t request;
+    request.txnid = TxnId();
+    request.vmoid = vmoid;
+    request.opcode = BLOCKIO_CLOSE_VMO;
+    return Txn(&request, 1);
+}
+
 mx_status_t Blobstore::AddInodes() {
     if (!(info_.flags & kBlobstoreFlagFVM)) {
         return MX_ERR_NO_SPACE;
@@ -662,6 +1047,26 @@ mx_status_t Blobstore::AddInodes() {
     return txn.Flush();
 }
 
+void Blobstore::GetCacheStats(vfs_cache_stats_t* out) const {
+    memset(out, 0, sizeof(*out));
+    out->hits = cache_hits_.load();
+    out->misses = cache_misses_.load();
+    out->readahead = cache_readahead_.load();
+    {
+        fs::AutoLock lock(&hash_lock_);
+        out->vnode_count = hash_.size();
+    }
+    out->block_size = kBlobstoreBlockSize;
+}
+
+void Blobstore::GetUsage(vfs_query_info_t* out) const {
+    fs::AutoLock lock(&alloc_lock_);
+    out->total_bytes = info_.block_count * info_.block_size;
+    out->used_bytes = info_.alloc_block_count * info_.block_size;
+    out->total_nodes = info_.inode_count;
+    out->used_nodes = info_.alloc_inode_count;
+}
+
 mx_status_t Blobstore::AddBlocks(size_t nblocks) {
     if (!(info_.flags & kBlobstoreFlagFVM)) {
         return MX_ERR_NO_SPACE;
@@ -741,6 +1146,11 @@ mx_status_t Blobstore::Create(int fd, const blobstore_info_t* info, fbl::RefPtr<
         return MX_ERR_NO_MEMORY;
     }
 
+    block_info_t block_info;
+    if (ioctl_block_get_info(fd, &block_info) >= 0) {
+        fs->trim_ = (block_info.flags & BLOCK_FLAG_TRIM_SUPPORT) != 0;
+    }
+
     mx_handle_t fifo;
     ssize_t r;
     if ((r = ioctl_block_get_fifos(fd, &fifo)) < 0) {
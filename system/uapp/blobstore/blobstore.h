@@ -33,7 +33,10 @@ using RawBitmap = bitmap::RawBitmapGeneric<bitmap::DefaultStorage>;
 
 constexpr uint64_t kBlobstoreMagic0  = (0xac2153479e694d21ULL);
 constexpr uint64_t kBlobstoreMagic1  = (0x985000d4d4d3d314ULL);
-constexpr uint32_t kBlobstoreVersion = 0x00000003;
+constexpr uint32_t kBlobstoreVersion = 0x00000004;
+// Volumes from before compressed blobs are still mounted, but blobs are only
+// written to them uncompressed so that older drivers can keep reading them.
+constexpr uint32_t kBlobstoreVersionUncompressed = 0x00000003;
 
 constexpr uint32_t kBlobstoreFlagClean      = 1;
 constexpr uint32_t kBlobstoreFlagDirty      = 2;
@@ -124,9 +127,13 @@ typedef struct {
     uint64_t start_block;
     uint64_t num_blocks;
     uint64_t blob_size;
-    uint64_t reserved;
+    uint32_t flags;
+    uint32_t reserved;
 } blobstore_inode_t;
 
+// The blob data is stored compressed (see below).
+constexpr uint32_t kBlobstoreInodeFlagCompressed = 0x00000001;
+
 static_assert(sizeof(blobstore_inode_t) == kBlobstoreInodeSize,
               "Blobstore Inode size is wrong");
 static_assert(kBlobstoreBlockSize % kBlobstoreInodeSize == 0,
@@ -137,5 +144,24 @@ constexpr uint64_t BlobDataBlocks(const blobstore_inode_t& blobNode) {
     return fbl::roundup(blobNode.blob_size, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
+// Blobs may be stored LZ4-compressed, when their writer asks for it (with
+// IOCTL_VFS_BLOB_COMPRESS) and doing so saves space.
+//
+// The Merkle tree is always computed over the uncompressed data, and is
+// stored as usual. It is followed by a table of one uint32_t per
+// kBlobstoreCompressChunkSize bytes of uncompressed data, holding the offset
+// (from the start of the table) at which that chunk's compressed data ends.
+// The chunks follow the table back to back, the first starting right after
+// it. Each chunk is compressed independently so that any part of a blob can
+// be read without decompressing what precedes it. A chunk which LZ4 does not
+// shrink is stored as is, and recognized by its length.
+constexpr uint32_t kBlobstoreCompressChunkSize = 8 * kBlobstoreBlockSize;
+
+// Number of compressed chunks (and entries in the chunk table)
+constexpr uint64_t BlobCompressedChunks(const blobstore_inode_t& blobNode) {
+    return fbl::roundup(blobNode.blob_size, kBlobstoreCompressChunkSize) /
+           kBlobstoreCompressChunkSize;
+}
+
 void* GetBlock(const RawBitmap& bitmap, uint32_t blkno);
 void* GetBitBlock(const RawBitmap& bitmap, uint32_t* blkno_out, uint32_t bitno);
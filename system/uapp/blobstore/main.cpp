@@ -45,7 +45,7 @@ int do_blobstore_mount(int fd, int argc, char** argv) {
     if ((status = vfs.ServeDirectory(fbl::move(vn), mx::channel(h))) != MX_OK) {
         return status;
     }
-    loop.Run();
+    fs::RunDispatchLoop(&loop, "blobstore-dispatcher");
     return 0;
 }
 
@@ -29,6 +29,7 @@ mx_status_t VnodeBlob::GetHandles(uint32_t flags, mx_handle_t* hnds,
     if (IsDirectory()) {
         return 0;
     }
+    fs::AutoLock lock(&lock_);
     mx_status_t r = GetReadableEvent(&hnds[0]);
     if (r < 0) {
         return r;
@@ -27,6 +27,7 @@ MODULE_STATIC_LIBS := \
     system/ulib/block-client \
     system/ulib/digest \
     third_party/ulib/cryptolib \
+    third_party/ulib/lz4 \
     system/ulib/mx \
     system/ulib/mxcpp \
     system/ulib/fbl \
@@ -61,6 +62,8 @@ MODULE_SRCS := \
 MODULE_HOST_LIBS := \
     system/ulib/fbl.hostlib
 
+MODULE_HOST_SYSLIBS := -lpthread
+
 MODULE_COMPILEFLAGS := \
     -Werror-implicit-function-declaration \
     -Wstrict-prototypes -Wwrite-strings \
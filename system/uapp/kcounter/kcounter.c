@@ -0,0 +1,187 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <magenta/device/sysinfo.h>
+#include <magenta/kcounters.h>
+#include <magenta/status.h>
+#include <magenta/syscalls.h>
+
+void usage(void) {
+    fprintf(stderr,
+        "usage: kcounter [options] [prefix...]\n"
+        "       print the kernel counters whose names start with any prefix\n"
+        "\n"
+        "options: -a        also print counters which are zero\n"
+        "         -c        print each cpu's count as well as the total\n"
+        "         -w <sec>  don't exit, print the changes every <sec> seconds\n"
+        "         -h        show help\n"
+        );
+}
+
+static mx_status_t get_root_resource(mx_handle_t* root_resource) {
+    int fd = open("/dev/misc/sysinfo", O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "kcounter: cannot open sysinfo: %s\n", strerror(errno));
+        return MX_ERR_NOT_FOUND;
+    }
+
+    ssize_t n = ioctl_sysinfo_get_root_resource(fd, root_resource);
+    close(fd);
+    if (n != sizeof(*root_resource)) {
+        fprintf(stderr, "kcounter: cannot obtain root resource: %zd\n", n);
+        return n < 0 ? (mx_status_t)n : MX_ERR_NOT_FOUND;
+    }
+    return MX_OK;
+}
+
+// Maps the counters VMO read-only and checks its header.
+static mx_status_t map_counters(const mx_kcounters_header_t** out) {
+    mx_handle_t root_resource;
+    mx_status_t status = get_root_resource(&root_resource);
+    if (status != MX_OK)
+        return status;
+
+    mx_handle_t vmo;
+    status = mx_kcounters_get_vmo(root_resource, &vmo);
+    mx_handle_close(root_resource);
+    if (status != MX_OK) {
+        fprintf(stderr, "kcounter: cannot get counters: %d (%s)\n",
+                status, mx_status_get_string(status));
+        return status;
+    }
+
+    uint64_t size;
+    uintptr_t addr;
+    if ((status = mx_vmo_get_size(vmo, &size)) == MX_OK) {
+        status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                             MX_VM_FLAG_PERM_READ, &addr);
+    }
+    mx_handle_close(vmo);
+    if (status != MX_OK) {
+        fprintf(stderr, "kcounter: cannot map counters: %d (%s)\n",
+                status, mx_status_get_string(status));
+        return status;
+    }
+
+    const mx_kcounters_header_t* header = (const mx_kcounters_header_t*)addr;
+    if (header->magic != MX_KCOUNTERS_MAGIC ||
+        header->counters_offset +
+                (uint64_t)header->num_cpus * header->cpu_stride * sizeof(uint64_t) > size) {
+        fprintf(stderr, "kcounter: bad counters header\n");
+        return MX_ERR_BAD_STATE;
+    }
+    *out = header;
+    return MX_OK;
+}
+
+static const uint64_t* cpu_counters(const mx_kcounters_header_t* header, uint32_t cpu) {
+    return (const uint64_t*)((uintptr_t)header + header->counters_offset) +
+           (size_t)cpu * header->cpu_stride;
+}
+
+static bool matches(const char* name, int num_prefixes, char** prefixes) {
+    if (num_prefixes == 0)
+        return true;
+    for (int i = 0; i < num_prefixes; i++) {
+        if (!strncmp(name, prefixes[i], strlen(prefixes[i])))
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    bool all = false;
+    bool per_cpu = false;
+    unsigned int watch_sec = 0;
+
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-h")) {
+            usage();
+            return 0;
+        } else if (!strcmp(argv[1], "-a")) {
+            all = true;
+        } else if (!strcmp(argv[1], "-c")) {
+            per_cpu = true;
+        } else if (!strcmp(argv[1], "-w")) {
+            argc--;
+            argv++;
+            if (argc < 2 || (watch_sec = (unsigned int)atoi(argv[1])) == 0) {
+                usage();
+                return -1;
+            }
+        } else {
+            usage();
+            return -1;
+        }
+        argc--;
+        argv++;
+    }
+    int num_prefixes = argc - 1;
+    char** prefixes = argv + 1;
+
+    const mx_kcounters_header_t* header;
+    if (map_counters(&header) != MX_OK)
+        return -1;
+
+    const mx_kcounter_desc_t* descs =
+        (const mx_kcounter_desc_t*)((uintptr_t)header + header->desc_offset);
+    const uint32_t num_counters = header->num_counters;
+    // The kernel sets up arrays for every cpu it could have; only the ones
+    // which exist are worth printing.
+    uint32_t num_cpus = mx_system_get_num_cpus();
+    if (num_cpus > header->num_cpus)
+        num_cpus = header->num_cpus;
+
+    // Previous totals, for printing changes when watching.
+    uint64_t* last = calloc(num_counters, sizeof(uint64_t));
+    if (!last) {
+        fprintf(stderr, "kcounter: out of memory\n");
+        return -1;
+    }
+
+    for (;;) {
+        for (uint32_t i = 0; i < num_counters; i++) {
+            // Don't rely on the VMO for the terminator.
+            char name[MX_KCOUNTER_NAME_LEN];
+            strncpy(name, descs[i].name, sizeof(name));
+            name[sizeof(name) - 1] = '\0';
+            if (!matches(name, num_prefixes, prefixes))
+                continue;
+
+            // The counters are only ever added to, so no snapshot is
+            // needed: reading each cpu's word in turn is good enough.
+            uint64_t total = 0;
+            for (uint32_t cpu = 0; cpu < header->num_cpus; cpu++)
+                total += cpu_counters(header, cpu)[i];
+            uint64_t delta = total - last[i];
+            last[i] = total;
+            if (delta == 0 && !all)
+                continue;
+
+            printf("%-40s %20" PRIu64, name, watch_sec ? delta : total);
+            if (per_cpu) {
+                for (uint32_t cpu = 0; cpu < num_cpus; cpu++)
+                    printf(" %" PRIu64, cpu_counters(header, cpu)[i]);
+            }
+            printf("\n");
+        }
+
+        if (!watch_sec)
+            break;
+        mx_nanosleep(mx_deadline_after(MX_SEC(watch_sec)));
+        printf("\n");
+    }
+
+    free(last);
+    return 0;
+}
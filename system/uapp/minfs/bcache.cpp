@@ -15,6 +15,7 @@
 #include <fbl/unique_ptr.h>
 #include <magenta/device/device.h>
 
+#include "journal.h"
 #include "minfs.h"
 #include "minfs-private.h"
 
@@ -51,6 +52,11 @@ mx_status_t Bcache::Writeblk(blk_t bno, const void* data) {
 }
 
 int Bcache::Sync() {
+#ifdef __Fuchsia__
+    if (journal_ != nullptr && journal_->Commit() != MX_OK) {
+        return -1;
+    }
+#endif
     return fsync(fd_);
 }
 
@@ -65,6 +71,11 @@ mx_status_t Bcache::Create(fbl::unique_ptr<Bcache>* out, int fd, uint32_t blockm
     mx_handle_t fifo;
     ssize_t r;
 
+    block_info_t info;
+    if (ioctl_block_get_info(fd, &info) >= 0) {
+        bc->trim_ = (info.flags & BLOCK_FLAG_TRIM_SUPPORT) != 0;
+    }
+
     if ((r = ioctl_block_get_fifos(fd, &fifo)) < 0) {
         return static_cast<mx_status_t>(r);
     } else if ((r = ioctl_block_alloc_txn(fd, &bc->txnid_)) < 0) {
@@ -87,6 +98,45 @@ ssize_t Bcache::GetDevicePath(char* out, size_t out_len) {
 }
 
 mx_status_t Bcache::AttachVmo(mx_handle_t vmo, vmoid_t* out) {
+    mx_status_t status = AttachVmoInternal(vmo, out);
+    if (status != MX_OK || journal_ == nullptr) {
+        return status;
+    }
+    return journal_->TrackVmo(vmo, *out);
+}
+
+mx_status_t Bcache::AttachDataVmo(mx_handle_t vmo, vmoid_t* out) {
+    return AttachVmoInternal(vmo, out);
+}
+
+mx_status_t Bcache::Txn(block_fifo_request_t* requests, size_t count) {
+    if (journal_ != nullptr) {
+        return journal_->Txn(requests, count);
+    }
+    return FifoTxn(requests, count);
+}
+
+mx_status_t Bcache::Barrier() {
+    ssize_t r = ioctl_device_sync(fd_);
+    if (r == MX_ERR_NOT_SUPPORTED) {
+        // Drivers without IOCTL_DEVICE_SYNC do not cache writes: each write
+        // is already stable once it has completed.
+        return MX_OK;
+    }
+    return (r < 0) ? static_cast<mx_status_t>(r) : MX_OK;
+}
+
+void Bcache::TakeFreed(fbl::Vector<BlockRun>* out) {
+    if (journal_ != nullptr) {
+        journal_->TakeFreed(out);
+    }
+}
+
+void Bcache::SetJournal(fbl::unique_ptr<Journal> journal) {
+    journal_ = fbl::move(journal);
+}
+
+mx_status_t Bcache::AttachVmoInternal(mx_handle_t vmo, vmoid_t* out) {
     mx_handle_t xfer_vmo;
     mx_status_t status = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &xfer_vmo);
     if (status != MX_OK) {
@@ -106,6 +156,8 @@ Bcache::Bcache(int fd, uint32_t blockmax) :
 
 Bcache::~Bcache() {
 #ifdef __Fuchsia__
+    // Commit outstanding metadata while the fifo is still open
+    journal_.reset();
     if (fifo_client_ != nullptr) {
         ioctl_block_free_txn(fd_, &txnid_);
         ioctl_block_fifo_close(fd_);
@@ -0,0 +1,150 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <fbl/alloc_checker.h>
+
+#include "dir-index.h"
+#include "misc.h"
+
+namespace minfs {
+namespace {
+
+constexpr uint32_t kEmpty = UINT32_MAX;
+constexpr uint32_t kTombstone = UINT32_MAX - 1;
+constexpr size_t kMinCapacity = 256;
+
+static_assert(kMinfsMaxDirectorySize < kTombstone,
+              "Directory offsets must not collide with index markers");
+
+} // namespace
+
+uint32_t DirectoryIndex::Hash(const char* name, size_t len) {
+    return fnv1a32(name, len);
+}
+
+mx_status_t DirectoryIndex::Rehash(size_t capacity) {
+    fbl::AllocChecker ac;
+    fbl::Array<Entry> table(new (&ac) Entry[capacity], capacity);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        table[i].off = kEmpty;
+    }
+    const size_t mask = capacity - 1;
+    for (size_t i = 0; i < table_.size(); i++) {
+        if ((table_[i].off == kEmpty) || (table_[i].off == kTombstone)) {
+            continue;
+        }
+        size_t slot = table_[i].hash & mask;
+        while (table[slot].off != kEmpty) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = table_[i];
+    }
+    table_ = fbl::move(table);
+    used_ = live_;
+    return MX_OK;
+}
+
+mx_status_t DirectoryIndex::Insert(uint32_t hash, uint32_t off) {
+    // Keep the table at most 3/4 full (counting tombstones), growing it once
+    // half of it is live.
+    if ((used_ + 1) * 4 > table_.size() * 3) {
+        size_t capacity = table_.size() ? table_.size() : kMinCapacity;
+        if ((live_ + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        mx_status_t status;
+        if ((status = Rehash(capacity)) != MX_OK) {
+            return status;
+        }
+    }
+
+    const size_t mask = table_.size() - 1;
+    size_t slot = hash & mask;
+    while ((table_[slot].off != kEmpty) && (table_[slot].off != kTombstone)) {
+        slot = (slot + 1) & mask;
+    }
+    if (table_[slot].off == kEmpty) {
+        used_++;
+    }
+    table_[slot].hash = hash;
+    table_[slot].off = off;
+    live_++;
+    return MX_OK;
+}
+
+void DirectoryIndex::Remove(uint32_t hash, uint32_t off) {
+    if (table_.size() == 0) {
+        return;
+    }
+    const size_t mask = table_.size() - 1;
+    for (size_t slot = hash & mask; table_[slot].off != kEmpty; slot = (slot + 1) & mask) {
+        if ((table_[slot].off == off) && (table_[slot].hash == hash)) {
+            table_[slot].off = kTombstone;
+            live_--;
+            return;
+        }
+    }
+}
+
+bool DirectoryIndex::Find(uint32_t hash, size_t* cursor, uint32_t* off) const {
+    if (table_.size() == 0) {
+        return false;
+    }
+    const size_t mask = table_.size() - 1;
+    while (*cursor < table_.size()) {
+        const Entry& entry = table_[(hash + *cursor) & mask];
+        if (entry.off == kEmpty) {
+            return false;
+        }
+        (*cursor)++;
+        if ((entry.off != kTombstone) && (entry.hash == hash)) {
+            *off = entry.off;
+            return true;
+        }
+    }
+    return false;
+}
+
+mx_status_t DirectoryIndex::AddFree(uint32_t off) {
+    if (free_.find(off).IsValid()) {
+        return MX_OK;
+    }
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<FreeRecord> record(new (&ac) FreeRecord(off));
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    free_.insert(fbl::move(record));
+    return MX_OK;
+}
+
+void DirectoryIndex::RemoveFree(uint32_t off) {
+    free_.erase(off);
+}
+
+bool DirectoryIndex::FindFreeBefore(uint32_t off, uint32_t* out) {
+    auto iter = free_.lower_bound(off);
+    if (iter == free_.begin()) {
+        return false;
+    }
+    --iter;
+    *out = iter->off;
+    return true;
+}
+
+bool DirectoryIndex::TakeFree(uint32_t* off) {
+    if (free_.is_empty()) {
+        return false;
+    }
+    *off = free_.pop_front()->off;
+    return true;
+}
+
+} // namespace minfs
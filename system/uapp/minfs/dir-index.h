@@ -0,0 +1,93 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <fbl/array.h>
+#include <fbl/intrusive_wavl_tree.h>
+#include <fbl/macros.h>
+#include <fbl/unique_ptr.h>
+#include <magenta/types.h>
+
+#include "minfs.h"
+
+namespace minfs {
+
+// Directories which grow to at least this size are indexed on first access.
+constexpr uint32_t kMinfsDirIndexMinSize = 4 * kMinfsBlockSize;
+
+// DirectoryIndex is an in-memory index over the dirents of a large directory.
+//
+// It is built with a single scan the first time the directory is searched,
+// and kept up to date as dirents are added and removed, so that lookups,
+// unlinks and renames can go straight to the dirent they name. It maps the
+// hash of each name to the offset of the dirent holding it, and additionally
+// remembers which records have room for another dirent (free records, and
+// live records with unused space at their end) and where the last record is,
+// so that creation does not need to scan for space either.
+//
+// Only offsets are recorded: every candidate must be verified against the
+// dirent it refers to. The on-disk format, and therefore readdir cookies,
+// are unaffected.
+//
+// Free records are coalesced as usual; a record merged into its predecessor
+// is forgotten, so that every offset in the index always refers to the start
+// of a record.
+class DirectoryIndex {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(DirectoryIndex);
+    DirectoryIndex() = default;
+
+    static uint32_t Hash(const char* name, size_t len);
+
+    // Records the live dirent at |off| with a name hashing to |hash|.
+    mx_status_t Insert(uint32_t hash, uint32_t off);
+    // Forgets the live dirent at |off| with a name hashing to |hash|.
+    void Remove(uint32_t hash, uint32_t off);
+    // Iterates over the offsets of live dirents with names hashing to |hash|.
+    // |*cursor| must be zero on the first call. Returns false when there are
+    // no more candidates.
+    bool Find(uint32_t hash, size_t* cursor, uint32_t* off) const;
+
+    // Records that the record at |off| has room for another dirent, if it is
+    // not already known.
+    mx_status_t AddFree(uint32_t off);
+    // Forgets the record at |off|, if known to have room.
+    void RemoveFree(uint32_t off);
+    // Finds the highest offset below |off| known to have room.
+    bool FindFreeBefore(uint32_t off, uint32_t* out);
+    // Returns (and forgets) the lowest offset known to have room. The record
+    // may have been reused since; it is the caller's responsibility to check.
+    bool TakeFree(uint32_t* off);
+
+    // The offset of the record holding kMinfsReclenLast.
+    uint32_t Last() const { return last_; }
+    void SetLast(uint32_t off) { last_ = off; }
+
+private:
+    struct Entry {
+        uint32_t hash;
+        uint32_t off;
+    };
+
+    struct FreeRecord : public fbl::WAVLTreeContainable<fbl::unique_ptr<FreeRecord>> {
+        explicit FreeRecord(uint32_t off) : off(off) {}
+        uint32_t GetKey() const { return off; }
+        uint32_t off;
+    };
+
+    mx_status_t Rehash(size_t capacity);
+
+    // Open-addressed with linear probing; the capacity is a power of two.
+    fbl::Array<Entry> table_;
+    size_t live_ = 0;
+    size_t used_ = 0; // Live entries and tombstones
+    // Records with room for another dirent, ordered by offset
+    fbl::WAVLTree<uint32_t, fbl::unique_ptr<FreeRecord>> free_;
+    uint32_t last_ = 0;
+};
+
+} // namespace minfs
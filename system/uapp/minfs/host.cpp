@@ -215,7 +215,6 @@ int emu_unlink(const char* path) {
     mx_status_t status = minfs::vfs.Walk(fake_root, &vn, path + PREFIX_SIZE, &path);
     if (status == MX_OK) {
         status = vn->Unlink(path, strlen(path), false);
-        vn->Close();
     }
     STATUS(status);
 }
@@ -252,17 +251,11 @@ int emu_stat(const char* fn, struct stat* s) {
             return -ENOENT;
         }
         vn = fbl::RefPtr<fs::Vnode>::Downcast(vn_fs);
-        if (cur != fake_root) {
-            cur->Close();
-        }
         cur = vn;
         fn = nextpath;
     } while (nextpath != nullptr);
 
     status = do_stat(vn, s);
-    if (vn != fake_root) {
-        vn->Close();
-    }
     STATUS(status);
 }
 
@@ -0,0 +1,683 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs/block-txn.h>
+#include <fs/trace.h>
+#include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
+
+#ifdef __Fuchsia__
+#include <magenta/syscalls.h>
+#endif
+
+#include "journal.h"
+#include "minfs.h"
+
+namespace minfs {
+namespace {
+
+// Extends the FNV-1a hash |n| with |len| bytes of |ptr|.
+uint64_t ChecksumUpdate(uint64_t n, const void* ptr, size_t len) {
+    const uint8_t* data = static_cast<const uint8_t*>(ptr);
+    while (len-- > 0) {
+        n = (n ^ (*data++)) * FNV64_PRIME;
+    }
+    return n;
+}
+
+uint32_t JournalCapacity(const minfs_info_t* info) {
+    return fbl::min(info->jnl_blocks - kMinfsJournalOverhead, kMinfsJournalMaxEntryBlocks);
+}
+
+} // namespace
+
+mx_status_t minfs_journal_format(Bcache* bc, const minfs_info_t* info) {
+    uint8_t blk[kMinfsBlockSize];
+    const blk_t start = info->dat_block + info->jnl_start;
+
+    // Invalidate any entry left behind by a previous filesystem
+    memset(blk, 0, sizeof(blk));
+    mx_status_t status;
+    if ((status = bc->Writeblk(start + 1, blk)) != MX_OK) {
+        return status;
+    }
+
+    minfs_journal_info_t* jinfo = reinterpret_cast<minfs_journal_info_t*>(blk);
+    jinfo->magic = kMinfsJournalMagic;
+    jinfo->seq = 1;
+    return bc->Writeblk(start, blk);
+}
+
+mx_status_t minfs_journal_replay(Bcache* bc, const minfs_info_t* info) {
+    if ((info->flags & kMinfsFlagJournal) == 0) {
+        return MX_OK;
+    }
+
+    const blk_t start = info->dat_block + info->jnl_start;
+    uint8_t blk[kMinfsBlockSize];
+    mx_status_t status;
+    if ((status = bc->Readblk(start, blk)) != MX_OK) {
+        FS_TRACE_ERROR("minfs: cannot read journal info\n");
+        return status;
+    }
+    minfs_journal_info_t jinfo;
+    memcpy(&jinfo, blk, sizeof(jinfo));
+    if (jinfo.magic != kMinfsJournalMagic) {
+        FS_TRACE_ERROR("minfs: bad journal magic\n");
+        return MX_ERR_IO_DATA_INTEGRITY;
+    }
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<minfs_journal_header_t> hdr(new (&ac) minfs_journal_header_t);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    if ((status = bc->Readblk(start + 1, hdr.get())) != MX_OK) {
+        return status;
+    }
+    if ((hdr->magic != kMinfsJournalHeaderMagic) || (hdr->seq != jinfo.seq) ||
+        (hdr->count == 0) || (hdr->count > JournalCapacity(info))) {
+        // The last entry was retired; nothing to replay
+        return MX_OK;
+    }
+
+    // Only replay the entry if it was completely written
+    uint64_t checksum = ChecksumUpdate(FNV64_OFFSET_BASIS, hdr.get(), kMinfsBlockSize);
+    for (uint32_t n = 0; n < hdr->count; n++) {
+        if ((status = bc->Readblk(start + 2 + n, blk)) != MX_OK) {
+            return status;
+        }
+        checksum = ChecksumUpdate(checksum, blk, kMinfsBlockSize);
+    }
+    if ((status = bc->Readblk(start + 2 + hdr->count, blk)) != MX_OK) {
+        return status;
+    }
+    const minfs_journal_commit_t* commit = reinterpret_cast<minfs_journal_commit_t*>(blk);
+    if ((commit->magic != kMinfsJournalCommitMagic) || (commit->seq != jinfo.seq) ||
+        (commit->checksum != checksum)) {
+        // Torn entry: nothing was written back in place yet, so the
+        // metadata on disk is still consistent.
+        FS_TRACE_WARN("minfs: discarding incomplete journal entry %" PRIu64 "\n", jinfo.seq);
+        return MX_OK;
+    }
+
+    FS_TRACE_WARN("minfs: replaying journal entry %" PRIu64 " (%u blocks)\n",
+                  jinfo.seq, hdr->count);
+    for (uint32_t n = 0; n < hdr->count; n++) {
+        blk_t target = hdr->target[n];
+        if (target == kMinfsJournalRevoked) {
+            continue;
+        } else if (target >= bc->Maxblk()) {
+            FS_TRACE_ERROR("minfs: journal target %u out of range\n", target);
+            return MX_ERR_IO_DATA_INTEGRITY;
+        }
+        if ((status = bc->Readblk(start + 2 + n, blk)) != MX_OK) {
+            return status;
+        } else if ((status = bc->Writeblk(target, blk)) != MX_OK) {
+            return status;
+        }
+    }
+
+    // Retire the entry
+    memset(blk, 0, sizeof(blk));
+    jinfo.seq++;
+    memcpy(blk, &jinfo, sizeof(jinfo));
+    if ((status = bc->Writeblk(start, blk)) != MX_OK) {
+        return status;
+    }
+    return bc->Sync() ? MX_ERR_IO : MX_OK;
+}
+
+#ifdef __Fuchsia__
+
+namespace {
+
+// Upper bound on how long metadata may stay in memory before it is committed
+constexpr mx_duration_t kJournalCommitInterval = MX_MSEC(500);
+
+} // namespace
+
+Journal::Journal(Bcache* bc, const minfs_info_t* info, uint32_t capacity) :
+    bc_(bc), start_(info->dat_block + info->jnl_start), capacity_(capacity) {
+    mtx_init(&lock_, mtx_plain);
+    cnd_init(&wake_);
+}
+
+mx_status_t Journal::Create(Bcache* bc, const minfs_info_t* info,
+                            fbl::unique_ptr<Journal>* out) {
+    if ((info->jnl_blocks < kMinfsMinJournalBlocks) ||
+        (info->jnl_start + info->jnl_blocks > info->block_count)) {
+        FS_TRACE_ERROR("minfs: invalid journal size\n");
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<Journal> journal(new (&ac) Journal(bc, info, JournalCapacity(info)));
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+
+    mx_status_t status;
+    size_t size = (journal->capacity_ + kMinfsJournalOverhead) * kMinfsBlockSize;
+    if ((status = MappedVmo::Create(size, "minfs-journal", &journal->staging_)) != MX_OK) {
+        return status;
+    }
+    // The staging buffer is written out by the journal itself
+    if ((status = bc->AttachDataVmo(journal->staging_->GetVmo(),
+                                    &journal->staging_vmoid_)) != MX_OK) {
+        return status;
+    }
+
+    minfs_journal_info_t* jinfo = static_cast<minfs_journal_info_t*>(journal->staging_->GetData());
+    if ((status = bc->Readblk(journal->start_, jinfo)) != MX_OK) {
+        return status;
+    } else if (jinfo->magic != kMinfsJournalMagic) {
+        FS_TRACE_ERROR("minfs: bad journal magic\n");
+        return MX_ERR_IO_DATA_INTEGRITY;
+    }
+    journal->seq_ = jinfo->seq;
+
+    size_t index_size = 1;
+    while (index_size < 2 * journal->capacity_) {
+        index_size <<= 1;
+    }
+    journal->index_.reset(new (&ac) uint16_t[index_size](), index_size);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+
+    if (thrd_create(&journal->thread_, CommitThread, journal.get()) != thrd_success) {
+        return MX_ERR_NO_RESOURCES;
+    }
+    journal->thread_running_ = true;
+
+    *out = fbl::move(journal);
+    return MX_OK;
+}
+
+Journal::~Journal() {
+    mtx_lock(&lock_);
+    stopping_ = true;
+    cnd_signal(&wake_);
+    mtx_unlock(&lock_);
+    if (thread_running_) {
+        thrd_join(thread_, nullptr);
+    }
+
+    mtx_lock(&lock_);
+    if (staging_ != nullptr && status_ == MX_OK && CommitLocked() != MX_OK) {
+        FS_TRACE_ERROR("minfs: failed to commit journal on shutdown\n");
+    }
+    mtx_unlock(&lock_);
+    cnd_destroy(&wake_);
+    mtx_destroy(&lock_);
+}
+
+int Journal::CommitThread(void* arg) {
+    Journal* journal = static_cast<Journal*>(arg);
+    mtx_lock(&journal->lock_);
+    while (!journal->stopping_) {
+        // After a failed commit nothing more is committed, so there is
+        // nothing to wait for but shutdown.
+        if ((journal->status_ != MX_OK) ||
+            ((journal->Header()->count == 0) && (journal->trim_count_ == 0))) {
+            cnd_wait(&journal->wake_, &journal->lock_);
+            continue;
+        }
+        mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+        mx_time_t deadline = journal->oldest_ + kJournalCommitInterval;
+        if (now >= deadline) {
+            journal->CommitLocked();
+            continue;
+        }
+        struct timespec ts;
+        timespec_get(&ts, TIME_UTC);
+        uint64_t ns = ts.tv_nsec + (deadline - now);
+        ts.tv_sec += ns / MX_SEC(1);
+        ts.tv_nsec = ns % MX_SEC(1);
+        cnd_timedwait(&journal->wake_, &journal->lock_, &ts);
+    }
+    mtx_unlock(&journal->lock_);
+    return 0;
+}
+
+mx_status_t Journal::TrackVmo(mx_handle_t vmo, vmoid_t vmoid) {
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<TrackedVmo> tracked(new (&ac) TrackedVmo);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    mx_handle_t dup;
+    mx_status_t status;
+    if ((status = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &dup)) != MX_OK) {
+        return status;
+    }
+    tracked->vmo.reset(dup);
+    tracked->vmoid = vmoid;
+
+    mtx_lock(&lock_);
+    vmos_.insert(fbl::move(tracked));
+    mtx_unlock(&lock_);
+    return MX_OK;
+}
+
+mx_status_t Journal::Commit() {
+    mtx_lock(&lock_);
+    mx_status_t status = CommitLocked();
+    mtx_unlock(&lock_);
+    return status;
+}
+
+void Journal::TakeFreed(fbl::Vector<BlockRun>* out) {
+    mtx_lock(&lock_);
+    *out = fbl::move(freed_);
+    mtx_unlock(&lock_);
+}
+
+mx_status_t Journal::Txn(block_fifo_request_t* requests, size_t count) {
+    if (count > MAX_TXN_MESSAGES) {
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    mtx_lock(&lock_);
+    // Transactions usually correspond to whole filesystem operations;
+    // committing here (rather than once the journal is full) avoids
+    // splitting a single operation across entries.
+    mx_status_t status = MX_OK;
+    if (Header()->count >= capacity_ / 2) {
+        status = CommitLocked();
+    }
+    if (status == MX_OK) {
+        status = ReserveLocked(requests, count);
+    }
+
+    block_fifo_request_t passthrough[MAX_TXN_MESSAGES];
+    size_t passthrough_count = 0;
+    bool reads_metadata = false;
+    for (size_t i = 0; (i < count) && (status == MX_OK); i++) {
+        const block_fifo_request_t* req = &requests[i];
+        const blk_t bno = static_cast<blk_t>(req->dev_offset / kMinfsBlockSize);
+        const uint64_t blocks = req->length / kMinfsBlockSize;
+
+        switch (req->opcode & BLOCKIO_OP_MASK) {
+        case BLOCKIO_READ:
+            reads_metadata |= vmos_.find(req->vmoid).IsValid();
+            break;
+        case BLOCKIO_WRITE: {
+            auto tracked = vmos_.find(req->vmoid);
+            if (tracked.IsValid()) {
+                status = StageLocked(tracked->vmo.get(), req->vmo_offset, bno, blocks);
+                continue;
+            }
+            // Revoked before the data is written, so that no commit can
+            // write stale metadata over it afterwards.
+            RevokeLocked(bno, blocks);
+            break;
+        }
+        case BLOCKIO_TRIM:
+            status = TrimLocked(bno, blocks);
+            continue;
+        case BLOCKIO_CLOSE_VMO:
+            vmos_.erase(req->vmoid);
+            break;
+        }
+        passthrough[passthrough_count++] = *req;
+    }
+    if ((status != MX_OK) || (passthrough_count == 0)) {
+        mtx_unlock(&lock_);
+        return status;
+    }
+
+    // File data is read and written without holding lock_, so that other
+    // operations can stage metadata meanwhile. Metadata reads keep it, so
+    // that the blocks they overlay cannot be committed (and dropped from the
+    // batch) between reading the disk and applying the overlay.
+    if (!reads_metadata) {
+        mtx_unlock(&lock_);
+        return bc_->FifoTxn(passthrough, passthrough_count);
+    }
+    status = bc_->FifoTxn(passthrough, passthrough_count);
+
+    // The disk may not reflect metadata which has yet to be committed
+    for (size_t i = 0; (i < count) && (status == MX_OK); i++) {
+        const block_fifo_request_t* req = &requests[i];
+        if ((req->opcode & BLOCKIO_OP_MASK) != BLOCKIO_READ) {
+            continue;
+        }
+        auto tracked = vmos_.find(req->vmoid);
+        if (tracked.IsValid()) {
+            status = OverlayLocked(tracked->vmo.get(), req->vmo_offset,
+                                   static_cast<blk_t>(req->dev_offset / kMinfsBlockSize),
+                                   req->length / kMinfsBlockSize);
+        }
+    }
+    mtx_unlock(&lock_);
+    return status;
+}
+
+mx_status_t Journal::ReserveLocked(const block_fifo_request_t* requests, size_t count) {
+    if (status_ != MX_OK) {
+        // Only reads are served once a commit has failed
+        for (size_t i = 0; i < count; i++) {
+            if ((requests[i].opcode & BLOCKIO_OP_MASK) != BLOCKIO_READ) {
+                return status_;
+            }
+        }
+        return MX_OK;
+    }
+
+    // Blocks written more than once by the same operation are counted
+    // each time; the estimate only needs to be an upper bound.
+    uint64_t blocks = 0;
+    size_t trims = 0;
+    for (size_t i = 0; i < count; i++) {
+        const block_fifo_request_t* req = &requests[i];
+        switch (req->opcode & BLOCKIO_OP_MASK) {
+        case BLOCKIO_WRITE: {
+            if (!vmos_.find(req->vmoid).IsValid()) {
+                break;
+            }
+            const blk_t bno = static_cast<blk_t>(req->dev_offset / kMinfsBlockSize);
+            for (uint64_t n = 0; n < req->length / kMinfsBlockSize; n++) {
+                if (FindLocked(static_cast<blk_t>(bno + n)) < 0) {
+                    blocks++;
+                }
+            }
+            break;
+        }
+        case BLOCKIO_TRIM:
+            trims++;
+            break;
+        }
+    }
+
+    if ((Header()->count + blocks <= capacity_) &&
+        (trim_count_ + trims <= fbl::count_of(trims_))) {
+        return MX_OK;
+    }
+    mx_status_t status = CommitLocked();
+    if (status != MX_OK) {
+        return status;
+    }
+    if (blocks > capacity_) {
+        // Could only be written by splitting it across entries, which would
+        // make it possible for half of it to survive a crash.
+        FS_TRACE_ERROR("minfs: operation writes %" PRIu64 " metadata blocks; "
+                       "the journal only holds %u\n", blocks, capacity_);
+        return MX_ERR_NO_SPACE;
+    }
+    return MX_OK;
+}
+
+minfs_journal_header_t* Journal::Header() const {
+    return static_cast<minfs_journal_header_t*>(fs::GetBlock<kMinfsBlockSize>(staging_->GetData(), 1));
+}
+
+void* Journal::Slot(uint32_t slot) const {
+    return fs::GetBlock<kMinfsBlockSize>(staging_->GetData(), 2 + slot);
+}
+
+int32_t Journal::FindLocked(blk_t bno) const {
+    const minfs_journal_header_t* hdr = Header();
+    const size_t mask = index_.size() - 1;
+    for (size_t h = (bno * 2654435761u) & mask; index_[h] != 0; h = (h + 1) & mask) {
+        uint32_t slot = index_[h] - 1;
+        if (hdr->target[slot] == bno) {
+            return static_cast<int32_t>(slot);
+        }
+    }
+    return -1;
+}
+
+mx_status_t Journal::StageLocked(mx_handle_t vmo, uint64_t vmo_offset, blk_t bno,
+                                 uint64_t count) {
+    minfs_journal_header_t* hdr = Header();
+    mx_status_t status;
+    for (uint64_t n = 0; n < count; n++) {
+        int32_t slot = FindLocked(static_cast<blk_t>(bno + n));
+        if (slot < 0) {
+            // Room was reserved by ReserveLocked
+            assert(hdr->count < capacity_);
+            if (hdr->count == 0) {
+                oldest_ = mx_time_get(MX_CLOCK_MONOTONIC);
+                cnd_signal(&wake_);
+            }
+            slot = hdr->count++;
+            hdr->target[slot] = static_cast<blk_t>(bno + n);
+            const size_t mask = index_.size() - 1;
+            size_t h = ((bno + n) * 2654435761u) & mask;
+            while (index_[h] != 0) {
+                h = (h + 1) & mask;
+            }
+            index_[h] = static_cast<uint16_t>(slot + 1);
+        }
+
+        size_t actual;
+        if ((status = mx_vmo_read(vmo, Slot(slot), vmo_offset + n * kMinfsBlockSize,
+                                  kMinfsBlockSize, &actual)) != MX_OK) {
+            return status;
+        } else if (actual != kMinfsBlockSize) {
+            return MX_ERR_IO;
+        }
+    }
+    return MX_OK;
+}
+
+void Journal::RevokeLocked(blk_t bno, uint64_t count) {
+    minfs_journal_header_t* hdr = Header();
+    if (hdr->count == 0) {
+        return;
+    }
+    for (uint64_t n = 0; n < count; n++) {
+        int32_t slot = FindLocked(static_cast<blk_t>(bno + n));
+        if (slot >= 0) {
+            hdr->target[slot] = kMinfsJournalRevoked;
+        }
+    }
+}
+
+mx_status_t Journal::TrimLocked(blk_t bno, uint64_t count) {
+    for (size_t i = 0; i < trim_count_; i++) {
+        block_fifo_request_t* trim = &trims_[i];
+        if (trim->dev_offset + trim->length == bno) {
+            trim->length += count;
+            return MX_OK;
+        }
+    }
+    // Room was reserved by ReserveLocked
+    assert(trim_count_ < fbl::count_of(trims_));
+    if ((Header()->count == 0) && (trim_count_ == 0)) {
+        oldest_ = mx_time_get(MX_CLOCK_MONOTONIC);
+        cnd_signal(&wake_);
+    }
+    // Kept in blocks until the blocks are released
+    block_fifo_request_t* trim = &trims_[trim_count_++];
+    trim->txnid = bc_->TxnId();
+    trim->vmoid = 0;
+    trim->opcode = BLOCKIO_TRIM;
+    trim->vmo_offset = 0;
+    trim->dev_offset = bno;
+    trim->length = count;
+    return MX_OK;
+}
+
+mx_status_t Journal::OverlayLocked(mx_handle_t vmo, uint64_t vmo_offset, blk_t bno,
+                                   uint64_t count) {
+    if (Header()->count == 0) {
+        return MX_OK;
+    }
+    for (uint64_t n = 0; n < count; n++) {
+        int32_t slot = FindLocked(static_cast<blk_t>(bno + n));
+        if (slot < 0) {
+            continue;
+        }
+        size_t actual;
+        mx_status_t status = mx_vmo_write(vmo, Slot(slot), vmo_offset + n * kMinfsBlockSize,
+                                          kMinfsBlockSize, &actual);
+        if (status != MX_OK) {
+            return status;
+        } else if (actual != kMinfsBlockSize) {
+            return MX_ERR_IO;
+        }
+    }
+    return MX_OK;
+}
+
+mx_status_t Journal::WriteStagingLocked(uint64_t vmo_block, blk_t bno, uint64_t count) {
+    block_fifo_request_t request;
+    request.txnid = bc_->TxnId();
+    request.vmoid = staging_vmoid_;
+    request.opcode = BLOCKIO_WRITE;
+    request.length = count * kMinfsBlockSize;
+    request.vmo_offset = vmo_block * kMinfsBlockSize;
+    request.dev_offset = bno * static_cast<uint64_t>(kMinfsBlockSize);
+    mx_status_t status;
+    if ((status = bc_->FifoTxn(&request, 1)) != MX_OK) {
+        return status;
+    }
+    return bc_->Barrier();
+}
+
+mx_status_t Journal::CommitLocked() {
+    if (status_ != MX_OK) {
+        return status_;
+    }
+    mx_status_t status = WriteEntryLocked();
+    if (status != MX_OK) {
+        // The entry may be partly written, and the blocks it holds cannot be
+        // written anywhere else; keep the disk as it is, and fail any further
+        // changes to it.
+        FS_TRACE_ERROR("minfs: journal commit failed: %d; filesystem is now read-only\n",
+                       status);
+        status_ = status;
+    }
+    return status;
+}
+
+mx_status_t Journal::WriteEntryLocked() {
+    minfs_journal_header_t* hdr = Header();
+    const uint32_t count = hdr->count;
+    if (count == 0) {
+        // Anything freed now was freed by an entry which has been
+        // written back already.
+        ReleaseFreedLocked();
+        return MX_OK;
+    }
+
+    hdr->magic = kMinfsJournalHeaderMagic;
+    hdr->seq = seq_;
+    hdr->rsvd = 0;
+    uint64_t checksum = ChecksumUpdate(FNV64_OFFSET_BASIS, hdr, kMinfsBlockSize);
+    for (uint32_t n = 0; n < count; n++) {
+        checksum = ChecksumUpdate(checksum, Slot(n), kMinfsBlockSize);
+    }
+    minfs_journal_commit_t* commit = static_cast<minfs_journal_commit_t*>(Slot(count));
+    memset(commit, 0, kMinfsBlockSize);
+    commit->magic = kMinfsJournalCommitMagic;
+    commit->seq = seq_;
+    commit->checksum = checksum;
+
+    // The header and payload must be stable before the commit block which
+    // vouches for them is written, and the commit block before anything is
+    // written back in place.
+    mx_status_t status;
+    if ((status = WriteStagingLocked(1, start_ + 1, count + 1)) != MX_OK ||
+        (status = WriteStagingLocked(2 + count, start_ + 2 + count, 1)) != MX_OK) {
+        FS_TRACE_ERROR("minfs: failed to write journal entry: %d\n", status);
+        return status;
+    }
+
+    // Write back each block in place, coalescing runs which are contiguous
+    // both in the journal and on disk.
+    block_fifo_request_t requests[MAX_TXN_MESSAGES];
+    size_t request_count = 0;
+    for (uint32_t n = 0; n < count; n++) {
+        const uint64_t target = hdr->target[n];
+        if (target == kMinfsJournalRevoked) {
+            continue;
+        }
+        const uint64_t vmo_offset = (2 + n) * kMinfsBlockSize;
+        const uint64_t dev_offset = target * kMinfsBlockSize;
+        if (request_count != 0) {
+            block_fifo_request_t* prev = &requests[request_count - 1];
+            if ((prev->vmo_offset + prev->length == vmo_offset) &&
+                (prev->dev_offset + prev->length == dev_offset)) {
+                prev->length += kMinfsBlockSize;
+                continue;
+            }
+        }
+        if (request_count == MAX_TXN_MESSAGES) {
+            if ((status = bc_->FifoTxn(requests, request_count)) != MX_OK) {
+                return status;
+            }
+            request_count = 0;
+        }
+        requests[request_count].txnid = bc_->TxnId();
+        requests[request_count].vmoid = staging_vmoid_;
+        requests[request_count].opcode = BLOCKIO_WRITE;
+        requests[request_count].length = kMinfsBlockSize;
+        requests[request_count].vmo_offset = vmo_offset;
+        requests[request_count].dev_offset = dev_offset;
+        request_count++;
+    }
+    if (request_count != 0 && (status = bc_->FifoTxn(requests, request_count)) != MX_OK) {
+        return status;
+    }
+    if ((status = bc_->Barrier()) != MX_OK) {
+        return status;
+    }
+
+    // Retire the entry
+    minfs_journal_info_t* jinfo = static_cast<minfs_journal_info_t*>(staging_->GetData());
+    jinfo->magic = kMinfsJournalMagic;
+    jinfo->seq = seq_ + 1;
+    if ((status = WriteStagingLocked(0, start_, 1)) != MX_OK) {
+        return status;
+    }
+
+    seq_++;
+    hdr->count = 0;
+    memset(index_.get(), 0, index_.size() * sizeof(index_[0]));
+    ReleaseFreedLocked();
+    return MX_OK;
+}
+
+void Journal::ReleaseFreedLocked() {
+    if (trim_count_ == 0) {
+        return;
+    }
+    for (size_t i = 0; i < trim_count_; i++) {
+        fbl::AllocChecker ac;
+        freed_.push_back(BlockRun{static_cast<blk_t>(trims_[i].dev_offset), trims_[i].length}, &ac);
+        if (!ac.check()) {
+            FS_TRACE_WARN("minfs: %" PRIu64 " freed blocks unavailable until remount\n",
+                          trims_[i].length);
+        }
+    }
+    if (bc_->SupportsTrim()) {
+        for (size_t i = 0; i < trim_count_; i++) {
+            const uint64_t length = trims_[i].length;
+            assert(length <= UINT64_MAX / kMinfsBlockSize); // Overflow
+            trims_[i].dev_offset *= kMinfsBlockSize;
+            trims_[i].length = length * kMinfsBlockSize;
+        }
+        // Discards are advisory; the blocks are already free on disk
+        mx_status_t status = bc_->FifoTxn(trims_, trim_count_);
+        if (status != MX_OK) {
+            FS_TRACE_WARN("minfs: failed to discard freed blocks: %d\n", status);
+        }
+    }
+    trim_count_ = 0;
+}
+
+#endif
+
+} // namespace minfs
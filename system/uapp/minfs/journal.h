@@ -0,0 +1,161 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#ifdef __Fuchsia__
+#include <threads.h>
+
+#include <fs/mapped-vmo.h>
+#include <mx/vmo.h>
+#endif
+
+#include <fbl/array.h>
+#include <fbl/intrusive_hash_table.h>
+#include <fbl/intrusive_single_list.h>
+#include <fbl/macros.h>
+#include <fbl/unique_ptr.h>
+
+#include "minfs.h"
+
+namespace minfs {
+
+// Replays the pending journal entry (if any) of the filesystem described by
+// |info| into place, and retires it. Must be called before the rest of the
+// metadata is read from disk.
+mx_status_t minfs_journal_replay(Bcache* bc, const minfs_info_t* info);
+
+// Initializes an empty journal for the filesystem described by |info|.
+mx_status_t minfs_journal_format(Bcache* bc, const minfs_info_t* info);
+
+#ifdef __Fuchsia__
+
+// Journal batches metadata writes issued through Bcache::Txn.
+//
+// Metadata blocks are copied out of their source VMOs when the write is
+// issued, and held in a staging VMO which mirrors the on-disk layout of the
+// journal. Multiple writes to the same block are coalesced. The batch is
+// committed as a single entry (one sequential write), and then written back
+// in place, when:
+// - It grows past half of the journal,
+// - The next transaction would not fit alongside it,
+// - The filesystem is synced or unmounted,
+// - kJournalCommitInterval passes with blocks still pending.
+//
+// Writes of file data bypass the journal; since they are issued immediately
+// they always reach the disk before any metadata which refers to them. They
+// are issued without holding the journal's lock.
+//
+// If a commit fails, the journal stops: the pending blocks are kept out of
+// place, and every further write fails, leaving the filesystem read-only.
+//
+// Blocks freed by an entry (announced as BLOCKIO_TRIM requests issued after
+// the bitmap writes which free them) must not be reused until that entry is
+// committed and written back; otherwise file data could overwrite blocks
+// which the metadata on disk still refers to. They are handed back through
+// TakeFreed() only then, and discarded on the device if it supports it.
+//
+// Each step of a commit is made stable before the next is written: the
+// header and payload, then the commit block, then the blocks written back
+// in place, then the retired journal info.
+class Journal {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(Journal);
+
+    static mx_status_t Create(Bcache* bc, const minfs_info_t* info,
+                              fbl::unique_ptr<Journal>* out);
+    // Commits any pending blocks before returning.
+    ~Journal();
+
+    // Identifies |vmoid| (a duplicate of |vmo|) as a source of metadata.
+    mx_status_t TrackVmo(mx_handle_t vmo, vmoid_t vmoid);
+
+    // Stages metadata writes, passes everything else through to the device.
+    // Reads are served from the pending batch where it is newer than the disk.
+    // The metadata of a single transaction (at most MAX_TXN_MESSAGES
+    // requests) is always committed in the same entry.
+    //
+    // Once a commit has failed, every request but reads fails with its error.
+    mx_status_t Txn(block_fifo_request_t* requests, size_t count);
+
+    // Commits and writes back all pending blocks.
+    mx_status_t Commit();
+
+    // Moves the device blocks freed by entries which have been written back
+    // since the last call into |out|.
+    void TakeFreed(fbl::Vector<BlockRun>* out);
+
+private:
+    struct TrackedVmo : public fbl::SinglyLinkedListable<fbl::unique_ptr<TrackedVmo>> {
+        vmoid_t GetKey() const { return vmoid; }
+        static size_t GetHash(vmoid_t key) { return key; }
+
+        vmoid_t vmoid;
+        mx::vmo vmo;
+    };
+    using VmoTable = fbl::HashTable<vmoid_t, fbl::unique_ptr<TrackedVmo>>;
+
+    Journal(Bcache* bc, const minfs_info_t* info, uint32_t capacity);
+
+    static int CommitThread(void* arg);
+
+    // The following must be called with |lock_| held.
+    // Commits the pending blocks, failing the journal if that fails.
+    mx_status_t CommitLocked();
+    mx_status_t WriteEntryLocked();
+    // Commits the pending blocks first if the metadata blocks and freed runs
+    // of |requests| would not fit alongside them.
+    mx_status_t ReserveLocked(const block_fifo_request_t* requests, size_t count);
+    // Copies |count| blocks of |vmo|, starting at byte |vmo_offset|, into the
+    // pending batch, targeting device block |bno| onwards. Room for them must
+    // have been reserved.
+    mx_status_t StageLocked(mx_handle_t vmo, uint64_t vmo_offset, blk_t bno, uint64_t count);
+    // Drops pending blocks in [bno, bno + count), which were overwritten with file data.
+    void RevokeLocked(blk_t bno, uint64_t count);
+    // Holds back the freed blocks [bno, bno + count) until the pending
+    // blocks have been written back.
+    mx_status_t TrimLocked(blk_t bno, uint64_t count);
+    // Hands the held back blocks over to TakeFreed(), discarding them on
+    // the device if it supports it.
+    void ReleaseFreedLocked();
+    // Writes |count| blocks of the staging VMO from block |vmo_block| to
+    // device block |bno|, and waits for them to be stable.
+    mx_status_t WriteStagingLocked(uint64_t vmo_block, blk_t bno, uint64_t count);
+    // Copies pending blocks in [bno, bno + count) into |vmo| at byte |vmo_offset|.
+    mx_status_t OverlayLocked(mx_handle_t vmo, uint64_t vmo_offset, blk_t bno, uint64_t count);
+    // Returns the payload slot staging |bno|, or -1.
+    int32_t FindLocked(blk_t bno) const;
+    minfs_journal_header_t* Header() const;
+    void* Slot(uint32_t slot) const;
+
+    Bcache* bc_;
+    blk_t start_;               // device block of the journal
+    const uint32_t capacity_;   // maximum payload blocks per entry
+    uint64_t seq_{};
+
+    mtx_t lock_;
+    cnd_t wake_;
+    thrd_t thread_;
+    bool thread_running_{};
+    bool stopping_{};
+    mx_time_t oldest_{};        // when the first pending block was staged
+    mx_status_t status_{};      // error of the first failed commit
+
+    // Mirrors the on-disk journal: info block, header, payload, commit block.
+    fbl::unique_ptr<MappedVmo> staging_{};
+    vmoid_t staging_vmoid_{};
+    // Open-addressed map of device block to (payload slot + 1).
+    fbl::Array<uint16_t> index_{};
+    VmoTable vmos_{};
+    // Blocks freed by the pending blocks, to release once they are
+    // written back.
+    block_fifo_request_t trims_[MAX_TXN_MESSAGES];
+    size_t trim_count_{};
+    // Released blocks not yet taken by TakeFreed().
+    fbl::Vector<BlockRun> freed_{};
+};
+
+#endif
+
+} // namespace minfs
@@ -38,6 +38,10 @@ int run_fs_tests(int argc, char** argv);
 
 namespace {
 
+// Cache limits requested on the command line; zero keeps the default.
+uint32_t cache_vnodes = 0;
+uint32_t cache_blocks = 0;
+
 int do_minfs_check(fbl::unique_ptr<minfs::Bcache> bc, int argc, char** argv) {
 #ifdef __Fuchsia__
     return minfs_check(fbl::move(bc));
@@ -52,6 +56,7 @@ int do_minfs_mount(fbl::unique_ptr<minfs::Bcache> bc, int argc, char** argv) {
     if (minfs_mount(&vn, fbl::move(bc)) < 0) {
         return -1;
     }
+    vn->fs_->SetCacheLimits(cache_vnodes, cache_blocks);
 
     mx_handle_t h = mx_get_startup_handle(PA_HND(PA_USER0, 0));
     if (h == MX_HANDLE_INVALID) {
@@ -67,7 +72,7 @@ int do_minfs_mount(fbl::unique_ptr<minfs::Bcache> bc, int argc, char** argv) {
                                             mx::channel(h))) != MX_OK) {
         return status;
     }
-    loop.Run();
+    fs::RunDispatchLoop(&loop, "minfs-dispatcher");
     return 0;
 }
 #else
@@ -76,6 +81,12 @@ int io_setup(fbl::unique_ptr<minfs::Bcache> bc) {
     if (minfs_mount(&vn, fbl::move(bc)) < 0) {
         return -1;
     }
+    // The root stays open for as long as the tool runs.
+    fbl::RefPtr<fs::Vnode> root = vn;
+    if (root->Open(O_RDONLY | O_DIRECTORY) != MX_OK) {
+        return -1;
+    }
+    vn->fs_->SetCacheLimits(cache_vnodes, cache_blocks);
     fake_root = vn;
     return 0;
 }
@@ -252,8 +263,9 @@ struct {
 } CMDS[] = {
     {"create", do_minfs_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
     {"mkfs", do_minfs_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
-    {"check", do_minfs_check, O_RDONLY, "check filesystem integrity"},
-    {"fsck", do_minfs_check, O_RDONLY, "check filesystem integrity"},
+    // Checking may replay the journal
+    {"check", do_minfs_check, O_RDWR, "check filesystem integrity"},
+    {"fsck", do_minfs_check, O_RDWR, "check filesystem integrity"},
 #ifdef __Fuchsia__
     {"mount", do_minfs_mount, O_RDWR, "mount filesystem"},
 #else
@@ -274,6 +286,8 @@ int usage() {
             "\n"
             "options:  -v         some debug messages\n"
             "          -vv        all debug messages\n"
+            "          --cache-vnodes=<n>  closed vnodes kept in memory\n"
+            "          --cache-blocks=<n>  file data blocks kept in memory\n"
 #ifdef __Fuchsia__
             "\n"
             "On Fuchsia, MinFS takes the block device argument by handle.\n"
@@ -318,6 +332,10 @@ int main(int argc, char** argv) {
             fs_trace_on(FS_TRACE_SOME);
         } else if (!strcmp(argv[1], "-vv")) {
             fs_trace_on(FS_TRACE_ALL);
+        } else if (!strncmp(argv[1], "--cache-vnodes=", 15)) {
+            cache_vnodes = static_cast<uint32_t>(strtoul(argv[1] + 15, nullptr, 10));
+        } else if (!strncmp(argv[1], "--cache-blocks=", 15)) {
+            cache_blocks = static_cast<uint32_t>(strtoul(argv[1] + 15, nullptr, 10));
         } else {
             break;
         }
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "journal.h"
 #include "minfs-private.h"
 #include "minfs.h"
 
@@ -266,7 +267,112 @@ const char* MinfsChecker::CheckDataBlock(blk_t bno) {
     return nullptr;
 }
 
+mx_status_t MinfsChecker::CheckExtentBlock(ino_t ino, uint32_t index, blk_t bno,
+                                          minfs_extent_block_t* out) {
+    if (bno == 0) {
+        FS_TRACE_ERROR("check: ino#%u: extent block %u missing\n", ino, index);
+        return MX_ERR_IO_DATA_INTEGRITY;
+    }
+    const char* msg;
+    if ((msg = CheckDataBlock(bno)) != nullptr) {
+        FS_TRACE_WARN("check: ino#%u: extent block %u (@%u): %s\n", ino, index, bno, msg);
+        conforming_ = false;
+        if (bno >= fs_->info_.block_count) {
+            return MX_ERR_IO_DATA_INTEGRITY;
+        }
+    }
+    return fs_->bc_->Readblk(bno + fs_->info_.dat_block, out);
+}
+
+mx_status_t MinfsChecker::CheckExtents(minfs_inode_t* inode, ino_t ino) {
+    const minfs_extent_map_t* map = MinfsExtentMap(inode);
+    FS_TRACE_INFO("Extents: %u (extent block %u)\n", map->count, map->eblock);
+
+    uint32_t block_count = 0;
+    minfs_extent_block_t block;
+
+    if (map->count > kMinfsMaxFileBlock) {
+        FS_TRACE_ERROR("check: ino#%u: too many extents (%u)\n", ino, map->count);
+        return MX_ERR_IO_DATA_INTEGRITY;
+    } else if ((map->count > kMinfsInlineExtents) && (map->eblock == 0)) {
+        FS_TRACE_ERROR("check: ino#%u: %u extents without extent block\n", ino, map->count);
+        return MX_ERR_IO_DATA_INTEGRITY;
+    } else if ((map->count <= kMinfsInlineExtents) && (map->eblock != 0)) {
+        FS_TRACE_WARN("check: ino#%u: %u extents with unnecessary extent block\n", ino,
+                      map->count);
+        conforming_ = false;
+    }
+
+    mx_status_t status;
+    if (map->eblock) {
+        if ((status = CheckExtentBlock(ino, 0, map->eblock, &block)) != MX_OK) {
+            return status;
+        }
+        block_count++;
+    }
+
+    // The next block which would be allocated if we expand the file size
+    // by a single block.
+    blk_t next_blk = 0;
+    for (uint32_t i = 0; i < map->count; i++) {
+        if (map->eblock && i > 0 && (i % kMinfsExtentsPerBlock) == 0) {
+            // Move on to the next extent block in the chain
+            if ((status = CheckExtentBlock(ino, i / kMinfsExtentsPerBlock, block.next,
+                                           &block)) != MX_OK) {
+                return status;
+            }
+            block_count++;
+        }
+        const minfs_extent_t* e = map->eblock ? &block.extents[i % kMinfsExtentsPerBlock] :
+                                                &map->extents[i];
+        if (e->count == 0) {
+            FS_TRACE_WARN("check: ino#%u: extent %u is empty\n", ino, i);
+            conforming_ = false;
+            continue;
+        } else if (e->fblock < next_blk) {
+            FS_TRACE_WARN("check: ino#%u: extent %u overlaps or is out of order\n", ino, i);
+            conforming_ = false;
+        } else if (e->fblock + e->count > kMinfsMaxFileBlock) {
+            FS_TRACE_ERROR("check: ino#%u: extent %u beyond max file size\n", ino, i);
+            return MX_ERR_IO_DATA_INTEGRITY;
+        }
+        for (blk_t n = 0; n < e->count; n++) {
+            const char* msg;
+            if ((msg = CheckDataBlock(e->start + n)) != nullptr) {
+                FS_TRACE_WARN("check: ino#%u: block %u(@%u): %s\n", ino, e->fblock + n,
+                              e->start + n, msg);
+                conforming_ = false;
+            }
+        }
+        block_count += e->count;
+        next_blk = e->fblock + e->count;
+    }
+    if (map->eblock && block.next != 0) {
+        FS_TRACE_WARN("check: ino#%u: extent block chain continues past the last extent\n",
+                      ino);
+        conforming_ = false;
+    }
+
+    if (next_blk) {
+        unsigned max_blocks = fbl::roundup(inode->size, kMinfsBlockSize) / kMinfsBlockSize;
+        if (next_blk > max_blocks) {
+            FS_TRACE_WARN("check: ino#%u: filesize too small\n", ino);
+            conforming_ = false;
+        }
+    }
+    if (block_count != inode->block_count) {
+        FS_TRACE_WARN("check: ino#%u: block count %u, actual blocks %u\n",
+             ino, inode->block_count, block_count);
+        conforming_ = false;
+    }
+    return MX_OK;
+}
+
 mx_status_t MinfsChecker::CheckFile(minfs_inode_t* inode, ino_t ino) {
+    if (inode->inode_flags & kMinfsInodeFlagExtents) {
+        return CheckExtents(inode, ino);
+    }
+
     FS_TRACE_INFO("Direct blocks: \n");
     for (unsigned n = 0; n < kMinfsDirect; n++) {
         FS_TRACE_INFO(" %d,", inode->dnum[n]);
@@ -420,6 +526,21 @@ mx_status_t MinfsChecker::CheckInode(ino_t ino, ino_t parent, bool dot_or_dotdot
     return MX_OK;
 }
 
+mx_status_t MinfsChecker::CheckJournal() {
+    if ((fs_->info_.flags & kMinfsFlagJournal) == 0) {
+        return MX_OK;
+    }
+    for (blk_t n = 0; n < fs_->info_.jnl_blocks; n++) {
+        const char* msg;
+        if ((msg = CheckDataBlock(fs_->info_.jnl_start + n)) != nullptr) {
+            FS_TRACE_ERROR("check: journal block %u: %s\n", n, msg);
+            conforming_ = false;
+            return MX_ERR_BAD_STATE;
+        }
+    }
+    return MX_OK;
+}
+
 mx_status_t MinfsChecker::CheckForUnusedBlocks() const {
     unsigned missing = 0;
     for (unsigned n = fs_->info_.dat_block; n < fs_->info_.block_count; n++) {
@@ -524,6 +645,15 @@ mx_status_t minfs_check(fbl::unique_ptr<Bcache> bc) {
     if (minfs_check_info(info, bc->Maxblk())) {
         return -1;
     }
+    if (info->flags & kMinfsFlagJournal) {
+        // Check the filesystem as it will be seen once mounted
+        if ((status = minfs_journal_replay(bc.get(), info)) != MX_OK) {
+            return status;
+        } else if (bc->Readblk(0, data) < 0) {
+            FS_TRACE_ERROR("minfs: could not read info block\n");
+            return -1;
+        }
+    }
 
     MinfsChecker chk;
     if ((status = chk.Init(fbl::move(bc), info)) != MX_OK) {
@@ -534,6 +664,9 @@ mx_status_t minfs_check(fbl::unique_ptr<Bcache> bc) {
     if ((status = chk.CheckInode(1, 1, 0)) < 0) {
         return status;
     }
+    if ((status = chk.CheckJournal()) < 0) {
+        return status;
+    }
 
     status = MX_OK;
     mx_status_t r;
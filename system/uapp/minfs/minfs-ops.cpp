@@ -12,10 +12,13 @@
 
 #include <fs/block-txn.h>
 #include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/auto_call.h>
 #include <magenta/device/vfs.h>
 
 #ifdef __Fuchsia__
 #include <magenta/syscalls.h>
+#include <mxio/remoteio.h>
 #include <mxio/vfs.h>
 #endif
 
@@ -198,6 +201,10 @@ mx_status_t VnodeMinfs::BlocksShrinkDoublyIndirect(WriteTxn *txn, uint32_t ibind
 // Delete all blocks (relative to a file) from "start" (inclusive) to the end of
 // the file. Does not update mtime/atime.
 mx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, blk_t start) {
+    if (IsExtentMapped()) {
+        return ExtentsShrink(txn, start);
+    }
+
     bool dirty = false;
     mx_status_t status = MX_OK;
     size_t size = (kMinfsIndirect + kMinfsDoublyIndirect) * kMinfsBlockSize;
@@ -305,8 +312,9 @@ mx_status_t VnodeMinfs::InitIndirectVmo() {
     }
 
     mx_status_t status;
-    if ((status = MappedVmo::Create(kMinfsBlockSize * (kMinfsIndirect + kMinfsDoublyIndirect),
-                                    "minfs-indirect", &vmo_indirect_)) != MX_OK) {
+    size_t size = IsExtentMapped() ? kMinfsBlockSize :
+                                     kMinfsBlockSize * (kMinfsIndirect + kMinfsDoublyIndirect);
+    if ((status = MappedVmo::Create(size, "minfs-indirect", &vmo_indirect_)) != MX_OK) {
         return status;
     }
     if ((status = fs_->bc_->AttachVmo(vmo_indirect_->GetVmo(), &vmoid_indirect_)) != MX_OK) {
@@ -314,6 +322,25 @@ mx_status_t VnodeMinfs::InitIndirectVmo() {
         return status;
     }
 
+    if (IsExtentMapped()) {
+        // Only the extent blocks (if any) need to be cached; each one names
+        // the next block in the chain.
+        const minfs_extent_map_t* map = MinfsExtentMap(&inode_);
+        blk_t bno = map->eblock;
+        for (uint32_t i = 0; i < MinfsExtentBlocks(map->count); i++) {
+            if (bno == 0) {
+                vmo_indirect_ = nullptr;
+                return MX_ERR_IO_DATA_INTEGRITY;
+            }
+            if ((status = LoadIndirectBlocks(&bno, 1, i, (i + 1) * kMinfsBlockSize)) != MX_OK) {
+                vmo_indirect_ = nullptr;
+                return status;
+            }
+            bno = ExtentBlock(i)->next;
+        }
+        return MX_OK;
+    }
+
     // Load initial set of indirect blocks
     if ((status = LoadIndirectBlocks(inode_.inum, kMinfsIndirect, 0, 0)) != MX_OK) {
         vmo_indirect_ = nullptr;
@@ -333,11 +360,8 @@ mx_status_t VnodeMinfs::InitIndirectVmo() {
 
 // Since we cannot yet register the filesystem as a paging service (and cleanly
 // fault on pages when they are actually needed), we currently read an entire
-// file to a VMO when a file's data block are accessed.
-//
-// TODO(smklein): Even this hack can be optimized; a bitmap could be used to
-// track all 'empty/read/dirty' blocks for each vnode, rather than reading
-// the entire file.
+// directory to a VMO when its data blocks are accessed. Files are read one
+// range of blocks at a time, as they are accessed (see LoadForRead).
 mx_status_t VnodeMinfs::InitVmo() {
     if (vmo_.is_valid()) {
         return MX_OK;
@@ -352,12 +376,52 @@ mx_status_t VnodeMinfs::InitVmo() {
 
     mx_object_set_property(vmo_.get(), MX_PROP_NAME, "minfs-inode", 11);
 
-    if ((status = fs_->bc_->AttachVmo(vmo_.get(), &vmoid_)) != MX_OK) {
+    // Directory contents are metadata, and are journaled; file contents are not.
+    if ((status = IsDirectory() ? fs_->bc_->AttachVmo(vmo_.get(), &vmoid_) :
+                                  fs_->bc_->AttachDataVmo(vmo_.get(), &vmoid_)) != MX_OK) {
         vmo_.reset();
         return status;
     }
+
+    if (!IsDirectory()) {
+        // Only the block map is read up front; GetBno expects the indirect
+        // blocks within doubly indirect blocks to be present.
+        blk_t count = static_cast<blk_t>(fbl::roundup(inode_.size, kMinfsBlockSize) /
+                                         kMinfsBlockSize);
+        if ((status = ReserveLoaded(count)) != MX_OK) {
+            vmo_.reset();
+            return status;
+        }
+        for (uint32_t i = 0; !IsExtentMapped() && (i < kMinfsDoublyIndirect); i++) {
+            if (inode_.dinum[i] != 0) {
+                fs_->ValidateBno(inode_.dinum[i]);
+                if (((status = InitIndirectVmo()) != MX_OK) ||
+                    ((status = LoadIndirectWithinDoublyIndirect(i)) != MX_OK)) {
+                    vmo_.reset();
+                    return status;
+                }
+            }
+        }
+        return MX_OK;
+    }
+
     ReadTxn txn(fs_->bc_.get());
 
+    if (IsExtentMapped()) {
+        // Each extent is read with a single request
+        if ((status = ExtentsLoad()) != MX_OK) {
+            vmo_.reset();
+            return status;
+        }
+        for (uint32_t i = 0; i < MinfsExtentMap(&inode_)->count; i++) {
+            const minfs_extent_t* e = ExtentAt(i);
+            fs_->ValidateBno(e->start);
+            fs_->ValidateBno(e->start + e->count - 1);
+            txn.Enqueue(vmoid_, e->fblock, e->start + fs_->info_.dat_block, e->count);
+        }
+        return txn.Flush();
+    }
+
     // Initialize all direct blocks
     blk_t bno;
     for (uint32_t d = 0; d < kMinfsDirect; d++) {
@@ -427,7 +491,7 @@ mx_status_t VnodeMinfs::InitVmo() {
                             fs_->ValidateBno(bno);
                             uint32_t n = kMinfsDirect + kMinfsIndirect * kMinfsDirectPerIndirect
                                          + j * kMinfsDirectPerIndirect + k;
-                            txn.Enqueue(vmoid_, n, bno, 1);
+                            txn.Enqueue(vmoid_, n, bno + fs_->info_.dat_block, 1);
                         }
                     }
                 }
@@ -437,6 +501,171 @@ mx_status_t VnodeMinfs::InitVmo() {
 
     return txn.Flush();
 }
+
+// Returns the number of set bits in [start, end).
+static size_t CountLoaded(const RawBitmap& map, size_t start, size_t end) {
+    size_t count = 0;
+    while ((start = map.Scan(start, end, false)) < end) {
+        size_t run_end = map.Scan(start, end, true);
+        count += run_end - start;
+        start = run_end;
+    }
+    return count;
+}
+
+mx_status_t VnodeMinfs::ReserveLoaded(blk_t count) {
+    if ((loaded_ != nullptr) && (loaded_->size() >= count)) {
+        return MX_OK;
+    }
+
+    size_t old_size = (loaded_ == nullptr) ? 0 : loaded_->size();
+    size_t size = fbl::max(fbl::max(static_cast<size_t>(count), old_size * 2),
+                           static_cast<size_t>(kMinfsBlockBits));
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<RawBitmap> loaded(new (&ac) RawBitmap());
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    mx_status_t status;
+    if ((status = loaded->Reset(size)) != MX_OK) {
+        return status;
+    }
+    for (size_t start = 0; (start = loaded_->Scan(start, old_size, false)) < old_size;) {
+        size_t end = loaded_->Scan(start, old_size, true);
+        loaded->Set(start, end);
+        start = end;
+    }
+    loaded_ = fbl::move(loaded);
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::LoadBlocks(blk_t start, blk_t end, uint32_t* out_count) {
+    *out_count = 0;
+    if (IsDirectory()) {
+        return MX_OK;
+    }
+
+    end = fbl::min(end, static_cast<blk_t>(fbl::roundup(inode_.size, kMinfsBlockSize) /
+                                           kMinfsBlockSize));
+    if (start >= end) {
+        return MX_OK;
+    }
+    mx_status_t status;
+    if ((status = ReserveLoaded(end)) != MX_OK) {
+        return status;
+    }
+
+    // Sparse blocks need no I/O: they are already zero in vmo_.
+    ReadTxn txn(fs_->bc_.get());
+    size_t count = 0;
+    for (size_t n = start; (n = loaded_->Scan(n, end, true)) < end;) {
+        size_t run_end = loaded_->Scan(n, end, false);
+        count += run_end - n;
+        for (; n < run_end; n++) {
+            blk_t bno;
+            if ((status = GetBno(nullptr, static_cast<blk_t>(n), &bno)) != MX_OK) {
+                return status;
+            }
+            if (bno != 0) {
+                txn.Enqueue(vmoid_, n, bno + fs_->info_.dat_block, 1);
+            }
+        }
+    }
+    if (count == 0) {
+        return MX_OK;
+    } else if ((status = txn.Flush()) != MX_OK) {
+        return status;
+    }
+
+    loaded_->Set(start, end);
+    resident_blocks_ += static_cast<uint32_t>(count);
+    fs_->CacheCharge(this, static_cast<uint32_t>(count));
+    *out_count = static_cast<uint32_t>(count);
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::LoadForRead(size_t off, size_t len) {
+    if (IsDirectory()) {
+        return MX_OK;
+    }
+
+    blk_t start = static_cast<blk_t>(off / kMinfsBlockSize);
+    blk_t end = static_cast<blk_t>(fbl::roundup(off + len, kMinfsBlockSize) / kMinfsBlockSize);
+    // A read which picks up where the last one left off (possibly within the
+    // same block) grows the read-ahead window; any other read resets it.
+    bool sequential = (start == readahead_next_) || (start + 1 == readahead_next_);
+    readahead_next_ = end;
+    if (!sequential) {
+        readahead_ = 0;
+    }
+
+    mx_status_t status;
+    if ((status = ReserveLoaded(end)) != MX_OK) {
+        return status;
+    }
+    size_t present = CountLoaded(*loaded_, start, end);
+    fs_->cache_hits_.fetch_add(present);
+    if (present == end - start) {
+        return MX_OK;
+    }
+    fs_->cache_misses_.fetch_add((end - start) - present);
+
+    if (sequential) {
+        readahead_ = (readahead_ == 0) ? kMinfsReadAheadMin :
+                                         fbl::min(readahead_ * 2, kMinfsReadAheadMax);
+    }
+    if (fs_->CacheFull()) {
+        // Nothing else could be evicted to make room; the bulk of the cached
+        // data belongs to this file.
+        fs_->CacheUncharge(EvictBlocks());
+    }
+
+    uint32_t count;
+    if ((status = LoadBlocks(start, end + readahead_, &count)) != MX_OK) {
+        return status;
+    }
+    if (count > (end - start) - present) {
+        fs_->cache_readahead_.fetch_add(count - ((end - start) - present));
+    }
+    return MX_OK;
+}
+
+void VnodeMinfs::ForgetBlocks(blk_t start) {
+    if ((loaded_ == nullptr) || (start >= loaded_->size())) {
+        return;
+    }
+    uint32_t count = static_cast<uint32_t>(CountLoaded(*loaded_, start, loaded_->size()));
+    loaded_->Clear(start, loaded_->size());
+    resident_blocks_ -= count;
+    fs_->CacheUncharge(count);
+}
+
+uint32_t VnodeMinfs::EvictBlocks() {
+    if ((resident_blocks_ == 0) || (readers_.load() != 0)) {
+        return 0;
+    }
+    if (cloned_) {
+        // The clones hold on to vmo_ (and the pages they have not copied yet)
+        // for as long as they are mapped; the vnode starts over with a new one.
+        block_fifo_request_t request;
+        request.txnid = fs_->bc_->TxnId();
+        request.vmoid = vmoid_;
+        request.opcode = BLOCKIO_CLOSE_VMO;
+        if (fs_->bc_->Txn(&request, 1) != MX_OK) {
+            return 0;
+        }
+        vmo_.reset();
+        cloned_ = false;
+    } else if (vmo_.op_range(MX_VMO_OP_DECOMMIT, 0, fbl::roundup(inode_.size, kMinfsBlockSize),
+                             nullptr, 0) != MX_OK) {
+        return 0;
+    }
+    loaded_->ClearAll();
+    uint32_t count = resident_blocks_;
+    fs_->cache_evictions_.fetch_add(count);
+    resident_blocks_ = 0;
+    return count;
+}
 #endif
 
 mx_status_t VnodeMinfs::GetBnoDirect(WriteTxn* txn, blk_t* bno, bool* dirty) {
@@ -597,8 +826,316 @@ void VnodeMinfs::ClearIndirectBlock(blk_t bno) {
 }
 #endif
 
+mx_status_t VnodeMinfs::ExtentsLoad() {
+    minfs_extent_map_t* map = MinfsExtentMap(&inode_);
+    if (map->eblock == 0) {
+        return MX_OK;
+    }
+#ifdef __Fuchsia__
+    // The whole chain is read when the indirect VMO is created
+    return InitIndirectVmo();
+#else
+    if (extent_blocks_.size() != 0) {
+        return MX_OK;
+    }
+    blk_t bno = map->eblock;
+    for (uint32_t i = 0; i < MinfsExtentBlocks(map->count); i++) {
+        if (bno == 0) {
+            extent_blocks_.reset();
+            return MX_ERR_IO_DATA_INTEGRITY;
+        }
+        fs_->ValidateBno(bno);
+        fbl::AllocChecker ac;
+        fbl::unique_ptr<minfs_extent_block_t> block(new (&ac) minfs_extent_block_t);
+        if (!ac.check()) {
+            extent_blocks_.reset();
+            return MX_ERR_NO_MEMORY;
+        }
+        if (fs_->bc_->Readblk(bno + fs_->info_.dat_block, block.get()) != MX_OK) {
+            extent_blocks_.reset();
+            return MX_ERR_IO;
+        }
+        bno = block->next;
+        extent_blocks_.push_back(fbl::move(block), &ac);
+        if (!ac.check()) {
+            extent_blocks_.reset();
+            return MX_ERR_NO_MEMORY;
+        }
+    }
+    return MX_OK;
+#endif
+}
+
+minfs_extent_block_t* VnodeMinfs::ExtentBlock(uint32_t index) {
+#ifdef __Fuchsia__
+    uintptr_t data = reinterpret_cast<uintptr_t>(vmo_indirect_->GetData());
+    return reinterpret_cast<minfs_extent_block_t*>(data + index * kMinfsBlockSize);
+#else
+    return extent_blocks_[index].get();
+#endif
+}
+
+minfs_extent_t* VnodeMinfs::ExtentAt(uint32_t index) {
+    minfs_extent_map_t* map = MinfsExtentMap(&inode_);
+    if (map->eblock == 0) {
+        return &map->extents[index];
+    }
+    return &ExtentBlock(index / kMinfsExtentsPerBlock)->extents[index % kMinfsExtentsPerBlock];
+}
+
+mx_status_t VnodeMinfs::ExtentsAddBlock(WriteTxn* txn) {
+    minfs_extent_map_t* map = MinfsExtentMap(&inode_);
+    uint32_t blocks = MinfsExtentBlocks(map->count);
+    mx_status_t status;
+    blk_t bno;
+    if ((status = fs_->BlockNew(txn, 0, &bno)) != MX_OK) {
+        return status;
+    }
+#ifdef __Fuchsia__
+    if ((status = InitIndirectVmo()) != MX_OK ||
+        (vmo_indirect_->GetSize() < (blocks + 1) * kMinfsBlockSize &&
+         (status = vmo_indirect_->Grow((blocks + 1) * kMinfsBlockSize)) != MX_OK)) {
+        fs_->BlockFree(txn, bno);
+        return status;
+    }
+#else
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<minfs_extent_block_t> new_block(new (&ac) minfs_extent_block_t);
+    if (ac.check()) {
+        extent_blocks_.push_back(fbl::move(new_block), &ac);
+    }
+    if (!ac.check()) {
+        fs_->BlockFree(txn, bno);
+        return MX_ERR_NO_MEMORY;
+    }
+#endif
+    minfs_extent_block_t* block = ExtentBlock(blocks);
+    memset(block, 0, kMinfsBlockSize);
+    if (blocks == 0) {
+        // Move the extent list out of the inode, into its own block
+        memcpy(block->extents, map->extents, map->count * sizeof(minfs_extent_t));
+        memset(map->extents, 0, sizeof(map->extents));
+        map->eblock = bno;
+    } else {
+        ExtentBlock(blocks - 1)->next = bno;
+    }
+    inode_.block_count++;
+    return MX_OK;
+}
+
+void VnodeMinfs::ExtentsFreeBlocks(WriteTxn* txn, uint32_t old_blocks) {
+    minfs_extent_map_t* map = MinfsExtentMap(&inode_);
+    uint32_t blocks = MinfsExtentBlocks(map->count);
+    if (blocks >= old_blocks) {
+        return;
+    }
+
+    blk_t bno = (blocks == 0) ? map->eblock : ExtentBlock(blocks - 1)->next;
+    for (uint32_t i = blocks; i < old_blocks; i++) {
+        blk_t next = ExtentBlock(i)->next;
+        fs_->BlockFree(txn, bno);
+        inode_.block_count--;
+        bno = next;
+    }
+
+    if (blocks == 0) {
+        // The extent list fits in the inode again
+        memset(map->extents, 0, sizeof(map->extents));
+        memcpy(map->extents, ExtentBlock(0)->extents, map->count * sizeof(minfs_extent_t));
+        map->eblock = 0;
+    } else {
+        ExtentBlock(blocks - 1)->next = 0;
+    }
+
+#ifdef __Fuchsia__
+    size_t size = fbl::max(blocks, 1u) * kMinfsBlockSize;
+    if (vmo_indirect_->GetSize() > size) {
+        vmo_indirect_->Shrink(0, size);
+    }
+#else
+    while (extent_blocks_.size() > blocks) {
+        extent_blocks_.pop_back();
+    }
+#endif
+}
+
+void VnodeMinfs::ExtentsSync(WriteTxn* txn, uint32_t first, uint32_t end) {
+    minfs_extent_map_t* map = MinfsExtentMap(&inode_);
+    end = fbl::min(end, MinfsExtentBlocks(map->count));
+    if (first < end) {
+        blk_t bno = (first == 0) ? map->eblock : ExtentBlock(first - 1)->next;
+        for (uint32_t i = first; i < end; i++) {
+#ifdef __Fuchsia__
+            txn->Enqueue(vmoid_indirect_, i, bno + fs_->info_.dat_block, 1);
+#else
+            txn->Enqueue(ExtentBlock(i), 0, bno + fs_->info_.dat_block, 1);
+#endif
+            bno = ExtentBlock(i)->next;
+        }
+    }
+    InodeSync(txn, kMxFsSyncDefault);
+}
+
+mx_status_t VnodeMinfs::GetBnoExtent(WriteTxn* txn, blk_t n, blk_t* bno) {
+    mx_status_t status;
+    if ((status = ExtentsLoad()) != MX_OK) {
+        return status;
+    }
+
+    // Find the first extent which starts beyond 'n'; only its predecessor
+    // may contain 'n'.
+    uint32_t lo = 0;
+    uint32_t hi = MinfsExtentMap(&inode_)->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ExtentAt(mid)->fblock <= n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo > 0) {
+        const minfs_extent_t* prev = ExtentAt(lo - 1);
+        if (n - prev->fblock < prev->count) {
+            *bno = prev->start + (n - prev->fblock);
+            fs_->ValidateBno(*bno);
+            return MX_OK;
+        }
+    }
+
+    if (txn == nullptr) {
+        *bno = 0;
+        return MX_OK;
+    }
+
+    // Allocate a block positioned so that the file stays physically contiguous
+    // with the preceding extent (or, failing that, the following one).
+    blk_t hint = 0;
+    if (lo > 0) {
+        const minfs_extent_t* prev = ExtentAt(lo - 1);
+        hint = prev->start + (n - prev->fblock);
+    } else if (lo < MinfsExtentMap(&inode_)->count &&
+               ExtentAt(lo)->start > ExtentAt(lo)->fblock - n) {
+        hint = ExtentAt(lo)->start - (ExtentAt(lo)->fblock - n);
+    }
+
+    blk_t new_bno;
+    if ((status = fs_->BlockNew(txn, hint, &new_bno)) != MX_OK) {
+        return status;
+    }
+    if ((status = ExtentsInsert(txn, lo, n, new_bno)) != MX_OK) {
+        fs_->BlockFree(txn, new_bno);
+        return status;
+    }
+    *bno = new_bno;
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::ExtentsInsert(WriteTxn* txn, uint32_t index, blk_t n, blk_t bno) {
+    mx_status_t status;
+    minfs_extent_map_t* map = MinfsExtentMap(&inode_);
+    if ((status = ExtentsLoad()) != MX_OK) {
+        return status;
+    }
+
+    minfs_extent_t* prev = (index > 0) ? ExtentAt(index - 1) : nullptr;
+    minfs_extent_t* next = (index < map->count) ? ExtentAt(index) : nullptr;
+    bool merge_prev = (prev != nullptr) && (prev->fblock + prev->count == n) &&
+                      (prev->start + prev->count == bno);
+    bool merge_next = (next != nullptr) && (next->fblock == n + 1) && (next->start == bno + 1);
+
+    // The first and last (exclusive) extent blocks which are modified
+    uint32_t first = (merge_prev ? index - 1 : index) / kMinfsExtentsPerBlock;
+    uint32_t end = first + 1;
+    if (merge_prev && merge_next) {
+        // The new block bridges two extents
+        uint32_t old_blocks = MinfsExtentBlocks(map->count);
+        prev->count += 1 + next->count;
+        for (uint32_t i = index; i + 1 < map->count; i++) {
+            *ExtentAt(i) = *ExtentAt(i + 1);
+        }
+        memset(ExtentAt(map->count - 1), 0, sizeof(minfs_extent_t));
+        map->count--;
+        ExtentsFreeBlocks(txn, old_blocks);
+        end = UINT32_MAX;
+    } else if (merge_prev) {
+        prev->count++;
+    } else if (merge_next) {
+        next->fblock--;
+        next->start--;
+        next->count++;
+    } else {
+        uint32_t blocks = MinfsExtentBlocks(map->count);
+        if (MinfsExtentBlocks(map->count + 1) > blocks) {
+            if ((status = ExtentsAddBlock(txn)) != MX_OK) {
+                return status;
+            }
+            // The new block is linked from its predecessor
+            first = (blocks == 0) ? 0 : fbl::min(first, blocks - 1);
+        }
+        for (uint32_t i = map->count; i > index; i--) {
+            *ExtentAt(i) = *ExtentAt(i - 1);
+        }
+        minfs_extent_t* e = ExtentAt(index);
+        e->fblock = n;
+        e->start = bno;
+        e->count = 1;
+        map->count++;
+        end = UINT32_MAX;
+    }
+
+    inode_.block_count++;
+    if (map->eblock != 0) {
+        // Removing an extent may have released the block holding it
+        first = fbl::min(first, MinfsExtentBlocks(map->count) - 1);
+    }
+    ExtentsSync(txn, first, end);
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::ExtentsShrink(WriteTxn* txn, blk_t start) {
+    mx_status_t status;
+    minfs_extent_map_t* map = MinfsExtentMap(&inode_);
+    if ((status = ExtentsLoad()) != MX_OK) {
+        return status;
+    }
+
+    uint32_t old_blocks = MinfsExtentBlocks(map->count);
+    bool dirty = false;
+    while (map->count > 0) {
+        minfs_extent_t* e = ExtentAt(map->count - 1);
+        if (e->fblock + e->count <= start) {
+            break;
+        }
+        // Release the tail of the extent which lies beyond 'start'
+        blk_t keep = (e->fblock < start) ? start - e->fblock : 0;
+        fs_->BlockFreeRange(txn, e->start + keep, e->count - keep);
+        inode_.block_count -= e->count - keep;
+        dirty = true;
+        if (keep != 0) {
+            e->count = keep;
+            break;
+        }
+        memset(e, 0, sizeof(*e));
+        map->count--;
+    }
+
+    if (dirty) {
+        ExtentsFreeBlocks(txn, old_blocks);
+        // Only the last remaining extent block was modified
+        uint32_t blocks = MinfsExtentBlocks(map->count);
+        ExtentsSync(txn, (blocks == 0) ? 0 : blocks - 1, blocks);
+    }
+    return MX_OK;
+}
+
 // Get the bno corresponding to the nth logical block within the file.
 mx_status_t VnodeMinfs::GetBno(WriteTxn* txn, blk_t n, blk_t* bno) {
+    if (IsExtentMapped()) {
+        return GetBnoExtent(txn, n, bno);
+    }
+
     bool dirty = false;
 
     if (n < kMinfsDirect) {
@@ -634,6 +1171,9 @@ mx_status_t VnodeMinfs::GetBno(WriteTxn* txn, blk_t n, blk_t* bno) {
     #ifdef __Fuchsia__
         // Grow VMO if we need more space to fit this set of indirect blocks
         mx_status_t status;
+        if ((status = InitIndirectVmo()) != MX_OK) {
+            return status;
+        }
         uint64_t vmo_size = GetVmoSizeForIndirect(dibindex);
         if (vmo_indirect_->GetSize() < vmo_size) {
             if ((status = vmo_indirect_->Grow(vmo_size)) != MX_OK) {
@@ -681,6 +1221,12 @@ mx_status_t VnodeMinfs::WriteExactInternal(WriteTxn* txn, const void* data,
     return MX_OK;
 }
 
+// Returns true if the (not last) record "de" could hold another dirent.
+static bool dirent_has_room(const minfs_dirent_t* de) {
+    uint32_t used = (de->ino != 0) ? DirentSize(de->namelen) : 0;
+    return (de->reclen & kMinfsReclenMask) >= used + DirentSize(1);
+}
+
 static mx_status_t validate_dirent(minfs_dirent_t* de, size_t bytes_read, size_t off) {
     uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, off));
     if ((bytes_read < MINFS_DIRENT_SIZE) || (reclen < MINFS_DIRENT_SIZE)) {
@@ -748,8 +1294,17 @@ mx_status_t VnodeMinfs::UnlinkChild(WriteTxn* txn,
     // Read the direntries we're considering merging with.
     // Verify they are free and small enough to merge.
     size_t coalesced_size = MinfsReclen(de, off);
+    if ((off_prev == off) && (dir_index_ != nullptr)) {
+        // Indexed lookups do not visit the previous record; it may still be
+        // merged if the index knows it has room.
+        uint32_t candidate;
+        if (dir_index_->FindFreeBefore(static_cast<uint32_t>(off), &candidate)) {
+            off_prev = candidate;
+        }
+    }
     // Coalesce with "next" first, so the kMinfsReclenLast bit can easily flow
     // back to "de" and "de_prev".
+    bool merged_next = false;
     if (!(de->reclen & kMinfsReclenLast)) {
         size_t len = MINFS_DIRENT_SIZE;
         if ((status = ReadExactInternal(&de_next, len, off_next)) != MX_OK) {
@@ -760,6 +1315,7 @@ mx_status_t VnodeMinfs::UnlinkChild(WriteTxn* txn,
             return status;
         }
         if (de_next.ino == 0) {
+            merged_next = true;
             coalesced_size += MinfsReclen(&de_next, off_next);
             // If the next entry *was* last, then 'de' is now last.
             de->reclen |= (de_next.reclen & kMinfsReclenLast);
@@ -774,7 +1330,7 @@ mx_status_t VnodeMinfs::UnlinkChild(WriteTxn* txn,
             FS_TRACE_ERROR("unlink: Read invalid dirent\n");
             return status;
         }
-        if (de_prev.ino == 0) {
+        if ((de_prev.ino == 0) && (off_prev + MinfsReclen(&de_prev, off_prev) == off)) {
             coalesced_size += MinfsReclen(&de_prev, off_prev);
             off = off_prev;
         }
@@ -792,6 +1348,24 @@ mx_status_t VnodeMinfs::UnlinkChild(WriteTxn* txn,
         return status;
     }
 
+    if (dir_index_ != nullptr) {
+        // Forget the unlinked dirent, and any record merged into another.
+        dir_index_->Remove(DirectoryIndex::Hash(de->name, de->namelen),
+                           static_cast<uint32_t>(offs->off));
+        if (merged_next) {
+            dir_index_->RemoveFree(static_cast<uint32_t>(off_next));
+        }
+        if (off != offs->off) {
+            dir_index_->RemoveFree(static_cast<uint32_t>(offs->off));
+        }
+        if (de->reclen & kMinfsReclenLast) {
+            dir_index_->RemoveFree(static_cast<uint32_t>(off));
+            dir_index_->SetLast(static_cast<uint32_t>(off));
+        } else if (dir_index_->AddFree(static_cast<uint32_t>(off)) != MX_OK) {
+            dir_index_.reset();
+        }
+    }
+
     if (de->reclen & kMinfsReclenLast) {
         // Truncating the directory merely removed unused space; if it fails,
         // the directory contents are still valid.
@@ -809,6 +1383,7 @@ mx_status_t VnodeMinfs::UnlinkChild(WriteTxn* txn,
 }
 
 void VnodeMinfs::RemoveInodeLink(WriteTxn* txn) {
+    fs::AutoLock lock(&lock_);
     // This effectively 'unlinks' the target node without deleting the direntry
     inode_.link_count--;
     if (MinfsMagicType(inode_.magic) == kMinfsTypeDir) {
@@ -820,6 +1395,10 @@ void VnodeMinfs::RemoveInodeLink(WriteTxn* txn) {
             flags_ |= kMinfsFlagDeletedDirectory;
         }
     }
+    if (inode_.link_count == 0) {
+        // Let the inode be freed as soon as it is closed.
+        fs_->VnodeRelease(this);
+    }
 
     InodeSync(txn, kMxFsSyncMtime);
 }
@@ -939,6 +1518,7 @@ static mx_status_t add_dirent(fbl::RefPtr<VnodeMinfs> vndir,
     if (status != MX_OK) {
         return status;
     }
+    vndir->IndexDirent(de, off);
     vndir->inode_.dirent_count++;
     if (args->type == kMinfsTypeDir) {
         // Child directory has '..' which will point to parent directory
@@ -950,6 +1530,12 @@ static mx_status_t add_dirent(fbl::RefPtr<VnodeMinfs> vndir,
 static mx_status_t cb_dir_append(fbl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t* de,
                                  DirArgs* args, DirectoryOffset* offs) {
     uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, offs->off));
+    uint32_t max_size = vndir->fs_->MaxDirectorySize();
+    if ((de->reclen & kMinfsReclenLast) && (offs->off + reclen > max_size)) {
+        // Only use as much of the last record as this volume's directories
+        // may hold.
+        reclen = (offs->off < max_size) ? max_size - static_cast<uint32_t>(offs->off) : 0;
+    }
     if (de->ino == 0) {
         // empty entry, do we fit?
         if (args->reclen > reclen) {
@@ -959,7 +1545,9 @@ static mx_status_t cb_dir_append(fbl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
     } else {
         // filled entry, can we sub-divide?
         uint32_t size = static_cast<uint32_t>(DirentSize(de->namelen));
-        if (size > reclen) {
+        if ((size > reclen) && (de->reclen & kMinfsReclenLast)) {
+            return do_next_dirent(de, offs);
+        } else if (size > reclen) {
             FS_TRACE_ERROR("bad reclen (smaller than dirent) %u < %u\n", reclen, size);
             return MX_ERR_IO;
         }
@@ -997,7 +1585,30 @@ static mx_status_t cb_dir_append(fbl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
 //  'offs': Offset info about where in the directory this direntry is located.
 //          Since 'func' may create / remove surrounding dirents, it is responsible for
 //          updating the offset information to access the next dirent.
+//
+// Large directories are indexed: rather than visiting every direntry, 'func'
+// is only invoked on those which may hold 'args->name' (or, when appending,
+// on records known to have space).
 mx_status_t VnodeMinfs::ForEachDirent(DirArgs* args, const DirentCallback func) {
+    if ((dir_index_ == nullptr) && (inode_.size >= kMinfsDirIndexMinSize)) {
+        // Without the index, we merely fall back to scanning the directory.
+        BuildDirIndex();
+    }
+    if (dir_index_ != nullptr) {
+        mx_status_t status = (func == cb_dir_append) ? AppendIndexedDirent(args) :
+                                                       ForEachIndexedDirent(args, func);
+        if ((status < 0) && (status != MX_ERR_NOT_FOUND)) {
+            // The directory may have been partially modified; rebuild the
+            // index from scratch on next use.
+            dir_index_.reset();
+            return status;
+        } else if ((status != MX_ERR_NOT_FOUND) || (func != cb_dir_append)) {
+            return status;
+        }
+        // None of the known records have space for the new direntry; search
+        // the whole directory before giving up.
+    }
+
     char data[kMinfsMaxDirentSize];
     minfs_dirent_t* de = (minfs_dirent_t*) data;
     DirectoryOffset offs = {
@@ -1029,13 +1640,128 @@ mx_status_t VnodeMinfs::ForEachDirent(DirArgs* args, const DirentCallback func)
     return MX_ERR_NOT_FOUND;
 }
 
+mx_status_t VnodeMinfs::ApplyToDirent(DirArgs* args, const DirentCallback func, size_t off) {
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    DirectoryOffset offs = {
+        .off = off,
+        .off_prev = off,
+    };
+    size_t r;
+    mx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, off, &r);
+    if (status != MX_OK) {
+        return status;
+    } else if ((status = validate_dirent(de, r, off)) != MX_OK) {
+        return status;
+    }
+
+    switch ((status = func(fbl::RefPtr<VnodeMinfs>(this), de, args, &offs))) {
+    case DIR_CB_NEXT:
+        return DIR_CB_NEXT;
+    case DIR_CB_SAVE_SYNC:
+        inode_.seq_num++;
+        InodeSync(args->txn, kMxFsSyncMtime);
+        return MX_OK;
+    case DIR_CB_DONE:
+    default:
+        return status;
+    }
+}
+
+mx_status_t VnodeMinfs::ForEachIndexedDirent(DirArgs* args, const DirentCallback func) {
+    const uint32_t hash = DirectoryIndex::Hash(args->name, args->len);
+    size_t cursor = 0;
+    uint32_t off;
+    while (dir_index_->Find(hash, &cursor, &off)) {
+        mx_status_t status = ApplyToDirent(args, func, off);
+        if (status != DIR_CB_NEXT) {
+            return status;
+        }
+    }
+    return MX_ERR_NOT_FOUND;
+}
+
+mx_status_t VnodeMinfs::AppendIndexedDirent(DirArgs* args) {
+    // Free records which are too small for this direntry are forgotten; they
+    // are rediscovered the next time the index is built.
+    uint32_t off;
+    while (dir_index_->TakeFree(&off)) {
+        mx_status_t status = ApplyToDirent(args, cb_dir_append, off);
+        if (status != DIR_CB_NEXT) {
+            return status;
+        }
+    }
+    mx_status_t status = ApplyToDirent(args, cb_dir_append, dir_index_->Last());
+    return (status == DIR_CB_NEXT) ? MX_ERR_NOT_FOUND : status;
+}
+
+mx_status_t VnodeMinfs::BuildDirIndex() {
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<DirectoryIndex> index(new (&ac) DirectoryIndex());
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    size_t off = 0;
+    while (off + MINFS_DIRENT_SIZE < kMinfsMaxDirectorySize) {
+        size_t r;
+        mx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, off, &r);
+        if (status != MX_OK) {
+            return status;
+        } else if ((status = validate_dirent(de, r, off)) != MX_OK) {
+            return status;
+        }
+
+        if (de->ino != 0) {
+            status = index->Insert(DirectoryIndex::Hash(de->name, de->namelen),
+                                   static_cast<uint32_t>(off));
+        }
+        if ((status == MX_OK) && !(de->reclen & kMinfsReclenLast) && dirent_has_room(de)) {
+            status = index->AddFree(static_cast<uint32_t>(off));
+        }
+        if (status != MX_OK) {
+            return status;
+        }
+
+        if (de->reclen & kMinfsReclenLast) {
+            index->SetLast(static_cast<uint32_t>(off));
+            dir_index_ = fbl::move(index);
+            return MX_OK;
+        }
+        off += MinfsReclen(de, off);
+    }
+    return MX_ERR_IO;
+}
+
+void VnodeMinfs::IndexDirent(const minfs_dirent_t* de, size_t off) {
+    if (dir_index_ == nullptr) {
+        return;
+    }
+    if (dir_index_->Insert(DirectoryIndex::Hash(de->name, de->namelen),
+                           static_cast<uint32_t>(off)) != MX_OK) {
+        dir_index_.reset();
+        return;
+    }
+    if (de->reclen & kMinfsReclenLast) {
+        dir_index_->SetLast(static_cast<uint32_t>(off));
+    } else if (dirent_has_room(de) &&
+               (dir_index_->AddFree(static_cast<uint32_t>(off)) != MX_OK)) {
+        dir_index_.reset();
+    }
+}
+
 VnodeMinfs::~VnodeMinfs() {
+    // With the last reference gone, nothing else can reach the vnode; only
+    // the state it shares with the rest of the filesystem is locked.
     if (inode_.link_count == 0) {
         fs_->InoFree(this);
     }
 
     fs_->VnodeRelease(this);
 #ifdef __Fuchsia__
+    fs_->CacheUncharge(resident_blocks_);
     // Detach the vmoids from the underlying block device,
     // so the underlying VMO may be released.
     size_t request_count = 0;
@@ -1072,6 +1798,13 @@ mx_status_t VnodeMinfs::Open(uint32_t flags) {
         }
     }
 
+    fs_->VnodeOpen(this);
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::Close() {
+    FS_TRACE(MINFS, "minfs_close() vn=%p(#%u)\n", this, ino_);
+    fs_->VnodeClose(this);
     return MX_OK;
 }
 
@@ -1081,7 +1814,31 @@ ssize_t VnodeMinfs::Read(void* data, size_t len, size_t off) {
         return MX_ERR_NOT_FILE;
     }
     size_t r;
-    mx_status_t status = ReadInternal(data, len, off, &r);
+    mx_status_t status;
+#ifdef __Fuchsia__
+    // Only the copy out of vmo_ happens without the vnode lock, so that
+    // reads of cached data may proceed in parallel. The vnode's IoLock keeps
+    // writers away in the meantime, and readers_ keeps the data from being
+    // evicted.
+    {
+        fs::AutoLock lock(&lock_);
+        if (off >= inode_.size) {
+            return 0;
+        } else if (len > (inode_.size - off)) {
+            len = inode_.size - off;
+        }
+        if ((status = InitVmo()) != MX_OK) {
+            return status;
+        } else if ((status = LoadForRead(off, len)) != MX_OK) {
+            return status;
+        }
+        readers_.fetch_add(1);
+    }
+    status = vmo_.read(data, off, len, &r);
+    readers_.fetch_sub(1);
+#else
+    status = ReadInternal(data, len, off, &r);
+#endif
     if (status != MX_OK) {
         return status;
     }
@@ -1103,6 +1860,8 @@ mx_status_t VnodeMinfs::ReadInternal(void* data, size_t len, size_t off, size_t*
 #ifdef __Fuchsia__
     if ((status = InitVmo()) != MX_OK) {
         return status;
+    } else if ((status = LoadForRead(off, len)) != MX_OK) {
+        return status;
     } else if ((status = vmo_.read(data, off, len, actual)) != MX_OK) {
         return status;
     }
@@ -1145,6 +1904,7 @@ mx_status_t VnodeMinfs::ReadInternal(void* data, size_t len, size_t off, size_t*
 }
 
 ssize_t VnodeMinfs::Write(const void* data, size_t len, size_t off) {
+    fs::AutoLock lock(&lock_);
     FS_TRACE(MINFS, "minfs_write() vn=%p(#%u) len=%zd off=%zd\n", this, ino_, len, off);
     if (IsDirectory()) {
         return MX_ERR_NOT_FILE;
@@ -1174,6 +1934,11 @@ mx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
     if ((status = InitVmo()) != MX_OK) {
         return status;
     }
+    if (!IsDirectory() && fs_->CacheFull()) {
+        // Any data written previously has already reached the disk.
+        fs_->CacheUncharge(EvictBlocks());
+    }
+    uint32_t loaded = 0;
 #endif
     const void* const start = data;
     uint32_t n = static_cast<uint32_t>(off / kMinfsBlockSize);
@@ -1189,6 +1954,16 @@ mx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
 
 #ifdef __Fuchsia__
         size_t xfer_off = n * kMinfsBlockSize + adjust;
+        if (!IsDirectory()) {
+            // A partially overwritten block must be read first.
+            uint32_t count;
+            if ((xfer != kMinfsBlockSize) && (n * kMinfsBlockSize < inode_.size) &&
+                ((status = LoadBlocks(n, n + 1, &count)) != MX_OK)) {
+                goto done;
+            } else if ((status = ReserveLoaded(n + 1)) != MX_OK) {
+                goto done;
+            }
+        }
         if ((xfer_off + xfer) > inode_.size) {
             size_t new_size = xfer_off + xfer;
             if ((status = vmo_.set_size(fbl::roundup(new_size, kMinfsBlockSize))) != MX_OK) {
@@ -1209,6 +1984,10 @@ mx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
         }
         MX_DEBUG_ASSERT(bno != 0);
         txn->Enqueue(vmoid_, n, bno + fs_->info_.dat_block, 1);
+        if (!IsDirectory() && !loaded_->GetOne(n)) {
+            loaded_->SetOne(n);
+            loaded++;
+        }
 #else
         blk_t bno;
         if ((status = GetBno(txn, n, &bno)) != MX_OK) {
@@ -1232,6 +2011,12 @@ mx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
     }
 
 done:
+#ifdef __Fuchsia__
+    if (loaded != 0) {
+        resident_blocks_ += loaded;
+        fs_->CacheCharge(this, loaded);
+    }
+#endif
     len = (uintptr_t)data - (uintptr_t)start;
     if (len == 0) {
         // If more than zero bytes were requested, but zero bytes were written,
@@ -1251,6 +2036,7 @@ done:
 }
 
 mx_status_t VnodeMinfs::Lookup(fbl::RefPtr<fs::Vnode>* out, const char* name, size_t len) {
+    fs::AutoLock lock(&lock_);
     FS_TRACE(MINFS, "minfs_lookup() vn=%p(#%u) name='%.*s'\n", this, ino_, (int)len, name);
     MX_DEBUG_ASSERT(fs::vfs_valid_name(name, len));
 
@@ -1280,6 +2066,7 @@ mx_status_t VnodeMinfs::LookupInternal(fbl::RefPtr<fs::Vnode>* out,
 }
 
 mx_status_t VnodeMinfs::Getattr(vnattr_t* a) {
+    fs::AutoLock lock(&lock_);
     FS_TRACE(MINFS, "minfs_getattr() vn=%p(#%u)\n", this, ino_);
     a->mode = DTYPE_TO_VTYPE(MinfsMagicType(inode_.magic)) |
             V_IRUSR | V_IWUSR | V_IRGRP | V_IROTH;
@@ -1294,6 +2081,7 @@ mx_status_t VnodeMinfs::Getattr(vnattr_t* a) {
 }
 
 mx_status_t VnodeMinfs::Setattr(vnattr_t* a) {
+    fs::AutoLock lock(&lock_);
     int dirty = 0;
     FS_TRACE(MINFS, "minfs_setattr() vn=%p(#%u)\n", this, ino_);
     if ((a->valid & ~(ATTR_CTIME|ATTR_MTIME)) != 0) {
@@ -1325,6 +2113,7 @@ static_assert(sizeof(dircookie_t) <= sizeof(vdircookie_t),
               "MinFS dircookie too large to fit in IO state");
 
 mx_status_t VnodeMinfs::Readdir(void* cookie, void* dirents, size_t len) {
+    fs::AutoLock lock(&lock_);
     FS_TRACE(MINFS, "minfs_readdir() vn=%p(#%u) cookie=%p len=%zd\n", this, ino_, cookie, len);
     dircookie_t* dc = reinterpret_cast<dircookie_t*>(cookie);
     fs::DirentFiller df(dirents, len);
@@ -1418,6 +2207,9 @@ mx_status_t VnodeMinfs::Allocate(Minfs* fs, uint32_t type, fbl::RefPtr<VnodeMinf
     (*out)->inode_.magic = MinfsMagic(type);
     (*out)->inode_.create_time = (*out)->inode_.modify_time = minfs_gettime_utc();
     (*out)->inode_.link_count = (type == kMinfsTypeDir ? 2 : 1);
+    if (fs->UseExtents()) {
+        (*out)->inode_.inode_flags |= kMinfsInodeFlagExtents;
+    }
     return MX_OK;
 }
 
@@ -1431,6 +2223,7 @@ mx_status_t VnodeMinfs::AllocateHollow(Minfs* fs, fbl::RefPtr<VnodeMinfs>* out)
 }
 
 mx_status_t VnodeMinfs::Create(fbl::RefPtr<fs::Vnode>* out, const char* name, size_t len, uint32_t mode) {
+    fs::AutoLock lock(&lock_);
     FS_TRACE(MINFS, "minfs_create() vn=%p(#%u) name='%.*s' mode=%#x\n",
           this, ino_, (int)len, name, mode);
     MX_DEBUG_ASSERT(fs::vfs_valid_name(name, len));
@@ -1482,6 +2275,8 @@ mx_status_t VnodeMinfs::Create(fbl::RefPtr<fs::Vnode>* out, const char* name, si
         return status;
     }
 
+    // The new vnode is handed back open.
+    fs_->VnodeOpen(vn.get());
     *out = fbl::move(vn);
     return MX_OK;
 }
@@ -1497,10 +2292,7 @@ ssize_t VnodeMinfs::Ioctl(uint32_t op, const void* in_buf, size_t in_len, void*
             }
 
             vfs_query_info_t* info = static_cast<vfs_query_info_t*>(out_buf);
-            info->total_bytes = fs_->info_.block_count * fs_->info_.block_size;
-            info->used_bytes = fs_->info_.alloc_block_count * fs_->info_.block_size;
-            info->total_nodes = fs_->info_.inode_count;
-            info->used_nodes = fs_->info_.alloc_inode_count;
+            fs_->GetUsage(info);
             memcpy(info->name, kFsName, strlen(kFsName));
             return sizeof(vfs_query_info_t) + strlen(kFsName);
         }
@@ -1512,6 +2304,13 @@ ssize_t VnodeMinfs::Ioctl(uint32_t op, const void* in_buf, size_t in_len, void*
             // 'fs_' is deleted after Unmount is called.
             return fs_->Unmount();
         }
+        case IOCTL_VFS_GET_CACHE_STATS: {
+            if (out_len < sizeof(vfs_cache_stats_t)) {
+                return MX_ERR_INVALID_ARGS;
+            }
+            fs_->GetCacheStats(static_cast<vfs_cache_stats_t*>(out_buf));
+            return sizeof(vfs_cache_stats_t);
+        }
 #ifdef __Fuchsia__
         case IOCTL_VFS_GET_DEVICE_PATH: {
             ssize_t len = fs_->bc_->GetDevicePath(static_cast<char*>(out_buf), out_len);
@@ -1530,6 +2329,7 @@ ssize_t VnodeMinfs::Ioctl(uint32_t op, const void* in_buf, size_t in_len, void*
 }
 
 mx_status_t VnodeMinfs::Unlink(const char* name, size_t len, bool must_be_dir) {
+    fs::AutoLock lock(&lock_);
     FS_TRACE(MINFS, "minfs_unlink() vn=%p(#%u) name='%.*s'\n", this, ino_, (int)len, name);
     MX_DEBUG_ASSERT(fs::vfs_valid_name(name, len));
 
@@ -1546,6 +2346,7 @@ mx_status_t VnodeMinfs::Unlink(const char* name, size_t len, bool must_be_dir) {
 }
 
 mx_status_t VnodeMinfs::Truncate(size_t len) {
+    fs::AutoLock lock(&lock_);
     if (IsDirectory()) {
         return MX_ERR_NOT_FILE;
     }
@@ -1562,8 +2363,6 @@ mx_status_t VnodeMinfs::Truncate(size_t len) {
 mx_status_t VnodeMinfs::TruncateInternal(WriteTxn* txn, size_t len) {
     mx_status_t r = 0;
 #ifdef __Fuchsia__
-    // TODO(smklein): We should only init up to 'len'; no need
-    // to read in the portion of a large file we plan on deleting.
     if (InitVmo() != MX_OK) {
         return MX_ERR_IO;
     }
@@ -1597,7 +2396,10 @@ mx_status_t VnodeMinfs::TruncateInternal(WriteTxn* txn, size_t len) {
             if (bno != 0) {
                 size_t adjust = len % kMinfsBlockSize;
 #ifdef __Fuchsia__
-                if ((r = VmoReadExact(bdata, len - adjust, adjust)) != MX_OK) {
+                uint32_t count;
+                if ((r = LoadBlocks(rel_bno, rel_bno + 1, &count)) != MX_OK) {
+                    return r;
+                } else if ((r = VmoReadExact(bdata, len - adjust, adjust)) != MX_OK) {
                     return MX_ERR_IO;
                 }
                 memset(bdata + adjust, 0, kMinfsBlockSize - adjust);
@@ -1633,13 +2435,17 @@ mx_status_t VnodeMinfs::TruncateInternal(WriteTxn* txn, size_t len) {
     if ((r = vmo_.set_size(fbl::roundup(len, kMinfsBlockSize))) != MX_OK) {
         return r;
     }
+    ForgetBlocks(static_cast<blk_t>(fbl::roundup(len, kMinfsBlockSize) / kMinfsBlockSize));
 #endif
 
     return MX_OK;
 }
 
 // verify that the 'newdir' inode is not a subdirectory of the source.
-static mx_status_t check_not_subdirectory(fbl::RefPtr<VnodeMinfs> src, fbl::RefPtr<VnodeMinfs> newdir) {
+// The caller holds the locks of 'olddir' and 'newdir'; those of the other
+// directories on the way up are acquired in turn.
+static mx_status_t check_not_subdirectory(VnodeMinfs* olddir, fbl::RefPtr<VnodeMinfs> src,
+                                          fbl::RefPtr<VnodeMinfs> newdir) {
     fbl::RefPtr<VnodeMinfs> vn = newdir;
     mx_status_t status = MX_OK;
     while (vn->ino_ != kMinfsRootIno) {
@@ -1649,7 +2455,13 @@ static mx_status_t check_not_subdirectory(fbl::RefPtr<VnodeMinfs> src, fbl::RefP
         }
 
         fbl::RefPtr<fs::Vnode> out = nullptr;
-        if ((status = vn->LookupInternal(&out, "..", 2)) < 0) {
+        if ((vn.get() == olddir) || (vn == newdir)) {
+            status = vn->LookupInternal(&out, "..", 2);
+        } else {
+            fs::AutoLock lock(&vn->lock_);
+            status = vn->LookupInternal(&out, "..", 2);
+        }
+        if (status < 0) {
             break;
         }
         vn = fbl::RefPtr<VnodeMinfs>::Downcast(out);
@@ -1660,7 +2472,18 @@ static mx_status_t check_not_subdirectory(fbl::RefPtr<VnodeMinfs> src, fbl::RefP
 mx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, const char* oldname, size_t oldlen,
                                const char* newname, size_t newlen, bool src_must_be_dir,
                                bool dst_must_be_dir) {
+    fs::AutoLock lock(&lock_);
     auto newdir = fbl::RefPtr<VnodeMinfs>::Downcast(_newdir);
+    // The Vfs serializes renames with every other operation which could
+    // lock two directories.
+    if (newdir.get() != this) {
+        newdir->lock_.Acquire();
+    }
+    auto unlock_newdir = fbl::MakeAutoCall([this, &newdir]() {
+        if (newdir.get() != this) {
+            newdir->lock_.Release();
+        }
+    });
     FS_TRACE(MINFS, "minfs_rename() olddir=%p(#%u) newdir=%p(#%u) oldname='%.*s' newname='%.*s'\n",
           this, ino_, newdir.get(), newdir->ino_, (int)oldlen, oldname, (int)newlen, newname);
     MX_DEBUG_ASSERT(fs::vfs_valid_name(oldname, oldlen));
@@ -1680,7 +2503,7 @@ mx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, const char* oldna
         return status;
     } else if ((status = fs_->VnodeGet(&oldvn, args.ino)) < 0) {
         return status;
-    } else if ((status = check_not_subdirectory(oldvn, newdir)) < 0) {
+    } else if ((status = check_not_subdirectory(this, oldvn, newdir)) < 0) {
         return status;
     }
 
@@ -1712,13 +2535,14 @@ mx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, const char* oldna
     // moved to a new directory
     if ((args.type == kMinfsTypeDir) && (ino_ != newdir->ino_)) {
         fbl::RefPtr<fs::Vnode> vn_fs;
-        if ((status = newdir->Lookup(&vn_fs, newname, newlen)) < 0) {
+        if ((status = newdir->LookupInternal(&vn_fs, newname, newlen)) < 0) {
             return status;
         }
         auto vn = fbl::RefPtr<VnodeMinfs>::Downcast(vn_fs);
         args.name = "..";
         args.len = 2;
         args.ino = newdir->ino_;
+        fs::AutoLock vn_lock(&vn->lock_);
         if ((status = vn->ForEachDirent(&args, cb_dir_update_inode)) < 0) {
             return status;
         }
@@ -1726,7 +2550,10 @@ mx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, const char* oldna
 
     // at this point, the oldvn exists with multiple names (or the same name in
     // different directories)
-    oldvn->inode_.link_count++;
+    {
+        fs::AutoLock oldvn_lock(&oldvn->lock_);
+        oldvn->inode_.link_count++;
+    }
 
     // finally, remove oldname from its original position
     args.name = oldname;
@@ -1735,6 +2562,7 @@ mx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, const char* oldna
 }
 
 mx_status_t VnodeMinfs::Link(const char* name, size_t len, fbl::RefPtr<fs::Vnode> _target) {
+    fs::AutoLock lock(&lock_);
     FS_TRACE(MINFS, "minfs_link() vndir=%p(#%u) name='%.*s'\n", this, ino_, (int)len, name);
     MX_DEBUG_ASSERT(fs::vfs_valid_name(name, len));
 
@@ -1769,6 +2597,7 @@ mx_status_t VnodeMinfs::Link(const char* name, size_t len, fbl::RefPtr<fs::Vnode
     }
 
     // We have successfully added the vn to a new location. Increment the link count.
+    fs::AutoLock target_lock(&target->lock_);
     target->inode_.link_count++;
     target->InodeSync(&txn, kMxFsSyncDefault);
 
@@ -1789,6 +2618,55 @@ mx_status_t VnodeMinfs::AttachRemote(fs::MountChannel h) {
     SetRemote(fbl::move(h.TakeChannel()));
     return MX_OK;
 }
+
+mx_status_t VnodeMinfs::Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) {
+    fs::AutoLock lock(&lock_);
+    FS_TRACE(MINFS, "minfs_mmap() vn=%p(#%u) flags=%x len=%zu off=%zu\n", this, ino_, flags,
+             len, *off);
+    if (IsDirectory()) {
+        return MX_ERR_ACCESS_DENIED;
+    } else if (!(flags & MXIO_MMAP_FLAG_PRIVATE)) {
+        // A shared mapping would have to stay coherent with vmo_, which could
+        // then never be evicted, and every page of it would have to be
+        // written back on sync, since there is no record of which were dirtied.
+        return MX_ERR_NOT_SUPPORTED;
+    }
+    // Pages past the end of the file are left out of the clone.
+    len = (*off < inode_.size) ? fbl::min(len, inode_.size - *off) : 0;
+
+    // Until minfs can service page faults, the requested range must be
+    // present before it is handed out. Only that (block-aligned) range is
+    // loaded and cloned; the clone copies pages out of vmo_ as they are
+    // written, and EvictBlocks leaves vmo_ to it rather than decommitting it.
+    const size_t clone_start = *off - (*off % kMinfsBlockSize);
+    const size_t clone_end = fbl::roundup(*off + len, kMinfsBlockSize);
+    mx_status_t status;
+    uint32_t count;
+    if ((status = InitVmo()) != MX_OK) {
+        return status;
+    } else if ((status = LoadBlocks(static_cast<blk_t>(clone_start / kMinfsBlockSize),
+                                    static_cast<blk_t>(clone_end / kMinfsBlockSize),
+                                    &count)) != MX_OK) {
+        return status;
+    }
+
+    mx_rights_t rights = MX_RIGHT_TRANSFER | MX_RIGHT_MAP;
+    rights |= (flags & MXIO_MMAP_FLAG_READ) ? MX_RIGHT_READ : 0;
+    rights |= (flags & MXIO_MMAP_FLAG_WRITE) ? MX_RIGHT_WRITE : 0;
+    rights |= (flags & MXIO_MMAP_FLAG_EXEC) ? MX_RIGHT_EXECUTE : 0;
+    mx::vmo clone;
+    mx::vmo result;
+    if ((status = vmo_.clone(MX_VMO_CLONE_COPY_ON_WRITE, clone_start, clone_end - clone_start,
+                             &clone)) != MX_OK) {
+        return status;
+    } else if ((status = clone.replace(rights, &result)) != MX_OK) {
+        return status;
+    }
+    cloned_ = true;
+    *off -= clone_start;
+    *out = result.release();
+    return MX_OK;
+}
 #endif
 
 } // namespace minfs
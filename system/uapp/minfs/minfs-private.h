@@ -12,17 +12,23 @@
 #endif
 
 #include <fbl/algorithm.h>
+#include <fbl/atomic.h>
+#include <fbl/intrusive_double_list.h>
 #include <fbl/intrusive_hash_table.h>
 #include <fbl/intrusive_single_list.h>
 #include <fbl/macros.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
+#include <fbl/vector.h>
 
 #include <fs/block-txn.h>
+#include <fs/locking.h>
 #include <fs/mapped-vmo.h>
 
 #include <fs/vfs.h>
+#include <magenta/device/vfs.h>
 
+#include "dir-index.h"
 #include "minfs.h"
 #include "misc.h"
 
@@ -46,11 +52,27 @@ constexpr uint32_t kMxFsSyncCtime = (1 << 1);
 
 constexpr uint32_t kMinfsBlockCacheSize = 64;
 
+// Default bounds on the vnode cache (see Minfs::CacheTouch): the number of
+// recently used vnodes kept in memory once they are closed, and the number of
+// file data blocks resident in memory across all vnodes.
+constexpr uint32_t kMinfsDefaultCacheVnodes = 1024;
+constexpr uint32_t kMinfsDefaultCacheBlocks = 8192;
+
+// Sequential reads fetch up to this many blocks past the end of each read,
+// starting with kMinfsReadAheadMin blocks and doubling while the file
+// continues to be read sequentially.
+constexpr uint32_t kMinfsReadAheadMin = 4;
+constexpr uint32_t kMinfsReadAheadMax = 128;
+
 // Used by fsck
 class MinfsChecker;
 
 class VnodeMinfs;
 
+struct VnodeMinfsLruTraits {
+    static fbl::DoublyLinkedListNodeState<fbl::RefPtr<VnodeMinfs>>& node_state(VnodeMinfs& vn);
+};
+
 class Minfs {
 public:
     DISALLOW_COPY_ASSIGN_AND_MOVE(Minfs);
@@ -67,15 +89,32 @@ public:
     // instantiate a vnode with a new inode
     mx_status_t VnodeNew(WriteTxn* txn, fbl::RefPtr<VnodeMinfs>* out, uint32_t type);
 
-    // remove a vnode from the hash map
+    // remove a vnode from the hash map (and the vnode cache), so that it is
+    // destroyed once the last reference to it is dropped
     void VnodeRelease(VnodeMinfs* vn);
 
-    // Allocate a new data block.
+    // Count the connections (or other users) which hold a vnode open. Once a
+    // vnode is closed for the last time, it is only kept by the vnode cache.
+    void VnodeOpen(VnodeMinfs* vn);
+    void VnodeClose(VnodeMinfs* vn);
+
+    // Allocate a new data block, preferably at or after |hint|.
     mx_status_t BlockNew(WriteTxn* txn, blk_t hint, blk_t* out_bno);
 
     // free block in block bitmap
     mx_status_t BlockFree(WriteTxn* txn, blk_t bno);
 
+    // free |count| contiguous blocks, starting at |bno|, in block bitmap
+    mx_status_t BlockFreeRange(WriteTxn* txn, blk_t bno, blk_t count);
+
+    // Returns true if new inodes should be extent-mapped.
+    bool UseExtents() const { return info_.version >= kMinfsVersionExtents; }
+    // Returns the size directories may grow to on this volume.
+    uint32_t MaxDirectorySize() const {
+        return (info_.version >= kMinfsVersionLargeDirectories) ? kMinfsMaxDirectorySize :
+                                                                 kMinfsMaxDirectorySizeV7;
+    }
+
     // free ino in inode bitmap, release all blocks held by inode
     mx_status_t InoFree(VnodeMinfs* vn);
 
@@ -83,6 +122,33 @@ public:
     // Does not modify inode bitmap.
     mx_status_t InodeSync(WriteTxn* txn, ino_t ino, const minfs_inode_t* inode);
 
+    // Fills |out| with the usage counts of the volume.
+    void GetUsage(vfs_query_info_t* out) const;
+
+    // The vnode cache keeps recently used vnodes (along with their cached
+    // contents) alive after they are closed, up to |cache_vnodes_| vnodes.
+    // Independently, the file data held in memory by all vnodes is bounded by
+    // |cache_blocks_|; the data of the least recently used files is dropped
+    // first.
+    //
+    // Accounts for |count| blocks of file data which |vn| has loaded into
+    // memory, evicting the data of other files if the limit is exceeded.
+    // |vn| must be locked.
+    void CacheCharge(VnodeMinfs* vn, uint32_t count);
+    void CacheUncharge(uint32_t count);
+    void GetCacheStats(vfs_cache_stats_t* out) const;
+    // Replaces the limits of the cache, trimming it if it now holds too much.
+    // A limit of zero leaves the current limit in place.
+    void SetCacheLimits(uint32_t vnodes, uint32_t blocks);
+
+    bool CacheFull() const;
+
+    // Block-level cache statistics, maintained by vnodes.
+    fbl::atomic<uint64_t> cache_hits_{};
+    fbl::atomic<uint64_t> cache_misses_{};
+    fbl::atomic<uint64_t> cache_readahead_{};
+    fbl::atomic<uint64_t> cache_evictions_{};
+
 #ifdef __Fuchsia__
     fs::Dispatcher* GetDispatcher() {
         return dispatcher_.get();
@@ -94,22 +160,51 @@ public:
     }
 
     fbl::unique_ptr<Bcache> bc_{};
+    // The fields of the superblock which change after mount (the allocation
+    // counts, and the size of an FVM-backed volume) are guarded by
+    // |alloc_lock_|.
     minfs_info_t info_{};
 
 private:
     // Fsck can introspect Minfs
     friend class MinfsChecker;
     Minfs(fbl::unique_ptr<Bcache> bc_, const minfs_info_t* info_);
+    // The following require |alloc_lock_|, and do not acquire it.
+    //
     // Find a free inode, allocate it in the inode bitmap, and write it back to disk
     mx_status_t InoNew(WriteTxn* txn, const minfs_inode_t* inode, ino_t* ino_out);
-
+    mx_status_t InodeSyncLocked(WriteTxn* txn, ino_t ino, const minfs_inode_t* inode);
     // Enqueues an update for allocated inode/block counts
     mx_status_t CountUpdate(WriteTxn* txn);
-
+    // Finds a block in [start, end) which is free and may be reused.
+    mx_status_t BlockFind(size_t start, size_t end, size_t* out) const;
+#ifdef __Fuchsia__
+    // Makes blocks whose release has been written back available again.
+    void ReleaseFreedBlocks();
+#endif
     // If possible, attempt to resize the MinFS partition.
     mx_status_t AddInodes();
     mx_status_t AddBlocks();
 
+    // Copies inode |ino| out of the inode table.
+    mx_status_t InodeLoad(ino_t ino, minfs_inode_t* out);
+
+    // Marks |vn| as the most recently used vnode, adding it to the cache.
+    void CacheTouch(VnodeMinfs* vn);
+    // Drops the least recently used vnodes until at most |cache_vnodes_|
+    // remain, if no lookup is in progress.
+    void CacheTrim();
+
+    // Vnodes lock their own state first, and may then acquire |hash_lock_|,
+    // followed by |alloc_lock_|. Neither is held while acquiring a vnode's
+    // lock (other than with TryAcquire).
+    //
+    // Guards vnode_hash_, the vnode cache (including the open count of each
+    // vnode) and the accounting of resident file data.
+    mutable fs::Mutex hash_lock_{};
+    // Guards the inode and block bitmaps, the inode table and the superblock.
+    mutable fs::Mutex alloc_lock_{};
+
 #ifdef __Fuchsia__
     fbl::unique_ptr<fs::Dispatcher> dispatcher_{nullptr};
 #endif
@@ -118,6 +213,9 @@ private:
     RawBitmap inode_map_{};
     RawBitmap block_map_{};
 #ifdef __Fuchsia__
+    // Blocks which are free in block_map_, but which the metadata on disk may
+    // still refer to until the journal entry freeing them is written back.
+    RawBitmap pending_free_{};
     fbl::unique_ptr<MappedVmo> inode_table_{};
     fbl::unique_ptr<MappedVmo> info_vmo_{};
     vmoid_t inode_map_vmoid_{};
@@ -126,10 +224,20 @@ private:
     vmoid_t info_vmoid_{};
 #endif
 
-    // Vnodes exist in the hash table as long as one or more reference exists;
-    // when the Vnode is deleted, it is immediately removed from the map.
+    // Every vnode in the hash table is either open, or held by the vnode
+    // cache; a vnode leaves the table before its last reference is dropped.
     using HashTable = fbl::HashTable<ino_t, VnodeMinfs*>;
     HashTable vnode_hash_{};
+
+    // Most recently used first. Holds a reference to each cached vnode.
+    using LruList = fbl::DoublyLinkedList<fbl::RefPtr<VnodeMinfs>, VnodeMinfsLruTraits>;
+    LruList lru_{};
+    uint32_t lru_count_{};
+    uint32_t cache_vnodes_ = kMinfsDefaultCacheVnodes;
+    uint32_t cache_blocks_ = kMinfsDefaultCacheBlocks;
+    uint64_t resident_blocks_{};
+    uint64_t vnode_hits_{};
+    uint64_t vnode_misses_{};
 };
 
 struct DirArgs {
@@ -164,6 +272,7 @@ public:
     static mx_status_t AllocateHollow(Minfs* fs, fbl::RefPtr<VnodeMinfs>* out);
 
     bool IsDirectory() const { return inode_.magic == kMinfsMagicDir; }
+    bool IsExtentMapped() const { return inode_.inode_flags & kMinfsInodeFlagExtents; }
     bool IsDeletedDirectory() const { return flags_ & kMinfsFlagDeletedDirectory; }
     mx_status_t CanUnlink() const;
 
@@ -172,9 +281,21 @@ public:
 
     mx_status_t UnlinkChild(WriteTxn* txn, fbl::RefPtr<VnodeMinfs> child,
                             minfs_dirent_t* de, DirectoryOffset* offs);
+    // Records the dirent |de|, just written at |off|, in the directory index (if any).
+    void IndexDirent(const minfs_dirent_t* de, size_t off);
     // Remove the link to a vnode (referring to inodes exclusively).
     // Has no impact on direntries (or parent inode).
     void RemoveInodeLink(WriteTxn* txn);
+#ifdef __Fuchsia__
+    // Files only: drops all file data cached in memory. File data is written
+    // through to disk, so it may be read back later. Does nothing while a
+    // read is copying data out of the vnode. If vmo_ has been cloned by
+    // Mmap, it is released to the clones rather than decommitted.
+    //
+    // Requires lock_. Returns the number of blocks dropped, which the caller
+    // must uncharge from the cache.
+    uint32_t EvictBlocks();
+#endif
     mx_status_t ReadInternal(void* data, size_t len, size_t off, size_t* actual);
     mx_status_t ReadExactInternal(void* data, size_t len, size_t off);
     mx_status_t WriteInternal(WriteTxn* txn, const void* data, size_t len,
@@ -192,17 +313,25 @@ public:
     ino_t ino_{};
     minfs_inode_t inode_{};
 
+    // Guards the in-memory state of the vnode: its inode, cached contents
+    // and indices. Held by each vnode operation (after the vnode's IoLock,
+    // if any). Operations on the namespace, which the Vfs serializes, may
+    // also lock the children of the directory they hold.
+    fs::Mutex lock_{};
+
     ~VnodeMinfs();
 
 private:
     // Fsck can introspect Minfs
     friend class MinfsChecker;
-    friend mx_status_t Minfs::InoFree(VnodeMinfs* vn);
+    friend struct VnodeMinfsLruTraits;
+    friend class Minfs;
     VnodeMinfs(Minfs* fs);
 
     // Implementing methods from the fs::Vnode, so MinFS vnodes may be utilized
     // by the VFS library.
     mx_status_t Open(uint32_t flags) final;
+    mx_status_t Close() final;
     ssize_t Read(void* data, size_t len, size_t off) final;
     ssize_t Write(const void* data, size_t len, size_t off) final;
     mx_status_t Getattr(vnattr_t* a) final;
@@ -221,7 +350,25 @@ private:
 
 #ifdef __Fuchsia__
     mx_status_t AttachRemote(fs::MountChannel h) final;
+    bool SupportsTransferVmo() const final { return !IsDirectory(); }
+    // Files only: maps a private copy of the requested range of the file.
+    // Shared mappings are not supported until minfs can service page faults
+    // and track which pages were written through a mapping.
+    mx_status_t Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) final;
+    // Creates vmo_. Directories are read in their entirety; files are
+    // loaded on demand, with LoadBlocks.
     mx_status_t InitVmo();
+    // Files only: reads the blocks in [start, end) which are not yet present
+    // in vmo_ with a single batch of requests.
+    mx_status_t LoadBlocks(blk_t start, blk_t end, uint32_t* out_count);
+    // Files only: ensures the bytes in [off, off + len) are present in vmo_,
+    // reading ahead of sequential readers.
+    mx_status_t LoadForRead(size_t off, size_t len);
+    // Files only: forgets any cached blocks at or beyond |start|, after the
+    // file has been shrunk.
+    void ForgetBlocks(blk_t start);
+    // Files only: ensures loaded_ can describe the first |count| blocks.
+    mx_status_t ReserveLoaded(blk_t count);
     mx_status_t InitIndirectVmo();
     // Loads indirect blocks up to and including the doubly indirect block at |index|
     mx_status_t LoadIndirectWithinDoublyIndirect(uint32_t index);
@@ -298,6 +445,35 @@ private:
                                            size_t count, uint32_t dib_vmo_offset,
                                            uint32_t ib_vmo_offset, blk_t* diarray, bool* dirty);
 
+    // Extent-mapped inodes only.
+    //
+    // Reads the extent blocks of the inode (if any) into memory. The list lives
+    // in the inode until it outgrows kMinfsInlineExtents, after which it is held
+    // in a chain of extent blocks (cached in memory alongside the vnode).
+    mx_status_t ExtentsLoad();
+    // Returns the |index|th extent of the inode. The extent blocks must be loaded.
+    minfs_extent_t* ExtentAt(uint32_t index);
+    // Returns the in-memory copy of the |index|th extent block.
+    minfs_extent_block_t* ExtentBlock(uint32_t index);
+    // Appends an extent block to the chain, moving the list out of the inode
+    // if it is the first one.
+    mx_status_t ExtentsAddBlock(WriteTxn* txn);
+    // Releases the extent blocks beyond those needed by the current extent count,
+    // given that |old_blocks| are in the chain; moves the list back into the inode
+    // once it fits.
+    void ExtentsFreeBlocks(WriteTxn* txn, uint32_t old_blocks);
+    // Writes back the extent map, and the extent blocks in [first, end), after
+    // modification.
+    void ExtentsSync(WriteTxn* txn, uint32_t first, uint32_t end);
+    // Get the disk block 'bno' backing file block 'n', allocating it (contiguous
+    // with its neighbouring extents where possible) if requested with a non-null "txn".
+    mx_status_t GetBnoExtent(WriteTxn* txn, blk_t n, blk_t* bno);
+    // Adds the newly allocated block |bno| at file block |n| (at position |index| in the
+    // sorted extent list), merging with adjacent extents when contiguous.
+    mx_status_t ExtentsInsert(WriteTxn* txn, uint32_t index, blk_t n, blk_t bno);
+    // Deletes all blocks from file block |start| (inclusive) to the end of the file.
+    mx_status_t ExtentsShrink(WriteTxn* txn, blk_t start);
+
 #ifdef __Fuchsia__
     // Reads the block at |offset| in memory
     void ReadIndirectVmoBlock(uint32_t offset, uint32_t** entry);
@@ -308,6 +484,9 @@ private:
     void ReadIndirectBlock(blk_t bno, uint32_t* entry);
     // Clears the block at |bno| on disk
     void ClearIndirectBlock(blk_t bno);
+
+    // In-memory copy of the extent blocks of extent-mapped inodes
+    fbl::Vector<fbl::unique_ptr<minfs_extent_block_t>> extent_blocks_{};
 #endif
 
     // Update the vnode's inode and write it to disk
@@ -319,6 +498,18 @@ private:
 
     // Directories only
     mx_status_t ForEachDirent(DirArgs* args, const DirentCallback func);
+    // Invokes |func| on the single dirent at |off|. Returns DIR_CB_NEXT if
+    // the callback passed over it.
+    mx_status_t ApplyToDirent(DirArgs* args, const DirentCallback func, size_t off);
+    // Applies a name-matching callback to the indexed dirents which may hold args->name.
+    mx_status_t ForEachIndexedDirent(DirArgs* args, const DirentCallback func);
+    // Attempts to place args->name in one of the indexed free records, or the last record.
+    mx_status_t AppendIndexedDirent(DirArgs* args);
+    // Scans the directory to build dir_index_.
+    mx_status_t BuildDirIndex();
+
+    // Directories of at least kMinfsDirIndexMinSize bytes are indexed in memory.
+    fbl::unique_ptr<DirectoryIndex> dir_index_{};
 
 #ifdef __Fuchsia__
     // The following functionality interacts with handles directly, and are not applicable outside
@@ -329,11 +520,13 @@ private:
 
     // TODO(smklein): When we have can register MinFS as a pager service, and
     // it can properly handle pages faults on a vnode's contents, then we can
-    // avoid reading the entire file up-front. Until then, read the contents of
-    // a VMO into memory when it is read/written.
+    // let the kernel fault in pages of vmo_. Until then, read the contents of
+    // a VMO into memory when it is read/written (file blocks are tracked by
+    // loaded_, and may be evicted by the vnode cache).
     mx::vmo vmo_{};
 
-    // vmo_indirect_ contains all indirect and doubly indirect blocks in the following order:
+    // For extent-mapped inodes, vmo_indirect_ only holds the extent block (at offset 0).
+    // Otherwise, it contains all indirect and doubly indirect blocks in the following order:
     // First kMinfsIndirect blocks                                - initial set of indirect blocks
     // Next kMinfsDoublyIndirect blocks                           - doubly indirect blocks
     // Next kMinfsDoublyIndirect * kMinfsDirectPerIndirect blocks - indirect blocks pointed to
@@ -343,6 +536,21 @@ private:
     vmoid_t vmoid_{};
     vmoid_t vmoid_indirect_{};
 
+    // Files only: the blocks of vmo_ which hold the contents of the file.
+    // Replaced with a larger bitmap as the file grows.
+    fbl::unique_ptr<RawBitmap> loaded_{};
+    uint32_t resident_blocks_{};
+    // Read-ahead window (in blocks) and the block at which the next
+    // sequential read is expected to start.
+    uint32_t readahead_{};
+    blk_t readahead_next_{};
+    // The number of reads copying data out of vmo_ without holding lock_.
+    // Only incremented with lock_ held.
+    fbl::atomic<uint32_t> readers_{};
+    // Files only: whether vmo_ has been cloned by Mmap. Uncommitted clones
+    // read through to vmo_, so its pages may not be decommitted.
+    bool cloned_{};
+
     // Use the watcher container to implement a directory watcher
     void Notify(const char* name, size_t len, unsigned event) final;
     mx_status_t WatchDir(mx::channel* out) final;
@@ -358,8 +566,17 @@ private:
     fs::RemoteContainer remoter_{};
     fs::WatcherContainer watcher_{};
 #endif
+
+    fbl::DoublyLinkedListNodeState<fbl::RefPtr<VnodeMinfs>> lru_node_state_{};
+    // Guarded by Minfs::hash_lock_.
+    uint32_t fd_count_{};
 };
 
+inline fbl::DoublyLinkedListNodeState<fbl::RefPtr<VnodeMinfs>>&
+VnodeMinfsLruTraits::node_state(VnodeMinfs& vn) {
+    return vn.lru_node_state_;
+}
+
 // Return the block offset in vmo_indirect_ of indirect blocks pointed to by the doubly indirect
 // block at dindex
 constexpr uint32_t GetVmoOffsetForIndirect(uint32_t dibindex) {
@@ -403,6 +620,8 @@ public:
     mx_status_t CheckForUnusedInodes() const;
     mx_status_t CheckLinkCounts() const;
     mx_status_t CheckAllocatedCounts() const;
+    // Marks the blocks reserved for the journal as in use.
+    mx_status_t CheckJournal();
 
     // "Set once"-style flag to identify if anything nonconforming
     // was found in the underlying filesystem -- even if it was fixed.
@@ -424,6 +643,10 @@ private:
                                ino_t parent, uint32_t flags);
     const char* CheckDataBlock(blk_t bno);
     mx_status_t CheckFile(minfs_inode_t* inode, ino_t ino);
+    mx_status_t CheckExtents(minfs_inode_t* inode, ino_t ino);
+    // Checks and reads the |index|th extent block of inode |ino|.
+    mx_status_t CheckExtentBlock(ino_t ino, uint32_t index, blk_t bno,
+                                 minfs_extent_block_t* out);
 
     fbl::unique_ptr<Minfs> fs_;
     RawBitmap checked_inodes_;
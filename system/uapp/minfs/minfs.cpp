@@ -18,6 +18,7 @@
 #include <fbl/limits.h>
 #include <fbl/unique_ptr.h>
 
+#include "journal.h"
 #include "minfs-private.h"
 
 namespace minfs {
@@ -34,6 +35,10 @@ void minfs_dump_info(const minfs_info_t* info) {
     FS_TRACE(MINFS, "minfs: inode table  @ %10u\n", info->ino_block);
     FS_TRACE(MINFS, "minfs: data blocks  @ %10u\n", info->dat_block);
     FS_TRACE(MINFS, "minfs: FVM-aware: %s\n", (info->flags & kMinfsFlagFVM) ? "YES" : "NO");
+    if (info->flags & kMinfsFlagJournal) {
+        FS_TRACE(MINFS, "minfs: journal      @ %10u (%u blocks)\n", info->jnl_start,
+                 info->jnl_blocks);
+    }
 }
 
 void minfs_dump_inode(const minfs_inode_t* inode, ino_t ino) {
@@ -51,7 +56,7 @@ mx_status_t minfs_check_info(const minfs_info_t* info, uint32_t max) {
         FS_TRACE_ERROR("minfs: bad magic\n");
         return MX_ERR_INVALID_ARGS;
     }
-    if (info->version != kMinfsVersion) {
+    if ((info->version > kMinfsVersion) || (info->version < kMinfsVersionBlockMap)) {
         FS_TRACE_ERROR("minfs: FS Version: %08x. Driver version: %08x\n", info->version,
               kMinfsVersion);
         return MX_ERR_INVALID_ARGS;
@@ -110,11 +115,24 @@ mx_status_t minfs_check_info(const minfs_info_t* info, uint32_t max) {
             return MX_ERR_INVALID_ARGS;
         }
     }
+    if (info->flags & kMinfsFlagJournal) {
+        if ((info->version < kMinfsVersionJournal) || (info->jnl_start == 0) ||
+            (info->jnl_blocks < kMinfsMinJournalBlocks) ||
+            (info->jnl_start + info->jnl_blocks > info->block_count)) {
+            FS_TRACE_ERROR("minfs: invalid journal location\n");
+            return MX_ERR_INVALID_ARGS;
+        }
+    }
     //TODO: validate layout
     return 0;
 }
 
 mx_status_t Minfs::InodeSync(WriteTxn* txn, ino_t ino, const minfs_inode_t* inode) {
+    fs::AutoLock lock(&alloc_lock_);
+    return InodeSyncLocked(txn, ino, inode);
+}
+
+mx_status_t Minfs::InodeSyncLocked(WriteTxn* txn, ino_t ino, const minfs_inode_t* inode) {
     // Obtain the offset of the inode within its containing block
     const uint32_t off_of_ino = (ino % kMinfsInodesPerBlock) * kMinfsInodeSize;
     const blk_t inoblock_rel = ino / kMinfsInodesPerBlock;
@@ -142,9 +160,151 @@ Minfs::Minfs(fbl::unique_ptr<Bcache> bc, const minfs_info_t* info) : bc_(fbl::mo
 }
 
 Minfs::~Minfs() {
+    lru_.clear();
     vnode_hash_.clear();
 }
 
+void Minfs::CacheTouch(VnodeMinfs* vn) {
+    fbl::RefPtr<VnodeMinfs> ref;
+    if (VnodeMinfsLruTraits::node_state(*vn).InContainer()) {
+        ref = lru_.erase(*vn);
+    } else {
+        ref = fbl::RefPtr<VnodeMinfs>(vn);
+        lru_count_++;
+    }
+    lru_.push_front(fbl::move(ref));
+}
+
+void Minfs::CacheTrim() {
+    LruList victims;
+#ifdef __Fuchsia__
+    // A vnode found by a lookup is only referenced by its caller until it
+    // is opened, and it must not be dropped from the hash table in the
+    // meantime. Lookups hold the namespace lock, so while it is busy
+    // (possibly with the current thread) the cache is trimmed on a later
+    // close instead.
+    if (mtx_trylock(&vfs.vfs_lock_) != thrd_success) {
+        return;
+    }
+#endif
+    {
+        fs::AutoLock lock(&hash_lock_);
+        auto iter = lru_.end();
+        while ((lru_count_ > cache_vnodes_) && (iter != lru_.begin())) {
+            VnodeMinfs* vn = &*(--iter);
+#ifdef __Fuchsia__
+            if ((vn->fd_count_ == 0) && vn->IsRemote()) {
+                // The mount point is held by the Vfs.
+                continue;
+            }
+#endif
+            ++iter;
+            victims.push_front(lru_.erase(*vn));
+            lru_count_--;
+            if (vn->fd_count_ == 0) {
+                vnode_hash_.erase(*vn);
+            }
+        }
+    }
+#ifdef __Fuchsia__
+    mtx_unlock(&vfs.vfs_lock_);
+
+    // Vnodes which are still open stay in memory; either way, their data is
+    // no longer worth keeping.
+    for (auto& vn : victims) {
+        if (!vn.IsDirectory() && vn.lock_.TryAcquire()) {
+            CacheUncharge(vn.EvictBlocks());
+            vn.lock_.Release();
+        }
+    }
+#endif
+    // Any victims which were closed are destroyed here, without locks held.
+}
+
+void Minfs::VnodeOpen(VnodeMinfs* vn) {
+    fs::AutoLock lock(&hash_lock_);
+    vn->fd_count_++;
+}
+
+void Minfs::VnodeClose(VnodeMinfs* vn) {
+    {
+        fs::AutoLock lock(&hash_lock_);
+        MX_DEBUG_ASSERT(vn->fd_count_ > 0);
+        // Unlinked vnodes have left the hash table, and are not cached.
+        if ((--vn->fd_count_ == 0) && vn->InContainer()) {
+            CacheTouch(vn);
+        }
+    }
+    CacheTrim();
+}
+
+void Minfs::CacheCharge(VnodeMinfs* vn, uint32_t count) {
+    fs::AutoLock lock(&hash_lock_);
+    resident_blocks_ += count;
+#ifdef __Fuchsia__
+    for (auto iter = lru_.end(); (resident_blocks_ > cache_blocks_) && (iter != lru_.begin());) {
+        --iter;
+        // Vnodes which are busy keep their data for now.
+        if ((&*iter != vn) && !iter->IsDirectory() && iter->lock_.TryAcquire()) {
+            uint32_t evicted = iter->EvictBlocks();
+            iter->lock_.Release();
+            MX_DEBUG_ASSERT(resident_blocks_ >= evicted);
+            resident_blocks_ -= evicted;
+        }
+    }
+#endif
+}
+
+void Minfs::SetCacheLimits(uint32_t vnodes, uint32_t blocks) {
+    {
+        fs::AutoLock lock(&hash_lock_);
+        if (vnodes != 0) {
+            cache_vnodes_ = vnodes;
+        }
+        if (blocks != 0) {
+            cache_blocks_ = blocks;
+        }
+    }
+    CacheTrim();
+    CacheCharge(nullptr, 0);
+}
+
+bool Minfs::CacheFull() const {
+    fs::AutoLock lock(&hash_lock_);
+    return resident_blocks_ > cache_blocks_;
+}
+
+void Minfs::CacheUncharge(uint32_t count) {
+    fs::AutoLock lock(&hash_lock_);
+    MX_DEBUG_ASSERT(resident_blocks_ >= count);
+    resident_blocks_ -= count;
+}
+
+void Minfs::GetCacheStats(vfs_cache_stats_t* out) const {
+    memset(out, 0, sizeof(*out));
+    out->hits = cache_hits_.load();
+    out->misses = cache_misses_.load();
+    out->readahead = cache_readahead_.load();
+    out->evictions = cache_evictions_.load();
+    out->block_size = kMinfsBlockSize;
+
+    fs::AutoLock lock(&hash_lock_);
+    out->resident_blocks = resident_blocks_;
+    out->limit_blocks = cache_blocks_;
+    out->vnode_hits = vnode_hits_;
+    out->vnode_misses = vnode_misses_;
+    out->vnode_count = lru_count_;
+    out->vnode_limit = cache_vnodes_;
+}
+
+void Minfs::GetUsage(vfs_query_info_t* out) const {
+    fs::AutoLock lock(&alloc_lock_);
+    out->total_bytes = info_.block_count * info_.block_size;
+    out->used_bytes = info_.alloc_block_count * info_.block_size;
+    out->total_nodes = info_.inode_count;
+    out->used_nodes = info_.alloc_inode_count;
+}
+
 mx_status_t Minfs::InoFree(VnodeMinfs* vn) {
     // We're going to be updating block bitmaps repeatedly.
     WriteTxn txn(bc_.get());
@@ -154,14 +314,41 @@ mx_status_t Minfs::InoFree(VnodeMinfs* vn) {
     auto ibm_id = inode_map_.StorageUnsafe()->GetData();
 #endif
 
+    // Load the extents before freeing anything, so that failing to do so
+    // does not leave the inode freed but its blocks still allocated.
+    mx_status_t status;
+    if (vn->IsExtentMapped() && ((status = vn->ExtentsLoad()) != MX_OK)) {
+        return status;
+    }
+
     // Free the inode bit itself
-    inode_map_.Clear(vn->ino_, vn->ino_ + 1);
-    info_.alloc_inode_count--;
+    {
+        fs::AutoLock lock(&alloc_lock_);
+        inode_map_.Clear(vn->ino_, vn->ino_ + 1);
+        info_.alloc_inode_count--;
 
-    blk_t bitbno = vn->ino_ / kMinfsBlockBits;
-    txn.Enqueue(ibm_id, bitbno, info_.ibm_block + bitbno, 1);
+        blk_t bitbno = vn->ino_ / kMinfsBlockBits;
+        txn.Enqueue(ibm_id, bitbno, info_.ibm_block + bitbno, 1);
+        CountUpdate(&txn);
+    }
     uint32_t block_count = vn->inode_.block_count;
 
+    if (vn->IsExtentMapped()) {
+        // release every extent, followed by the extent blocks themselves
+        minfs_extent_map_t* map = MinfsExtentMap(&vn->inode_);
+        for (unsigned n = 0; n < map->count; n++) {
+            const minfs_extent_t* e = vn->ExtentAt(n);
+            block_count -= e->count;
+            BlockFreeRange(&txn, e->start, e->count);
+        }
+        uint32_t eblocks = MinfsExtentBlocks(map->count);
+        map->count = 0;
+        vn->ExtentsFreeBlocks(&txn, eblocks);
+
+        MX_DEBUG_ASSERT(block_count == eblocks);
+        return MX_OK;
+    }
+
     // release all direct blocks
     for (unsigned n = 0; n < kMinfsDirect; n++) {
         if (vn->inode_.dnum[n] == 0) {
@@ -180,7 +367,6 @@ mx_status_t Minfs::InoFree(VnodeMinfs* vn) {
         }
 
 #ifdef __Fuchsia__
-        mx_status_t status;
         if ((status = vn->InitIndirectVmo()) != MX_OK) {
             return status;
         }
@@ -212,7 +398,6 @@ mx_status_t Minfs::InoFree(VnodeMinfs* vn) {
             continue;
         }
 #ifdef __Fuchsia__
-        mx_status_t status;
         if ((status = vn->InitIndirectVmo()) != MX_OK) {
             return status;
         }
@@ -261,7 +446,6 @@ mx_status_t Minfs::InoFree(VnodeMinfs* vn) {
         BlockFree(&txn, vn->inode_.dinum[n]);
     }
 
-    CountUpdate(&txn);
     MX_DEBUG_ASSERT(block_count == 0);
     return MX_OK;
 }
@@ -365,12 +549,14 @@ mx_status_t Minfs::AddBlocks() {
 
     // Update the block bitmap, write the new blocks back to disk
     // as "zero".
-    if (block_map_.Grow(fbl::roundup(blocks, kMinfsBlockBits)) != MX_OK) {
+    if (block_map_.Grow(fbl::roundup(blocks, kMinfsBlockBits)) != MX_OK ||
+        pending_free_.Grow(fbl::roundup(blocks, kMinfsBlockBits)) != MX_OK) {
         return MX_ERR_NO_SPACE;
     }
     // Grow before shrinking to ensure the underlying storage is a multiple
     // of kMinfsBlockSize.
     block_map_.Shrink(blocks);
+    pending_free_.Shrink(blocks);
     if (abmblks > abmblks_old) {
         txn.Enqueue(block_map_vmoid_, abmblks_old, info_.abm_block + abmblks_old,
                     abmblks - abmblks_old);
@@ -418,7 +604,7 @@ mx_status_t Minfs::InoNew(WriteTxn* txn, const minfs_inode_t* inode, ino_t* ino_
     // TODO(smklein): optional sanity check of both blocks
 
     // Write the inode back
-    if ((status = InodeSync(txn, ino, inode)) != MX_OK) {
+    if ((status = InodeSyncLocked(txn, ino, inode)) != MX_OK) {
         inode_map_.Clear(ino, ino + 1);
         info_.alloc_inode_count--;
         return status;
@@ -451,33 +637,39 @@ mx_status_t Minfs::VnodeNew(WriteTxn* txn, fbl::RefPtr<VnodeMinfs>* out, uint32_
     }
 
     // Allocate the on-disk inode
-    if ((status = InoNew(txn, &vn->inode_, &vn->ino_)) != MX_OK) {
-        return status;
+    {
+        fs::AutoLock lock(&alloc_lock_);
+        if ((status = InoNew(txn, &vn->inode_, &vn->ino_)) != MX_OK) {
+            return status;
+        }
     }
 
+    fs::AutoLock lock(&hash_lock_);
     vnode_hash_.insert(vn.get());
+    CacheTouch(vn.get());
 
     *out = fbl::move(vn);
     return 0;
 }
 
 void Minfs::VnodeRelease(VnodeMinfs* vn) {
-    vnode_hash_.erase(*vn);
+    // Declared first, so that it is dropped after the lock.
+    fbl::RefPtr<VnodeMinfs> cached;
+    fs::AutoLock lock(&hash_lock_);
+    if (vn->InContainer()) {
+        vnode_hash_.erase(*vn);
+    }
+    if (VnodeMinfsLruTraits::node_state(*vn).InContainer()) {
+        cached = lru_.erase(*vn);
+        lru_count_--;
+    }
 }
 
-mx_status_t Minfs::VnodeGet(fbl::RefPtr<VnodeMinfs>* out, ino_t ino) {
+mx_status_t Minfs::InodeLoad(ino_t ino, minfs_inode_t* out) {
+    fs::AutoLock lock(&alloc_lock_);
     if ((ino < 1) || (ino >= info_.inode_count)) {
         return MX_ERR_OUT_OF_RANGE;
     }
-    fbl::RefPtr<VnodeMinfs> vn = fbl::RefPtr<VnodeMinfs>(vnode_hash_.find(ino).CopyPointer());
-    if (vn != nullptr) {
-        *out = fbl::move(vn);
-        return MX_OK;
-    }
-    mx_status_t status;
-    if ((status = VnodeMinfs::AllocateHollow(this, &vn)) != MX_OK) {
-        return MX_ERR_NO_MEMORY;
-    }
 
     // obtain the block of the inode table we need
     uint32_t off_of_ino = (ino % kMinfsInodesPerBlock) * kMinfsInodeSize;
@@ -488,16 +680,52 @@ mx_status_t Minfs::VnodeGet(fbl::RefPtr<VnodeMinfs>* out, ino_t ino) {
     uint8_t inodata[kMinfsBlockSize];
     bc_->Readblk(info_.ino_block + (ino / kMinfsInodesPerBlock), inodata);
 #endif
-    memcpy(&vn->inode_, (void*)((uintptr_t)inodata + off_of_ino), kMinfsInodeSize);
+    memcpy(out, (void*)((uintptr_t)inodata + off_of_ino), kMinfsInodeSize);
+    return MX_OK;
+}
+
+mx_status_t Minfs::VnodeGet(fbl::RefPtr<VnodeMinfs>* out, ino_t ino) {
+    {
+        fs::AutoLock lock(&hash_lock_);
+        VnodeMinfs* raw = vnode_hash_.find(ino).CopyPointer();
+        if (raw != nullptr) {
+            // Vnodes in the table are open or cached, so this is never the
+            // last reference to come back.
+            vnode_hits_++;
+            CacheTouch(raw);
+            *out = fbl::RefPtr<VnodeMinfs>(raw);
+            return MX_OK;
+        }
+        vnode_misses_++;
+    }
+
+    fbl::RefPtr<VnodeMinfs> vn;
+    mx_status_t status;
+    if ((status = VnodeMinfs::AllocateHollow(this, &vn)) != MX_OK) {
+        return MX_ERR_NO_MEMORY;
+    }
+    if ((status = InodeLoad(ino, &vn->inode_)) != MX_OK) {
+        return status;
+    }
     vn->ino_ = ino;
+
+    // Lookups are serialized by the Vfs, so no other vnode for ino can have
+    // been created in the meantime.
+    fs::AutoLock lock(&hash_lock_);
     vnode_hash_.insert(vn.get());
+    CacheTouch(vn.get());
 
     *out = fbl::move(vn);
     return MX_OK;
 }
 
 mx_status_t Minfs::BlockFree(WriteTxn* txn, blk_t bno) {
+    return BlockFreeRange(txn, bno, 1);
+}
+
+mx_status_t Minfs::BlockFreeRange(WriteTxn* txn, blk_t bno, blk_t count) {
     ValidateBno(bno);
+    ValidateBno(bno + count - 1);
 
 #ifdef __Fuchsia__
     auto bbm_id = block_map_vmoid_;
@@ -505,10 +733,23 @@ mx_status_t Minfs::BlockFree(WriteTxn* txn, blk_t bno) {
     auto bbm_id = block_map_.StorageUnsafe()->GetData();
 #endif
 
-    block_map_.Clear(bno, bno + 1);
-    info_.alloc_block_count--;
-    blk_t bitbno = bno / kMinfsBlockBits;
-    txn->Enqueue(bbm_id, bitbno, info_.abm_block + bitbno, 1);
+    fs::AutoLock lock(&alloc_lock_);
+    block_map_.Clear(bno, bno + count);
+    info_.alloc_block_count -= count;
+    blk_t bitbno_start = bno / kMinfsBlockBits;
+    blk_t bitbno_end = (bno + count - 1) / kMinfsBlockBits;
+    txn->Enqueue(bbm_id, bitbno_start, info_.abm_block + bitbno_start,
+                 bitbno_end - bitbno_start + 1);
+#ifdef __Fuchsia__
+    // The trim follows the bitmap write, so the journal can tell which
+    // entry frees the blocks.
+    if (bc_->DefersFrees()) {
+        pending_free_.Set(bno, bno + count);
+    }
+    if (bc_->SupportsTrim() || bc_->DefersFrees()) {
+        txn->EnqueueTrim(static_cast<uint64_t>(info_.dat_block) + bno, count);
+    }
+#endif
     return CountUpdate(txn);
 }
 
@@ -516,16 +757,61 @@ mx_status_t Minfs::BlockFree(WriteTxn* txn, blk_t bno) {
 //
 // If hint is nonzero it indicates which block number to start the search for
 // free blocks from.
+mx_status_t Minfs::BlockFind(size_t start, size_t end, size_t* out) const {
+    mx_status_t status;
+    while ((status = block_map_.Find(false, start, end, 1, out)) == MX_OK) {
+#ifdef __Fuchsia__
+        size_t pending_end = pending_free_.Scan(*out, end, true);
+        if (pending_end != *out) {
+            start = pending_end;
+            continue;
+        }
+#endif
+        return MX_OK;
+    }
+    return status;
+}
+
+#ifdef __Fuchsia__
+void Minfs::ReleaseFreedBlocks() {
+    fbl::Vector<BlockRun> freed;
+    bc_->TakeFreed(&freed);
+    for (const auto& run : freed) {
+        if (run.start < info_.dat_block) {
+            continue;
+        }
+        const size_t start = run.start - info_.dat_block;
+        pending_free_.Clear(start, start + run.count);
+    }
+}
+#endif
+
 mx_status_t Minfs::BlockNew(WriteTxn* txn, blk_t hint, blk_t* out_bno) {
     size_t bitoff_start;
     mx_status_t status;
-    if ((status = block_map_.Find(false, hint, block_map_.size(), 1, &bitoff_start)) != MX_OK) {
-        if ((status = block_map_.Find(false, 0, hint, 1, &bitoff_start)) != MX_OK) {
+    fs::AutoLock lock(&alloc_lock_);
+    if (hint >= block_map_.size()) {
+        hint = 0;
+    }
+#ifdef __Fuchsia__
+    ReleaseFreedBlocks();
+#endif
+    if ((status = BlockFind(hint, block_map_.size(), &bitoff_start)) != MX_OK &&
+        (status = BlockFind(0, hint, &bitoff_start)) != MX_OK) {
+#ifdef __Fuchsia__
+        // Blocks freed recently may only be waiting for their journal
+        // entry to be written back.
+        if (bc_->DefersFrees() && bc_->Sync() == 0) {
+            ReleaseFreedBlocks();
+            status = BlockFind(0, block_map_.size(), &bitoff_start);
+        }
+#endif
+        if (status != MX_OK) {
             size_t old_size = block_map_.size();
             if ((status = AddBlocks()) != MX_OK) {
                 return status;
-            } else if ((status = block_map_.Find(false, old_size, block_map_.size(),
-                                                 1, &bitoff_start)) != MX_OK) {
+            } else if ((status = BlockFind(old_size, block_map_.size(),
+                                           &bitoff_start)) != MX_OK) {
                 return status;
             }
         }
@@ -627,6 +913,10 @@ mx_status_t Minfs::Create(Minfs** out, fbl::unique_ptr<Bcache> bc, const minfs_i
     }
 
 #ifdef __Fuchsia__
+    if ((status = fs->pending_free_.Reset(fs->abmblks_ * kMinfsBlockBits)) < 0 ||
+        (status = fs->pending_free_.Shrink(fs->info_.block_count)) < 0) {
+        return status;
+    }
     if ((status = fs->bc_->AttachVmo(fs->block_map_.StorageUnsafe()->GetVmo(),
                                      &fs->block_map_vmoid_)) != MX_OK) {
         return status;
@@ -696,6 +986,29 @@ mx_status_t minfs_mount(fbl::RefPtr<VnodeMinfs>* out, fbl::unique_ptr<Bcache> bc
         return status;
     }
     const minfs_info_t* info = reinterpret_cast<minfs_info_t*>(blk);
+    if ((status = minfs_check_info(info, bc->Maxblk())) != MX_OK) {
+        return status;
+    }
+
+    if (info->flags & kMinfsFlagJournal) {
+        // Bring the metadata up to date (the superblock included) before
+        // anything else is read from disk.
+        if ((status = minfs_journal_replay(bc.get(), info)) != MX_OK) {
+            FS_TRACE_ERROR("minfs: journal replay failed\n");
+            return status;
+        } else if ((status = bc->Readblk(0, &blk)) != MX_OK) {
+            FS_TRACE_ERROR("minfs: could not read info block\n");
+            return status;
+        }
+#ifdef __Fuchsia__
+        fbl::unique_ptr<Journal> journal;
+        if ((status = Journal::Create(bc.get(), info, &journal)) != MX_OK) {
+            FS_TRACE_ERROR("minfs: could not initialize journal\n");
+            return status;
+        }
+        bc->SetJournal(fbl::move(journal));
+#endif
+    }
 
     Minfs* fs;
     if ((status = Minfs::Create(&fs, fbl::move(bc), info)) != MX_OK) {
@@ -908,6 +1221,22 @@ int minfs_mkfs(fbl::unique_ptr<Bcache> bc) {
     abm.Set(0, 2);
     info.alloc_block_count++;
 
+    // Reserve the journal right after the root directory, unless the
+    // volume is too small to spare the blocks.
+    uint32_t jnl_blocks = fbl::min(kMinfsDefaultJournalBlocks, info.block_count / 32);
+    if (jnl_blocks >= kMinfsMinJournalBlocks) {
+        info.flags |= kMinfsFlagJournal;
+        info.jnl_start = 2;
+        info.jnl_blocks = jnl_blocks;
+        abm.Set(info.jnl_start, info.jnl_start + jnl_blocks);
+        info.alloc_block_count += jnl_blocks;
+        if ((status = minfs_journal_format(bc.get(), &info)) != MX_OK) {
+            FS_TRACE_ERROR("mkfs: Failed to initialize journal\n");
+            minfs_free_slices(bc.get(), &info);
+            return status;
+        }
+    }
+
     // write allocation bitmap
     for (uint32_t n = 0; n < abmblks; n++) {
         void* bmdata = fs::GetBlock<kMinfsBlockSize>(abm.StorageUnsafe()->GetData(), n);
@@ -935,7 +1264,12 @@ int minfs_mkfs(fbl::unique_ptr<Bcache> bc) {
     ino[kMinfsRootIno].block_count = 1;
     ino[kMinfsRootIno].link_count = 2;
     ino[kMinfsRootIno].dirent_count = 2;
-    ino[kMinfsRootIno].dnum[0] = 1;
+    ino[kMinfsRootIno].inode_flags = kMinfsInodeFlagExtents;
+    minfs_extent_map_t* map = MinfsExtentMap(&ino[kMinfsRootIno]);
+    map->count = 1;
+    map->extents[0].fblock = 0;
+    map->extents[0].start = 1;
+    map->extents[0].count = 1;
     bc->Writeblk(info.ino_block, blk);
 
     memset(blk, 0, sizeof(blk));
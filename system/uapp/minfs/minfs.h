@@ -13,6 +13,7 @@
 #include <fbl/ref_ptr.h>
 #include <fbl/type_support.h>
 #include <fbl/unique_free_ptr.h>
+#include <fbl/vector.h>
 
 #include <magenta/types.h>
 
@@ -25,6 +26,7 @@
 
 #ifdef __Fuchsia__
 #include <block-client/client.h>
+#include <fs/locking.h>
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::VmoStorage>;
 #else
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::DefaultStorage>;
@@ -44,11 +46,22 @@ typedef uint32_t ino_t;
 
 constexpr uint64_t kMinfsMagic0         = (0x002153466e694d21ULL);
 constexpr uint64_t kMinfsMagic1         = (0x385000d3d3d3d304ULL);
-constexpr uint32_t kMinfsVersion        = 0x00000005;
+constexpr uint32_t kMinfsVersion        = 0x00000008;
+// Oldest on-disk revision still understood by the driver. Volumes of this
+// revision only contain block-mapped inodes, and new inodes created on them
+// stay block-mapped so the image remains usable by older drivers.
+constexpr uint32_t kMinfsVersionBlockMap = 0x00000005;
+// First revision which creates extent-mapped inodes.
+constexpr uint32_t kMinfsVersionExtents  = 0x00000006;
+// First revision which may hold a metadata journal.
+constexpr uint32_t kMinfsVersionJournal  = 0x00000007;
+// First revision whose directories may grow beyond kMinfsMaxDirectorySizeV7.
+constexpr uint32_t kMinfsVersionLargeDirectories = 0x00000008;
 
 constexpr ino_t kMinfsRootIno           = 1;
 constexpr uint32_t kMinfsFlagClean      = 0x00000001; // Currently unused
 constexpr uint32_t kMinfsFlagFVM        = 0x00000002; // Mounted on FVM
+constexpr uint32_t kMinfsFlagJournal    = 0x00000004; // Metadata journal present
 constexpr uint32_t kMinfsBlockSize      = 8192;
 constexpr uint32_t kMinfsBlockBits      = (kMinfsBlockSize * 8);
 constexpr uint32_t kMinfsInodeSize      = 256;
@@ -66,6 +79,10 @@ constexpr uint64_t kMinfsMaxFileBlock = (kMinfsDirect + (kMinfsIndirect * kMinfs
                                         * kMinfsDirectPerIndirect));
 constexpr uint64_t kMinfsMaxFileSize  = kMinfsMaxFileBlock * kMinfsBlockSize;
 
+// Extent-mapped inodes reuse the storage of the direct, indirect and doubly
+// indirect block tables to hold a minfs_extent_map_t.
+constexpr uint32_t kMinfsInlineExtents   = 15;
+
 constexpr uint32_t kMinfsTypeFile = 8;
 constexpr uint32_t kMinfsTypeDir  = 4;
 
@@ -101,6 +118,9 @@ typedef struct {
     uint32_t abm_slices;    // Slices allocated to block bitmap
     uint32_t ino_slices;    // Slices allocated to inode table
     uint32_t dat_slices;    // Slices allocated to file data section
+    // The following fields are only valid with (flags & kMinfsFlagJournal):
+    blk_t jnl_start;        // first data block of the journal
+    uint32_t jnl_blocks;    // number of data blocks reserved for the journal
 } minfs_info_t;
 
 // Notes:
@@ -116,6 +136,16 @@ typedef struct {
 //     ino_block + ino / kMinfsInodesPerBlock
 //   at offset: ino % kMinfsInodesPerBlock
 // - inode 0 is never used, should be marked allocated but ignored
+// - inodes with kMinfsInodeFlagExtents set map their data through an
+//   extent map instead of dnum / inum / dinum. Extents are sorted by
+//   fblock and never overlap. Up to kMinfsInlineExtents are stored in
+//   the inode itself; larger maps are moved, as a whole, into a chain of
+//   extent blocks starting at eblock, each holding the next
+//   kMinfsExtentsPerBlock extents of the map. The chain holds exactly as
+//   many blocks as the map needs, and is released again once the map fits
+//   back in the inode.
+// - the journal (if any) is a contiguous run of data blocks, marked as
+//   allocated in the block bitmap. See "Journal" below.
 
 typedef struct {
     uint32_t magic;
@@ -127,7 +157,8 @@ typedef struct {
     uint32_t seq_num;               // bumped when modified
     uint32_t gen_num;               // bumped when deleted
     uint32_t dirent_count;          // for directories
-    uint32_t rsvd[5];
+    uint32_t inode_flags;           // kMinfsInodeFlag*
+    uint32_t rsvd[4];
     blk_t dnum[kMinfsDirect];    // direct blocks
     blk_t inum[kMinfsIndirect];  // indirect blocks
     blk_t dinum[kMinfsDoublyIndirect]; // doubly indirect blocks
@@ -136,6 +167,53 @@ typedef struct {
 static_assert(sizeof(minfs_inode_t) == kMinfsInodeSize,
               "minfs inode size is wrong");
 
+// Inode maps its data with extents rather than direct / indirect blocks
+constexpr uint32_t kMinfsInodeFlagExtents = 0x00000001;
+
+typedef struct {
+    blk_t fblock;                   // first file-relative block mapped
+    blk_t start;                    // first data block backing fblock
+    uint32_t count;                 // number of contiguous blocks
+} minfs_extent_t;
+
+constexpr uint32_t kMinfsExtentsPerBlock = (kMinfsBlockSize / sizeof(minfs_extent_t));
+
+typedef struct {
+    minfs_extent_t extents[kMinfsExtentsPerBlock];
+    blk_t next;                     // next extent block in the chain, or 0
+    uint32_t rsvd;
+} minfs_extent_block_t;
+
+static_assert(sizeof(minfs_extent_block_t) == kMinfsBlockSize,
+              "minfs extent block size is wrong");
+
+typedef struct {
+    uint32_t count;                 // number of extents mapped by the inode
+    blk_t eblock;                   // first extent block, once the extents outgrow the inode
+    uint32_t rsvd;
+    minfs_extent_t extents[kMinfsInlineExtents];
+} minfs_extent_map_t;
+
+static_assert(sizeof(minfs_extent_map_t) ==
+              sizeof(blk_t) * (kMinfsDirect + kMinfsIndirect + kMinfsDoublyIndirect),
+              "minfs extent map must overlay the inode block tables exactly");
+
+static inline minfs_extent_map_t* MinfsExtentMap(minfs_inode_t* inode) {
+    return reinterpret_cast<minfs_extent_map_t*>(inode->dnum);
+}
+
+static inline const minfs_extent_map_t* MinfsExtentMap(const minfs_inode_t* inode) {
+    return reinterpret_cast<const minfs_extent_map_t*>(inode->dnum);
+}
+
+// Returns the number of extent blocks needed to hold a map of |count| extents.
+static inline uint32_t MinfsExtentBlocks(uint32_t count) {
+    if (count <= kMinfsInlineExtents) {
+        return 0;
+    }
+    return (count + kMinfsExtentsPerBlock - 1) / kMinfsExtentsPerBlock;
+}
+
 typedef struct {
     ino_t ino;                      // inode number
     uint32_t reclen;                // Low 28 bits: Length of record
@@ -153,7 +231,11 @@ constexpr uint32_t DirentSize(uint8_t namelen) {
 
 constexpr uint8_t kMinfsMaxNameSize       = 255;
 constexpr uint32_t kMinfsMaxDirentSize    = DirentSize(kMinfsMaxNameSize);
-constexpr uint32_t kMinfsMaxDirectorySize = (((1 << 20) - 1) & (~3));
+constexpr uint32_t kMinfsMaxDirectorySize = (((1 << 24) - 1) & (~3));
+// Older drivers stop scanning directories at this size, so volumes of
+// revisions before kMinfsVersionLargeDirectories never grow directories
+// beyond it.
+constexpr uint32_t kMinfsMaxDirectorySizeV7 = (((1 << 20) - 1) & (~3));
 
 static_assert(kMinfsMaxNameSize >= NAME_MAX,
               "MinFS names must be large enough to hold NAME_MAX characters");
@@ -179,6 +261,61 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 //   also increase in size.
 
 
+// Journal
+//
+// Metadata updates (bitmaps, inodes, the superblock, directory and
+// indirect / extent blocks) are batched into a single journal entry,
+// which is written sequentially and committed before any of its blocks
+// are written back to their home location. File data is not journaled;
+// it always reaches the disk before the metadata which references it.
+//
+// Journal block 0 holds a minfs_journal_info_t. A pending entry starts at
+// journal block 1 with a minfs_journal_header_t, followed by |count|
+// payload blocks and a minfs_journal_commit_t. An entry is replayed at
+// mount time iff its header and commit block carry the sequence number
+// recorded in the journal info block and the commit checksum matches.
+// Once all blocks of an entry are written back, the sequence number in
+// the info block is advanced, retiring the entry.
+
+constexpr uint64_t kMinfsJournalMagic       = (0x6c6e724a73666e4dULL); // "MnfsJrnl"
+constexpr uint64_t kMinfsJournalHeaderMagic = (0x7264684a73666e4dULL); // "MnfsJhdr"
+constexpr uint64_t kMinfsJournalCommitMagic = (0x746d634a73666e4dULL); // "MnfsJcmt"
+
+// Default and smallest usable journal sizes, in blocks
+constexpr uint32_t kMinfsDefaultJournalBlocks = 256;
+constexpr uint32_t kMinfsMinJournalBlocks     = 8;
+// Journal blocks used for bookkeeping: info, header and commit blocks
+constexpr uint32_t kMinfsJournalOverhead      = 3;
+
+// Payload blocks whose target is set to this value were superseded after
+// they were staged (the block was rewritten as file data); they are
+// neither replayed nor written back.
+constexpr blk_t kMinfsJournalRevoked = 0xFFFFFFFF;
+
+typedef struct {
+    uint64_t magic;                 // kMinfsJournalMagic
+    uint64_t seq;                   // sequence number of the next entry
+} minfs_journal_info_t;
+
+constexpr uint32_t kMinfsJournalMaxEntryBlocks = ((kMinfsBlockSize - 24) / sizeof(blk_t));
+
+typedef struct {
+    uint64_t magic;                 // kMinfsJournalHeaderMagic
+    uint64_t seq;
+    uint32_t count;                 // number of payload blocks
+    uint32_t rsvd;
+    blk_t target[kMinfsJournalMaxEntryBlocks]; // device block of each payload block
+} minfs_journal_header_t;
+
+static_assert(sizeof(minfs_journal_header_t) == kMinfsBlockSize,
+              "minfs journal header must fill exactly one block");
+
+typedef struct {
+    uint64_t magic;                 // kMinfsJournalCommitMagic
+    uint64_t seq;
+    uint64_t checksum;              // fnv1a64 of the header and payload blocks
+} minfs_journal_commit_t;
+
 // blocksize   8K    16K    32K
 // 16 dir =  128K   256K   512K
 // 32 ind =  512M  1024M  2048M
@@ -190,6 +327,16 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 // Block Cache (bcache.c)
 constexpr uint32_t kMinfsHashBits = (8);
 
+#ifdef __Fuchsia__
+class Journal;
+
+// A run of device blocks.
+struct BlockRun {
+    blk_t start;
+    uint64_t count;
+};
+#endif
+
 class Bcache {
 public:
     DISALLOW_COPY_ASSIGN_AND_MOVE(Bcache);
@@ -208,11 +355,32 @@ public:
 
 #ifdef __Fuchsia__
     ssize_t GetDevicePath(char* out, size_t out_len);
+    // Attaches a VMO holding filesystem metadata. Once a journal is
+    // installed, writes from this VMO are journaled.
     mx_status_t AttachVmo(mx_handle_t vmo, vmoid_t* out);
-    mx_status_t Txn(block_fifo_request_t* requests, size_t count) {
+    // Attaches a VMO holding file data, which is never journaled.
+    mx_status_t AttachDataVmo(mx_handle_t vmo, vmoid_t* out);
+    // Issues requests to the block device, routing them through the
+    // journal (if one is installed).
+    mx_status_t Txn(block_fifo_request_t* requests, size_t count);
+    // Issues requests directly to the block device, bypassing the journal.
+    mx_status_t FifoTxn(block_fifo_request_t* requests, size_t count) {
+        fs::AutoLock lock(&fifo_lock_);
         return block_fifo_txn(fifo_client_, requests, count);
     }
     txnid_t TxnId() const { return txnid_; }
+    // Returns true if the device can discard freed blocks.
+    bool SupportsTrim() const { return trim_; }
+    // Waits for completed writes to reach stable storage.
+    mx_status_t Barrier();
+    // Returns true if blocks freed by metadata writes must be announced
+    // with BLOCKIO_TRIM and kept unused until returned by TakeFreed().
+    bool DefersFrees() const { return journal_ != nullptr; }
+    // Moves the device blocks which may be reused again into |out|.
+    void TakeFreed(fbl::Vector<BlockRun>* out);
+
+    // Routes all subsequent metadata writes through |journal|.
+    void SetJournal(fbl::unique_ptr<Journal> journal);
 
     mx_status_t FVMQuery(fvm_info_t* info) {
         ssize_t r = ioctl_block_fvm_query(fd_, info);
@@ -239,6 +407,7 @@ public:
     }
 #endif
 
+    // Commits any pending journal entry and flushes the block device.
     int Sync();
 
     ~Bcache();
@@ -247,8 +416,15 @@ private:
     Bcache(int fd, uint32_t blockmax);
 
 #ifdef __Fuchsia__
+    mx_status_t AttachVmoInternal(mx_handle_t vmo, vmoid_t* out);
+
+    fbl::unique_ptr<Journal> journal_{};
+    // Vnodes issue transactions concurrently, but they all share txnid_, so
+    // each must run to completion before the next is sent.
+    fs::Mutex fifo_lock_{};
     fifo_client_t* fifo_client_{}; // Fast path to interact with block device
     txnid_t txnid_{}; // TODO(smklein): One per thread
+    bool trim_{};
 #endif
     int fd_ = -1;
     uint32_t blockmax_{};
@@ -19,6 +19,8 @@ MODULE_SRCS += \
 
 # minfs implementation
 MODULE_SRCS += \
+    $(LOCAL_DIR)/dir-index.cpp \
+    $(LOCAL_DIR)/journal.cpp \
     $(LOCAL_DIR)/minfs.cpp \
     $(LOCAL_DIR)/minfs-ops.cpp \
     $(LOCAL_DIR)/minfs-check.cpp \
@@ -57,6 +59,8 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test.cpp \
     $(LOCAL_DIR)/host.cpp \
     $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/dir-index.cpp \
+    $(LOCAL_DIR)/journal.cpp \
     $(LOCAL_DIR)/minfs.cpp \
     $(LOCAL_DIR)/minfs-ops.cpp \
     system/ulib/bitmap/raw-bitmap.cpp \
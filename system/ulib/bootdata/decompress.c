@@ -5,6 +5,7 @@
 #include <bootdata/decompress.h>
 
 #include <limits.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include <magenta/boot/bootdata.h>
@@ -46,6 +47,8 @@ typedef struct {
 #define MX_LZ4_BLOCK_1MB          (6 << 4)
 #define MX_LZ4_BLOCK_4MB          (7 << 4)
 
+#define MX_LZ4_BLOCK_MAX          65536
+
 static mx_status_t check_lz4_frame(const lz4_frame_desc* fd,
                                    size_t expected, const char** err) {
     if ((fd->flag & MX_LZ4_FLAG_VERSION) != MX_LZ4_VERSION) {
@@ -175,6 +178,405 @@ static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar, const uint8_t* data,
     return MX_OK;
 }
 
+// Decompresses the LZ4 frame of len bytes at data, which must hold exactly
+// outsize bytes, into dst.  If buffer is not NULL, each block goes through
+// it and is written into vmo at vmo_off instead.
+static mx_status_t decompress_frame(const uint8_t* data, size_t len,
+                                    size_t outsize, uint8_t* dst,
+                                    uint8_t* buffer, mx_handle_t vmo,
+                                    uint64_t vmo_off, const char** err) {
+    const size_t frame_hdr = sizeof(uint32_t) + sizeof(lz4_frame_desc);
+    if (len < frame_hdr + sizeof(uint32_t)) {
+        *err = "lz4 frame too small";
+        return MX_ERR_INVALID_ARGS;
+    }
+    if (*(const uint32_t*)data != MX_LZ4_MAGIC) {
+        *err = "bad magic number for compressed bootfs file";
+        return MX_ERR_INVALID_ARGS;
+    }
+    mx_status_t status = check_lz4_frame(
+        (const lz4_frame_desc*)(data + sizeof(uint32_t)), outsize, err);
+    if (status != MX_OK) {
+        return status;
+    }
+
+    const uint8_t* end = data + len;
+    data += frame_hdr;
+
+    size_t remaining = outsize;
+    for (;;) {
+        if ((size_t)(end - data) < sizeof(uint32_t)) {
+            *err = "lz4 frame truncated";
+            return MX_ERR_INVALID_ARGS;
+        }
+        uint32_t blocksize = *(const uint32_t*)data;
+        data += sizeof(uint32_t);
+        if (blocksize == 0) {
+            break;
+        }
+
+        // If the data is uncompressed, the high bit is 1.
+        bool raw = blocksize >> 31;
+        blocksize &= 0x7fffffff;
+        if (blocksize > (size_t)(end - data)) {
+            *err = "lz4 block overruns frame";
+            return MX_ERR_INVALID_ARGS;
+        }
+
+        size_t space = remaining < MX_LZ4_BLOCK_MAX ? remaining : MX_LZ4_BLOCK_MAX;
+        const uint8_t* block;
+        size_t actual;
+        if (raw) {
+            if (blocksize > space) {
+                *err = "bootdata outsize too small for lz4 decompression";
+                return MX_ERR_INVALID_ARGS;
+            }
+            block = data;
+            actual = blocksize;
+            if (buffer == NULL) {
+                memcpy(dst, block, actual);
+            }
+        } else {
+            uint8_t* out = buffer ? buffer : dst;
+            int dcmp = LZ4_decompress_safe((const char*)data, (char*)out,
+                                           blocksize, space);
+            if (dcmp < 0) {
+                *err = "lz4 decompression failed";
+                return MX_ERR_BAD_STATE;
+            }
+            block = out;
+            actual = dcmp;
+        }
+
+        if (buffer != NULL) {
+            size_t wrote;
+            status = mx_vmo_write(vmo, block, vmo_off, actual, &wrote);
+            if (status < 0) {
+                *err = "mx_vmo_write failed on bootfs vmo";
+                return status;
+            }
+            vmo_off += actual;
+        } else {
+            dst += actual;
+        }
+        data += blocksize;
+        remaining -= actual;
+    }
+
+    if (remaining != 0) {
+        *err = "bootfs file size does not match decompressed size";
+        return MX_ERR_INVALID_ARGS;
+    }
+    return MX_OK;
+}
+
+// Checks the bootfs header, directory and index at the start of a
+// per-file compressed payload, and the frames the index points to.
+static mx_status_t lazy_parse(bootfs_lazy_t* lazy, const uint8_t* payload,
+                              size_t len, size_t outsize, const char** err) {
+    const bootfs_header_t* hdr = (const bootfs_header_t*)payload;
+    if ((len < sizeof(*hdr)) || (hdr->magic != BOOTFS_MAGIC)) {
+        *err = "bad magic number for per-file compressed bootfs";
+        return MX_ERR_INVALID_ARGS;
+    }
+    if ((hdr->dirsize > len - sizeof(*hdr)) ||
+        (len - sizeof(*hdr) - hdr->dirsize < sizeof(bootfs_index_t))) {
+        *err = "bootfs directory overruns bootdata item";
+        return MX_ERR_INVALID_ARGS;
+    }
+    size_t dir_len = sizeof(*hdr) + hdr->dirsize;
+    if (dir_len > outsize) {
+        *err = "bootfs directory larger than bootdata outsize";
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    const bootfs_index_t* index = (const bootfs_index_t*)(payload + dir_len);
+    if (index->magic != BOOTFS_INDEX_MAGIC) {
+        *err = "bad magic number for bootfs index";
+        return MX_ERR_INVALID_ARGS;
+    }
+    if (index->count > (len - dir_len - sizeof(*index)) / sizeof(bootfs_frame_t)) {
+        *err = "bootfs index overruns bootdata item";
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    // Lookups rely on the files being in order.
+    const bootfs_frame_t* frames = (const bootfs_frame_t*)(index + 1);
+    uint64_t data_end = dir_len;
+    for (uint32_t i = 0; i < index->count; i++) {
+        const bootfs_frame_t* f = &frames[i];
+        if ((f->data_off < data_end) ||
+            ((uint64_t)f->data_off + f->data_len > outsize)) {
+            *err = "bootfs index has bogus file offset";
+            return MX_ERR_INVALID_ARGS;
+        }
+        if (((uint64_t)f->frame_off + f->frame_len > len) ||
+            ((f->frame_len == 0) && (f->data_len != 0))) {
+            *err = "bootfs index has bogus frame offset";
+            return MX_ERR_INVALID_ARGS;
+        }
+        data_end = (uint64_t)f->data_off + f->data_len;
+    }
+
+    lazy->payload = payload;
+    lazy->payload_len = len;
+    lazy->dir_len = dir_len;
+    lazy->frames = frames;
+    lazy->frame_count = index->count;
+    return MX_OK;
+}
+
+// Sets up the bitmap of files bootfs_lazy_fill has done.  There's no
+// heap in userboot, so it's a mapping of its own VMO.
+static mx_status_t lazy_map_filled(bootfs_lazy_t* lazy, const char** err) {
+    size_t len = ((lazy->frame_count + 7) / 8 + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (len == 0) {
+        return MX_OK;
+    }
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(len, 0, &vmo);
+    if (status < 0) {
+        *err = "mx_vmo_create failed for bootfs bitmap";
+        return status;
+    }
+    uintptr_t addr = 0;
+    status = mx_vmar_map(lazy->vmar, 0, vmo, 0, len,
+                         MX_VM_FLAG_PERM_READ|MX_VM_FLAG_PERM_WRITE, &addr);
+    mx_handle_close(vmo);
+    if (status < 0) {
+        *err = "mx_vmar_map failed for bootfs bitmap";
+        return status;
+    }
+    lazy->filled = (uint8_t*)addr;
+    lazy->filled_len = len;
+    return MX_OK;
+}
+
+// Maps the bootdata item at offset and finds the bootfs index in it.
+static mx_status_t lazy_map_item(bootfs_lazy_t* lazy, mx_handle_t vmar,
+                                 mx_handle_t vmo, size_t offset, size_t length,
+                                 const char** err) {
+    memset(lazy, 0, sizeof(*lazy));
+    lazy->vmar = vmar;
+    lazy->vmo = MX_HANDLE_INVALID;
+
+    uintptr_t addr = 0;
+    size_t aligned_offset = offset & ~(PAGE_SIZE - 1);
+    size_t align_shift = offset - aligned_offset;
+    length += align_shift;
+    mx_status_t status = mx_vmar_map(vmar, 0, vmo, aligned_offset, length,
+                                     MX_VM_FLAG_PERM_READ, &addr);
+    if (status < 0) {
+        *err = "mx_vmar_map failed on bootfs vmo";
+        return status;
+    }
+    lazy->item_addr = addr;
+    lazy->item_len = length;
+
+    const bootdata_t* hdr = (const bootdata_t*)(addr + align_shift);
+    size_t hdrsz = sizeof(bootdata_t);
+    if ((length - align_shift >= hdrsz) && (hdr->flags & BOOTDATA_FLAG_EXTRA))
+        hdrsz += sizeof(bootextra_t);
+    if ((length - align_shift < hdrsz) ||
+        !(hdr->flags & BOOTDATA_BOOTFS_FLAG_FILE_COMPRESSED) ||
+        ((hdr->type & BOOTDATA_BOOTFS_MASK) != BOOTDATA_BOOTFS_TYPE)) {
+        *err = "bootdata item is not a per-file compressed bootfs";
+        return MX_ERR_INVALID_ARGS;
+    }
+    if (hdr->length > length - align_shift - hdrsz) {
+        *err = "bootdata item overruns bootfs vmo";
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    size_t outsize = (hdr->extra + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (outsize < hdr->extra) {
+        *err = "lz4 output size too large";
+        return MX_ERR_NO_MEMORY;
+    }
+    lazy->image_len = outsize;
+
+    status = lazy_parse(lazy, (const uint8_t*)hdr + hdrsz, hdr->length,
+                        hdr->extra, err);
+    if (status != MX_OK) {
+        return status;
+    }
+    return lazy_map_filled(lazy, err);
+}
+
+// Keeps a handle to the bootfs image and maps it for writing.
+static mx_status_t lazy_map_image(bootfs_lazy_t* lazy, mx_handle_t bootfs_vmo,
+                                  const char** err) {
+    uint64_t size;
+    mx_status_t status = mx_vmo_get_size(bootfs_vmo, &size);
+    if (status < 0) {
+        *err = "mx_vmo_get_size failed on bootfs vmo";
+        return status;
+    }
+    if (size < lazy->image_len) {
+        *err = "bootfs vmo smaller than bootdata outsize";
+        return MX_ERR_INVALID_ARGS;
+    }
+    status = mx_handle_duplicate(bootfs_vmo, MX_RIGHT_SAME_RIGHTS, &lazy->vmo);
+    if (status < 0) {
+        *err = "mx_handle_duplicate failed on bootfs vmo";
+        return status;
+    }
+    uintptr_t addr = 0;
+    status = mx_vmar_map(lazy->vmar, 0, lazy->vmo, 0, lazy->image_len,
+                         MX_VM_FLAG_PERM_READ|MX_VM_FLAG_PERM_WRITE, &addr);
+    if (status < 0) {
+        *err = "mx_vmar_map failed on bootfs vmo for decompression";
+        return status;
+    }
+    lazy->image = (uint8_t*)addr;
+    return MX_OK;
+}
+
+mx_status_t bootfs_lazy_attach(mx_handle_t vmar, mx_handle_t vmo,
+                               size_t offset, size_t length,
+                               mx_handle_t bootfs_vmo, bootfs_lazy_t* lazy,
+                               const char** err) {
+    *err = "none";
+
+    mx_status_t status = lazy_map_item(lazy, vmar, vmo, offset, length, err);
+    if (status == MX_OK) {
+        status = lazy_map_image(lazy, bootfs_vmo, err);
+    }
+    if (status != MX_OK) {
+        bootfs_lazy_destroy(lazy);
+    }
+    return status;
+}
+
+mx_status_t bootfs_lazy_create(mx_handle_t vmar, mx_handle_t vmo,
+                               size_t offset, size_t length,
+                               bootfs_lazy_t* lazy, mx_handle_t* out,
+                               const char** err) {
+    *err = "none";
+
+    mx_status_t status = lazy_map_item(lazy, vmar, vmo, offset, length, err);
+    if (status != MX_OK) {
+        bootfs_lazy_destroy(lazy);
+        return status;
+    }
+
+    // Only the pages which are written get committed, so the files
+    // take no memory until they are filled in.
+    mx_handle_t dst_vmo;
+    status = mx_vmo_create((uint64_t)lazy->image_len, 0, &dst_vmo);
+    if (status < 0) {
+        *err = "mx_vmo_create failed for decompressing bootfs";
+        bootfs_lazy_destroy(lazy);
+        return status;
+    }
+    mx_object_set_property(dst_vmo, MX_PROP_NAME, "bootfs", 6);
+
+    size_t actual;
+    status = mx_vmo_write(dst_vmo, lazy->payload, 0, lazy->dir_len, &actual);
+    if (status < 0) {
+        *err = "mx_vmo_write failed for bootfs directory";
+    } else {
+        status = lazy_map_image(lazy, dst_vmo, err);
+    }
+    if (status != MX_OK) {
+        mx_handle_close(dst_vmo);
+        bootfs_lazy_destroy(lazy);
+        return status;
+    }
+
+    *out = dst_vmo;
+    return MX_OK;
+}
+
+mx_status_t bootfs_lazy_fill_frame(bootfs_lazy_t* lazy, uint32_t i,
+                                   uint8_t* buffer, const char** err) {
+    if (i >= lazy->frame_count) {
+        *err = "bootfs index entry out of range";
+        return MX_ERR_OUT_OF_RANGE;
+    }
+    const bootfs_frame_t* f = &lazy->frames[i];
+    if (f->frame_len == 0) {
+        return MX_OK;
+    }
+    return decompress_frame(lazy->payload + f->frame_off, f->frame_len,
+                            f->data_len, lazy->image + f->data_off,
+                            buffer, lazy->vmo, f->data_off, err);
+}
+
+mx_status_t bootfs_lazy_fill(bootfs_lazy_t* lazy, uint32_t data_off,
+                             const char** err) {
+    uint32_t lo = 0;
+    uint32_t hi = lazy->frame_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t off = lazy->frames[mid].data_off;
+        if (off == data_off) {
+            uint8_t bit = (uint8_t)(1u << (mid % 8));
+            if (lazy->filled[mid / 8] & bit) {
+                return MX_OK;
+            }
+            mx_status_t status = bootfs_lazy_fill_frame(lazy, mid, NULL, err);
+            if (status == MX_OK) {
+                lazy->filled[mid / 8] |= bit;
+            }
+            return status;
+        }
+        if (off < data_off) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *err = "no bootfs index entry for file";
+    return MX_ERR_NOT_FOUND;
+}
+
+void bootfs_lazy_destroy(bootfs_lazy_t* lazy) {
+    if (lazy->image != NULL) {
+        mx_vmar_unmap(lazy->vmar, (uintptr_t)lazy->image, lazy->image_len);
+        lazy->image = NULL;
+    }
+    if (lazy->item_addr != 0) {
+        mx_vmar_unmap(lazy->vmar, lazy->item_addr, lazy->item_len);
+        lazy->item_addr = 0;
+    }
+    if (lazy->filled != NULL) {
+        mx_vmar_unmap(lazy->vmar, (uintptr_t)lazy->filled, lazy->filled_len);
+        lazy->filled = NULL;
+    }
+    if (lazy->vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(lazy->vmo);
+        lazy->vmo = MX_HANDLE_INVALID;
+    }
+    lazy->frames = NULL;
+    lazy->frame_count = 0;
+}
+
+// Decompresses every file of a per-file compressed bootfs up front.
+static mx_status_t decompress_bootfs_files(mx_handle_t vmar, mx_handle_t vmo,
+                                           size_t offset, size_t length,
+                                           mx_handle_t* out, const char** err) {
+    bootfs_lazy_t lazy;
+    mx_handle_t bootfs_vmo;
+    mx_status_t status = bootfs_lazy_create(vmar, vmo, offset, length,
+                                            &lazy, &bootfs_vmo, err);
+    if (status != MX_OK) {
+        return status;
+    }
+    for (uint32_t i = 0; i < lazy.frame_count; i++) {
+        if ((status = bootfs_lazy_fill_frame(&lazy, i, NULL, err)) != MX_OK) {
+            break;
+        }
+    }
+    bootfs_lazy_destroy(&lazy);
+    if (status != MX_OK) {
+        mx_handle_close(bootfs_vmo);
+        return status;
+    }
+    *out = bootfs_vmo;
+    return MX_OK;
+}
+
 mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
                                 size_t offset, size_t length,
                                 mx_handle_t* out, const char** err) {
@@ -186,6 +588,7 @@ mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
     }
 
     uintptr_t addr = 0;
+    size_t item_length = length;
     size_t aligned_offset = offset & ~(PAGE_SIZE - 1);
     size_t align_shift = offset - aligned_offset;
     length += align_shift;
@@ -204,7 +607,9 @@ mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
     switch (hdr->type) {
     case BOOTDATA_BOOTFS_BOOT:
     case BOOTDATA_BOOTFS_SYSTEM:
-        if (hdr->flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED) {
+        if (hdr->flags & BOOTDATA_BOOTFS_FLAG_FILE_COMPRESSED) {
+            status = decompress_bootfs_files(vmar, vmo, offset, item_length, out, err);
+        } else if (hdr->flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED) {
             status = decompress_bootfs_vmo(vmar, (const uint8_t*)bootdata_addr, hdr->extra, out, err);
         }
         break;
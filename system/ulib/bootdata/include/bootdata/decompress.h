@@ -7,7 +7,10 @@
 
 #pragma GCC visibility push(hidden)
 
+#include <magenta/boot/bootdata.h>
 #include <magenta/types.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // Decompress bootdata at offset of total size length into a new VMO
 // On failure, errmsg is a human readable error description to provide
@@ -16,4 +19,63 @@ mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
                                 size_t offset, size_t length,
                                 mx_handle_t* out, const char** errmsg);
 
+// State for decompressing the files of a bootfs item with
+// BOOTDATA_BOOTFS_FLAG_FILE_COMPRESSED one at a time, as they are needed.
+typedef struct bootfs_lazy {
+    mx_handle_t vmar;
+
+    // The bootfs image being filled in, and a writable mapping of it.
+    mx_handle_t vmo;
+    uint8_t* image;
+    size_t image_len;
+
+    // The mapping of the bootdata item, and the parts of it in use.
+    uintptr_t item_addr;
+    size_t item_len;
+    const uint8_t* payload;
+    size_t payload_len;
+    size_t dir_len;
+    const bootfs_frame_t* frames;
+    uint32_t frame_count;
+
+    // One bit per file, set once bootfs_lazy_fill has filled it in.
+    uint8_t* filled;
+    size_t filled_len;
+} bootfs_lazy_t;
+
+// Size of the buffer bootfs_lazy_fill_frame() may be given.
+#define BOOTFS_LAZY_BUFFER_SIZE 65536
+
+// Creates a new VMO for the bootfs item at offset of total size length,
+// with only the bootfs header and directory filled in, and sets up lazy
+// to fill in the files.  Returns the new VMO in out.
+mx_status_t bootfs_lazy_create(mx_handle_t vmar, mx_handle_t vmo,
+                               size_t offset, size_t length,
+                               bootfs_lazy_t* lazy, mx_handle_t* out,
+                               const char** errmsg);
+
+// Like bootfs_lazy_create, but for a bootfs VMO made earlier from the
+// same item, perhaps by another process.  Does not consume bootfs_vmo.
+mx_status_t bootfs_lazy_attach(mx_handle_t vmar, mx_handle_t vmo,
+                               size_t offset, size_t length,
+                               mx_handle_t bootfs_vmo, bootfs_lazy_t* lazy,
+                               const char** errmsg);
+
+// Decompresses the file whose data is at data_off in the bootfs image
+// in place, unless this already did so.  Until that is done, nothing else
+// may use the file's pages.  Only one thread at a time may use this.
+mx_status_t bootfs_lazy_fill(bootfs_lazy_t* lazy, uint32_t data_off,
+                             const char** errmsg);
+
+// Decompresses the file with index entry i.  If buffer is not NULL, the
+// data is decompressed into it a block at a time and written into the
+// VMO, rather than decompressed in place.  This never leaves other than
+// the final contents in any byte of the image, so it is safe to use on
+// files which may already be filled in and in use.  Several threads may
+// fill in different files at once.
+mx_status_t bootfs_lazy_fill_frame(bootfs_lazy_t* lazy, uint32_t i,
+                                   uint8_t* buffer, const char** errmsg);
+
+void bootfs_lazy_destroy(bootfs_lazy_t* lazy);
+
 #pragma GCC visibility pop
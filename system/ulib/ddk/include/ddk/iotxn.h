@@ -37,6 +37,8 @@ typedef struct iotxn iotxn_t;
 // opcodes
 #define IOTXN_OP_READ      1
 #define IOTXN_OP_WRITE     2
+// Discards [offset, offset + length) of a block device. Carries no data.
+#define IOTXN_OP_TRIM      3
 
 // cache maintenance ops
 #define IOTXN_CACHE_INVALIDATE        MX_VMO_OP_CACHE_INVALIDATE
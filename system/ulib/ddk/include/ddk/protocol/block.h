@@ -21,6 +21,8 @@ typedef struct block_protocol_ops {
                  uint64_t dev_offset, void* cookie);
     void (*write)(void* ctx, mx_handle_t vmo, uint64_t length, uint64_t vmo_offset,
                   uint64_t dev_offset, void* cookie);
+    // Optional; devices which cannot discard leave this NULL.
+    void (*trim)(void* ctx, uint64_t length, uint64_t dev_offset, void* cookie);
 } block_protocol_ops_t;
 
 typedef struct {
@@ -52,4 +54,10 @@ static inline void block_write(block_protocol_t* block, mx_handle_t vmo, uint64_
     block->ops->write(block->ctx, vmo, length, vmo_offset, dev_offset, cookie);
 }
 
+// Discard a range of the block device
+static inline void block_trim(block_protocol_t* block, uint64_t length, uint64_t dev_offset,
+                              void* cookie) {
+    block->ops->trim(block->ctx, length, dev_offset, cookie);
+}
+
 __END_CDECLS;
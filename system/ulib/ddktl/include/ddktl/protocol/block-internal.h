@@ -18,6 +18,7 @@ DECLARE_HAS_MEMBER_FN(has_block_set_callbacks, BlockSetCallbacks);
 DECLARE_HAS_MEMBER_FN(has_block_get_info, BlockGetInfo);
 DECLARE_HAS_MEMBER_FN(has_block_read, BlockRead);
 DECLARE_HAS_MEMBER_FN(has_block_write, BlockWrite);
+DECLARE_HAS_MEMBER_FN(has_block_trim, BlockTrim);
 
 template <typename D>
 constexpr void CheckBlockProtocolSubclass() {
@@ -53,6 +54,14 @@ constexpr void CheckBlockProtocolSubclass() {
                   "'void BlockWrite(mx_handle_t, uint64_t, uint64_t, uint64_t, void*)', and be "
                   "visible to ddk::BlockProtocol<D> (either because they are public, or because of "
                   "friendship).");
+    static_assert(internal::has_block_trim<D>::value,
+                  "BlockProtocol subclasses must implement BlockTrim");
+    static_assert(fbl::is_same<decltype(&D::BlockTrim),
+                                void (D::*)(uint64_t, uint64_t, void*)>::value,
+                  "BlockTrim must be a non-static member function with signature "
+                  "'void BlockTrim(uint64_t, uint64_t, void*)', and be visible to "
+                  "ddk::BlockProtocol<D> (either because they are public, or because of "
+                  "friendship).");
 }
 
 }  // namespace internal
@@ -58,6 +58,7 @@ class BlockProtocol : public internal::base_protocol {
         ops_.get_info = GetInfo;
         ops_.read = Read;
         ops_.write = Write;
+        ops_.trim = Trim;
 
         // Can only inherit from one base_protocol implemenation
         MX_ASSERT(ddk_proto_ops_ == nullptr);
@@ -84,6 +85,10 @@ class BlockProtocol : public internal::base_protocol {
         static_cast<D*>(ctx)->BlockWrite(vmo, length, vmo_offset, dev_offset, cookie);
     }
 
+    static void Trim(void* ctx, uint64_t length, uint64_t dev_offset, void* cookie) {
+        static_cast<D*>(ctx)->BlockTrim(length, dev_offset, cookie);
+    }
+
     block_protocol_ops_t ops_ = {};
 };
 
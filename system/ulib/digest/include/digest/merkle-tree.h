@@ -55,6 +55,8 @@ public:
 
     // Writes a Merkle tree for the given data and saves its root digest.
     // |tree_len| must be at least as much as returned by GetTreeLength().
+    // Large inputs have their data nodes hashed on several threads; the
+    // resulting tree is identical to one built by CreateInit/Update/Final.
     static mx_status_t Create(const void* data, size_t data_len, void* tree,
                               size_t tree_len, Digest* digest);
 
@@ -107,6 +109,12 @@ private:
                                    const void* tree, size_t offset,
                                    size_t length, uint64_t level);
 
+    // See Create.  This hashes the bottom level of the tree across multiple
+    // threads before building the levels above serially.
+    static mx_status_t CreateParallel(const void* data, size_t data_len,
+                                      void* tree, size_t tree_len,
+                                      Digest* digest);
+
     // See CreateFinal.  This implements that method, with an extra parameter to
     // allow levels other than the bottommost to be padded.
     mx_status_t CreateFinalInternal(const void* data, void* tree, Digest* root);
@@ -4,8 +4,10 @@
 
 #include <digest/merkle-tree.h>
 
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <digest/digest.h>
 #include <magenta/assert.h>
@@ -24,6 +26,12 @@ constexpr size_t MerkleTree::kNodeSize;
 // the corresponding digest-aligned length in the next level up.
 const size_t kDigestsPerNode = MerkleTree::kNodeSize / Digest::kLength;
 
+// |MerkleTree::Create| spreads the hashing of the data nodes across up to
+// |kMaxHashThreads| threads, giving each at least |kMinNodesPerThread| nodes so
+// that starting a thread costs less than the hashing it saves.
+const size_t kMaxHashThreads = 16;
+const size_t kMinNodesPerThread = 32;
+
 namespace {
 
 // Digest wrapper functions.  These functions implement how a node in the Merkle
@@ -93,6 +101,46 @@ size_t NextAligned(size_t length) {
     return fbl::roundup(NextLength(length), MerkleTree::kNodeSize);
 }
 
+////////
+// Helper functions for hashing the data nodes in parallel.
+
+// A contiguous range of data nodes, given by index, whose digests are written
+// to the bottom level of |tree|.
+struct LeafRange {
+    const uint8_t* data;
+    size_t data_len;
+    uint8_t* tree;
+    size_t start;
+    size_t end;
+};
+
+// Hashes each data node in |range| with the same padding and locality as
+// |MerkleTree::CreateUpdate| and stores its digest in the tree.
+void HashLeaves(const LeafRange* range) {
+    Digest digest;
+    for (size_t i = range->start; i < range->end; ++i) {
+        size_t offset = i * MerkleTree::kNodeSize;
+        size_t length = range->data_len - offset;
+        DigestInit(&digest, offset, length);
+        offset += DigestUpdate(&digest, range->data + offset, offset, length);
+        DigestFinal(&digest, offset);
+        digest.CopyTo(range->tree + (i * Digest::kLength), Digest::kLength);
+    }
+}
+
+void* HashLeavesThread(void* arg) {
+    HashLeaves(static_cast<const LeafRange*>(arg));
+    return nullptr;
+}
+
+// Returns the number of threads to use to hash |num_nodes| data nodes.
+size_t HashThreadCount(size_t num_nodes) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = (num_cpus > 0 ? static_cast<size_t>(num_cpus) : 1);
+    num_threads = fbl::min(num_threads, kMaxHashThreads);
+    return fbl::min(num_threads, num_nodes / kMinNodesPerThread);
+}
+
 } // namespace
 
 ////////
@@ -105,6 +153,9 @@ size_t MerkleTree::GetTreeLength(size_t data_len) {
 
 mx_status_t MerkleTree::Create(const void* data, size_t data_len, void* tree,
                                size_t tree_len, Digest* digest) {
+    if (data && tree && HashThreadCount(data_len / kNodeSize) > 1) {
+        return CreateParallel(data, data_len, tree, tree_len, digest);
+    }
     mx_status_t rc;
     MerkleTree mt;
     if ((rc = mt.CreateInit(data_len, tree_len)) != MX_OK ||
@@ -115,6 +166,59 @@ mx_status_t MerkleTree::Create(const void* data, size_t data_len, void* tree,
     return MX_OK;
 }
 
+mx_status_t MerkleTree::CreateParallel(const void* data, size_t data_len,
+                                       void* tree, size_t tree_len,
+                                       Digest* digest) {
+    if (!digest) {
+        return MX_ERR_INVALID_ARGS;
+    }
+    if (tree_len < GetTreeLength(data_len)) {
+        return MX_ERR_BUFFER_TOO_SMALL;
+    }
+    // Hash the data nodes, splitting them evenly between the threads.  The
+    // calling thread takes the first range, and also any range whose thread
+    // could not be started.
+    size_t num_nodes = fbl::roundup(data_len, kNodeSize) / kNodeSize;
+    size_t num_threads = HashThreadCount(num_nodes);
+    uint8_t* leaves = static_cast<uint8_t*>(tree);
+    LeafRange ranges[kMaxHashThreads];
+    pthread_t threads[kMaxHashThreads];
+    bool started[kMaxHashThreads];
+    for (size_t i = 0; i < num_threads; ++i) {
+        ranges[i].data = static_cast<const uint8_t*>(data);
+        ranges[i].data_len = data_len;
+        ranges[i].tree = leaves;
+        ranges[i].start = (num_nodes * i) / num_threads;
+        ranges[i].end = (num_nodes * (i + 1)) / num_threads;
+        started[i] = (i != 0 && pthread_create(&threads[i], nullptr,
+                                               HashLeavesThread,
+                                               &ranges[i]) == 0);
+    }
+    HashLeaves(&ranges[0]);
+    for (size_t i = 1; i < num_threads; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], nullptr);
+        } else {
+            HashLeaves(&ranges[i]);
+        }
+    }
+    // Zero the rest of the last node of digests, as |CreateUpdate| would.
+    size_t leaves_len = NextAligned(data_len);
+    size_t digests_len = num_nodes * Digest::kLength;
+    memset(leaves + digests_len, 0, leaves_len - digests_len);
+    // The levels above are small enough to build serially.
+    mx_status_t rc;
+    MerkleTree mt;
+    mt.level_ = 1;
+    uint8_t* next = leaves + leaves_len;
+    if ((rc = mt.CreateInit(leaves_len, tree_len - leaves_len)) != MX_OK ||
+        (rc = mt.CreateUpdate(leaves, leaves_len, next)) != MX_OK ||
+        (rc = mt.CreateFinal(next, digest)) != MX_OK) {
+        return rc;
+    }
+    return MX_OK;
+}
+
 MerkleTree::MerkleTree()
     : initialized_(false), next_(nullptr), level_(0), offset_(0), length_(0) {}
 
@@ -0,0 +1,750 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magenta/assert.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/intrusive_container_utils.h>
+#include <fbl/intrusive_pointer_traits.h>
+#include <fbl/intrusive_single_list.h>
+#include <fbl/macros.h>
+#include <fbl/new.h>
+
+namespace fbl {
+
+// Fwd decl of sanity checker class used by tests.
+namespace tests {
+namespace intrusive_containers {
+class ResizableHashTableChecker;
+}  // namespace tests
+}  // namespace intrusive_containers
+
+// DefaultResizableHashTraits defines a default implementation of the traits
+// used to define the hash function for a resizable hash table.
+//
+// Unlike the traits of a fixed size HashTable, the GetHash method of the hash
+// traits of a ResizableHashTable must NOT reduce its result to a bucket
+// index; the table does that itself as it grows.  The full range of HashType
+// should be used.  The table mixes the hash before using it, so a cheap hash
+// (the identity function for integer keys, for example) is acceptable.
+//
+// Users of DefaultResizableHashTraits only need to implement a static method
+// of ObjType named GetHash which takes a const reference to a KeyType and
+// returns a HashType.
+template <typename KeyType,
+          typename ObjType,
+          typename HashType>
+struct DefaultResizableHashTraits {
+    static_assert(is_unsigned_integer<HashType>::value, "HashTypes must be unsigned integers");
+    static HashType GetHash(const KeyType& key) {
+        return static_cast<HashType>(ObjType::GetHash(key));
+    }
+};
+
+// ResizableHashTable
+//
+// An intrusive hash table whose bucket array grows with the number of
+// elements it holds.  It uses the same bucket types and node state traits as
+// HashTable, so an object which can be held in a HashTable can be held in a
+// ResizableHashTable as well.
+//
+// A new table starts with a single bucket embedded in the table object
+// itself.  Once the number of elements exceeds the number of buckets, a table
+// with twice as many buckets is allocated.  Rather than moving every element
+// at once, elements are migrated from the old bucket array to the new one a
+// few buckets at a time as part of subsequent insert operations, so that no
+// single insert takes time proportional to the size of the table.  If the
+// new bucket array cannot be allocated, the table simply keeps using its
+// current buckets; inserts never fail.
+//
+// Notes:
+// ++ Insert operations (insert, insert_or_find, insert_or_replace) may move
+//    elements between buckets and invalidate all outstanding iterators.
+//    Erase operations never move elements, so it is safe to erase elements
+//    while iterating.
+// ++ The table never shrinks while it holds elements.  clear() and
+//    clear_unsafe() release the bucket arrays and return the table to its
+//    initial, single bucket state.
+// ++ The bucket arrays are allocated with new and released with delete, so
+//    inserting into a ResizableHashTable must not happen in contexts which
+//    cannot allocate memory.  Use a HashTable there instead.
+template <typename  _KeyType,
+          typename  _PtrType,
+          typename  _BucketType = SinglyLinkedList<_PtrType>,
+          typename  _HashType   = size_t,
+          typename  _KeyTraits  = DefaultKeyedObjectTraits<
+                                    _KeyType,
+                                    typename internal::ContainerPtrTraits<_PtrType>::ValueType>,
+          typename  _HashTraits = DefaultResizableHashTraits<
+                                    _KeyType,
+                                    typename internal::ContainerPtrTraits<_PtrType>::ValueType,
+                                    _HashType>>
+class ResizableHashTable {
+private:
+    // Private fwd decls of the iterator implementation.
+    template <typename IterTraits> class iterator_impl;
+    struct iterator_traits;
+    struct const_iterator_traits;
+
+public:
+    // Pointer types/traits
+    using PtrType      = _PtrType;
+    using PtrTraits    = internal::ContainerPtrTraits<PtrType>;
+    using ValueType    = typename PtrTraits::ValueType;
+
+    // Key types/traits
+    using KeyType      = _KeyType;
+    using KeyTraits    = _KeyTraits;
+
+    // Hash types/traits
+    using HashType     = _HashType;
+    using HashTraits   = _HashTraits;
+
+    // Bucket types/traits
+    using BucketType   = _BucketType;
+    using NodeTraits   = typename BucketType::NodeTraits;
+
+    // Declarations of the standard iterator types.
+    using iterator       = iterator_impl<iterator_traits>;
+    using const_iterator = iterator_impl<const_iterator_traits>;
+
+    // An alias for the type of this specific ResizableHashTable<...> and its
+    // test sanity checker.
+    using ContainerType = ResizableHashTable<_KeyType, _PtrType, _BucketType, _HashType,
+                                             _KeyTraits, _HashTraits>;
+    using CheckerType   = ::fbl::tests::intrusive_containers::ResizableHashTableChecker;
+
+    // The number of buckets in the first allocated bucket array, and the
+    // number of old buckets migrated to the new bucket array by each insert
+    // operation while a resize is in progress.  Migrating more than one
+    // bucket per insert guarantees that a resize always completes before the
+    // next one becomes necessary.
+    static constexpr size_t kMinBucketBits = 4;
+    static constexpr size_t kMigrateBucketsPerInsert = 2;
+
+    // Resizable hash tables only support constant order erase if their
+    // underlying bucket type does.
+    static constexpr bool SupportsConstantOrderErase = BucketType::SupportsConstantOrderErase;
+    static constexpr bool SupportsConstantOrderSize = true;
+    static constexpr bool IsAssociative = true;
+    static constexpr bool IsSequenced = false;
+
+    static_assert(is_unsigned_integer<HashType>::value, "HashTypes must be unsigned integers");
+
+    constexpr ResizableHashTable() {}
+    ~ResizableHashTable() {
+        MX_DEBUG_ASSERT(PtrTraits::IsManaged || is_empty());
+        ReleaseTables();
+    }
+
+    // Standard begin/end, cbegin/cend iterator accessors.
+    iterator begin()              { return       iterator(this,       iterator::BEGIN); }
+    const_iterator begin()  const { return const_iterator(this, const_iterator::BEGIN); }
+    const_iterator cbegin() const { return const_iterator(this, const_iterator::BEGIN); }
+
+    iterator end()              { return       iterator(this,       iterator::END); }
+    const_iterator end()  const { return const_iterator(this, const_iterator::END); }
+    const_iterator cend() const { return const_iterator(this, const_iterator::END); }
+
+    // make_iterator : construct an iterator out of a reference to an object.
+    iterator make_iterator(ValueType& obj) {
+        size_t ndx = GetBucketNdx(KeyTraits::GetKey(obj));
+        return iterator(this, ndx, GetBucket(ndx).make_iterator(obj));
+    }
+
+    void insert(const PtrType& ptr) { insert(PtrType(ptr)); }
+    void insert(PtrType&& ptr) {
+        MX_DEBUG_ASSERT(ptr != nullptr);
+        PrepareForInsert();
+
+        KeyType key = KeyTraits::GetKey(*ptr);
+        BucketType& bucket = GetBucket(GetBucketNdx(key));
+
+        // Duplicate keys are disallowed.  Debug assert if someone tries to to
+        // insert an element with a duplicate key.  If the user thought that
+        // there might be a duplicate key in the ResizableHashTable already,
+        // he/she should have used insert_or_find() instead.
+        MX_DEBUG_ASSERT(FindInBucket(bucket, key).IsValid() == false);
+
+        bucket.push_front(fbl::move(ptr));
+        ++count_;
+    }
+
+    // insert_or_find
+    //
+    // Insert the element pointed to by ptr if it is not already in the
+    // ResizableHashTable, or find the element that the ptr collided with
+    // instead.
+    //
+    // 'iter' is an optional out parameter pointer to an iterator which
+    // will reference either the newly inserted item, or the item whose key
+    // collided with ptr.
+    //
+    // insert_or_find returns true if there was no collision and the item was
+    // successfully inserted, otherwise it returns false.
+    //
+    bool insert_or_find(const PtrType& ptr, iterator* iter = nullptr) {
+        return insert_or_find(PtrType(ptr), iter);
+    }
+
+    bool insert_or_find(PtrType&& ptr, iterator* iter = nullptr) {
+        MX_DEBUG_ASSERT(ptr != nullptr);
+        PrepareForInsert();
+
+        KeyType key         = KeyTraits::GetKey(*ptr);
+        size_t  ndx         = GetBucketNdx(key);
+        auto&   bucket      = GetBucket(ndx);
+        auto    bucket_iter = FindInBucket(bucket, key);
+
+        if (bucket_iter.IsValid()) {
+            if (iter) *iter = iterator(this, ndx, bucket_iter);
+            return false;
+        }
+
+        bucket.push_front(fbl::move(ptr));
+        ++count_;
+        if (iter) *iter = iterator(this, ndx, bucket.begin());
+        return true;
+    }
+
+    // insert_or_replace
+    //
+    // Find the element in the hashtable with the same key as *ptr and replace
+    // it with ptr, then return the pointer to the element which was replaced.
+    // If no element in the hashtable shares a key with *ptr, simply add ptr to
+    // the hashtable and return nullptr.
+    //
+    PtrType insert_or_replace(const PtrType& ptr) {
+        return insert_or_replace(PtrType(ptr));
+    }
+
+    PtrType insert_or_replace(PtrType&& ptr) {
+        MX_DEBUG_ASSERT(ptr != nullptr);
+        PrepareForInsert();
+
+        KeyType key    = KeyTraits::GetKey(*ptr);
+        auto&   bucket = GetBucket(GetBucketNdx(key));
+        auto    orig   = PtrTraits::GetRaw(ptr);
+
+        PtrType replaced = bucket.replace_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            },
+            fbl::move(ptr));
+
+        if (orig == PtrTraits::GetRaw(replaced)) {
+            bucket.push_front(PtrTraits::Take(replaced));
+            count_++;
+        }
+
+        return fbl::move(replaced);
+    }
+
+    iterator find(const KeyType& key) {
+        size_t ndx         = GetBucketNdx(key);
+        auto&  bucket      = GetBucket(ndx);
+        auto   bucket_iter = FindInBucket(bucket, key);
+
+        return bucket_iter.IsValid() ? iterator(this, ndx, bucket_iter)
+                                     : iterator(this, iterator::END);
+    }
+
+    const_iterator find(const KeyType& key) const {
+        size_t      ndx         = GetBucketNdx(key);
+        const auto& bucket      = GetBucket(ndx);
+        auto        bucket_iter = FindInBucket(bucket, key);
+
+        return bucket_iter.IsValid() ? const_iterator(this, ndx, bucket_iter)
+                                     : const_iterator(this, const_iterator::END);
+    }
+
+    PtrType erase(const KeyType& key) {
+        BucketType& bucket = GetBucket(GetBucketNdx(key));
+
+        PtrType ret = internal::KeyEraseUtils<BucketType, KeyTraits>::erase(bucket, key);
+        if (ret != nullptr)
+            --count_;
+
+        return ret;
+    }
+
+    PtrType erase(const iterator& iter) {
+        if (!iter.IsValid())
+            return PtrType(nullptr);
+
+        return direct_erase(GetBucket(iter.bucket_ndx_), *iter);
+    }
+
+    PtrType erase(ValueType& obj) {
+        return direct_erase(GetBucket(GetBucketNdx(KeyTraits::GetKey(obj))), obj);
+    }
+
+    // clear
+    //
+    // Clear out the all of the hashtable buckets and release the bucket
+    // arrays.  For managed pointer types, this will release all references
+    // held by the hashtable to the objects which were in it.
+    void clear() {
+        for (size_t i = 0; i < bucket_count(); ++i)
+            GetBucket(i).clear();
+        count_ = 0;
+        ReleaseTables();
+    }
+
+    // clear_unsafe
+    //
+    // Perform a clear_unsafe on all buckets, reset the internal count to zero
+    // and release the bucket arrays.  See comments in
+    // fbl/intrusive_single_list.h
+    // Think carefully before calling this!
+    void clear_unsafe() {
+        static_assert(PtrTraits::IsManaged == false,
+                     "clear_unsafe is not allowed for containers of managed pointers");
+
+        for (size_t i = 0; i < bucket_count(); ++i)
+            GetBucket(i).clear_unsafe();
+
+        count_ = 0;
+        ReleaseTables();
+    }
+
+    size_t size()      const { return count_; }
+    bool   is_empty()  const { return count_ == 0; }
+
+    // bucket_count
+    //
+    // The total number of buckets currently in use, including the not yet
+    // migrated buckets of the old bucket array while a resize is in progress.
+    size_t bucket_count() const { return live_bucket_count() + old_bucket_count(); }
+
+    // erase_if
+    //
+    // Find the first member of the hash table which satisfies the predicate
+    // given by 'fn' and erase it from the list, returning a referenced pointer
+    // to the removed element.  Return nullptr if no member satisfies the
+    // predicate.
+    template <typename UnaryFn>
+    PtrType erase_if(UnaryFn fn) {
+        if (is_empty())
+            return PtrType(nullptr);
+
+        for (size_t i = 0; i < bucket_count(); ++i) {
+            auto& bucket = GetBucket(i);
+            if (!bucket.is_empty()) {
+                PtrType ret = bucket.erase_if(fn);
+                if (ret != nullptr) {
+                    --count_;
+                    return ret;
+                }
+            }
+        }
+
+        return PtrType(nullptr);
+    }
+
+    // find_if
+    //
+    // Find the first member of the hash table which satisfies the predicate
+    // given by 'fn' and return an iterator to it.  Return end() if no member
+    // satisfies the predicate.
+    template <typename UnaryFn>
+    const_iterator find_if(UnaryFn fn) const {
+        for (auto iter = begin(); iter.IsValid(); ++iter)
+            if (fn(*iter))
+                return iter;
+
+        return end();
+    }
+
+    template <typename UnaryFn>
+    iterator find_if(UnaryFn fn) {
+        for (auto iter = begin(); iter.IsValid(); ++iter)
+            if (fn(*iter))
+                return iter;
+
+        return end();
+    }
+
+private:
+    // The traits of a non-const iterator
+    struct iterator_traits {
+        using RefType    = typename PtrTraits::RefType;
+        using RawPtrType = typename PtrTraits::RawPtrType;
+        using IterType   = typename BucketType::iterator;
+
+        static IterType BucketBegin(BucketType& bucket) { return bucket.begin(); }
+        static IterType BucketEnd  (BucketType& bucket) { return bucket.end(); }
+    };
+
+    // The traits of a const iterator
+    struct const_iterator_traits {
+        using RefType    = typename PtrTraits::ConstRefType;
+        using RawPtrType = typename PtrTraits::ConstRawPtrType;
+        using IterType   = typename BucketType::const_iterator;
+
+        static IterType BucketBegin(const BucketType& bucket) { return bucket.cbegin(); }
+        static IterType BucketEnd  (const BucketType& bucket) { return bucket.cend(); }
+    };
+
+    // The shared implementation of the iterator.  Iterators walk the buckets
+    // of the old bucket array (if a resize is in progress) followed by the
+    // buckets of the current bucket array; see GetBucket below.
+    template <class IterTraits>
+    class iterator_impl {
+    public:
+        iterator_impl() { }
+        iterator_impl(const iterator_impl& other) {
+            hash_table_ = other.hash_table_;
+            bucket_ndx_ = other.bucket_ndx_;
+            iter_       = other.iter_;
+        }
+
+        iterator_impl& operator=(const iterator_impl& other) {
+            hash_table_ = other.hash_table_;
+            bucket_ndx_ = other.bucket_ndx_;
+            iter_       = other.iter_;
+            return *this;
+        }
+
+        bool IsValid() const { return iter_.IsValid(); }
+        bool operator==(const iterator_impl& other) const { return iter_ == other.iter_; }
+        bool operator!=(const iterator_impl& other) const { return iter_ != other.iter_; }
+
+        // Prefix
+        iterator_impl& operator++() {
+            if (!IsValid()) return *this;
+            MX_DEBUG_ASSERT(hash_table_);
+
+            // Bump the bucket iterator and go looking for a new bucket if the
+            // iterator has become invalid.
+            ++iter_;
+            advance_if_invalid_iter();
+
+            return *this;
+        }
+
+        iterator_impl& operator--() {
+            // If we have never been bound to a ResizableHashTable instance,
+            // the we had better be invalid.
+            if (!hash_table_) {
+                MX_DEBUG_ASSERT(!IsValid());
+                return *this;
+            }
+
+            // Back up the bucket iterator.  If it is still valid, then we are done.
+            --iter_;
+            if (iter_.IsValid())
+                return *this;
+
+            // If the iterator is invalid after backing up, check previous
+            // buckets to see if they contain any nodes.
+            while (bucket_ndx_) {
+                --bucket_ndx_;
+                auto& bucket = GetBucket(bucket_ndx_);
+                if (!bucket.is_empty()) {
+                    iter_ = --IterTraits::BucketEnd(bucket);
+                    MX_DEBUG_ASSERT(iter_.IsValid());
+                    return *this;
+                }
+            }
+
+            // Looks like we have backed up past the beginning.  Update the
+            // bookkeeping to point at the end of the last bucket.
+            bucket_ndx_ = LastBucketNdx();
+            iter_ = IterTraits::BucketEnd(GetBucket(bucket_ndx_));
+
+            return *this;
+        }
+
+        // Postfix
+        iterator_impl operator++(int) {
+            iterator_impl ret(*this);
+            ++(*this);
+            return ret;
+        }
+
+        iterator_impl operator--(int) {
+            iterator_impl ret(*this);
+            --(*this);
+            return ret;
+        }
+
+        typename PtrTraits::PtrType CopyPointer()          { return iter_.CopyPointer(); }
+        typename IterTraits::RefType operator*()     const { return iter_.operator*(); }
+        typename IterTraits::RawPtrType operator->() const { return iter_.operator->(); }
+
+    private:
+        friend ContainerType;
+        using IterType = typename IterTraits::IterType;
+
+        enum BeginTag { BEGIN };
+        enum EndTag { END };
+
+        iterator_impl(const ContainerType* hash_table, BeginTag)
+            : hash_table_(hash_table),
+              bucket_ndx_(0),
+              iter_(IterTraits::BucketBegin(GetBucket(0))) {
+            advance_if_invalid_iter();
+        }
+
+        iterator_impl(const ContainerType* hash_table, EndTag)
+            : hash_table_(hash_table),
+              bucket_ndx_(LastBucketNdx()),
+              iter_(IterTraits::BucketEnd(GetBucket(bucket_ndx_))) { }
+
+        iterator_impl(const ContainerType* hash_table, size_t bucket_ndx, const IterType& iter)
+            : hash_table_(hash_table),
+              bucket_ndx_(bucket_ndx),
+              iter_(iter) { }
+
+        BucketType& GetBucket(size_t ndx) {
+            return const_cast<ContainerType*>(hash_table_)->GetBucket(ndx);
+        }
+
+        size_t LastBucketNdx() const { return hash_table_->bucket_count() - 1; }
+
+        void advance_if_invalid_iter() {
+            // If the iterator has run off the end of it's current bucket, then
+            // check to see if there are nodes in any of the remaining buckets.
+            if (!iter_.IsValid()) {
+                size_t last = LastBucketNdx();
+                while (bucket_ndx_ < last) {
+                    ++bucket_ndx_;
+                    auto& bucket = GetBucket(bucket_ndx_);
+
+                    if (!bucket.is_empty()) {
+                        iter_ = IterTraits::BucketBegin(bucket);
+                        MX_DEBUG_ASSERT(iter_.IsValid());
+                        break;
+                    } else if (bucket_ndx_ == last) {
+                        iter_ = IterTraits::BucketEnd(bucket);
+                    }
+                }
+            }
+        }
+
+        const ContainerType* hash_table_ = nullptr;
+        size_t bucket_ndx_ = 0;
+        IterType iter_;
+    };
+
+    PtrType direct_erase(BucketType& bucket, ValueType& obj) {
+        PtrType ret = internal::DirectEraseUtils<BucketType>::erase(bucket, obj);
+
+        if (ret != nullptr)
+            --count_;
+
+        return ret;
+    }
+
+    static typename BucketType::iterator FindInBucket(BucketType& bucket,
+                                                      const KeyType& key) {
+        return bucket.find_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            });
+    }
+
+    static typename BucketType::const_iterator FindInBucket(const BucketType& bucket,
+                                                            const KeyType& key) {
+        return bucket.find_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            });
+    }
+
+    // The test framework's 'checker' class is our friend.
+    friend CheckerType;
+
+    // Iterators need to access our bucket arrays in order to iterate.
+    friend iterator;
+    friend const_iterator;
+
+    // Resizable hash tables may not currently be copied, assigned or moved.
+    DISALLOW_COPY_ASSIGN_AND_MOVE(ResizableHashTable);
+
+    // Map a hash to a bucket index in an array of (1 << bits) buckets.  The
+    // hash is multiplied by 2^64 / phi and the top bits of the product are
+    // used (Fibonacci hashing), which spreads out keys whose hashes differ
+    // only in their high or low bits.  Because the index is taken from the
+    // top bits, the elements of bucket N of an array of (1 << bits) buckets
+    // all land in buckets [N << k, (N + 1) << k) of an array of
+    // (1 << (bits + k)) buckets.
+    static size_t BucketIndex(HashType hash, size_t bits) {
+        constexpr uint64_t kGoldenRatio = 0x9E3779B97F4A7C15ull;
+        if (bits == 0)
+            return 0;
+        return static_cast<size_t>((static_cast<uint64_t>(hash) * kGoldenRatio) >> (64 - bits));
+    }
+
+    // The number of buckets of the current bucket array which have been
+    // constructed.  While a resize is in progress, only the buckets which the
+    // already migrated old buckets map to exist.
+    size_t live_bucket_count() const {
+        if (buckets_ == nullptr)
+            return 1;
+        if (old_buckets_ != nullptr)
+            return migrate_ndx_ << (bucket_bits_ - old_bucket_bits_);
+        return static_cast<size_t>(1) << bucket_bits_;
+    }
+
+    // The number of old buckets which have not been migrated yet.
+    size_t old_bucket_count() const {
+        if (old_buckets_ == nullptr)
+            return 0;
+        return (static_cast<size_t>(1) << old_bucket_bits_) - migrate_ndx_;
+    }
+
+    // Buckets are addressed with a single index which covers the live buckets
+    // of the current bucket array followed by the old buckets which have not
+    // been migrated yet.
+    BucketType& GetBucket(size_t ndx) {
+        size_t live = live_bucket_count();
+        if (ndx < live)
+            return (buckets_ != nullptr) ? buckets_[ndx] : inline_bucket_;
+        MX_DEBUG_ASSERT((ndx - live) < old_bucket_count());
+        return old_buckets_[migrate_ndx_ + (ndx - live)];
+    }
+
+    const BucketType& GetBucket(size_t ndx) const {
+        return const_cast<ContainerType*>(this)->GetBucket(ndx);
+    }
+
+    // Find the index of the bucket which holds (or would hold) key.
+    size_t GetBucketNdx(const KeyType& key) const {
+        HashType hash = HashTraits::GetHash(key);
+        if (old_buckets_ != nullptr) {
+            size_t old_ndx = BucketIndex(hash, old_bucket_bits_);
+            if (old_ndx >= migrate_ndx_)
+                return live_bucket_count() + (old_ndx - migrate_ndx_);
+        }
+        return BucketIndex(hash, bucket_bits_);
+    }
+
+    // Called before every insert operation.  Moves a few old buckets into the
+    // current bucket array if a resize is in progress, otherwise starts a
+    // resize if the insert would push the load factor above one.
+    //
+    // The new bucket array is allocated as raw storage and its buckets are
+    // constructed as old buckets are migrated into them, so that starting a
+    // resize does not touch every bucket.
+    void PrepareForInsert() {
+        if (old_buckets_ != nullptr) {
+            MigrateBuckets(kMigrateBucketsPerInsert);
+            return;
+        }
+
+        size_t max_bits = (sizeof(size_t) * 8) - 2;
+        if ((count_ < (static_cast<size_t>(1) << bucket_bits_)) || (bucket_bits_ >= max_bits))
+            return;
+
+        size_t new_bits = (buckets_ == nullptr) ? kMinBucketBits : bucket_bits_ + 1;
+        AllocChecker ac;
+        char* storage = new (&ac) char[(static_cast<size_t>(1) << new_bits) * sizeof(BucketType)];
+        if (!ac.check())
+            return;
+
+        old_buckets_     = (buckets_ != nullptr) ? buckets_ : &inline_bucket_;
+        old_bucket_bits_ = bucket_bits_;
+        migrate_ndx_     = 0;
+        buckets_         = reinterpret_cast<BucketType*>(storage);
+        bucket_bits_     = new_bits;
+        MigrateBuckets(kMigrateBucketsPerInsert);
+    }
+
+    void MigrateBuckets(size_t num_buckets) {
+        MX_DEBUG_ASSERT(old_buckets_ != nullptr);
+        size_t old_count = static_cast<size_t>(1) << old_bucket_bits_;
+        size_t fan_out   = static_cast<size_t>(1) << (bucket_bits_ - old_bucket_bits_);
+
+        while (num_buckets-- && (migrate_ndx_ < old_count)) {
+            BucketType* targets = &buckets_[migrate_ndx_ * fan_out];
+            for (size_t i = 0; i < fan_out; ++i)
+                new (&targets[i]) BucketType();
+
+            BucketType& old_bucket = old_buckets_[migrate_ndx_++];
+            while (!old_bucket.is_empty()) {
+                PtrType ptr = old_bucket.pop_front();
+                HashType hash = HashTraits::GetHash(KeyTraits::GetKey(*ptr));
+                size_t ndx = BucketIndex(hash, bucket_bits_);
+                MX_DEBUG_ASSERT(&buckets_[ndx] - targets < static_cast<ptrdiff_t>(fan_out));
+                buckets_[ndx].push_front(fbl::move(ptr));
+            }
+
+            if (&old_bucket != &inline_bucket_)
+                old_bucket.~BucketType();
+        }
+
+        if (migrate_ndx_ == old_count) {
+            if (old_buckets_ != &inline_bucket_)
+                delete[] reinterpret_cast<char*>(old_buckets_);
+            old_buckets_     = nullptr;
+            old_bucket_bits_ = 0;
+            migrate_ndx_     = 0;
+        }
+    }
+
+    // Destroy the buckets of the bucket arrays, release their storage and
+    // return to the initial single bucket state.  All buckets must be empty,
+    // unless the table is being destroyed and holds managed pointers.
+    void ReleaseTables() {
+        if ((old_buckets_ != nullptr) && (old_buckets_ != &inline_bucket_)) {
+            size_t old_count = static_cast<size_t>(1) << old_bucket_bits_;
+            for (size_t i = migrate_ndx_; i < old_count; ++i)
+                old_buckets_[i].~BucketType();
+            delete[] reinterpret_cast<char*>(old_buckets_);
+        }
+
+        if (buckets_ != nullptr) {
+            size_t live = live_bucket_count();
+            for (size_t i = 0; i < live; ++i)
+                buckets_[i].~BucketType();
+            delete[] reinterpret_cast<char*>(buckets_);
+        }
+
+        old_buckets_     = nullptr;
+        old_bucket_bits_ = 0;
+        migrate_ndx_     = 0;
+        buckets_         = nullptr;
+        bucket_bits_     = 0;
+    }
+
+    size_t count_ = 0UL;
+
+    // The current bucket array has room for (1 << bucket_bits_) buckets.  It
+    // is the inline bucket when buckets_ is nullptr.
+    BucketType* buckets_ = nullptr;
+    size_t bucket_bits_ = 0;
+
+    // The bucket array being migrated away from, if any, and the index of the
+    // next old bucket to migrate.  Old buckets are destroyed as they are
+    // migrated.
+    BucketType* old_buckets_ = nullptr;
+    size_t old_bucket_bits_ = 0;
+    size_t migrate_ndx_ = 0;
+
+    BucketType inline_bucket_;
+};
+
+// Explicit declaration of constexpr storage.
+#define RESIZABLE_HASH_TABLE_PROP(_type, _name) \
+template <typename KeyType, typename PtrType, typename BucketType, typename HashType, \
+          typename KeyTraits, typename HashTraits> \
+constexpr _type ResizableHashTable<KeyType, PtrType, BucketType, HashType, \
+                                   KeyTraits, HashTraits>::_name
+
+RESIZABLE_HASH_TABLE_PROP(size_t, kMinBucketBits);
+RESIZABLE_HASH_TABLE_PROP(size_t, kMigrateBucketsPerInsert);
+RESIZABLE_HASH_TABLE_PROP(bool, SupportsConstantOrderErase);
+RESIZABLE_HASH_TABLE_PROP(bool, SupportsConstantOrderSize);
+RESIZABLE_HASH_TABLE_PROP(bool, IsAssociative);
+RESIZABLE_HASH_TABLE_PROP(bool, IsSequenced);
+
+#undef RESIZABLE_HASH_TABLE_PROP
+
+}  // namespace fbl
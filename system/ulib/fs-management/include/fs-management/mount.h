@@ -39,6 +39,11 @@ typedef struct mount_options {
     // Create the mountpoint directory if it doesn't already exist.
     // Must be false if passed to "fmount".
     bool create_mountpoint;
+    // Limits on the closed vnodes and file data blocks kept in memory by
+    // filesystems with a bounded cache (currently minfs). Zero selects the
+    // filesystem's default.
+    uint32_t cache_vnodes;
+    uint32_t cache_blocks;
 } mount_options_t;
 
 static const mount_options_t default_mount_options = {
@@ -46,6 +51,8 @@ static const mount_options_t default_mount_options = {
     .verbose_mount = false,
     .wait_until_ready = true,
     .create_mountpoint = false,
+    .cache_vnodes = 0,
+    .cache_blocks = 0,
 };
 
 typedef struct mkfs_options {
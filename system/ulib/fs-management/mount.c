@@ -158,8 +158,9 @@ fail:
     return status;
 }
 
-static mx_status_t mount_mxfs(const char* binary, int devicefd, mountpoint_t* mp,
-                              const mount_options_t* options, LaunchCallback cb) {
+static mx_status_t mount_mxfs(const char* binary, bool cache_options, int devicefd,
+                              mountpoint_t* mp, const mount_options_t* options,
+                              LaunchCallback cb) {
     mx_handle_t hnd[MXIO_MAX_HANDLES * 2];
     uint32_t ids[MXIO_MAX_HANDLES * 2];
     size_t n = 0;
@@ -172,8 +173,25 @@ static mx_status_t mount_mxfs(const char* binary, int devicefd, mountpoint_t* mp
     if (options->verbose_mount) {
         printf("fs_mount: Launching %s\n", binary);
     }
-    const char* argv[] = {binary, "mount"};
-    return launch_and_mount(cb, options, argv, countof(argv), hnd, ids, n, mp, root);
+    const char* argv[4];
+    int argc = 0;
+    argv[argc++] = binary;
+    char cache_vnodes_arg[32];
+    char cache_blocks_arg[32];
+    if (cache_options) {
+        if (options->cache_vnodes) {
+            snprintf(cache_vnodes_arg, sizeof(cache_vnodes_arg), "--cache-vnodes=%u",
+                     options->cache_vnodes);
+            argv[argc++] = cache_vnodes_arg;
+        }
+        if (options->cache_blocks) {
+            snprintf(cache_blocks_arg, sizeof(cache_blocks_arg), "--cache-blocks=%u",
+                     options->cache_blocks);
+            argv[argc++] = cache_blocks_arg;
+        }
+    }
+    argv[argc++] = "mount";
+    return launch_and_mount(cb, options, argv, argc, hnd, ids, n, mp, root);
 }
 
 static mx_status_t mount_fat(int devicefd, mountpoint_t* mp, const mount_options_t* options,
@@ -209,9 +227,9 @@ mx_status_t fmount_common(int devicefd, mountpoint_t* mp, disk_format_t df,
                           const mount_options_t* options, LaunchCallback cb) {
     switch (df) {
     case DISK_FORMAT_MINFS:
-        return mount_mxfs("/boot/bin/minfs", devicefd, mp, options, cb);
+        return mount_mxfs("/boot/bin/minfs", true, devicefd, mp, options, cb);
     case DISK_FORMAT_BLOBFS:
-        return mount_mxfs("/boot/bin/blobstore", devicefd, mp, options, cb);
+        return mount_mxfs("/boot/bin/blobstore", false, devicefd, mp, options, cb);
     case DISK_FORMAT_FAT:
         return mount_fat(devicefd, mp, options, cb);
     default:
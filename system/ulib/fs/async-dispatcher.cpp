@@ -8,6 +8,8 @@
 #include <async/dispatcher.h>
 #include <async/wait.h>
 #include <fs/async-dispatcher.h>
+#include <fs/trace.h>
+#include <magenta/syscalls.h>
 #include <magenta/types.h>
 
 namespace fs {
@@ -64,4 +66,17 @@ mx_status_t AsyncDispatcher::AddVFSHandler(mx::channel channel,
     return status;
 }
 
+void RunDispatchLoop(async::Loop* loop, const char* name, uint32_t threads) {
+    if (threads == 0) {
+        threads = mx_system_get_num_cpus();
+    }
+    for (uint32_t i = 1; i < threads; i++) {
+        if (loop->StartThread(name) != MX_OK) {
+            FS_TRACE_ERROR("vfs: Could not start dispatch thread %u\n", i);
+            break;
+        }
+    }
+    loop->Run();
+}
+
 } // namespace fs
@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 #include <async/dispatcher.h>
+#include <async/loop.h>
 #include <async/wait.h>
 #include <fs/vfs.h>
 #include <magenta/types.h>
@@ -48,4 +49,10 @@ private:
     async_t* async_;
 };
 
+// Runs |loop| on the calling thread, as well as on |threads - 1| additional
+// threads (or one per CPU, if |threads| is zero), until the loop quits.
+//
+// Messages on a single channel are still handled one at a time, and in order.
+void RunDispatchLoop(async::Loop* loop, const char* name, uint32_t threads = 0);
+
 } // namespace fs
@@ -38,7 +38,7 @@ template <bool Write, size_t BlockSize, typename TxnHandler>
 class BlockTxn <vmoid_t, Write, BlockSize, TxnHandler> {
 public:
     DISALLOW_COPY_AND_ASSIGN_ALLOW_MOVE(BlockTxn);
-    explicit BlockTxn(TxnHandler* handler) : handler_(handler), count_(0) {}
+    explicit BlockTxn(TxnHandler* handler) : handler_(handler), count_(0), trim_count_(0) {}
     ~BlockTxn() {
         Flush();
     }
@@ -46,6 +46,9 @@ public:
     // Identify that a block should be written to disk
     // as a later point in time.
     void Enqueue(vmoid_t id, uint64_t relative_block, uint64_t absolute_block, uint64_t nblocks) {
+        if (Write) {
+            CancelTrims(absolute_block, nblocks);
+        }
         for (size_t i = 0; i < count_; i++) {
             if (requests_[i].vmoid != id) {
                 continue;
@@ -82,13 +85,52 @@ public:
         }
     }
 
+    // Identify that blocks no longer hold useful data, and may be
+    // discarded by the device once the rest of the transaction is written.
+    void EnqueueTrim(uint64_t absolute_block, uint64_t nblocks) {
+        static_assert(Write, "Only write transactions may discard blocks");
+        for (size_t i = 0; i < trim_count_; i++) {
+            if (trims_[i].dev_offset + trims_[i].length == absolute_block) {
+                trims_[i].length += nblocks;
+                return;
+            } else if (absolute_block + nblocks == trims_[i].dev_offset) {
+                trims_[i].dev_offset = absolute_block;
+                trims_[i].length += nblocks;
+                return;
+            }
+        }
+        if (trim_count_ == MAX_TXN_MESSAGES) {
+            Flush();
+        }
+        trims_[trim_count_].txnid = handler_->TxnId();
+        trims_[trim_count_].vmoid = 0;
+        trims_[trim_count_].vmo_offset = 0;
+        trims_[trim_count_].dev_offset = absolute_block;
+        trims_[trim_count_].length = nblocks;
+        trim_count_++;
+    }
+
     // Activate the transaction
     mx_status_t Flush();
 
 private:
+    // Drops pending discards of blocks which are being written again.
+    void CancelTrims(uint64_t absolute_block, uint64_t nblocks) {
+        for (size_t i = 0; i < trim_count_;) {
+            if ((trims_[i].dev_offset < absolute_block + nblocks) &&
+                (absolute_block < trims_[i].dev_offset + trims_[i].length)) {
+                trims_[i] = trims_[--trim_count_];
+            } else {
+                i++;
+            }
+        }
+    }
+
     TxnHandler* handler_;
     size_t count_;
     block_fifo_request_t requests_[MAX_TXN_MESSAGES];
+    size_t trim_count_;
+    block_fifo_request_t trims_[Write ? MAX_TXN_MESSAGES : 1];
 };
 
 template <bool Write, size_t BlockSize, typename TxnHandler>
@@ -104,6 +146,24 @@ inline mx_status_t BlockTxn<vmoid_t, Write, BlockSize, TxnHandler>::Flush() {
         status = handler_->Txn(requests_, count_);
     }
     count_ = 0;
+
+    // Discards are sent only once the writes which free the blocks have been
+    // issued. They are advisory, so failures are not reported.
+    // Coalesced discards can be far larger than any single write, so the
+    // conversion to bytes must not wrap.
+    for (size_t i = 0; i < trim_count_; i++) {
+        const uint64_t dev_offset = trims_[i].dev_offset;
+        const uint64_t length = trims_[i].length;
+        assert(dev_offset <= UINT64_MAX / BlockSize);
+        assert(length <= (UINT64_MAX - dev_offset * BlockSize) / BlockSize);
+        trims_[i].opcode = BLOCKIO_TRIM;
+        trims_[i].dev_offset = dev_offset * BlockSize;
+        trims_[i].length = length * BlockSize;
+    }
+    if (trim_count_ != 0 && status == MX_OK) {
+        handler_->Txn(trims_, trim_count_);
+    }
+    trim_count_ = 0;
     return status;
 }
 
@@ -136,6 +196,9 @@ public:
         }
     }
 
+    // Discarding blocks is not supported on the host (do nothing)
+    void EnqueueTrim(uint64_t absolute_block, uint64_t nblocks) {}
+
     // Activate the transaction (do nothing)
     mx_status_t Flush() { return MX_OK; }
 
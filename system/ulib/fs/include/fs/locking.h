@@ -0,0 +1,87 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <pthread.h>
+
+#include <fbl/macros.h>
+
+namespace fs {
+
+// A reader / writer lock.
+//
+// Every vnode carries one (see |Vnode::IoLock|): the RPC dispatcher holds it
+// shared while reading from the vnode, and exclusively while modifying it.
+class RwLock {
+public:
+    RwLock() { pthread_rwlock_init(&lock_, nullptr); }
+    ~RwLock() { pthread_rwlock_destroy(&lock_); }
+
+    void Acquire() { pthread_rwlock_wrlock(&lock_); }
+    void AcquireShared() { pthread_rwlock_rdlock(&lock_); }
+    void Release() { pthread_rwlock_unlock(&lock_); }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(RwLock);
+
+private:
+    pthread_rwlock_t lock_;
+};
+
+class AutoExclusiveLock {
+public:
+    explicit AutoExclusiveLock(RwLock* lock) : lock_(lock) { lock_->Acquire(); }
+    ~AutoExclusiveLock() { lock_->Release(); }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(AutoExclusiveLock);
+
+private:
+    RwLock* lock_;
+};
+
+class AutoSharedLock {
+public:
+    explicit AutoSharedLock(RwLock* lock) : lock_(lock) { lock_->AcquireShared(); }
+    ~AutoSharedLock() { lock_->Release(); }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(AutoSharedLock);
+
+private:
+    RwLock* lock_;
+};
+
+// A plain (non-recursive) mutex.
+//
+// Filesystems keep one in each vnode to guard its in-memory state, and a few
+// more to guard state shared between vnodes (allocation maps, the table of
+// cached vnodes). Each lock is held only while that state is touched, so
+// operations on different vnodes proceed concurrently.
+class Mutex {
+public:
+    Mutex() { pthread_mutex_init(&mutex_, nullptr); }
+    ~Mutex() { pthread_mutex_destroy(&mutex_); }
+
+    void Acquire() { pthread_mutex_lock(&mutex_); }
+    // Returns true if the mutex was acquired.
+    bool TryAcquire() { return pthread_mutex_trylock(&mutex_) == 0; }
+    void Release() { pthread_mutex_unlock(&mutex_); }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(Mutex);
+
+private:
+    pthread_mutex_t mutex_;
+};
+
+class AutoLock {
+public:
+    explicit AutoLock(Mutex* mutex) : mutex_(mutex) { mutex_->Acquire(); }
+    ~AutoLock() { mutex_->Release(); }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(AutoLock);
+
+private:
+    Mutex* mutex_;
+};
+
+} // namespace fs
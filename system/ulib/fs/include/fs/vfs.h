@@ -46,6 +46,7 @@ __END_CDECLS
 
 #ifdef __Fuchsia__
 #include <fs/dispatcher.h>
+#include <fs/locking.h>
 #include <mx/channel.h>
 #include <mx/event.h>
 #include <mx/vmo.h>
@@ -147,6 +148,12 @@ public:
         return 0;
     }
 
+    // Returns true if clients opening vn with O_XFER_VMO may be granted a
+    // transfer VMO, through which their large reads and writes are passed
+    // to Read() and Write() without being copied. Such vnodes must be
+    // served by the default Serve().
+    virtual bool SupportsTransferVmo() const { return false; }
+
     virtual mx_status_t WatchDir(mx::channel* out) { return MX_ERR_NOT_SUPPORTED; }
     virtual mx_status_t WatchDirV2(Vfs* vfs, const vfs_watch_dir_t* cmd) {
         return MX_ERR_NOT_SUPPORTED;
@@ -155,9 +162,13 @@ public:
     virtual void Notify(const char* name, size_t len, unsigned event) {}
 
     // Ensure that it is valid to open vn.
+    //
+    // Each successful Open() is balanced by exactly one Close(), once the
+    // connection (or other user) which opened vn is done with it.
     virtual mx_status_t Open(uint32_t flags) = 0;
 
     // Closes vn. Typically, most Vnodes simply return "MX_OK".
+    // May be called with or without |Vfs::vfs_lock_| held.
     virtual mx_status_t Close();
 
     // Read data from vn at offset.
@@ -198,6 +209,8 @@ public:
     // Create a new node under vn.
     // Name is len bytes long, and does not include a null terminator.
     // Mode specifies the type of entity to create.
+    // The new node is returned already open, as if by Open(), and is
+    // balanced by one Close() like any other.
     virtual mx_status_t Create(fbl::RefPtr<Vnode>* out, const char* name, size_t len, uint32_t mode) {
         return MX_ERR_NOT_SUPPORTED;
     }
@@ -277,12 +290,25 @@ public:
         flags_ |= VFS_FLAG_DEVICE_DETACHED;
     }
     bool IsDetachedDevice() const { return (flags_ & VFS_FLAG_DEVICE_DETACHED); }
+
+    // Guards the contents of the vnode. The RPC dispatcher holds it shared
+    // while reading from, listing or syncing the vnode (or reading its
+    // attributes), and exclusively while writing, truncating or otherwise
+    // modifying it. Ioctls are left to the filesystem. Operations on the
+    // namespace are serialized by |Vfs::vfs_lock_| instead, which is always
+    // acquired first.
+    RwLock* IoLock() { return &io_lock_; }
 #endif
 protected:
     DISALLOW_COPY_ASSIGN_AND_MOVE(Vnode);
     Vnode() : flags_(0) {};
 
     uint32_t flags_;
+
+#ifdef __Fuchsia__
+private:
+    RwLock io_lock_;
+#endif
 };
 
 #ifdef __Fuchsia__
@@ -369,7 +395,10 @@ public:
     // response of each one with the provided deadline.
     mx_status_t UninstallAll(mx_time_t deadline) __TA_EXCLUDES(vfs_lock_);
 
-    // A lock which should be used to protect lookup and walk operations
+    // The namespace lock: serializes lookup and walk operations, as well as
+    // any operation which modifies a directory (create, unlink, rename, link).
+    // Operations on the contents of a single vnode only acquire its
+    // |Vnode::IoLock|.
     // TODO(smklein): Encapsulate the lock; make it private.
     mtx_t vfs_lock_{};
 #endif
@@ -85,10 +85,15 @@ mx_status_t Vfs::MountMkdir(fbl::RefPtr<Vnode> vn, const mount_mkdir_config_t* c
             Vfs::UninstallRemoteLocked(vn, &old_remote);
             vfs_unmount_handle(old_remote.release(), 0);
         } else {
+            vn->Close();
             return MX_ERR_BAD_STATE;
         }
     }
-    return Vfs::InstallRemoteLocked(vn, fbl::move(h));
+    // The mount list keeps its own reference to vn; the open from
+    // OpenLocked is not needed past this point.
+    r = Vfs::InstallRemoteLocked(vn, fbl::move(h));
+    vn->Close();
+    return r;
 }
 
 mx_status_t Vfs::UninstallRemote(fbl::RefPtr<Vnode> vn, mx::channel* h) {
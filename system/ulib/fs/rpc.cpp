@@ -12,6 +12,8 @@
 #include <fs/vfs.h>
 #include <magenta/process.h>
 #include <mx/event.h>
+#include <mx/vmar.h>
+#include <mx/vmo.h>
 #include <mxio/debug.h>
 #include <mxio/io.h>
 #include <mxio/remoteio.h>
@@ -32,6 +34,10 @@ typedef struct vfs_iostate {
     vdircookie_t dircookie;
     size_t io_off;
     uint32_t io_flags;
+    // Where the transfer VMO granted to the client when it opened the
+    // connection (see O_XFER_VMO) is mapped, if it was; 0 otherwise.
+    uintptr_t io_xfer_buf;
+    size_t io_xfer_size;
 } vfs_iostate_t;
 
 static bool writable(uint32_t flags) {
@@ -58,6 +64,56 @@ static void txn_handoff_open(mx_handle_t srv, mx::channel channel,
     mxrio_txn_handoff(srv, channel.release(), &msg);
 }
 
+// Creates a transfer VMO for a new connection and maps it, returning in
+// |out| a handle for the client which can read, write and map it, but not
+// resize it out from under the mapping.
+mx_status_t vfs_xfer_create(uintptr_t* buf, mx_handle_t* out) {
+    mx::vmo vmo;
+    mx_status_t status;
+    if ((status = mx::vmo::create(MXIO_VMO_XFER_SIZE, 0, &vmo)) != MX_OK) {
+        return status;
+    }
+    if ((status = mx::vmar::root_self().map(0, vmo, 0, MXIO_VMO_XFER_SIZE,
+                                            MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                                            buf)) != MX_OK) {
+        return status;
+    }
+    mx::vmo client;
+    if ((status = vmo.duplicate(MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE | MX_RIGHT_MAP,
+                                &client)) != MX_OK) {
+        mx::vmar::root_self().unmap(*buf, MXIO_VMO_XFER_SIZE);
+        return status;
+    }
+    *out = client.release();
+    return MX_OK;
+}
+
+// Allocates io state for a connection to vn, moving large transfers
+// through |xfer_buf| (a mapping of MXIO_VMO_XFER_SIZE bytes, or 0), and
+// registers the connection with the dispatcher. Once this succeeds, the
+// mapping is released when the connection is closed.
+mx_status_t vfs_serve(Vnode* vn, Vfs* vfs, mx::channel channel, uint32_t flags,
+                      uintptr_t xfer_buf) {
+    mx_status_t r;
+    vfs_iostate_t* ios;
+
+    if ((ios = static_cast<vfs_iostate_t*>(calloc(1, sizeof(vfs_iostate_t)))) == nullptr) {
+        return MX_ERR_NO_MEMORY;
+    }
+    ios->vn = fbl::RefPtr<fs::Vnode>(vn);
+    ios->io_flags = flags;
+    ios->vfs = vfs;
+    ios->io_xfer_buf = xfer_buf;
+    ios->io_xfer_size = xfer_buf ? MXIO_VMO_XFER_SIZE : 0;
+
+    if ((r = vfs->Serve(fbl::move(channel), ios)) < 0) {
+        ios->vn = nullptr;
+        free(ios);
+        return r;
+    }
+    return MX_OK;
+}
+
 // Initializes io state for a vnode and attaches it to a dispatcher.
 void vfs_rpc_open(mxrio_msg_t* msg, mx::channel channel, fbl::RefPtr<Vnode> vn,
                   vfs_iostate_t* ios, const char* path, uint32_t flags, uint32_t mode) {
@@ -67,7 +123,9 @@ void vfs_rpc_open(mxrio_msg_t* msg, mx::channel channel, fbl::RefPtr<Vnode> vn,
     // immediately, rather than describing the VFS object to the caller.
     // We check it early so we can throw away the protocol part of flags.
     bool pipeline = flags & O_PIPELINE;
-    uint32_t open_flags = flags & (~O_PIPELINE);
+    bool xfer = flags & O_XFER_VMO;
+    uint32_t open_flags = flags & ~(O_PIPELINE | O_XFER_VMO);
+    uintptr_t xfer_buf = 0;
 
     r = ios->vfs->Open(fbl::move(vn), &vn, path, &path, open_flags, mode);
 
@@ -83,11 +141,28 @@ void vfs_rpc_open(mxrio_msg_t* msg, mx::channel channel, fbl::RefPtr<Vnode> vn,
     }
 
     // Acquire the handles to the VFS object
-    if ((r = vn->GetHandles(flags, obj.handle, &obj.type, obj.extra, &obj.esize)) < 0) {
+    {
+        // Describing a vnode may lazily initialize it (e.g., by creating
+        // its VMO).
+        AutoExclusiveLock lock(vn->IoLock());
+        r = vn->GetHandles(flags, obj.handle, &obj.type, obj.extra, &obj.esize);
+    }
+    if (r < 0) {
         vn->Close();
         goto done;
     }
 
+    // Grant the transfer VMO asked for, if the connection will be served
+    // here and its reads and writes go to the vnode. Without one, the
+    // client moves its data through messages.
+    if (xfer && !pipeline && (r == 0) && (obj.type == MXIO_PROTOCOL_REMOTE) &&
+        vn->SupportsTransferVmo() && (vfs_xfer_create(&xfer_buf, &obj.handle[0]) == MX_OK)) {
+        mxrio_xfer_vmo_t info = {MXIO_VMO_XFER_SIZE};
+        memcpy(obj.extra, &info, sizeof(info));
+        obj.esize = sizeof(info);
+        r = 1;
+    }
+
 done:
     // If r >= 0, then we hold a reference to vn from open.
     // Otherwise, vn is closed, and we're simply responding to the client.
@@ -114,7 +189,18 @@ done:
         return;
     }
 
-    vn->Serve(ios->vfs, fbl::move(channel), open_flags);
+    // Vnodes which support a transfer VMO are served by the default Serve().
+    if (xfer_buf != 0) {
+        r = vfs_serve(vn.get(), ios->vfs, fbl::move(channel), open_flags, xfer_buf);
+        if (r != MX_OK) {
+            mx::vmar::root_self().unmap(xfer_buf, MXIO_VMO_XFER_SIZE);
+        }
+    } else {
+        r = vn->Serve(ios->vfs, fbl::move(channel), open_flags);
+    }
+    if (r != MX_OK) {
+        vn->Close();
+    }
 }
 
 void mxrio_reply_channel_status(mx::channel channel, mx_status_t status) {
@@ -125,24 +211,31 @@ void mxrio_reply_channel_status(mx::channel channel, mx_status_t status) {
     channel.write(0, &reply, MXRIO_OBJECT_MINSIZE, nullptr, 0);
 }
 
-} // namespace
-
-mx_status_t Vnode::Serve(fs::Vfs* vfs, mx::channel channel, uint32_t flags) {
-    mx_status_t r;
-    vfs_iostate_t* ios;
-
-    if ((ios = static_cast<vfs_iostate_t*>(calloc(1, sizeof(vfs_iostate_t)))) == nullptr) {
-        return MX_ERR_NO_MEMORY;
+// Reads and writes through the transfer VMO go directly between the vnode
+// and the server's mapping of it. The client's handle to the VMO cannot
+// resize it, so the mapping stays valid while the connection is open.
+ssize_t vfs_read_xfer(Vnode* vn, const vfs_iostate_t* ios, int32_t arg, size_t off) {
+    if (ios->io_xfer_buf == 0) {
+        return MX_ERR_BAD_STATE;
+    } else if ((arg < 0) || (static_cast<size_t>(arg) > ios->io_xfer_size)) {
+        return MX_ERR_INVALID_ARGS;
     }
-    ios->vn = fbl::RefPtr<fs::Vnode>(this);
-    ios->io_flags = flags;
-    ios->vfs = vfs;
+    return vn->Read(reinterpret_cast<void*>(ios->io_xfer_buf), arg, off);
+}
 
-    if ((r = vfs->Serve(fbl::move(channel), ios)) < 0) {
-        free(ios);
-        return r;
+ssize_t vfs_write_xfer(Vnode* vn, const vfs_iostate_t* ios, int32_t arg, size_t off) {
+    if (ios->io_xfer_buf == 0) {
+        return MX_ERR_BAD_STATE;
+    } else if ((arg < 0) || (static_cast<size_t>(arg) > ios->io_xfer_size)) {
+        return MX_ERR_INVALID_ARGS;
     }
-    return MX_OK;
+    return vn->Write(reinterpret_cast<const void*>(ios->io_xfer_buf), arg, off);
+}
+
+} // namespace
+
+mx_status_t Vnode::Serve(fs::Vfs* vfs, mx::channel channel, uint32_t flags) {
+    return vfs_serve(this, vfs, fbl::move(channel), flags, 0);
 }
 
 mx_status_t Vfs::Serve(mx::channel channel, void* ios) {
@@ -159,10 +252,14 @@ mx_status_t Vfs::ServeDirectory(fbl::RefPtr<fs::Vnode> vn,
 
     // Tell the calling process that we've mounted the directory.
     if ((r = channel.signal_peer(0, MX_USER_SIGNAL_0)) != MX_OK) {
+        vn->Close();
         return r;
     }
 
-    return vn->Serve(this, fbl::move(channel), O_ADMIN);
+    if ((r = vn->Serve(this, fbl::move(channel), O_ADMIN)) != MX_OK) {
+        vn->Close();
+    }
+    return r;
 }
 
 } // namespace fs
@@ -198,6 +295,9 @@ static mx_status_t vfs_handler_vn(mxrio_msg_t* msg, fbl::RefPtr<fs::Vnode> vn, v
     }
     case MXRIO_CLOSE: {
         ios->vfs->TokenDiscard(&ios->token);
+        if (ios->io_xfer_buf != 0) {
+            mx::vmar::root_self().unmap(ios->io_xfer_buf, ios->io_xfer_size);
+        }
         // this will drop the ref on the vn
         mx_status_t status = vn->Close();
         ios->vn = nullptr;
@@ -206,13 +306,19 @@ static mx_status_t vfs_handler_vn(mxrio_msg_t* msg, fbl::RefPtr<fs::Vnode> vn, v
     }
     case MXRIO_CLONE: {
         mx::channel channel(msg->handle[0]); // take ownership
+        // The clone is a new connection to vn, and is closed like any other.
+        // Access was checked when the original connection was opened.
+        mx_status_t status = vn->Open(ios->io_flags & ~O_ACCMODE);
         if (!(arg & O_PIPELINE)) {
             mxrio_object_t obj;
             memset(&obj, 0, MXRIO_OBJECT_MINSIZE);
+            obj.status = status;
             obj.type = MXIO_PROTOCOL_REMOTE;
             channel.write(0, &obj, MXRIO_OBJECT_MINSIZE, 0, 0);
         }
-        vn->Serve(ios->vfs, fbl::move(channel), ios->io_flags);
+        if (status == MX_OK && vn->Serve(ios->vfs, fbl::move(channel), ios->io_flags) != MX_OK) {
+            vn->Close();
+        }
         return ERR_DISPATCHER_INDIRECT;
     }
     case MXRIO_READ: {
@@ -263,6 +369,50 @@ static mx_status_t vfs_handler_vn(mxrio_msg_t* msg, fbl::RefPtr<fs::Vnode> vn, v
         ssize_t r = vn->Write(msg->data, len, msg->arg2.off);
         return static_cast<mx_status_t>(r);
     }
+    case MXRIO_READ_VMO: {
+        if (!readable(ios->io_flags)) {
+            return MX_ERR_BAD_HANDLE;
+        }
+        ssize_t r = fs::vfs_read_xfer(vn.get(), ios, arg, ios->io_off);
+        if (r >= 0) {
+            ios->io_off += r;
+            msg->arg2.off = ios->io_off;
+        }
+        return static_cast<mx_status_t>(r);
+    }
+    case MXRIO_READ_AT_VMO: {
+        if (!readable(ios->io_flags)) {
+            return MX_ERR_BAD_HANDLE;
+        }
+        ssize_t r = fs::vfs_read_xfer(vn.get(), ios, arg, msg->arg2.off);
+        return static_cast<mx_status_t>(r);
+    }
+    case MXRIO_WRITE_VMO: {
+        if (!writable(ios->io_flags)) {
+            return MX_ERR_BAD_HANDLE;
+        }
+        if (ios->io_flags & O_APPEND) {
+            vnattr_t attr;
+            mx_status_t r;
+            if ((r = vn->Getattr(&attr)) < 0) {
+                return r;
+            }
+            ios->io_off = attr.size;
+        }
+        ssize_t r = fs::vfs_write_xfer(vn.get(), ios, arg, ios->io_off);
+        if (r >= 0) {
+            ios->io_off += r;
+            msg->arg2.off = ios->io_off;
+        }
+        return static_cast<mx_status_t>(r);
+    }
+    case MXRIO_WRITE_AT_VMO: {
+        if (!writable(ios->io_flags)) {
+            return MX_ERR_BAD_HANDLE;
+        }
+        ssize_t r = fs::vfs_write_xfer(vn.get(), ios, arg, msg->arg2.off);
+        return static_cast<mx_status_t>(r);
+    }
     case MXRIO_SEEK: {
         vnattr_t attr;
         mx_status_t r;
@@ -357,7 +507,10 @@ static mx_status_t vfs_handler_vn(mxrio_msg_t* msg, fbl::RefPtr<fs::Vnode> vn, v
         }
         mx_status_t r;
         {
+            // The namespace lock keeps entries from coming and going; the
+            // vnode's lock keeps its contents from being rewritten.
             fbl::AutoLock lock(&ios->vfs->vfs_lock_);
+            fs::AutoSharedLock io_lock(vn->IoLock());
             r = vn->Readdir(&ios->dircookie, msg->data, arg);
         }
         if (r >= 0) {
@@ -538,15 +691,43 @@ static mx_status_t vfs_handler_vn(mxrio_msg_t* msg, fbl::RefPtr<fs::Vnode> vn, v
     }
 }
 
-// TODO(orr): temporary; prevent multithread weirdness while we
-// make locking more fine grained
-static mtx_t vfs_big_lock = MTX_INIT;
-
 mx_status_t vfs_handler(mxrio_msg_t* msg, void* cookie) {
     vfs_iostate_t* ios = static_cast<vfs_iostate_t*>(cookie);
-
-    fbl::AutoLock lock(&vfs_big_lock);
     fbl::RefPtr<fs::Vnode> vn = ios->vn;
-    mx_status_t status = vfs_handler_vn(msg, fbl::move(vn), ios);
-    return status;
+
+    // Messages on a single handle are never dispatched concurrently, but
+    // messages on different handles (possibly to the same vnode) are.
+    // Operations on the contents of the vnode take its lock here. Of the rest:
+    // - Open, readdir, unlink, rename and link are serialized by the Vfs's
+    //   namespace lock (readdir also takes the vnode's lock, shared).
+    // - Close, clone and fcntl only touch the iostate, and
+    //   the filesystem's own open count.
+    // - Ioctls are not covered: several of them (mounting, unmounting,
+    //   tokens, watchers) take the namespace lock, which must be acquired
+    //   before the vnode's lock. Filesystems guard the state their own
+    //   ioctls touch with their own locks.
+    switch (MXRIO_OP(msg->op)) {
+    case MXRIO_READ:
+    case MXRIO_READ_AT:
+    case MXRIO_READ_VMO:
+    case MXRIO_READ_AT_VMO:
+    case MXRIO_SEEK:
+    case MXRIO_STAT:
+    case MXRIO_SYNC: {
+        fs::AutoSharedLock lock(vn->IoLock());
+        return vfs_handler_vn(msg, vn, ios);
+    }
+    case MXRIO_WRITE:
+    case MXRIO_WRITE_AT:
+    case MXRIO_WRITE_VMO:
+    case MXRIO_WRITE_AT_VMO:
+    case MXRIO_SETATTR:
+    case MXRIO_TRUNCATE:
+    case MXRIO_MMAP: {
+        fs::AutoExclusiveLock lock(vn->IoLock());
+        return vfs_handler_vn(msg, vn, ios);
+    }
+    default:
+        return vfs_handler_vn(msg, fbl::move(vn), ios);
+    }
 }
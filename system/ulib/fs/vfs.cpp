@@ -223,13 +223,21 @@ mx_status_t Vfs::OpenLocked(fbl::RefPtr<Vnode> vndir, fbl::RefPtr<Vnode>* out,
         }
 #ifdef __Fuchsia__
         if (vn->IsDevice() && !(flags & O_DIRECTORY)) {
+            // The caller is handed off to the device; it never holds vn open.
             *pathout = ".";
             r = vn->GetRemote();
+            vn->Close();
             return r;
         }
 #endif
-        if ((flags & O_TRUNC) && ((r = vn->Truncate(0)) < 0)) {
-            return r;
+        if (flags & O_TRUNC) {
+#ifdef __Fuchsia__
+            AutoExclusiveLock lock(vn->IoLock());
+#endif
+            if ((r = vn->Truncate(0)) < 0) {
+                vn->Close();
+                return r;
+            }
         }
     }
     FS_TRACE(VFS, "VfsOpen: vn=%p\n", vn.get());
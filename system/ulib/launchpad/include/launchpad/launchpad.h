@@ -134,6 +134,53 @@ mx_status_t launchpad_load_from_fd(launchpad_t* lp, int fd);
 mx_status_t launchpad_load_from_vmo(launchpad_t* lp, mx_handle_t vmo);
 
 
+// PROCESS TEMPLATES
+// A template holds the parts of loading that come out the same every
+// time a given executable is launched: the executable's VM object, the
+// dynamic linker named by its PT_INTERP (looked up once via the default
+// loader service), the system vDSO, and their parsed ELF headers.
+// Launching from a template maps copy-on-write clones of those VM
+// objects without any file or loader service lookups, which makes it
+// the cheap way to start many processes running the same program:
+//   launchpad_template_t* tmpl;
+//   launchpad_template_create_from_file("/boot/bin/worker", &tmpl);
+//   for (...) {
+//       launchpad_create(job, "worker", &lp);
+//       launchpad_load_from_template(lp, tmpl);
+//       launchpad_set_args(lp, argc, argv);
+//       launchpad_go(lp, &proc, &errmsg);
+//   }
+//   launchpad_template_destroy(tmpl);
+//
+// A template is never modified after it's created, so it may be used by
+// several threads at once, each with its own launchpad.  Templates only
+// cover ELF files; #! scripts must go through launchpad_file_load.
+// --------------------------------------------------------------------
+
+// Opaque type representing a process template.
+typedef struct launchpad_template launchpad_template_t;
+
+// Create a template for the ELF executable in vmo.  This consumes the
+// VM object, whether or not it succeeds.
+mx_status_t launchpad_template_create_from_vmo(mx_handle_t vmo,
+                                               launchpad_template_t** tmpl);
+
+// Create a template for the ELF executable at path.
+mx_status_t launchpad_template_create_from_file(const char* path,
+                                                launchpad_template_t** tmpl);
+
+// Free a template and close its handles.  Processes already launched
+// from it are not affected.
+void launchpad_template_destroy(launchpad_template_t* tmpl);
+
+// Load the template's program into the launchpad's process, along with
+// the system vDSO.  This is equivalent to launchpad_load_from_vmo on the
+// template's executable, and like it also adds the vDSO VM object handle
+// (see launchpad_add_vdso_vmo).
+mx_status_t launchpad_load_from_template(launchpad_t* lp,
+                                         const launchpad_template_t* tmpl);
+
+
 // ADDING ARGUMENTS, ENVIRONMENT, AND HANDLES
 // These functions setup arguments, environment, or handles to be
 // passed to the new process via the processargs protocol.
@@ -61,6 +61,14 @@ typedef struct loader_service loader_service_t;
 // any number of clients.
 mx_status_t loader_service_create_fs(const char* name, loader_service_t** out);
 
+// Like loader_service_create_fs, but searches the |count| directories of
+// |paths| in order, instead of the system library directories.  |paths|
+// must outlive the service.
+mx_status_t loader_service_create_fs_paths(const char* name,
+                                           const char* const* paths,
+                                           size_t count,
+                                           loader_service_t** out);
+
 // Returns a new dl_set_loader_service-compatible loader service channel.
 mx_status_t loader_service_connect(loader_service_t* svc, mx_handle_t* out);
 
@@ -521,20 +521,31 @@ static mx_status_t reserve_low_address_space(launchpad_t* lp) {
     return MX_OK;
 }
 
-// Consumes 'vmo' on success, not on failure.
-static mx_status_t handle_interp(launchpad_t* lp, mx_handle_t vmo,
-                                 const char* interp, size_t interp_len) {
-    mx_status_t status = setup_loader_svc(lp);
+// Map the main program of a file with no PT_INTERP.
+static mx_status_t load_static(launchpad_t* lp, elf_load_info_t* elf,
+                               mx_handle_t vmo) {
+    mx_handle_t segments_vmar;
+    mx_status_t status = elf_load_finish(lp_vmar(lp), elf, vmo,
+                                         &segments_vmar, &lp->base, &lp->entry);
     if (status != MX_OK)
-        return status;
+        return lp_error(lp, status, "elf_load: elf_load_finish() failed");
 
-    mx_handle_t interp_vmo;
-    status = loader_svc_rpc(
-        lp->special_handles[HND_LOADER_SVC], LOADER_SVC_OP_LOAD_OBJECT,
-        interp, interp_len, &interp_vmo);
-    if (status != MX_OK)
-        return status;
+    // With no PT_INTERP, we obey PT_GNU_STACK.p_memsz for the stack
+    // size setting.  With PT_INTERP, the dynamic linker is responsible
+    // for that.
+    check_elf_stack_size(lp, elf);
+    lp->loader_message = false;
+    return launchpad_add_handle(lp, segments_vmar, PA_HND(PA_VMAR_LOADED, 0));
+}
 
+// Map the dynamic linker found in 'interp_vmo', and pass it the main
+// program's 'vmo' in the loader message.  The loader service must
+// already be set up.  Consumes 'vmo' on success, not on failure;
+// never consumes 'interp_vmo'.
+static mx_status_t load_interp(launchpad_t* lp, mx_handle_t vmo,
+                               elf_load_info_t* interp_elf,
+                               mx_handle_t interp_vmo) {
+    mx_status_t status;
     if (lp->fresh_process) {
         // A fresh process using PT_INTERP might be loading a libc.so that
         // supports sanitizers, so in that case (the most common case)
@@ -544,16 +555,9 @@ static mx_status_t handle_interp(launchpad_t* lp, mx_handle_t vmo,
             return status;
     }
 
-    elf_load_info_t* elf;
     mx_handle_t segments_vmar;
-    status = elf_load_start(interp_vmo, NULL, 0, &elf);
-    if (status == MX_OK) {
-        status = elf_load_finish(lp_vmar(lp), elf, interp_vmo,
-                                 &segments_vmar, &lp->base, &lp->entry);
-        elf_load_destroy(elf);
-    }
-    mx_handle_close(interp_vmo);
-
+    status = elf_load_finish(lp_vmar(lp), interp_elf, interp_vmo,
+                             &segments_vmar, &lp->base, &lp->entry);
     if (status == MX_OK) {
         if (lp->special_handles[HND_EXEC_VMO] != MX_HANDLE_INVALID)
             mx_handle_close(lp->special_handles[HND_EXEC_VMO]);
@@ -567,6 +571,31 @@ static mx_status_t handle_interp(launchpad_t* lp, mx_handle_t vmo,
     return status;
 }
 
+// Consumes 'vmo' on success, not on failure.
+static mx_status_t handle_interp(launchpad_t* lp, mx_handle_t vmo,
+                                 const char* interp, size_t interp_len) {
+    mx_status_t status = setup_loader_svc(lp);
+    if (status != MX_OK)
+        return status;
+
+    mx_handle_t interp_vmo;
+    status = loader_svc_rpc(
+        lp->special_handles[HND_LOADER_SVC], LOADER_SVC_OP_LOAD_OBJECT,
+        interp, interp_len, &interp_vmo);
+    if (status != MX_OK)
+        return status;
+
+    elf_load_info_t* elf;
+    status = elf_load_start(interp_vmo, NULL, 0, &elf);
+    if (status == MX_OK) {
+        status = load_interp(lp, vmo, elf, interp_vmo);
+        elf_load_destroy(elf);
+    }
+    mx_handle_close(interp_vmo);
+
+    return status;
+}
+
 static mx_status_t launchpad_elf_load_body(launchpad_t* lp, const char* hdr_buf,
                                            size_t buf_sz, mx_handle_t vmo) {
     elf_load_info_t* elf;
@@ -584,21 +613,7 @@ static mx_status_t launchpad_elf_load_body(launchpad_t* lp, const char* hdr_buf,
             lp_error(lp, status, "elf_load: get_interp() failed");
         } else {
             if (interp == NULL) {
-                mx_handle_t segments_vmar;
-                status = elf_load_finish(lp_vmar(lp), elf, vmo, &segments_vmar,
-                                         &lp->base, &lp->entry);
-                if (status != MX_OK) {
-                    lp_error(lp, status, "elf_load: elf_load_finish() failed");
-                } else {
-                    // With no PT_INTERP, we obey PT_GNU_STACK.p_memsz for
-                    // the stack size setting.  With PT_INTERP, the dynamic
-                    // linker is responsible for that.
-                    check_elf_stack_size(lp, elf);
-                    lp->loader_message = false;
-                    launchpad_add_handle(
-                        lp, segments_vmar,
-                        PA_HND(PA_VMAR_LOADED, 0));
-                }
+                load_static(lp, elf, vmo);
             } else {
                 if ((status = handle_interp(lp, vmo, interp, interp_len))) {
                     lp_error(lp, status, "elf_load: handle_interp failed");
@@ -1294,3 +1309,133 @@ mx_status_t launchpad_load_from_fd(launchpad_t* lp, int fd) {
 mx_status_t launchpad_load_from_vmo(launchpad_t* lp, mx_handle_t vmo) {
     return launchpad_file_load_with_vdso(lp, vmo);
 }
+
+struct launchpad_template {
+    // The main program, and its headers if it has no PT_INTERP.
+    mx_handle_t exec_vmo;
+    elf_load_info_t* exec_elf;
+
+    // The dynamic linker named by the main program's PT_INTERP, if any.
+    mx_handle_t interp_vmo;
+    elf_load_info_t* interp_elf;
+
+    mx_handle_t vdso_vmo;
+    elf_load_info_t* vdso_elf;
+};
+
+void launchpad_template_destroy(launchpad_template_t* tmpl) {
+    close_handles(&tmpl->exec_vmo, 1);
+    close_handles(&tmpl->interp_vmo, 1);
+    close_handles(&tmpl->vdso_vmo, 1);
+    elf_load_destroy(tmpl->exec_elf);
+    elf_load_destroy(tmpl->interp_elf);
+    elf_load_destroy(tmpl->vdso_elf);
+    free(tmpl);
+}
+
+// Look up the dynamic linker the way handle_interp() would, but with the
+// default loader service since there is no launchpad to take one from.
+static mx_status_t template_find_interp(launchpad_template_t* tmpl,
+                                        const char* interp, size_t interp_len) {
+    mx_handle_t loader_svc;
+    mx_status_t status = loader_service_get_default(&loader_svc);
+    if (status != MX_OK)
+        return status;
+    status = loader_svc_rpc(loader_svc, LOADER_SVC_OP_LOAD_OBJECT,
+                            interp, interp_len, &tmpl->interp_vmo);
+    mx_handle_close(loader_svc);
+    if (status != MX_OK)
+        return status;
+    return elf_load_start(tmpl->interp_vmo, NULL, 0, &tmpl->interp_elf);
+}
+
+mx_status_t launchpad_template_create_from_vmo(mx_handle_t vmo,
+                                               launchpad_template_t** result) {
+    if (INVALID_HANDLE(vmo))
+        return MX_ERR_INVALID_ARGS;
+
+    launchpad_template_t* tmpl = calloc(1, sizeof(*tmpl));
+    if (tmpl == NULL) {
+        mx_handle_close(vmo);
+        return MX_ERR_NO_MEMORY;
+    }
+    tmpl->exec_vmo = vmo;
+
+    elf_load_info_t* elf = NULL;
+    char* interp = NULL;
+    size_t interp_len = 0;
+    mx_status_t status = elf_load_start(vmo, NULL, 0, &elf);
+    if (status == MX_OK)
+        status = elf_load_get_interp(elf, vmo, &interp, &interp_len);
+    if (status == MX_OK) {
+        if (interp == NULL) {
+            tmpl->exec_elf = elf;
+            elf = NULL;
+        } else {
+            status = template_find_interp(tmpl, interp, interp_len);
+        }
+    }
+    free(interp);
+    elf_load_destroy(elf);
+
+    if (status == MX_OK)
+        status = launchpad_get_vdso_vmo(&tmpl->vdso_vmo);
+    if (status == MX_OK)
+        status = elf_load_start(tmpl->vdso_vmo, NULL, 0, &tmpl->vdso_elf);
+
+    if (status != MX_OK) {
+        launchpad_template_destroy(tmpl);
+        return status;
+    }
+    *result = tmpl;
+    return MX_OK;
+}
+
+mx_status_t launchpad_template_create_from_file(const char* path,
+                                                launchpad_template_t** result) {
+    mx_handle_t vmo;
+    mx_status_t status = launchpad_vmo_from_file(path, &vmo);
+    if (status != MX_OK)
+        return status;
+    return launchpad_template_create_from_vmo(vmo, result);
+}
+
+mx_status_t launchpad_load_from_template(launchpad_t* lp,
+                                         const launchpad_template_t* tmpl) {
+    if (lp->error)
+        return lp->error;
+
+    mx_handle_t vmo;
+    mx_status_t status = mx_handle_duplicate(tmpl->exec_vmo,
+                                             MX_RIGHT_SAME_RIGHTS, &vmo);
+    if (status != MX_OK)
+        return lp_error(lp, status, "load_from_template: cannot duplicate vmo");
+
+    if (tmpl->interp_vmo == MX_HANDLE_INVALID) {
+        load_static(lp, tmpl->exec_elf, vmo);
+        mx_handle_close(vmo);
+    } else {
+        // The dynamic linker still needs a loader service for the
+        // program's own shared libraries.
+        status = setup_loader_svc(lp);
+        if (status == MX_OK)
+            status = load_interp(lp, vmo, tmpl->interp_elf, tmpl->interp_vmo);
+        if (status != MX_OK) {
+            mx_handle_close(vmo);
+            return lp_error(lp, status, "load_from_template: cannot load interpreter");
+        }
+    }
+    if (lp->error)
+        return lp->error;
+
+    status = elf_load_finish(lp_vmar(lp), tmpl->vdso_elf, tmpl->vdso_vmo,
+                             NULL, &lp->vdso_base, NULL);
+    if (status != MX_OK)
+        return lp_error(lp, status, "load_from_template: cannot load vDSO");
+
+    mx_handle_t vdso;
+    status = mx_handle_duplicate(tmpl->vdso_vmo, MX_RIGHT_SAME_RIGHTS, &vdso);
+    if (status != MX_OK)
+        return lp_error(lp, status, "load_from_template: cannot duplicate vDSO vmo");
+    return launchpad_add_handle(lp, vdso, PA_HND(PA_VMO_VDSO, 0));
+}
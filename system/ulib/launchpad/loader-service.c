@@ -67,6 +67,18 @@ static const char* const libpaths[] = {
     "/boot/lib",
 };
 
+// The directories a file-system backed service searches, in order.
+// Such a service's ctx points to one of these, or is NULL for libpaths.
+typedef struct fs_libpaths {
+    const char* const* paths;
+    size_t count;
+} fs_libpaths_t;
+
+static const fs_libpaths_t default_libpaths = {
+    .paths = libpaths,
+    .count = countof(libpaths),
+};
+
 mx_status_t loader_service_publish_data_sink_fs(const char* sink_name, mx_handle_t vmo) {
     union {
         vmo_create_config_t header;
@@ -133,16 +145,119 @@ mx_status_t loader_service_publish_data_sink_fs(const char* sink_name, mx_handle
 
 
 // When loading a library object, search in the hard-coded locations.
-static int open_from_libpath(const char* fn) {
+// On success, |path| holds the path of the file opened.
+static int open_from_libpath(const fs_libpaths_t* search, const char* fn,
+                             char path[PATH_MAX]) {
     int fd = -1;
-    for (size_t n = 0; fd < 0 && n < countof(libpaths); ++n) {
-        char path[PATH_MAX];
-        snprintf(path, sizeof(path), "%s/%s", libpaths[n], fn);
+    for (size_t n = 0; fd < 0 && n < search->count; ++n) {
+        snprintf(path, PATH_MAX, "%s/%s", search->paths[n], fn);
         fd = open(path, O_RDONLY);
     }
     return fd;
 }
 
+// Libraries loaded from the library paths are kept, so that loading the
+// same file again (typically for another process) hands out a
+// copy-on-write clone instead of reading the file again.  Entries are
+// keyed by the path the library path search resolved to, so a library
+// that appears earlier in the search (e.g. once /system is mounted) is
+// never shadowed by a cached copy from a later directory, and are reused
+// only while the file's size and modification time are unchanged.
+// Nobody is ever given the cached VMO itself, so no process can change
+// what the others see.
+#define LIB_CACHE_MAX 128
+
+typedef struct lib_cache_entry {
+    char* path;
+    mx_handle_t vmo;
+    off_t file_size;
+    struct timespec file_mtime;
+} lib_cache_entry_t;
+
+static mtx_t lib_cache_lock = MTX_INIT;
+static lib_cache_entry_t lib_cache[LIB_CACHE_MAX];
+static size_t lib_cache_count;
+
+static bool lib_cache_entry_valid(const lib_cache_entry_t* entry,
+                                  const struct stat* st) {
+    return st->st_size == entry->file_size &&
+           st->st_mtim.tv_sec == entry->file_mtime.tv_sec &&
+           st->st_mtim.tv_nsec == entry->file_mtime.tv_nsec;
+}
+
+// Returns a read-only copy-on-write clone of |vmo| named |name|.
+static mx_status_t lib_cache_clone(mx_handle_t vmo, const char* name,
+                                   mx_handle_t* out) {
+    uint64_t size;
+    mx_status_t status = mx_vmo_get_size(vmo, &size);
+    if (status != MX_OK)
+        return status;
+    mx_handle_t clone;
+    status = mx_vmo_clone(vmo, MX_VMO_CLONE_COPY_ON_WRITE, 0, size, &clone);
+    if (status != MX_OK)
+        return status;
+    mx_object_set_property(clone, MX_PROP_NAME, name, strlen(name));
+    return mx_handle_replace(
+        clone,
+        MX_RIGHT_READ | MX_RIGHT_EXECUTE | MX_RIGHT_MAP |
+        MX_RIGHT_TRANSFER | MX_RIGHT_DUPLICATE | MX_RIGHT_GET_PROPERTY,
+        out);
+}
+
+static void lib_cache_remove(size_t i) {
+    free(lib_cache[i].path);
+    mx_handle_close(lib_cache[i].vmo);
+    lib_cache[i] = lib_cache[--lib_cache_count];
+}
+
+// Looks up the file at |path|, whose current attributes are |st|.
+static mx_status_t lib_cache_lookup(const char* path, const struct stat* st,
+                                    const char* name, mx_handle_t* out) {
+    mx_status_t status = MX_ERR_NOT_FOUND;
+    mtx_lock(&lib_cache_lock);
+    for (size_t i = 0; i < lib_cache_count; ++i) {
+        if (strcmp(lib_cache[i].path, path))
+            continue;
+        if (lib_cache_entry_valid(&lib_cache[i], st)) {
+            status = lib_cache_clone(lib_cache[i].vmo, name, out);
+        } else {
+            lib_cache_remove(i);
+        }
+        break;
+    }
+    mtx_unlock(&lib_cache_lock);
+    return status;
+}
+
+// Takes ownership of |vmo|, which nobody else may have a handle to.
+static void lib_cache_insert(const char* path, const struct stat* st,
+                             mx_handle_t vmo) {
+    mtx_lock(&lib_cache_lock);
+    lib_cache_entry_t* entry = NULL;
+    for (size_t i = 0; i < lib_cache_count; ++i) {
+        if (!strcmp(lib_cache[i].path, path)) {
+            // Another thread loaded the same library at the same time.
+            goto drop;
+        }
+    }
+    if (lib_cache_count == LIB_CACHE_MAX)
+        goto drop;
+    entry = &lib_cache[lib_cache_count];
+    entry->path = strdup(path);
+    if (entry->path == NULL)
+        goto drop;
+    entry->vmo = vmo;
+    entry->file_size = st->st_size;
+    entry->file_mtime = st->st_mtim;
+    ++lib_cache_count;
+    mtx_unlock(&lib_cache_lock);
+    return;
+
+drop:
+    mtx_unlock(&lib_cache_lock);
+    mx_handle_close(vmo);
+}
+
 // Always consumes the fd.
 static mx_handle_t load_object_fd(int fd, const char* fn, mx_handle_t* out) {
     mx_status_t status = mxio_get_vmo(fd, out);
@@ -153,10 +268,31 @@ static mx_handle_t load_object_fd(int fd, const char* fn, mx_handle_t* out) {
 }
 
 static mx_status_t fs_load_object(void *ctx, const char* name, mx_handle_t* out) {
-    int fd = open_from_libpath(name);
-    if (fd >= 0)
+    const fs_libpaths_t* search = ctx != NULL ? ctx : &default_libpaths;
+    char path[PATH_MAX];
+    int fd = open_from_libpath(search, name, path);
+    if (fd < 0)
+        return MX_ERR_NOT_FOUND;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
         return load_object_fd(fd, name, out);
-    return MX_ERR_NOT_FOUND;
+    if (lib_cache_lookup(path, &st, name, out) == MX_OK) {
+        close(fd);
+        return MX_OK;
+    }
+
+    mx_handle_t vmo;
+    mx_status_t status = load_object_fd(fd, name, &vmo);
+    if (status != MX_OK)
+        return status;
+    status = lib_cache_clone(vmo, name, out);
+    if (status != MX_OK) {
+        // Not cloneable, so not cacheable; just hand out the original.
+        *out = vmo;
+        return MX_OK;
+    }
+    lib_cache_insert(path, &st, vmo);
+    return MX_OK;
 }
 
 static mx_status_t fs_load_abspath(void *ctx, const char* path, mx_handle_t* out) {
@@ -261,6 +397,71 @@ struct startup {
     mx_handle_t syslog_handle;
 };
 
+// Loads each of the |msg->arg| names in the request with a separate
+// LOADER_SVC_OP_LOAD_OBJECT call of |loader|, and sends one reply
+// carrying all of the results.  |terminated| says whether the client
+// ended the last name itself; if not, that name was cut short and the
+// request is rejected rather than loading something by a shorter name.
+static mx_status_t handle_load_objects(mx_handle_t h, mx_loader_svc_msg_t* msg,
+                                       uint32_t sz, bool terminated,
+                                       loader_service_fn_t loader,
+                                       void* loader_arg) {
+    const char* names[LOADER_SVC_LOAD_OBJECTS_MAX];
+    uint32_t count = (uint32_t)msg->arg;
+    mx_status_t r = MX_OK;
+    if (!terminated || msg->arg <= 0 || count > LOADER_SVC_LOAD_OBJECTS_MAX) {
+        r = MX_ERR_INVALID_ARGS;
+    } else {
+        // The caller has null-terminated the data, so only the number of
+        // names needs checking.
+        const char* name = (const char*)msg->data;
+        const char* end = (const char*)msg + sz;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (name >= end) {
+                r = MX_ERR_INVALID_ARGS;
+                break;
+            }
+            names[i] = name;
+            name += strlen(name) + 1;
+        }
+    }
+
+    struct {
+        mx_loader_svc_msg_t header;
+        int32_t status[LOADER_SVC_LOAD_OBJECTS_MAX];
+    } reply;
+    mx_handle_t handles[LOADER_SVC_LOAD_OBJECTS_MAX];
+    uint32_t num_handles = 0;
+    uint32_t reply_size = sizeof(reply.header);
+    if (r == MX_OK) {
+        for (uint32_t i = 0; i < count; ++i) {
+            mx_handle_t handle = MX_HANDLE_INVALID;
+            reply.status[i] = (*loader)(loader_arg, LOADER_SVC_OP_LOAD_OBJECT,
+                                        MX_HANDLE_INVALID, names[i], &handle);
+            if (reply.status[i] == MX_OK) {
+                handles[num_handles++] = handle;
+            } else if (reply.status[i] == MX_ERR_NOT_FOUND) {
+                fprintf(stderr, "dlsvc: could not open '%s'\n", names[i]);
+            }
+        }
+        reply_size += count * sizeof(reply.status[0]);
+    }
+
+    // txid returned as received from the client.
+    reply.header = *msg;
+    reply.header.opcode = LOADER_SVC_OP_STATUS;
+    reply.header.arg = r;
+    reply.header.reserved0 = 0;
+    reply.header.reserved1 = 0;
+    if ((r = mx_channel_write(h, 0, &reply, reply_size, handles, num_handles)) < 0) {
+        fprintf(stderr, "dlsvc: msg write error: %d: %s\n", r, mx_status_get_string(r));
+        for (uint32_t i = 0; i < num_handles; ++i)
+            mx_handle_close(handles[i]);
+        return r;
+    }
+    return MX_OK;
+}
+
 static mx_status_t handle_loader_rpc(mx_handle_t h,
                                      loader_service_fn_t loader,
                                      void* loader_arg, mx_handle_t sys_log) {
@@ -286,6 +487,7 @@ static mx_status_t handle_loader_rpc(mx_handle_t h,
         return MX_ERR_IO;
     }
 
+    bool terminated = data[sz - 1] == 0;
     // forcibly null-terminate the message data argument
     data[sz - 1] = 0;
 
@@ -308,6 +510,13 @@ static mx_status_t handle_loader_rpc(mx_handle_t h,
         request_handle = MX_HANDLE_INVALID;
         msg->arg = r;
         break;
+    case LOADER_SVC_OP_LOAD_OBJECTS:
+        if (request_handle != MX_HANDLE_INVALID) {
+            fprintf(stderr, "dlsvc: unused handle (%#x) opcode=%#x\n",
+                    request_handle, msg->opcode);
+            mx_handle_close(request_handle);
+        }
+        return handle_load_objects(h, msg, sz, terminated, loader, loader_arg);
     case LOADER_SVC_OP_DEBUG_PRINT:
         log_printf(sys_log, "dlsvc: debug: %s\n", (const char*) msg->data);
         msg->arg = MX_OK;
@@ -391,6 +600,27 @@ mx_status_t loader_service_create_fs(const char* name,
     return loader_service_create(name, &fs_ops, NULL, out);
 }
 
+mx_status_t loader_service_create_fs_paths(const char* name,
+                                           const char* const* paths,
+                                           size_t count,
+                                           loader_service_t** out) {
+    if (paths == NULL || count == 0) {
+        return MX_ERR_INVALID_ARGS;
+    }
+    // Loader services are never destroyed, so neither is this.
+    fs_libpaths_t* search = malloc(sizeof(*search));
+    if (search == NULL) {
+        return MX_ERR_NO_MEMORY;
+    }
+    search->paths = paths;
+    search->count = count;
+    mx_status_t r = loader_service_create(name, &fs_ops, search, out);
+    if (r != MX_OK) {
+        free(search);
+    }
+    return r;
+}
+
 static mx_status_t multiloader_cb(mx_handle_t h, void* cb, void* cookie) {
     if (h == 0) {
         // close notification, which we can ignore
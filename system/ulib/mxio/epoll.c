@@ -0,0 +1,399 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/port.h>
+#include <mxio/io.h>
+#include <mxio/util.h>
+
+#include "private.h"
+#include "unistd.h"
+
+// epoll is implemented on top of a port.
+//
+// Every registered fd gets an async wait on the handle its mxio_t hands out
+// from wait_begin(), keyed by the fd and a generation number. Level-triggered
+// and one-shot registrations use single-shot waits which epoll_wait() re-arms
+// after reporting; edge-triggered registrations use a repeating wait. Unlike
+// poll(), the cost of epoll_wait() therefore depends on the number of ready
+// fds, not on the number of registered ones.
+//
+// Since the kernel may deliver a packet for a wait which has already been
+// cancelled, packets whose key no longer matches the registration for the
+// fd are dropped.
+//
+// A registration holds a reference to the mxio_t it was made for. If the fd
+// is closed, the wait is cancelled by the kernel along with its handle and
+// the registration goes quiet; it is replaced if the fd number is reused
+// and registered again, and released by EPOLL_CTL_DEL or when the epoll fd
+// itself is closed.
+
+static_assert(EPOLLIN == POLLIN, "EPOLL and POLL events must match");
+static_assert(EPOLLPRI == POLLPRI, "EPOLL and POLL events must match");
+static_assert(EPOLLOUT == POLLOUT, "EPOLL and POLL events must match");
+static_assert(EPOLLERR == POLLERR, "EPOLL and POLL events must match");
+static_assert(EPOLLHUP == POLLHUP, "EPOLL and POLL events must match");
+static_assert(EPOLLRDHUP == POLLRDHUP, "EPOLL and POLL events must match");
+
+#define EPOLL_KEY(gen, fd) (((uint64_t)(gen) << 32) | (uint32_t)(fd))
+#define EPOLL_KEY_FD(key) ((int)((key) & 0xffffffffu))
+
+typedef struct mxio_epoll_item {
+    // the registered object; a reference is held
+    mxio_t* io;
+
+    // EPOLL* events of interest, and EPOLLET / EPOLLONESHOT
+    uint32_t events;
+    epoll_data_t data;
+
+    // what to wait on, as reported by wait_begin()
+    mx_handle_t handle;
+    mx_signals_t signals;
+
+    // key of the current async wait
+    uint64_t key;
+    bool armed;
+
+    // the epoll_wait() batch this item was last reported in, and where
+    uint64_t batch;
+    int slot;
+} mxio_epoll_item_t;
+
+typedef struct mxio_epoll {
+    // base mxio io object
+    mxio_t io;
+
+    mx_handle_t port;
+
+    // guards everything below
+    mtx_t lock;
+    uint32_t generation;
+    uint64_t batch;
+    mxio_epoll_item_t* items[MAX_MXIO_FD];
+} mxio_epoll_t;
+
+static mx_status_t epoll_arm_locked(mxio_epoll_t* ep, mxio_epoll_item_t* item) {
+    uint32_t options = MX_WAIT_ASYNC_ONCE;
+    if ((item->events & (EPOLLET | EPOLLONESHOT)) == EPOLLET) {
+        options = MX_WAIT_ASYNC_REPEATING;
+    }
+    mx_status_t status = mx_object_wait_async(item->handle, ep->port, item->key,
+                                              item->signals, options);
+    item->armed = (status == MX_OK);
+    return status;
+}
+
+static void epoll_disarm_locked(mxio_epoll_t* ep, mxio_epoll_item_t* item) {
+    if (item->armed) {
+        // This fails harmlessly if the handle has since been closed.
+        mx_port_cancel(ep->port, item->handle, item->key);
+        item->armed = false;
+    }
+}
+
+// Points |item| at the current state of its fd and registers a fresh wait.
+static mx_status_t epoll_register_locked(mxio_epoll_t* ep, mxio_epoll_item_t* item, int fd) {
+    item->io->ops->wait_begin(item->io, item->events & ~(EPOLLET | EPOLLONESHOT),
+                              &item->handle, &item->signals);
+    if (item->handle == MX_HANDLE_INVALID) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+    item->key = EPOLL_KEY(++ep->generation, fd);
+    item->batch = 0;
+    return epoll_arm_locked(ep, item);
+}
+
+static void epoll_remove_locked(mxio_epoll_t* ep, int fd) {
+    mxio_epoll_item_t* item = ep->items[fd];
+    ep->items[fd] = NULL;
+    epoll_disarm_locked(ep, item);
+    mxio_release(item->io);
+    free(item);
+}
+
+static mx_status_t mxio_epoll_close(mxio_t* io) {
+    mxio_epoll_t* ep = (mxio_epoll_t*)io;
+    mtx_lock(&ep->lock);
+    for (int fd = 0; fd < MAX_MXIO_FD; fd++) {
+        if (ep->items[fd] != NULL) {
+            epoll_remove_locked(ep, fd);
+        }
+    }
+    mx_handle_t port = ep->port;
+    ep->port = MX_HANDLE_INVALID;
+    mtx_unlock(&ep->lock);
+    return mx_handle_close(port);
+}
+
+static mxio_ops_t mxio_epoll_ops = {
+    .read = mxio_default_read,
+    .read_at = mxio_default_read_at,
+    .write = mxio_default_write,
+    .write_at = mxio_default_write_at,
+    .recvfrom = mxio_default_recvfrom,
+    .sendto = mxio_default_sendto,
+    .recvmsg = mxio_default_recvmsg,
+    .sendmsg = mxio_default_sendmsg,
+    .seek = mxio_default_seek,
+    .misc = mxio_default_misc,
+    .close = mxio_epoll_close,
+    .open = mxio_default_open,
+    .clone = mxio_default_clone,
+    .ioctl = mxio_default_ioctl,
+    .unwrap = mxio_default_unwrap,
+    .shutdown = mxio_default_shutdown,
+    .wait_begin = mxio_default_wait_begin,
+    .wait_end = mxio_default_wait_end,
+    .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = mxio_default_get_vmo,
+};
+
+// Returns the epoll object behind |epfd|, with a reference held.
+static mxio_epoll_t* fd_to_epoll(int epfd) {
+    mxio_t* io = fd_to_io(epfd);
+    if (io == NULL) {
+        errno = EBADF;
+        return NULL;
+    }
+    if (!(io->flags & MXIO_FLAG_EPOLL)) {
+        mxio_release(io);
+        errno = EINVAL;
+        return NULL;
+    }
+    return (mxio_epoll_t*)io;
+}
+
+int epoll_create1(int flags) {
+    if (flags & ~EPOLL_CLOEXEC) {
+        return ERRNO(EINVAL);
+    }
+    mxio_epoll_t* ep = calloc(1, sizeof(*ep));
+    if (ep == NULL) {
+        return ERRNO(ENOMEM);
+    }
+    mx_status_t status;
+    if ((status = mx_port_create(0, &ep->port)) != MX_OK) {
+        free(ep);
+        return ERROR(status);
+    }
+    mtx_init(&ep->lock, mtx_plain);
+    ep->io.ops = &mxio_epoll_ops;
+    ep->io.magic = MXIO_MAGIC;
+    ep->io.refcount = 1;
+    ep->io.flags |= MXIO_FLAG_EPOLL;
+    if (flags & EPOLL_CLOEXEC) {
+        ep->io.flags |= MXIO_FLAG_CLOEXEC;
+    }
+
+    int fd;
+    if ((fd = mxio_bind_to_fd(&ep->io, -1, 0)) < 0) {
+        mxio_close(&ep->io);
+        mxio_release(&ep->io);
+        return -1;
+    }
+    return fd;
+}
+
+int epoll_create(int size) {
+    if (size <= 0) {
+        return ERRNO(EINVAL);
+    }
+    return epoll_create1(0);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+    if ((fd < 0) || (fd >= MAX_MXIO_FD)) {
+        return ERRNO(EBADF);
+    }
+    if ((op != EPOLL_CTL_DEL) && (event == NULL)) {
+        return ERRNO(EFAULT);
+    }
+    mxio_epoll_t* ep;
+    if ((ep = fd_to_epoll(epfd)) == NULL) {
+        return -1;
+    }
+    mxio_t* io;
+    if ((io = fd_to_io(fd)) == NULL) {
+        mxio_release(&ep->io);
+        return ERRNO(EBADF);
+    }
+    if (io == &ep->io) {
+        mxio_release(io);
+        mxio_release(&ep->io);
+        return ERRNO(EINVAL);
+    }
+
+    int r = 0;
+    mx_status_t status;
+    mtx_lock(&ep->lock);
+    mxio_epoll_item_t* item = ep->items[fd];
+    if ((item != NULL) && (item->io != io)) {
+        // The fd was closed and reused since it was registered.
+        epoll_remove_locked(ep, fd);
+        item = NULL;
+    }
+
+    switch (op) {
+    case EPOLL_CTL_ADD:
+        if (item != NULL) {
+            r = ERRNO(EEXIST);
+            break;
+        }
+        if ((item = calloc(1, sizeof(*item))) == NULL) {
+            r = ERRNO(ENOMEM);
+            break;
+        }
+        item->io = io;
+        item->events = event->events;
+        item->data = event->data;
+        if ((status = epoll_register_locked(ep, item, fd)) != MX_OK) {
+            free(item);
+            r = (status == MX_ERR_NOT_SUPPORTED) ? ERRNO(EPERM) : ERROR(status);
+            break;
+        }
+        ep->items[fd] = item;
+        // The registration keeps the reference taken by fd_to_io().
+        io = NULL;
+        break;
+    case EPOLL_CTL_MOD:
+        if (item == NULL) {
+            r = ERRNO(ENOENT);
+            break;
+        }
+        epoll_disarm_locked(ep, item);
+        item->events = event->events;
+        item->data = event->data;
+        if ((status = epoll_register_locked(ep, item, fd)) != MX_OK) {
+            epoll_remove_locked(ep, fd);
+            r = ERROR(status);
+        }
+        break;
+    case EPOLL_CTL_DEL:
+        if (item == NULL) {
+            r = ERRNO(ENOENT);
+            break;
+        }
+        epoll_remove_locked(ep, fd);
+        break;
+    default:
+        r = ERRNO(EINVAL);
+        break;
+    }
+    mtx_unlock(&ep->lock);
+
+    if (io != NULL) {
+        mxio_release(io);
+    }
+    mxio_release(&ep->io);
+    return r;
+}
+
+// Turns |packet| into an event in |events|, merging it with an event for
+// the same fd already reported in this batch. Items which must be re-armed
+// once the batch is complete are appended to |rearm|.
+static void epoll_deliver_locked(mxio_epoll_t* ep, const mx_port_packet_t* packet,
+                                 struct epoll_event* events, int* count,
+                                 mxio_epoll_item_t** rearm, int* rearm_count) {
+    int fd = EPOLL_KEY_FD(packet->key);
+    if ((fd < 0) || (fd >= MAX_MXIO_FD)) {
+        return;
+    }
+    mxio_epoll_item_t* item = ep->items[fd];
+    if ((item == NULL) || (item->key != packet->key)) {
+        // stale packet for a wait which has been cancelled
+        return;
+    }
+    if (packet->type == MX_PKT_TYPE_SIGNAL_ONE) {
+        item->armed = false;
+    }
+
+    mx_signals_t observed = packet->signal.observed;
+    if (!(item->events & EPOLLET)) {
+        // The packet may have been queued when the wait was re-armed, before
+        // the caller consumed what was last reported; level-triggered
+        // readiness is a matter of the current state.
+        mx_signals_t pending;
+        mx_status_t status = mx_object_wait_one(item->handle, item->signals, 0, &pending);
+        if ((status == MX_OK) || (status == MX_ERR_TIMED_OUT)) {
+            observed = pending;
+        }
+    }
+
+    uint32_t ready = 0;
+    item->io->ops->wait_end(item->io, observed, &ready);
+    // mask unrequested events except HUP/ERR
+    ready &= item->events | EPOLLHUP | EPOLLERR;
+
+    // One-shot registrations stay disarmed once they have reported something.
+    if (!item->armed && (!(item->events & EPOLLONESHOT) || (ready == 0))) {
+        rearm[(*rearm_count)++] = item;
+    }
+    if (ready == 0) {
+        return;
+    }
+    if (item->batch == ep->batch) {
+        events[item->slot].events |= ready;
+        return;
+    }
+    item->batch = ep->batch;
+    item->slot = *count;
+    events[*count].events = ready;
+    events[*count].data = item->data;
+    (*count)++;
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+    if (maxevents <= 0) {
+        return ERRNO(EINVAL);
+    }
+    // No more fds than this can be registered, so none can be reported.
+    if (maxevents > MAX_MXIO_FD) {
+        maxevents = MAX_MXIO_FD;
+    }
+    mxio_epoll_t* ep;
+    if ((ep = fd_to_epoll(epfd)) == NULL) {
+        return -1;
+    }
+
+    mx_time_t deadline = (timeout >= 0) ? mx_deadline_after(MX_MSEC(timeout)) : MX_TIME_INFINITE;
+    mxio_epoll_item_t* rearm[MAX_MXIO_FD];
+    int count = 0;
+    mx_status_t status;
+    mx_port_packet_t packet;
+    while ((status = mx_port_wait(ep->port, deadline, &packet, 0)) == MX_OK) {
+        // Take whatever else is already queued, without blocking, before
+        // re-arming anything: a level-triggered fd which is still ready
+        // would otherwise be reported twice.
+        int rearm_count = 0;
+        mtx_lock(&ep->lock);
+        ep->batch++;
+        do {
+            epoll_deliver_locked(ep, &packet, events, &count, rearm, &rearm_count);
+        } while ((count < maxevents) && (rearm_count < MAX_MXIO_FD) &&
+                 (mx_port_wait(ep->port, 0, &packet, 0) == MX_OK));
+        for (int i = 0; i < rearm_count; i++) {
+            epoll_arm_locked(ep, rearm[i]);
+        }
+        mtx_unlock(&ep->lock);
+
+        if (count > 0) {
+            break;
+        }
+        // Every packet was stale, or reported nothing of interest.
+    }
+    mxio_release(&ep->io);
+
+    if ((status == MX_OK) || (status == MX_ERR_TIMED_OUT)) {
+        return count;
+    }
+    return ERROR(status);
+}
@@ -16,6 +16,10 @@
 // at least this size.
 #define MXIO_CHUNK_SIZE 8192
 
+// Size of the transfer VMO which remoteio servers may grant to a
+// connection, to move larger reads and writes through (see O_XFER_VMO).
+#define MXIO_VMO_XFER_SIZE (256 * 1024)
+
 // Maximum size for an ioctl input.
 #define MXIO_IOCTL_MAX_INPUT 1024
 
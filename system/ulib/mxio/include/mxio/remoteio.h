@@ -51,7 +51,11 @@ __BEGIN_CDECLS
 #define MXRIO_LINK        (0x0000001a | MXRIO_ONE_HANDLE)
 #define MXRIO_MMAP         0x0000001b
 #define MXRIO_FCNTL        0x0000001c
-#define MXRIO_NUM_OPS      29
+#define MXRIO_READ_VMO     0x0000001d
+#define MXRIO_READ_AT_VMO  0x0000001e
+#define MXRIO_WRITE_VMO    0x0000001f
+#define MXRIO_WRITE_AT_VMO 0x00000020
+#define MXRIO_NUM_OPS      33
 
 #define MXRIO_OP(n)        ((n) & 0x3FF) // opcode
 #define MXRIO_HC(n)        (((n) >> 8) & 3) // handle count
@@ -64,7 +68,8 @@ __BEGIN_CDECLS
     "read_at", "write_at", "truncate", "rename", \
     "connect", "bind", "listen", "getsockname", \
     "getpeername", "getsockopt", "setsockopt", "getaddrinfo", \
-    "setattr", "sync", "link", "mmap", "fcntl" }
+    "setattr", "sync", "link", "mmap", "fcntl", "read_vmo", \
+    "read_at_vmo", "write_vmo", "write_at_vmo" }
 
 // dispatcher callback return code that there were no messages to read
 #define ERR_DISPATCHER_NO_WORK MX_ERR_SHOULD_WAIT
@@ -133,6 +138,12 @@ typedef struct {
     mx_handle_t handle[MXIO_MAX_HANDLES];
 } mxrio_object_t;
 
+// The extra data of a REMOTE object granted a transfer VMO by an OPEN with
+// O_XFER_VMO. The VMO is the last handle; its handle cannot resize it.
+typedef struct mxrio_xfer_vmo {
+    uint64_t size;
+} mxrio_xfer_vmo_t;
+
 
 struct mxrio_msg {
     mx_txid_t txid;                    // transaction id
@@ -204,6 +215,16 @@ static_assert(MXIO_CHUNK_SIZE >= PATH_MAX, "MXIO_CHUNK_SIZE must be large enough
 // LINK        0          0        <name1>0<name2>0  0           -               -
 // MMAP        maxreply   0        mmap_data_msg     0           mmap_data_msg   vmohandle
 // FCNTL       cmd        flags    0                 flags       -               -
+// READ_VMO    maxread    0        -                 newoffset   -               -
+// READ_AT_VMO maxread    offset   -                 0           -               -
+// WRITE_VMO   len        0        -                 newoffset   -               -
+// WRITE_AT_VMO len       offset   -                 0           -               -
+//
+// The *_VMO variants of READ and WRITE move their bytes through the start of
+// the transfer VMO granted when the connection was opened (see
+// mxrio_xfer_vmo_t), rather than through data[], allowing up to the size of
+// that VMO per call. Servers which did not grant one reply with
+// MX_ERR_BAD_STATE.
 //
 // proposed:
 //
@@ -19,6 +19,13 @@ struct mxrio {
 
     // transaction id used for synchronous remoteio calls
     _Atomic mx_txid_t txid;
+
+    // Where the transfer VMO granted when the connection was opened (see
+    // O_XFER_VMO) is mapped, if it was; 0 otherwise. Set before the
+    // connection is shared. One transfer uses it at a time, under xfer_lock.
+    mtx_t xfer_lock;
+    uintptr_t xfer_buf;
+    size_t xfer_size;
 };
 
 // These are for the benefit of namespace.c
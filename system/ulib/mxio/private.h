@@ -94,6 +94,18 @@ typedef struct mxio {
 // dupcount tracks how many fdtab entries an mxio object
 // is in.  close() reduces the dupcount, and only actually
 // closes the underlying object when it reaches zero.
+//
+// Lookups of fds (fd_to_io()) do not take the mxio_lock.
+// Instead, a lookup counts itself in one of the two reader
+// counts of the slot's mxio_fdtab_readers entry, chosen by
+// the slot's epoch, while it loads the slot and upref's the
+// mxio object it finds.  Changes to fdtab slots are made
+// with the mxio_lock held, and after taking an mxio object
+// out of a slot, __mxio_fdtab_quiesce() must be called
+// before the fdtab's reference to it is released, so that
+// a lookup never upref's an object which has been free()'d.
+// Quiescing flips the epoch first, so that it only waits
+// for lookups which started before the slot was changed.
 
 #define MXIO_MAGIC 0x4f49584d // MXIO
 
@@ -199,6 +211,20 @@ void __mxio_startup_handles_init(uint32_t num, mx_handle_t handles[],
 
 void __mxio_rchannel_init(void) __attribute__((visibility("hidden")));
 
+// Wait for lock-free lookups which may have seen the previous
+// occupant of fdtab slot fd to finish.  Called with mxio_lock
+// held, after the slot has been changed.  Lookups which start
+// meanwhile are not waited for.
+void __mxio_fdtab_quiesce(int fd) __attribute__((visibility("hidden")));
+
+// In-flight lookups of one fdtab slot.  Each slot has a
+// cache line to itself, so that lookups of different fds
+// on different threads do not contend.
+typedef struct {
+    atomic_uint epoch;
+    atomic_int readers[2];
+} __ALIGNED(64) mxio_fdtab_readers_t;
+
 typedef struct {
     mtx_t lock;
     mtx_t cwd_lock;
@@ -206,7 +232,8 @@ typedef struct {
     mode_t umask;
     mxio_t* root;
     mxio_t* cwd;
-    mxio_t* fdtab[MAX_MXIO_FD];
+    _Atomic(mxio_t*) fdtab[MAX_MXIO_FD];
+    mxio_fdtab_readers_t fdtab_readers[MAX_MXIO_FD];
     mxio_ns_t* ns;
     char cwd_path[PATH_MAX];
 } mxio_state_t;
@@ -219,5 +246,6 @@ extern mxio_state_t __mxio_global_state;
 #define mxio_cwd_lock (__mxio_global_state.cwd_lock)
 #define mxio_cwd_path (__mxio_global_state.cwd_path)
 #define mxio_fdtab (__mxio_global_state.fdtab)
+#define mxio_fdtab_readers (__mxio_global_state.fdtab_readers)
 #define mxio_root_init (__mxio_global_state.init)
 #define mxio_root_ns (__mxio_global_state.ns)
@@ -333,6 +333,38 @@ ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
     return r;
 }
 
+// Maps the transfer VMO granted to the connection when it was opened
+// (see O_XFER_VMO), consuming |vmo|. Without it, reads and writes are
+// moved through messages.
+static void mxrio_attach_xfer(mxrio_t* rio, mx_handle_t vmo, uint64_t size) {
+    uintptr_t buf;
+    if ((size >= MXIO_CHUNK_SIZE) && (size <= MXIO_VMO_XFER_SIZE) &&
+        (mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                     MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &buf) == MX_OK)) {
+        rio->xfer_buf = buf;
+        rio->xfer_size = size;
+    }
+    mx_handle_close(vmo);
+}
+
+static void mxrio_detach_xfer(mxrio_t* rio) {
+    if (rio->xfer_buf != 0) {
+        mx_vmar_unmap(mx_vmar_root_self(), rio->xfer_buf, rio->xfer_size);
+        rio->xfer_buf = 0;
+        rio->xfer_size = 0;
+    }
+}
+
+// Transfers larger than a single message are made through the connection's
+// transfer VMO, if it has one. Returns true, with rio->xfer_lock held, if so.
+static bool mxrio_xfer_acquire(mxrio_t* rio, size_t len) {
+    if ((len <= MXIO_CHUNK_SIZE) || (rio->xfer_buf == 0)) {
+        return false;
+    }
+    mtx_lock(&rio->xfer_lock);
+    return true;
+}
+
 static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t len, off_t offset) {
     mxrio_t* rio = (mxrio_t*)io;
     const uint8_t* data = _data;
@@ -341,15 +373,27 @@ static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t l
     mxrio_msg_t msg;
     ssize_t xfer;
 
+    bool vmo = mxrio_xfer_acquire(rio, len);
+    size_t chunk = vmo ? rio->xfer_size : MXIO_CHUNK_SIZE;
+    bool at = (op == MXRIO_WRITE_AT);
+    if (vmo) {
+        op = at ? MXRIO_WRITE_AT_VMO : MXRIO_WRITE_VMO;
+    }
+
     while (len > 0) {
-        xfer = (len > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : len;
+        xfer = (len > chunk) ? chunk : len;
 
         memset(&msg, 0, MXRIO_HDR_SZ);
         msg.op = op;
-        msg.datalen = xfer;
-        if (op == MXRIO_WRITE_AT)
+        if (at)
             msg.arg2.off = offset;
-        memcpy(msg.data, data, xfer);
+        if (vmo) {
+            msg.arg = xfer;
+            memcpy((void*)rio->xfer_buf, data, xfer);
+        } else {
+            msg.datalen = xfer;
+            memcpy(msg.data, data, xfer);
+        }
 
         if ((r = mxrio_txn(rio, &msg)) < 0) {
             break;
@@ -363,13 +407,16 @@ static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t l
         count += r;
         data += r;
         len -= r;
-        if (op == MXRIO_WRITE_AT)
+        if (at)
             offset += r;
         // stop at short read
         if (r < xfer) {
             break;
         }
     }
+    if (vmo) {
+        mtx_unlock(&rio->xfer_lock);
+    }
     return count ? count : r;
 }
 
@@ -389,13 +436,20 @@ static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off
     mxrio_msg_t msg;
     ssize_t xfer;
 
+    bool vmo = mxrio_xfer_acquire(rio, len);
+    size_t chunk = vmo ? rio->xfer_size : MXIO_CHUNK_SIZE;
+    bool at = (op == MXRIO_READ_AT);
+    if (vmo) {
+        op = at ? MXRIO_READ_AT_VMO : MXRIO_READ_VMO;
+    }
+
     while (len > 0) {
-        xfer = (len > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : len;
+        xfer = (len > chunk) ? chunk : len;
 
         memset(&msg, 0, MXRIO_HDR_SZ);
         msg.op = op;
         msg.arg = xfer;
-        if (op == MXRIO_READ_AT)
+        if (at)
             msg.arg2.off = offset;
 
         if ((r = mxrio_txn(rio, &msg)) < 0) {
@@ -403,15 +457,22 @@ static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off
         }
         discard_handles(msg.handle, msg.hcount);
 
-        if ((r > (int)msg.datalen) || (r > xfer)) {
+        if (r > xfer) {
+            r = MX_ERR_IO;
+            break;
+        }
+        if (vmo) {
+            memcpy(data, (const void*)rio->xfer_buf, r);
+        } else if (r > (int)msg.datalen) {
             r = MX_ERR_IO;
             break;
+        } else {
+            memcpy(data, msg.data, r);
         }
-        memcpy(data, msg.data, r);
         count += r;
         data += r;
         len -= r;
-        if (op == MXRIO_READ_AT)
+        if (at)
             offset += r;
 
         // stop at short read
@@ -419,6 +480,9 @@ static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off
             break;
         }
     }
+    if (vmo) {
+        mtx_unlock(&rio->xfer_lock);
+    }
     return count ? count : r;
 }
 
@@ -460,6 +524,8 @@ mx_status_t mxrio_close(mxio_t* io) {
         discard_handles(msg.handle, msg.hcount);
     }
 
+    mxrio_detach_xfer(rio);
+
     mx_handle_t h = rio->h;
     rio->h = 0;
     mx_handle_close(h);
@@ -702,7 +768,14 @@ mx_status_t mxio_from_handles(uint32_t type, mx_handle_t* handles, int hcount,
     mx_status_t r;
     mxio_t* io;
     switch (type) {
-    case MXIO_PROTOCOL_REMOTE:
+    case MXIO_PROTOCOL_REMOTE: {
+        // A transfer VMO granted by OPEN comes after the other handles.
+        mx_handle_t xfer = MX_HANDLE_INVALID;
+        mxrio_xfer_vmo_t xfer_info;
+        if ((esize == sizeof(xfer_info)) && (hcount >= 2)) {
+            memcpy(&xfer_info, extra, sizeof(xfer_info));
+            xfer = handles[--hcount];
+        }
         if (hcount == 1) {
             io = mxio_remote_create(handles[0], 0);
             xprintf("rio (%x,%x) -> %p\n", handles[0], 0, io);
@@ -710,16 +783,20 @@ mx_status_t mxio_from_handles(uint32_t type, mx_handle_t* handles, int hcount,
             io = mxio_remote_create(handles[0], handles[1]);
             xprintf("rio (%x,%x) -> %p\n", handles[0], handles[1], io);
         } else {
+            mx_handle_close(xfer);
             r = MX_ERR_INVALID_ARGS;
             break;
         }
         if (io == NULL) {
+            mx_handle_close(xfer);
             return MX_ERR_NO_RESOURCES;
-        } else {
-            *out = io;
-            return MX_OK;
         }
-        break;
+        if (xfer != MX_HANDLE_INVALID) {
+            mxrio_attach_xfer((mxrio_t*)io, xfer, xfer_info.size);
+        }
+        *out = io;
+        return MX_OK;
+    }
     case MXIO_PROTOCOL_SERVICE:
         if (hcount != 1) {
             r = MX_ERR_INVALID_ARGS;
@@ -893,6 +970,7 @@ static mx_status_t mxrio_unwrap(mxio_t* io, mx_handle_t* handles, uint32_t* type
     } else {
         r = 1;
     }
+    mxrio_detach_xfer(rio);
     free(io);
     return r;
 }
@@ -955,5 +1033,6 @@ mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
     atomic_init(&rio->io.refcount, 1);
     rio->h = h;
     rio->h2 = e;
+    mtx_init(&rio->xfer_lock, mtx_plain);
     return &rio->io;
 }
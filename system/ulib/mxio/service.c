@@ -69,6 +69,7 @@ mx_status_t mxio_get_service_handle(int fd, mx_handle_t* out) {
     mxio_t* io = mxio_fdtab[fd];
     io->dupcount--;
     mxio_fdtab[fd] = NULL;
+    __mxio_fdtab_quiesce(fd);
     if (io->dupcount > 0) {
         // still alive in other fdtab slots
         // this fd goes away but we can't give away the handle
@@ -65,6 +65,7 @@ void mxio_install_root(mxio_t* root) {
 // fdtab prior to binding.
 int mxio_bind_to_fd(mxio_t* io, int fd, int starting_fd) {
     mxio_t* io_to_close = NULL;
+    bool still_bound = false;
 
     mtx_lock(&mxio_lock);
     if (fd < 0) {
@@ -86,17 +87,21 @@ int mxio_bind_to_fd(mxio_t* io, int fd, int starting_fd) {
         io_to_close = mxio_fdtab[fd];
         if (io_to_close) {
             io_to_close->dupcount--;
-            if (io_to_close->dupcount > 0) {
-                // still alive in another fdtab slot
-                mxio_release(io_to_close);
-                io_to_close = NULL;
-            }
+            still_bound = (io_to_close->dupcount > 0);
         }
     }
 
 free_fd_found:
     io->dupcount++;
     mxio_fdtab[fd] = io;
+    if (io_to_close) {
+        __mxio_fdtab_quiesce(fd);
+        if (still_bound) {
+            // still alive in another fdtab slot
+            mxio_release(io_to_close);
+            io_to_close = NULL;
+        }
+    }
     mtx_unlock(&mxio_lock);
 
     if (io_to_close) {
@@ -113,7 +118,7 @@ free_fd_found:
 mx_status_t mxio_unbind_from_fd(int fd, mxio_t** out) {
     mx_status_t status;
     mtx_lock(&mxio_lock);
-    if (fd >= MAX_MXIO_FD) {
+    if ((fd < 0) || (fd >= MAX_MXIO_FD)) {
         status = MX_ERR_INVALID_ARGS;
         goto done;
     }
@@ -126,12 +131,16 @@ mx_status_t mxio_unbind_from_fd(int fd, mxio_t** out) {
         status = MX_ERR_UNAVAILABLE;
         goto done;
     }
+    // Detach io before checking its refcount, so that a concurrent
+    // lookup can't upref it after the check.
+    mxio_fdtab[fd] = NULL;
+    __mxio_fdtab_quiesce(fd);
     if (atomic_load(&io->refcount) > 1) {
+        mxio_fdtab[fd] = io;
         status = MX_ERR_UNAVAILABLE;
         goto done;
     }
     io->dupcount = 0;
-    mxio_fdtab[fd] = NULL;
     *out = io;
     status = MX_OK;
 done:
@@ -143,21 +152,39 @@ mxio_t* __mxio_fd_to_io(int fd) {
     if ((fd < 0) || (fd >= MAX_MXIO_FD)) {
         return NULL;
     }
-    mxio_t* io = NULL;
-    mtx_lock(&mxio_lock);
-    if ((io = mxio_fdtab[fd]) != NULL) {
+    // No lock: a writer which changes the slot waits in
+    // __mxio_fdtab_quiesce() until we are done with it.
+    mxio_fdtab_readers_t* r = &mxio_fdtab_readers[fd];
+    atomic_int* readers = &r->readers[atomic_load(&r->epoch) & 1];
+    atomic_fetch_add(readers, 1);
+    mxio_t* io = mxio_fdtab[fd];
+    if (io != NULL) {
         mxio_acquire(io);
     }
-    mtx_unlock(&mxio_lock);
+    atomic_fetch_sub(readers, 1);
     return io;
 }
 
+void __mxio_fdtab_quiesce(int fd) {
+    // Lookups counted under the new epoch started after the slot
+    // was changed and see the new occupant, so only the previous
+    // epoch's count is waited for.  It can only be raised by
+    // lookups which read the epoch before the flip, so it drains
+    // even while the fd is in heavy use.
+    mxio_fdtab_readers_t* r = &mxio_fdtab_readers[fd];
+    unsigned epoch = atomic_fetch_add(&r->epoch, 1);
+    while (atomic_load(&r->readers[epoch & 1]) != 0) {
+        thrd_yield();
+    }
+}
+
 static void mxio_exit(void) {
     mtx_lock(&mxio_lock);
     for (int fd = 0; fd < MAX_MXIO_FD; fd++) {
         mxio_t* io = mxio_fdtab[fd];
         if (io) {
             mxio_fdtab[fd] = NULL;
+            __mxio_fdtab_quiesce(fd);
             io->dupcount--;
             if (io->dupcount == 0) {
                 io->ops->close(io);
@@ -1019,6 +1046,7 @@ int close(int fd) {
     mxio_t* io = mxio_fdtab[fd];
     io->dupcount--;
     mxio_fdtab[fd] = NULL;
+    __mxio_fdtab_quiesce(fd);
     if (io->dupcount > 0) {
         // still alive in other fdtab slots
         mtx_unlock(&mxio_lock);
@@ -1322,6 +1350,11 @@ static int vopenat(int dirfd, const char* path, int flags, va_list args) {
         }
         mode = va_arg(args, uint32_t) & 0777;
     }
+    // Ask for a transfer VMO for reads and writes larger than a message;
+    // only files served by remoteio are granted one.
+    if (!(flags & O_DIRECTORY)) {
+        flags |= O_XFER_VMO;
+    }
     if ((r = __mxio_open_at(&io, dirfd, path, flags, mode)) < 0) {
         return ERROR(r);
     }
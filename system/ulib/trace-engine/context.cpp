@@ -4,12 +4,17 @@
 
 #include "context_impl.h"
 
+#include <string.h>
+
 #include <magenta/compiler.h>
 #include <magenta/syscalls.h>
 
 #include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
 #include <fbl/atomic.h>
-#include <fbl/intrusive_hash_table.h>
+#include <fbl/auto_lock.h>
+#include <fbl/intrusive_resizable_hash_table.h>
+#include <fbl/macros.h>
 #include <fbl/unique_ptr.h>
 #include <mx/process.h>
 #include <mx/thread.h>
@@ -65,7 +70,7 @@ void GetObjectName(mx_handle_t handle, char* name_buf, size_t name_buf_size,
 fbl::atomic<uint32_t> g_next_generation{1u};
 
 // A string table entry.
-struct StringEntry : public fbl::SinglyLinkedListable<StringEntry*> {
+struct StringEntry : public fbl::SinglyLinkedListable<fbl::unique_ptr<StringEntry>> {
     // Attempted to assign an index.
     static constexpr uint32_t kAllocIndexAttempted = 1u << 0;
     // Successfully assigned an index.
@@ -75,14 +80,17 @@ struct StringEntry : public fbl::SinglyLinkedListable<StringEntry*> {
     // Category is enabled.
     static constexpr uint32_t kCategoryEnabled = 1u << 3;
 
+    explicit StringEntry(const char* string_literal)
+        : string_literal(string_literal) {}
+
     // The string literal itself.
-    const char* string_literal;
+    const char* const string_literal;
 
     // Flags for the string entry.
-    uint32_t flags;
+    uint32_t flags = 0u;
 
     // The index with which the string was associated, or 0 if none.
-    trace_string_index_t index;
+    trace_string_index_t index = 0u;
 
     // Used by the hash table.
     const char* GetKey() const { return string_literal; }
@@ -91,8 +99,9 @@ struct StringEntry : public fbl::SinglyLinkedListable<StringEntry*> {
 
 // Cached thread and string data for a context.
 // Each thread has its own cache of context state to avoid locking overhead
-// while writing trace events in the common case.  There may be some
-// duplicate registration of strings across threads.
+// while writing trace events in the common case.  Strings which miss in the
+// cache are looked up in the context's shared string table before being
+// registered, so they are rarely registered more than once per trace.
 struct ContextCache {
     ContextCache() = default;
     ~ContextCache() { string_table.clear(); }
@@ -103,16 +112,10 @@ struct ContextCache {
     // Thread reference created when this thread was registered.
     trace_thread_ref_t thread_ref{};
 
-    // Maximum number of strings to cache per thread.
-    static constexpr size_t kMaxStringEntries = 256;
-
     // String table.
-    // Provides a limited amount of storage for rapidly looking up string literals
-    // registered by this thread.
-    fbl::HashTable<const char*, StringEntry*> string_table;
-
-    // Storage for the string entries.
-    StringEntry string_entries[kMaxStringEntries];
+    // Grows with the number of distinct string literals registered by this
+    // thread so that lookups stay cheap however many are in use.
+    fbl::ResizableHashTable<const char*, fbl::unique_ptr<StringEntry>> string_table;
 };
 thread_local fbl::unique_ptr<ContextCache> tls_cache{};
 
@@ -124,7 +127,10 @@ ContextCache* GetCurrentContextCache(uint32_t generation) {
         if (unlikely(cache->generation > generation))
             return nullptr;
     } else {
-        cache = new ContextCache();
+        fbl::AllocChecker ac;
+        cache = new (&ac) ContextCache();
+        if (!ac.check())
+            return nullptr;
         tls_cache.reset(cache);
     }
     cache->generation = generation;
@@ -141,18 +147,16 @@ StringEntry* CacheStringEntry(uint32_t generation,
 
     auto it = cache->string_table.find(string_literal);
     if (likely(it.IsValid()))
-        return it.CopyPointer();
+        return &*it;
 
-    size_t count = cache->string_table.size();
-    if (unlikely(count == ContextCache::kMaxStringEntries))
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<StringEntry> entry(new (&ac) StringEntry(string_literal));
+    if (!ac.check())
         return nullptr;
 
-    StringEntry* entry = &cache->string_entries[count];
-    entry->string_literal = string_literal;
-    entry->flags = 0u;
-    entry->index = 0u;
-    cache->string_table.insert(entry);
-    return entry;
+    StringEntry* result = entry.get();
+    cache->string_table.insert(fbl::move(entry));
+    return result;
 }
 
 inline constexpr uint64_t MakeRecordHeader(RecordType type, size_t size) {
@@ -220,11 +224,40 @@ size_t SizeOfEncodedArgs(const trace_arg_t* args, size_t num_args) {
     return total_size;
 }
 
+// Selects the durable buffer for a |Payload|.
+struct DurableTag {};
+constexpr DurableTag kDurable{};
+
 // Provides support for writing sequences of 64-bit words into a trace buffer.
+// The record is committed when the payload is destroyed.
 class Payload {
 public:
     explicit Payload(trace_context_t* context, size_t num_bytes)
-        : ptr_(context->AllocRecord(num_bytes)) {}
+        : context_(context), start_(context->AllocRecord(num_bytes)),
+          num_bytes_(num_bytes), durable_(false), ptr_(start_) {}
+
+    // Writes a record which other records may refer to into the
+    // durable buffer.
+    Payload(trace_context_t* context, size_t num_bytes, DurableTag)
+        : context_(context), start_(context->AllocDurableRecord(num_bytes)),
+          num_bytes_(num_bytes), durable_(true), ptr_(start_) {}
+
+    Payload(Payload&& other)
+        : context_(other.context_), start_(other.start_),
+          num_bytes_(other.num_bytes_), durable_(other.durable_), ptr_(other.ptr_) {
+        other.start_ = nullptr;
+        other.ptr_ = nullptr;
+    }
+
+    ~Payload() {
+        if (!start_)
+            return;
+        if (durable_) {
+            context_->CommitDurableRecord();
+        } else {
+            context_->CommitRecord(start_, num_bytes_);
+        }
+    }
 
     explicit operator bool() const {
         return ptr_ != nullptr;
@@ -340,7 +373,13 @@ private:
         WriteStringRef(name_ref);
     }
 
+    trace_context_t* const context_;
+    uint64_t* start_;
+    size_t const num_bytes_;
+    bool const durable_;
     uint64_t* ptr_;
+
+    DISALLOW_COPY_AND_ASSIGN_ALLOW_MOVE(Payload);
 };
 
 Payload WriteEventRecordBase(
@@ -377,6 +416,106 @@ Payload WriteEventRecordBase(
     return payload;
 }
 
+// Writes a string record into the durable buffer.
+// Returns false if there was no room, in which case the string index must
+// not be used.
+bool WriteStringRecord(trace_context_t* context,
+                       trace_string_index_t index, const char* string, size_t length) {
+    MX_DEBUG_ASSERT(index != TRACE_ENCODED_STRING_REF_EMPTY);
+    MX_DEBUG_ASSERT(index <= TRACE_ENCODED_STRING_REF_MAX_INDEX);
+
+    if (length > TRACE_ENCODED_STRING_REF_MAX_LENGTH)
+        length = TRACE_ENCODED_STRING_REF_MAX_LENGTH;
+
+    const size_t record_size = sizeof(RecordHeader) +
+                               Pad(length);
+    Payload payload(context, record_size, kDurable);
+    if (!payload)
+        return false;
+    payload
+        .WriteUint64(MakeRecordHeader(RecordType::kString, record_size) |
+                     StringRecordFields::StringIndex::Make(index) |
+                     StringRecordFields::StringLength::Make(length))
+        .WriteBytes(string, length);
+    return true;
+}
+
+// Writes a thread record into the durable buffer.
+// Returns false if there was no room, in which case the thread index must
+// not be used.
+bool WriteThreadRecord(trace_context_t* context,
+                       trace_thread_index_t index,
+                       mx_koid_t process_koid,
+                       mx_koid_t thread_koid) {
+    MX_DEBUG_ASSERT(index != TRACE_ENCODED_THREAD_REF_INLINE);
+    MX_DEBUG_ASSERT(index <= TRACE_ENCODED_THREAD_REF_MAX_INDEX);
+
+    const size_t record_size = sizeof(RecordHeader) +
+                               WordsToBytes(2);
+    Payload payload(context, record_size, kDurable);
+    if (!payload)
+        return false;
+    payload
+        .WriteUint64(MakeRecordHeader(RecordType::kThread, record_size) |
+                     ThreadRecordFields::ThreadIndex::Make(index))
+        .WriteUint64(process_koid)
+        .WriteUint64(thread_koid);
+    return true;
+}
+
+// Gets the index of a string literal registered with the context by any
+// thread, registering it if it has not been yet.
+bool InternStringLiteral(trace_context_t* context, const char* string_literal,
+                         trace_string_index_t* out_index) {
+    bool claimed = false;
+    trace_context_t::StringTable::Slot* slot = context->string_table()->FindOrClaim(
+        reinterpret_cast<uintptr_t>(string_literal), &claimed);
+    if (likely(slot && !claimed)) {
+        trace_string_index_t index = slot->index();
+        if (likely(index)) {
+            *out_index = index;
+            return true;
+        }
+    }
+
+    trace_string_index_t index;
+    if (unlikely(!context->AllocStringIndex(&index) ||
+                 !WriteStringRecord(context, index,
+                                    string_literal, strlen(string_literal))))
+        return false;
+    if (claimed)
+        slot->Publish(index);
+    *out_index = index;
+    return true;
+}
+
+// Gets the index of a thread registered with the context by any thread,
+// registering it if it has not been yet.
+bool InternThread(trace_context_t* context,
+                  mx_koid_t process_koid, mx_koid_t thread_koid,
+                  trace_thread_index_t* out_index) {
+    bool claimed = false;
+    trace_context_t::ThreadTable::Slot* slot = nullptr;
+    if (likely(thread_koid != MX_KOID_INVALID))
+        slot = context->thread_table()->FindOrClaim(thread_koid, &claimed);
+    if (likely(slot && !claimed)) {
+        trace_thread_index_t index = slot->index();
+        if (likely(index)) {
+            *out_index = index;
+            return true;
+        }
+    }
+
+    trace_thread_index_t index;
+    if (unlikely(!context->AllocThreadIndex(&index) ||
+                 !WriteThreadRecord(context, index, process_koid, thread_koid)))
+        return false;
+    if (claimed)
+        slot->Publish(index);
+    *out_index = index;
+    return true;
+}
+
 bool CheckCategory(trace_context_t* context, const char* category) {
     return context->handler()->ops->is_category_enabled(context->handler(), category);
 }
@@ -412,11 +551,9 @@ bool RegisterString(trace_context_t* context,
 
         if (out_ref_optional) {
             if (unlikely(!(entry->flags & StringEntry::kAllocIndexAttempted))) {
-                if (context->AllocStringIndex(&entry->index)) {
+                if (InternStringLiteral(context, string_literal, &entry->index)) {
                     entry->flags |= StringEntry::kAllocIndexAttempted |
                                     StringEntry::kAllocIndexSucceeded;
-                    trace_context_write_string_record(context, entry->index,
-                                                      string_literal, strlen(string_literal));
                 } else {
                     entry->flags |= StringEntry::kAllocIndexAttempted;
                 }
@@ -430,15 +567,18 @@ bool RegisterString(trace_context_t* context,
         return true;
     }
 
-    // Slow path.
-    // TODO(MG-1035): Since we can't use the thread-local cache here, cache
-    // this registered string on the trace context structure, guarded by a mutex.
-    // Make sure to assign it a string index if possible instead of inlining.
+    // Slow path: the thread-local cache can't be used, so go straight to
+    // the context's string table.
     if (check_category && !CheckCategory(context, string_literal)) {
         return false; // category disabled
     }
     if (out_ref_optional) {
-        *out_ref_optional = trace_make_inline_c_string_ref(string_literal);
+        trace_string_index_t index;
+        if (InternStringLiteral(context, string_literal, &index)) {
+            *out_ref_optional = trace_make_indexed_string_ref(index);
+        } else {
+            *out_ref_optional = trace_make_inline_c_string_ref(string_literal);
+        }
     }
     return true;
 }
@@ -459,8 +599,8 @@ void trace_context_register_string_copy(
     // TODO(MG-1035): Cache the registered strings on the trace context structure,
     // guarded by a mutex.
     trace_string_index_t index;
-    if (likely(context->AllocStringIndex(&index))) {
-        trace_context_write_string_record(context, index, string, length);
+    if (likely(context->AllocStringIndex(&index) &&
+               trace::WriteStringRecord(context, index, string, length))) {
         *out_ref = trace_make_indexed_string_ref(index);
     } else {
         *out_ref = trace_make_inline_string_ref(string, length);
@@ -502,9 +642,8 @@ void trace_context_register_current_thread(
 
     if (likely(cache)) {
         trace_thread_index_t index;
-        if (likely(context->AllocThreadIndex(&index))) {
+        if (likely(trace::InternThread(context, process_koid, thread_koid, &index))) {
             cache->thread_ref = trace_make_indexed_thread_ref(index);
-            trace_context_write_thread_record(context, index, process_koid, thread_koid);
         } else {
             cache->thread_ref = trace_make_inline_thread_ref(
                 process_koid, thread_koid);
@@ -525,11 +664,8 @@ void trace_context_register_thread(
     trace_context_t* context,
     mx_koid_t process_koid, mx_koid_t thread_koid,
     trace_thread_ref_t* out_ref) {
-    // TODO(MG-1035): Since we can't use the thread-local cache here, cache
-    // this registered thread on the trace context structure, guarded by a mutex.
     trace_thread_index_t index;
-    if (likely(context->AllocThreadIndex(&index))) {
-        trace_context_write_thread_record(context, index, process_koid, thread_koid);
+    if (likely(trace::InternThread(context, process_koid, thread_koid, &index))) {
         *out_ref = trace_make_indexed_thread_ref(index);
     } else {
         *out_ref = trace_make_inline_thread_ref(process_koid, thread_koid);
@@ -862,7 +998,7 @@ void trace_context_write_initialization_record(
     uint64_t ticks_per_second) {
     const size_t record_size = sizeof(trace::RecordHeader) +
                                trace::WordsToBytes(1);
-    trace::Payload payload(context, record_size);
+    trace::Payload payload(context, record_size, trace::kDurable);
     if (payload) {
         payload
             .WriteUint64(trace::MakeRecordHeader(trace::RecordType::kInitialization, record_size))
@@ -873,22 +1009,7 @@ void trace_context_write_initialization_record(
 void trace_context_write_string_record(
     trace_context_t* context,
     trace_string_index_t index, const char* string, size_t length) {
-    MX_DEBUG_ASSERT(index != TRACE_ENCODED_STRING_REF_EMPTY);
-    MX_DEBUG_ASSERT(index <= TRACE_ENCODED_STRING_REF_MAX_INDEX);
-
-    if (length > TRACE_ENCODED_STRING_REF_MAX_LENGTH)
-        length = TRACE_ENCODED_STRING_REF_MAX_LENGTH;
-
-    const size_t record_size = sizeof(trace::RecordHeader) +
-                               trace::Pad(length);
-    trace::Payload payload(context, record_size);
-    if (payload) {
-        payload
-            .WriteUint64(trace::MakeRecordHeader(trace::RecordType::kString, record_size) |
-                         trace::StringRecordFields::StringIndex::Make(index) |
-                         trace::StringRecordFields::StringLength::Make(length))
-            .WriteBytes(string, length);
-    }
+    trace::WriteStringRecord(context, index, string, length);
 }
 
 void trace_context_write_thread_record(
@@ -896,45 +1017,107 @@ void trace_context_write_thread_record(
     trace_thread_index_t index,
     mx_koid_t process_koid,
     mx_koid_t thread_koid) {
-    MX_DEBUG_ASSERT(index != TRACE_ENCODED_THREAD_REF_INLINE);
-    MX_DEBUG_ASSERT(index <= TRACE_ENCODED_THREAD_REF_MAX_INDEX);
-
-    const size_t record_size = sizeof(trace::RecordHeader) +
-                               trace::WordsToBytes(2);
-    trace::Payload payload(context, record_size);
-    if (payload) {
-        payload
-            .WriteUint64(trace::MakeRecordHeader(trace::RecordType::kThread, record_size) |
-                         trace::ThreadRecordFields::ThreadIndex::Make(index))
-            .WriteUint64(process_koid)
-            .WriteUint64(thread_koid);
-    }
+    trace::WriteThreadRecord(context, index, process_koid, thread_koid);
 }
 
 void* trace_context_alloc_record(trace_context_t* context, size_t num_bytes) {
+    uint64_t* ptr = context->AllocRecord(num_bytes);
+    if (likely(ptr))
+        context->CommitRecord(ptr, num_bytes);
+    return ptr;
+}
+
+void* trace_context_begin_record(trace_context_t* context, size_t num_bytes) {
     return context->AllocRecord(num_bytes);
 }
 
+void trace_context_commit_record(trace_context_t* context,
+                                 void* ptr, size_t num_bytes) {
+    context->CommitRecord(static_cast<const uint64_t*>(ptr), num_bytes);
+}
+
+namespace trace {
+namespace {
+
+// The fraction of the buffer which holds durable records in the rolling modes.
+constexpr size_t kDurableBufferFraction = 16u;
+
+// Each rolling buffer must be able to hold the largest record, and must be
+// small enough for offsets within it to fit in the rolling state.
+constexpr size_t kMinRollingBufferSize = TRACE_ENCODED_RECORD_MAX_LENGTH;
+constexpr size_t kMaxRollingBufferSize = 1u << 30;
+
+size_t DurableBufferSize(size_t buffer_num_bytes) {
+    return (buffer_num_bytes / kDurableBufferFraction) & ~size_t(7u);
+}
+
+size_t RollingBufferSize(size_t buffer_num_bytes) {
+    size_t size = ((buffer_num_bytes - DurableBufferSize(buffer_num_bytes)) / 2u) & ~size_t(7u);
+    return fbl::min(size, kMaxRollingBufferSize);
+}
+
+void ReverseWords(uint8_t* begin, uint8_t* end) {
+    uint64_t* lo = reinterpret_cast<uint64_t*>(begin);
+    uint64_t* hi = reinterpret_cast<uint64_t*>(end);
+    while (lo < hi && lo < --hi) {
+        uint64_t tmp = *lo;
+        *lo++ = *hi;
+        *hi = tmp;
+    }
+}
+
+} // namespace
+} // namespace trace
+
 /* struct trace_context */
 
 trace_context::trace_context(void* buffer, size_t buffer_num_bytes,
+                             trace_buffering_mode_t buffering_mode,
                              trace_handler_t* handler)
     : generation_(trace::g_next_generation.fetch_add(1u, fbl::memory_order_relaxed) + 1u),
+      buffering_mode_(buffering_mode),
       buffer_start_(static_cast<uint8_t*>(buffer)),
       buffer_end_(buffer_start_ + buffer_num_bytes),
       buffer_current_(reinterpret_cast<uintptr_t>(buffer_start_)),
       buffer_full_mark_(0u),
       handler_(handler) {
     MX_DEBUG_ASSERT(generation_ != 0u);
+    MX_DEBUG_ASSERT(IsValidBuffer(buffering_mode, buffer_num_bytes));
+
+    if (buffering_mode_ != TRACE_BUFFERING_MODE_ONESHOT) {
+        durable_buffer_size_ = trace::DurableBufferSize(buffer_num_bytes);
+        rolling_buffer_size_ = trace::RollingBufferSize(buffer_num_bytes);
+        rolling_buffers_[0].start = buffer_start_ + durable_buffer_size_;
+        rolling_buffers_[1].start = rolling_buffers_[0].start + rolling_buffer_size_;
+        // In circular mode the second buffer starts out ready to be overwritten.
+        if (buffering_mode_ == TRACE_BUFFERING_MODE_CIRCULAR)
+            rolling_buffers_[1].status.store(kReady);
+    }
 }
 
 trace_context::~trace_context() = default;
 
+bool trace_context::IsValidBuffer(trace_buffering_mode_t buffering_mode,
+                                  size_t buffer_num_bytes) {
+    switch (buffering_mode) {
+    case TRACE_BUFFERING_MODE_ONESHOT:
+        return true;
+    case TRACE_BUFFERING_MODE_CIRCULAR:
+    case TRACE_BUFFERING_MODE_STREAMING:
+        return trace::RollingBufferSize(buffer_num_bytes) >= trace::kMinRollingBufferSize;
+    default:
+        return false;
+    }
+}
+
 uint64_t* trace_context::AllocRecord(size_t num_bytes) {
     MX_DEBUG_ASSERT((num_bytes & 7) == 0);
     if (unlikely(num_bytes > TRACE_ENCODED_RECORD_MAX_LENGTH))
         return nullptr;
 
+    if (buffering_mode_ != TRACE_BUFFERING_MODE_ONESHOT)
+        return AllocRollingRecord(num_bytes);
+
     uint8_t* ptr = reinterpret_cast<uint8_t*>(
         buffer_current_.fetch_add(num_bytes,
                                   fbl::memory_order_relaxed));
@@ -956,6 +1139,261 @@ uint64_t* trace_context::AllocRecord(size_t num_bytes) {
     return nullptr;
 }
 
+uint64_t* trace_context::AllocRollingRecord(size_t num_bytes) {
+    for (;;) {
+        uint64_t state = rolling_state_.fetch_add(num_bytes, fbl::memory_order_relaxed);
+        uint32_t wrapped_count = static_cast<uint32_t>(state >> kWrappedCountShift);
+        uint64_t offset = state & kOffsetMask;
+        if (likely(offset + num_bytes <= rolling_buffer_size_)) {
+            RollingBuffer* rb = &rolling_buffers_[wrapped_count & 1u];
+            return reinterpret_cast<uint64_t*>(rb->start + offset); // success!
+        }
+
+        if (offset <= rolling_buffer_size_) {
+            // This is the first allocation which did not fit so everything
+            // before it is what the buffer holds.
+            MarkRollingBufferFull(wrapped_count, offset);
+        } else if (unlikely(offset > kMaxOffset)) {
+            uint64_t current = rolling_state_.load(fbl::memory_order_relaxed);
+            uint64_t snapped = (static_cast<uint64_t>(wrapped_count) << kWrappedCountShift) |
+                               (rolling_buffer_size_ + 1u);
+            while ((current >> kWrappedCountShift) == wrapped_count &&
+                   (current & kOffsetMask) > kMaxOffset &&
+                   !rolling_state_.compare_exchange_weak(&current, snapped,
+                                                         fbl::memory_order_relaxed,
+                                                         fbl::memory_order_relaxed)) {
+            }
+        }
+
+        // Try again if writing has moved on to the other buffer.
+        uint64_t current = rolling_state_.load(fbl::memory_order_relaxed);
+        if ((current >> kWrappedCountShift) == wrapped_count) {
+            num_records_dropped_.fetch_add(1u, fbl::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+}
+
+void trace_context::MarkRollingBufferFull(uint32_t wrapped_count, size_t num_bytes) {
+    const uint32_t buffer_number = wrapped_count & 1u;
+    RollingBuffer* rb = &rolling_buffers_[buffer_number];
+    RollingBuffer* next = &rolling_buffers_[buffer_number ^ 1u];
+
+    if (buffering_mode_ == TRACE_BUFFERING_MODE_CIRCULAR) {
+        // Start overwriting the other buffer unless records allocated in it
+        // are still being written, in which case the last of them to be
+        // committed will move on.
+        rb->status.store(kFull);
+        rb->full_num_bytes.store(num_bytes);
+        MaybeOverwriteRollingBuffer(wrapped_count);
+        MaybeReportFullBuffer(rb);
+        return;
+    }
+
+    // Move on to the other buffer unless it is still waiting to be saved,
+    // in which case |MarkBufferSaved()| will move on once it has been.
+    rb->status.store(kFull);
+    rb->full_num_bytes.store(num_bytes);
+    if (next->status.load() == kAvailable)
+        SwitchRollingBuffer(wrapped_count, wrapped_count + 1u);
+    MaybeReportFullBuffer(rb);
+}
+
+bool trace_context::SwitchRollingBuffer(uint32_t wrapped_count, uint32_t new_wrapped_count) {
+    rolling_buffers_[new_wrapped_count & 1u].wrapped_count.store(new_wrapped_count);
+
+    const uint64_t new_state = static_cast<uint64_t>(new_wrapped_count) << kWrappedCountShift;
+    uint64_t state = rolling_state_.load();
+    while ((state >> kWrappedCountShift) == wrapped_count) {
+        if (rolling_state_.compare_exchange_weak(&state, new_state,
+                                                 fbl::memory_order_seq_cst,
+                                                 fbl::memory_order_seq_cst))
+            return true;
+    }
+    return false;
+}
+
+void trace_context::MaybeOverwriteRollingBuffer(uint32_t wrapped_count) {
+    // Only one thread gets to claim the other buffer once it is ready,
+    // and it resets the buffer before any writer can allocate from it.
+    RollingBuffer* next = &rolling_buffers_[(wrapped_count + 1u) & 1u];
+    int status = kReady;
+    if (!next->status.compare_exchange_strong(&status, kAvailable,
+                                              fbl::memory_order_seq_cst,
+                                              fbl::memory_order_seq_cst))
+        return;
+    next->full_num_bytes.store(RollingBuffer::kNotFull);
+    next->committed_num_bytes.store(0u);
+    SwitchRollingBuffer(wrapped_count, wrapped_count + 1u);
+}
+
+void trace_context::CommitRollingRecord(const uint64_t* ptr, size_t num_bytes) {
+    RollingBuffer* rb = &rolling_buffers_[
+        reinterpret_cast<const uint8_t*>(ptr) >= rolling_buffers_[1].start ? 1 : 0];
+    rb->committed_num_bytes.fetch_add(num_bytes);
+    if (unlikely(rb->full_num_bytes.load() != RollingBuffer::kNotFull))
+        MaybeReportFullBuffer(rb);
+}
+
+void trace_context::MaybeReportFullBuffer(RollingBuffer* rb) {
+    // The buffer is ready once every record allocated before it filled
+    // has been written.  Only one thread gets to report it.
+    size_t full_num_bytes = rb->full_num_bytes.load();
+    if (full_num_bytes == RollingBuffer::kNotFull ||
+        rb->committed_num_bytes.load() != full_num_bytes)
+        return;
+
+    int status = kFull;
+    if (!rb->status.compare_exchange_strong(&status, kReady,
+                                            fbl::memory_order_seq_cst,
+                                            fbl::memory_order_seq_cst))
+        return;
+
+    if (buffering_mode_ == TRACE_BUFFERING_MODE_STREAMING) {
+        trace_engine_request_save_buffer();
+        return;
+    }
+
+    // Circular mode: writers may be waiting to overwrite this buffer because
+    // the other one has filled in the meantime.
+    uint32_t wrapped_count = static_cast<uint32_t>(rolling_state_.load() >> kWrappedCountShift);
+    const RollingBuffer* current = &rolling_buffers_[wrapped_count & 1u];
+    if (current != rb && current->status.load() != kAvailable)
+        MaybeOverwriteRollingBuffer(wrapped_count);
+}
+
+uint64_t* trace_context::AllocDurableRecord(size_t num_bytes) {
+    if (buffering_mode_ == TRACE_BUFFERING_MODE_ONESHOT)
+        return AllocRecord(num_bytes);
+
+    MX_DEBUG_ASSERT((num_bytes & 7) == 0);
+    if (unlikely(num_bytes > TRACE_ENCODED_RECORD_MAX_LENGTH))
+        return nullptr;
+
+    durable_mutex_.Acquire();
+    if (unlikely(durable_buffer_size_ - durable_num_bytes_ < num_bytes)) {
+        durable_mutex_.Release();
+        return nullptr;
+    }
+    uint8_t* ptr = buffer_start_ + durable_num_bytes_;
+    durable_num_bytes_ += num_bytes;
+    return reinterpret_cast<uint64_t*>(ptr);
+}
+
+void trace_context::CommitDurableRecord() {
+    if (buffering_mode_ != TRACE_BUFFERING_MODE_ONESHOT)
+        durable_mutex_.Release();
+}
+
+bool trace_context::TakeFullBuffer(uint32_t* out_buffer_number,
+                                   size_t* out_durable_offset,
+                                   size_t* out_durable_num_bytes,
+                                   size_t* out_buffer_offset,
+                                   size_t* out_buffer_num_bytes) {
+    MX_DEBUG_ASSERT(buffering_mode_ == TRACE_BUFFERING_MODE_STREAMING);
+
+    // Hand the buffers over oldest first.
+    const bool first_is_older = static_cast<int32_t>(rolling_buffers_[0].wrapped_count.load() -
+                                                     rolling_buffers_[1].wrapped_count.load()) <= 0;
+    RollingBuffer* rb = &rolling_buffers_[first_is_older ? 0 : 1];
+    RollingBuffer* other = &rolling_buffers_[first_is_older ? 1 : 0];
+    if (rb->status.load() != kReady) {
+        if (rb->status.load() == kFull)
+            return false; // the older buffer is still being written
+        rb = other;
+        if (rb->status.load() != kReady)
+            return false;
+    }
+    rb->status.store(kSaving);
+
+    *out_buffer_number = static_cast<uint32_t>(rb - rolling_buffers_);
+    *out_buffer_offset = rb->start - buffer_start_;
+    *out_buffer_num_bytes = rb->full_num_bytes.load();
+
+    fbl::AutoLock lock(&durable_mutex_);
+    *out_durable_offset = durable_saved_num_bytes_;
+    *out_durable_num_bytes = durable_num_bytes_ - durable_saved_num_bytes_;
+    durable_saved_num_bytes_ = durable_num_bytes_;
+    return true;
+}
+
+mx_status_t trace_context::MarkBufferSaved(uint32_t buffer_number) {
+    if (buffering_mode_ != TRACE_BUFFERING_MODE_STREAMING || buffer_number > 1u)
+        return MX_ERR_BAD_STATE;
+
+    RollingBuffer* rb = &rolling_buffers_[buffer_number];
+    if (rb->status.load() != kSaving)
+        return MX_ERR_BAD_STATE;
+    rb->full_num_bytes.store(RollingBuffer::kNotFull);
+    rb->committed_num_bytes.store(0u);
+    rb->status.store(kAvailable);
+
+    // Resume writing if writers have been waiting for this buffer.
+    uint32_t wrapped_count = static_cast<uint32_t>(rolling_state_.load() >> kWrappedCountShift);
+    if ((wrapped_count & 1u) == buffer_number) {
+        // The other buffer filled first and is still being saved, then this
+        // one filled again.
+        SwitchRollingBuffer(wrapped_count, wrapped_count + 2u);
+    } else if (rolling_buffers_[wrapped_count & 1u].status.load() != kAvailable) {
+        SwitchRollingBuffer(wrapped_count, wrapped_count + 1u);
+    }
+    return MX_OK;
+}
+
+size_t trace_context::FinishBuffer() {
+    if (buffering_mode_ == TRACE_BUFFERING_MODE_ONESHOT) {
+        uintptr_t tail = buffer_full_mark_.load(fbl::memory_order_relaxed);
+        if (!tail)
+            tail = buffer_current_.load(fbl::memory_order_relaxed);
+        return reinterpret_cast<uint8_t*>(tail) - buffer_start_;
+    }
+
+    const uint64_t state = rolling_state_.load();
+    const RollingBuffer* current = &rolling_buffers_[(state >> kWrappedCountShift) & 1u];
+    auto unsaved_num_bytes = [this, state, current](const RollingBuffer* rb) -> size_t {
+        if (buffering_mode_ == TRACE_BUFFERING_MODE_STREAMING) {
+            int status = rb->status.load();
+            if (status == kSaving || (status == kAvailable && rb != current))
+                return 0u;
+        }
+        size_t full_num_bytes = rb->full_num_bytes.load();
+        if (full_num_bytes != RollingBuffer::kNotFull)
+            return full_num_bytes;
+        if (rb != current)
+            return 0u; // never filled
+        return fbl::min(static_cast<size_t>(state & kOffsetMask), rolling_buffer_size_);
+    };
+
+    // Move the durable records first, then the contents of each rolling
+    // buffer in the order they appear in memory, so that nothing is
+    // overwritten before it has been moved.
+    uint8_t* ptr = buffer_start_;
+    {
+        fbl::AutoLock lock(&durable_mutex_);
+        size_t num_bytes = durable_num_bytes_ - durable_saved_num_bytes_;
+        memmove(ptr, buffer_start_ + durable_saved_num_bytes_, num_bytes);
+        ptr += num_bytes;
+        durable_saved_num_bytes_ = durable_num_bytes_;
+    }
+    uint8_t* first = ptr;
+    size_t first_num_bytes = unsaved_num_bytes(&rolling_buffers_[0]);
+    memmove(ptr, rolling_buffers_[0].start, first_num_bytes);
+    ptr += first_num_bytes;
+    size_t second_num_bytes = unsaved_num_bytes(&rolling_buffers_[1]);
+    memmove(ptr, rolling_buffers_[1].start, second_num_bytes);
+    ptr += second_num_bytes;
+
+    // Put the older buffer's records first.
+    if (first_num_bytes && second_num_bytes &&
+        static_cast<int32_t>(rolling_buffers_[0].wrapped_count.load() -
+                             rolling_buffers_[1].wrapped_count.load()) > 0) {
+        trace::ReverseWords(first, first + first_num_bytes);
+        trace::ReverseWords(first + first_num_bytes, ptr);
+        trace::ReverseWords(first, ptr);
+    }
+    return ptr - buffer_start_;
+}
+
 bool trace_context::AllocThreadIndex(trace_thread_index_t* out_index) {
     trace_thread_index_t index = next_thread_index_.fetch_add(1u, fbl::memory_order_relaxed);
     if (unlikely(index > TRACE_ENCODED_THREAD_REF_MAX_INDEX)) {
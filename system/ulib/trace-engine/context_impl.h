@@ -5,45 +5,224 @@
 #pragma once
 
 #include <magenta/assert.h>
+#include <magenta/compiler.h>
 
 #include <fbl/atomic.h>
+#include <fbl/mutex.h>
 
 #include <trace-engine/context.h>
 #include <trace-engine/handler.h>
 
+namespace trace {
+
+// A fixed size, lock-free table which associates keys with the string or
+// thread indexes they were registered with.  Shared by all threads writing
+// to a trace context so that each string literal or thread is normally
+// registered only once per trace.
+//
+// Entries are never removed.  The first thread to look up a key claims its
+// slot, registers the key, and publishes the index.  Until then, or if the
+// table is full, other threads see no index and register the key themselves,
+// which costs a duplicate record but is never wrong.
+template <typename KeyType, typename IndexType, size_t kNumSlots>
+class InternTable {
+public:
+    static_assert((kNumSlots & (kNumSlots - 1)) == 0, "kNumSlots must be a power of 2");
+
+    class Slot {
+    public:
+        // Returns the published index, or 0 if there is none yet.
+        IndexType index() const { return index_.load(fbl::memory_order_acquire); }
+
+        // Publishes the index once the key's record has been written.
+        void Publish(IndexType index) { index_.store(index, fbl::memory_order_release); }
+
+    private:
+        friend class InternTable;
+
+        fbl::atomic<KeyType> key_{0};
+        fbl::atomic<IndexType> index_{0};
+    };
+
+    // Finds the slot for |key|, which must not be zero, or claims an empty
+    // one.  Sets |*out_claimed| to true if the caller claimed the slot and
+    // should publish an index for it.  Returns null if the table is full.
+    Slot* FindOrClaim(KeyType key, bool* out_claimed) {
+        MX_DEBUG_ASSERT(key != 0);
+        size_t hash = static_cast<size_t>(
+            (static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ull) >> 32);
+        for (size_t probe = 0; probe < kMaxProbes; probe++) {
+            Slot* slot = &slots_[(hash + probe) & (kNumSlots - 1)];
+            KeyType slot_key = slot->key_.load(fbl::memory_order_acquire);
+            if (slot_key == 0 &&
+                slot->key_.compare_exchange_strong(&slot_key, key,
+                                                   fbl::memory_order_acq_rel,
+                                                   fbl::memory_order_acquire)) {
+                *out_claimed = true;
+                return slot;
+            }
+            if (slot_key == key) {
+                *out_claimed = false;
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    // Bounds the cost of a lookup once the table is nearly full.
+    static constexpr size_t kMaxProbes = 16;
+
+    Slot slots_[kNumSlots];
+};
+
+} // namespace trace
+
 // Maintains state for a single trace session.
 // This structure is accessed concurrently from many threads which hold trace
 // context references.
 // Implements the opaque type declared in <trace-engine/context.h>.
+//
+// In |TRACE_BUFFERING_MODE_ONESHOT| records are allocated linearly from the
+// whole buffer.
+//
+// In the rolling modes (|TRACE_BUFFERING_MODE_CIRCULAR| and
+// |TRACE_BUFFERING_MODE_STREAMING|) the buffer is divided into a durable
+// buffer followed by two rolling buffers of equal size.  The durable buffer
+// holds the initialization, string, and thread records which other records
+// refer to so that they are never overwritten or dropped; the rolling
+// buffers hold everything else and are filled in turn.  In both rolling modes
+// writing only moves on to a rolling buffer once every record allocated in it
+// the last time around has been written, so that a slow writer never
+// overwrites newer records.
 struct trace_context {
-    trace_context(void* buffer, size_t buffer_num_bytes, trace_handler_t* handler);
+    trace_context(void* buffer, size_t buffer_num_bytes,
+                  trace_buffering_mode_t buffering_mode, trace_handler_t* handler);
 
     ~trace_context();
 
+    // Returns true if |buffering_mode| is known and a buffer of
+    // |buffer_num_bytes| is large enough to use with it.
+    static bool IsValidBuffer(trace_buffering_mode_t buffering_mode,
+                              size_t buffer_num_bytes);
+
     uint32_t generation() const { return generation_; }
 
     trace_handler_t* handler() const { return handler_; }
 
+    trace_buffering_mode_t buffering_mode() const { return buffering_mode_; }
+
+    // Returns true if records were dropped because the buffer was full.
     bool is_buffer_full() const {
-        return buffer_full_mark_.load(fbl::memory_order_relaxed) != 0u;
+        if (buffering_mode_ == TRACE_BUFFERING_MODE_ONESHOT)
+            return buffer_full_mark_.load(fbl::memory_order_relaxed) != 0u;
+        return num_records_dropped_.load(fbl::memory_order_relaxed) != 0u;
     }
 
-    size_t bytes_allocated() const {
-        uintptr_t tail = buffer_full_mark_.load(fbl::memory_order_relaxed);
-        if (!tail)
-            tail = buffer_current_.load(fbl::memory_order_relaxed);
-        return reinterpret_cast<uint8_t*>(tail) - buffer_start_;
-    }
+    // Table of string literals registered with this context, keyed by address.
+    using StringTable = trace::InternTable<uintptr_t, trace_string_index_t, 4096>;
+    StringTable* string_table() { return &string_table_; }
+
+    // Table of threads registered with this context, keyed by thread koid.
+    using ThreadTable = trace::InternTable<mx_koid_t, trace_thread_index_t, 512>;
+    ThreadTable* thread_table() { return &thread_table_; }
 
     uint64_t* AllocRecord(size_t num_bytes);
     bool AllocThreadIndex(trace_thread_index_t* out_index);
     bool AllocStringIndex(trace_string_index_t* out_index);
 
+    // Called once a record returned by |AllocRecord()| has been written.
+    void CommitRecord(const uint64_t* ptr, size_t num_bytes) {
+        if (likely(buffering_mode_ == TRACE_BUFFERING_MODE_ONESHOT))
+            return;
+        CommitRollingRecord(ptr, num_bytes);
+    }
+
+    // Allocates space for a record which must survive for the whole trace.
+    // In the rolling modes, the durable buffer stays locked until
+    // |CommitDurableRecord()| is called so that the handler only ever sees
+    // complete durable records.  Returns null (and leaves the buffer unlocked)
+    // if the durable buffer is full.
+    uint64_t* AllocDurableRecord(size_t num_bytes) __TA_NO_THREAD_SAFETY_ANALYSIS;
+    void CommitDurableRecord() __TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    // Streaming mode: gets the oldest rolling buffer which has filled and whose
+    // records have all been written, and marks it as handed to the handler.
+    // Returns false if there is none.
+    bool TakeFullBuffer(uint32_t* out_buffer_number,
+                        size_t* out_durable_offset, size_t* out_durable_num_bytes,
+                        size_t* out_buffer_offset, size_t* out_buffer_num_bytes);
+
+    // Streaming mode: makes a rolling buffer which was handed to the handler
+    // available for writing again.
+    mx_status_t MarkBufferSaved(uint32_t buffer_number);
+
+    // Called once all references to the context have been released.
+    // In the rolling modes, moves the records which the handler has not
+    // already saved to the start of the buffer, oldest first.
+    // Returns the number of bytes of records at the start of the buffer.
+    size_t FinishBuffer();
+
 private:
+    // Status of a rolling buffer.
+    enum RollingBufferStatus : int {
+        // Streaming mode: empty or being written.
+        // Circular mode: being written.
+        kAvailable,
+        // Full, but records allocated before it filled may still be being written.
+        kFull,
+        // Full and completely written.
+        // Streaming mode: the engine has been asked to hand it to the handler.
+        // Circular mode: it may be overwritten.
+        kReady,
+        // Streaming mode: handed to the handler, waiting for |MarkBufferSaved()|.
+        kSaving,
+    };
+
+    struct RollingBuffer {
+        static constexpr size_t kNotFull = SIZE_MAX;
+
+        uint8_t* start = nullptr;
+
+        // Number of bytes of records in the buffer once it has filled,
+        // or |kNotFull|.
+        fbl::atomic<size_t> full_num_bytes{kNotFull};
+
+        // The number of bytes of records which have been completely written.
+        fbl::atomic<size_t> committed_num_bytes{0u};
+
+        // A |RollingBufferStatus|.
+        fbl::atomic<int> status{kAvailable};
+
+        // The value of the wrap count when writing to the buffer began.
+        // Orders the buffers from oldest to newest.
+        fbl::atomic<uint32_t> wrapped_count{0u};
+    };
+
+    // |rolling_state_| holds the wrap count in its upper 32 bits and the
+    // allocation offset within the current rolling buffer in its lower 32 bits.
+    // The current rolling buffer is |rolling_buffers_[wrapped_count & 1]|.
+    static constexpr int kWrappedCountShift = 32;
+    static constexpr uint64_t kOffsetMask = (1ull << kWrappedCountShift) - 1u;
+
+    // The offset is snapped back to just past the end of a full rolling buffer
+    // once it passes this value to keep it from overflowing into the wrap count
+    // while writers wait for the other buffer to be saved.
+    static constexpr uint64_t kMaxOffset = 1ull << 31;
+
+    uint64_t* AllocRollingRecord(size_t num_bytes);
+    void CommitRollingRecord(const uint64_t* ptr, size_t num_bytes);
+    void MarkRollingBufferFull(uint32_t wrapped_count, size_t num_bytes);
+    bool SwitchRollingBuffer(uint32_t wrapped_count, uint32_t new_wrapped_count);
+    void MaybeOverwriteRollingBuffer(uint32_t wrapped_count);
+    void MaybeReportFullBuffer(RollingBuffer* rb);
+
     // The generation counter associated with this context to distinguish
     // it from previously created contexts.
     uint32_t const generation_;
 
+    trace_buffering_mode_t const buffering_mode_;
+
     // Buffer start and end pointers.
     uint8_t* const buffer_start_;
     uint8_t* const buffer_end_;
@@ -51,12 +230,32 @@ private:
     // Current allocation pointer.
     // Starts at |buffer_start| and grows from there.
     // May exceed |buffer_end| when the buffer is full.
+    // Only used in oneshot mode.
     fbl::atomic<uintptr_t> buffer_current_;
 
     // Pointer beyond the last successful allocation, or null if not full.
     // Only ever set to non-null once in the lifetime of the trace context.
+    // Only used in oneshot mode.
     fbl::atomic<uintptr_t> buffer_full_mark_;
 
+    // The durable buffer, at the start of the buffer in the rolling modes.
+    size_t durable_buffer_size_ = 0u;
+    fbl::Mutex durable_mutex_;
+    // Number of bytes of durable records written.
+    size_t durable_num_bytes_ __TA_GUARDED(durable_mutex_) = 0u;
+    // Number of bytes of durable records already handed to the handler.
+    size_t durable_saved_num_bytes_ __TA_GUARDED(durable_mutex_) = 0u;
+
+    // The rolling buffers, which follow the durable buffer.
+    size_t rolling_buffer_size_ = 0u;
+    RollingBuffer rolling_buffers_[2];
+    fbl::atomic<uint64_t> rolling_state_{0u};
+
+    // Number of records which were dropped in the rolling modes because both
+    // rolling buffers were full (in circular mode, because records were still
+    // being written to the buffer which was due to be overwritten).
+    fbl::atomic<uint64_t> num_records_dropped_{0u};
+
     // Handler associated with the trace session.
     trace_handler_t* const handler_;
 
@@ -67,4 +266,12 @@ private:
     // The next string table index to be assigned.
     fbl::atomic<trace_string_index_t> next_string_index_{
         TRACE_ENCODED_STRING_REF_MIN_INDEX};
+
+    // Strings and threads registered by any thread.
+    StringTable string_table_;
+    ThreadTable thread_table_;
 };
+
+// Asks the trace engine to hand full rolling buffers to the trace handler.
+// Implemented by the engine.  Called by writers in streaming mode.
+void trace_engine_request_save_buffer();
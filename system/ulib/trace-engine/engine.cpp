@@ -8,6 +8,7 @@
 
 #include <magenta/assert.h>
 
+#include <async/task.h>
 #include <async/wait.h>
 #include <mx/event.h>
 #include <fbl/atomic.h>
@@ -87,10 +88,21 @@ trace_context_t* g_context{nullptr};
 // engine is running.  Use of these structures is guarded by the engine lock.
 async_wait_t g_context_released_wait;
 
+// Task which hands full rolling buffers to the trace handler in streaming mode.
+// Rules:
+//   - can only be initialized while holding g_engine_mutex and engine is stopped
+//   - can be posted by a thread holding a context reference which changes
+//     g_buffer_full_task_posted from 0 to 1
+async_task_t g_buffer_full_task;
+fbl::atomic_int g_buffer_full_task_posted{0};
+
 async_wait_result_t handle_context_released(async_t* async, async_wait_t* wait,
                                             mx_status_t status,
                                             const mx_packet_signal_t* signal);
 
+async_task_result_t handle_buffer_full(async_t* async, async_task_t* task,
+                                       mx_status_t status);
+
 // must hold g_engine_mutex
 inline void update_disposition_locked(mx_status_t disposition) {
     if (g_disposition == MX_OK)
@@ -113,10 +125,23 @@ mx_status_t trace_start_engine(async_t* async,
                                trace_handler_t* handler,
                                void* buffer,
                                size_t buffer_num_bytes) {
+    return trace_start_engine_with_mode(async, handler, TRACE_BUFFERING_MODE_ONESHOT,
+                                        buffer, buffer_num_bytes);
+}
+
+// thread-safe
+mx_status_t trace_start_engine_with_mode(async_t* async,
+                                         trace_handler_t* handler,
+                                         trace_buffering_mode_t buffering_mode,
+                                         void* buffer,
+                                         size_t buffer_num_bytes) {
     MX_DEBUG_ASSERT(async);
     MX_DEBUG_ASSERT(handler);
     MX_DEBUG_ASSERT(buffer);
 
+    if (!trace_context::IsValidBuffer(buffering_mode, buffer_num_bytes))
+        return MX_ERR_INVALID_ARGS;
+
     fbl::AutoLock lock(&g_engine_mutex);
 
     // We must have fully stopped a prior tracing session before starting a new one.
@@ -146,8 +171,15 @@ mx_status_t trace_start_engine(async_t* async,
     g_async = async;
     g_handler = handler;
     g_disposition = MX_OK;
-    g_context = new trace_context(buffer, buffer_num_bytes, handler);
+    g_context = new trace_context(buffer, buffer_num_bytes, buffering_mode, handler);
     g_context_released_event = fbl::move(context_released_event);
+    g_buffer_full_task = {
+        .state = {ASYNC_STATE_INIT},
+        .handler = &handle_buffer_full,
+        .deadline = 0u,
+        .flags = 0u,
+        .reserved = 0u};
+    g_buffer_full_task_posted.store(0);
 
     // Write the trace initialization record first before allowing clients to
     // get in and write their own trace records.
@@ -190,8 +222,62 @@ mx_status_t trace_stop_engine(mx_status_t disposition) {
     return MX_OK;
 }
 
+// thread-safe
+mx_status_t trace_engine_mark_buffer_saved(uint32_t buffer_number) {
+    fbl::AutoLock lock(&g_engine_mutex);
+
+    if (g_state.load(fbl::memory_order_relaxed) == TRACE_STOPPED)
+        return MX_ERR_BAD_STATE;
+    MX_DEBUG_ASSERT(g_context != nullptr);
+
+    return g_context->MarkBufferSaved(buffer_number);
+}
+
+// thread-safe, called while holding a context reference
+void trace_engine_request_save_buffer() {
+    if (g_buffer_full_task_posted.exchange(1))
+        return; // already posted
+
+    // If the dispatcher is shutting down, the buffer will be collected
+    // along with the rest of the records once tracing stops.
+    mx_status_t status = async_post_task(g_async, &g_buffer_full_task);
+    if (status != MX_OK)
+        g_buffer_full_task_posted.store(0);
+}
+
 namespace {
 
+async_task_result_t handle_buffer_full(async_t* async, async_task_t* task,
+                                       mx_status_t status) {
+    // Allow the task to be posted again before looking for full buffers
+    // so that none are missed.
+    g_buffer_full_task_posted.store(0);
+    if (status != MX_OK)
+        return ASYNC_TASK_FINISHED;
+
+    for (;;) {
+        trace_handler_t* handler;
+        uint32_t buffer_number;
+        size_t durable_offset, durable_num_bytes, buffer_offset, buffer_num_bytes;
+        {
+            fbl::AutoLock lock(&g_engine_mutex);
+
+            if (g_state.load(fbl::memory_order_relaxed) == TRACE_STOPPED ||
+                !g_context->TakeFullBuffer(&buffer_number,
+                                           &durable_offset, &durable_num_bytes,
+                                           &buffer_offset, &buffer_num_bytes))
+                return ASYNC_TASK_FINISHED;
+            handler = g_handler;
+        }
+
+        // Call the handler without the lock so that it can mark the buffer
+        // as saved straight away.
+        handler->ops->notify_buffer_full(handler, async, buffer_number,
+                                         durable_offset, durable_num_bytes,
+                                         buffer_offset, buffer_num_bytes);
+    }
+}
+
 async_wait_result_t handle_context_released(async_t* async, async_wait_t* wait,
                                             mx_status_t status,
                                             const mx_packet_signal_t* signal) {
@@ -242,9 +328,11 @@ async_wait_result_t handle_context_released(async_t* async, async_wait_t* wait,
             update_disposition_locked(MX_ERR_NO_MEMORY);
         disposition = g_disposition;
         handler = g_handler;
-        buffer_bytes_written = g_context->bytes_allocated();
+        buffer_bytes_written = g_context->FinishBuffer();
 
         // Tidy up.
+        async_cancel_task(async, &g_buffer_full_task);
+        g_buffer_full_task_posted.store(0);
         g_async = nullptr;
         g_handler = nullptr;
         g_disposition = MX_OK;
@@ -557,7 +557,33 @@ void trace_context_write_thread_record(
 // 8 byte alignment, or NULL if the trace buffer is full or if |num_bytes|
 // exceeds |TRACE_ENCODED_RECORD_MAX_LENGTH|.
 //
+// The record counts as written as soon as it has been allocated: in the
+// rolling buffering modes it may be handed to the trace handler or
+// overwritten at any time, so write it out immediately.  Callers which need
+// the record to be kept until it has been written should use
+// |trace_context_begin_record()| instead.
+//
 // This function is thread-safe, fail-fast, and lock-free.
 void* trace_context_alloc_record(trace_context_t* context, size_t num_bytes);
 
+// Allocates space for a record in the trace buffer, like
+// |trace_context_alloc_record()|, which is kept until it has been written.
+//
+// Once the record has been written, the caller must pass it to
+// |trace_context_commit_record()|.  Until then, in the rolling buffering
+// modes, the buffer holding it is neither handed to the trace handler nor
+// overwritten.
+//
+// This function is thread-safe, fail-fast, and lock-free.
+void* trace_context_begin_record(trace_context_t* context, size_t num_bytes);
+
+// Marks a record allocated by |trace_context_begin_record()| as written.
+//
+// |context| must be a valid trace context reference.
+// |ptr| and |num_bytes| must be those of the allocated record.
+//
+// This function is thread-safe, fail-fast, and lock-free.
+void trace_context_commit_record(trace_context_t* context,
+                                 void* ptr, size_t num_bytes);
+
 __END_CDECLS
@@ -27,6 +27,21 @@
 
 __BEGIN_CDECLS
 
+// Trace buffering modes.
+typedef enum {
+    // Records are written until the buffer is full, after which they are dropped.
+    // The handler collects the whole buffer when tracing stops.
+    TRACE_BUFFERING_MODE_ONESHOT = 0,
+    // The buffer is split into two halves which are filled in turn.  When a half
+    // fills, writing moves to the other half, overwriting its older records.
+    // The handler collects the most recent records when tracing stops.
+    TRACE_BUFFERING_MODE_CIRCULAR = 1,
+    // The buffer is split into two halves which are filled in turn.  When a half
+    // fills, the handler is asked to save it while writing moves to the other
+    // half.  Records are dropped only if the handler falls behind.
+    TRACE_BUFFERING_MODE_STREAMING = 2,
+} trace_buffering_mode_t;
+
 // Trace handler interface.
 //
 // Implementations must supply valid function pointers for each function
@@ -64,6 +79,25 @@ struct trace_handler_ops {
     // Called on an asynchronous dispatch thread.
     void (*trace_stopped)(trace_handler_t* handler, async_t* async,
                           mx_status_t disposition, size_t buffer_bytes_written);
+
+    // Called by the trace engine in |TRACE_BUFFERING_MODE_STREAMING| when one
+    // half of the trace buffer has filled and must be saved.
+    //
+    // The handler must save the |durable_num_bytes| bytes of string and thread
+    // records at |durable_offset| followed by the |buffer_num_bytes| bytes of
+    // records at |buffer_offset| (both offsets are relative to the start of
+    // the trace buffer), then call |trace_engine_mark_buffer_saved()| with
+    // |buffer_number| so that the half can be reused.
+    //
+    // |handler| is the trace handler object itself.
+    // |async| is the trace engine's asynchronous dispatcher.
+    // |buffer_number| identifies the half which filled, 0 or 1.
+    //
+    // Called on an asynchronous dispatch thread.
+    void (*notify_buffer_full)(trace_handler_t* handler, async_t* async,
+                               uint32_t buffer_number,
+                               size_t durable_offset, size_t durable_num_bytes,
+                               size_t buffer_offset, size_t buffer_num_bytes);
 };
 
 // Asynchronously starts the trace engine.
@@ -100,6 +134,23 @@ mx_status_t trace_start_engine(async_t* async,
                                void* buffer,
                                size_t buffer_num_bytes);
 
+// Asynchronously starts the trace engine using the specified buffering mode.
+//
+// Behaves like |trace_start_engine()|, which uses |TRACE_BUFFERING_MODE_ONESHOT|.
+//
+// When tracing stops in |TRACE_BUFFERING_MODE_CIRCULAR| or
+// |TRACE_BUFFERING_MODE_STREAMING|, the records which the handler has not
+// already saved are moved to the start of the buffer so that the handler can
+// collect them exactly as it would in |TRACE_BUFFERING_MODE_ONESHOT|.
+//
+// Returns |MX_ERR_INVALID_ARGS| if |buffering_mode| is unknown or |buffer|
+// is too small to split into halves.
+mx_status_t trace_start_engine_with_mode(async_t* async,
+                                         trace_handler_t* handler,
+                                         trace_buffering_mode_t buffering_mode,
+                                         void* buffer,
+                                         size_t buffer_num_bytes);
+
 // Asynchronously stops the trace engine.
 //
 // The trace handler's |trace_stopped()| method will be invoked asynchronously
@@ -114,4 +165,16 @@ mx_status_t trace_start_engine(async_t* async,
 // This function is thread-safe.
 mx_status_t trace_stop_engine(mx_status_t disposition);
 
+// Tells the trace engine that the handler has saved the half of the trace buffer
+// reported by |trace_handler_ops.notify_buffer_full()| so that it can be reused.
+//
+// |buffer_number| is the number of the half which was saved.
+//
+// Returns |MX_OK| on success.
+// Returns |MX_ERR_BAD_STATE| if tracing is stopped or is not streaming, or if
+// the half was not waiting to be saved.
+//
+// This function is thread-safe.
+mx_status_t trace_engine_mark_buffer_saved(uint32_t buffer_number);
+
 __END_CDECLS
@@ -0,0 +1,207 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <trace-reader/reader.h>
+#include <trace-reader/records.h>
+
+#include <fbl/array.h>
+#include <fbl/function.h>
+#include <fbl/macros.h>
+#include <fbl/string.h>
+#include <fbl/string_piece.h>
+#include <fbl/vector.h>
+#include <trace-engine/types.h>
+
+namespace trace {
+
+// An argument decoded in place.
+// Its strings point into the trace buffer.
+struct ArgumentView {
+    fbl::StringPiece name;
+    ArgumentType type;
+    union {
+        int32_t int32;
+        uint32_t uint32;
+        int64_t int64;
+        uint64_t uint64;
+        double dbl;
+        uint64_t pointer;
+        mx_koid_t koid;
+    };
+    // The value of a string argument.
+    fbl::StringPiece string;
+};
+
+// An event record decoded in place.
+// Unlike |Record|, nothing is copied: its strings point into the trace
+// buffer and remain valid for as long as the buffer does.
+struct EventView {
+    EventType type;
+    trace_ticks_t timestamp;
+    ProcessThread process_thread;
+    fbl::StringPiece category;
+    fbl::StringPiece name;
+
+    // The event type specific data: the scope of an instant event, or the
+    // id of a counter, async, or flow event.  Zero for duration events.
+    uint64_t data;
+
+    size_t num_arguments;
+    ArgumentView arguments[TRACE_MAX_ARGS];
+};
+
+// Indexes a complete trace held in memory, such as a mapped trace file,
+// without copying it.
+//
+// The trace is divided into segments of consecutive records which all
+// belong to the same provider.  For each segment the index records the
+// range of timestamps and the set of threads of its events, so that
+// analyses can seek to the parts of a trace they are interested in.
+// The index also records where each provider's string and thread records
+// are, so that any segment can be decoded on its own by a |SegmentDecoder|.
+//
+// Once |Index()| has returned, the view is immutable and may be shared by
+// any number of decoders running on different threads.  The error handler
+// may then be called concurrently by those decoders.
+class TraceView {
+public:
+    // Callback invoked when decoding errors are detected in the trace.
+    using ErrorHandler = TraceReader::ErrorHandler;
+
+    // The default segment size, in words.
+    static constexpr size_t kDefaultSegmentWords = 64 * 1024;
+
+    struct Segment {
+        // Range of the segment's records, in words from the start of the trace.
+        size_t begin;
+        size_t end;
+
+        // Index of the segment's provider in |providers()|.
+        size_t provider;
+
+        // Range of the timestamps of the segment's events.
+        // |min_timestamp| is greater than |max_timestamp| if there are none.
+        trace_ticks_t min_timestamp;
+        trace_ticks_t max_timestamp;
+
+        // Number of event records in the segment.
+        size_t num_events;
+
+        // The threads which wrote the segment's events, sorted.
+        fbl::Vector<ProcessThread> threads;
+    };
+
+    // A provider's records, from its provider info record (or the start of
+    // the trace) until it is registered again.
+    struct Provider {
+        ProviderId id;
+        fbl::String name;
+
+        // Offsets of the provider's string and thread records, in words from
+        // the start of the trace, in increasing order.
+        fbl::Vector<size_t> string_records;
+        fbl::Vector<size_t> thread_records;
+    };
+
+    explicit TraceView(ErrorHandler error_handler);
+    ~TraceView();
+
+    // Indexes the |num_words| words of trace records at |words|, which must
+    // remain valid and unchanged for as long as the view is used.
+    // Returns false if the trace is corrupt, in which case the index covers
+    // the records before the corruption.
+    bool Index(const uint64_t* words, size_t num_words,
+               size_t segment_words = kDefaultSegmentWords);
+
+    const uint64_t* words() const { return words_; }
+    size_t num_words() const { return num_words_; }
+
+    const fbl::Vector<Segment>& segments() const { return segments_; }
+    const fbl::Vector<Provider>& providers() const { return providers_; }
+
+    // Returns the index of the first segment which may contain events at or
+    // after |timestamp|, or the number of segments if there is none.
+    size_t FindSegment(trace_ticks_t timestamp, size_t start = 0u) const;
+
+    // Returns the indexes of the segments which contain events written by
+    // |process_thread|.
+    fbl::Vector<size_t> FindSegments(const ProcessThread& process_thread) const;
+
+private:
+    friend class SegmentDecoder;
+
+    void ReportError(fbl::String error) const;
+
+    ErrorHandler const error_handler_;
+
+    const uint64_t* words_ = nullptr;
+    size_t num_words_ = 0u;
+    fbl::Vector<Segment> segments_;
+    fbl::Vector<Provider> providers_;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(TraceView);
+};
+
+// Decodes the event records of individual segments of a |TraceView|.
+//
+// Each decoder keeps its own string and thread tables, so decoders working
+// on different segments of the same view can run concurrently.
+class SegmentDecoder {
+public:
+    // Called for each event record decoded.  The view is only valid for
+    // the duration of the call, although the strings it points to remain
+    // valid for as long as the trace buffer does.
+    using EventConsumer = fbl::Function<void(const EventView&)>;
+
+    explicit SegmentDecoder(const TraceView* view);
+    ~SegmentDecoder();
+
+    // Decodes the event records of the segment with index |segment|, calling
+    // |event_consumer| for each one.  Other records are skipped; use
+    // |TraceReader| to read them.
+    // Returns false if the segment is corrupt.
+    bool Decode(size_t segment, const EventConsumer& event_consumer);
+
+private:
+    struct StringSlot {
+        fbl::StringPiece string;
+        uint32_t generation = 0u;
+    };
+
+    struct ThreadSlot {
+        ProcessThread process_thread;
+        uint32_t generation = 0u;
+    };
+
+    void LoadTables(const TraceView::Provider& provider, size_t offset);
+    bool ReadStringRecord(Chunk& record, RecordHeader header);
+    bool ReadThreadRecord(Chunk& record, RecordHeader header);
+    bool ReadEventRecord(Chunk& record, RecordHeader header, EventView* event);
+    bool ReadArguments(Chunk& record, size_t count, EventView* event);
+    bool DecodeStringRef(Chunk& chunk, trace_encoded_string_ref_t string_ref,
+                         fbl::StringPiece* out_string) const;
+    bool DecodeThreadRef(Chunk& chunk, trace_encoded_thread_ref_t thread_ref,
+                         ProcessThread* out_process_thread) const;
+
+    const TraceView* const view_;
+
+    // Table entries are only valid if their generation matches the current
+    // one, so switching segments does not require clearing the tables.
+    uint32_t generation_ = 0u;
+    fbl::Array<StringSlot> strings_;
+    fbl::Array<ThreadSlot> threads_;
+
+    // The provider whose definitions are in the tables, and the offset up
+    // to which they have been loaded.
+    const TraceView::Provider* loaded_provider_ = nullptr;
+    size_t loaded_offset_ = 0u;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(SegmentDecoder);
+};
+
+} // namespace trace
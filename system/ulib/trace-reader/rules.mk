@@ -12,7 +12,8 @@ MODULE_TYPE := userlib
 
 MODULE_SRCS = \
     $(LOCAL_DIR)/reader.cpp \
-    $(LOCAL_DIR)/records.cpp
+    $(LOCAL_DIR)/records.cpp \
+    $(LOCAL_DIR)/view.cpp
 
 MODULE_STATIC_LIBS := \
     system/ulib/trace-engine \
@@ -32,7 +33,8 @@ MODULE_TYPE := hostlib
 
 MODULE_SRCS = \
     $(LOCAL_DIR)/reader.cpp \
-    $(LOCAL_DIR)/records.cpp
+    $(LOCAL_DIR)/records.cpp \
+    $(LOCAL_DIR)/view.cpp
 
 MODULE_COMPILEFLAGS := \
     -Isystem/ulib/trace-engine/include \
@@ -0,0 +1,496 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <trace-reader/view.h>
+
+#include <fbl/string_printf.h>
+#include <trace-engine/fields.h>
+
+namespace trace {
+namespace {
+
+// Adds |process_thread| to |threads| unless it was the last one added or is
+// already there.  Segments rarely have more than a few threads.
+void AddThread(fbl::Vector<ProcessThread>* threads, const ProcessThread& process_thread) {
+    size_t size = threads->size();
+    if (size && (*threads)[size - 1] == process_thread)
+        return;
+    for (size_t i = 0; i < size; i++) {
+        if ((*threads)[i] == process_thread) {
+            // Keep the most recently seen thread at the end.
+            (*threads)[i] = (*threads)[size - 1];
+            (*threads)[size - 1] = process_thread;
+            return;
+        }
+    }
+    threads->push_back(process_thread);
+}
+
+void SortThreads(fbl::Vector<ProcessThread>* threads) {
+    for (size_t i = 1; i < threads->size(); i++) {
+        ProcessThread process_thread = (*threads)[i];
+        size_t j = i;
+        for (; j > 0 && process_thread < (*threads)[j - 1]; j--)
+            (*threads)[j] = (*threads)[j - 1];
+        (*threads)[j] = process_thread;
+    }
+}
+
+// Returns the index of the first element of |offsets| which is not less
+// than |offset|.
+size_t LowerBound(const fbl::Vector<size_t>& offsets, size_t offset) {
+    size_t begin = 0u;
+    size_t end = offsets.size();
+    while (begin < end) {
+        size_t mid = begin + (end - begin) / 2;
+        if (offsets[mid] < offset) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return begin;
+}
+
+// Returns the index of the most recently registered provider with |id|, or
+// the number of providers if there is none.
+size_t FindProvider(const fbl::Vector<TraceView::Provider>& providers, ProviderId id) {
+    for (size_t i = providers.size(); i-- > 0u;) {
+        if (providers[i].id == id)
+            return i;
+    }
+    return providers.size();
+}
+
+} // namespace
+
+TraceView::TraceView(ErrorHandler error_handler)
+    : error_handler_(fbl::move(error_handler)) {}
+
+TraceView::~TraceView() = default;
+
+bool TraceView::Index(const uint64_t* words, size_t num_words, size_t segment_words) {
+    MX_DEBUG_ASSERT(segment_words > 0u);
+
+    words_ = words;
+    num_words_ = num_words;
+    segments_.reset();
+    providers_.reset();
+
+    // The thread table of the current provider, used to attribute events to
+    // threads.  Rebuilt from the provider's thread records when switching
+    // providers.
+    ProcessThread thread_table[TRACE_ENCODED_THREAD_REF_MAX_INDEX + 1];
+
+    // For each thread index, one more than the number of the last segment
+    // whose threads include it, so that most events need not search them.
+    size_t thread_seen[TRACE_ENCODED_THREAD_REF_MAX_INDEX + 1] = {};
+
+    auto add_provider = [this](ProviderId id, fbl::String name) {
+        Provider provider;
+        provider.id = id;
+        provider.name = fbl::move(name);
+        providers_.push_back(fbl::move(provider));
+        return providers_.size() - 1u;
+    };
+
+    auto load_thread_table = [this, &thread_table, &thread_seen](size_t provider) {
+        for (auto& process_thread : thread_table)
+            process_thread = ProcessThread();
+        for (auto& seen : thread_seen)
+            seen = 0u;
+        for (size_t offset : providers_[provider].thread_records) {
+            auto index = ThreadRecordFields::ThreadIndex::Get<trace_thread_index_t>(
+                words_[offset]);
+            thread_table[index] = ProcessThread(words_[offset + 1], words_[offset + 2]);
+        }
+    };
+
+    Segment segment{};
+    segment.provider = add_provider(0u, "");
+    segment.min_timestamp = UINT64_MAX;
+
+    auto finish_segment = [this, &segment](size_t offset, size_t next_provider) {
+        segment.end = offset;
+        if (segment.end > segment.begin) {
+            SortThreads(&segment.threads);
+            segments_.push_back(fbl::move(segment));
+        }
+        segment = Segment{};
+        segment.begin = offset;
+        segment.provider = next_provider;
+        segment.min_timestamp = UINT64_MAX;
+    };
+
+    size_t offset = 0u;
+    while (offset < num_words) {
+        RecordHeader header = words[offset];
+        auto size = RecordFields::RecordSize::Get<size_t>(header);
+        if (size == 0u) {
+            ReportError("Unexpected record of size 0");
+            break;
+        }
+        if (size > num_words - offset) {
+            ReportError("Truncated record");
+            break;
+        }
+
+        auto type = RecordFields::Type::Get<RecordType>(header);
+        if (type == RecordType::kMetadata) {
+            auto metadata_type = MetadataRecordFields::MetadataType::Get<MetadataType>(header);
+            if (metadata_type == MetadataType::kProviderInfo) {
+                auto id = ProviderInfoMetadataRecordFields::Id::Get<ProviderId>(header);
+                auto name_length =
+                    ProviderInfoMetadataRecordFields::NameLength::Get<size_t>(header);
+                Chunk record(words + offset + 1u, size - 1u);
+                fbl::StringPiece name;
+                if (record.ReadString(name_length, &name)) {
+                    // Registering a provider again starts it over with empty
+                    // string and thread tables, as in |TraceReader|.
+                    finish_segment(offset, add_provider(id, fbl::String(name)));
+                    load_thread_table(segment.provider);
+                } else {
+                    ReportError("Failed to read metadata record");
+                }
+            } else if (metadata_type == MetadataType::kProviderSection) {
+                auto id = ProviderSectionMetadataRecordFields::Id::Get<ProviderId>(header);
+                size_t provider = FindProvider(providers_, id);
+                if (provider == providers_.size())
+                    provider = add_provider(id, "");
+                finish_segment(offset, provider);
+                load_thread_table(provider);
+            }
+        } else if (offset - segment.begin >= segment_words) {
+            finish_segment(offset, segment.provider);
+        }
+
+        switch (type) {
+        case RecordType::kString: {
+            providers_[segment.provider].string_records.push_back(offset);
+            break;
+        }
+        case RecordType::kThread: {
+            auto index = ThreadRecordFields::ThreadIndex::Get<trace_thread_index_t>(header);
+            if (size < 3u || index < TRACE_ENCODED_THREAD_REF_MIN_INDEX) {
+                ReportError("Failed to read thread record");
+                break;
+            }
+            providers_[segment.provider].thread_records.push_back(offset);
+            thread_table[index] = ProcessThread(words[offset + 1], words[offset + 2]);
+            thread_seen[index] = 0u;
+            break;
+        }
+        case RecordType::kEvent: {
+            auto thread_ref = EventRecordFields::ThreadRef::Get<trace_encoded_thread_ref_t>(header);
+            size_t min_size = thread_ref == TRACE_ENCODED_THREAD_REF_INLINE ? 4u : 2u;
+            if (size < min_size) {
+                ReportError("Failed to read event record");
+                break;
+            }
+            trace_ticks_t timestamp = words[offset + 1];
+            if (timestamp < segment.min_timestamp)
+                segment.min_timestamp = timestamp;
+            if (timestamp > segment.max_timestamp)
+                segment.max_timestamp = timestamp;
+            segment.num_events++;
+            if (thread_ref == TRACE_ENCODED_THREAD_REF_INLINE) {
+                AddThread(&segment.threads, ProcessThread(words[offset + 2], words[offset + 3]));
+            } else if (thread_seen[thread_ref] != segments_.size() + 1u &&
+                       thread_table[thread_ref]) {
+                thread_seen[thread_ref] = segments_.size() + 1u;
+                AddThread(&segment.threads, thread_table[thread_ref]);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        offset += size;
+    }
+
+    finish_segment(offset, segment.provider);
+    return offset == num_words;
+}
+
+size_t TraceView::FindSegment(trace_ticks_t timestamp, size_t start) const {
+    for (size_t i = start; i < segments_.size(); i++) {
+        const Segment& segment = segments_[i];
+        if (segment.min_timestamp <= segment.max_timestamp &&
+            segment.max_timestamp >= timestamp)
+            return i;
+    }
+    return segments_.size();
+}
+
+fbl::Vector<size_t> TraceView::FindSegments(const ProcessThread& process_thread) const {
+    fbl::Vector<size_t> result;
+    for (size_t i = 0; i < segments_.size(); i++) {
+        for (const auto& segment_thread : segments_[i].threads) {
+            if (segment_thread == process_thread) {
+                result.push_back(i);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+void TraceView::ReportError(fbl::String error) const {
+    if (error_handler_)
+        error_handler_(fbl::move(error));
+}
+
+SegmentDecoder::SegmentDecoder(const TraceView* view)
+    : view_(view),
+      strings_(new StringSlot[TRACE_ENCODED_STRING_REF_MAX_INDEX + 1],
+               TRACE_ENCODED_STRING_REF_MAX_INDEX + 1),
+      threads_(new ThreadSlot[TRACE_ENCODED_THREAD_REF_MAX_INDEX + 1],
+               TRACE_ENCODED_THREAD_REF_MAX_INDEX + 1) {}
+
+SegmentDecoder::~SegmentDecoder() = default;
+
+bool SegmentDecoder::Decode(size_t segment_index, const EventConsumer& event_consumer) {
+    MX_DEBUG_ASSERT(segment_index < view_->segments_.size());
+    const TraceView::Segment& segment = view_->segments_[segment_index];
+
+    LoadTables(view_->providers_[segment.provider], segment.begin);
+
+    Chunk chunk(view_->words_ + segment.begin, segment.end - segment.begin);
+    EventView event;
+    RecordHeader header;
+    while (chunk.ReadUint64(&header)) {
+        auto size = RecordFields::RecordSize::Get<size_t>(header);
+        Chunk record;
+        if (size == 0u || !chunk.ReadChunk(size - 1u, &record)) {
+            view_->ReportError("Invalid record size");
+            return false;
+        }
+
+        switch (RecordFields::Type::Get<RecordType>(header)) {
+        case RecordType::kString: {
+            if (!ReadStringRecord(record, header))
+                view_->ReportError("Failed to read string record");
+            break;
+        }
+        case RecordType::kThread: {
+            if (!ReadThreadRecord(record, header))
+                view_->ReportError("Failed to read thread record");
+            break;
+        }
+        case RecordType::kEvent: {
+            if (ReadEventRecord(record, header, &event)) {
+                event_consumer(event);
+            } else {
+                view_->ReportError("Failed to read event record");
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    loaded_offset_ = segment.end;
+    return true;
+}
+
+// Makes the string and thread tables hold the provider's definitions as of
+// |offset|.  Decoders usually work through segments in increasing order, so
+// when the provider is the same as for the previous segment only the
+// definitions in between are loaded.
+void SegmentDecoder::LoadTables(const TraceView::Provider& provider, size_t offset) {
+    size_t loaded = 0u;
+    if (generation_ && &provider == loaded_provider_ && offset >= loaded_offset_) {
+        loaded = loaded_offset_;
+    } else if (++generation_ == 0u) {
+        // The generation wrapped around: invalidate every entry explicitly.
+        for (size_t i = 0; i < strings_.size(); i++)
+            strings_[i].generation = 0u;
+        for (size_t i = 0; i < threads_.size(); i++)
+            threads_[i].generation = 0u;
+        generation_ = 1u;
+    }
+
+    const uint64_t* words = view_->words_;
+    for (size_t i = LowerBound(provider.string_records, loaded);
+         i < provider.string_records.size() && provider.string_records[i] < offset; i++) {
+        size_t record_offset = provider.string_records[i];
+        RecordHeader header = words[record_offset];
+        Chunk record(words + record_offset + 1u,
+                     RecordFields::RecordSize::Get<size_t>(header) - 1u);
+        ReadStringRecord(record, header);
+    }
+    for (size_t i = LowerBound(provider.thread_records, loaded);
+         i < provider.thread_records.size() && provider.thread_records[i] < offset; i++) {
+        size_t record_offset = provider.thread_records[i];
+        RecordHeader header = words[record_offset];
+        Chunk record(words + record_offset + 1u,
+                     RecordFields::RecordSize::Get<size_t>(header) - 1u);
+        ReadThreadRecord(record, header);
+    }
+
+    loaded_provider_ = &provider;
+    loaded_offset_ = offset;
+}
+
+bool SegmentDecoder::ReadStringRecord(Chunk& record, RecordHeader header) {
+    auto index = StringRecordFields::StringIndex::Get<trace_string_index_t>(header);
+    if (index < TRACE_ENCODED_STRING_REF_MIN_INDEX ||
+        index > TRACE_ENCODED_STRING_REF_MAX_INDEX)
+        return false;
+
+    auto length = StringRecordFields::StringLength::Get<size_t>(header);
+    fbl::StringPiece string;
+    if (!record.ReadString(length, &string))
+        return false;
+
+    strings_[index].string = string;
+    strings_[index].generation = generation_;
+    return true;
+}
+
+bool SegmentDecoder::ReadThreadRecord(Chunk& record, RecordHeader header) {
+    auto index = ThreadRecordFields::ThreadIndex::Get<trace_thread_index_t>(header);
+    if (index < TRACE_ENCODED_THREAD_REF_MIN_INDEX ||
+        index > TRACE_ENCODED_THREAD_REF_MAX_INDEX)
+        return false;
+
+    mx_koid_t process_koid, thread_koid;
+    if (!record.ReadUint64(&process_koid) ||
+        !record.ReadUint64(&thread_koid))
+        return false;
+
+    threads_[index].process_thread = ProcessThread(process_koid, thread_koid);
+    threads_[index].generation = generation_;
+    return true;
+}
+
+bool SegmentDecoder::ReadEventRecord(Chunk& record, RecordHeader header,
+                                     EventView* event) {
+    event->type = EventRecordFields::EventType::Get<EventType>(header);
+    auto argument_count = EventRecordFields::ArgumentCount::Get<size_t>(header);
+    auto thread_ref = EventRecordFields::ThreadRef::Get<trace_encoded_thread_ref_t>(header);
+    auto category_ref =
+        EventRecordFields::CategoryStringRef::Get<trace_encoded_string_ref_t>(header);
+    auto name_ref =
+        EventRecordFields::NameStringRef::Get<trace_encoded_string_ref_t>(header);
+
+    if (!record.ReadUint64(&event->timestamp) ||
+        !DecodeThreadRef(record, thread_ref, &event->process_thread) ||
+        !DecodeStringRef(record, category_ref, &event->category) ||
+        !DecodeStringRef(record, name_ref, &event->name) ||
+        !ReadArguments(record, argument_count, event))
+        return false;
+
+    switch (event->type) {
+    case EventType::kDurationBegin:
+    case EventType::kDurationEnd:
+        event->data = 0u;
+        return true;
+    default:
+        // All other event types have one word of data.  Unknown event types
+        // are passed through for forward compatibility.
+        return record.ReadUint64(&event->data);
+    }
+}
+
+bool SegmentDecoder::ReadArguments(Chunk& record, size_t count, EventView* event) {
+    event->num_arguments = 0u;
+    while (count-- > 0) {
+        ArgumentHeader header;
+        if (!record.ReadUint64(&header))
+            return false;
+
+        auto size = ArgumentFields::ArgumentSize::Get<size_t>(header);
+        Chunk arg;
+        if (!size || !record.ReadChunk(size - 1, &arg))
+            return false;
+
+        ArgumentView& argument = event->arguments[event->num_arguments];
+        auto name_ref = ArgumentFields::NameRef::Get<trace_encoded_string_ref_t>(header);
+        if (!DecodeStringRef(arg, name_ref, &argument.name))
+            return false;
+
+        argument.type = ArgumentFields::Type::Get<ArgumentType>(header);
+        argument.uint64 = 0u;
+        argument.string = fbl::StringPiece();
+        switch (argument.type) {
+        case ArgumentType::kNull:
+            break;
+        case ArgumentType::kInt32:
+            argument.int32 = Int32ArgumentFields::Value::Get<int32_t>(header);
+            break;
+        case ArgumentType::kUint32:
+            argument.uint32 = Uint32ArgumentFields::Value::Get<uint32_t>(header);
+            break;
+        case ArgumentType::kInt64:
+        case ArgumentType::kUint64:
+        case ArgumentType::kDouble:
+        case ArgumentType::kPointer:
+        case ArgumentType::kKoid:
+            // All of these are stored as a single word.
+            if (!arg.ReadUint64(&argument.uint64))
+                return false;
+            break;
+        case ArgumentType::kString: {
+            auto string_ref =
+                StringArgumentFields::Index::Get<trace_encoded_string_ref_t>(header);
+            if (!DecodeStringRef(arg, string_ref, &argument.string))
+                return false;
+            break;
+        }
+        default:
+            // Skip unknown argument types for forward compatibility.
+            continue;
+        }
+        event->num_arguments++;
+    }
+    return true;
+}
+
+bool SegmentDecoder::DecodeStringRef(Chunk& chunk,
+                                     trace_encoded_string_ref_t string_ref,
+                                     fbl::StringPiece* out_string) const {
+    if (string_ref == TRACE_ENCODED_STRING_REF_EMPTY) {
+        *out_string = fbl::StringPiece();
+        return true;
+    }
+
+    if (string_ref & TRACE_ENCODED_STRING_REF_INLINE_FLAG) {
+        size_t length = string_ref & TRACE_ENCODED_STRING_REF_LENGTH_MASK;
+        return length <= TRACE_ENCODED_STRING_REF_MAX_LENGTH &&
+               chunk.ReadString(length, out_string);
+    }
+
+    const StringSlot& slot = strings_[string_ref];
+    if (slot.generation != generation_) {
+        view_->ReportError(fbl::StringPrintf("String ref %u not in table", string_ref));
+        return false;
+    }
+    *out_string = slot.string;
+    return true;
+}
+
+bool SegmentDecoder::DecodeThreadRef(Chunk& chunk,
+                                     trace_encoded_thread_ref_t thread_ref,
+                                     ProcessThread* out_process_thread) const {
+    if (thread_ref == TRACE_ENCODED_THREAD_REF_INLINE) {
+        mx_koid_t process_koid, thread_koid;
+        if (!chunk.ReadUint64(&process_koid) ||
+            !chunk.ReadUint64(&thread_koid))
+            return false;
+        *out_process_thread = ProcessThread(process_koid, thread_koid);
+        return true;
+    }
+
+    const ThreadSlot& slot = threads_[thread_ref];
+    if (slot.generation != generation_) {
+        view_->ReportError(fbl::StringPrintf("Thread ref %u not in table", thread_ref));
+        return false;
+    }
+    *out_process_thread = slot.process_thread;
+    return true;
+}
+
+} // namespace trace
@@ -8,7 +8,8 @@ namespace trace {
 
 const trace_handler_ops_t TraceHandler::kOps =
     {.is_category_enabled = &TraceHandler::CallIsCategoryEnabled,
-     .trace_stopped = &TraceHandler::CallTraceStopped};
+     .trace_stopped = &TraceHandler::CallTraceStopped,
+     .notify_buffer_full = &TraceHandler::CallNotifyBufferFull};
 
 TraceHandler::TraceHandler()
     : trace_handler{.ops = &kOps} {}
@@ -25,4 +26,13 @@ void TraceHandler::CallTraceStopped(trace_handler_t* handler, async_t* async,
                                                       disposition, buffer_bytes_written);
 }
 
+void TraceHandler::CallNotifyBufferFull(trace_handler_t* handler, async_t* async,
+                                        uint32_t buffer_number,
+                                        size_t durable_offset, size_t durable_num_bytes,
+                                        size_t buffer_offset, size_t buffer_num_bytes) {
+    static_cast<TraceHandler*>(handler)->NotifyBufferFull(async, buffer_number,
+                                                          durable_offset, durable_num_bytes,
+                                                          buffer_offset, buffer_num_bytes);
+}
+
 } // namespace trace
@@ -49,10 +49,28 @@ public:
     virtual void TraceStopped(async_t* async,
                               mx_status_t disposition, size_t buffer_bytes_written) {}
 
+    // Called by the trace engine in |TRACE_BUFFERING_MODE_STREAMING| when one
+    // half of the trace buffer has filled and must be saved.
+    //
+    // The handler must save the |durable_num_bytes| bytes at |durable_offset|
+    // followed by the |buffer_num_bytes| bytes at |buffer_offset|, then call
+    // |trace_engine_mark_buffer_saved()| with |buffer_number|.
+    //
+    // Handlers which start the engine in streaming mode must override this.
+    //
+    // Called on an asynchronous dispatch thread.
+    virtual void NotifyBufferFull(async_t* async, uint32_t buffer_number,
+                                  size_t durable_offset, size_t durable_num_bytes,
+                                  size_t buffer_offset, size_t buffer_num_bytes) {}
+
 private:
     static bool CallIsCategoryEnabled(trace_handler_t* handler, const char* category);
     static void CallTraceStopped(trace_handler_t* handler, async_t* async,
                                  mx_status_t disposition, size_t buffer_bytes_written);
+    static void CallNotifyBufferFull(trace_handler_t* handler, async_t* async,
+                                     uint32_t buffer_number,
+                                     size_t durable_offset, size_t durable_num_bytes,
+                                     size_t buffer_offset, size_t buffer_num_bytes);
 
     static const trace_handler_ops_t kOps;
 };
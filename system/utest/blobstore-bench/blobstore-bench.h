@@ -23,6 +23,7 @@ typedef enum {
     WRITE, // write data to blob
     OPEN, // open fd to blob
     READ, // read data from blob
+    FIRST_READ, // read first block of blob (time to first byte)
     CLOSE, // close blob fd
     UNLINK, // unlink blob
     NAME_COUNT // number of name options
@@ -33,6 +33,7 @@
 #include <fbl/auto_lock.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/unique_ptr.h>
+#include <mxio/vfs.h>
 #include <unittest/unittest.h>
 
 #define MOUNT_PATH "/tmp/magenta-blobstore-test"
@@ -241,11 +242,16 @@ static bool VerifyContents(int fd, const char* data, size_t size_data) {
 }
 
 // Creates an open blob with the provided Merkle tree + Data, and
-// reads to verify the data.
+// reads to verify the data. If |compress|, asks for the blob to be stored
+// compressed.
 static bool MakeBlob(const char* path, const char* merkle, size_t size_merkle,
-                     const char* data, size_t size_data, int* out_fd) {
+                     const char* data, size_t size_data, int* out_fd,
+                     bool compress = false) {
     int fd = open(path, O_CREAT | O_RDWR);
     ASSERT_GT(fd, 0, "Failed to create blob");
+    if (compress) {
+        ASSERT_EQ(ioctl_vfs_blob_compress(fd), MX_OK, "Failed to request compression");
+    }
     ASSERT_EQ(ftruncate(fd, size_data), 0);
     ASSERT_EQ(StreamAll(write, fd, data, size_data), 0, "Failed to write Data");
 
@@ -301,7 +307,10 @@ typedef struct blob_info {
 
 // Creates, writes, reads (to verify) and operates on a blob.
 // Returns the result of the post-processing 'func' (true == success).
-static bool GenerateBlob(size_t size_data, fbl::unique_ptr<blob_info_t>* out) {
+//
+// Compressible blobs are made of words drawn from a small random vocabulary.
+static bool GenerateBlob(size_t size_data, fbl::unique_ptr<blob_info_t>* out,
+                         bool compressible = false) {
     // Generate a Blob of random data
     fbl::AllocChecker ac;
     fbl::unique_ptr<blob_info_t> info(new (&ac) blob_info_t);
@@ -310,8 +319,18 @@ static bool GenerateBlob(size_t size_data, fbl::unique_ptr<blob_info_t>* out) {
     EXPECT_EQ(ac.check(), true);
     static unsigned int seed = static_cast<unsigned int>(mx_ticks_get());
 
-    for (size_t i = 0; i < size_data; i++) {
-        info->data[i] = (char)rand_r(&seed);
+    if (compressible) {
+        char words[64][16];
+        for (size_t i = 0; i < sizeof(words); i++) {
+            words[i / 16][i % 16] = (char)rand_r(&seed);
+        }
+        for (size_t i = 0; i < size_data; i += 16) {
+            memcpy(&info->data[i], words[rand_r(&seed) % 64], fbl::min(size_data - i, sizeof(words[0])));
+        }
+    } else {
+        for (size_t i = 0; i < size_data; i++) {
+            info->data[i] = (char)rand_r(&seed);
+        }
     }
     info->size_data = size_data;
 
@@ -398,6 +417,133 @@ static bool TestMmap(void) {
     END_TEST;
 }
 
+// Reads and maps small ranges of a large blob, out of order, without ever
+// touching the rest of it.
+template <fs_test_type_t TestType>
+static bool TestPartialAccess(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    char fvm_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest<TestType>(512, 1 << 20, ramdisk_path, fvm_path), 0, "Mounting Blobstore");
+
+    fbl::unique_ptr<blob_info_t> info;
+    ASSERT_TRUE(GenerateBlob(1 << 22, &info));
+    int fd;
+    ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                         info->data.get(), info->size_data, &fd));
+    ASSERT_EQ(close(fd), 0);
+
+    fd = open(info->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to-reopen blob");
+    const size_t offsets[] = { info->size_data - 100, (1 << 21) + 4000, 0, 12345 };
+    char buf[10000];
+    for (size_t i = 0; i < fbl::count_of(offsets); i++) {
+        size_t len = fbl::min(sizeof(buf), info->size_data - offsets[i]);
+        ASSERT_EQ(lseek(fd, offsets[i], SEEK_SET), static_cast<off_t>(offsets[i]));
+        ASSERT_EQ(StreamAll(read, fd, buf, len), 0, "Failed to read data");
+        ASSERT_EQ(memcmp(buf, &info->data[offsets[i]], len), 0, "Read data, but it was bad");
+    }
+
+    // Page aligned, but not block aligned
+    const size_t map_off = (1 << 20) + PAGE_SIZE;
+    const size_t map_len = 3 * PAGE_SIZE;
+    void* addr = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, map_off);
+    ASSERT_NE(addr, MAP_FAILED, "Could not mmap blob");
+    ASSERT_EQ(memcmp(addr, &info->data[map_off], map_len), 0, "Mmap data invalid");
+    ASSERT_EQ(munmap(addr, map_len), 0, "Could not unmap blob");
+
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink(info->path), 0);
+    ASSERT_EQ(EndBlobstoreTest<TestType>(ramdisk_path, fvm_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+// Writes compressible blobs, asking for them to be compressed, which should
+// then take less space than their size, and reads them back (in part and in
+// full) after remounting.
+template <fs_test_type_t TestType>
+static bool TestCompressed(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    char fvm_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest<TestType>(512, 1 << 20, ramdisk_path, fvm_path), 0, "Mounting Blobstore");
+
+    const size_t sizes[] = { 20000, (1 << 17) + 1234, 1 << 22 };
+    for (size_t i = 0; i < fbl::count_of(sizes); i++) {
+        fbl::unique_ptr<blob_info_t> info;
+        ASSERT_TRUE(GenerateBlob(sizes[i], &info, true));
+
+        int fd;
+        ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                             info->data.get(), info->size_data, &fd, true));
+        struct stat s;
+        ASSERT_EQ(fstat(fd, &s), 0);
+        ASSERT_EQ(static_cast<size_t>(s.st_size), info->size_data);
+        ASSERT_LT(static_cast<size_t>(s.st_blocks) * VNATTR_BLKSIZE,
+                  info->size_data + info->size_merkle, "Blob was not compressed");
+        ASSERT_EQ(close(fd), 0);
+
+        ASSERT_EQ(umount(MOUNT_PATH), MX_OK, "Could not unmount blobstore");
+        ASSERT_EQ(MountBlobstore(ramdisk_path), 0, "Could not re-mount blobstore");
+
+        fd = open(info->path, O_RDONLY);
+        ASSERT_GT(fd, 0, "Failed to open blob");
+        const size_t offsets[] = { info->size_data - 100, info->size_data / 2 + 4000, 12345 };
+        char buf[10000];
+        for (size_t j = 0; j < fbl::count_of(offsets); j++) {
+            size_t len = fbl::min(sizeof(buf), info->size_data - offsets[j]);
+            ASSERT_EQ(lseek(fd, offsets[j], SEEK_SET), static_cast<off_t>(offsets[j]));
+            ASSERT_EQ(StreamAll(read, fd, buf, len), 0, "Failed to read data");
+            ASSERT_EQ(memcmp(buf, &info->data[offsets[j]], len), 0, "Read data, but it was bad");
+        }
+        ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data));
+        ASSERT_EQ(close(fd), 0);
+        ASSERT_EQ(unlink(info->path), 0);
+    }
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(ramdisk_path, fvm_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+// Compressible blobs are stored uncompressed unless their writer asks
+// otherwise, which it must do before setting their size.
+template <fs_test_type_t TestType>
+static bool TestCompressOptional(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    char fvm_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest<TestType>(512, 1 << 20, ramdisk_path, fvm_path), 0, "Mounting Blobstore");
+
+    fbl::unique_ptr<blob_info_t> info;
+    ASSERT_TRUE(GenerateBlob(1 << 17, &info, true));
+    int fd;
+    ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                         info->data.get(), info->size_data, &fd));
+    struct stat s;
+    ASSERT_EQ(fstat(fd, &s), 0);
+    ASSERT_GE(static_cast<size_t>(s.st_blocks) * VNATTR_BLKSIZE,
+              info->size_data + info->size_merkle, "Blob was compressed");
+    ASSERT_EQ(ioctl_vfs_blob_compress(fd), MX_ERR_BAD_STATE);
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink(info->path), 0);
+
+    ASSERT_TRUE(GenerateBlob(1 << 17, &info, true));
+    fd = open(info->path, O_CREAT | O_RDWR);
+    ASSERT_GT(fd, 0, "Failed to create blob");
+    ASSERT_EQ(ftruncate(fd, info->size_data), 0);
+    ASSERT_EQ(ioctl_vfs_blob_compress(fd), MX_ERR_BAD_STATE);
+    ASSERT_EQ(unlink(info->path), 0);
+    ASSERT_EQ(close(fd), 0);
+
+    fd = open(MOUNT_PATH, O_RDONLY | O_DIRECTORY);
+    ASSERT_GT(fd, 0, "Failed to open root directory");
+    ASSERT_EQ(ioctl_vfs_blob_compress(fd), MX_ERR_NOT_FILE);
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(ramdisk_path, fvm_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
 template <fs_test_type_t TestType>
 static bool TestReaddir(void) {
     BEGIN_TEST;
@@ -1436,6 +1582,9 @@ static bool ResizePartition(void) {
 BEGIN_TEST_CASE(blobstore_tests)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, TestBasic)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, TestMmap)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, TestPartialAccess)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, TestCompressed)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, TestCompressOptional)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, TestReaddir)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, UseAfterUnlink)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, WriteAfterRead)
@@ -0,0 +1,99 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/kcounters.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+#include <magenta/syscalls/resource.h>
+#include <unittest/unittest.h>
+#include <string.h>
+
+extern mx_handle_t root_resource;
+
+static bool test_kcounters_requires_root_resource(void) {
+    BEGIN_TEST;
+
+    mx_handle_t vmo;
+    EXPECT_EQ(mx_kcounters_get_vmo(MX_HANDLE_INVALID, &vmo), MX_ERR_BAD_HANDLE, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), MX_OK, "");
+    EXPECT_EQ(mx_kcounters_get_vmo(event, &vmo), MX_ERR_WRONG_TYPE, "");
+    mx_handle_close(event);
+
+    ASSERT_NE(root_resource, MX_HANDLE_INVALID, "no root resource handle");
+    mx_handle_t resource;
+    ASSERT_EQ(mx_resource_create(root_resource, 0x12345678, 0x1000, 0x2000, &resource),
+              MX_OK, "");
+    EXPECT_EQ(mx_kcounters_get_vmo(resource, &vmo), MX_ERR_ACCESS_DENIED, "");
+    mx_handle_close(resource);
+
+    END_TEST;
+}
+
+static bool test_kcounters_vmo(void) {
+    BEGIN_TEST;
+
+    ASSERT_NE(root_resource, MX_HANDLE_INVALID, "no root resource handle");
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_kcounters_get_vmo(root_resource, &vmo), MX_OK, "");
+
+    // Readers may only map the counters.
+    mx_info_handle_basic_t info;
+    ASSERT_EQ(mx_object_get_info(vmo, MX_INFO_HANDLE_BASIC, &info, sizeof(info), NULL, NULL),
+              MX_OK, "");
+    EXPECT_EQ(info.rights & MX_RIGHT_WRITE, 0u, "vmo is writable");
+    uint64_t zero = 0;
+    size_t actual;
+    EXPECT_NE(mx_vmo_write(vmo, &zero, 0, sizeof(zero), &actual), MX_OK, "");
+
+    uint64_t size;
+    ASSERT_EQ(mx_vmo_get_size(vmo, &size), MX_OK, "");
+    ASSERT_GE(size, sizeof(mx_kcounters_header_t), "");
+
+    // The kernel writes the counters without faulting, so the pages must
+    // not go away underneath it.
+    EXPECT_NE(mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0, size, NULL, 0), MX_OK, "");
+
+    uintptr_t addr;
+    EXPECT_NE(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr),
+              MX_OK, "writable mapping");
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size, MX_VM_FLAG_PERM_READ, &addr),
+              MX_OK, "");
+
+    const mx_kcounters_header_t* header = (const mx_kcounters_header_t*)addr;
+    EXPECT_EQ(header->magic, MX_KCOUNTERS_MAGIC, "");
+    EXPECT_GT(header->num_counters, 0u, "");
+    EXPECT_GE(header->cpu_stride, header->num_counters, "");
+    EXPECT_LE(header->counters_offset +
+                  (uint64_t)header->num_cpus * header->cpu_stride * sizeof(uint64_t),
+              size, "counters run past the end of the vmo");
+
+    // The scheduler counts context switches, so by now there have been some.
+    const mx_kcounter_desc_t* descs =
+        (const mx_kcounter_desc_t*)(addr + header->desc_offset);
+    const uint64_t* counters = (const uint64_t*)(addr + header->counters_offset);
+    bool found = false;
+    for (uint32_t i = 0; i < header->num_counters; i++) {
+        if (strcmp(descs[i].name, "kernel.context_switches"))
+            continue;
+        uint64_t total = 0;
+        for (uint32_t cpu = 0; cpu < header->num_cpus; cpu++)
+            total += counters[cpu * header->cpu_stride + i];
+        EXPECT_GT(total, 0u, "no context switches counted");
+        found = true;
+    }
+    EXPECT_TRUE(found, "kernel.context_switches missing");
+
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), addr, size), MX_OK, "");
+    mx_handle_close(vmo);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(kcounters_tests)
+RUN_TEST(test_kcounters_requires_root_resource);
+RUN_TEST(test_kcounters_vmo);
+END_TEST_CASE(kcounters_tests)
@@ -0,0 +1,79 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <digest/digest.h>
+#include <digest/merkle-tree.h>
+#include <magenta/syscalls.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
+#include <unittest/unittest.h>
+
+using digest::Digest;
+using digest::MerkleTree;
+
+namespace {
+
+constexpr size_t kMB = 1 << 20;
+constexpr int kIterations = 4;
+
+// Builds Merkle trees for |DataSize| bytes of random data, both with the
+// one-shot |Create| (which hashes the data nodes in parallel) and with the
+// serial CreateInit/Update/Final methods, and reports the throughput of each.
+template <size_t DataSize>
+bool benchmark_merkle_tree_create(void) {
+    BEGIN_TEST;
+    size_t tree_len = MerkleTree::GetTreeLength(DataSize);
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[DataSize]);
+    ASSERT_TRUE(ac.check(), "Failed to allocate data");
+    fbl::unique_ptr<uint8_t[]> tree(new (&ac) uint8_t[tree_len]);
+    ASSERT_TRUE(ac.check(), "Failed to allocate tree");
+    for (size_t i = 0; i < DataSize; ++i) {
+        data[i] = static_cast<uint8_t>(rand());
+    }
+
+    Digest parallel;
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (int i = 0; i < kIterations; ++i) {
+        ASSERT_EQ(MerkleTree::Create(data.get(), DataSize, tree.get(),
+                                     tree_len, &parallel),
+                  MX_OK, "Create failed");
+    }
+    mx_time_t parallel_ns = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+
+    Digest serial;
+    start = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (int i = 0; i < kIterations; ++i) {
+        MerkleTree mt;
+        ASSERT_EQ(mt.CreateInit(DataSize, tree_len), MX_OK, "CreateInit failed");
+        ASSERT_EQ(mt.CreateUpdate(data.get(), DataSize, tree.get()), MX_OK,
+                  "CreateUpdate failed");
+        ASSERT_EQ(mt.CreateFinal(tree.get(), &serial), MX_OK,
+                  "CreateFinal failed");
+    }
+    mx_time_t serial_ns = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+    ASSERT_TRUE(parallel == serial, "Root digests differ");
+
+    uint64_t bytes = static_cast<uint64_t>(DataSize) * kIterations * 1000;
+    printf("\n%zu MB: parallel %" PRIu64 " MB/s, serial %" PRIu64 " MB/s\n",
+           DataSize / kMB, bytes / (parallel_ns + 1),
+           bytes / (serial_ns + 1));
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(digest_benchmarks)
+RUN_TEST_PERFORMANCE((benchmark_merkle_tree_create<kMB>))
+RUN_TEST_PERFORMANCE((benchmark_merkle_tree_create<16 * kMB>))
+RUN_TEST_PERFORMANCE((benchmark_merkle_tree_create<64 * kMB>))
+END_TEST_CASE(digest_benchmarks)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
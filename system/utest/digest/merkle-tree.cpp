@@ -5,10 +5,13 @@
 #include <digest/merkle-tree.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <digest/digest.h>
 #include <magenta/assert.h>
 #include <magenta/status.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
 #include <unittest/unittest.h>
 
 namespace {
@@ -378,6 +381,38 @@ bool CreateByteByByte(void) {
     END_TEST;
 }
 
+bool CreateParallel(void) {
+    BEGIN_TEST_WITH_RC;
+    // Large enough for |Create| to hash the data nodes on several threads on
+    // multi-core machines; the tree must match the one built serially.
+    size_t data_len = (kNodeSize * 1024) + (kNodeSize / 3);
+    size_t tree_len = MerkleTree::GetTreeLength(data_len);
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[data_len]);
+    ASSERT_TRUE(ac.check(), "Failed to allocate data");
+    fbl::unique_ptr<uint8_t[]> actual_tree(new (&ac) uint8_t[tree_len]);
+    ASSERT_TRUE(ac.check(), "Failed to allocate tree");
+    fbl::unique_ptr<uint8_t[]> expected_tree(new (&ac) uint8_t[tree_len]);
+    ASSERT_TRUE(ac.check(), "Failed to allocate tree");
+    for (size_t i = 0; i < data_len; ++i) {
+        data[i] = static_cast<uint8_t>(rand());
+    }
+    memset(actual_tree.get(), 0xff, tree_len);
+    Digest actual;
+    ASSERT_OK(MerkleTree::Create(data.get(), data_len, actual_tree.get(),
+                                 tree_len, &actual));
+    MerkleTree merkleTree;
+    Digest expected;
+    ASSERT_OK(merkleTree.CreateInit(data_len, tree_len));
+    ASSERT_OK(merkleTree.CreateUpdate(data.get(), data_len,
+                                      expected_tree.get()));
+    ASSERT_OK(merkleTree.CreateFinal(expected_tree.get(), &expected));
+    ASSERT_TRUE(actual == expected, "Incorrect root digest");
+    ASSERT_EQ(memcmp(actual_tree.get(), expected_tree.get(), tree_len), 0,
+              "Incorrect Merkle tree");
+    END_TEST;
+}
+
 bool CreateMissingData(void) {
     BEGIN_TEST_WITH_RC;
     size_t tree_len = MerkleTree::GetTreeLength(kSmall);
@@ -719,6 +754,7 @@ RUN_TEST(CreateAll)
 RUN_TEST(CreateFinalCAll)
 RUN_TEST(CreateCAll)
 RUN_TEST(CreateByteByByte)
+RUN_TEST(CreateParallel)
 RUN_TEST(CreateMissingData)
 RUN_TEST(CreateMissingTree)
 RUN_TEST(CreateTreeTooSmall)
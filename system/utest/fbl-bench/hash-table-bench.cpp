@@ -0,0 +1,118 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <fbl/alloc_checker.h>
+#include <fbl/intrusive_hash_table.h>
+#include <fbl/intrusive_resizable_hash_table.h>
+#include <fbl/intrusive_single_list.h>
+#include <fbl/unique_ptr.h>
+#include <unittest/unittest.h>
+
+namespace {
+
+constexpr size_t kLookups = 10000;
+
+struct BenchObj : public fbl::SinglyLinkedListable<BenchObj*> {
+    uint64_t GetKey() const { return key_; }
+    static uint64_t GetHash(const uint64_t& key) { return key; }
+    uint64_t key_ = 0;
+};
+
+using FixedTable = fbl::HashTable<uint64_t, BenchObj*>;
+using ResizableTable = fbl::ResizableHashTable<uint64_t, BenchObj*>;
+
+// Runs on both the host and the target, so use the POSIX clock rather than
+// mx_time_get.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+struct BenchResult {
+    uint64_t insert_ns;
+    uint64_t max_insert_ns;
+    uint64_t find_ns;
+};
+
+// Inserts |count| objects into |table| (timing each insert individually to
+// find the worst one), looks up kLookups of them, then empties the table.
+template <typename TableType>
+bool run_bench(TableType* table, BenchObj* objs, size_t count, BenchResult* result) {
+    BEGIN_HELPER;
+
+    uint64_t max_insert_ns = 0;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t insert_start = now_ns();
+        table->insert(&objs[i]);
+        uint64_t insert_ns = now_ns() - insert_start;
+        if (insert_ns > max_insert_ns)
+            max_insert_ns = insert_ns;
+    }
+    result->insert_ns = now_ns() - start;
+    result->max_insert_ns = max_insert_ns;
+
+    start = now_ns();
+    for (size_t i = 0; i < kLookups; ++i) {
+        size_t ndx = (i * 7919) % count;
+        ASSERT_TRUE(table->find(objs[ndx].key_).IsValid(), "lookup failed");
+    }
+    result->find_ns = now_ns() - start;
+
+    ASSERT_EQ(count, table->size(), "wrong table size");
+    table->clear();
+
+    END_HELPER;
+}
+
+// Compares the fixed size HashTable (with its default 37 buckets) to the
+// ResizableHashTable holding |Count| elements.
+template <size_t Count>
+bool benchmark_hash_table(void) {
+    BEGIN_TEST;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<BenchObj[]> objs(new (&ac) BenchObj[Count]);
+    ASSERT_TRUE(ac.check(), "Failed to allocate objects");
+    for (size_t i = 0; i < Count; ++i) {
+        objs[i].key_ = (i + 1) * 0x9E3779B97F4A7C15ull;
+    }
+
+    BenchResult fixed, resizable;
+    {
+        FixedTable table;
+        ASSERT_TRUE(run_bench(&table, objs.get(), Count, &fixed), "");
+    }
+    {
+        ResizableTable table;
+        ASSERT_TRUE(run_bench(&table, objs.get(), Count, &resizable), "");
+    }
+
+    printf("\n%zu elements:\n", Count);
+    printf("    fixed:     insert %" PRIu64 " ns/op (max %" PRIu64 " ns), find %" PRIu64 " ns/op\n",
+           fixed.insert_ns / Count, fixed.max_insert_ns, fixed.find_ns / kLookups);
+    printf("    resizable: insert %" PRIu64 " ns/op (max %" PRIu64 " ns), find %" PRIu64 " ns/op\n",
+           resizable.insert_ns / Count, resizable.max_insert_ns, resizable.find_ns / kLookups);
+
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(hash_table_benchmarks)
+RUN_TEST_PERFORMANCE((benchmark_hash_table<1000>))
+RUN_TEST_PERFORMANCE((benchmark_hash_table<10000>))
+RUN_TEST_PERFORMANCE((benchmark_hash_table<100000>))
+RUN_TEST_PERFORMANCE((benchmark_hash_table<1000000>))
+END_TEST_CASE(hash_table_benchmarks)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
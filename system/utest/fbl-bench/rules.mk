@@ -0,0 +1,49 @@
+# Copyright 2017 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+# Userspace benchmarks.
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := usertest
+
+MODULE_NAME := fbl-bench-test
+
+MODULE_SRCS := \
+    $(LOCAL_DIR)/hash-table-bench.cpp \
+
+MODULE_STATIC_LIBS := \
+    system/ulib/mxcpp \
+    system/ulib/fbl \
+
+MODULE_LIBS := \
+    system/ulib/c \
+    system/ulib/unittest \
+    system/ulib/magenta \
+
+include make/module.mk
+
+# Host benchmarks.
+
+MODULE := $(LOCAL_DIR).hostapp
+
+MODULE_TYPE := hostapp
+
+MODULE_NAME := fbl-bench
+
+MODULE_SRCS := \
+    $(LOCAL_DIR)/hash-table-bench.cpp \
+
+MODULE_COMPILEFLAGS := \
+    -Isystem/ulib/fbl/include \
+    -Isystem/ulib/unittest/include \
+
+MODULE_HOST_LIBS := \
+    system/ulib/fbl.hostlib \
+    system/ulib/pretty.hostlib \
+    system/ulib/unittest.hostlib \
+
+include make/module.mk
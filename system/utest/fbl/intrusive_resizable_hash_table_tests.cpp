@@ -0,0 +1,293 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <unittest/unittest.h>
+#include <fbl/intrusive_single_list.h>
+#include <fbl/intrusive_resizable_hash_table.h>
+#include <fbl/unique_ptr.h>
+#include <fbl/tests/intrusive_containers/associative_container_test_environment.h>
+#include <fbl/tests/intrusive_containers/intrusive_resizable_hash_table_checker.h>
+#include <fbl/tests/intrusive_containers/test_thunks.h>
+
+namespace fbl {
+namespace tests {
+namespace intrusive_containers {
+
+using OtherKeyType  = uint16_t;
+using OtherHashType = uint32_t;
+
+// Resizable hash tables expect hash functions to use the full range of their
+// HashType.  The test objects' default hash reduces its result modulo the
+// "number of buckets" they are instantiated with, so instantiate them with a
+// large prime instead.
+static constexpr size_t kHashModulus = 0xfffffffb;
+
+template <typename PtrType>
+struct OtherHashTraits {
+    using ObjType = typename ::fbl::internal::ContainerPtrTraits<PtrType>::ValueType;
+    using BucketStateType = SinglyLinkedListNodeState<PtrType>;
+
+    // Linked List Traits
+    static BucketStateType& node_state(ObjType& obj) {
+        return obj.other_container_state_.bucket_state_;
+    }
+
+    // Keyed Object Traits
+    static OtherKeyType GetKey(const ObjType& obj) {
+        return obj.other_container_state_.key_;
+    }
+
+    static bool LessThan(const OtherKeyType& key1, const OtherKeyType& key2) {
+        return key1 <  key2;
+    }
+
+    static bool EqualTo(const OtherKeyType& key1, const OtherKeyType& key2) {
+        return key1 == key2;
+    }
+
+    // Hash Traits
+    static OtherHashType GetHash(const OtherKeyType& key) {
+        return static_cast<OtherHashType>(key * 0xaee58187);
+    }
+
+    // Set key is a trait which is only used by the tests, not by the containers
+    // themselves.
+    static void SetKey(ObjType& obj, OtherKeyType key) {
+        obj.other_container_state_.key_ = key;
+    }
+};
+
+template <typename PtrType>
+struct OtherHashState {
+private:
+    friend struct OtherHashTraits<PtrType>;
+    OtherKeyType key_;
+    typename OtherHashTraits<PtrType>::BucketStateType bucket_state_;
+};
+
+template <typename PtrType>
+class RHTSLLTraits {
+public:
+    using ObjType = typename ::fbl::internal::ContainerPtrTraits<PtrType>::ValueType;
+
+    using ContainerType           = ResizableHashTable<size_t, PtrType>;
+    using ContainableBaseClass    = SinglyLinkedListable<PtrType>;
+    using ContainerStateType      = SinglyLinkedListNodeState<PtrType>;
+    using KeyType                 = typename ContainerType::KeyType;
+    using HashType                = typename ContainerType::HashType;
+
+    using OtherContainerTraits    = OtherHashTraits<PtrType>;
+    using OtherContainerStateType = OtherHashState<PtrType>;
+    using OtherBucketType         = SinglyLinkedList<PtrType, OtherContainerTraits>;
+    using OtherContainerType      = ResizableHashTable<OtherKeyType,
+                                                       PtrType,
+                                                       OtherBucketType,
+                                                       OtherHashType,
+                                                       OtherContainerTraits,
+                                                       OtherContainerTraits>;
+
+    using TestObjBaseType  = HashedTestObjBase<typename ContainerType::KeyType,
+                                               typename ContainerType::HashType,
+                                               kHashModulus>;
+};
+
+DEFINE_TEST_OBJECTS(RHTSLL);
+using UMTE = DEFINE_TEST_THUNK(Associative, RHTSLL, Unmanaged);
+using UPTE = DEFINE_TEST_THUNK(Associative, RHTSLL, UniquePtr);
+using RPTE = DEFINE_TEST_THUNK(Associative, RHTSLL, RefPtr);
+
+// Objects with an identity hash, used to exercise the table through many
+// resizes.  Sequential keys only differ in their low bits, which the table's
+// own hash mixing has to spread over all of the buckets.
+struct ResizeTestObj : public SinglyLinkedListable<ResizeTestObj*> {
+    size_t GetKey() const { return key_; }
+    static size_t GetHash(const size_t& key) { return key; }
+    size_t key_ = 0;
+};
+
+using ResizeTestTable = ResizableHashTable<size_t, ResizeTestObj*>;
+
+static bool ResizeTest() {
+    BEGIN_TEST;
+
+    static constexpr size_t kObjCount = 5000;
+    static constexpr size_t kCheckInterval = 97;
+
+    AllocChecker ac;
+    unique_ptr<ResizeTestObj[]> objs(new (&ac) ResizeTestObj[kObjCount]);
+    ASSERT_TRUE(ac.check(), "");
+
+    // Insert everything, checking the table as it grows and migrates.
+    ResizeTestTable table;
+    for (size_t i = 0; i < kObjCount; ++i) {
+        objs[i].key_ = i;
+        table.insert(&objs[i]);
+        if (!(i % kCheckInterval))
+            ASSERT_TRUE(ResizableHashTableChecker::SanityCheck(table), "");
+    }
+    ASSERT_TRUE(ResizableHashTableChecker::SanityCheck(table), "");
+    EXPECT_EQ(kObjCount, table.size(), "");
+
+    for (size_t i = 0; i < kObjCount; ++i) {
+        auto iter = table.find(i);
+        ASSERT_TRUE(iter.IsValid(), "");
+        EXPECT_EQ(&objs[i], &(*iter), "");
+    }
+
+    // Erasing while iterating is safe; erase the odd keys this way.
+    size_t visited = 0;
+    for (auto iter = table.begin(); iter.IsValid(); ) {
+        auto cur = iter++;
+        if (cur->key_ & 1)
+            EXPECT_EQ(&(*cur), table.erase(cur), "");
+        ++visited;
+    }
+    EXPECT_EQ(kObjCount, visited, "");
+    EXPECT_EQ(kObjCount / 2, table.size(), "");
+    ASSERT_TRUE(ResizableHashTableChecker::SanityCheck(table), "");
+
+    // Put them back, this time with insert_or_find, which must find each even
+    // key and insert each odd one.
+    for (size_t i = 0; i < kObjCount; ++i) {
+        ResizeTestTable::iterator iter;
+        EXPECT_EQ(static_cast<bool>(i & 1), table.insert_or_find(&objs[i], &iter), "");
+        ASSERT_TRUE(iter.IsValid(), "");
+        EXPECT_EQ(&objs[i], &(*iter), "");
+    }
+    ASSERT_TRUE(ResizableHashTableChecker::SanityCheck(table), "");
+
+    // Clearing returns the table to its initial state, after which it must
+    // grow again.
+    table.clear();
+    EXPECT_TRUE(table.is_empty(), "");
+    EXPECT_EQ(1u, table.bucket_count(), "");
+    for (size_t i = 0; i < kCheckInterval; ++i)
+        table.insert(&objs[i]);
+    ASSERT_TRUE(ResizableHashTableChecker::SanityCheck(table), "");
+    EXPECT_LT(1u, table.bucket_count(), "");
+    table.clear();
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(resizable_hashtable_sll_tests)
+//////////////////////////////////////////
+// General container specific tests.
+//////////////////////////////////////////
+RUN_NAMED_TEST("Clear (unmanaged)",            UMTE::ClearTest)
+RUN_NAMED_TEST("Clear (unique)",               UPTE::ClearTest)
+RUN_NAMED_TEST("Clear (RefPtr)",               RPTE::ClearTest)
+
+RUN_NAMED_TEST("ClearUnsafe (unmanaged)",      UMTE::ClearUnsafeTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("ClearUnsafe (unique)",         UPTE::ClearUnsafeTest)
+RUN_NAMED_TEST("ClearUnsafe (RefPtr)",         RPTE::ClearUnsafeTest)
+#endif
+
+RUN_NAMED_TEST("IsEmpty (unmanaged)",          UMTE::IsEmptyTest)
+RUN_NAMED_TEST("IsEmpty (unique)",             UPTE::IsEmptyTest)
+RUN_NAMED_TEST("IsEmpty (RefPtr)",             RPTE::IsEmptyTest)
+
+RUN_NAMED_TEST("Iterate (unmanaged)",          UMTE::IterateTest)
+RUN_NAMED_TEST("Iterate (unique)",             UPTE::IterateTest)
+RUN_NAMED_TEST("Iterate (RefPtr)",             RPTE::IterateTest)
+
+// Hashtables with singly linked list bucket can perform direct
+// iterator/reference erase operations, but the operations will be O(n)
+RUN_NAMED_TEST("IterErase (unmanaged)",        UMTE::IterEraseTest)
+RUN_NAMED_TEST("IterErase (unique)",           UPTE::IterEraseTest)
+RUN_NAMED_TEST("IterErase (RefPtr)",           RPTE::IterEraseTest)
+
+RUN_NAMED_TEST("DirectErase (unmanaged)",      UMTE::DirectEraseTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("DirectErase (unique)",         UPTE::DirectEraseTest)
+#endif
+RUN_NAMED_TEST("DirectErase (RefPtr)",         RPTE::DirectEraseTest)
+
+RUN_NAMED_TEST("MakeIterator (unmanaged)",     UMTE::MakeIteratorTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("MakeIterator (unique)",        UPTE::MakeIteratorTest)
+#endif
+RUN_NAMED_TEST("MakeIterator (RefPtr)",        RPTE::MakeIteratorTest)
+
+// HashTables with SinglyLinkedList buckets cannot iterate backwards (because
+// their buckets cannot iterate backwards)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("ReverseIterErase (unmanaged)", UMTE::ReverseIterEraseTest)
+RUN_NAMED_TEST("ReverseIterErase (unique)",    UPTE::ReverseIterEraseTest)
+RUN_NAMED_TEST("ReverseIterErase (RefPtr)",    RPTE::ReverseIterEraseTest)
+
+RUN_NAMED_TEST("ReverseIterate (unmanaged)",   UMTE::ReverseIterateTest)
+RUN_NAMED_TEST("ReverseIterate (unique)",      UPTE::ReverseIterateTest)
+RUN_NAMED_TEST("ReverseIterate (RefPtr)",      RPTE::ReverseIterateTest)
+#endif
+
+// Hash tables do not support swapping or Rvalue operations (Assignment or
+// construction) as doing so would be an O(n) operation (With 'n' == to the
+// number of buckets in the hashtable)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("Swap (unmanaged)",             UMTE::SwapTest)
+RUN_NAMED_TEST("Swap (unique)",                UPTE::SwapTest)
+RUN_NAMED_TEST("Swap (RefPtr)",                RPTE::SwapTest)
+
+RUN_NAMED_TEST("Rvalue Ops (unmanaged)",       UMTE::RvalueOpsTest)
+RUN_NAMED_TEST("Rvalue Ops (unique)",          UPTE::RvalueOpsTest)
+RUN_NAMED_TEST("Rvalue Ops (RefPtr)",          RPTE::RvalueOpsTest)
+#endif
+
+RUN_NAMED_TEST("Scope (unique)",               UPTE::ScopeTest)
+RUN_NAMED_TEST("Scope (RefPtr)",               RPTE::ScopeTest)
+
+RUN_NAMED_TEST("TwoContainer (unmanaged)",     UMTE::TwoContainerTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("TwoContainer (unique)",        UPTE::TwoContainerTest)
+#endif
+RUN_NAMED_TEST("TwoContainer (RefPtr)",        RPTE::TwoContainerTest)
+
+RUN_NAMED_TEST("IterCopyPointer (unmanaged)",  UMTE::IterCopyPointerTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("IterCopyPointer (unique)",     UPTE::IterCopyPointerTest)
+#endif
+RUN_NAMED_TEST("IterCopyPointer (RefPtr)",     RPTE::IterCopyPointerTest)
+
+RUN_NAMED_TEST("EraseIf (unmanaged)",          UMTE::EraseIfTest)
+RUN_NAMED_TEST("EraseIf (unique)",             UPTE::EraseIfTest)
+RUN_NAMED_TEST("EraseIf (RefPtr)",             RPTE::EraseIfTest)
+
+RUN_NAMED_TEST("FindIf (unmanaged)",           UMTE::FindIfTest)
+RUN_NAMED_TEST("FindIf (unique)",              UPTE::FindIfTest)
+RUN_NAMED_TEST("FindIf (RefPtr)",              RPTE::FindIfTest)
+
+//////////////////////////////////////////
+// Associative container specific tests.
+//////////////////////////////////////////
+RUN_NAMED_TEST("InsertByKey (unmanaged)",      UMTE::InsertByKeyTest)
+RUN_NAMED_TEST("InsertByKey (unique)",         UPTE::InsertByKeyTest)
+RUN_NAMED_TEST("InsertByKey (RefPtr)",         RPTE::InsertByKeyTest)
+
+RUN_NAMED_TEST("FindByKey (unmanaged)",        UMTE::FindByKeyTest)
+RUN_NAMED_TEST("FindByKey (unique)",           UPTE::FindByKeyTest)
+RUN_NAMED_TEST("FindByKey (RefPtr)",           RPTE::FindByKeyTest)
+
+RUN_NAMED_TEST("EraseByKey (unmanaged)",       UMTE::EraseByKeyTest)
+RUN_NAMED_TEST("EraseByKey (unique)",          UPTE::EraseByKeyTest)
+RUN_NAMED_TEST("EraseByKey (RefPtr)",          RPTE::EraseByKeyTest)
+
+RUN_NAMED_TEST("InsertOrFind (unmanaged)",     UMTE::InsertOrFindTest)
+RUN_NAMED_TEST("InsertOrFind (unique)",        UPTE::InsertOrFindTest)
+RUN_NAMED_TEST("InsertOrFind (RefPtr)",        RPTE::InsertOrFindTest)
+
+RUN_NAMED_TEST("InsertOrReplace (unmanaged)",  UMTE::InsertOrReplaceTest)
+RUN_NAMED_TEST("InsertOrReplace (unique)",     UPTE::InsertOrReplaceTest)
+RUN_NAMED_TEST("InsertOrReplace (RefPtr)",     RPTE::InsertOrReplaceTest)
+
+//////////////////////////////////////////
+// Resizable hash table specific tests.
+//////////////////////////////////////////
+RUN_NAMED_TEST("Resize (unmanaged)",           ResizeTest)
+END_TEST_CASE(resizable_hashtable_sll_tests);
+
+}  // namespace intrusive_containers
+}  // namespace tests
+}  // namespace fbl
@@ -16,6 +16,7 @@ fbl_common_tests := \
     $(LOCAL_DIR)/intrusive_doubly_linked_list_tests.cpp \
     $(LOCAL_DIR)/intrusive_hash_table_dll_tests.cpp \
     $(LOCAL_DIR)/intrusive_hash_table_sll_tests.cpp \
+    $(LOCAL_DIR)/intrusive_resizable_hash_table_tests.cpp \
     $(LOCAL_DIR)/intrusive_singly_linked_list_tests.cpp \
     $(LOCAL_DIR)/intrusive_wavl_tree_tests.cpp \
     $(LOCAL_DIR)/main.c \
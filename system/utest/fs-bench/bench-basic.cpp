@@ -9,8 +9,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <threads.h>
 #include <unistd.h>
 
 #include <magenta/device/vfs.h>
@@ -105,6 +107,202 @@ bool benchmark_write_read(void) {
     END_TEST;
 }
 
+void print_cache_stats(int fd, const vfs_cache_stats_t* before) {
+    vfs_cache_stats_t after;
+    if (ioctl_vfs_get_cache_stats(fd, &after) != sizeof(after)) {
+        return;
+    }
+    printf("  cache: %lu hits, %lu misses, %lu read ahead, %lu evicted (blocks of %u bytes)\n",
+           after.hits - before->hits, after.misses - before->misses,
+           after.readahead - before->readahead, after.evictions - before->evictions,
+           after.block_size);
+}
+
+// The goal of this benchmark is to measure sequential reads of a file which
+// was written a while ago, and is larger than the filesystem's cache; in
+// other words, how well reads are batched and fetched ahead of the reader.
+template <size_t FileSize, size_t ReadSize>
+bool benchmark_sequential_read(void) {
+    BEGIN_TEST;
+    int fd = open(MOUNT_POINT "/bigfile", O_CREAT | O_RDWR, 0644);
+    ASSERT_GT(fd, 0, "Cannot create file (FS benchmarks assume mounted FS exists at '/benchmark')");
+    if (FileSize / MB > 64 && benchmark_banned(fd, "memfs")) {
+        ASSERT_EQ(close(fd), 0);
+        ASSERT_EQ(unlink(MOUNT_POINT "/bigfile"), 0);
+        return true;
+    }
+    printf("\nBenchmarking Sequential Read (%lu MB, %lu KB reads)\n", FileSize / MB,
+           ReadSize / KB);
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[ReadSize]);
+    ASSERT_EQ(ac.check(), true);
+    memset(data.get(), kMagicByte, ReadSize);
+    for (size_t i = 0; i < FileSize / ReadSize; i++) {
+        ASSERT_EQ(write(fd, data.get(), ReadSize), ReadSize);
+    }
+    ASSERT_EQ(close(fd), 0);
+
+    for (int i = 0; i < kWriteReadCycles; i++) {
+        fd = open(MOUNT_POINT "/bigfile", O_RDONLY);
+        ASSERT_GT(fd, 0);
+        vfs_cache_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+        ioctl_vfs_get_cache_stats(fd, &stats);
+
+        char str[100];
+        snprintf(str, sizeof(str), "read %d", i);
+        uint64_t start = mx_ticks_get();
+        for (size_t count = FileSize / ReadSize; count > 0; count--) {
+            ASSERT_EQ(read(fd, data.get(), ReadSize), ReadSize);
+            ASSERT_EQ(data[0], kMagicByte);
+        }
+        time_end(str, start);
+        print_cache_stats(fd, &stats);
+        ASSERT_EQ(close(fd), 0);
+    }
+
+    ASSERT_EQ(unlink(MOUNT_POINT "/bigfile"), 0);
+    END_TEST;
+}
+
+// The goal of this benchmark is to compare scanning a large file with read()
+// against scanning it through a mapping of the file, where no RPCs are needed
+// once the mapping is established.
+template <size_t FileSize>
+bool benchmark_mmap_scan(void) {
+    BEGIN_TEST;
+    constexpr size_t kReadSize = 64 * KB;
+    int fd = open(MOUNT_POINT "/bigfile", O_CREAT | O_RDWR, 0644);
+    ASSERT_GT(fd, 0, "Cannot create file (FS benchmarks assume mounted FS exists at '/benchmark')");
+    printf("\nBenchmarking mmap scan vs read scan (%lu MB)\n", FileSize / MB);
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[kReadSize]);
+    ASSERT_EQ(ac.check(), true);
+    memset(data.get(), kMagicByte, kReadSize);
+    for (size_t i = 0; i < FileSize / kReadSize; i++) {
+        ASSERT_EQ(write(fd, data.get(), kReadSize), kReadSize);
+    }
+
+    for (int i = 0; i < kWriteReadCycles; i++) {
+        char str[100];
+        uint64_t sum = 0;
+
+        snprintf(str, sizeof(str), "read scan %d", i);
+        ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+        uint64_t start = mx_ticks_get();
+        for (size_t count = FileSize / kReadSize; count > 0; count--) {
+            ASSERT_EQ(read(fd, data.get(), kReadSize), kReadSize);
+            for (size_t j = 0; j < kReadSize; j += PAGE_SIZE) {
+                sum += data[j];
+            }
+        }
+        time_end(str, start);
+
+        snprintf(str, sizeof(str), "mmap scan %d", i);
+        start = mx_ticks_get();
+        void* addr = mmap(NULL, FileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            printf("Filesystem does not support mmap; not timing mmap scan\n");
+            break;
+        }
+        const uint8_t* mapped = static_cast<const uint8_t*>(addr);
+        for (size_t j = 0; j < FileSize; j += PAGE_SIZE) {
+            sum -= mapped[j];
+        }
+        ASSERT_EQ(munmap(addr, FileSize), 0);
+        time_end(str, start);
+        ASSERT_EQ(sum, 0);
+    }
+
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink(MOUNT_POINT "/bigfile"), 0);
+    END_TEST;
+}
+
+constexpr size_t kConcurrentFileSize = 16 * MB;
+constexpr size_t kConcurrentReadSize = 64 * KB;
+
+struct ConcurrentReader {
+    char path[PATH_MAX];
+    bool ok;
+};
+
+int concurrent_read_thread(void* arg) {
+    ConcurrentReader* reader = static_cast<ConcurrentReader*>(arg);
+    reader->ok = false;
+    int fd = open(reader->path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    uint8_t* data = static_cast<uint8_t*>(malloc(kConcurrentReadSize));
+    if (data == nullptr) {
+        close(fd);
+        return -1;
+    }
+    for (size_t count = kConcurrentFileSize / kConcurrentReadSize; count > 0; count--) {
+        if ((read(fd, data, kConcurrentReadSize) != kConcurrentReadSize) ||
+            (data[0] != kMagicByte)) {
+            free(data);
+            close(fd);
+            return -1;
+        }
+    }
+    free(data);
+    reader->ok = (close(fd) == 0);
+    return 0;
+}
+
+// The goal of this benchmark is to measure how reads scale with the number of
+// clients: each client reads a file of its own, from its own thread, at the
+// same time as all the others.
+template <size_t NumClients>
+bool benchmark_concurrent_read(void) {
+    BEGIN_TEST;
+    printf("\nBenchmarking Concurrent Read (%lu clients, %lu MB each)\n", NumClients,
+           kConcurrentFileSize / MB);
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[kConcurrentReadSize]);
+    ASSERT_EQ(ac.check(), true);
+    memset(data.get(), kMagicByte, kConcurrentReadSize);
+
+    ConcurrentReader readers[NumClients];
+    for (size_t i = 0; i < NumClients; i++) {
+        snprintf(readers[i].path, sizeof(readers[i].path), MOUNT_POINT "/reader%zu", i);
+        int fd = open(readers[i].path, O_CREAT | O_RDWR, 0644);
+        ASSERT_GT(fd, 0, "Cannot create file (FS benchmarks assume mounted FS exists at '/benchmark')");
+        for (size_t count = kConcurrentFileSize / kConcurrentReadSize; count > 0; count--) {
+            ASSERT_EQ(write(fd, data.get(), kConcurrentReadSize), kConcurrentReadSize);
+        }
+        ASSERT_EQ(close(fd), 0);
+    }
+
+    for (int i = 0; i < kWriteReadCycles; i++) {
+        char str[100];
+        snprintf(str, sizeof(str), "read %d", i);
+        thrd_t threads[NumClients];
+        uint64_t start = mx_ticks_get();
+        for (size_t j = 0; j < NumClients; j++) {
+            ASSERT_EQ(thrd_create(&threads[j], concurrent_read_thread, &readers[j]),
+                      thrd_success);
+        }
+        for (size_t j = 0; j < NumClients; j++) {
+            int result;
+            ASSERT_EQ(thrd_join(threads[j], &result), thrd_success);
+            ASSERT_EQ(result, 0);
+            ASSERT_TRUE(readers[j].ok);
+        }
+        time_end(str, start);
+    }
+
+    for (size_t i = 0; i < NumClients; i++) {
+        ASSERT_EQ(unlink(readers[i].path), 0);
+    }
+    END_TEST;
+}
+
 #define START_STRING "/aaa"
 
 size_t constexpr kComponentLength = fbl::constexpr_strlen(START_STRING);
@@ -191,14 +389,95 @@ bool benchmark_path_walk(void) {
     END_TEST;
 }
 
+// Creates, looks up, and deletes |num_files| files within the (new)
+// directory |dir|, timing each phase.
+bool large_directory_helper(const char* dir, size_t num_files) {
+    ASSERT_EQ(mkdir(dir, 0755), 0);
+
+    char path[PATH_MAX];
+    uint64_t start = mx_ticks_get();
+    size_t count;
+    for (count = 0; count < num_files; count++) {
+        snprintf(path, sizeof(path), "%s/%08zu", dir, count);
+        int fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 && errno == ENOSPC) {
+            printf("Filesystem full after %zu files; not timing lookup / unlink\n", count);
+            break;
+        }
+        ASSERT_GT(fd, 0, "Could not create file");
+        ASSERT_EQ(close(fd), 0);
+    }
+    if (count == num_files) {
+        time_end("create", start);
+
+        start = mx_ticks_get();
+        for (size_t i = 0; i < num_files; i++) {
+            struct stat buf;
+            snprintf(path, sizeof(path), "%s/%08zu", dir, i);
+            ASSERT_EQ(stat(path, &buf), 0, "Could not stat file");
+        }
+        time_end("lookup", start);
+    }
+
+    start = mx_ticks_get();
+    for (size_t i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%08zu", dir, i);
+        ASSERT_EQ(unlink(path), 0, "Could not unlink file");
+    }
+    if (count == num_files) {
+        time_end("unlink", start);
+    }
+    ASSERT_EQ(rmdir(dir), 0);
+    return true;
+}
+
+// The goal of this benchmark is to measure operations on a single directory
+// holding many entries (such as a package cache), where lookup cost dominates.
+// Every file is created, looked up, and deleted in turn.
+template <size_t NumFiles>
+bool benchmark_large_directory(void) {
+    BEGIN_TEST;
+    printf("\nBenchmarking Large directory (%lu files)\n", NumFiles);
+    ASSERT_TRUE(large_directory_helper(MOUNT_POINT "/bigdir", NumFiles));
+    END_TEST;
+}
+
+// As above, but always within /tmp, which is served by the memfs instance in
+// devmgr regardless of the filesystem being benchmarked.
+template <size_t NumFiles>
+bool benchmark_memfs_directory(void) {
+    BEGIN_TEST;
+    printf("\nBenchmarking memfs directory (%lu files)\n", NumFiles);
+    ASSERT_TRUE(large_directory_helper("/tmp/fs-bench-bigdir", NumFiles));
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(basic_benchmarks)
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 1024>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 2048>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 4096>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 8192>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 16384>))
+RUN_TEST_PERFORMANCE((benchmark_write_read<128 * KB, 8192>))
+RUN_TEST_PERFORMANCE((benchmark_write_read<256 * KB, 4096>))
+RUN_TEST_PERFORMANCE((benchmark_sequential_read<128 * MB, 8 * KB>))
+RUN_TEST_PERFORMANCE((benchmark_sequential_read<128 * MB, 64 * KB>))
+RUN_TEST_PERFORMANCE((benchmark_sequential_read<128 * MB, 256 * KB>))
+RUN_TEST_PERFORMANCE((benchmark_mmap_scan<16 * MB>))
+RUN_TEST_PERFORMANCE((benchmark_mmap_scan<64 * MB>))
+RUN_TEST_PERFORMANCE((benchmark_concurrent_read<1>))
+RUN_TEST_PERFORMANCE((benchmark_concurrent_read<2>))
+RUN_TEST_PERFORMANCE((benchmark_concurrent_read<4>))
+RUN_TEST_PERFORMANCE((benchmark_concurrent_read<8>))
+RUN_TEST_PERFORMANCE((benchmark_concurrent_read<16>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<125>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<250>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<500>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<1000>))
+RUN_TEST_PERFORMANCE((benchmark_large_directory<1000>))
+RUN_TEST_PERFORMANCE((benchmark_large_directory<10000>))
+RUN_TEST_PERFORMANCE((benchmark_large_directory<100000>))
+RUN_TEST_PERFORMANCE((benchmark_memfs_directory<1000>))
+RUN_TEST_PERFORMANCE((benchmark_memfs_directory<10000>))
+RUN_TEST_PERFORMANCE((benchmark_memfs_directory<100000>))
 END_TEST_CASE(basic_benchmarks)
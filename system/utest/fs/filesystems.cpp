@@ -247,10 +247,15 @@ int mount_minfs(const char* disk_path, const char* mount_path) {
         return -1;
     }
 
+    // Keep the data cache small, so that tests which move a few megabytes
+    // through the filesystem also exercise eviction.
+    mount_options_t options = default_mount_options;
+    options.cache_blocks = MINFS_TEST_CACHE_BLOCKS;
+
     // fd consumed by mount. By default, mount waits until the filesystem is ready to accept
     // commands.
     mx_status_t status;
-    if ((status = mount(fd, mount_path, DISK_FORMAT_MINFS, &default_mount_options,
+    if ((status = mount(fd, mount_path, DISK_FORMAT_MINFS, &options,
                         launch_stdio_async)) != MX_OK) {
         fprintf(stderr, "Could not mount filesystem\n");
         return status;
@@ -329,6 +334,7 @@ fs_info_t FILESYSTEMS[NUM_FILESYSTEMS] = {
         .supports_watchers = true,
         .supports_create_by_vmo = true,
         .supports_mmap = true,
+        .supports_shared_mmap = true,
         .supports_resize = false,
         .nsec_granularity = 1,
     },
@@ -339,7 +345,8 @@ fs_info_t FILESYSTEMS[NUM_FILESYSTEMS] = {
         .supports_hardlinks = true,
         .supports_watchers = true,
         .supports_create_by_vmo = false,
-        .supports_mmap = false,
+        .supports_mmap = true,
+        .supports_shared_mmap = false,
         .supports_resize = true,
         .nsec_granularity = 1,
     },
@@ -351,6 +358,7 @@ fs_info_t FILESYSTEMS[NUM_FILESYSTEMS] = {
         .supports_watchers = false,
         .supports_create_by_vmo = false,
         .supports_mmap = false,
+        .supports_shared_mmap = false,
         .supports_resize = false,
         .nsec_granularity = MX_SEC(2),
     },
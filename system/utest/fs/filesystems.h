@@ -28,6 +28,7 @@ typedef struct fs_info {
     bool supports_watchers;
     bool supports_create_by_vmo;
     bool supports_mmap;
+    bool supports_shared_mmap;
     bool supports_resize;
     int64_t nsec_granularity;
 } fs_info_t;
@@ -96,6 +97,9 @@ inline bool can_execute_test(fs_info_t* info, fs_test_type_t t) {
 
 #define DEFAULT_DISK_SIZE (1llu << 32)
 
+// Blocks of file data minfs may keep in memory during tests (1 MB).
+#define MINFS_TEST_CACHE_BLOCKS 128
+
 #define RUN_FOR_ALL_FILESYSTEMS_TYPE(case_name, test_type, CASE_TESTS)           \
     FS_TEST_CASE(case_name, DEFAULT_DISK_SIZE, CASE_TESTS, test_type, memfs, 0)  \
     FS_TEST_CASE(case_name, DEFAULT_DISK_SIZE, CASE_TESTS, test_type, minfs, 1)  \
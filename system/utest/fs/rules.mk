@@ -25,6 +25,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test-dot-dot.c \
     $(LOCAL_DIR)/test-link.c \
     $(LOCAL_DIR)/test-fcntl.cpp \
+    $(LOCAL_DIR)/test-journal.cpp \
     $(LOCAL_DIR)/test-maxfile.c \
     $(LOCAL_DIR)/test-mmap.cpp \
     $(LOCAL_DIR)/test-overflow.c \
@@ -42,6 +43,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test-utils.cpp \
     $(LOCAL_DIR)/test-vmo.cpp \
     $(LOCAL_DIR)/test-watcher.cpp \
+    $(LOCAL_DIR)/test-xfer.cpp \
 
 MODULE_LDFLAGS := --wrap open --wrap unlink --wrap stat --wrap mkdir
 MODULE_LDFLAGS += --wrap rename --wrap truncate --wrap opendir
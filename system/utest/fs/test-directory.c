@@ -156,6 +156,59 @@ bool test_directory_coalesce(void) {
     END_TEST;
 }
 
+// Enough entries that minfs indexes the directory holding them.
+#define COALESCE_LARGE_FILES 512
+
+bool test_directory_coalesce_large(void) {
+    BEGIN_TEST;
+
+    char path[PATH_MAX + 1];
+    ASSERT_EQ(mkdir("::coalesce", 0755), 0, "");
+    for (int i = 0; i < COALESCE_LARGE_FILES; i++) {
+        snprintf(path, sizeof(path), "::coalesce/%060d", i);
+        int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0, "");
+        ASSERT_EQ(close(fd), 0, "");
+    }
+    struct stat s;
+    ASSERT_EQ(stat("::coalesce", &s), 0, "");
+    off_t size = s.st_size;
+
+    // Unlink every other entry, then the ones in between, so that each of the
+    // latter merges with both of its neighbours. The last entry is kept, so the
+    // directory cannot simply be truncated.
+    for (int i = 0; i < COALESCE_LARGE_FILES - 1; i += 2) {
+        snprintf(path, sizeof(path), "::coalesce/%060d", i);
+        ASSERT_EQ(unlink(path), 0, "");
+    }
+    for (int i = 1; i < COALESCE_LARGE_FILES - 1; i += 2) {
+        snprintf(path, sizeof(path), "::coalesce/%060d", i);
+        ASSERT_EQ(unlink(path), 0, "");
+    }
+
+    // Only the merged records have room for these names.
+    for (int i = 0; i < COALESCE_LARGE_FILES / 4; i++) {
+        snprintf(path, sizeof(path), "::coalesce/%0200d", i);
+        int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0, "");
+        ASSERT_EQ(close(fd), 0, "");
+    }
+    if (!strcmp(test_info->name, "minfs")) {
+        ASSERT_EQ(stat("::coalesce", &s), 0, "");
+        ASSERT_EQ(s.st_size, size, "directory grew instead of reusing freed records");
+    }
+
+    for (int i = 0; i < COALESCE_LARGE_FILES / 4; i++) {
+        snprintf(path, sizeof(path), "::coalesce/%0200d", i);
+        ASSERT_EQ(unlink(path), 0, "");
+    }
+    snprintf(path, sizeof(path), "::coalesce/%060d", COALESCE_LARGE_FILES - 1);
+    ASSERT_EQ(unlink(path), 0, "");
+    ASSERT_EQ(rmdir("::coalesce"), 0, "");
+
+    END_TEST;
+}
+
 bool test_directory_trailing_slash(void) {
     BEGIN_TEST;
 
@@ -401,6 +454,7 @@ bool test_directory_after_rmdir(void) {
 
 RUN_FOR_ALL_FILESYSTEMS(directory_tests,
     RUN_TEST_MEDIUM(test_directory_coalesce)
+    RUN_TEST_MEDIUM(test_directory_coalesce_large)
     RUN_TEST_MEDIUM(test_directory_filename_max)
     RUN_TEST_LARGE(test_directory_large)
     RUN_TEST_MEDIUM(test_directory_trailing_slash)
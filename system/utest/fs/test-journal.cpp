@@ -0,0 +1,133 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <magenta/device/ramdisk.h>
+#include <fbl/algorithm.h>
+
+#include "filesystems.h"
+#include "misc.h"
+
+namespace {
+
+constexpr size_t kFileCount = 16;
+constexpr char kData[] = "The journal keeps the filesystem consistent";
+
+// Cuts power to the underlying ramdisk after |budget| more blocks are
+// written (or restores it, given UINT64_MAX).
+bool drop_writes_after(uint64_t budget) {
+    BEGIN_HELPER;
+    int fd = open(test_disk_path, O_RDWR);
+    ASSERT_GT(fd, 0);
+    ASSERT_EQ(ioctl_ramdisk_drop_writes_after(fd, &budget), 0);
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+bool create_file(const char* path) {
+    BEGIN_HELPER;
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_STREAM_ALL(write, fd, kData, sizeof(kData));
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+bool check_file(const char* path) {
+    BEGIN_HELPER;
+    int fd = open(path, O_RDONLY, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_TRUE(check_file_contents(fd, reinterpret_cast<const uint8_t*>(kData),
+                                    sizeof(kData)));
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+bool sync_root(void) {
+    BEGIN_HELPER;
+    int fd = open("::.", O_RDONLY | O_DIRECTORY);
+    ASSERT_GT(fd, 0);
+    ASSERT_EQ(fsync(fd), 0);
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+// Crashes in the middle of a burst of metadata updates, after |budget|
+// device blocks have been written. Whatever was synced beforehand must
+// survive, and the filesystem must be consistent once remounted.
+template <uint64_t budget>
+bool test_journal_crash(void) {
+    BEGIN_TEST;
+
+    if (strcmp(test_info->name, "minfs") || use_real_disk) {
+        fprintf(stderr, "Test requires minfs on a ramdisk; skipping\n");
+        return true;
+    }
+
+    char path[PATH_MAX];
+    ASSERT_EQ(mkdir("::stable", 0755), 0);
+    for (size_t i = 0; i < kFileCount; i++) {
+        snprintf(path, sizeof(path), "::stable/%zu", i);
+        ASSERT_TRUE(create_file(path));
+    }
+    ASSERT_TRUE(sync_root());
+
+    ASSERT_TRUE(drop_writes_after(budget));
+    ASSERT_EQ(mkdir("::volatile", 0755), 0);
+    for (size_t i = 0; i < kFileCount; i++) {
+        snprintf(path, sizeof(path), "::volatile/%zu", i);
+        ASSERT_TRUE(create_file(path));
+        if (i % 2) {
+            char newpath[PATH_MAX];
+            snprintf(newpath, sizeof(newpath), "::stable/renamed-%zu", i);
+            ASSERT_EQ(rename(path, newpath), 0);
+        }
+    }
+    snprintf(path, sizeof(path), "::stable/%zu", kFileCount - 1);
+    ASSERT_EQ(unlink(path), 0);
+    ASSERT_TRUE(sync_root());
+
+    // "Power off", then reboot: mounting replays the journal
+    ASSERT_EQ(test_info->unmount(test_root_path), 0);
+    ASSERT_TRUE(drop_writes_after(UINT64_MAX));
+    ASSERT_EQ(test_info->mount(test_disk_path, test_root_path), 0);
+    ASSERT_EQ(test_info->unmount(test_root_path), 0);
+    ASSERT_EQ(test_info->fsck(test_disk_path), 0);
+    ASSERT_EQ(test_info->mount(test_disk_path, test_root_path), 0);
+
+    // Files which were synced before the crash are intact, unless the
+    // crash happened late enough for their unlink to persist.
+    for (size_t i = 0; i < kFileCount - 1; i++) {
+        snprintf(path, sizeof(path), "::stable/%zu", i);
+        ASSERT_TRUE(check_file(path));
+    }
+    snprintf(path, sizeof(path), "::stable/%zu", kFileCount - 1);
+    struct stat s;
+    if (stat(path, &s) == 0) {
+        ASSERT_TRUE(check_file(path));
+    }
+
+    END_TEST;
+}
+
+} // namespace
+
+RUN_FOR_ALL_FILESYSTEMS_TYPE(journal_tests, FS_TEST_NORMAL,
+    RUN_TEST_MEDIUM((test_journal_crash<0>))
+    RUN_TEST_MEDIUM((test_journal_crash<1>))
+    RUN_TEST_MEDIUM((test_journal_crash<16>))
+    RUN_TEST_MEDIUM((test_journal_crash<17>))
+    RUN_TEST_MEDIUM((test_journal_crash<64>))
+    RUN_TEST_MEDIUM((test_journal_crash<256>))
+    RUN_TEST_MEDIUM((test_journal_crash<1024>))
+    RUN_TEST_LARGE((test_journal_crash<4096>))
+)
@@ -17,6 +17,7 @@
 #include <unittest/unittest.h>
 
 #include "filesystems.h"
+#include "misc.h"
 
 // Certain filesystems delay creation of internal structures
 // until the file is initially accessed. Test that we can
@@ -24,7 +25,7 @@
 // accessed.
 bool test_mmap_empty(void) {
     BEGIN_TEST;
-    if (!test_info->supports_mmap) {
+    if (!test_info->supports_shared_mmap) {
         return true;
     }
 
@@ -48,7 +49,7 @@ bool test_mmap_empty(void) {
 // a read-only buffer.
 bool test_mmap_readable(void) {
     BEGIN_TEST;
-    if (!test_info->supports_mmap) {
+    if (!test_info->supports_shared_mmap) {
         return true;
     }
 
@@ -84,7 +85,7 @@ bool test_mmap_readable(void) {
 // to the file.
 bool test_mmap_writable(void) {
     BEGIN_TEST;
-    if (!test_info->supports_mmap) {
+    if (!test_info->supports_shared_mmap) {
         return true;
     }
 
@@ -136,7 +137,7 @@ bool test_mmap_writable(void) {
 // the file has been closed / unlinked / renamed.
 bool test_mmap_unlinked(void) {
     BEGIN_TEST;
-    if (!test_info->supports_mmap) {
+    if (!test_info->supports_shared_mmap) {
         return true;
     }
 
@@ -171,7 +172,7 @@ bool test_mmap_unlinked(void) {
 // Test that MAP_SHARED propagates updates to the file
 bool test_mmap_shared(void) {
     BEGIN_TEST;
-    if (!test_info->supports_mmap) {
+    if (!test_info->supports_shared_mmap) {
         return true;
     }
 
@@ -279,6 +280,112 @@ bool test_mmap_private(void) {
     END_TEST;
 }
 
+// Test that a private mapping keeps its contents once the file's cached data
+// has been evicted, and that the file is unaffected by writes to the mapping.
+bool test_mmap_private_evict(void) {
+    BEGIN_TEST;
+    if (!test_info->supports_mmap) {
+        return true;
+    }
+
+    constexpr char kFilename[] = "::mmap_private_evict";
+    constexpr size_t kFileSize = PAGE_SIZE * 4;
+    int fd = open(kFilename, O_RDWR | O_CREAT | O_EXCL);
+    ASSERT_GT(fd, 0);
+    char buf[PAGE_SIZE];
+    for (size_t i = 0; i < kFileSize / PAGE_SIZE; i++) {
+        memset(buf, 'a' + (int)i, sizeof(buf));
+        ASSERT_EQ(write(fd, buf, sizeof(buf)), sizeof(buf));
+    }
+
+    void* addr = mmap(NULL, kFileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ASSERT_NE(addr, MAP_FAILED);
+    char* caddr = reinterpret_cast<char*>(addr);
+    memset(caddr, 'z', 16);
+
+    // Stream more data through the filesystem than its cache may hold (minfs
+    // blocks are 8 KB).
+    constexpr size_t kFillerSize = MINFS_TEST_CACHE_BLOCKS * 8192 * 2;
+    int fd2 = open("::mmap_filler", O_RDWR | O_CREAT | O_EXCL);
+    ASSERT_GT(fd2, 0);
+    memset(buf, 'f', sizeof(buf));
+    for (size_t i = 0; i < kFillerSize / sizeof(buf); i++) {
+        ASSERT_EQ(write(fd2, buf, sizeof(buf)), sizeof(buf));
+    }
+    ASSERT_EQ(lseek(fd2, 0, SEEK_SET), 0);
+    for (size_t i = 0; i < kFillerSize / sizeof(buf); i++) {
+        ASSERT_EQ(read(fd2, buf, sizeof(buf)), sizeof(buf));
+    }
+    ASSERT_EQ(close(fd2), 0);
+    ASSERT_EQ(unlink("::mmap_filler"), 0);
+
+    char expected[PAGE_SIZE];
+    for (size_t i = 0; i < kFileSize / PAGE_SIZE; i++) {
+        memset(expected, 'a' + (int)i, sizeof(expected));
+        if (i == 0) {
+            memset(expected, 'z', 16);
+        }
+        ASSERT_EQ(memcmp(caddr + i * PAGE_SIZE, expected, sizeof(expected)), 0);
+    }
+    ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+    for (size_t i = 0; i < kFileSize / PAGE_SIZE; i++) {
+        memset(expected, 'a' + (int)i, sizeof(expected));
+        ASSERT_EQ(read(fd, buf, sizeof(buf)), sizeof(buf));
+        ASSERT_EQ(memcmp(buf, expected, sizeof(expected)), 0);
+    }
+
+    ASSERT_EQ(munmap(addr, kFileSize), 0, "munmap failed");
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink(kFilename), 0);
+    END_TEST;
+}
+
+// Test that a private mapping of part of a file holds that part, at the
+// requested offset, and keeps it across the eviction of the file's data.
+bool test_mmap_private_offset(void) {
+    BEGIN_TEST;
+    if (!test_info->supports_mmap) {
+        return true;
+    }
+
+    constexpr char kFilename[] = "::mmap_private_offset";
+    constexpr size_t kFileSize = PAGE_SIZE * 8;
+    int fd = open(kFilename, O_RDWR | O_CREAT | O_EXCL);
+    ASSERT_GT(fd, 0);
+    char buf[PAGE_SIZE];
+    for (size_t i = 0; i < kFileSize / PAGE_SIZE; i++) {
+        memset(buf, 'a' + (int)i, sizeof(buf));
+        ASSERT_EQ(write(fd, buf, sizeof(buf)), sizeof(buf));
+    }
+
+    constexpr size_t kMapOffset = PAGE_SIZE * 3;
+    constexpr size_t kMapSize = PAGE_SIZE * 2;
+    void* addr = mmap(NULL, kMapSize, PROT_READ, MAP_PRIVATE, fd, kMapOffset);
+    ASSERT_NE(addr, MAP_FAILED);
+    char* caddr = reinterpret_cast<char*>(addr);
+
+    constexpr size_t kFillerSize = MINFS_TEST_CACHE_BLOCKS * 8192 * 2;
+    int fd2 = open("::mmap_filler", O_RDWR | O_CREAT | O_EXCL);
+    ASSERT_GT(fd2, 0);
+    memset(buf, 'f', sizeof(buf));
+    for (size_t i = 0; i < kFillerSize / sizeof(buf); i++) {
+        ASSERT_EQ(write(fd2, buf, sizeof(buf)), sizeof(buf));
+    }
+    ASSERT_EQ(close(fd2), 0);
+    ASSERT_EQ(unlink("::mmap_filler"), 0);
+
+    char expected[PAGE_SIZE];
+    for (size_t i = 0; i < kMapSize / PAGE_SIZE; i++) {
+        memset(expected, 'a' + (int)(kMapOffset / PAGE_SIZE + i), sizeof(expected));
+        ASSERT_EQ(memcmp(caddr + i * PAGE_SIZE, expected, sizeof(expected)), 0);
+    }
+
+    ASSERT_EQ(munmap(addr, kMapSize), 0, "munmap failed");
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink(kFilename), 0);
+    END_TEST;
+}
+
 // Test that mmap fails with appropriate error codes when
 // we expect.
 bool test_mmap_evil(void) {
@@ -423,17 +530,21 @@ bool test_mmap_death(void) {
 
     // Crashes while mapped
     ASSERT_TRUE(mmap_crash(PROT_READ, MAP_PRIVATE, Write));
-    ASSERT_TRUE(mmap_crash(PROT_READ, MAP_SHARED, Write));
-    // Write-only is not possible
-    ASSERT_TRUE(mmap_crash(PROT_NONE, MAP_SHARED, Read));
-    ASSERT_TRUE(mmap_crash(PROT_NONE, MAP_SHARED, Write));
+    if (test_info->supports_shared_mmap) {
+        ASSERT_TRUE(mmap_crash(PROT_READ, MAP_SHARED, Write));
+        // Write-only is not possible
+        ASSERT_TRUE(mmap_crash(PROT_NONE, MAP_SHARED, Read));
+        ASSERT_TRUE(mmap_crash(PROT_NONE, MAP_SHARED, Write));
+    }
 
     // Crashes after unmapped
     ASSERT_TRUE(mmap_crash(PROT_READ, MAP_PRIVATE, ReadAfterUnmap));
-    ASSERT_TRUE(mmap_crash(PROT_READ, MAP_SHARED, ReadAfterUnmap));
     ASSERT_TRUE(mmap_crash(PROT_WRITE | PROT_READ, MAP_PRIVATE, WriteAfterUnmap));
-    ASSERT_TRUE(mmap_crash(PROT_WRITE | PROT_READ, MAP_SHARED, WriteAfterUnmap));
-    ASSERT_TRUE(mmap_crash(PROT_NONE, MAP_SHARED, WriteAfterUnmap));
+    if (test_info->supports_shared_mmap) {
+        ASSERT_TRUE(mmap_crash(PROT_READ, MAP_SHARED, ReadAfterUnmap));
+        ASSERT_TRUE(mmap_crash(PROT_WRITE | PROT_READ, MAP_SHARED, WriteAfterUnmap));
+        ASSERT_TRUE(mmap_crash(PROT_NONE, MAP_SHARED, WriteAfterUnmap));
+    }
 
     ASSERT_EQ(unlink("::inaccessible"), 0);
     END_TEST;
@@ -446,6 +557,8 @@ RUN_FOR_ALL_FILESYSTEMS(fs_mmap_tests,
     RUN_TEST_MEDIUM(test_mmap_unlinked)
     RUN_TEST_MEDIUM(test_mmap_shared)
     RUN_TEST_MEDIUM(test_mmap_private)
+    RUN_TEST_MEDIUM(test_mmap_private_evict)
+    RUN_TEST_MEDIUM(test_mmap_private_offset)
     RUN_TEST_MEDIUM(test_mmap_evil)
     RUN_TEST_ENABLE_CRASH_HANDLER(test_mmap_death)
 )
@@ -6,10 +6,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <magenta/syscalls.h>
+#include <mxio/limits.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/unique_ptr.h>
 #include <unittest/unittest.h>
@@ -78,6 +80,52 @@ bool test_sparse(void) {
 constexpr size_t kBlockSize = 8192;
 constexpr size_t kDirectBlocks = 16;
 
+// Writes every other block of a file, so that no two written blocks are
+// contiguous, then truncates it back a block at a time.
+template <size_t Blocks>
+bool test_sparse_fragmented(void) {
+    BEGIN_TEST;
+
+    int fd = open("::my_file", O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0);
+
+    uint8_t wbuf[kBlockSize];
+    uint8_t rbuf[kBlockSize];
+    for (size_t i = 0; i < Blocks; i++) {
+        memset(wbuf, static_cast<int>(i + 1), sizeof(wbuf));
+        ASSERT_EQ(pwrite(fd, wbuf, sizeof(wbuf), 2 * i * kBlockSize), sizeof(wbuf));
+    }
+
+    // Reopen file
+    ASSERT_EQ(close(fd), 0);
+    fd = open("::my_file", O_RDWR, 0644);
+    ASSERT_GT(fd, 0);
+
+    for (size_t i = 0; i < Blocks; i++) {
+        memset(wbuf, static_cast<int>(i + 1), sizeof(wbuf));
+        ASSERT_EQ(pread(fd, rbuf, sizeof(rbuf), 2 * i * kBlockSize), sizeof(rbuf));
+        ASSERT_EQ(memcmp(rbuf, wbuf, sizeof(wbuf)), 0);
+        if (i + 1 < Blocks) {
+            ASSERT_EQ(pread(fd, rbuf, sizeof(rbuf), (2 * i + 1) * kBlockSize), sizeof(rbuf));
+            memset(wbuf, 0, sizeof(wbuf));
+            ASSERT_EQ(memcmp(rbuf, wbuf, sizeof(wbuf)), 0);
+        }
+    }
+
+    // Release the mapping of the file from its tail
+    for (size_t i = Blocks; i > 0; i -= Blocks / 8) {
+        ASSERT_EQ(ftruncate(fd, (2 * (i - 1) + 1) * kBlockSize), 0);
+        memset(wbuf, static_cast<int>(i), sizeof(wbuf));
+        ASSERT_EQ(pread(fd, rbuf, sizeof(rbuf), 2 * (i - 1) * kBlockSize), sizeof(rbuf));
+        ASSERT_EQ(memcmp(rbuf, wbuf, sizeof(wbuf)), 0);
+    }
+
+    // Clean up
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink("::my_file"), 0);
+    END_TEST;
+}
+
 RUN_FOR_ALL_FILESYSTEMS(sparse_tests,
     RUN_TEST_MEDIUM((test_sparse<0, 0, kBlockSize>))
     RUN_TEST_MEDIUM((test_sparse<kBlockSize / 2, 0, kBlockSize>))
@@ -97,4 +145,8 @@ RUN_FOR_ALL_FILESYSTEMS(sparse_tests,
     RUN_TEST_MEDIUM((test_sparse<kBlockSize * kDirectBlocks + kBlockSize,
                                  kBlockSize * kDirectBlocks + 2 * kBlockSize,
                                  kBlockSize * 32>))
+    // Larger than a single transfer through the connection's VMO.
+    RUN_TEST_MEDIUM((test_sparse<kBlockSize / 2, kBlockSize, MXIO_VMO_XFER_SIZE * 3>))
+    // Enough separate extents to need a chain of several extent blocks.
+    RUN_TEST_LARGE((test_sparse_fragmented<2048>))
 )
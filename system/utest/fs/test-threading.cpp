@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <threads.h>
 #include <unistd.h>
@@ -243,6 +244,112 @@ bool test_link_exclusive(void) {
     END_TEST;
 }
 
+constexpr size_t kRecordSize = 4096;
+constexpr size_t kRecordIterCount = 200;
+
+// Writers repeatedly overwrite a record with their own pattern while readers,
+// each on its own connection to the same file, check that every read sees
+// the whole of exactly one write.
+bool test_read_write_concurrent(void) {
+    BEGIN_TEST;
+    int fd = open("::concurrent", O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0);
+    char buf[kRecordSize];
+    memset(buf, 'a', sizeof(buf));
+    ASSERT_EQ(write(fd, buf, sizeof(buf)), sizeof(buf));
+    ASSERT_EQ(close(fd), 0);
+
+    static fbl::atomic<int> next_id;
+    next_id.store(0);
+    ASSERT_TRUE((thread_action_test<8, 8>([](void* arg) {
+        int id = next_id.fetch_add(1);
+        int fd = open("::concurrent", O_RDWR);
+        if (fd < 0) {
+            return kUnexpectedFailure;
+        }
+        char buf[kRecordSize];
+        int rc = kSuccess;
+        for (size_t i = 0; (i < kRecordIterCount) && (rc == kSuccess); i++) {
+            if (id % 2) {
+                memset(buf, 'a' + id, sizeof(buf));
+                if (pwrite(fd, buf, sizeof(buf), 0) != static_cast<ssize_t>(sizeof(buf))) {
+                    rc = kUnexpectedFailure;
+                }
+            } else if (pread(fd, buf, sizeof(buf), 0) != static_cast<ssize_t>(sizeof(buf))) {
+                rc = kUnexpectedFailure;
+            } else {
+                for (size_t j = 1; j < sizeof(buf); j++) {
+                    if (buf[j] != buf[0]) {
+                        rc = kUnexpectedFailure;
+                        break;
+                    }
+                }
+            }
+        }
+        close(fd);
+        return rc;
+    })));
+    ASSERT_EQ(unlink("::concurrent"), 0);
+    END_TEST;
+}
+
+// Lists and syncs a directory while its entries come and go.
+bool test_readdir_sync_concurrent(void) {
+    BEGIN_TEST;
+    ASSERT_EQ(mkdir("::churn", 0755), 0);
+
+    static fbl::atomic<int> next_id;
+    next_id.store(0);
+    ASSERT_TRUE((thread_action_test<6, 6>([](void* arg) {
+        int id = next_id.fetch_add(1);
+        for (size_t i = 0; i < kRecordIterCount; i++) {
+            switch (id % 3) {
+            case 0: {
+                char name[32];
+                snprintf(name, sizeof(name), "::churn/file%d", id);
+                int fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+                if ((fd < 0) || (close(fd) != 0) || (unlink(name) != 0)) {
+                    return kUnexpectedFailure;
+                }
+                break;
+            }
+            case 1: {
+                DIR* dir = opendir("::churn");
+                if (dir == nullptr) {
+                    return kUnexpectedFailure;
+                }
+                struct dirent* de;
+                while ((de = readdir(dir)) != nullptr) {
+                    if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..") &&
+                        strncmp(de->d_name, "file", 4)) {
+                        closedir(dir);
+                        return kUnexpectedFailure;
+                    }
+                }
+                if (closedir(dir) != 0) {
+                    return kUnexpectedFailure;
+                }
+                break;
+            }
+            case 2: {
+                int fd = open("::churn", O_RDONLY | O_DIRECTORY);
+                if (fd < 0) {
+                    return kUnexpectedFailure;
+                }
+                int r = fsync(fd);
+                if ((close(fd) != 0) || ((r != 0) && (errno != ENOTSUP))) {
+                    return kUnexpectedFailure;
+                }
+                break;
+            }
+            }
+        }
+        return kSuccess;
+    })));
+    ASSERT_EQ(rmdir("::churn"), 0);
+    END_TEST;
+}
+
 RUN_FOR_ALL_FILESYSTEMS(threading_tests,
     RUN_TEST_MEDIUM((test_inode_reuse<false>))
     RUN_TEST_MEDIUM((test_inode_reuse<true>))
@@ -251,4 +358,6 @@ RUN_FOR_ALL_FILESYSTEMS(threading_tests,
     RUN_TEST_MEDIUM(test_rename_exclusive)
     RUN_TEST_MEDIUM(test_rename_overwrite)
     RUN_TEST_MEDIUM(test_link_exclusive)
+    RUN_TEST_MEDIUM(test_read_write_concurrent)
+    RUN_TEST_MEDIUM(test_readdir_sync_concurrent)
 )
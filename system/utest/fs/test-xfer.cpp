@@ -0,0 +1,206 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+#include <mxio/limits.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/atomic.h>
+#include <fbl/unique_ptr.h>
+#include <unittest/unittest.h>
+
+#include "filesystems.h"
+
+// Tests of reads and writes larger than a single message, which move through
+// the transfer VMO granted to the connection when the file was opened.
+
+static void fill_pattern(uint8_t* buf, size_t len, unsigned seed) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t) rand_r(&seed);
+    }
+}
+
+// Writes and reads back |Size| bytes with write/read, which track the
+// connection's offset, and with pwrite/pread at an unaligned offset.
+template <size_t Size>
+bool test_xfer_size(void) {
+    BEGIN_TEST;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> wbuf(new (&ac) uint8_t[Size]);
+    ASSERT_TRUE(ac.check());
+    fbl::unique_ptr<uint8_t[]> rbuf(new (&ac) uint8_t[Size]);
+    ASSERT_TRUE(ac.check());
+    unsigned seed = static_cast<unsigned>(mx_ticks_get());
+    unittest_printf("Transfer test using seed: %u\n", seed);
+    fill_pattern(wbuf.get(), Size, seed);
+
+    int fd = open("::xfer", O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_EQ(write(fd, wbuf.get(), Size), Size);
+    ASSERT_EQ(write(fd, wbuf.get(), Size), Size);
+    ASSERT_EQ(lseek(fd, 0, SEEK_CUR), 2 * Size);
+    ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+    for (size_t i = 0; i < 2; i++) {
+        memset(rbuf.get(), 0, Size);
+        ASSERT_EQ(read(fd, rbuf.get(), Size), Size);
+        ASSERT_EQ(memcmp(wbuf.get(), rbuf.get(), Size), 0);
+    }
+    // Short read at the end of the file.
+    ASSERT_EQ(read(fd, rbuf.get(), Size), 0);
+
+    constexpr off_t kOffset = 3 * MXIO_CHUNK_SIZE / 2 + 1;
+    ASSERT_EQ(pwrite(fd, wbuf.get(), Size, kOffset), Size);
+    memset(rbuf.get(), 0, Size);
+    ASSERT_EQ(pread(fd, rbuf.get(), Size, kOffset), Size);
+    ASSERT_EQ(memcmp(wbuf.get(), rbuf.get(), Size), 0);
+    // Reading past the end returns only the bytes up to it.
+    ASSERT_EQ(pread(fd, rbuf.get(), Size, 2 * Size - 1), 1);
+    ASSERT_EQ(rbuf[0], wbuf[Size - 1]);
+
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink("::xfer"), 0);
+    END_TEST;
+}
+
+// Large appends move through the transfer VMO too.
+bool test_xfer_append(void) {
+    BEGIN_TEST;
+
+    constexpr size_t kSize = MXIO_VMO_XFER_SIZE + MXIO_CHUNK_SIZE + 7;
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[kSize]);
+    ASSERT_TRUE(ac.check());
+    fill_pattern(buf.get(), kSize, 1);
+
+    int fd = open("::xfer", O_RDWR | O_CREAT | O_EXCL | O_APPEND, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_EQ(write(fd, buf.get(), kSize), kSize);
+    ASSERT_EQ(write(fd, buf.get(), kSize), kSize);
+    struct stat s;
+    ASSERT_EQ(fstat(fd, &s), 0);
+    ASSERT_EQ(s.st_size, 2 * kSize);
+
+    fbl::unique_ptr<uint8_t[]> rbuf(new (&ac) uint8_t[kSize]);
+    ASSERT_TRUE(ac.check());
+    ASSERT_EQ(pread(fd, rbuf.get(), kSize, kSize), kSize);
+    ASSERT_EQ(memcmp(buf.get(), rbuf.get(), kSize), 0);
+
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink("::xfer"), 0);
+    END_TEST;
+}
+
+constexpr size_t kRecordSize = MXIO_VMO_XFER_SIZE + MXIO_CHUNK_SIZE + 11;
+constexpr size_t kRecordCount = 4;
+constexpr size_t kRecordIterCount = 8;
+
+// Several threads make large transfers through the same file descriptor,
+// and so through the same transfer VMO, each to its own record.
+bool test_xfer_shared_fd(void) {
+    BEGIN_TEST;
+
+    static int fd;
+    fd = open("::xfer", O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_EQ(ftruncate(fd, kRecordSize * kRecordCount), 0);
+
+    static fbl::atomic<unsigned> next_id;
+    next_id.store(0);
+    thrd_t threads[kRecordCount];
+    for (size_t i = 0; i < kRecordCount; i++) {
+        ASSERT_EQ(thrd_create(&threads[i], [](void* arg) {
+            unsigned id = next_id.fetch_add(1);
+            fbl::AllocChecker ac;
+            fbl::unique_ptr<uint8_t[]> wbuf(new (&ac) uint8_t[kRecordSize]);
+            if (!ac.check()) {
+                return -1;
+            }
+            fbl::unique_ptr<uint8_t[]> rbuf(new (&ac) uint8_t[kRecordSize]);
+            if (!ac.check()) {
+                return -1;
+            }
+            off_t off = id * kRecordSize;
+            for (unsigned i = 0; i < kRecordIterCount; i++) {
+                fill_pattern(wbuf.get(), kRecordSize, id * kRecordIterCount + i);
+                if (pwrite(fd, wbuf.get(), kRecordSize, off) !=
+                    static_cast<ssize_t>(kRecordSize)) {
+                    return -1;
+                }
+                if (pread(fd, rbuf.get(), kRecordSize, off) !=
+                    static_cast<ssize_t>(kRecordSize)) {
+                    return -1;
+                }
+                if (memcmp(wbuf.get(), rbuf.get(), kRecordSize)) {
+                    return -1;
+                }
+            }
+            return 0;
+        }, nullptr), thrd_success);
+    }
+    for (size_t i = 0; i < kRecordCount; i++) {
+        int rc;
+        ASSERT_EQ(thrd_join(threads[i], &rc), thrd_success);
+        ASSERT_EQ(rc, 0);
+    }
+
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink("::xfer"), 0);
+    END_TEST;
+}
+
+// Connections without a transfer VMO move large transfers through messages:
+// pipelined opens are never described, so they are never granted one.
+bool test_xfer_none(void) {
+    BEGIN_TEST;
+
+    constexpr size_t kSize = MXIO_VMO_XFER_SIZE + 13;
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> wbuf(new (&ac) uint8_t[kSize]);
+    ASSERT_TRUE(ac.check());
+    fbl::unique_ptr<uint8_t[]> rbuf(new (&ac) uint8_t[kSize]);
+    ASSERT_TRUE(ac.check());
+    fill_pattern(wbuf.get(), kSize, 2);
+
+    int fd = open("::xfer", O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_EQ(close(fd), 0);
+    fd = open("::xfer", O_RDWR | O_PIPELINE);
+    ASSERT_GT(fd, 0);
+    ASSERT_EQ(pwrite(fd, wbuf.get(), kSize, 0), kSize);
+    ASSERT_EQ(pread(fd, rbuf.get(), kSize, 0), kSize);
+    ASSERT_EQ(memcmp(wbuf.get(), rbuf.get(), kSize), 0);
+    ASSERT_EQ(close(fd), 0);
+
+    // And what was written that way reads back the same through a
+    // connection which has one.
+    fd = open("::xfer", O_RDONLY);
+    ASSERT_GT(fd, 0);
+    memset(rbuf.get(), 0, kSize);
+    ASSERT_EQ(read(fd, rbuf.get(), kSize), kSize);
+    ASSERT_EQ(memcmp(wbuf.get(), rbuf.get(), kSize), 0);
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_EQ(unlink("::xfer"), 0);
+    END_TEST;
+}
+
+RUN_FOR_ALL_FILESYSTEMS(xfer_tests,
+    RUN_TEST_MEDIUM((test_xfer_size<MXIO_CHUNK_SIZE + 1>))
+    RUN_TEST_MEDIUM((test_xfer_size<MXIO_VMO_XFER_SIZE - 1>))
+    RUN_TEST_MEDIUM((test_xfer_size<MXIO_VMO_XFER_SIZE>))
+    RUN_TEST_MEDIUM((test_xfer_size<MXIO_VMO_XFER_SIZE + 1>))
+    RUN_TEST_MEDIUM((test_xfer_size<MXIO_VMO_XFER_SIZE * 2 + 4097>))
+    RUN_TEST_MEDIUM(test_xfer_append)
+    RUN_TEST_MEDIUM(test_xfer_shared_fd)
+    RUN_TEST_MEDIUM(test_xfer_none)
+)
@@ -0,0 +1,114 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <launchpad/launchpad.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+#include <unittest/unittest.h>
+
+// Passed to the processes this test launches, which are copies of itself,
+// so they exit as soon as they start.
+static const char child_arg[] = "--exit-at-once";
+
+#define ITERATIONS 100
+
+// argv[0]
+static const char* program_path;
+
+typedef struct {
+    mx_time_t launch;
+    mx_time_t total;
+} spawn_times_t;
+
+// Launches the child via |tmpl| if it's not NULL, else the usual way, and
+// waits for it to exit.  Adds the time until launchpad_go() returns and the
+// time until the process is gone to |times|.
+static bool spawn_one(const launchpad_template_t* tmpl, spawn_times_t* times) {
+    BEGIN_HELPER;
+
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+
+    launchpad_t* lp;
+    ASSERT_EQ(launchpad_create(MX_HANDLE_INVALID, "launchpad-bench", &lp),
+              MX_OK, "");
+    if (tmpl != NULL) {
+        launchpad_load_from_template(lp, tmpl);
+    } else {
+        launchpad_load_from_file(lp, program_path);
+    }
+    const char* const argv[] = { program_path, child_arg };
+    launchpad_set_args(lp, countof(argv), argv);
+
+    mx_handle_t proc = MX_HANDLE_INVALID;
+    const char* errmsg = "???";
+    ASSERT_EQ(launchpad_go(lp, &proc, &errmsg), MX_OK, errmsg);
+    mx_time_t launched = mx_time_get(MX_CLOCK_MONOTONIC);
+
+    EXPECT_EQ(mx_object_wait_one(proc, MX_PROCESS_TERMINATED,
+                                 MX_TIME_INFINITE, NULL), MX_OK, "");
+    mx_time_t done = mx_time_get(MX_CLOCK_MONOTONIC);
+
+    mx_info_process_t info;
+    EXPECT_EQ(mx_object_get_info(proc, MX_INFO_PROCESS,
+                                 &info, sizeof(info), NULL, NULL), MX_OK, "");
+    mx_handle_close(proc);
+    EXPECT_EQ(info.return_code, 0, "child exit status");
+
+    times->launch += launched - start;
+    times->total += done - start;
+
+    END_HELPER;
+}
+
+static void print_times(const char* how, const spawn_times_t* times) {
+    printf("%-10s launch %6" PRIu64 " us, until exit %6" PRIu64 " us\n", how,
+           times->launch / ITERATIONS / 1000, times->total / ITERATIONS / 1000);
+}
+
+// Compares the average cost of starting short-lived processes from a file
+// with starting them from a launchpad template.
+static bool benchmark_spawn(void) {
+    BEGIN_TEST;
+
+    // Warm the file system and loader service caches, so the first
+    // iteration doesn't count against either way of launching.
+    spawn_times_t warmup = { 0, 0 };
+    ASSERT_TRUE(spawn_one(NULL, &warmup), "");
+
+    spawn_times_t from_file = { 0, 0 };
+    for (int i = 0; i < ITERATIONS; ++i)
+        ASSERT_TRUE(spawn_one(NULL, &from_file), "");
+
+    launchpad_template_t* tmpl;
+    ASSERT_EQ(launchpad_template_create_from_file(program_path, &tmpl),
+              MX_OK, "");
+    spawn_times_t from_template = { 0, 0 };
+    for (int i = 0; i < ITERATIONS; ++i) {
+        if (!spawn_one(tmpl, &from_template))
+            break;
+    }
+    launchpad_template_destroy(tmpl);
+
+    printf("\n");
+    print_times("file", &from_file);
+    print_times("template", &from_template);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(launchpad_benchmarks)
+RUN_TEST_PERFORMANCE(benchmark_spawn)
+END_TEST_CASE(launchpad_benchmarks)
+
+int main(int argc, char** argv) {
+    if (argc == 2 && !strcmp(argv[1], child_arg))
+        return 0;
+
+    program_path = argv[0];
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
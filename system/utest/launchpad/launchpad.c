@@ -9,13 +9,22 @@
 #include <elfload/elfload.h>
 
 #include <launchpad/launchpad.h>
+#include <launchpad/loader-service.h>
 #include <launchpad/vmo.h>
 
 #include <magenta/process.h>
 #include <magenta/processargs.h>
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/object.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <unistd.h>
 
 #include <mxio/util.h>
 
@@ -34,6 +43,10 @@ static const char dynld_path[] = LIBPREFIX "ld.so.1";
 
 static const char test_inferior_child_name[] = "inferior";
 
+// Passed to the processes the loader service tests launch, which are
+// copies of this program, so they exit as soon as they start.
+static const char exit_at_once_arg[] = "--exit-at-once";
+
 static bool launchpad_test(void)
 {
     BEGIN_TEST;
@@ -125,13 +138,425 @@ static bool argument_size_test(void) {
     return ok;
 }
 
+static bool template_test(void) {
+    BEGIN_TEST;
+
+    launchpad_template_t* tmpl;
+    ASSERT_EQ(launchpad_template_create_from_file("/boot/bin/sh", &tmpl),
+              MX_OK, "");
+
+    // Each process gets its own copy of the writable segments, so
+    // launching several from one template must work every time.
+    for (int i = 0; i < 3; ++i) {
+        launchpad_t* lp;
+        ASSERT_EQ(launchpad_create(MX_HANDLE_INVALID, "template test", &lp),
+                  MX_OK, "");
+        EXPECT_EQ(launchpad_load_from_template(lp, tmpl), MX_OK, "");
+        char cmd[16];
+        snprintf(cmd, sizeof(cmd), "exit %d", i + 1);
+        const char* const argv[] = { "/boot/bin/sh", "-c", cmd };
+        EXPECT_EQ(launchpad_set_args(lp, countof(argv), argv), MX_OK, "");
+
+        mx_handle_t proc = MX_HANDLE_INVALID;
+        const char* errmsg = "???";
+        ASSERT_EQ(launchpad_go(lp, &proc, &errmsg), MX_OK, errmsg);
+
+        EXPECT_EQ(mx_object_wait_one(proc, MX_PROCESS_TERMINATED,
+                                     MX_TIME_INFINITE, NULL), MX_OK, "");
+        mx_info_process_t info;
+        EXPECT_EQ(mx_object_get_info(proc, MX_INFO_PROCESS,
+                                     &info, sizeof(info), NULL, NULL), MX_OK, "");
+        EXPECT_EQ(mx_handle_close(proc), MX_OK, "");
+
+        EXPECT_EQ(info.return_code, i + 1, "shell exit status");
+    }
+
+    launchpad_template_destroy(tmpl);
+
+    END_TEST;
+}
+
+typedef struct {
+    mx_loader_svc_msg_t header;
+    uint8_t data[1024 - sizeof(mx_loader_svc_msg_t)];
+} loader_msg_t;
+
+// Fake loader for loader_service_simple(): every name starting with "lib"
+// is found, as a VMO holding the name, and nothing else is.
+static mx_status_t fake_loader(void* arg, uint32_t load_op,
+                               mx_handle_t request_handle, const char* name,
+                               mx_handle_t* out) {
+    if (request_handle != MX_HANDLE_INVALID)
+        mx_handle_close(request_handle);
+    if (load_op != LOADER_SVC_OP_LOAD_OBJECT)
+        return MX_ERR_NOT_SUPPORTED;
+    if (strncmp(name, "lib", 3))
+        return MX_ERR_NOT_FOUND;
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(strlen(name), 0, &vmo);
+    if (status != MX_OK)
+        return status;
+    size_t actual;
+    status = mx_vmo_write(vmo, name, 0, strlen(name), &actual);
+    if (status != MX_OK) {
+        mx_handle_close(vmo);
+        return status;
+    }
+    *out = vmo;
+    return MX_OK;
+}
+
+// Sends a LOADER_SVC_OP_LOAD_OBJECTS request for |count| names, the
+// |len| bytes at |names|, and reads the reply into |reply| and |handles|.
+static bool load_objects(mx_handle_t svc, int32_t count, const char* names,
+                         size_t len, loader_msg_t* reply, uint32_t* reply_size,
+                         mx_handle_t handles[LOADER_SVC_LOAD_OBJECTS_MAX],
+                         uint32_t* num_handles) {
+    BEGIN_HELPER;
+
+    loader_msg_t msg;
+    ASSERT_LE(len, sizeof(msg.data), "request too big");
+    memset(&msg.header, 0, sizeof(msg.header));
+    msg.header.opcode = LOADER_SVC_OP_LOAD_OBJECTS;
+    msg.header.arg = count;
+    memcpy(msg.data, names, len);
+
+    mx_channel_call_args_t call = {
+        .wr_bytes = &msg,
+        .wr_num_bytes = (uint32_t)(sizeof(msg.header) + len),
+        .rd_bytes = reply,
+        .rd_num_bytes = sizeof(*reply),
+        .rd_handles = handles,
+        .rd_num_handles = LOADER_SVC_LOAD_OBJECTS_MAX,
+    };
+    mx_status_t read_status = MX_OK;
+    ASSERT_EQ(mx_channel_call(svc, 0, MX_TIME_INFINITE, &call,
+                              reply_size, num_handles, &read_status),
+              MX_OK, "mx_channel_call");
+    EXPECT_EQ(reply->header.opcode, (uint32_t)LOADER_SVC_OP_STATUS, "");
+
+    END_HELPER;
+}
+
+// Checks that |vmo| holds exactly |contents|, and closes it.
+static bool expect_vmo_contents(mx_handle_t vmo, const char* contents) {
+    BEGIN_HELPER;
+
+    char buf[64];
+    size_t actual = 0;
+    uint64_t size = 0;
+    EXPECT_EQ(mx_vmo_get_size(vmo, &size), MX_OK, "");
+    EXPECT_GE(size, strlen(contents), "vmo too small");
+    EXPECT_EQ(mx_vmo_read(vmo, buf, 0, strlen(contents), &actual), MX_OK, "");
+    EXPECT_EQ(actual, strlen(contents), "");
+    EXPECT_EQ(memcmp(buf, contents, strlen(contents)), 0, "vmo contents");
+    mx_handle_close(vmo);
+
+    END_HELPER;
+}
+
+static bool loader_load_objects_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t svc;
+    ASSERT_EQ(loader_service_simple(fake_loader, NULL, &svc), MX_OK, "");
+
+    loader_msg_t reply;
+    uint32_t reply_size;
+    mx_handle_t handles[LOADER_SVC_LOAD_OBJECTS_MAX];
+    uint32_t num_handles;
+
+    // Names which are not found get their own status; the rest still
+    // come back, in order.
+    static const char names[] = "liba.so\0missing.so\0libb.so";
+    ASSERT_TRUE(load_objects(svc, 3, names, sizeof(names), &reply,
+                             &reply_size, handles, &num_handles), "");
+    EXPECT_EQ(reply.header.arg, MX_OK, "");
+    ASSERT_EQ(reply_size, sizeof(reply.header) + 3 * sizeof(int32_t), "");
+    const int32_t* statuses = (const int32_t*)reply.data;
+    EXPECT_EQ(statuses[0], MX_OK, "");
+    EXPECT_EQ(statuses[1], MX_ERR_NOT_FOUND, "");
+    EXPECT_EQ(statuses[2], MX_OK, "");
+    ASSERT_EQ(num_handles, 2u, "");
+    EXPECT_TRUE(expect_vmo_contents(handles[0], "liba.so"), "");
+    EXPECT_TRUE(expect_vmo_contents(handles[1], "libb.so"), "");
+
+    // One more name than the protocol allows is rejected as a whole.
+    char many[LOADER_SVC_LOAD_OBJECTS_MAX * 8 + 8];
+    size_t len = 0;
+    for (int i = 0; i <= LOADER_SVC_LOAD_OBJECTS_MAX; ++i)
+        len += snprintf(&many[len], sizeof(many) - len, "lib%d", i) + 1;
+    ASSERT_TRUE(load_objects(svc, LOADER_SVC_LOAD_OBJECTS_MAX + 1, many, len,
+                             &reply, &reply_size, handles, &num_handles), "");
+    EXPECT_EQ(reply.header.arg, MX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(reply_size, sizeof(reply.header), "");
+    EXPECT_EQ(num_handles, 0u, "");
+
+    // The maximum itself is fine.
+    len = 0;
+    for (int i = 0; i < LOADER_SVC_LOAD_OBJECTS_MAX; ++i)
+        len += snprintf(&many[len], sizeof(many) - len, "lib%d", i) + 1;
+    ASSERT_TRUE(load_objects(svc, LOADER_SVC_LOAD_OBJECTS_MAX, many, len,
+                             &reply, &reply_size, handles, &num_handles), "");
+    EXPECT_EQ(reply.header.arg, MX_OK, "");
+    ASSERT_EQ(num_handles, (uint32_t)LOADER_SVC_LOAD_OBJECTS_MAX, "");
+    for (uint32_t i = 0; i < num_handles; ++i)
+        mx_handle_close(handles[i]);
+
+    // No names at all.
+    ASSERT_TRUE(load_objects(svc, 0, "liba.so", sizeof("liba.so"),
+                             &reply, &reply_size, handles, &num_handles), "");
+    EXPECT_EQ(reply.header.arg, MX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(num_handles, 0u, "");
+
+    // Fewer names than the count says.
+    ASSERT_TRUE(load_objects(svc, 3, names, sizeof("liba.so\0missing.so"),
+                             &reply, &reply_size, handles, &num_handles), "");
+    EXPECT_EQ(reply.header.arg, MX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(num_handles, 0u, "");
+
+    // A last name without its terminator must not be loaded as "liba.s".
+    ASSERT_TRUE(load_objects(svc, 1, "liba.so", strlen("liba.so"),
+                             &reply, &reply_size, handles, &num_handles), "");
+    EXPECT_EQ(reply.header.arg, MX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(num_handles, 0u, "");
+
+    mx_handle_close(svc);
+
+    END_TEST;
+}
+
+// A loader service which forwards every request to the default loader
+// service and counts them.  Unless |batch| is set, it rejects
+// LOADER_SVC_OP_LOAD_OBJECTS, as services which predate it do.
+typedef struct {
+    mx_handle_t client;
+    mx_handle_t upstream;
+    bool batch;
+    int load_object_count;
+    int load_objects_count;
+} loader_proxy_t;
+
+static int loader_proxy_thread(void* arg) {
+    loader_proxy_t* proxy = arg;
+    for (;;) {
+        loader_msg_t msg;
+        mx_handle_t handles[LOADER_SVC_LOAD_OBJECTS_MAX];
+        uint32_t size, num_handles;
+        mx_signals_t pending;
+        if (mx_object_wait_one(proxy->client,
+                               MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                               MX_TIME_INFINITE, &pending) != MX_OK ||
+            !(pending & MX_CHANNEL_READABLE))
+            break;
+        if (mx_channel_read(proxy->client, 0, &msg, handles, sizeof(msg),
+                            countof(handles), &size, &num_handles) != MX_OK)
+            break;
+        if (size < sizeof(msg.header))
+            break;
+
+        if (msg.header.opcode == LOADER_SVC_OP_LOAD_OBJECT) {
+            ++proxy->load_object_count;
+        } else if (msg.header.opcode == LOADER_SVC_OP_LOAD_OBJECTS) {
+            ++proxy->load_objects_count;
+            if (!proxy->batch) {
+                for (uint32_t i = 0; i < num_handles; ++i)
+                    mx_handle_close(handles[i]);
+                msg.header.opcode = LOADER_SVC_OP_STATUS;
+                msg.header.arg = MX_ERR_INVALID_ARGS;
+                mx_channel_write(proxy->client, 0, &msg.header,
+                                 sizeof(msg.header), NULL, 0);
+                continue;
+            }
+        }
+
+        // mx_channel_call() uses its own txid; the client expects its own.
+        uint32_t txid = msg.header.txid;
+        mx_channel_call_args_t call = {
+            .wr_bytes = &msg,
+            .wr_handles = handles,
+            .wr_num_bytes = size,
+            .wr_num_handles = num_handles,
+            .rd_bytes = &msg,
+            .rd_handles = handles,
+            .rd_num_bytes = sizeof(msg),
+            .rd_num_handles = countof(handles),
+        };
+        mx_status_t read_status;
+        if (mx_channel_call(proxy->upstream, 0, MX_TIME_INFINITE, &call,
+                            &size, &num_handles, &read_status) != MX_OK)
+            break;
+        msg.header.txid = txid;
+        if (mx_channel_write(proxy->client, 0, &msg, size,
+                             handles, num_handles) != MX_OK) {
+            for (uint32_t i = 0; i < num_handles; ++i)
+                mx_handle_close(handles[i]);
+        }
+    }
+    mx_handle_close(proxy->client);
+    mx_handle_close(proxy->upstream);
+    return 0;
+}
+
+// Launches a copy of this program, which exits at once, with its
+// libraries loaded through |proxy|.
+static bool launch_with_proxy(loader_proxy_t* proxy) {
+    BEGIN_HELPER;
+
+    mx_handle_t svc;
+    ASSERT_EQ(mx_channel_create(0, &svc, &proxy->client), MX_OK, "");
+    ASSERT_EQ(loader_service_get_default(&proxy->upstream), MX_OK, "");
+    thrd_t thread;
+    ASSERT_EQ(thrd_create(&thread, loader_proxy_thread, proxy),
+              thrd_success, "");
+
+    launchpad_t* lp;
+    ASSERT_EQ(launchpad_create(MX_HANDLE_INVALID, "loader proxy test", &lp),
+              MX_OK, "");
+    launchpad_use_loader_service(lp, svc);
+    EXPECT_EQ(launchpad_load_from_file(lp, program_path), MX_OK, "");
+    const char* const argv[] = { program_path, exit_at_once_arg };
+    EXPECT_EQ(launchpad_set_args(lp, countof(argv), argv), MX_OK, "");
+
+    mx_handle_t proc = MX_HANDLE_INVALID;
+    const char* errmsg = "???";
+    EXPECT_EQ(launchpad_go(lp, &proc, &errmsg), MX_OK, errmsg);
+    EXPECT_EQ(mx_object_wait_one(proc, MX_PROCESS_TERMINATED,
+                                 MX_TIME_INFINITE, NULL), MX_OK, "");
+    mx_info_process_t info;
+    EXPECT_EQ(mx_object_get_info(proc, MX_INFO_PROCESS,
+                                 &info, sizeof(info), NULL, NULL), MX_OK, "");
+    mx_handle_close(proc);
+    EXPECT_EQ(info.return_code, 0, "child exit status");
+
+    // The proxy exits once the process's end of the channel is gone.
+    thrd_join(thread, NULL);
+
+    END_HELPER;
+}
+
+static bool loader_batch_fallback_test(void) {
+    BEGIN_TEST;
+
+    // A service which knows the batched request serves the libraries
+    // with it.
+    loader_proxy_t batched = { .batch = true };
+    ASSERT_TRUE(launch_with_proxy(&batched), "");
+    EXPECT_GT(batched.load_objects_count, 0, "batched requests");
+
+    // Against an older service the dynamic linker tries the batched
+    // request once, then fetches each library by itself.
+    loader_proxy_t unbatched = { .batch = false };
+    ASSERT_TRUE(launch_with_proxy(&unbatched), "");
+    EXPECT_EQ(unbatched.load_objects_count, 1, "batched requests");
+    EXPECT_GT(unbatched.load_object_count, batched.load_object_count,
+              "single requests");
+
+    END_TEST;
+}
+
+static bool write_file(const char* path, const char* contents,
+                       const struct timespec* mtime) {
+    BEGIN_HELPER;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0, "open");
+    EXPECT_EQ(write(fd, contents, strlen(contents)), (ssize_t)strlen(contents), "");
+    const struct timespec times[2] = { *mtime, *mtime };
+    EXPECT_EQ(futimens(fd, times), 0, "futimens");
+    EXPECT_EQ(close(fd), 0, "");
+
+    END_HELPER;
+}
+
+static bool load_object(mx_handle_t svc, const char* name, mx_handle_t* out) {
+    BEGIN_HELPER;
+
+    loader_msg_t msg;
+    memset(&msg.header, 0, sizeof(msg.header));
+    msg.header.opcode = LOADER_SVC_OP_LOAD_OBJECT;
+    size_t len = strlen(name) + 1;
+    memcpy(msg.data, name, len);
+
+    mx_channel_call_args_t call = {
+        .wr_bytes = &msg,
+        .wr_num_bytes = (uint32_t)(sizeof(msg.header) + len),
+        .rd_bytes = &msg,
+        .rd_num_bytes = sizeof(msg),
+        .rd_handles = out,
+        .rd_num_handles = 1,
+    };
+    uint32_t size, num_handles;
+    mx_status_t read_status = MX_OK;
+    ASSERT_EQ(mx_channel_call(svc, 0, MX_TIME_INFINITE, &call,
+                              &size, &num_handles, &read_status),
+              MX_OK, "mx_channel_call");
+    ASSERT_EQ(msg.header.arg, MX_OK, "load status");
+    ASSERT_EQ(num_handles, 1u, "");
+
+    END_HELPER;
+}
+
+// The file system backed service caches library VMOs, and must notice
+// when the file changes size or modification time.
+static bool loader_cache_test(void) {
+    BEGIN_TEST;
+
+    static const char dir[] = "/tmp/loader-cache-test";
+    static const char path[] = "/tmp/loader-cache-test/libcache.so";
+    static const char* const paths[] = { dir };
+    ASSERT_TRUE(mkdir(dir, 0755) == 0 || errno == EEXIST, "mkdir");
+
+    const struct timespec mtime1 = { .tv_sec = 1000 };
+    const struct timespec mtime2 = { .tv_sec = 2000 };
+    ASSERT_TRUE(write_file(path, "first", &mtime1), "");
+
+    loader_service_t* svc;
+    ASSERT_EQ(loader_service_create_fs_paths("loader-cache-test", paths,
+                                             countof(paths), &svc), MX_OK, "");
+    mx_handle_t h;
+    ASSERT_EQ(loader_service_connect(svc, &h), MX_OK, "");
+
+    mx_handle_t vmo;
+    ASSERT_TRUE(load_object(h, "libcache.so", &vmo), "");
+    EXPECT_TRUE(expect_vmo_contents(vmo, "first"), "");
+    ASSERT_TRUE(load_object(h, "libcache.so", &vmo), "");
+    EXPECT_TRUE(expect_vmo_contents(vmo, "first"), "cached");
+
+    // Same size, new modification time.
+    ASSERT_TRUE(write_file(path, "other", &mtime2), "");
+    ASSERT_TRUE(load_object(h, "libcache.so", &vmo), "");
+    EXPECT_TRUE(expect_vmo_contents(vmo, "other"), "mtime changed");
+
+    // New size, same modification time.
+    ASSERT_TRUE(write_file(path, "longer", &mtime2), "");
+    ASSERT_TRUE(load_object(h, "libcache.so", &vmo), "");
+    EXPECT_TRUE(expect_vmo_contents(vmo, "longer"), "size changed");
+
+    mx_handle_close(h);
+    EXPECT_EQ(unlink(path), 0, "");
+    EXPECT_EQ(rmdir(dir), 0, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(launchpad_tests)
 RUN_TEST(launchpad_test);
 RUN_TEST(argument_size_test);
+RUN_TEST(template_test);
 END_TEST_CASE(launchpad_tests)
 
+BEGIN_TEST_CASE(loader_service_tests)
+RUN_TEST(loader_load_objects_test);
+RUN_TEST(loader_batch_fallback_test);
+RUN_TEST(loader_cache_test);
+END_TEST_CASE(loader_service_tests)
+
 int main(int argc, char **argv)
 {
+    if (argc == 2 && !strcmp(argv[1], exit_at_once_arg))
+        return 0;
+
     program_path = argv[0];
 
     bool success = unittest_run_all_tests(argc, argv);
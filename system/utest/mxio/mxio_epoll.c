@@ -0,0 +1,225 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+
+#include <unittest/unittest.h>
+
+static int wait_one(int epfd, struct epoll_event* event) {
+    return epoll_wait(epfd, event, 1, 0);
+}
+
+bool epoll_level_triggered_test(void) {
+    BEGIN_TEST;
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, "socketpair failed");
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT_GE(epfd, 0, "epoll_create1 failed");
+
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = 0x1234};
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event), 0, "EPOLL_CTL_ADD failed");
+    EXPECT_EQ(wait_one(epfd, &event), 0, "idle fd reported ready");
+
+    char c = 'a';
+    ASSERT_EQ(write(fds[1], &c, 1), 1, "write failed");
+    memset(&event, 0, sizeof(event));
+    ASSERT_EQ(wait_one(epfd, &event), 1, "readable fd not reported");
+    EXPECT_EQ(event.events, (uint32_t)EPOLLIN, "wrong events");
+    EXPECT_EQ(event.data.u64, 0x1234u, "wrong data");
+
+    // Still readable, so reported again.
+    EXPECT_EQ(wait_one(epfd, &event), 1, "level-triggered fd not reported twice");
+    ASSERT_EQ(read(fds[0], &c, 1), 1, "read failed");
+    EXPECT_EQ(wait_one(epfd, &event), 0, "drained fd reported ready");
+
+    ASSERT_EQ(close(fds[1]), 0, "close failed");
+    ASSERT_EQ(epoll_wait(epfd, &event, 1, 1000), 1, "hangup not reported");
+    EXPECT_TRUE(event.events & EPOLLHUP, "hangup not reported");
+
+    EXPECT_EQ(close(epfd), 0, "close epoll fd failed");
+    EXPECT_EQ(close(fds[0]), 0, "close failed");
+
+    END_TEST;
+}
+
+bool epoll_edge_triggered_test(void) {
+    BEGIN_TEST;
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, "socketpair failed");
+    int epfd = epoll_create(1);
+    ASSERT_GE(epfd, 0, "epoll_create failed");
+
+    struct epoll_event event = {.events = EPOLLIN | EPOLLET, .data.fd = fds[0]};
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event), 0, "EPOLL_CTL_ADD failed");
+
+    char c = 'a';
+    ASSERT_EQ(write(fds[1], &c, 1), 1, "write failed");
+    ASSERT_EQ(epoll_wait(epfd, &event, 1, 1000), 1, "readable fd not reported");
+    EXPECT_EQ(event.data.fd, fds[0], "wrong data");
+    EXPECT_EQ(wait_one(epfd, &event), 0, "edge-triggered fd reported twice");
+
+    ASSERT_EQ(write(fds[1], &c, 1), 1, "write failed");
+    EXPECT_EQ(epoll_wait(epfd, &event, 1, 1000), 1, "new data not reported");
+
+    EXPECT_EQ(close(epfd), 0, "close epoll fd failed");
+    EXPECT_EQ(close(fds[0]), 0, "close failed");
+    EXPECT_EQ(close(fds[1]), 0, "close failed");
+
+    END_TEST;
+}
+
+bool epoll_oneshot_test(void) {
+    BEGIN_TEST;
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, "socketpair failed");
+    int epfd = epoll_create1(0);
+    ASSERT_GE(epfd, 0, "epoll_create1 failed");
+
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT};
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event), 0, "EPOLL_CTL_ADD failed");
+
+    char c = 'a';
+    ASSERT_EQ(write(fds[1], &c, 1), 1, "write failed");
+    ASSERT_EQ(epoll_wait(epfd, &event, 1, 1000), 1, "readable fd not reported");
+    EXPECT_EQ(wait_one(epfd, &event), 0, "one-shot fd reported twice");
+
+    // Rearmed by EPOLL_CTL_MOD.
+    event.events = EPOLLIN | EPOLLONESHOT;
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &event), 0, "EPOLL_CTL_MOD failed");
+    EXPECT_EQ(epoll_wait(epfd, &event, 1, 1000), 1, "rearmed fd not reported");
+
+    EXPECT_EQ(close(epfd), 0, "close epoll fd failed");
+    EXPECT_EQ(close(fds[0]), 0, "close failed");
+    EXPECT_EQ(close(fds[1]), 0, "close failed");
+
+    END_TEST;
+}
+
+bool epoll_ctl_errors_test(void) {
+    BEGIN_TEST;
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, "socketpair failed");
+    int epfd = epoll_create1(0);
+    ASSERT_GE(epfd, 0, "epoll_create1 failed");
+
+    struct epoll_event event = {.events = EPOLLIN};
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL), -1, "DEL of unregistered fd");
+    EXPECT_EQ(errno, ENOENT, "wrong errno");
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &event), -1, "MOD of unregistered fd");
+    EXPECT_EQ(errno, ENOENT, "wrong errno");
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, epfd, &event), -1, "ADD of epoll fd to itself");
+    EXPECT_EQ(errno, EINVAL, "wrong errno");
+    EXPECT_EQ(epoll_ctl(fds[1], EPOLL_CTL_ADD, fds[0], &event), -1, "ADD to non-epoll fd");
+    EXPECT_EQ(errno, EINVAL, "wrong errno");
+
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event), 0, "EPOLL_CTL_ADD failed");
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event), -1, "duplicate ADD");
+    EXPECT_EQ(errno, EEXIST, "wrong errno");
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL), 0, "EPOLL_CTL_DEL failed");
+    EXPECT_EQ(epoll_wait(epfd, &event, 0, 0), -1, "zero maxevents");
+    EXPECT_EQ(errno, EINVAL, "wrong errno");
+
+    EXPECT_EQ(close(epfd), 0, "close epoll fd failed");
+    EXPECT_EQ(close(fds[0]), 0, "close failed");
+    EXPECT_EQ(close(fds[1]), 0, "close failed");
+
+    END_TEST;
+}
+
+// Compares the cost of waiting for one active connection among many idle
+// ones with poll() and with epoll_wait(). Socket pairs stand in for the
+// connections; their number is bounded by the size of the fd table.
+#define BENCH_CONNECTIONS 120
+#define BENCH_ROUNDS 2000
+
+static mx_time_t bench_poll(int* fds, int active) {
+    struct pollfd pfds[BENCH_CONNECTIONS];
+    for (int i = 0; i < BENCH_CONNECTIONS; i++) {
+        pfds[i].fd = fds[2 * i];
+        pfds[i].events = POLLIN;
+    }
+    char c = 'a';
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (int n = 0; n < BENCH_ROUNDS; n++) {
+        if ((write(fds[2 * active + 1], &c, 1) != 1) ||
+            (poll(pfds, BENCH_CONNECTIONS, -1) != 1) ||
+            (read(fds[2 * active], &c, 1) != 1)) {
+            return 0;
+        }
+    }
+    return mx_time_get(MX_CLOCK_MONOTONIC) - start;
+}
+
+static mx_time_t bench_epoll(int* fds, int active) {
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        return 0;
+    }
+    for (int i = 0; i < BENCH_CONNECTIONS; i++) {
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = fds[2 * i]};
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[2 * i], &event) != 0) {
+            close(epfd);
+            return 0;
+        }
+    }
+    char c = 'a';
+    struct epoll_event events[16];
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (int n = 0; n < BENCH_ROUNDS; n++) {
+        if ((write(fds[2 * active + 1], &c, 1) != 1) ||
+            (epoll_wait(epfd, events, 16, -1) != 1) ||
+            (read(events[0].data.fd, &c, 1) != 1)) {
+            close(epfd);
+            return 0;
+        }
+    }
+    mx_time_t elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+    close(epfd);
+    return elapsed;
+}
+
+bool epoll_idle_connections_benchmark(void) {
+    BEGIN_TEST;
+
+    int fds[2 * BENCH_CONNECTIONS];
+    for (int i = 0; i < BENCH_CONNECTIONS; i++) {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[2 * i]), 0, "socketpair failed");
+    }
+
+    const int active = BENCH_CONNECTIONS / 2;
+    mx_time_t poll_time = bench_poll(fds, active);
+    mx_time_t epoll_time = bench_epoll(fds, active);
+    ASSERT_NEQ(poll_time, 0u, "poll benchmark failed");
+    ASSERT_NEQ(epoll_time, 0u, "epoll benchmark failed");
+
+    printf("\n%d connections, 1 active: poll %" PRIu64 " ns/wakeup, epoll %" PRIu64 " ns/wakeup\n",
+           BENCH_CONNECTIONS, poll_time / BENCH_ROUNDS, epoll_time / BENCH_ROUNDS);
+
+    for (int i = 0; i < 2 * BENCH_CONNECTIONS; i++) {
+        EXPECT_EQ(close(fds[i]), 0, "close failed");
+    }
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(mxio_epoll_test)
+RUN_TEST(epoll_level_triggered_test);
+RUN_TEST(epoll_edge_triggered_test);
+RUN_TEST(epoll_oneshot_test);
+RUN_TEST(epoll_ctl_errors_test);
+RUN_TEST(epoll_idle_connections_benchmark);
+END_TEST_CASE(mxio_epoll_test)
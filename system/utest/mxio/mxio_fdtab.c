@@ -0,0 +1,129 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+
+#include <unittest/unittest.h>
+
+#define MAX_THREADS 8
+
+typedef struct {
+    int fd;
+    int iterations;
+    atomic_bool* stop;
+    int failures;
+} lookup_args_t;
+
+// Looks up args->fd with a call which goes through the fd table
+// but doesn't leave the process.
+static int lookup_thread(void* arg) {
+    lookup_args_t* args = arg;
+    for (int n = 0; (args->iterations == 0) || (n < args->iterations); n++) {
+        if ((args->stop != NULL) && atomic_load(args->stop)) {
+            break;
+        }
+        if ((fcntl(args->fd, F_GETFD) < 0) && (errno != EBADF)) {
+            args->failures++;
+        }
+    }
+    return 0;
+}
+
+bool fdtab_close_while_looking_up_test(void) {
+    BEGIN_TEST;
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0, "pipe failed");
+    const int target = dup(fds[0]);
+    ASSERT_GE(target, 0, "dup failed");
+
+    atomic_bool stop = ATOMIC_VAR_INIT(false);
+    lookup_args_t args[3];
+    thrd_t threads[3];
+    for (int i = 0; i < 3; i++) {
+        args[i] = (lookup_args_t){.fd = target, .iterations = 0, .stop = &stop};
+        ASSERT_EQ(thrd_create(&threads[i], lookup_thread, &args[i]), thrd_success,
+                  "thrd_create failed");
+    }
+
+    // Keep replacing and closing the fd the other threads are looking up.
+    for (int n = 0; n < 10000; n++) {
+        ASSERT_EQ(dup2(fds[n & 1], target), target, "dup2 failed");
+        if (n % 3 == 0) {
+            ASSERT_EQ(close(target), 0, "close failed");
+        }
+    }
+    atomic_store(&stop, true);
+
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(thrd_join(threads[i], NULL), thrd_success, "thrd_join failed");
+        EXPECT_EQ(args[i].failures, 0, "lookup failed");
+    }
+
+    close(target);
+    EXPECT_EQ(close(fds[0]), 0, "close failed");
+    EXPECT_EQ(close(fds[1]), 0, "close failed");
+
+    END_TEST;
+}
+
+// Measures fd lookups from 1 to MAX_THREADS threads, each using its own fd.
+// Lookups of unrelated fds should not slow each other down.
+#define BENCH_LOOKUPS 200000
+
+bool fdtab_lookup_benchmark(void) {
+    BEGIN_TEST;
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0, "pipe failed");
+
+    int thread_fds[MAX_THREADS];
+    for (int i = 0; i < MAX_THREADS; i++) {
+        thread_fds[i] = dup(fds[0]);
+        ASSERT_GE(thread_fds[i], 0, "dup failed");
+    }
+
+    printf("\n");
+    for (int nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+        lookup_args_t args[MAX_THREADS];
+        thrd_t threads[MAX_THREADS];
+
+        mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+        for (int i = 0; i < nthreads; i++) {
+            args[i] = (lookup_args_t){.fd = thread_fds[i], .iterations = BENCH_LOOKUPS};
+            ASSERT_EQ(thrd_create(&threads[i], lookup_thread, &args[i]), thrd_success,
+                      "thrd_create failed");
+        }
+        for (int i = 0; i < nthreads; i++) {
+            ASSERT_EQ(thrd_join(threads[i], NULL), thrd_success, "thrd_join failed");
+            EXPECT_EQ(args[i].failures, 0, "lookup failed");
+        }
+        mx_time_t elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+
+        printf("%d thread(s): %" PRIu64 " ns/lookup/thread, %" PRIu64 " lookups/ms total\n",
+               nthreads, elapsed / BENCH_LOOKUPS,
+               (uint64_t)nthreads * BENCH_LOOKUPS * 1000000 / (elapsed + 1));
+    }
+
+    for (int i = 0; i < MAX_THREADS; i++) {
+        EXPECT_EQ(close(thread_fds[i]), 0, "close failed");
+    }
+    EXPECT_EQ(close(fds[0]), 0, "close failed");
+    EXPECT_EQ(close(fds[1]), 0, "close failed");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(mxio_fdtab_test)
+RUN_TEST(fdtab_close_while_looking_up_test);
+RUN_TEST_PERFORMANCE(fdtab_lookup_benchmark);
+END_TEST_CASE(mxio_fdtab_test)
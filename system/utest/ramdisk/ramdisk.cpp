@@ -431,6 +431,167 @@ bool ramdisk_test_fifo_basic(void) {
     END_TEST;
 }
 
+bool ramdisk_test_fifo_trim(void) {
+    BEGIN_TEST;
+    const uint64_t kBlockSize = 512;
+    const uint64_t kBlockCount = 64;
+    int fd = get_ramdisk(kBlockSize, kBlockCount);
+    block_info_t info;
+    ASSERT_GE(ioctl_block_get_info(fd, &info), 0, "Failed to get block info");
+    ASSERT_TRUE(info.flags & BLOCK_FLAG_TRIM_SUPPORT, "Ramdisk should support trim");
+
+    mx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+
+    const uint64_t disk_size = kBlockSize * kBlockCount;
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(disk_size, 0, &vmo), MX_OK, "Failed to create VMO");
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[disk_size]);
+    ASSERT_TRUE(ac.check());
+    fill_random(buf.get(), disk_size);
+    size_t actual;
+    ASSERT_EQ(mx_vmo_write(vmo, buf.get(), 0, disk_size, &actual), MX_OK);
+
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    mx_handle_t xfer_vmo;
+    ASSERT_EQ(mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &xfer_vmo), MX_OK);
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &vmoid), expected,
+              "Failed to attach vmo");
+
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), MX_OK);
+    block_fifo_request_t request;
+    request.txnid      = txnid;
+    request.vmoid      = vmoid;
+    request.opcode     = BLOCKIO_WRITE;
+    request.length     = disk_size;
+    request.vmo_offset = 0;
+    request.dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+
+    // Discard a range which starts and ends partway through a page
+    const uint64_t trim_start = kBlockSize * 3;
+    const uint64_t trim_length = kBlockSize * 20;
+    request.vmoid      = 0;
+    request.opcode     = BLOCKIO_TRIM;
+    request.length     = trim_length;
+    request.vmo_offset = 0;
+    request.dev_offset = trim_start;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+    memset(buf.get() + trim_start, 0, trim_length);
+
+    // Discarded blocks read back as zeroes, the rest is untouched
+    fbl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[disk_size]());
+    ASSERT_TRUE(ac.check());
+    ASSERT_EQ(mx_vmo_write(vmo, out.get(), 0, disk_size, &actual), MX_OK);
+    request.vmoid      = vmoid;
+    request.opcode     = BLOCKIO_READ;
+    request.length     = disk_size;
+    request.dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+    ASSERT_EQ(mx_vmo_read(vmo, out.get(), 0, disk_size, &actual), MX_OK);
+    ASSERT_EQ(memcmp(buf.get(), out.get(), disk_size), 0, "Unexpected data after trim");
+
+    request.opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+    ASSERT_EQ(mx_handle_close(vmo), MX_OK);
+    block_fifo_release_client(client);
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0);
+    END_TEST;
+}
+
+bool ramdisk_test_fifo_trim_write_budget(void) {
+    BEGIN_TEST;
+    const uint64_t kBlockSize = 512;
+    const uint64_t kBlockCount = 64;
+    int fd = get_ramdisk(kBlockSize, kBlockCount);
+
+    mx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+
+    const uint64_t disk_size = kBlockSize * kBlockCount;
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(disk_size, 0, &vmo), MX_OK, "Failed to create VMO");
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[disk_size]);
+    ASSERT_TRUE(ac.check());
+    fill_random(buf.get(), disk_size);
+    size_t actual;
+    ASSERT_EQ(mx_vmo_write(vmo, buf.get(), 0, disk_size, &actual), MX_OK);
+
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    mx_handle_t xfer_vmo;
+    ASSERT_EQ(mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &xfer_vmo), MX_OK);
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &vmoid), expected,
+              "Failed to attach vmo");
+
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), MX_OK);
+    block_fifo_request_t request;
+    request.txnid      = txnid;
+    request.vmoid      = vmoid;
+    request.opcode     = BLOCKIO_WRITE;
+    request.length     = disk_size;
+    request.vmo_offset = 0;
+    request.dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+
+    // A trim is charged against the write budget like a write: only the
+    // blocks it covers are discarded, and later writes are dropped.
+    const uint64_t kBudget = 4;
+    ASSERT_EQ(ioctl_ramdisk_drop_writes_after(fd, &kBudget), 0);
+    const uint64_t trim_start = kBlockSize * 3;
+    request.vmoid      = 0;
+    request.opcode     = BLOCKIO_TRIM;
+    request.length     = kBlockSize * 10;
+    request.vmo_offset = 0;
+    request.dev_offset = trim_start;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+    memset(buf.get() + trim_start, 0, kBlockSize * kBudget);
+
+    request.length     = kBlockSize;
+    request.dev_offset = kBlockSize * 40;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+
+    fbl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[disk_size]());
+    ASSERT_TRUE(ac.check());
+    ASSERT_EQ(mx_vmo_write(vmo, out.get(), 0, disk_size, &actual), MX_OK);
+    request.vmoid      = vmoid;
+    request.opcode     = BLOCKIO_WRITE;
+    request.length     = kBlockSize;
+    request.dev_offset = kBlockSize * 50;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+
+    request.opcode     = BLOCKIO_READ;
+    request.length     = disk_size;
+    request.dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+    ASSERT_EQ(mx_vmo_read(vmo, out.get(), 0, disk_size, &actual), MX_OK);
+    ASSERT_EQ(memcmp(buf.get(), out.get(), disk_size), 0, "Unexpected data after trim");
+
+    uint64_t unlimited = UINT64_MAX;
+    ASSERT_EQ(ioctl_ramdisk_drop_writes_after(fd, &unlimited), 0);
+    request.opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), MX_OK);
+    ASSERT_EQ(mx_handle_close(vmo), MX_OK);
+    block_fifo_release_client(client);
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0);
+    END_TEST;
+}
+
 typedef struct {
     uint64_t vmo_size;
     mx_handle_t vmo;
@@ -1039,6 +1200,8 @@ RUN_TEST_SMALL(ramdisk_test_release_during_fifo_access)
 RUN_TEST_SMALL(ramdisk_test_multiple)
 RUN_TEST_SMALL(ramdisk_test_fifo_no_op)
 RUN_TEST_SMALL(ramdisk_test_fifo_basic)
+RUN_TEST_SMALL(ramdisk_test_fifo_trim)
+RUN_TEST_SMALL(ramdisk_test_fifo_trim_write_budget)
 RUN_TEST_SMALL(ramdisk_test_fifo_multiple_vmo)
 RUN_TEST_SMALL(ramdisk_test_fifo_multiple_vmo_multithreaded)
 // TODO(smklein): Test ops across different vmos
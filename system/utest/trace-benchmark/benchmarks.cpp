@@ -13,6 +13,17 @@
 
 namespace {
 
+// Distinct event names, as used by services instrumented with many
+// categories and names.
+constexpr unsigned kNumNames = 1000;
+char g_names[kNumNames][16];
+
+void InitNames() {
+    for (unsigned i = 0; i < kNumNames; i++) {
+        snprintf(g_names[i], sizeof(g_names[i]), "name%u", i);
+    }
+}
+
 void RunBenchmarks(bool tracing_enabled) {
     Run("is enabled", [] {
         trace_is_enabled();
@@ -103,6 +114,13 @@ void RunBenchmarks(bool tracing_enabled) {
                              "k5", "string5", "k6", "string6", "k7", "string7", "k8", "string8");
     });
 
+    InitNames();
+    Run("TRACE_DURATION_BEGIN macro with 0 arguments and 1000 distinct names", [] {
+        static unsigned n = 0;
+        TRACE_DURATION_BEGIN("+enabled", g_names[n]);
+        n = (n + 1) % kNumNames;
+    });
+
     if (tracing_enabled) {
         Run("TRACE_DURATION_BEGIN macro with 0 arguments for disabled category", [] {
             TRACE_DURATION_BEGIN("-disabled", "name");
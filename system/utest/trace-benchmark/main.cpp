@@ -9,8 +9,8 @@
 #include <magenta/assert.h>
 
 #include <async/loop.h>
-#include <async/task.h>
 #include <fbl/array.h>
+#include <mx/event.h>
 #include <trace/handler.h>
 
 #include "benchmarks.h"
@@ -18,21 +18,33 @@
 namespace {
 
 // Trace buffer size.
-// Should be sized so it does not overflow during the test.
+// In oneshot mode, later benchmarks may find the buffer full and measure
+// the cost of dropping records instead.
 static constexpr size_t kBufferSizeBytes = 16 * 1024 * 1024;
 
 class BenchmarkHandler : public trace::TraceHandler {
 public:
-    BenchmarkHandler(async::Loop* loop)
-        : loop_(loop), buffer_(new uint8_t[kBufferSizeBytes], kBufferSizeBytes) {
+    BenchmarkHandler(async::Loop* loop, trace_buffering_mode_t buffering_mode)
+        : loop_(loop), buffering_mode_(buffering_mode),
+          buffer_(new uint8_t[kBufferSizeBytes], kBufferSizeBytes) {
+        mx_status_t status = mx::event::create(0u, &trace_stopped_);
+        MX_DEBUG_ASSERT(status == MX_OK);
     }
 
-    void Start() {
-        mx_status_t status = trace_start_engine(loop_->async(), this,
-                                                buffer_.get(), buffer_.size());
+    void Start(const char* mode_name) {
+        mx_status_t status = trace_start_engine_with_mode(loop_->async(), this, buffering_mode_,
+                                                          buffer_.get(), buffer_.size());
         MX_DEBUG_ASSERT(status == MX_OK);
 
-        puts("\nTrace started\n");
+        printf("\nTrace started in %s mode\n\n", mode_name);
+    }
+
+    void Stop() {
+        mx_status_t status = trace_stop_engine(MX_OK);
+        MX_DEBUG_ASSERT(status == MX_OK);
+
+        status = trace_stopped_.wait_one(MX_EVENT_SIGNALED, MX_TIME_INFINITE, nullptr);
+        MX_DEBUG_ASSERT(status == MX_OK);
     }
 
 private:
@@ -44,35 +56,49 @@ private:
     void TraceStopped(async_t* async,
                       mx_status_t disposition,
                       size_t buffer_bytes_written) override {
-        puts("\nTrace stopped");
+        printf("\nTrace stopped, %zu bytes written\n", buffer_bytes_written);
 
-        MX_DEBUG_ASSERT(disposition == MX_OK);
-        loop_->Quit();
+        trace_stopped_.signal(0u, MX_EVENT_SIGNALED);
+    }
+
+    void NotifyBufferFull(async_t* async, uint32_t buffer_number,
+                          size_t durable_offset, size_t durable_num_bytes,
+                          size_t buffer_offset, size_t buffer_num_bytes) override {
+        // Discard the records straight away: saving them is the trace
+        // manager's cost, not the instrumented program's.
+        mx_status_t status = trace_engine_mark_buffer_saved(buffer_number);
+        MX_DEBUG_ASSERT(status == MX_OK);
     }
 
     async::Loop* loop_;
+    trace_buffering_mode_t const buffering_mode_;
     fbl::Array<uint8_t> buffer_;
+    mx::event trace_stopped_;
 };
 
+void RunTracingEnabledBenchmarksWithMode(async::Loop* loop,
+                                         trace_buffering_mode_t buffering_mode,
+                                         const char* mode_name) {
+    BenchmarkHandler handler(loop, buffering_mode);
+    handler.Start(mode_name);
+    RunTracingEnabledBenchmarks();
+    handler.Stop();
+}
+
 } // namespace
 
 int main(int argc, char** argv) {
+    // The trace engine's dispatcher runs on its own thread so that it can
+    // save full buffers while the benchmarks run in streaming mode.
     async::Loop loop;
-    BenchmarkHandler handler(&loop);
+    loop.StartThread("trace-benchmark");
 
     RunTracingDisabledBenchmarks();
-    handler.Start();
-
-    async::Task task(0u);
-    task.set_handler([](async_t* async, mx_status_t status) {
-        RunTracingEnabledBenchmarks();
-        RunNoTraceBenchmarks();
-
-        trace_stop_engine(MX_OK);
-        return ASYNC_TASK_FINISHED;
-    });
-    task.Post(loop.async());
+    RunTracingEnabledBenchmarksWithMode(&loop, TRACE_BUFFERING_MODE_ONESHOT, "oneshot");
+    RunTracingEnabledBenchmarksWithMode(&loop, TRACE_BUFFERING_MODE_CIRCULAR, "circular");
+    RunTracingEnabledBenchmarksWithMode(&loop, TRACE_BUFFERING_MODE_STREAMING, "streaming");
+    RunNoTraceBenchmarks();
 
-    loop.Run(); // run until quit
+    loop.Shutdown();
     return 0;
 }
@@ -0,0 +1,174 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <fbl/atomic.h>
+#include <fbl/string_printf.h>
+#include <fbl/vector.h>
+#include <trace-reader/reader.h>
+#include <trace-reader/view.h>
+#include <unittest/unittest.h>
+
+#include "trace_builder.h"
+
+namespace {
+
+constexpr size_t kNumEvents = 2000000;
+constexpr size_t kNumThreads = 64;
+constexpr size_t kNumNames = 1000;
+constexpr size_t kMaxWorkers = 8;
+
+// Runs on both the host and the target, so use the POSIX clock rather than
+// mx_time_get.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// A trace of |kNumEvents| instant events spread over |kNumThreads| threads
+// and |kNumNames| names, as written by a single provider.
+const fbl::Vector<uint64_t>& GetSyntheticTrace() {
+    static trace::test::TraceBuilder* builder;
+    if (builder)
+        return builder->words();
+
+    builder = new trace::test::TraceBuilder();
+    builder->AddString(1u, "category");
+    builder->AddString(2u, "arg");
+    for (size_t i = 0; i < kNumNames; i++)
+        builder->AddString(static_cast<trace_string_index_t>(3u + i),
+                           fbl::StringPrintf("name%zu", i).c_str());
+    for (size_t i = 0; i < kNumThreads; i++)
+        builder->AddThread(static_cast<trace_thread_index_t>(1u + i), 1000u, 2000u + i);
+    for (size_t i = 0; i < kNumEvents; i++) {
+        builder->AddInstantEvent(i, static_cast<trace_thread_index_t>(1u + i % kNumThreads),
+                                 1u, static_cast<trace_string_index_t>(3u + i % kNumNames),
+                                 2u, static_cast<int32_t>(i));
+    }
+    return builder->words();
+}
+
+void PrintResult(const char* name, uint64_t elapsed_ns, size_t num_words) {
+    printf("    %-32s %8.1f ms, %6.1f ns/event, %7.1f MB/s\n", name,
+           static_cast<double>(elapsed_ns) / 1000000.0,
+           static_cast<double>(elapsed_ns) / kNumEvents,
+           static_cast<double>(num_words * sizeof(uint64_t)) * 1000.0 /
+               static_cast<double>(elapsed_ns));
+}
+
+struct Worker {
+    const trace::TraceView* view;
+    fbl::atomic<size_t>* next_segment;
+    size_t num_events;
+    size_t num_errors;
+};
+
+void* DecodeSegments(void* arg) {
+    Worker* worker = static_cast<Worker*>(arg);
+    trace::SegmentDecoder decoder(worker->view);
+    size_t num_events = 0u;
+    const size_t num_segments = worker->view->segments().size();
+    for (;;) {
+        size_t segment = worker->next_segment->fetch_add(1u);
+        if (segment >= num_segments)
+            break;
+        if (!decoder.Decode(segment, [&num_events](const trace::EventView& event) {
+                num_events++;
+            })) {
+            worker->num_errors++;
+        }
+    }
+    worker->num_events = num_events;
+    return nullptr;
+}
+
+// Decodes the trace with the record-copying |TraceReader|.
+bool benchmark_trace_reader(void) {
+    BEGIN_TEST;
+
+    const fbl::Vector<uint64_t>& words = GetSyntheticTrace();
+
+    size_t num_events = 0u;
+    size_t num_errors = 0u;
+    trace::TraceReader reader(
+        [&num_events](trace::Record record) {
+            if (record.type() == trace::RecordType::kEvent)
+                num_events++;
+        },
+        [&num_errors](fbl::String error) { num_errors++; });
+
+    uint64_t start = now_ns();
+    trace::Chunk chunk(words.get(), words.size());
+    EXPECT_TRUE(reader.ReadRecords(chunk));
+    uint64_t elapsed = now_ns() - start;
+
+    EXPECT_EQ(kNumEvents, num_events);
+    EXPECT_EQ(0u, num_errors);
+    printf("\n");
+    PrintResult("TraceReader", elapsed, words.size());
+
+    END_TEST;
+}
+
+// Indexes the trace with a |TraceView|, then decodes its segments in place
+// with increasing numbers of workers.
+bool benchmark_trace_view(void) {
+    BEGIN_TEST;
+
+    const fbl::Vector<uint64_t>& words = GetSyntheticTrace();
+
+    size_t num_errors = 0u;
+    trace::TraceView view([&num_errors](fbl::String error) { num_errors++; });
+    uint64_t start = now_ns();
+    EXPECT_TRUE(view.Index(words.get(), words.size()));
+    uint64_t elapsed = now_ns() - start;
+
+    printf("\n");
+    PrintResult(fbl::StringPrintf("TraceView::Index (%zu segments)",
+                                  view.segments().size()).c_str(),
+                elapsed, words.size());
+
+    for (size_t num_workers = 1; num_workers <= kMaxWorkers; num_workers *= 2) {
+        fbl::atomic<size_t> next_segment(0u);
+        Worker workers[kMaxWorkers];
+        pthread_t threads[kMaxWorkers];
+
+        start = now_ns();
+        for (size_t i = 0; i < num_workers; i++) {
+            workers[i] = Worker{&view, &next_segment, 0u, 0u};
+            ASSERT_EQ(0, pthread_create(&threads[i], nullptr, DecodeSegments, &workers[i]));
+        }
+        size_t num_events = 0u;
+        for (size_t i = 0; i < num_workers; i++) {
+            ASSERT_EQ(0, pthread_join(threads[i], nullptr));
+            num_events += workers[i].num_events;
+            EXPECT_EQ(0u, workers[i].num_errors);
+        }
+        elapsed = now_ns() - start;
+
+        EXPECT_EQ(kNumEvents, num_events);
+        PrintResult(fbl::StringPrintf("SegmentDecoder x %zu", num_workers).c_str(),
+                    elapsed, words.size());
+    }
+    EXPECT_EQ(0u, num_errors);
+
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(trace_reader_benchmarks)
+RUN_TEST_PERFORMANCE(benchmark_trace_reader)
+RUN_TEST_PERFORMANCE(benchmark_trace_view)
+END_TEST_CASE(trace_reader_benchmarks)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -7,7 +7,8 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 reader_tests := \
     $(LOCAL_DIR)/main.c \
     $(LOCAL_DIR)/reader_tests.cpp \
-    $(LOCAL_DIR)/records_tests.cpp
+    $(LOCAL_DIR)/records_tests.cpp \
+    $(LOCAL_DIR)/view_tests.cpp
 
 # Userspace tests.
 
@@ -58,6 +59,57 @@ MODULE_COMPILEFLAGS := \
 
 include make/module.mk
 
+# Userspace benchmarks.
+
+MODULE := $(LOCAL_DIR).bench
+
+MODULE_TYPE := usertest
+
+MODULE_SRCS := $(LOCAL_DIR)/reader_bench.cpp
+
+MODULE_NAME := trace-reader-bench
+
+MODULE_STATIC_LIBS := \
+    system/ulib/trace-reader \
+    system/ulib/trace-engine \
+    system/ulib/mx \
+    system/ulib/mxcpp \
+    system/ulib/fbl
+
+MODULE_LIBS := \
+    system/ulib/c \
+    system/ulib/mxio \
+    system/ulib/magenta \
+    system/ulib/unittest
+
+include make/module.mk
+
+# Host benchmarks.
+
+MODULE := $(LOCAL_DIR).bench.hostapp
+
+MODULE_TYPE := hostapp
+
+MODULE_SRCS := $(LOCAL_DIR)/reader_bench.cpp
+
+MODULE_NAME := trace-reader-bench
+
+MODULE_HOST_LIBS := \
+    system/ulib/trace-reader.hostlib \
+    system/ulib/fbl.hostlib \
+    system/ulib/unittest.hostlib \
+    system/ulib/pretty.hostlib
+
+MODULE_HOST_SYSLIBS := -lpthread
+
+MODULE_COMPILEFLAGS := \
+    -Isystem/ulib/trace-engine/include \
+    -Isystem/ulib/trace-reader/include \
+    -Isystem/ulib/fbl/include \
+    -Isystem/ulib/unittest/include \
+
+include make/module.mk
+
 # Clear out local variables.
 
 reader_tests :=
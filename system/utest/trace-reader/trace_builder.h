@@ -0,0 +1,94 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <fbl/vector.h>
+#include <trace-engine/fields.h>
+#include <trace-engine/types.h>
+
+namespace trace {
+namespace test {
+
+// Builds a trace in memory one record at a time, for tests and benchmarks
+// which need traces without a running trace engine.
+class TraceBuilder {
+public:
+    const fbl::Vector<uint64_t>& words() const { return words_; }
+
+    void AddProviderInfo(ProviderId id, const char* name) {
+        size_t length = strlen(name);
+        AddHeader(RecordType::kMetadata, BytesToWords(length),
+                  MetadataRecordFields::MetadataType::Make(
+                      ToUnderlyingType(MetadataType::kProviderInfo)) |
+                      ProviderInfoMetadataRecordFields::Id::Make(id) |
+                      ProviderInfoMetadataRecordFields::NameLength::Make(length));
+        AddStringWords(name, length);
+    }
+
+    void AddProviderSection(ProviderId id) {
+        AddHeader(RecordType::kMetadata, 0u,
+                  MetadataRecordFields::MetadataType::Make(
+                      ToUnderlyingType(MetadataType::kProviderSection)) |
+                      ProviderSectionMetadataRecordFields::Id::Make(id));
+    }
+
+    void AddString(trace_string_index_t index, const char* string) {
+        size_t length = strlen(string);
+        AddHeader(RecordType::kString, BytesToWords(length),
+                  StringRecordFields::StringIndex::Make(index) |
+                      StringRecordFields::StringLength::Make(length));
+        AddStringWords(string, length);
+    }
+
+    void AddThread(trace_thread_index_t index,
+                   mx_koid_t process_koid, mx_koid_t thread_koid) {
+        AddHeader(RecordType::kThread, 2u, ThreadRecordFields::ThreadIndex::Make(index));
+        words_.push_back(process_koid);
+        words_.push_back(thread_koid);
+    }
+
+    // Adds an instant event with an indexed thread, category and name, and
+    // one int32 argument with an indexed name.
+    void AddInstantEvent(trace_ticks_t timestamp, trace_thread_index_t thread_index,
+                         trace_string_index_t category_index,
+                         trace_string_index_t name_index,
+                         trace_string_index_t arg_name_index, int32_t arg_value) {
+        AddHeader(RecordType::kEvent, 3u,
+                  EventRecordFields::EventType::Make(ToUnderlyingType(EventType::kInstant)) |
+                      EventRecordFields::ArgumentCount::Make(1u) |
+                      EventRecordFields::ThreadRef::Make(thread_index) |
+                      EventRecordFields::CategoryStringRef::Make(category_index) |
+                      EventRecordFields::NameStringRef::Make(name_index));
+        words_.push_back(timestamp);
+        words_.push_back(ArgumentFields::Type::Make(ToUnderlyingType(ArgumentType::kInt32)) |
+                         ArgumentFields::ArgumentSize::Make(1u) |
+                         ArgumentFields::NameRef::Make(arg_name_index) |
+                         Int32ArgumentFields::Value::Make(static_cast<uint32_t>(arg_value)));
+        words_.push_back(ToUnderlyingType(EventScope::kThread));
+    }
+
+private:
+    void AddHeader(RecordType type, size_t num_payload_words, uint64_t fields) {
+        words_.push_back(RecordFields::Type::Make(ToUnderlyingType(type)) |
+                         RecordFields::RecordSize::Make(num_payload_words + 1u) |
+                         fields);
+    }
+
+    void AddStringWords(const char* string, size_t length) {
+        for (size_t i = 0; i < length; i += sizeof(uint64_t)) {
+            uint64_t word = 0u;
+            memcpy(&word, string + i, length - i < sizeof(word) ? length - i : sizeof(word));
+            words_.push_back(word);
+        }
+    }
+
+    fbl::Vector<uint64_t> words_;
+};
+
+} // namespace test
+} // namespace trace
@@ -0,0 +1,285 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <trace-reader/view.h>
+
+#include <stdint.h>
+
+#include <fbl/string.h>
+#include <fbl/vector.h>
+#include <unittest/unittest.h>
+
+#include "trace_builder.h"
+
+namespace {
+
+struct DecodedEvent {
+    trace_ticks_t timestamp;
+    trace::ProcessThread process_thread;
+    fbl::String category;
+    fbl::String name;
+    fbl::String arg_name;
+    int32_t arg_value;
+};
+
+trace::TraceView::ErrorHandler MakeErrorHandler(fbl::String* out_error) {
+    return [out_error](fbl::String error) {
+        *out_error = fbl::move(error);
+    };
+}
+
+bool DecodeSegment(trace::SegmentDecoder* decoder, size_t segment,
+                   fbl::Vector<DecodedEvent>* out_events) {
+    return decoder->Decode(segment, [out_events](const trace::EventView& event) {
+        out_events->push_back(DecodedEvent{
+            event.timestamp, event.process_thread,
+            fbl::String(event.category), fbl::String(event.name),
+            event.num_arguments ? fbl::String(event.arguments[0].name) : fbl::String(),
+            event.num_arguments ? event.arguments[0].int32 : 0});
+    });
+}
+
+// Two providers whose string and thread tables use the same indexes,
+// with the trace switching back to the first provider part way through.
+void BuildTwoProviderTrace(trace::test::TraceBuilder* builder) {
+    builder->AddString(1u, "cat");
+    builder->AddString(2u, "name");
+    builder->AddString(3u, "arg");
+    builder->AddThread(1u, 10u, 11u);
+    for (int i = 0; i < 20; i++)
+        builder->AddInstantEvent(100u + i, 1u, 1u, 2u, 3u, i);
+
+    builder->AddProviderInfo(5u, "other");
+    builder->AddString(1u, "cat5");
+    builder->AddString(2u, "name5");
+    builder->AddString(3u, "arg5");
+    builder->AddThread(1u, 20u, 21u);
+    for (int i = 0; i < 10; i++)
+        builder->AddInstantEvent(1000u + i, 1u, 1u, 2u, 3u, i);
+
+    builder->AddProviderSection(0u);
+    for (int i = 0; i < 5; i++)
+        builder->AddInstantEvent(200u + i, 1u, 1u, 2u, 3u, i);
+}
+
+bool CheckEvent(const DecodedEvent& event, trace_ticks_t timestamp, bool other_provider,
+                int32_t arg_value) {
+    BEGIN_HELPER;
+
+    EXPECT_EQ(timestamp, event.timestamp);
+    if (other_provider) {
+        EXPECT_TRUE(event.process_thread == trace::ProcessThread(20u, 21u));
+        EXPECT_TRUE(event.category == "cat5");
+        EXPECT_TRUE(event.name == "name5");
+        EXPECT_TRUE(event.arg_name == "arg5");
+    } else {
+        EXPECT_TRUE(event.process_thread == trace::ProcessThread(10u, 11u));
+        EXPECT_TRUE(event.category == "cat");
+        EXPECT_TRUE(event.name == "name");
+        EXPECT_TRUE(event.arg_name == "arg");
+    }
+    EXPECT_EQ(arg_value, event.arg_value);
+
+    END_HELPER;
+}
+
+bool CheckTwoProviderEvents(const fbl::Vector<DecodedEvent>& events) {
+    BEGIN_HELPER;
+
+    ASSERT_EQ(35u, events.size());
+    for (int i = 0; i < 20; i++)
+        EXPECT_TRUE(CheckEvent(events[i], 100u + i, false, i));
+    for (int i = 0; i < 10; i++)
+        EXPECT_TRUE(CheckEvent(events[20 + i], 1000u + i, true, i));
+    for (int i = 0; i < 5; i++)
+        EXPECT_TRUE(CheckEvent(events[30 + i], 200u + i, false, i));
+
+    END_HELPER;
+}
+
+bool empty_trace_test() {
+    BEGIN_TEST;
+
+    fbl::String error;
+    trace::TraceView view(MakeErrorHandler(&error));
+    EXPECT_TRUE(view.Index(nullptr, 0u));
+    EXPECT_EQ(0u, view.segments().size());
+    EXPECT_EQ(1u, view.providers().size());
+    EXPECT_EQ(0u, view.FindSegment(0u));
+    EXPECT_TRUE(error.empty());
+
+    END_TEST;
+}
+
+bool index_test() {
+    BEGIN_TEST;
+
+    trace::test::TraceBuilder builder;
+    BuildTwoProviderTrace(&builder);
+
+    fbl::String error;
+    trace::TraceView view(MakeErrorHandler(&error));
+    ASSERT_TRUE(view.Index(builder.words().get(), builder.words().size(), 16u));
+    EXPECT_TRUE(error.empty());
+
+    ASSERT_EQ(2u, view.providers().size());
+    EXPECT_EQ(0u, view.providers()[0].id);
+    EXPECT_EQ(5u, view.providers()[1].id);
+    EXPECT_TRUE(view.providers()[1].name == "other");
+    EXPECT_EQ(3u, view.providers()[0].string_records.size());
+    EXPECT_EQ(1u, view.providers()[1].thread_records.size());
+
+    // Segments cover the whole trace, in order, and never span providers.
+    size_t offset = 0u;
+    size_t num_events = 0u;
+    for (const auto& segment : view.segments()) {
+        EXPECT_EQ(offset, segment.begin);
+        EXPECT_LT(segment.begin, segment.end);
+        EXPECT_LE(segment.end - segment.begin, 16u + 3u);
+        offset = segment.end;
+        num_events += segment.num_events;
+    }
+    EXPECT_EQ(builder.words().size(), offset);
+    EXPECT_EQ(35u, num_events);
+
+    // The other provider's segments are exactly the ones with its thread
+    // and timestamps.
+    fbl::Vector<size_t> other = view.FindSegments(trace::ProcessThread(20u, 21u));
+    ASSERT_GT(other.size(), 0u);
+    for (size_t i : other) {
+        EXPECT_EQ(1u, view.segments()[i].provider);
+        EXPECT_GE(view.segments()[i].min_timestamp, 1000u);
+    }
+    EXPECT_EQ(other[0], view.FindSegment(1000u));
+    EXPECT_EQ(view.segments().size(), view.FindSegment(2000u));
+    EXPECT_EQ(0u, view.FindSegment(0u));
+
+    END_TEST;
+}
+
+bool decode_in_order_test() {
+    BEGIN_TEST;
+
+    trace::test::TraceBuilder builder;
+    BuildTwoProviderTrace(&builder);
+
+    fbl::String error;
+    trace::TraceView view(MakeErrorHandler(&error));
+    ASSERT_TRUE(view.Index(builder.words().get(), builder.words().size(), 16u));
+
+    trace::SegmentDecoder decoder(&view);
+    fbl::Vector<DecodedEvent> events;
+    for (size_t i = 0; i < view.segments().size(); i++)
+        EXPECT_TRUE(DecodeSegment(&decoder, i, &events));
+    EXPECT_TRUE(CheckTwoProviderEvents(events));
+    EXPECT_TRUE(error.empty());
+
+    END_TEST;
+}
+
+bool decode_out_of_order_test() {
+    BEGIN_TEST;
+
+    trace::test::TraceBuilder builder;
+    BuildTwoProviderTrace(&builder);
+
+    fbl::String error;
+    trace::TraceView view(MakeErrorHandler(&error));
+    ASSERT_TRUE(view.Index(builder.words().get(), builder.words().size(), 16u));
+
+    // Decode the segments backwards, each with tables loaded from scratch,
+    // then put the events back in trace order.
+    const size_t num_segments = view.segments().size();
+    fbl::Vector<fbl::Vector<DecodedEvent>> segment_events;
+    for (size_t i = 0; i < num_segments; i++)
+        segment_events.push_back(fbl::Vector<DecodedEvent>());
+    trace::SegmentDecoder decoder(&view);
+    for (size_t i = num_segments; i-- > 0;)
+        EXPECT_TRUE(DecodeSegment(&decoder, i, &segment_events[i]));
+
+    fbl::Vector<DecodedEvent> events;
+    for (auto& segment : segment_events) {
+        for (auto& event : segment)
+            events.push_back(fbl::move(event));
+    }
+    EXPECT_TRUE(CheckTwoProviderEvents(events));
+    EXPECT_TRUE(error.empty());
+
+    END_TEST;
+}
+
+bool strings_point_into_buffer_test() {
+    BEGIN_TEST;
+
+    trace::test::TraceBuilder builder;
+    builder.AddString(1u, "category");
+    builder.AddString(2u, "name");
+    builder.AddThread(1u, 10u, 11u);
+    builder.AddInstantEvent(1u, 1u, 1u, 2u, 1u, 0);
+
+    trace::TraceView view(nullptr);
+    ASSERT_TRUE(view.Index(builder.words().get(), builder.words().size()));
+    ASSERT_EQ(1u, view.segments().size());
+
+    const char* begin = reinterpret_cast<const char*>(builder.words().get());
+    const char* end = begin + builder.words().size() * sizeof(uint64_t);
+    size_t count = 0u;
+    trace::SegmentDecoder decoder(&view);
+    EXPECT_TRUE(decoder.Decode(0u, [&](const trace::EventView& event) {
+        EXPECT_TRUE(event.category.data() >= begin && event.category.data() < end);
+        EXPECT_TRUE(event.name.data() >= begin && event.name.data() < end);
+        count++;
+    }));
+    EXPECT_EQ(1u, count);
+
+    END_TEST;
+}
+
+bool corrupt_trace_test() {
+    BEGIN_TEST;
+
+    trace::test::TraceBuilder builder;
+    builder.AddString(1u, "cat");
+    builder.AddThread(1u, 10u, 11u);
+    builder.AddInstantEvent(1u, 1u, 1u, 1u, 1u, 0);
+    // Undefined name string.
+    builder.AddInstantEvent(2u, 1u, 1u, 9u, 1u, 0);
+    const size_t valid_words = builder.words().size();
+
+    fbl::Vector<uint64_t> words;
+    for (uint64_t word : builder.words())
+        words.push_back(word);
+    // Record header claiming more words than are left.
+    words.push_back(trace::RecordFields::RecordSize::Make(4u));
+
+    fbl::String error;
+    trace::TraceView view(MakeErrorHandler(&error));
+    EXPECT_FALSE(view.Index(words.get(), words.size()));
+    EXPECT_FALSE(error.empty());
+    ASSERT_EQ(1u, view.segments().size());
+    EXPECT_EQ(valid_words, view.segments()[0].end);
+    EXPECT_EQ(2u, view.segments()[0].num_events);
+
+    error.clear();
+    size_t count = 0u;
+    trace::SegmentDecoder decoder(&view);
+    EXPECT_TRUE(decoder.Decode(0u, [&count](const trace::EventView& event) {
+        count++;
+    }));
+    EXPECT_EQ(1u, count);
+    EXPECT_FALSE(error.empty());
+
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(view_tests)
+RUN_TEST(empty_trace_test)
+RUN_TEST(index_test)
+RUN_TEST(decode_in_order_test)
+RUN_TEST(decode_out_of_order_test)
+RUN_TEST(strings_point_into_buffer_test)
+RUN_TEST(corrupt_trace_test)
+END_TEST_CASE(view_tests)
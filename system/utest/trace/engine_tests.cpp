@@ -6,12 +6,16 @@
 
 #include <threads.h>
 
+#include <async/loop.h>
+#include <fbl/algorithm.h>
 #include <fbl/function.h>
 #include <fbl/string.h>
 #include <fbl/string_printf.h>
 #include <fbl/vector.h>
 #include <mx/event.h>
+#include <trace-engine/handler.h>
 #include <trace-engine/instrumentation.h>
+#include <trace/handler.h>
 
 namespace {
 int RunClosure(void* arg) {
@@ -203,7 +207,6 @@ bool test_register_current_thread_multiple_threads() {
     ASSERT_RECORDS(R"X(String(index: 1, "process")
 KernelObject(koid: <>, type: thread, name: "initial-thread", {process: koid(<>)})
 Thread(index: 1, <>)
-String(index: 2, "process")
 KernelObject(koid: <>, type: thread, name: "thrd_t:<>/TLS=<>", {process: koid(<>)})
 Thread(index: 2, <>)
 )X",
@@ -212,6 +215,38 @@ Thread(index: 2, <>)
     END_TRACE_TEST;
 }
 
+bool test_register_thread_multiple_threads() {
+    BEGIN_TRACE_TEST;
+
+    fixture_start_tracing();
+
+    trace_thread_ref_t t1;
+    {
+        auto context = trace::TraceContext::Acquire();
+
+        trace_context_register_thread(context.get(), 1234, 5678, &t1);
+    }
+
+    trace_thread_ref_t t2;
+    RunThread([&t2] {
+        auto context = trace::TraceContext::Acquire();
+
+        trace_context_register_thread(context.get(), 1234, 5678, &t2);
+    });
+
+    EXPECT_TRUE(trace_is_indexed_thread_ref(&t1));
+    EXPECT_TRUE(trace_is_indexed_thread_ref(&t2));
+
+    // The context shares registered threads between threads.
+    EXPECT_EQ(t1.encoded_value, t2.encoded_value);
+
+    ASSERT_RECORDS(R"X(Thread(index: 1, <>)
+)X",
+                   "");
+
+    END_TRACE_TEST;
+}
+
 bool test_register_string_literal() {
     BEGIN_TRACE_TEST;
 
@@ -297,14 +332,12 @@ bool test_register_string_literal_multiple_threads() {
     EXPECT_NE(a1.encoded_value, a2.encoded_value);
     EXPECT_NE(b1.encoded_value, b2.encoded_value);
 
-    // Each thread has its own string pool.
-    EXPECT_NE(a1.encoded_value, b1.encoded_value);
-    EXPECT_NE(a2.encoded_value, b2.encoded_value);
+    // The context shares registered strings between threads.
+    EXPECT_EQ(a1.encoded_value, b1.encoded_value);
+    EXPECT_EQ(a2.encoded_value, b2.encoded_value);
 
     ASSERT_RECORDS(R"X(String(index: 1, "string1")
 String(index: 2, "string2")
-String(index: 3, "string1")
-String(index: 4, "string2")
 )X",
                    "");
 
@@ -316,21 +349,60 @@ bool test_register_string_literal_table_overflow() {
 
     fixture_start_tracing();
 
+    // Registers more strings than there are string indices.
+    constexpr unsigned kOverflowCount = 16u;
+    constexpr unsigned kStringCount = TRACE_ENCODED_STRING_REF_MAX_INDEX + kOverflowCount;
+
     fbl::Vector<fbl::String> strings;
+    fbl::Vector<trace_string_ref_t> refs;
 
     {
         auto context = trace::TraceContext::Acquire();
 
-        unsigned n = 0;
-        for (n = 0; n < TRACE_ENCODED_STRING_REF_MAX_INDEX; n++) {
+        for (unsigned n = 0; n < kStringCount; n++) {
             trace_string_ref_t r;
-            fbl::String string = fbl::StringPrintf("string%d", n);
+            fbl::String string = fbl::StringPrintf("string%u", n);
             strings.push_back(string);
             trace_context_register_string_literal(context.get(), string.c_str(), &r);
-            if (trace_is_inline_string_ref(&r))
-                break;
+            refs.push_back(r);
+        }
+
+        // The cache grows as needed, so only the string index space limits
+        // the number of strings which are indexed. Every string after that
+        // falls back to an inline ref to its own contents.
+        unsigned indexed = 0;
+        for (unsigned n = 0; n < kStringCount; n++) {
+            const trace_string_ref_t& r = refs[n];
+            if (n < TRACE_ENCODED_STRING_REF_MAX_INDEX) {
+                if (!trace_is_indexed_string_ref(&r))
+                    break;
+                indexed++;
+            } else {
+                EXPECT_TRUE(trace_is_inline_string_ref(&r));
+                EXPECT_EQ(strings[n].c_str(), r.inline_string);
+                EXPECT_EQ(strings[n].length(), trace_inline_string_ref_length(&r));
+            }
         }
-        EXPECT_GT(n, 100); // at least 100 string can be cached per thread
+        EXPECT_EQ(TRACE_ENCODED_STRING_REF_MAX_INDEX, indexed);
+
+        // Registering them again gives the same refs.
+        trace_string_ref_t r;
+        trace_context_register_string_literal(context.get(), strings[0].c_str(), &r);
+        EXPECT_EQ(refs[0].encoded_value, r.encoded_value);
+        trace_context_register_string_literal(context.get(), strings[kStringCount - 1].c_str(), &r);
+        EXPECT_TRUE(trace_is_inline_string_ref(&r));
+        EXPECT_EQ(strings[kStringCount - 1].c_str(), r.inline_string);
+
+        // So do strings registered from another thread, which has no cache
+        // of its own yet.
+        const char* overflowed = strings[kStringCount - 2].c_str();
+        trace_string_ref_t thread_ref;
+        RunThread([overflowed, &thread_ref] {
+            auto context = trace::TraceContext::Acquire();
+            trace_context_register_string_literal(context.get(), overflowed, &thread_ref);
+        });
+        EXPECT_TRUE(trace_is_inline_string_ref(&thread_ref));
+        EXPECT_EQ(overflowed, thread_ref.inline_string);
     }
 
     END_TRACE_TEST;
@@ -387,6 +459,211 @@ bool test_event_with_inline_everything() {
     END_TRACE_TEST;
 }
 
+// Writes |count| instant events whose "i" argument counts up from |first|,
+// registering strings and the thread as the trace macros do.
+void WriteNumberedEvents(int first, int count) {
+    auto context = trace::TraceContext::Acquire();
+    if (!context)
+        return;
+
+    trace_thread_ref_t thread_ref;
+    trace_context_register_current_thread(context.get(), &thread_ref);
+    trace_string_ref_t category_ref, name_ref, arg_name_ref;
+    trace_context_register_string_literal(context.get(), "+enabled", &category_ref);
+    trace_context_register_string_literal(context.get(), "name", &name_ref);
+    trace_context_register_string_literal(context.get(), "i", &arg_name_ref);
+
+    for (int i = first; i < first + count; i++) {
+        trace_arg_t args[] = {
+            trace_make_arg(arg_name_ref, trace_make_int32_arg_value(i))};
+        trace_context_write_instant_event_record(context.get(), mx_ticks_get(),
+                                                 &thread_ref, &category_ref, &name_ref,
+                                                 TRACE_SCOPE_THREAD,
+                                                 args, fbl::count_of(args));
+    }
+}
+
+// Checks that |records| contains a run of numbered events ending with |end - 1|.
+// Returns the number of events.
+bool CheckNumberedEvents(const fbl::Vector<trace::Record>& records, int end,
+                         size_t* out_count) {
+    BEGIN_HELPER;
+
+    int next = -1;
+    size_t count = 0u;
+    for (const auto& record : records) {
+        if (record.type() != trace::RecordType::kEvent)
+            continue;
+        const auto& event = record.GetEvent();
+        EXPECT_STR_EQ("+enabled", event.category.c_str(), 9u, "category");
+        EXPECT_STR_EQ("name", event.name.c_str(), 5u, "name");
+        ASSERT_EQ(1u, event.arguments.size(), "arguments");
+        int i = event.arguments[0].value().GetInt32();
+        if (next >= 0)
+            ASSERT_EQ(next, i, "events missing or out of order");
+        next = i + 1;
+        count++;
+    }
+    EXPECT_EQ(end, next, "last event missing");
+    *out_count = count;
+
+    END_HELPER;
+}
+
+bool test_invalid_buffering_mode() {
+    BEGIN_TEST;
+
+    async::Loop loop;
+    trace::TraceHandler handler;
+    uint8_t buffer[4096];
+    EXPECT_EQ(MX_ERR_INVALID_ARGS,
+              trace_start_engine_with_mode(loop.async(), &handler,
+                                           static_cast<trace_buffering_mode_t>(3),
+                                           buffer, sizeof(buffer)));
+    EXPECT_EQ(MX_ERR_INVALID_ARGS,
+              trace_start_engine_with_mode(loop.async(), &handler,
+                                           TRACE_BUFFERING_MODE_CIRCULAR,
+                                           buffer, sizeof(buffer)));
+    EXPECT_EQ(TRACE_STOPPED, trace_state());
+
+    END_TEST;
+}
+
+bool test_circular_mode() {
+    BEGIN_TRACE_TEST;
+
+    // Write much more than the buffer holds.
+    constexpr int kNumEvents = 100000;
+    fixture_start_tracing_with_mode(TRACE_BUFFERING_MODE_CIRCULAR);
+    WriteNumberedEvents(0, kNumEvents);
+
+    fbl::Vector<trace::Record> records;
+    ASSERT_TRUE(fixture_read_records(&records), "");
+    EXPECT_EQ(MX_OK, fixture_get_disposition());
+    ASSERT_GE(records.size(), 1u);
+    EXPECT_EQ(trace::RecordType::kInitialization, records[0].type(),
+              "expected initialization record");
+
+    // Only the most recent events remain.
+    size_t count;
+    ASSERT_TRUE(CheckNumberedEvents(records, kNumEvents, &count), "");
+    EXPECT_GT(count, 0u);
+    EXPECT_LT(count, static_cast<size_t>(kNumEvents));
+
+    END_TRACE_TEST;
+}
+
+bool test_streaming_mode() {
+    BEGIN_TRACE_TEST;
+
+    // Write much more than the buffer holds, giving the handler a chance to
+    // save each full buffer as we go.
+    constexpr int kNumEvents = 100000;
+    constexpr int kBatchSize = 1000;
+    fixture_start_tracing_with_mode(TRACE_BUFFERING_MODE_STREAMING);
+    for (int i = 0; i < kNumEvents; i += kBatchSize) {
+        WriteNumberedEvents(i, kBatchSize);
+        fixture_sync_loop();
+    }
+
+    fbl::Vector<trace::Record> records;
+    ASSERT_TRUE(fixture_read_records(&records), "");
+    EXPECT_EQ(MX_OK, fixture_get_disposition());
+    EXPECT_GT(fixture_get_buffers_saved(), 0u);
+    ASSERT_GE(records.size(), 1u);
+    EXPECT_EQ(trace::RecordType::kInitialization, records[0].type(),
+              "expected initialization record");
+
+    // Every event was kept.
+    size_t count;
+    ASSERT_TRUE(CheckNumberedEvents(records, kNumEvents, &count), "");
+    EXPECT_EQ(static_cast<size_t>(kNumEvents), count);
+
+    END_TRACE_TEST;
+}
+
+bool test_streaming_mode_uncommitted_record() {
+    BEGIN_TRACE_TEST;
+
+    // Hold a record uncommitted while the buffer holding it fills up.
+    constexpr int kNumEvents = 30000;
+    constexpr size_t kRecordSize = 16u;
+    fixture_start_tracing_with_mode(TRACE_BUFFERING_MODE_STREAMING);
+    uint64_t* held;
+    {
+        auto context = trace::TraceContext::Acquire();
+        held = static_cast<uint64_t*>(
+            trace_context_begin_record(context.get(), kRecordSize));
+    }
+    ASSERT_NONNULL(held);
+    WriteNumberedEvents(0, kNumEvents);
+    fixture_sync_loop();
+    EXPECT_EQ(0u, fixture_get_buffers_saved(), "buffer saved before commit");
+
+    // Once written and committed the buffer can be saved.
+    {
+        auto context = trace::TraceContext::Acquire();
+        held[0] = static_cast<uint64_t>(trace::RecordType::kInitialization) |
+                  ((kRecordSize / 8u) << 4);
+        held[1] = mx_ticks_per_second();
+        trace_context_commit_record(context.get(), held, kRecordSize);
+    }
+    fixture_sync_loop();
+    EXPECT_GT(fixture_get_buffers_saved(), 0u);
+
+    fbl::Vector<trace::Record> records;
+    ASSERT_TRUE(fixture_read_records(&records), "");
+    EXPECT_EQ(MX_OK, fixture_get_disposition());
+    size_t count;
+    ASSERT_TRUE(CheckNumberedEvents(records, kNumEvents, &count), "");
+    EXPECT_EQ(static_cast<size_t>(kNumEvents), count);
+
+    END_TRACE_TEST;
+}
+
+bool test_circular_mode_uncommitted_record() {
+    BEGIN_TRACE_TEST;
+
+    // Hold a record uncommitted while writing wraps around the buffer.
+    constexpr int kNumEvents = 100000;
+    constexpr size_t kRecordSize = 16u;
+    fixture_start_tracing_with_mode(TRACE_BUFFERING_MODE_CIRCULAR);
+    uint64_t* held;
+    {
+        auto context = trace::TraceContext::Acquire();
+        held = static_cast<uint64_t*>(
+            trace_context_begin_record(context.get(), kRecordSize));
+    }
+    ASSERT_NONNULL(held);
+    const uint64_t header = static_cast<uint64_t>(trace::RecordType::kInitialization) |
+                            ((kRecordSize / 8u) << 4);
+    const uint64_t ticks_per_second = mx_ticks_per_second();
+    held[0] = header;
+    held[1] = ticks_per_second;
+
+    // Records are dropped rather than overwriting the one being written.
+    WriteNumberedEvents(0, kNumEvents);
+    EXPECT_EQ(header, held[0], "uncommitted record overwritten");
+    EXPECT_EQ(ticks_per_second, held[1], "uncommitted record overwritten");
+
+    // Once committed its buffer is overwritten again.
+    {
+        auto context = trace::TraceContext::Acquire();
+        trace_context_commit_record(context.get(), held, kRecordSize);
+    }
+    WriteNumberedEvents(kNumEvents, kNumEvents);
+
+    fbl::Vector<trace::Record> records;
+    ASSERT_TRUE(fixture_read_records(&records), "");
+    EXPECT_EQ(MX_ERR_NO_MEMORY, fixture_get_disposition(), "records were dropped");
+    size_t count;
+    ASSERT_TRUE(CheckNumberedEvents(records, 2 * kNumEvents, &count), "");
+    EXPECT_GT(count, 0u);
+    EXPECT_LT(count, static_cast<size_t>(kNumEvents));
+
+    END_TRACE_TEST;
+}
+
 // NOTE: The functions for writing trace records are exercised by other trace tests.
 
 } // namespace
@@ -401,9 +678,15 @@ RUN_TEST(test_observer)
 RUN_TEST(test_observer_errors)
 RUN_TEST(test_register_current_thread)
 RUN_TEST(test_register_current_thread_multiple_threads)
+RUN_TEST(test_register_thread_multiple_threads)
 RUN_TEST(test_register_string_literal)
 RUN_TEST(test_register_string_literal_multiple_threads)
 RUN_TEST(test_register_string_literal_table_overflow)
 RUN_TEST(test_maximum_record_length)
 RUN_TEST(test_event_with_inline_everything)
+RUN_TEST(test_invalid_buffering_mode)
+RUN_TEST(test_circular_mode)
+RUN_TEST(test_streaming_mode)
+RUN_TEST(test_streaming_mode_uncommitted_record)
+RUN_TEST(test_circular_mode_uncommitted_record)
 END_TEST_CASE(engine_tests)
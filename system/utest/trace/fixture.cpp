@@ -12,6 +12,7 @@
 #include <magenta/assert.h>
 
 #include <async/loop.h>
+#include <async/task.h>
 #include <mx/event.h>
 #include <fbl/algorithm.h>
 #include <fbl/array.h>
@@ -38,7 +39,7 @@ public:
         StopTracing(false);
     }
 
-    void StartTracing() {
+    void StartTracing(trace_buffering_mode_t buffering_mode) {
         if (trace_running_)
             return;
 
@@ -46,8 +47,26 @@ public:
         loop_.StartThread("trace test");
 
         // Asynchronously start the engine.
-        mx_status_t status = trace_start_engine(loop_.async(), this,
-                                                buffer_.get(), buffer_.size());
+        mx_status_t status = trace_start_engine_with_mode(loop_.async(), this, buffering_mode,
+                                                          buffer_.get(), buffer_.size());
+        MX_DEBUG_ASSERT(status == MX_OK);
+    }
+
+    // Waits for the tasks which have already been posted to the loop to run.
+    void SyncLoop() {
+        mx::event done;
+        mx_status_t status = mx::event::create(0u, &done);
+        MX_DEBUG_ASSERT(status == MX_OK);
+
+        async::Task task(0u);
+        task.set_handler([&done](async_t* async, mx_status_t status) {
+            done.signal(0u, MX_EVENT_SIGNALED);
+            return ASYNC_TASK_FINISHED;
+        });
+        status = task.Post(loop_.async());
+        MX_DEBUG_ASSERT(status == MX_OK);
+
+        status = done.wait_one(MX_EVENT_SIGNALED, mx_deadline_after(MX_MSEC(1000)), nullptr);
         MX_DEBUG_ASSERT(status == MX_OK);
     }
 
@@ -80,11 +99,21 @@ public:
         return disposition_;
     }
 
+    size_t buffers_saved() const {
+        return buffers_saved_;
+    }
+
     bool ReadRecords(fbl::Vector<trace::Record>* out_records,
                      fbl::Vector<fbl::String>* out_errors) {
         trace::TraceReader reader(
             [out_records](trace::Record record) { out_records->push_back(fbl::move(record)); },
             [out_errors](fbl::String error) { out_errors->push_back(fbl::move(error)); });
+        // Records saved while streaming come before the rest.
+        trace::Chunk saved_chunk(reinterpret_cast<uint64_t*>(saved_.get()),
+                                 saved_.size() / 8u);
+        if (!reader.ReadRecords(saved_chunk)) {
+            out_errors->push_back(fbl::String("Saved trace data is corrupted"));
+        }
         trace::Chunk chunk(reinterpret_cast<uint64_t*>(buffer_.get()),
                            buffer_bytes_written_ / 8u);
         if (buffer_bytes_written_ & 7u) {
@@ -114,11 +143,31 @@ private:
         trace_stopped_.signal(0u, MX_EVENT_SIGNALED);
     }
 
+    void NotifyBufferFull(async_t* async, uint32_t buffer_number,
+                          size_t durable_offset, size_t durable_num_bytes,
+                          size_t buffer_offset, size_t buffer_num_bytes) override {
+        MX_DEBUG_ASSERT(async == loop_.async());
+        Save(durable_offset, durable_num_bytes);
+        Save(buffer_offset, buffer_num_bytes);
+        buffers_saved_++;
+
+        mx_status_t status = trace_engine_mark_buffer_saved(buffer_number);
+        MX_DEBUG_ASSERT(status == MX_OK);
+    }
+
+    void Save(size_t offset, size_t num_bytes) {
+        saved_.reserve(saved_.size() + num_bytes);
+        for (size_t i = 0; i < num_bytes; i++)
+            saved_.push_back(buffer_[offset + i]);
+    }
+
     async::Loop loop_;
     fbl::Array<uint8_t> buffer_;
     bool trace_running_ = false;
     mx_status_t disposition_ = MX_ERR_INTERNAL;
     size_t buffer_bytes_written_ = 0u;
+    fbl::Vector<uint8_t> saved_;
+    size_t buffers_saved_ = 0u;
     mx::event trace_stopped_;
     bool observed_stopped_callback_ = false;
 };
@@ -139,8 +188,17 @@ void fixture_tear_down(void) {
 }
 
 void fixture_start_tracing() {
+    fixture_start_tracing_with_mode(TRACE_BUFFERING_MODE_ONESHOT);
+}
+
+void fixture_start_tracing_with_mode(trace_buffering_mode_t buffering_mode) {
+    MX_DEBUG_ASSERT(g_fixture);
+    g_fixture->StartTracing(buffering_mode);
+}
+
+void fixture_sync_loop(void) {
     MX_DEBUG_ASSERT(g_fixture);
-    g_fixture->StartTracing();
+    g_fixture->SyncLoop();
 }
 
 void fixture_stop_tracing() {
@@ -158,6 +216,27 @@ mx_status_t fixture_get_disposition(void) {
     return g_fixture->disposition();
 }
 
+size_t fixture_get_buffers_saved(void) {
+    MX_DEBUG_ASSERT(g_fixture);
+    return g_fixture->buffers_saved();
+}
+
+bool fixture_read_records(fbl::Vector<trace::Record>* out_records) {
+    MX_DEBUG_ASSERT(g_fixture);
+    BEGIN_HELPER;
+
+    g_fixture->StopTracing(false);
+
+    fbl::Vector<fbl::String> errors;
+    EXPECT_TRUE(g_fixture->ReadRecords(out_records, &errors), "read error");
+
+    for (const auto& error : errors)
+        printf("error: %s\n", error.c_str());
+    ASSERT_EQ(0u, errors.size(), "errors encountered");
+
+    END_HELPER;
+}
+
 bool fixture_compare_records(const char* expected) {
     MX_DEBUG_ASSERT(g_fixture);
     BEGIN_HELPER;
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <magenta/compiler.h>
+#include <trace-engine/handler.h>
 #include <unittest/unittest.h>
 
 __BEGIN_CDECLS
@@ -17,9 +18,12 @@ __BEGIN_CDECLS
 void fixture_set_up(void);
 void fixture_tear_down(void);
 void fixture_start_tracing(void);
+void fixture_start_tracing_with_mode(trace_buffering_mode_t buffering_mode);
+void fixture_sync_loop(void);
 void fixture_stop_tracing(void);
 void fixture_stop_tracing_hard(void);
 mx_status_t fixture_get_disposition(void);
+size_t fixture_get_buffers_saved(void);
 bool fixture_compare_records(const char* expected);
 
 inline void fixture_scope_cleanup(bool* scope) {
@@ -49,3 +53,11 @@ inline void fixture_scope_cleanup(bool* scope) {
 #endif // NTRACE
 
 __END_CDECLS
+
+#ifdef __cplusplus
+#include <fbl/vector.h>
+#include <trace-reader/records.h>
+
+// Stops tracing and reads back all of the records which were written.
+bool fixture_read_records(fbl::Vector<trace::Record>* out_records);
+#endif // __cplusplus
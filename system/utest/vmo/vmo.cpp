@@ -302,6 +302,23 @@ bool vmo_resize_test() {
     status = mx_vmo_set_size(vmo, UINT64_MAX);
     EXPECT_EQ(MX_ERR_OUT_OF_RANGE, status, "vm_object_set_size too big");
 
+    // resizing needs both MX_RIGHT_WRITE and MX_RIGHT_SET_PROPERTY
+    mx_handle_t vmo2 = MX_HANDLE_INVALID;
+    status = mx_handle_duplicate(vmo, MX_RIGHT_READ | MX_RIGHT_WRITE | MX_RIGHT_MAP, &vmo2);
+    EXPECT_EQ(MX_OK, status, "handle_duplicate");
+    status = mx_vmo_set_size(vmo2, PAGE_SIZE);
+    EXPECT_EQ(MX_ERR_ACCESS_DENIED, status, "vm_object_set_size without SET_PROPERTY");
+    mx_handle_close(vmo2);
+    status = mx_handle_duplicate(vmo, MX_RIGHT_SET_PROPERTY, &vmo2);
+    EXPECT_EQ(MX_OK, status, "handle_duplicate");
+    status = mx_vmo_set_size(vmo2, PAGE_SIZE);
+    EXPECT_EQ(MX_ERR_ACCESS_DENIED, status, "vm_object_set_size without WRITE");
+    mx_handle_close(vmo2);
+    size = 0x99999999;
+    status = mx_vmo_get_size(vmo, &size);
+    EXPECT_EQ(MX_OK, status, "vm_object_get_size");
+    EXPECT_EQ(len, size, "vm_object_get_size");
+
     // map it
     uintptr_t ptr;
     status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, len,
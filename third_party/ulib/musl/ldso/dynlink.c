@@ -1211,27 +1211,41 @@ __NO_SAFESTACK static mx_status_t load_library(const char* name, int rtld_mode,
     return status;
 }
 
+static void prefetch_library_vmos(struct dso* p, struct dso* last);
+static void discard_prefetched_vmos(void);
+
 __NO_SAFESTACK static void load_deps(struct dso* p) {
-    for (; p; p = p->next) {
-        struct dso** deps = NULL;
-        // The two preallocated DSOs don't get space allocated for ->deps.
-        if (runtime && p->deps == NULL && p != &ldso && p != &vdso)
-            deps = p->deps = p->buf;
-        for (size_t i = 0; p->dynv[i].d_tag; i++) {
-            if (p->dynv[i].d_tag != DT_NEEDED)
-                continue;
-            const char* name = p->strings + p->dynv[i].d_un.d_val;
-            struct dso* dep;
-            mx_status_t status = load_library(name, 0, p, &dep);
-            if (status != MX_OK) {
-                error("Error loading shared library %s: %s (needed by %s)",
-                      name, _mx_status_get_string(status), p->name);
-                if (runtime)
-                    longjmp(*rtld_fail, 1);
-            } else if (deps != NULL) {
-                *deps++ = dep;
+    while (p != NULL) {
+        // Everything from here to the current tail is one level of the
+        // dependency graph.  Fetch everything it needs from the loader
+        // service at once, before loading it appends the next level.
+        struct dso* level_end = tail;
+        prefetch_library_vmos(p, level_end);
+        for (bool last = false; p != NULL && !last; p = p->next) {
+            last = p == level_end;
+            struct dso** deps = NULL;
+            // The two preallocated DSOs don't get space allocated for ->deps.
+            if (runtime && p->deps == NULL && p != &ldso && p != &vdso)
+                deps = p->deps = p->buf;
+            for (size_t i = 0; p->dynv[i].d_tag; i++) {
+                if (p->dynv[i].d_tag != DT_NEEDED)
+                    continue;
+                const char* name = p->strings + p->dynv[i].d_un.d_val;
+                struct dso* dep;
+                mx_status_t status = load_library(name, 0, p, &dep);
+                if (status != MX_OK) {
+                    error("Error loading shared library %s: %s (needed by %s)",
+                          name, _mx_status_get_string(status), p->name);
+                    if (runtime) {
+                        discard_prefetched_vmos();
+                        longjmp(*rtld_fail, 1);
+                    }
+                } else if (deps != NULL) {
+                    *deps++ = dep;
+                }
             }
         }
+        discard_prefetched_vmos();
     }
 }
 
@@ -2242,8 +2256,183 @@ __NO_SAFESTACK static void loader_svc_config(const char* config) {
                  config, _mx_status_get_string(status));
 }
 
+// Libraries fetched by prefetch_library_vmos() ahead of being loaded.
+// Loading is always serialized, so there is no danger of collision.
+#define PREFETCH_MAX 256
+static struct {
+    const char* name;
+    mx_handle_t vmo;
+    mx_status_t status;
+} prefetched[PREFETCH_MAX];
+static size_t prefetched_count;
+
+// Set once the loader service turns out not to support
+// LOADER_SVC_OP_LOAD_OBJECTS, or something went wrong with it; from
+// then on libraries are only fetched one at a time.
+static bool loader_svc_no_batch;
+
+// Fetches prefetched[first..first+count) with one LOADER_SVC_OP_LOAD_OBJECTS
+// request.  The caller makes sure the names fit in one message.
+__NO_SAFESTACK static mx_status_t loader_svc_load_objects(size_t first,
+                                                          size_t count) {
+    static struct {
+        mx_loader_svc_msg_t header;
+        uint8_t data[LOADER_SVC_MSG_MAX - sizeof(mx_loader_svc_msg_t)];
+    } msg;
+    mx_handle_t handles[LOADER_SVC_LOAD_OBJECTS_MAX];
+
+    size_t len = 0;
+    for (size_t i = first; i < first + count; ++i) {
+        size_t n = strlen(prefetched[i].name) + 1;
+        memcpy(&msg.data[len], prefetched[i].name, n);
+        len += n;
+    }
+    memset(&msg.header, 0, sizeof msg.header);
+    msg.header.txid = ++loader_svc_txid;
+    msg.header.opcode = LOADER_SVC_OP_LOAD_OBJECTS;
+    msg.header.arg = count;
+
+    mx_channel_call_args_t call = {
+        .wr_bytes = &msg,
+        .wr_num_bytes = sizeof(msg.header) + len,
+        .rd_bytes = &msg,
+        .rd_num_bytes = sizeof(msg),
+        .rd_handles = handles,
+        .rd_num_handles = sizeof(handles) / sizeof(handles[0]),
+    };
+
+    uint32_t reply_size;
+    uint32_t handle_count;
+    mx_status_t read_status = MX_OK;
+    mx_status_t status = _mx_channel_call(loader_svc, 0, MX_TIME_INFINITE,
+                                          &call, &reply_size, &handle_count,
+                                          &read_status);
+    if (status != MX_OK)
+        return status == MX_ERR_CALL_FAILED ? read_status : status;
+
+    const int32_t* statuses = (const int32_t*)msg.data;
+    if (msg.header.opcode != LOADER_SVC_OP_STATUS) {
+        status = MX_ERR_INVALID_ARGS;
+    } else if (msg.header.arg != MX_OK) {
+        status = msg.header.arg;
+    } else if (reply_size != sizeof(msg.header) + count * sizeof(statuses[0])) {
+        status = MX_ERR_INVALID_ARGS;
+    } else {
+        size_t num_ok = 0;
+        for (size_t i = 0; i < count; ++i)
+            num_ok += statuses[i] == MX_OK;
+        if (num_ok != handle_count)
+            status = MX_ERR_INVALID_ARGS;
+    }
+    if (status != MX_OK) {
+        for (uint32_t i = 0; i < handle_count; ++i)
+            _mx_handle_close(handles[i]);
+        return status;
+    }
+
+    size_t next_handle = 0;
+    for (size_t i = 0; i < count; ++i) {
+        prefetched[first + i].status = statuses[i];
+        if (statuses[i] == MX_OK)
+            prefetched[first + i].vmo = handles[next_handle++];
+    }
+    return MX_OK;
+}
+
+// Sends the names in prefetched[first..prefetched_count) to the loader
+// service, forgetting them if that fails so they are fetched one by one.
+__NO_SAFESTACK static void flush_prefetch(size_t first) {
+    if (first == prefetched_count)
+        return;
+    if (loader_svc_load_objects(first, prefetched_count - first) != MX_OK) {
+        prefetched_count = first;
+        loader_svc_no_batch = true;
+    }
+}
+
+// Like find_library, but without taking a reference or moving anything.
+__NO_SAFESTACK static bool library_loaded(const char* name) {
+    for (int i = 0; i < 2; ++i) {
+        for (struct dso* p = i == 0 ? head : detached_head; p; p = p->next) {
+            if (!strcmp(p->name, name) ||
+                (p->soname != NULL && !strcmp(p->soname, name)))
+                return true;
+        }
+    }
+    return false;
+}
+
+__NO_SAFESTACK static bool library_prefetched(const char* name) {
+    for (size_t i = 0; i < prefetched_count; ++i) {
+        if (prefetched[i].name != NULL && !strcmp(prefetched[i].name, name))
+            return true;
+    }
+    return false;
+}
+
+// Asks the loader service for all the libraries that the DSOs from |p|
+// through |last| need and that are not loaded yet, with as few round
+// trips as the protocol allows.  get_library_vmo() then finds them here.
+__NO_SAFESTACK static void prefetch_library_vmos(struct dso* p,
+                                                 struct dso* last) {
+    if (loader_svc == MX_HANDLE_INVALID || loader_svc_no_batch)
+        return;
+
+    size_t batch = prefetched_count;
+    size_t batch_len = 0;
+    for (bool done = false; p != NULL && !done; p = p->next) {
+        done = p == last;
+        for (size_t i = 0; p->dynv[i].d_tag; i++) {
+            if (p->dynv[i].d_tag != DT_NEEDED)
+                continue;
+            const char* name = p->strings + p->dynv[i].d_un.d_val;
+            if (*name == '\0' || library_loaded(name) || library_prefetched(name))
+                continue;
+            size_t len = strlen(name) + 1;
+            if (len > LOADER_SVC_MSG_MAX - sizeof(mx_loader_svc_msg_t))
+                continue;
+            if (prefetched_count - batch == LOADER_SVC_LOAD_OBJECTS_MAX ||
+                batch_len + len > LOADER_SVC_MSG_MAX - sizeof(mx_loader_svc_msg_t)) {
+                flush_prefetch(batch);
+                if (loader_svc_no_batch)
+                    return;
+                batch = prefetched_count;
+                batch_len = 0;
+            }
+            if (prefetched_count == PREFETCH_MAX)
+                goto flush;
+            prefetched[prefetched_count].name = name;
+            prefetched[prefetched_count].vmo = MX_HANDLE_INVALID;
+            prefetched[prefetched_count].status = MX_ERR_NOT_FOUND;
+            ++prefetched_count;
+            batch_len += len;
+        }
+    }
+flush:
+    flush_prefetch(batch);
+}
+
+// Closes the VMOs of any prefetched libraries that were not used after all,
+// e.g. because they turned out to match an already loaded DT_SONAME.
+__NO_SAFESTACK static void discard_prefetched_vmos(void) {
+    for (size_t i = 0; i < prefetched_count; ++i) {
+        if (prefetched[i].vmo != MX_HANDLE_INVALID)
+            _mx_handle_close(prefetched[i].vmo);
+    }
+    prefetched_count = 0;
+}
+
 __NO_SAFESTACK static mx_status_t get_library_vmo(const char* name,
                                                   mx_handle_t* result) {
+    for (size_t i = 0; i < prefetched_count; ++i) {
+        if (prefetched[i].name != NULL && !strcmp(prefetched[i].name, name)) {
+            prefetched[i].name = NULL;
+            *result = prefetched[i].vmo;
+            prefetched[i].vmo = MX_HANDLE_INVALID;
+            return prefetched[i].status;
+        }
+    }
+
     if (loader_svc == MX_HANDLE_INVALID) {
         error("cannot look up \"%s\" with no loader service", name);
         return MX_ERR_UNAVAILABLE;